@@ -0,0 +1,167 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * ART accelerator self-benchmark.
+ */
+
+#include "art_bench.h"
+
+#if ART_BENCH
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "stm32f4xx_hal.h"
+#include "sh2.h"
+#include "sh2_SensorValue.h"
+
+#define ACR_ART (FLASH_ACR_PRFTEN | FLASH_ACR_ICEN | FLASH_ACR_DCEN)
+
+#define DWT_PROF_EVENTS (DWT_CTRL_CPIEVTENA_Msk | DWT_CTRL_EXCEVTENA_Msk | \
+                         DWT_CTRL_SLEEPEVTENA_Msk | DWT_CTRL_LSUEVTENA_Msk | \
+                         DWT_CTRL_FOLDEVTENA_Msk)
+
+// ------------------------------------------------------------------------
+// Private types
+
+typedef struct {
+    uint32_t cycles;
+    uint32_t instrs;
+} Timing_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void makeEvent(void);
+static void timeCalls(Timing_t *t, bool decode);
+static void printIpc(const char *name, uint32_t cycles, uint32_t instrs);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static sh2_SensorEvent_t event;
+static bool ran;
+static Timing_t off;     // accelerator off
+static Timing_t on;      // ... and on
+
+// ------------------------------------------------------------------------
+// Public API
+
+void artBench_run(void)
+{
+    uint32_t acr = FLASH->ACR;
+    Timing_t overhead;
+
+    makeEvent();
+    DWT->CTRL |= DWT_PROF_EVENTS;
+
+    // Timing calibration, then the decode loop
+    timeCalls(&overhead, false);
+
+    FLASH->ACR = acr & ~ACR_ART;
+    timeCalls(&off, true);
+    FLASH->ACR = acr | ACR_ART;
+    timeCalls(&on, true);
+    FLASH->ACR = acr;
+
+    DWT->CTRL &= ~DWT_PROF_EVENTS;
+
+    off.cycles -= overhead.cycles;
+    on.cycles -= overhead.cycles;
+    on.instrs -= overhead.instrs;
+    ran = true;
+}
+
+void artBench_report(void)
+{
+    if (!ran) {
+        return;
+    }
+
+    printf("Decode loop: %u instructions\n", (unsigned)on.instrs);
+    printIpc("ART on", on.cycles, on.instrs);
+    printIpc("ART off", off.cycles, on.instrs);
+    if ((FLASH->ACR & ACR_ART) != ACR_ART) {
+        printf("  ART is not enabled!\n");
+    }
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+// A rotation vector report, as the sh2 library delivers it
+static void makeEvent(void)
+{
+    static const uint8_t report[] = {
+        SH2_ROTATION_VECTOR, 0, 3, 0,   // report id, sequence, status, delay
+        0x12, 0x01,  0x34, 0xfe,        // i, j (Q14)
+        0x56, 0x02,  0x9a, 0x3e,        // k, real
+        0x00, 0x02,                     // accuracy (Q12)
+    };
+
+    memset(&event, 0, sizeof(event));
+    event.timestamp_uS = 1000000;
+    event.reportId = SH2_ROTATION_VECTOR;
+    event.len = sizeof(report);
+    memcpy(event.report, report, sizeof(report));
+}
+
+// Fastest of ART_BENCH_CALLS calls (after one to warm the caches), and
+// the instructions it took: cycles less the stall, exception and sleep
+// cycles, plus the folded instructions that took none.
+static void timeCalls(Timing_t *t, bool decode)
+{
+    sh2_SensorValue_t value;
+
+    t->cycles = UINT32_MAX;
+    for (unsigned n = 0; n <= ART_BENCH_CALLS; n++) {
+        __disable_irq();
+        uint8_t cpi = DWT->CPICNT;
+        uint8_t exc = DWT->EXCCNT;
+        uint8_t sleep = DWT->SLEEPCNT;
+        uint8_t lsu = DWT->LSUCNT;
+        uint8_t fold = DWT->FOLDCNT;
+        uint32_t start = DWT->CYCCNT;
+        if (decode) {
+            sh2_decodeSensorEvent(&value, &event);
+        }
+        uint32_t cycles = DWT->CYCCNT - start;
+        cpi = DWT->CPICNT - cpi;
+        exc = DWT->EXCCNT - exc;
+        sleep = DWT->SLEEPCNT - sleep;
+        lsu = DWT->LSUCNT - lsu;
+        fold = DWT->FOLDCNT - fold;
+        __enable_irq();
+
+        if ((n > 0) && (cycles < t->cycles)) {
+            t->cycles = cycles;
+            t->instrs = cycles - cpi - exc - sleep - lsu + fold;
+        }
+    }
+}
+
+static void printIpc(const char *name, uint32_t cycles, uint32_t instrs)
+{
+    unsigned ipc100 = (cycles != 0) ? (unsigned)(instrs * 100u / cycles) : 0;
+
+    printf("  %-8s %6u cycles, %u.%02u instructions/cycle\n",
+           name, (unsigned)cycles, ipc100 / 100, ipc100 % 100);
+}
+
+#endif
@@ -0,0 +1,52 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Boot-time self-benchmark of the flash ART accelerator.
+ *
+ * Times sh2_decodeSensorEvent() on a canned report with the accelerator
+ * off and on, at the clock profile just configured, with the DWT cycle
+ * counter.  Instructions are counted with the DWT profiling counters,
+ * from the accelerated run, whose 8-bit stall counts don't wrap.
+ */
+
+#ifndef ART_BENCH_H
+#define ART_BENCH_H
+
+#ifndef ART_BENCH
+#define ART_BENCH (1)
+#endif
+
+// Calls timed in each mode, the fastest counts
+#define ART_BENCH_CALLS (16)
+
+#if ART_BENCH
+
+// Run the benchmark.  Call before the scheduler starts, after clock_config().
+void artBench_run(void);
+
+// Print the results.
+void artBench_report(void);
+
+#else
+
+#define artBench_run()
+#define artBench_report()
+
+#endif
+
+#endif
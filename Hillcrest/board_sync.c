@@ -0,0 +1,202 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Shared timebase across boards over one sync line.
+ */
+
+#include "board_sync.h"
+
+#if BOARD_SYNC
+
+#include <stdio.h>
+#include <string.h>
+#include "stm32f4xx_hal.h"
+#include "shell.h"
+#include "timebase.h"
+#include "gps_pps.h"
+#include "sensor_strobe.h"
+
+#if !GPS_PPS
+#error BOARD_SYNC needs GPS_PPS for its input
+#endif
+
+#define US_PER_S (1000000)
+#define CODES (256)
+
+// Same second code this many pulses in a row before stepping to it
+#define CONFIRM (2)
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void scheduleNext(void);
+static void masterPulse(void);
+static uint32_t slaveWidth(uint64_t rise_uS, uint32_t width_us);
+static void syncCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static volatile BoardSyncMode_t mode;
+
+// Master, TIM2 ISR
+static uint32_t pulsesOut;
+
+// Slave, EXTI ISR; read unlocked by the shell
+static volatile int lastCode = -1;
+static volatile uint32_t lastDiff;      // master second - ours, mod 256
+static unsigned confirmed;
+static uint32_t badWidths;
+static uint32_t secondSteps;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void boardSync_init(void)
+{
+    shell_addCommand("sync", "[master | slave | off] time sync across boards", syncCmd);
+    boardSync_setMode(BOARD_SYNC_MODE);
+}
+
+void boardSync_setMode(BoardSyncMode_t newMode)
+{
+    GPIO_InitTypeDef GPIO_InitStruct;
+
+    if (mode == BOARD_SYNC_MASTER) {
+        timebase_cancelPulse();
+    }
+    else if (mode == BOARD_SYNC_SLAVE) {
+        gpsPps_setWidthFn(0);
+    }
+    mode = newMode;
+
+    if (newMode == BOARD_SYNC_MASTER) {
+#if SENSOR_STROBE
+        sensorStrobe_set(0, 1, 0, SENSOR_STROBE_WIDTH_US);
+#endif
+        // Low before the timer gets the pin
+        timebase_cancelPulse();
+        memset(&GPIO_InitStruct, 0, sizeof(GPIO_InitStruct));
+        __GPIOA_CLK_ENABLE();
+        GPIO_InitStruct.Pin = SENSOR_STROBE_PIN;
+        GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+        GPIO_InitStruct.Pull = GPIO_NOPULL;
+        GPIO_InitStruct.Speed = GPIO_SPEED_HIGH;
+        GPIO_InitStruct.Alternate = GPIO_AF1_TIM2;
+        HAL_GPIO_Init(SENSOR_STROBE_PORT, &GPIO_InitStruct);
+        scheduleNext();
+    }
+    else if (newMode == BOARD_SYNC_SLAVE) {
+        lastCode = -1;
+        confirmed = 0;
+        gpsPps_setWidthFn(slaveWidth);
+    }
+}
+
+bool boardSync_isMaster(void)
+{
+    return mode == BOARD_SYNC_MASTER;
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+// Set the pulse for the next whole second, with its code
+static void scheduleNext(void)
+{
+    uint64_t second = timebase_getUs() / US_PER_S + 1;
+
+    timebase_setPulse(second * US_PER_S,
+                      BOARD_SYNC_WIDTH_US + (uint32_t)(second % CODES) * BOARD_SYNC_CODE_US,
+                      masterPulse);
+}
+
+// Rising edge of a sync pulse, in the TIM2 ISR
+static void masterPulse(void)
+{
+    pulsesOut++;
+    if (mode == BOARD_SYNC_MASTER) {
+        scheduleNext();
+    }
+}
+
+// A sync pulse seen by a slave whose loop is on the second, in the EXTI ISR
+static uint32_t slaveWidth(uint64_t rise_uS, uint32_t width_us)
+{
+    uint32_t ours = (uint32_t)(((rise_uS + US_PER_S/2) / US_PER_S) % CODES);
+    uint32_t code;
+    uint32_t diff;
+
+    if (width_us + BOARD_SYNC_CODE_US/2 < BOARD_SYNC_WIDTH_US) {
+        badWidths++;
+        return 0;
+    }
+    code = (width_us - BOARD_SYNC_WIDTH_US + BOARD_SYNC_CODE_US/2) / BOARD_SYNC_CODE_US;
+    if (code >= CODES) {
+        badWidths++;
+        return 0;
+    }
+
+    diff = (code - ours) % CODES;
+    confirmed = ((diff == lastDiff) && (confirmed < CONFIRM)) ? confirmed + 1 : 1;
+    lastCode = (int)code;
+    lastDiff = diff;
+
+    if ((diff == 0) || (confirmed < CONFIRM)) {
+        return 0;
+    }
+
+    // Next pulse, the difference is gone
+    confirmed = 0;
+    secondSteps++;
+    return diff;
+}
+
+static void syncCmd(int argc, char *argv[])
+{
+    static const char *const names[] = {"off", "master", "slave"};
+
+    if (argc > 1) {
+        if (strcmp(argv[1], "master") == 0) {
+            boardSync_setMode(BOARD_SYNC_MASTER);
+        }
+        else if (strcmp(argv[1], "slave") == 0) {
+            boardSync_setMode(BOARD_SYNC_SLAVE);
+        }
+        else if (strcmp(argv[1], "off") == 0) {
+            boardSync_setMode(BOARD_SYNC_OFF);
+        }
+        else {
+            printf("Usage: sync [master | slave | off]\n");
+            return;
+        }
+    }
+
+    printf("Board sync %s\n", names[mode]);
+    if (mode == BOARD_SYNC_MASTER) {
+        printf("  %lu pulses out\n", (unsigned long)pulsesOut);
+    }
+    else if (mode == BOARD_SYNC_SLAVE) {
+        printf("  %s, last second code %d (%s), %lu second steps, %lu bad widths\n",
+               gpsPps_locked() ? "locked" : "not locked", lastCode,
+               (lastDiff == 0) ? "matches" : "stepping",
+               (unsigned long)secondSteps, (unsigned long)badWidths);
+    }
+}
+
+#endif
@@ -0,0 +1,82 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Shared timebase across boards over one sync line.
+ *
+ * The master drives a pulse on the trigger output (TIM2_CH2, PA1, see
+ * sensor_strobe.h) at every whole second of its timebase.  The timer
+ * drives the edge, so the edge has no software delay in it.  The
+ * pulse's width carries the low bits of that second:
+ *
+ *   width = BOARD_SYNC_WIDTH_US + (second % 256) * BOARD_SYNC_CODE_US
+ *
+ * Slaves take the line on their PPS input (gps_pps.h), whose loop locks
+ * their timebase's rate and phase onto the rising edges as it would onto
+ * a GPS receiver's.  The falling edges give the width.  Once the width
+ * gives the same second twice in a row and it isn't the slave's own
+ * second, the slave steps forward by the difference, so its seconds
+ * match the master's modulo 256.  From then on every board stamps its
+ * samples on the master's timebase.  Logs whose start times are within
+ * two minutes of each other line up without further alignment.
+ *
+ * Steps are forward only, like every change to the timebase.  A slave
+ * ahead of the master ends up ahead by a whole multiple of 256 s, which
+ * the modulo removes.  Master mode takes the trigger output from the
+ * strobe.  A master may itself be disciplined by GPS PPS.
+ */
+
+#ifndef BOARD_SYNC_H
+#define BOARD_SYNC_H
+
+#include <stdbool.h>
+
+// Build in board sync (needs GPS_PPS for slave mode)
+#ifndef BOARD_SYNC
+#define BOARD_SYNC (1)
+#endif
+
+typedef enum {
+    BOARD_SYNC_OFF,
+    BOARD_SYNC_MASTER,
+    BOARD_SYNC_SLAVE,
+} BoardSyncMode_t;
+
+// Mode at startup
+#ifndef BOARD_SYNC_MODE
+#define BOARD_SYNC_MODE (BOARD_SYNC_OFF)
+#endif
+
+// Pulse width for second 0, and per second after it [us].  Widths must
+// stay well above the slave's EXTI latency and well below a second.
+#ifndef BOARD_SYNC_WIDTH_US
+#define BOARD_SYNC_WIDTH_US (1000)
+#endif
+#ifndef BOARD_SYNC_CODE_US
+#define BOARD_SYNC_CODE_US (100)
+#endif
+
+// Register the "sync" command and start in BOARD_SYNC_MODE.  Call after
+// sensorStrobe_init() and gpsPps_init().
+void boardSync_init(void);
+
+void boardSync_setMode(BoardSyncMode_t mode);
+
+// In master mode, and so using the trigger output
+bool boardSync_isMaster(void);
+
+#endif
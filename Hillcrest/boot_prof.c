@@ -0,0 +1,123 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Boot profiler.
+ */
+
+#include "boot_prof.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "timebase.h"
+#include "shell.h"
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void bootCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static const char * const phaseName[BOOT_NUM_PHASES] = {
+    "main",
+    "clock",
+    "peripherals",
+    "app start",
+    "hub reset",
+    "product ids",
+    "configured",
+    "subscribed",
+    "first sample",
+};
+
+// Each phase is marked once, from one context.
+static uint64_t phase_uS[BOOT_NUM_PHASES];
+static bool reached[BOOT_NUM_PHASES];
+
+// ------------------------------------------------------------------------
+// Public API
+
+void bootProf_init(void)
+{
+    shell_addCommand("boot", "startup time of each boot phase", bootCmd);
+}
+
+void bootProf_mark(BootPhase_t phase)
+{
+    if ((phase >= BOOT_NUM_PHASES) || reached[phase]) {
+        return;
+    }
+
+    phase_uS[phase] = timebase_getUs();
+    reached[phase] = true;
+}
+
+bool bootProf_phaseUs(BootPhase_t phase, uint32_t *pT_uS)
+{
+    if ((phase >= BOOT_NUM_PHASES) || !reached[phase]) {
+        return false;
+    }
+    *pT_uS = (uint32_t)(phase_uS[phase] - phase_uS[BOOT_MAIN]);
+    return true;
+}
+
+const char *bootProf_phaseName(BootPhase_t phase)
+{
+    return phaseName[phase];
+}
+
+void bootProf_dump(void)
+{
+    bool printed[BOOT_NUM_PHASES] = {false};
+    uint64_t prev_uS = 0;
+
+    printf("Boot profile [ms]:\n");
+    printf("  %-12s %10s %8s\n", "phase", "at", "took");
+
+    // Phases may be reached out of order (see STARTUP_OVERLAP), print by time
+    while (1) {
+        int next = -1;
+
+        for (int n = 0; n < BOOT_NUM_PHASES; n++) {
+            if (reached[n] && !printed[n] &&
+                ((next < 0) || (phase_uS[n] < phase_uS[next]))) {
+                next = n;
+            }
+        }
+        if (next < 0) {
+            break;
+        }
+
+        printf("  %-12s %8u.%01u %6u.%01u\n", phaseName[next],
+               (unsigned)(phase_uS[next] / 1000), (unsigned)(phase_uS[next] / 100 % 10),
+               (unsigned)((phase_uS[next] - prev_uS) / 1000),
+               (unsigned)((phase_uS[next] - prev_uS) / 100 % 10));
+        prev_uS = phase_uS[next];
+        printed[next] = true;
+    }
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static void bootCmd(int argc, char *argv[])
+{
+    bootProf_dump();
+}
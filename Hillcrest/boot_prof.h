@@ -0,0 +1,62 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Boot profiler: time of each startup phase, from main() to the first
+ * sensor report.  Printed once the first report arrives, and by the
+ * "boot" shell command.
+ *
+ * Times are on the timebase, which main() starts first thing, so the
+ * time from reset to main() (startup code, .data/.bss) is not included.
+ */
+
+#ifndef BOOT_PROF_H
+#define BOOT_PROF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum {
+    BOOT_MAIN = 0,       // main() entered, timebase started
+    BOOT_CLOCK,          // system clock configured
+    BOOT_PERIPH,         // peripherals initialized
+    BOOT_APP,            // scheduler running, demo task started
+    BOOT_HUB_RESET,      // hub reported its reset
+    BOOT_PROD_IDS,       // product ids reported
+    BOOT_CONFIGURED,     // hub configuration done
+    BOOT_SUBSCRIBED,     // sensor subscriptions sent
+    BOOT_FIRST_SAMPLE,   // first sensor report received
+    BOOT_NUM_PHASES
+} BootPhase_t;
+
+// Register the "boot" command.
+void bootProf_init(void);
+
+// Record that phase was reached now.  Only the first time counts, so
+// later hub resets don't disturb the boot profile.
+void bootProf_mark(BootPhase_t phase);
+
+// Time phase was reached [us from main()].  False if it wasn't.
+bool bootProf_phaseUs(BootPhase_t phase, uint32_t *pT_uS);
+
+// Phase name, as "boot" prints it.
+const char *bootProf_phaseName(BootPhase_t phase);
+
+// Print the phases reached, in time order.
+void bootProf_dump(void);
+
+#endif
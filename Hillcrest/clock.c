@@ -0,0 +1,200 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * System clock profiles.
+ */
+
+#include "clock.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include "stm32f4xx_hal.h"
+#include "usb_cdc.h"
+
+#define HSE_MHZ (8)
+#define HSI_MHZ (16)
+
+// ART accelerator: prefetch, instruction and data caches
+#define ACR_ART (FLASH_ACR_PRFTEN | FLASH_ACR_ICEN | FLASH_ACR_DCEN)
+
+// ------------------------------------------------------------------------
+// Private types
+
+typedef struct {
+    uint32_t sysclkMhz;
+    uint32_t pllN;          // VCO = 1MHz * pllN
+    uint32_t pllP;
+    uint32_t pllQ;          // VCO / pllQ = 48MHz for USB
+    uint32_t voltageScale;
+    uint32_t flashLatency;
+    uint32_t apb1Div;       // keep PCLK1 <= 50MHz (F411) / 42MHz (F401)
+} ClockProfile_t;
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static const ClockProfile_t profiles[] = {
+#if defined(STM32F411xE) && USB_CDC
+    // 100MHz has no divider to 48MHz, so USB costs 4%
+    [CLOCK_PROFILE_MAX] =
+    { 96, 384, RCC_PLLP_DIV4, 8, PWR_REGULATOR_VOLTAGE_SCALE1, FLASH_LATENCY_3, RCC_HCLK_DIV2 },
+#elif defined(STM32F411xE)
+    [CLOCK_PROFILE_MAX] =
+    { 100, 200, RCC_PLLP_DIV2, 4, PWR_REGULATOR_VOLTAGE_SCALE1, FLASH_LATENCY_3, RCC_HCLK_DIV2 },
+#else
+    [CLOCK_PROFILE_MAX] =
+    { 84, 336, RCC_PLLP_DIV4, 7, PWR_REGULATOR_VOLTAGE_SCALE2, FLASH_LATENCY_2, RCC_HCLK_DIV2 },
+#endif
+    [CLOCK_PROFILE_BALANCED] =
+    { 84, 336, RCC_PLLP_DIV4, 7, PWR_REGULATOR_VOLTAGE_SCALE2, FLASH_LATENCY_2, RCC_HCLK_DIV2 },
+    [CLOCK_PROFILE_LOW] =
+    { 42, 336, RCC_PLLP_DIV8, 7, PWR_REGULATOR_VOLTAGE_SCALE3, FLASH_LATENCY_1, RCC_HCLK_DIV1 },
+};
+
+static bool usingHse = false;
+static char description[32];
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static HAL_StatusTypeDef startPll(const ClockProfile_t *p, bool hse);
+
+// ------------------------------------------------------------------------
+// Public API
+
+void clock_config(void)
+{
+    const ClockProfile_t *p = &profiles[CLOCK_PROFILE];
+    RCC_ClkInitTypeDef RCC_ClkInitStruct;
+
+    __PWR_CLK_ENABLE();
+
+    __HAL_PWR_VOLTAGESCALING_CONFIG(p->voltageScale);
+
+    usingHse = false;
+    if (CLOCK_USE_HSE && (startPll(p, true) == HAL_OK)) {
+        usingHse = true;
+    }
+    else {
+        __HAL_RCC_HSE_CONFIG(RCC_HSE_OFF);
+        startPll(p, false);
+    }
+
+    RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_SYSCLK|RCC_CLOCKTYPE_HCLK|
+                                  RCC_CLOCKTYPE_PCLK1|RCC_CLOCKTYPE_PCLK2;
+    RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_PLLCLK;
+    RCC_ClkInitStruct.AHBCLKDivider = RCC_SYSCLK_DIV1;
+    RCC_ClkInitStruct.APB1CLKDivider = p->apb1Div;
+    RCC_ClkInitStruct.APB2CLKDivider = RCC_HCLK_DIV1;
+    HAL_RCC_ClockConfig(&RCC_ClkInitStruct, p->flashLatency);
+
+    // Instruction and data caches and prefetch help most with wait states.
+    // Set here whatever stm32f4xx_hal_conf.h asked HAL_Init() for; the
+    // caches were filled at the old latency, and only reset when off.
+    __HAL_FLASH_INSTRUCTION_CACHE_DISABLE();
+    __HAL_FLASH_DATA_CACHE_DISABLE();
+    __HAL_FLASH_INSTRUCTION_CACHE_RESET();
+    __HAL_FLASH_DATA_CACHE_RESET();
+    __HAL_FLASH_INSTRUCTION_CACHE_ENABLE();
+    __HAL_FLASH_DATA_CACHE_ENABLE();
+    __HAL_FLASH_PREFETCH_BUFFER_ENABLE();
+
+    // Read back what the flash interface actually took
+    uint32_t acr = FLASH->ACR;
+    bool artOk = ((acr & ACR_ART) == ACR_ART) &&
+                 ((acr & FLASH_ACR_LATENCY) == p->flashLatency);
+
+    snprintf(description, sizeof(description), "%uMHz %s, %u WS, %s",
+             (unsigned)(SystemCoreClock / 1000000), usingHse ? "HSE" : "HSI",
+             (unsigned)(acr & FLASH_ACR_LATENCY), artOk ? "ART" : "ART FAILED");
+}
+
+const char *clock_describe(void)
+{
+    return description;
+}
+
+bool clock_usingHse(void)
+{
+    return usingHse;
+}
+
+unsigned clock_hsiTrim(void)
+{
+    return (RCC->CR & RCC_CR_HSITRIM) >> POSITION_VAL(RCC_CR_HSITRIM);
+}
+
+void clock_setHsiTrim(unsigned trim)
+{
+    if (trim > (RCC_CR_HSITRIM >> POSITION_VAL(RCC_CR_HSITRIM))) {
+        trim = RCC_CR_HSITRIM >> POSITION_VAL(RCC_CR_HSITRIM);
+    }
+    __HAL_RCC_HSI_CALIBRATIONVALUE_ADJUST(trim);
+}
+
+void clock_resume(void)
+{
+    // STOP kept the PLL configuration and bus prescalers: only the
+    // oscillators need restarting, with the regulator back at its scale.
+    if (usingHse) {
+        RCC->CR |= RCC_CR_HSEON;
+        while ((RCC->CR & RCC_CR_HSERDY) == 0) {
+            // HSE bypass: ready as soon as the MCO runs
+        }
+    }
+    RCC->CR |= RCC_CR_PLLON;
+    while ((RCC->CR & RCC_CR_PLLRDY) == 0) {
+        // PLL lock, ~100us
+    }
+    while ((PWR->CSR & PWR_CSR_VOSRDY) == 0) {
+        // voltage scale ready
+    }
+    RCC->CFGR = (RCC->CFGR & ~RCC_CFGR_SW) | RCC_CFGR_SW_PLL;
+    while ((RCC->CFGR & RCC_CFGR_SWS) != RCC_CFGR_SWS_PLL) {
+        // switched
+    }
+}
+
+// ------------------------------------------------------------------------
+// Private functions
+
+// Start the PLL from HSE (bypass) or HSI, with a 1MHz VCO input.
+static HAL_StatusTypeDef startPll(const ClockProfile_t *p, bool hse)
+{
+    RCC_OscInitTypeDef RCC_OscInitStruct;
+
+    if (hse) {
+        RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSE;
+        RCC_OscInitStruct.HSEState = RCC_HSE_BYPASS;
+        RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_HSE;
+        RCC_OscInitStruct.PLL.PLLM = HSE_MHZ;
+    }
+    else {
+        RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSI;
+        RCC_OscInitStruct.HSIState = RCC_HSI_ON;
+        RCC_OscInitStruct.HSICalibrationValue = 16;
+        RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_HSI;
+        RCC_OscInitStruct.PLL.PLLM = HSI_MHZ;
+    }
+    RCC_OscInitStruct.PLL.PLLState = RCC_PLL_ON;
+    RCC_OscInitStruct.PLL.PLLN = p->pllN;
+    RCC_OscInitStruct.PLL.PLLP = p->pllP;
+    RCC_OscInitStruct.PLL.PLLQ = p->pllQ;
+
+    return HAL_RCC_OscConfig(&RCC_OscInitStruct);
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * System clock profiles.
+ *
+ * Each profile sets PLL, regulator voltage scale, flash wait states and
+ * bus prescalers together.  Peripheral drivers derive their baud rates
+ * from HAL_RCC_GetPCLKxFreq() at init, so they follow the profile.
+ * The PLL's Q output is 48MHz in every profile but the F411's 100MHz one,
+ * for USB (usb_cdc.h).
+ */
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdbool.h>
+
+#define CLOCK_PROFILE_MAX      (0)   // 100MHz on F411 (96MHz with USB_CDC), 84MHz on F401
+#define CLOCK_PROFILE_BALANCED (1)   // 84MHz
+#define CLOCK_PROFILE_LOW      (2)   // 42MHz, voltage scale 3
+
+#ifndef CLOCK_PROFILE
+#define CLOCK_PROFILE CLOCK_PROFILE_BALANCED
+#endif
+
+// Set to 1 to run the PLL from the 8MHz ST-LINK MCO (HSE bypass) rather
+// than the internal RC.  Falls back to HSI if HSE doesn't start.
+#ifndef CLOCK_USE_HSE
+#define CLOCK_USE_HSE (1)
+#endif
+
+// Configure oscillators and clock tree for CLOCK_PROFILE, and turn on
+// the flash ART accelerator (prefetch, I and D caches).
+// Updates SystemCoreClock.
+void clock_config(void);
+
+// Description of the running clock as read back, e.g.
+// "84MHz HSE, 2 WS, ART" ("ART FAILED" if the flash interface
+// didn't take the latency or accelerator settings).
+const char *clock_describe(void);
+
+// True if the PLL runs from HSE.  USB needs it: HSI is only good to 1%,
+// full speed USB to 0.25%.
+bool clock_usingHse(void);
+
+// HSI trim, 0 to 31 (RCC_CR HSITRIM); 16 at reset.  Each step moves the
+// HSI by roughly half a percent.  Out of range values are clamped.
+unsigned clock_hsiTrim(void);
+void clock_setHsiTrim(unsigned trim);
+
+// Restore the clock after STOP, which leaves the MCU running on HSI:
+// restart HSE (if used) and the PLL and switch back to it.  With
+// interrupts disabled.
+void clock_resume(void);
+
+#endif
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Named runtime policies.
+ */
+
+#include "config_policy.h"
+
+#include <string.h>
+#include "console.h"
+#include "sh2_hal_impl.h"
+
+// Delta frames carry the most reports per console byte
+#if BIN_DELTA
+#define THROUGHPUT_OUTPUT OUTPUT_DELTA
+#else
+#define THROUGHPUT_OUTPUT OUTPUT_BIN
+#endif
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static const ConfigPolicy_t policies[] = {
+    {
+        .name = "balanced",
+        .description = "build defaults",
+        .i2cHz = SH2_HAL_I2C_HZ,
+        .spiModerate_us = SH2_HAL_SPI_MODERATE_US,
+        .spiWake = SH2_HAL_SPI_WAKE,
+        .batch = POLICY_BATCH_AS_SUBSCRIBED,
+        .setOutput = false,
+        .consoleTx = CONSOLE_TX_POLICY,
+    },
+    {
+        // Every sample read and sent the moment it exists; console
+        // output that can't keep up is dropped rather than waited for
+        .name = "latency",
+        .description = "lowest latency: no batching or moderation, binary output, console drops",
+        .i2cHz = SH2_HAL_I2C_MAX_HZ,
+        .spiModerate_us = 0,
+        .spiWake = SH2_HAL_SPI_WAKE_EACH,
+        .batch = POLICY_BATCH_NONE,
+        .setOutput = true,
+        .output = OUTPUT_BIN,
+        .consoleTx = CONSOLE_TX_DROP_NEWEST,
+    },
+    {
+        // Few, large transfers and few wakeups; nothing logged is lost
+        .name = "throughput",
+        .description = "lowest CPU: 100ms batches, 2ms INTN moderation, delta output, lossless console",
+        .i2cHz = SH2_HAL_I2C_MAX_HZ,
+        .spiModerate_us = 2000,
+        .spiWake = SH2_HAL_SPI_WAKE_HOLD,
+        .batch = POLICY_BATCH_AT_LEAST,
+        .minBatch_us = 100000,
+        .setOutput = true,
+        .output = THROUGHPUT_OUTPUT,
+        .consoleTx = CONSOLE_TX_BLOCK,
+    },
+};
+#define NUM_POLICIES (sizeof(policies) / sizeof(policies[0]))
+
+// ------------------------------------------------------------------------
+// Public API
+
+unsigned configPolicy_count(void)
+{
+    return NUM_POLICIES;
+}
+
+const ConfigPolicy_t *configPolicy_get(unsigned n)
+{
+    return (n < NUM_POLICIES) ? &policies[n] : 0;
+}
+
+const ConfigPolicy_t *configPolicy_find(const char *name)
+{
+    for (unsigned n = 0; n < NUM_POLICIES; n++) {
+        if (strcmp(policies[n].name, name) == 0) {
+            return &policies[n];
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Named runtime policies: latency against throughput.
+ *
+ * Where a profile (config_profile.h) says what the hub reports, a policy
+ * says how the host moves it: bus speed, INTN moderation and WAKE use on
+ * the SPI HAL, the hub's batching, the output format, and whether console
+ * logging may stall the sensor path or drop instead.  The "policy"
+ * command switches all of it at run time, so an image tuned for an HMD
+ * serves a logger too.  A profile switched to afterwards sets the output
+ * format back to its own.
+ */
+
+#ifndef CONFIG_POLICY_H
+#define CONFIG_POLICY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sensor_output.h"
+
+// Policy applied at startup, by name
+#ifndef CONFIG_POLICY
+#define CONFIG_POLICY "balanced"
+#endif
+
+// What a policy does to the subscriptions' batch intervals
+typedef enum {
+    POLICY_BATCH_AS_SUBSCRIBED,
+    POLICY_BATCH_NONE,            // report every sample as produced
+    POLICY_BATCH_AT_LEAST,        // at least minBatch_us
+} PolicyBatch_t;
+
+typedef struct {
+    const char *name;
+    const char *description;
+    uint32_t i2cHz;               // hub's I2C bus speed
+    uint32_t spiModerate_us;      // SPI INTN moderation window, 0 for none
+    unsigned spiWake;             // SH2_HAL_SPI_WAKE_ mode
+    PolicyBatch_t batch;
+    uint32_t minBatch_us;         // for POLICY_BATCH_AT_LEAST
+    bool setOutput;               // false: leave the output format alone
+    OutputMode_t output;
+    unsigned consoleTx;           // CONSOLE_TX_ overflow policy
+} ConfigPolicy_t;
+
+// Number of policies, and policy n of them
+unsigned configPolicy_count(void);
+const ConfigPolicy_t *configPolicy_get(unsigned n);
+
+// Policy called name, or NULL
+const ConfigPolicy_t *configPolicy_find(const char *name);
+
+// Batch interval to ask the hub for, given a subscription's
+static inline uint32_t configPolicy_batch(const ConfigPolicy_t *p, uint32_t batch_us)
+{
+    if (p->batch == POLICY_BATCH_NONE) {
+        return 0;
+    }
+    if ((p->batch == POLICY_BATCH_AT_LEAST) && (batch_us < p->minBatch_us)) {
+        return p->minBatch_us;
+    }
+    return batch_us;
+}
+
+#endif
@@ -0,0 +1,144 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Named configuration profiles.
+ */
+
+#include "config_profile.h"
+
+#include <string.h>
+#include "sh2.h"
+#include "sensor_fix.h"
+
+#define DEG_TO_RAD (3.14159265358 / 180.0)
+
+// GIRV reference data types
+#define GIRV_REF_6AG  (0x0207)  // 6 axis Game Rotation Vector
+#define GIRV_REF_9AGM (0x0204)  // 9 axis Absolute Rotation Vector
+
+// Prediction filter parameters (factory defaults).  See section 4.3.24
+// of the SH-2 Reference Manual for a full explanation.
+#define GIRV_MAX_ERR FIX_Q(29, (30.0 * DEG_TO_RAD)) // max error: 30 degrees
+#define GIRV_ALPHA FIX_Q(20, 0.303072543909142)
+#define GIRV_BETA  FIX_Q(20, 0.113295896384921)
+#define GIRV_GAMMA FIX_Q(20, 0.002776219713054)
+
+// Default batch interval for subscriptions.  0 reports every sample as it
+// is produced, otherwise the hub holds samples in its FIFO for up to this
+// long and INTN fires once per batch.
+#define DFLT_BATCH_INTERVAL_US (0)
+
+#define CAL_AGM (SH2_CAL_ACCEL | SH2_CAL_GYRO | SH2_CAL_MAG)
+
+// Shield turned 90 degrees about Z on the board (x, y, z, w in Q30)
+#define ORIENT_Z90 { 0, 0, FIX_Q(30, 0.707106781), FIX_Q(30, 0.707106781) }
+
+// How the shield is mounted, for every profile: CONFIG_ORIENT_IDENTITY,
+// ORIENT_Z90 or the like.  All 0 leaves the hub's record as it is.
+#ifndef CONFIG_MOUNT_ORIENT
+#define CONFIG_MOUNT_ORIENT { 0, 0, 0, 0 }
+#endif
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static const ConfigProfile_t profiles[] = {
+    {
+        .name = "default",
+        .description = "demo: linear accel, geomagnetic RV and gyro at 100Hz, no prediction",
+        .girv = { GIRV_REF_6AG, 0, GIRV_MAX_ERR, FIX_Q(10, 0.0),
+                  GIRV_ALPHA, GIRV_BETA, GIRV_GAMMA },
+        .orientation = CONFIG_MOUNT_ORIENT,
+        .calSensors = CAL_AGM,
+        .output = OUTPUT_TEXT,
+        .power = POWER_MODE_DEFAULT,
+        .sub = {
+            { SH2_LINEAR_ACCELERATION,         10000, DFLT_BATCH_INTERVAL_US },
+            { SH2_GEOMAGNETIC_ROTATION_VECTOR, 10000, DFLT_BATCH_INTERVAL_US },
+            { SH2_GYROSCOPE_CALIBRATED,        10000, DFLT_BATCH_INTERVAL_US },
+        },
+    },
+    {
+        // 100Hz sync, 28ms prediction
+        .name = "hmd",
+        .description = "head mounted display: predicted GIRV at 400Hz, binary output",
+        .girv = { GIRV_REF_6AG, 10000, GIRV_MAX_ERR, FIX_Q(10, 0.028),
+                  GIRV_ALPHA, GIRV_BETA, GIRV_GAMMA },
+        .orientation = CONFIG_MOUNT_ORIENT,
+        .calSensors = CAL_AGM,
+        .output = OUTPUT_BIN,
+        .power = POWER_MODE_OFF,
+        .sub = {
+            { SH2_GYRO_INTEGRATED_RV, 2500, 0 },
+        },
+    },
+    {
+        // Motors upset the magnetometer: no mag calibration or heading
+        .name = "robotics",
+        .description = "game RV, gyro and linear accel at 200Hz, no magnetometer, DSF output",
+        .girv = { GIRV_REF_6AG, 0, GIRV_MAX_ERR, FIX_Q(10, 0.0),
+                  GIRV_ALPHA, GIRV_BETA, GIRV_GAMMA },
+        .orientation = CONFIG_MOUNT_ORIENT,
+        .calSensors = SH2_CAL_ACCEL | SH2_CAL_GYRO,
+        .output = OUTPUT_DSF,
+        .power = POWER_MODE_OFF,
+        .sub = {
+            { SH2_GAME_ROTATION_VECTOR, 5000, 0 },
+            { SH2_GYROSCOPE_CALIBRATED, 5000, 0 },
+            { SH2_LINEAR_ACCELERATION,  5000, 0 },
+        },
+    },
+    {
+        // Batched, so INTN fires once a second and the MCU STOPs between
+        .name = "lowpower",
+        .description = "geomagnetic RV at 10Hz, batched 1s, MCU in STOP between batches",
+        .girv = { GIRV_REF_6AG, 0, GIRV_MAX_ERR, FIX_Q(10, 0.0),
+                  GIRV_ALPHA, GIRV_BETA, GIRV_GAMMA },
+        .orientation = CONFIG_MOUNT_ORIENT,
+        .calSensors = CAL_AGM,
+        .output = OUTPUT_TEXT,
+        .power = POWER_MODE_AUTO,
+        .sub = {
+            { SH2_GEOMAGNETIC_ROTATION_VECTOR, 100000, 1000000 },
+        },
+    },
+};
+#define NUM_PROFILES (sizeof(profiles) / sizeof(profiles[0]))
+
+// ------------------------------------------------------------------------
+// Public API
+
+unsigned configProfile_count(void)
+{
+    return NUM_PROFILES;
+}
+
+const ConfigProfile_t *configProfile_get(unsigned n)
+{
+    return (n < NUM_PROFILES) ? &profiles[n] : 0;
+}
+
+const ConfigProfile_t *configProfile_find(const char *name)
+{
+    for (unsigned n = 0; n < NUM_PROFILES; n++) {
+        if (strcmp(profiles[n].name, name) == 0) {
+            return &profiles[n];
+        }
+    }
+    return 0;
+}
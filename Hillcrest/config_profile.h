@@ -0,0 +1,89 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Named configuration profiles.
+ *
+ * A profile is the hub set-up of one product line, as data: the GIRV
+ * prediction FRS record, the mounting orientation, the dynamic
+ * calibration sensors, the sensor
+ * subscriptions, and the console output format and power mode.  The
+ * sensor app starts with CONFIG_PROFILE's hub set-up and subscriptions
+ * (output and power keep their build defaults) and reapplies the hub
+ * set-up after every reset.  The "profile" command switches all of it
+ * at run time, so one image serves every product.  Add a product by
+ * adding an entry to the table in config_profile.c.
+ */
+
+#ifndef CONFIG_PROFILE_H
+#define CONFIG_PROFILE_H
+
+#include <stdint.h>
+#include "sensor_output.h"
+#include "power.h"
+
+// Profile applied at startup, by name ("hmd" for what CONFIGURE_HMD
+// in sensor_app.c used to build)
+#ifndef CONFIG_PROFILE
+#define CONFIG_PROFILE "default"
+#endif
+
+// Words of the GIRV prediction FRS record (FRS_ID_META_GYRO_INTEGRATED_RV):
+// reference data type, sync interval (0 disables prediction), maximum
+// error, prediction amount, alpha, beta, gamma
+#define CONFIG_GIRV_WORDS (7)
+
+// System orientation FRS record: the rotation from the hub's frame to the
+// product's, as a unit quaternion x, y, z, w in Q30.  The hub applies it
+// to every orientation and vector output, so reports arrive in the
+// product frame.  It is read when the hub initializes.
+#ifndef SYSTEM_ORIENTATION
+#define SYSTEM_ORIENTATION (0x2D3E)
+#endif
+#define CONFIG_ORIENT_WORDS (4)
+
+// Hub mounted as the product: no rotation
+#define CONFIG_ORIENT_IDENTITY { 0, 0, 0, 0x40000000 }
+
+// Subscriptions in a profile, at most
+#define CONFIG_PROFILE_SUBS (4)
+
+typedef struct {
+    int sensorId;                 // 0 ends the list
+    uint32_t reportInterval_us;
+    uint32_t batchInterval_us;
+} ConfigSub_t;
+
+typedef struct {
+    const char *name;
+    const char *description;
+    uint32_t girv[CONFIG_GIRV_WORDS];
+    uint32_t orientation[CONFIG_ORIENT_WORDS];  // all 0: leave the hub's
+    uint8_t calSensors;           // SH2_CAL_ bits
+    OutputMode_t output;
+    PowerMode_t power;
+    ConfigSub_t sub[CONFIG_PROFILE_SUBS];
+} ConfigProfile_t;
+
+// Number of profiles, and profile n of them
+unsigned configProfile_count(void);
+const ConfigProfile_t *configProfile_get(unsigned n);
+
+// Profile called name, or NULL
+const ConfigProfile_t *configProfile_find(const char *name);
+
+#endif
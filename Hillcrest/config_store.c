@@ -0,0 +1,313 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Configuration store in the MCU's own flash.
+ */
+
+#include "config_store.h"
+
+#include <string.h>
+#include "stm32f4xx_hal.h"
+#include "crc16.h"
+#include "sh2_err.h"
+
+#define SECTOR_MAGIC (0x53474643u)   // "CFGS"
+#define HDR_WORDS (2)                // magic, generation
+
+#define ERASED (0xFFFFFFFFu)
+
+// Words taken by a record of len bytes: key and length, value, commit
+#define RECORD_WORDS(len) (1 + ((len) + 3)/4 + 1)
+
+// ------------------------------------------------------------------------
+// Private types
+
+typedef struct {
+    uint32_t base;
+    uint32_t sector;
+} Sector_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void scan(unsigned s);
+static bool recordValid(const uint32_t *p, unsigned words);
+static uint16_t recordCrc(const uint32_t *p);
+static int append(ConfigKey_t key, const void *value, unsigned len);
+static int compact(ConfigKey_t key, const void *value, unsigned len);
+static int program(uint32_t addr, const uint32_t *words, unsigned n);
+static int programRecord(uint32_t addr, ConfigKey_t key, const void *value, unsigned len);
+static int eraseSector(unsigned s);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static const Sector_t sectors[2] = {
+    { CONFIG_STORE_BASE_A, CONFIG_STORE_SECTOR_A },
+    { CONFIG_STORE_BASE_B, CONFIG_STORE_SECTOR_B },
+};
+
+static int active = -1;             // sector in use, -1 if neither is
+static uint32_t generation;
+static uint32_t freeAddr;           // where the next record goes
+static uint32_t recordAddr[CONFIG_NUM_KEYS];   // latest of each key, 0 if none
+static uint32_t records;
+static uint32_t compactions;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void configStore_init(void)
+{
+    active = -1;
+    for (unsigned s = 0; s < 2; s++) {
+        const uint32_t *hdr = (const uint32_t *)sectors[s].base;
+
+        if ((hdr[0] == SECTOR_MAGIC) && ((active < 0) || (hdr[1] > generation))) {
+            active = s;
+            generation = hdr[1];
+        }
+    }
+
+    memset(recordAddr, 0, sizeof(recordAddr));
+    records = 0;
+    if (active >= 0) {
+        scan(active);
+    }
+}
+
+int configStore_get(ConfigKey_t key, void *buf, unsigned max)
+{
+    if ((key <= 0) || (key >= CONFIG_NUM_KEYS) || (recordAddr[key] == 0)) {
+        return -1;
+    }
+
+    const uint32_t *p = (const uint32_t *)recordAddr[key];
+    unsigned len = p[0] >> 16;
+    if (len == 0) {
+        // Removed
+        return -1;
+    }
+    memcpy(buf, &p[1], (len < max) ? len : max);
+
+    return len;
+}
+
+int configStore_put(ConfigKey_t key, const void *value, unsigned len)
+{
+    if ((key <= 0) || (key >= CONFIG_NUM_KEYS) || (len > CONFIG_STORE_MAX_LEN)) {
+        return SH2_ERR_BAD_PARAM;
+    }
+
+    if (recordAddr[key] != 0) {
+        const uint32_t *p = (const uint32_t *)recordAddr[key];
+        if (((p[0] >> 16) == len) && (memcmp(&p[1], value, len) == 0)) {
+            // Same as stored: spare the flash
+            return SH2_OK;
+        }
+    }
+    else if (len == 0) {
+        return SH2_OK;
+    }
+
+    uint32_t end = (active >= 0) ? sectors[active].base + CONFIG_STORE_SECTOR_LEN : 0;
+    if ((active < 0) || (freeAddr + 4*RECORD_WORDS(len) > end)) {
+        return compact(key, value, len);
+    }
+
+    return append(key, value, len);
+}
+
+int configStore_remove(ConfigKey_t key)
+{
+    return configStore_put(key, 0, 0);
+}
+
+int configStore_erase(void)
+{
+    int status = eraseSector(0);
+    if (status == SH2_OK) {
+        status = eraseSector(1);
+    }
+
+    configStore_init();
+    return status;
+}
+
+void configStore_usage(uint32_t *pUsed, uint32_t *pRecords, uint32_t *pCompactions)
+{
+    *pUsed = (active >= 0) ? freeAddr - sectors[active].base : 0;
+    *pRecords = records;
+    *pCompactions = compactions;
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+// Index the records of sector s and find its end
+static void scan(unsigned s)
+{
+    const uint32_t *p = (const uint32_t *)sectors[s].base + HDR_WORDS;
+    const uint32_t *end = (const uint32_t *)(sectors[s].base + CONFIG_STORE_SECTOR_LEN);
+
+    while ((p < end) && (*p != ERASED)) {
+        unsigned key = p[0] & 0xFFFF;
+        unsigned len = p[0] >> 16;
+        unsigned words = RECORD_WORDS(len);
+
+        if ((len > CONFIG_STORE_MAX_LEN) || (p + words > end)) {
+            // Not a record header: treat the rest as used
+            p = end;
+            break;
+        }
+        if (recordValid(p, words) && (key > 0) && (key < CONFIG_NUM_KEYS)) {
+            recordAddr[key] = (uint32_t)p;
+            records++;
+        }
+        p += words;
+    }
+
+    freeAddr = (uint32_t)p;
+}
+
+static bool recordValid(const uint32_t *p, unsigned words)
+{
+    uint32_t commit = p[words - 1];
+
+    return ((commit >> 16) == 0) && ((commit & 0xFFFF) == recordCrc(p));
+}
+
+static uint16_t recordCrc(const uint32_t *p)
+{
+    return crc16(CRC16_INIT, (const uint8_t *)p, 4 + (p[0] >> 16));
+}
+
+static int append(ConfigKey_t key, const void *value, unsigned len)
+{
+    int status = programRecord(freeAddr, key, value, len);
+
+    // Skipped over by the next scan if it didn't commit
+    uint32_t addr = freeAddr;
+    freeAddr += 4*RECORD_WORDS(len);
+    if (status == SH2_OK) {
+        recordAddr[key] = addr;
+        records++;
+    }
+
+    return status;
+}
+
+// Move the latest record of each key to the other sector, with key's
+// new value in place of its old one, and switch to it
+static int compact(ConfigKey_t key, const void *value, unsigned len)
+{
+    unsigned to = (active == 0) ? 1 : 0;
+    uint32_t addr = sectors[to].base + 4*HDR_WORDS;
+    int status;
+
+    status = eraseSector(to);
+    if (status != SH2_OK) {
+        return status;
+    }
+
+    for (int k = 1; (k < CONFIG_NUM_KEYS) && (status == SH2_OK); k++) {
+        const uint32_t *p = (const uint32_t *)recordAddr[k];
+        unsigned n;
+
+        if (k == key) {
+            if (len == 0) {
+                continue;
+            }
+            status = programRecord(addr, key, value, len);
+            n = len;
+        }
+        else if ((p != 0) && ((p[0] >> 16) != 0)) {
+            n = p[0] >> 16;
+            status = programRecord(addr, (ConfigKey_t)k, &p[1], n);
+        }
+        else {
+            continue;
+        }
+        addr += 4*RECORD_WORDS(n);
+    }
+
+    // Valid only once complete: until then the old sector stays active
+    uint32_t hdr[HDR_WORDS] = { SECTOR_MAGIC, (active >= 0) ? generation + 1 : 1 };
+    if (status == SH2_OK) {
+        status = program(sectors[to].base, hdr, HDR_WORDS);
+    }
+    if (status == SH2_OK) {
+        compactions++;
+    }
+
+    configStore_init();
+    return status;
+}
+
+static int program(uint32_t addr, const uint32_t *words, unsigned n)
+{
+    HAL_StatusTypeDef status = HAL_OK;
+
+    HAL_FLASH_Unlock();
+    for (unsigned i = 0; (i < n) && (status == HAL_OK); i++) {
+        status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, addr + 4*i, words[i]);
+    }
+    HAL_FLASH_Lock();
+
+    return (status == HAL_OK) ? SH2_OK : SH2_ERR_IO;
+}
+
+// Program a record at addr: header and value first, the commit word last
+static int programRecord(uint32_t addr, ConfigKey_t key, const void *value, unsigned len)
+{
+    uint32_t rec[RECORD_WORDS(CONFIG_STORE_MAX_LEN)];
+    unsigned words = RECORD_WORDS(len);
+    int status;
+
+    memset(rec, 0xFF, sizeof(rec));
+    rec[0] = (uint32_t)key | ((uint32_t)len << 16);
+    if (len != 0) {
+        memcpy(&rec[1], value, len);
+    }
+
+    status = program(addr, rec, words - 1);
+    if (status == SH2_OK) {
+        uint32_t commit = recordCrc(rec);
+        status = program(addr + 4*(words - 1), &commit, 1);
+    }
+
+    return status;
+}
+
+static int eraseSector(unsigned s)
+{
+    FLASH_EraseInitTypeDef erase;
+    uint32_t sectorError;
+    HAL_StatusTypeDef status;
+
+    erase.TypeErase = FLASH_TYPEERASE_SECTORS;
+    erase.Sector = sectors[s].sector;
+    erase.NbSectors = 1;
+    erase.VoltageRange = FLASH_VOLTAGE_RANGE_3;
+
+    HAL_FLASH_Unlock();
+    status = HAL_FLASHEx_Erase(&erase, &sectorError);
+    HAL_FLASH_Lock();
+
+    return (status == HAL_OK) ? SH2_OK : SH2_ERR_IO;
+}
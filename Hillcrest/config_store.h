@@ -0,0 +1,93 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Configuration store in the MCU's own flash.
+ *
+ * A small log-structured key/value store in two reserved 16KB sectors
+ * (2 and 3, taken out of ROM_region in stm32f401xe_flash.icf).  Each
+ * update appends a record to the active sector; nothing is erased until
+ * the sector fills, when the latest record of each key is copied to the
+ * other sector and that one becomes active.  So each sector is erased
+ * once per 16KB of updates, and a record is only taken once fully
+ * programmed: power lost mid-write leaves the previous value.
+ *
+ * Sector: magic, generation (the higher valid one is active), records.
+ * Record: key (16 bits) and length (16 bits), value padded to a word,
+ * then a commit word: CRC-16 of key, length and value in the low half,
+ * upper half 0.  The log ends at the first erased word.
+ *
+ * configStore_init() scans the active sector once and indexes the
+ * latest record of each key, so every lookup after is O(1).
+ * Programming and erasing stall code fetches from flash (the F401 has
+ * one bank): a word takes ~16us, an erase a few hundred ms, which only
+ * happens on compaction.  Call from one task at a time (the shell).
+ */
+
+#ifndef CONFIG_STORE_H
+#define CONFIG_STORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Build in the store
+#ifndef CONFIG_STORE
+#define CONFIG_STORE (1)
+#endif
+
+// Reserved sectors, which must match stm32f401xe_flash.icf
+#define CONFIG_STORE_SECTOR_A (FLASH_SECTOR_2)
+#define CONFIG_STORE_BASE_A (0x08008000u)
+#define CONFIG_STORE_SECTOR_B (FLASH_SECTOR_3)
+#define CONFIG_STORE_BASE_B (0x0800C000u)
+#define CONFIG_STORE_SECTOR_LEN (0x4000u)
+
+// Longest value stored
+#define CONFIG_STORE_MAX_LEN (256)
+
+// Keys.  Append only: stored records keep their key across firmware.
+typedef enum {
+    CONFIG_KEY_PROFILE = 1,     // startup profile name
+    CONFIG_KEY_POLICY,          // startup policy name
+    CONFIG_KEY_SUBS,            // subscription table (WarmSub_t entries)
+    CONFIG_KEY_CAL,             // dynamic calibration sensors
+    CONFIG_KEY_TUNE,            // sensitivity tuner target
+    CONFIG_NUM_KEYS,
+} ConfigKey_t;
+
+// Find the active sector and index its records.  Call once at startup.
+void configStore_init(void);
+
+// Copy key's value to buf (up to max bytes).  Returns its length, or
+// -1 if the key isn't stored.
+int configStore_get(ConfigKey_t key, void *buf, unsigned max);
+
+// Store a value for key (an unchanged value isn't written again).
+// Returns SH2_OK, SH2_ERR_BAD_PARAM, or SH2_ERR_IO if flash failed.
+int configStore_put(ConfigKey_t key, const void *value, unsigned len);
+
+// Remove key (stored as an empty value).
+int configStore_remove(ConfigKey_t key);
+
+// Erase both sectors: nothing stored.
+int configStore_erase(void);
+
+// Usage: bytes of the active sector used, records in it, compactions
+// since boot
+void configStore_usage(uint32_t *pUsed, uint32_t *pRecords, uint32_t *pCompactions);
+
+#endif
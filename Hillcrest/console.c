@@ -23,11 +23,19 @@
 #include "console.h"
 
 #include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
 #include <stm32f4xx_hal.h>
 #include <FreeRTOS.h>
+#include <task.h>
 #include <semphr.h>
-
-#define CONSOLE_BUFLEN (128)
+#include "sysstats.h"
+#include "shell.h"
+#include "itm.h"
+#include "placement.h"
+#include "usb_cdc.h"
+#include "power.h"
+#include "priorities.h"
 
 // ------------------------------------------------------------------------
 // Private state variables
@@ -35,34 +43,93 @@
 // The UART used by the console
 UART_HandleTypeDef *console_huart = 0;
 
-// Transmit state
+// Transmit channels, most urgent first.  printf and the shell write to
+// CTRL; console_write() and console_writeRaw() stream to BULK.
+typedef enum {
+	TX_CTRL,
+	TX_BULK,
+	TX_NUM_CHANS
+} TxChanId_t;
+
+// Double buffered output of one channel.  Each channel has its own
+// buffers, mutex and semaphore, so a writer blocked on a full BULK never
+// holds up a CTRL writer.
+typedef struct {
+	uint8_t *buf[2];
+	unsigned size;                  // of each buffer: the channel's budget
+	volatile unsigned len[2];
+	unsigned phase;                 // buffer owned by writers, the other may be sending
+	volatile bool blocked;
+	SemaphoreHandle_t blockSem;
+	SemaphoreHandle_t mutex;
+	volatile bool raw;              // no LF to CR-LF expansion
+	uint32_t drops;                 // bytes dropped by the tx policy
+	uint32_t dropsMarked;           // of those, reported by a marker
+} TxChan_t;
+
+// Transmit state.  One buffer of one channel is sent at a time.
 volatile bool txActive;
-volatile bool txBlocked;
-SemaphoreHandle_t txBlockSem;
-SemaphoreHandle_t txMutex;
-
-// Which buffer owned by process, other owned by interrupt.
-unsigned txPhase = 0;
+TxChan_t txChan[TX_NUM_CHANS];
+volatile unsigned txPolicy;
+volatile uint32_t txSent;           // bytes handed to the UART
 
-// Double buffers for transmit
-uint8_t txBuffer[2][CONSOLE_BUFLEN];
-volatile unsigned txBufLen[2];
+DMA_BUF uint8_t txCtrlBuffer[2][CONSOLE_CTRL_BUFLEN];
+DMA_BUF uint8_t txBulkBuffer[2][CONSOLE_TX_BUFLEN];
 
+// Receive ring.  rxIn and rxOut run freely and are masked on access.
+// With CONSOLE_RX_DMA the ring is the circular DMA buffer and rxIn
+// catches up with the DMA on half/full transfer and line-idle.
 SemaphoreHandle_t rxBlockSem;
 SemaphoreHandle_t rxMutex;
-bool rxBlocked;
+volatile bool rxBlocked;
 bool rxActive;
+bool rxLastCr;
+DMA_BUF uint8_t rxBuffer[CONSOLE_RX_BUFLEN];
+volatile uint32_t rxIn;
+uint32_t rxOut;
+uint32_t rxDrops;
+uint8_t rxFrameSync;
+// Bytes read in the same chunk as a frame's sync, handed out first
+uint8_t rxPend[32];
+uint8_t rxPendLen;
+uint8_t rxPendPos;
+#if MICROBENCH
+static volatile bool txDiscard;
+static uint32_t txDiscarded;
+#endif
+#if CONSOLE_TX_IN_PLACE
+// The open console_reserve(): its length, and the mask to restore
+static unsigned reserveLen;
+static uint32_t reserveWas;
+static uint32_t inPlaceLines;       // committed without a copy
+#endif
+#if CONSOLE_RX_DMA
+unsigned rxDmaPos;
+#else
 uint8_t rxChar;
-uint8_t rxBuffer[CONSOLE_BUFLEN];
-unsigned rxNextIn;
-unsigned rxNextOut;
-unsigned rxDrops;
+#endif
 
 // ------------------------------------------------------------------------
 // Forward declarations
 
-void startTx(void);
-void startTxIsr(void);
+static uint32_t consoleLock(void);
+static void consoleUnlock(uint32_t was);
+static void txChanInit(TxChan_t *pChan, uint8_t *buf0, uint8_t *buf1, unsigned size);
+static void startTx(unsigned chan);
+static void startTxIsr(unsigned chan);
+static size_t txWrite(unsigned chan, const unsigned char *buf, size_t len, bool expandLf);
+static unsigned txMarkDrops(TxChan_t *pChan, uint8_t *pBuf, unsigned bufLen);
+#if CONSOLE_TX_IN_PLACE
+static unsigned expandLfInPlace(uint8_t *p, unsigned len);
+#endif
+static void consoleCmd(int argc, char *argv[]);
+static void rxStart(void);
+static size_t rxRead(uint8_t *buf, size_t len, bool toEol, TickType_t wait);
+static bool rxSkipLf(uint8_t c);
+static void rxWakeIsr(void);
+#if CONSOLE_RX_DMA
+static void rxDmaUpdateIsr(void);
+#endif
 
 // ------------------------------------------------------------------------
 // Public API
@@ -70,23 +137,41 @@ void startTxIsr(void);
 void console_init(UART_HandleTypeDef *huart)
 {
 	console_huart = huart;
+	sysstats_addMemory("console buffers",
+	                   sizeof(txCtrlBuffer) + sizeof(txBulkBuffer) + sizeof(rxBuffer));
 
 	txActive = false;
-	txBlocked = false;
-	txBlockSem = xSemaphoreCreateBinary();
-	txMutex = xSemaphoreCreateMutex();
-	txPhase = 0;
-	txBufLen[0] = 0;
-	txBufLen[1] = 0;
+	txChanInit(&txChan[TX_CTRL], txCtrlBuffer[0], txCtrlBuffer[1], CONSOLE_CTRL_BUFLEN);
+	txChanInit(&txChan[TX_BULK], txBulkBuffer[0], txBulkBuffer[1], CONSOLE_TX_BUFLEN);
+	txPolicy = CONSOLE_TX_POLICY;
 
     // Receive support
 	rxBlocked = false;
 	rxBlockSem = xSemaphoreCreateBinary();
 	rxMutex = xSemaphoreCreateMutex();
-	rxNextIn = 0;
-	rxNextOut = 0;  // rxBuffer empty when rxNextIn == rxNextOut
+	rxIn = 0;
+	rxOut = 0;  // rxBuffer empty when rxIn == rxOut
 	rxDrops = 0;
 	rxActive = false;
+	rxLastCr = false;
+}
+
+uint32_t console_overSampling(uint32_t baud)
+{
+	// BRR holds USARTDIV to 1/16 at 16x and 1/8 at 8x, so both resolve
+	// the bit time to one PCLK cycle and give the same baud error.  The
+	// only gain from 8x is reaching PCLK1/8 when PCLK1/16 is too slow.
+	if (HAL_RCC_GetPCLK1Freq() / 16 >= baud) {
+		return UART_OVERSAMPLING_16;
+	}
+
+	return UART_OVERSAMPLING_8;
+}
+
+size_t console_writeRaw(const uint8_t *buf, size_t len)
+{
+	// Binary data goes out untouched
+	return txWrite(TX_BULK, buf, len, false);
 }
 
 size_t __read(int Handle, unsigned char * Buf, size_t BufSize)
@@ -108,202 +193,756 @@ size_t __read(int Handle, unsigned char * Buf, size_t BufSize)
 
 int getchar(void)
 {
-	static unsigned count = 0;
-	int c = -1;
-        
-        count++;
-	
+	uint8_t ch;
+
 	// Acquire mutex to prevent tasks from stomping each other.
 	xSemaphoreTake(rxMutex, portMAX_DELAY);
 
 	if (!rxActive) {
-		// Start receiving.
-		rxActive = true;
-		HAL_UART_Receive_IT(console_huart, &rxChar, 1);
+		rxStart();
 	}
-	
-	// Disable USART2 interrupts to maintain consistency
-	HAL_NVIC_DisableIRQ(USART2_IRQn);
 
-	if (rxNextIn == rxNextOut) {
-		// buffer empty, block until something arrives
-		rxBlocked = true;
+	do {
+		rxRead(&ch, 1, false, portMAX_DELAY);
+	} while (rxSkipLf(ch));
 
-		// enable interrupts again to permit receive processing
-		HAL_NVIC_EnableIRQ(USART2_IRQn);
+	xSemaphoreGive(rxMutex);
 
-		// Wait for stuff
-		xSemaphoreTake(rxBlockSem, portMAX_DELAY);
-	} else {
-		// Re-enable interrupts
-		HAL_NVIC_EnableIRQ(USART2_IRQn);
+	// translate CR to LF
+	int c = (ch == '\r') ? '\n' : ch;
+
+	// echo
+	putchar(c);
+
+	return c;
+}
+
+size_t console_readLine(char *line, size_t len)
+{
+	uint8_t chunk[32];
+	uint8_t echo[sizeof(chunk)];
+	size_t n = 0;
+	bool done = false;
+
+	xSemaphoreTake(rxMutex, portMAX_DELAY);
+
+	if (!rxActive) {
+		rxStart();
 	}
 
-	// Either way, UART2 interrupts are enabled now
+	while (!done) {
+		// Takes everything available up to the end of the line
+		size_t got = rxRead(chunk, sizeof(chunk), true, portMAX_DELAY);
+		size_t echoLen = 0;
+
+		for (size_t i = 0; i < got; i++) {
+			uint8_t c = chunk[i];
+
+			if (rxSkipLf(c)) {
+				continue;
+			}
+			if ((n == 0) && (rxFrameSync != 0) && (c == rxFrameSync)) {
+				// A binary frame: the caller reads the rest raw
+				rxPendLen = got - (i + 1);
+				rxPendPos = 0;
+				memcpy(rxPend, &chunk[i + 1], rxPendLen);
+				rxLastCr = false;
+				line[n++] = c;
+				done = true;
+				break;
+			}
+			if ((c == '\r') || (c == '\n')) {
+				echo[echoLen++] = '\n';
+				done = true;
+				break;
+			}
+			echo[echoLen++] = c;
+			if ((c == '\b') || (c == 0x7F)) {
+				if (n > 0) {
+					n--;
+				}
+			}
+			else if (n < len-1) {
+				line[n++] = c;
+			}
+		}
 
-	// Take a character from head of queue
-	c = rxBuffer[rxNextOut];
-	unsigned outIndex = rxNextOut;
-	outIndex++;
-	if (outIndex >= sizeof(rxBuffer)) {
-		outIndex = 0;
+		txWrite(TX_CTRL, echo, echoLen, true);
 	}
-	rxNextOut = outIndex;
 
 	xSemaphoreGive(rxMutex);
-        
-	// translate CR to LF
-	if (c == '\r') {
-		c = '\n';
+
+	line[n] = 0;
+	return n;
+}
+
+size_t console_readRaw(uint8_t *buf, size_t len, uint32_t timeout_ms)
+{
+	TickType_t start = xTaskGetTickCount();
+	TickType_t timeout = pdMS_TO_TICKS(timeout_ms);
+	size_t n = 0;
+
+	xSemaphoreTake(rxMutex, portMAX_DELAY);
+
+	if (!rxActive) {
+		rxStart();
 	}
-        
-	// echo
-	putchar(c);
 
-	return c;
+	while (n < len) {
+		TickType_t waited = xTaskGetTickCount() - start;
+		if (waited >= timeout) {
+			break;
+		}
+		n += rxRead(&buf[n], len - n, false, timeout - waited);
+	}
+
+	xSemaphoreGive(rxMutex);
+
+	return n;
 }
 
-size_t __write(int Handle, const unsigned char * Buf, size_t Bufsize)
+void console_setFrameSync(uint8_t sync)
 {
-	size_t n;
-	int rc;
+	rxFrameSync = sync;
+}
 
+void console_uartIrq(void)
+{
+#if CONSOLE_RX_DMA
+	if ((__HAL_UART_GET_FLAG(console_huart, UART_FLAG_IDLE) != RESET) &&
+	    (__HAL_UART_GET_IT_SOURCE(console_huart, UART_IT_IDLE) != RESET)) {
+		// Sender paused: hand over whatever the DMA has so far
+		__HAL_UART_CLEAR_IDLEFLAG(console_huart);
+		rxDmaUpdateIsr();
+	}
+#endif
+}
+
+void console_rxWakeIsr(void)
+{
+	rxWakeIsr();
+}
+
+size_t __write(int Handle, const unsigned char * Buf, size_t Bufsize)
+{
 	// This function only works for stdout, stderr
 	if (!((Handle == 1) || (Handle == 2))) {
 		return -1;
 	}
 
-	for (n = 0; n < Bufsize; n++) {
-		rc = putchar(Buf[n]);
-		if (rc < 0) break;
+	// A null buffer is a request to flush, nothing is held back here.
+	if (Buf == 0) {
+		return 0;
 	}
 
-	return n;
+	if (itm_routed(ITM_PORT_CONSOLE)) {
+		itm_write(ITM_PORT_CONSOLE, Buf, Bufsize);
+		return Bufsize;
+	}
+
+	return txWrite(TX_CTRL, Buf, Bufsize, !txChan[TX_CTRL].raw);
 }
 
-int putchar(int c)
+size_t console_write(const char *buf, size_t len)
 {
-	// expand LF to CR-LF
-	if (c == '\n') {
-		int rc = putchar('\r');
-		if (rc < 0) {
-			return rc;
+	if (itm_routed(ITM_PORT_CONSOLE)) {
+		itm_write(ITM_PORT_CONSOLE, (const uint8_t *)buf, len);
+		return len;
+	}
+
+	return txWrite(TX_BULK, (const unsigned char *)buf, len, !txChan[TX_BULK].raw);
+}
+
+#if CONSOLE_TX_IN_PLACE
+char *console_reserve(size_t len)
+{
+	TxChan_t *pChan = &txChan[TX_BULK];
+
+#if MICROBENCH
+	if (txDiscard) {
+		return 0;
+	}
+#endif
+#if USB_CDC
+	if (usbCdc_active()) {
+		return 0;
+	}
+#endif
+	if (itm_routed(ITM_PORT_CONSOLE) || (len > pChan->size)) {
+		return 0;
+	}
+
+	xSemaphoreTake(pChan->mutex, portMAX_DELAY);
+	uint32_t was = consoleLock();
+
+	while (1) {
+		unsigned phase = pChan->phase;
+		unsigned bufLen = txMarkDrops(pChan, pChan->buf[phase], pChan->len[phase]);
+
+		pChan->len[phase] = bufLen;
+		if (bufLen + len <= pChan->size) {
+			// Held, locked, until console_commit()
+			reserveLen = len;
+			reserveWas = was;
+			return (char *)&pChan->buf[phase][bufLen];
+		}
+
+		if (!txActive) {
+			startTx(TX_BULK);
+		}
+		else if (txPolicy == CONSOLE_TX_DROP_NEWEST) {
+			// console_write() drops it and counts the drop
+			break;
+		}
+		else if (txPolicy == CONSOLE_TX_DROP_OLDEST) {
+			pChan->drops += pChan->len[phase];
+			pChan->len[phase] = 0;
+		}
+		else {
+			// Block until the ISR swaps buffers, as txWrite() does
+			pChan->blocked = true;
+			consoleUnlock(was);
+			xSemaphoreTake(pChan->blockSem, portMAX_DELAY);
+			was = consoleLock();
 		}
 	}
-	
+
+	consoleUnlock(was);
+	xSemaphoreGive(pChan->mutex);
+
+	return 0;
+}
+
+void console_commit(size_t len)
+{
+	TxChan_t *pChan = &txChan[TX_BULK];
+	unsigned phase = pChan->phase;
+	uint8_t *p = &pChan->buf[phase][pChan->len[phase]];
+
+	if (len > reserveLen) {
+		len = reserveLen;
+	}
+	if (!pChan->raw) {
+		len = expandLfInPlace(p, len);
+	}
+	pChan->len[phase] += len;
+	inPlaceLines++;
+
+	if (!txActive) {
+		startTx(TX_BULK);
+	}
+
+	consoleUnlock(reserveWas);
+	xSemaphoreGive(pChan->mutex);
+}
+#endif
+
+int putchar(int c)
+{
+	unsigned char ch = c;
+
+	if (itm_routed(ITM_PORT_CONSOLE)) {
+		itm_write(ITM_PORT_CONSOLE, &ch, 1);
+		return c;
+	}
+
+	txWrite(TX_CTRL, &ch, 1, !txChan[TX_CTRL].raw);
+
+	return c;
+}
+
+void console_setRaw(ConsoleStream_t stream, bool raw)
+{
+	// Takes effect from the next write; bytes already queued are sent
+	// as they were written
+	txChan[(stream == CONSOLE_STREAM_BULK) ? TX_BULK : TX_CTRL].raw = raw;
+}
+
+bool console_isRaw(ConsoleStream_t stream)
+{
+	return txChan[(stream == CONSOLE_STREAM_BULK) ? TX_BULK : TX_CTRL].raw;
+}
+
+void console_setTxPolicy(unsigned policy)
+{
+	if (policy <= CONSOLE_TX_DROP_OLDEST) {
+		txPolicy = policy;
+	}
+}
+
+unsigned console_getTxPolicy(void)
+{
+	return txPolicy;
+}
+
+uint32_t console_txDrops(void)
+{
+	return txChan[TX_CTRL].drops + txChan[TX_BULK].drops;
+}
+
+uint32_t console_txBytes(void)
+{
+	return txSent;
+}
+
+unsigned console_txFill(void)
+{
+	const TxChan_t *pChan = &txChan[TX_BULK];
+
+#if USB_CDC
+	if (usbCdc_active()) {
+		return 0;
+	}
+#endif
+	// Unlocked: a reading, the lengths may be moving
+	return (pChan->len[0] + pChan->len[1]) * 1000 / (2 * pChan->size);
+}
+
+#if MICROBENCH
+void console_setDiscard(bool discard)
+{
+	txDiscard = discard;
+}
+
+uint32_t console_discarded(void)
+{
+	return txDiscarded;
+}
+#endif
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static void txChanInit(TxChan_t *pChan, uint8_t *buf0, uint8_t *buf1, unsigned size)
+{
+	pChan->buf[0] = buf0;
+	pChan->buf[1] = buf1;
+	pChan->size = size;
+	pChan->len[0] = 0;
+	pChan->len[1] = 0;
+	pChan->phase = 0;
+	pChan->blocked = false;
+	pChan->blockSem = xSemaphoreCreateBinary();
+	pChan->mutex = xSemaphoreCreateMutex();
+	pChan->raw = false;
+	pChan->drops = 0;
+	pChan->dropsMarked = 0;
+}
+
+// Copy a block into a channel's tx buffers, optionally expanding LF to
+// CR-LF.  The mutex and the console interrupt mask are taken once per
+// buffer fill rather than once per character.
+static size_t txWrite(unsigned chan, const unsigned char *buf, size_t len, bool expandLf)
+{
+	TxChan_t *pChan = &txChan[chan];
+	size_t n = 0;
+
+#if MICROBENCH
+	if (txDiscard) {
+		txDiscarded += len;
+		return len;
+	}
+#endif
+
+#if USB_CDC
+	// An open USB port takes over from the UART
+	if (usbCdc_active()) {
+		return usbCdc_write(buf, len, expandLf);
+	}
+#endif
+
 	// Acquire mutex to prevent tasks from stomping each other.
-	xSemaphoreTake(txMutex, portMAX_DELAY);
-	
-	// Disable USART2 interrupt while manipulating tx buffers
-	HAL_NVIC_DisableIRQ(USART2_IRQn);
+	xSemaphoreTake(pChan->mutex, portMAX_DELAY);
 	
-	// If current buffer is full, block until it's empty
-	if (txBufLen[txPhase] == CONSOLE_BUFLEN) {
-		txBlocked = true;
+	// Mask the console interrupts while manipulating tx buffers
+	uint32_t was = consoleLock();
+
+	while (n < len) {
+		unsigned phase = pChan->phase;
+		uint8_t *pBuf = pChan->buf[phase];
+		unsigned bufLen = txMarkDrops(pChan, pBuf, pChan->len[phase]);
+
+		// Fill as much of the current buffer as we can
+		while ((n < len) && (bufLen < pChan->size)) {
+			if (expandLf && (buf[n] == '\n')) {
+				if (bufLen + 2 > pChan->size) {
+					// CR-LF pair must not be split across buffers
+					break;
+				}
+				pBuf[bufLen++] = '\r';
+			}
+			pBuf[bufLen++] = buf[n++];
+		}
+		pChan->len[phase] = bufLen;
+
+		if (!txActive) {
+			// Start a new transmission, this frees the current buffer
+			startTx(chan);
+		}
+		else if ((n < len) && (txPolicy == CONSOLE_TX_DROP_NEWEST)) {
+			// Both buffers are full: the rest of this write is lost.
+			// CRs it would have added are not counted.
+			pChan->drops += len - n;
+			n = len;
+		}
+		else if ((n < len) && (txPolicy == CONSOLE_TX_DROP_OLDEST)) {
+			// Both buffers are full: make room by throwing away the one
+			// waiting to be sent, then fill it afresh
+			pChan->drops += pChan->len[phase];
+			pChan->len[phase] = 0;
+		}
+		else if (n < len) {
+			// Current buffer is full, block until ISR swaps buffers
+			pChan->blocked = true;
 		
-		// Re-enable USART2 interrupt while blocking
-		HAL_NVIC_EnableIRQ(USART2_IRQn);
+			// Unmask while blocking: BASEPRI isn't kept per task
+			consoleUnlock(was);
 		
-		// Block on semaphore until ISR frees up space.
-		xSemaphoreTake(txBlockSem, portMAX_DELAY);
+			// Block on semaphore until ISR frees up space.
+			xSemaphoreTake(pChan->blockSem, portMAX_DELAY);
 		
-		// Disable USART2 interrupt again while blocking
-		HAL_NVIC_DisableIRQ(USART2_IRQn);
+			// Mask again while filling
+			was = consoleLock();
+		}
 	}
 	
-	// Put this character into current buffer
-	txBuffer[txPhase][txBufLen[txPhase]] = c;
-	txBufLen[txPhase]++;
-
-	// If tx is inactive, start it.
-	if (!txActive) {
-		// Start a new transmission
-		startTx();
-	} 
-	
-	// Re-enable USART2 interrupts now
-	HAL_NVIC_EnableIRQ(USART2_IRQn);
+	// Unmask the console interrupts now
+	consoleUnlock(was);
 	
 	// Allow other tasks to transmit again.
-	xSemaphoreGive(txMutex);
+	xSemaphoreGive(pChan->mutex);
 
-	return c;
+	return n;
 }
 
-// ------------------------------------------------------------------------
-// Private utility functions
+// Append "[N bytes dropped]" to the tx buffer at bufLen if the channel
+// dropped output since its last marker and it fits.  Returns the new
+// length.  Called with the console locked.
+static unsigned txMarkDrops(TxChan_t *pChan, uint8_t *pBuf, unsigned bufLen)
+{
+	char mark[32];
+
+	if (pChan->drops == pChan->dropsMarked) {
+		return bufLen;
+	}
+
+	int len = snprintf(mark, sizeof(mark), "\r\n[%u bytes dropped]\r\n",
+	                   (unsigned)(pChan->drops - pChan->dropsMarked));
+	if ((len > 0) && (bufLen + len <= pChan->size)) {
+		memcpy(pBuf + bufLen, mark, len);
+		bufLen += len;
+		pChan->dropsMarked = pChan->drops;
+	}
 
-static void startTx(void)
+	return bufLen;
+}
+
+#if CONSOLE_TX_IN_PLACE
+// Turn each LF of the len bytes at p into CR-LF, moving the text up
+// from the end.  Returns the new length.
+static unsigned expandLfInPlace(uint8_t *p, unsigned len)
 {
-	unsigned isrBuf = txPhase;
+	unsigned lfs = 0;
+
+	for (unsigned n = 0; n < len; n++) {
+		lfs += (p[n] == '\n');
+	}
+	if (lfs == 0) {
+		return len;
+	}
+
+	uint8_t *src = p + len;
+	uint8_t *dst = src + lfs;
+	while (src != dst) {
+		uint8_t c = *--src;
+		*--dst = c;
+		if (c == '\n') {
+			*--dst = '\r';
+		}
+	}
+
+	return len + lfs;
+}
+#endif
 
-	// Swap buffers and clear new tx buffer
-	txPhase = txPhase ? 0 : 1;
-	txBufLen[txPhase] = 0;
+static void consoleCmd(int argc, char *argv[])
+{
+	static const char * const policyName[] = {"block", "newest", "oldest"};
+
+	if (argc > 1) {
+		unsigned n;
+		for (n = 0; n < 3; n++) {
+			if (strcmp(argv[1], policyName[n]) == 0) {
+				console_setTxPolicy(n);
+				break;
+			}
+		}
+		if (strcmp(argv[1], "raw") == 0) {
+			console_setRaw(CONSOLE_STREAM_BULK, true);
+		}
+		else if (strcmp(argv[1], "cooked") == 0) {
+			console_setRaw(CONSOLE_STREAM_BULK, false);
+		}
+		else if (n == 3) {
+			printf("Unknown policy %s.\n", argv[1]);
+			return;
+		}
+	}
+
+	printf("Console tx full: %s%s, %u ctrl and %u bulk bytes dropped, bulk %s.\n",
+	       (txPolicy == CONSOLE_TX_BLOCK) ? "" : "drop ",
+	       policyName[txPolicy],
+	       (unsigned)txChan[TX_CTRL].drops, (unsigned)txChan[TX_BULK].drops,
+	       txChan[TX_BULK].raw ? "raw" : "cooked");
+#if CONSOLE_TX_IN_PLACE
+	printf("%u bulk lines formatted in place.\n", (unsigned)inPlaceLines);
+#endif
+}
+
+// Start receiving.  Called once, by the first reader, with rxMutex held.
+static void rxStart(void)
+{
+	rxActive = true;
+
+	// The first reader runs after the scheduler has started
+	// (the shell), so register with sysstats and the shell here
+	sysstats_addCounter("console rx drops", &rxDrops);
+	sysstats_addCounter("console ctrl drops", &txChan[TX_CTRL].drops);
+	sysstats_addCounter("console bulk drops", &txChan[TX_BULK].drops);
+	shell_addCommand("console", "[block | newest | oldest | raw | cooked] tx policy, bulk LF mode", consoleCmd);
+
+#if CONSOLE_RX_DMA
+	// Keep tx completions from changing the HAL state meanwhile
+	uint32_t was = consoleLock();
+	rxDmaPos = 0;
+	HAL_UART_Receive_DMA(console_huart, rxBuffer, CONSOLE_RX_BUFLEN);
+	__HAL_UART_CLEAR_IDLEFLAG(console_huart);
+	__HAL_UART_ENABLE_IT(console_huart, UART_IT_IDLE);
+	consoleUnlock(was);
+#else
+	HAL_UART_Receive_IT(console_huart, &rxChar, 1);
+#endif
+}
+
+// Copy up to len received bytes into buf, blocking until there is at
+// least one: first any left over from a frame's sync, then from USB if
+// it has any, then the ring.  With toEol, stops after the
+// first CR or LF.  Returns 0 if nothing came within wait ticks.
+// rxMutex must be held.
+static size_t rxRead(uint8_t *buf, size_t len, bool toEol, TickType_t wait)
+{
+	size_t n = 0;
+	uint32_t in;
+
+	if (rxPendPos < rxPendLen) {
+		while ((n < len) && (rxPendPos < rxPendLen)) {
+			uint8_t c = rxPend[rxPendPos++];
+			buf[n++] = c;
+			if (toEol && ((c == '\r') || (c == '\n'))) {
+				break;
+			}
+		}
+		return n;
+	}
+
+	while (1) {
+		size_t usb = 0;
+
+		// Receive interrupts are below the syscall priority, so this
+		// masks them.
+		taskENTER_CRITICAL();
+		in = rxIn;
+#if USB_CDC
+		usb = usbCdc_rxAvailable();
+#endif
+		if ((in == rxOut) && (usb == 0)) {
+			rxBlocked = true;
+		}
+		taskEXIT_CRITICAL();
+
+#if USB_CDC
+		if (usb != 0) {
+			return usbCdc_read(buf, len, toEol);
+		}
+#endif
+		if (in != rxOut) {
+			break;
+		}
+
+		// Wait for stuff
+		if (xSemaphoreTake(rxBlockSem, wait) != pdTRUE) {
+			rxBlocked = false;
+			return 0;
+		}
+	}
+
+	if (in - rxOut > CONSOLE_RX_BUFLEN) {
+		// The DMA lapped the reader, the oldest bytes are gone
+		rxDrops += in - rxOut - CONSOLE_RX_BUFLEN;
+		rxOut = in - CONSOLE_RX_BUFLEN;
+	}
+
+	while ((n < len) && (rxOut != in)) {
+		uint8_t c = rxBuffer[rxOut & (CONSOLE_RX_BUFLEN-1)];
+		rxOut++;
+		buf[n++] = c;
+		if (toEol && ((c == '\r') || (c == '\n'))) {
+			break;
+		}
+	}
+
+	return n;
+}
+
+// True for the LF of a CR-LF pair, which has already ended the line.
+static bool rxSkipLf(uint8_t c)
+{
+	bool skip = (c == '\n') && rxLastCr;
+
+	rxLastCr = (c == '\r');
+
+	return skip;
+}
+
+// If the receiving process needs to wake up, do it.
+static void rxWakeIsr(void)
+{
+	BaseType_t woken = pdFALSE;
+
+	// Input: the user is at the console, keep it out of STOP
+	power_keepAwake();
+
+	if (rxBlocked) {
+		rxBlocked = false;
+		xSemaphoreGiveFromISR(rxBlockSem, &woken);
+	}
+
+	portYIELD_FROM_ISR(woken);
+}
+
+#if CONSOLE_RX_DMA
+// Count the bytes the DMA has written since the last update.  Called at
+// least every half buffer, so the distance is never ambiguous.
+static void rxDmaUpdateIsr(void)
+{
+	unsigned pos = CONSOLE_RX_BUFLEN - __HAL_DMA_GET_COUNTER(console_huart->hdmarx);
+
+	pos &= (CONSOLE_RX_BUFLEN-1);
+	rxIn += (pos - rxDmaPos) & (CONSOLE_RX_BUFLEN-1);
+	rxDmaPos = pos;
+
+	rxWakeIsr();
+}
+#endif
+
+// Mask USART2 and its DMA streams, and whatever runs below them, by
+// raising BASEPRI to their priority.  INTN, the sensor bus and USB still
+// run, and raising BASEPRI is cheaper than an NVIC disable and
+// enable per buffer.  Never lowers a mask already in place.  Task code
+// must unlock before it blocks.
+static uint32_t consoleLock(void)
+{
+	uint32_t was = __get_BASEPRI();
+	uint32_t level = PRIO_IRQ_CONSOLE << (8 - __NVIC_PRIO_BITS);
+
+	if ((was == 0) || (was > level)) {
+		__set_BASEPRI(level);
+		__DSB();
+		__ISB();
+	}
+
+	return was;
+}
+
+static void consoleUnlock(uint32_t was)
+{
+	__set_BASEPRI(was);
+}
+
+HOT_FN static void startTx(unsigned chan)
+{
+	TxChan_t *pChan = &txChan[chan];
+	unsigned isrBuf = pChan->phase;
+
+	// Swap the channel's buffers and clear its new fill buffer
+	pChan->phase = isrBuf ? 0 : 1;
+	pChan->len[pChan->phase] = 0;
 	
 	// Start transmission of current buffer
 	txActive = true;
-	HAL_UART_Transmit_IT(console_huart, txBuffer[isrBuf], txBufLen[isrBuf]);
+	txSent += pChan->len[isrBuf];
+	power_hold(POWER_HOLD_CONSOLE);
+#if CONSOLE_USE_DMA
+	HAL_UART_Transmit_DMA(console_huart, pChan->buf[isrBuf], pChan->len[isrBuf]);
+#else
+	HAL_UART_Transmit_IT(console_huart, pChan->buf[isrBuf], pChan->len[isrBuf]);
+#endif
 }
 
-static void startTxIsr(void)
+HOT_FN static void startTxIsr(unsigned chan)
 {
+	TxChan_t *pChan = &txChan[chan];
 	BaseType_t woken = pdFALSE;
 
-	startTx();
+	startTx(chan);
 
-	if (txBlocked) {
-		txBlocked = false;
-		xSemaphoreGiveFromISR(txBlockSem, &woken);
+	if (pChan->blocked) {
+		pChan->blocked = false;
+		xSemaphoreGiveFromISR(pChan->blockSem, &woken);
 	}
 	
 	portYIELD_FROM_ISR(woken);
 }
 
-void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+HOT_FN void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
 {
 	if (huart->Instance == USART2) {
-		// One transmission is complete.
-		if (txBufLen[txPhase] != 0) {
-			// Start the next transmission
-			startTxIsr();
-		}
-		else {
-			// Go to inactive state
-			txActive = false;
+		// One transmission is complete.  Send the most urgent channel
+		// with output waiting.
+		for (unsigned chan = 0; chan < TX_NUM_CHANS; chan++) {
+			if (txChan[chan].len[txChan[chan].phase] != 0) {
+				startTxIsr(chan);
+				return;
+			}
 		}
+
+		// Go to inactive state
+		txActive = false;
+		power_release(POWER_HOLD_CONSOLE);
 	}
 }
 
-void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
+#if CONSOLE_RX_DMA
+void HAL_UART_RxHalfCpltCallback(UART_HandleTypeDef *huart)
 {
-	BaseType_t woken = pdFALSE;
-	
-	// rxChar now has the latest input.
-
-	unsigned nextInsertPoint = rxNextIn + 1;
-	if (nextInsertPoint >= sizeof(rxBuffer)) {
-		nextInsertPoint = 0;
+	if (huart->Instance == USART2) {
+		rxDmaUpdateIsr();
 	}
+}
 
-	if (nextInsertPoint == rxNextOut) {
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
+{
+	// Circular mode: the DMA has wrapped and carries on
+	if (huart->Instance == USART2) {
+		rxDmaUpdateIsr();
+	}
+}
+#else
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
+{
+	// rxChar now has the latest input.
+	if (rxIn - rxOut >= CONSOLE_RX_BUFLEN) {
 		// circular queue is full, drop this
 		rxDrops++;
 	}
 	else {
 		// Put the character into circular queue
-		rxBuffer[rxNextIn] = rxChar;
-		rxNextIn = nextInsertPoint;
-	}
-
-	// If the receiving process needs to wake up, do it.
-	if (rxBlocked) {
-		rxBlocked = false;
-		xSemaphoreGiveFromISR(rxBlockSem, &woken);
+		rxBuffer[rxIn & (CONSOLE_RX_BUFLEN-1)] = rxChar;
+		rxIn++;
 	}
 
 	HAL_UART_Receive_IT(huart, &rxChar, 1);
 
-	portYIELD_FROM_ISR(woken);
+	rxWakeIsr();
 }
-
+#endif
@@ -18,14 +18,181 @@
 /*
  * usart2 console
  * Supports standard i/o over VCOM USB interface on Nucleo F401/F411 boards.
+ *
+ * Output goes out on two channels, each with its own buffers.  Control
+ * output (printf: the shell, errors, status) is sent ahead of bulk
+ * streams (console_write() and console_writeRaw(): sensor reports,
+ * captures, dumps), so a flood of samples delays a shell response or an
+ * error by at most the bulk buffer being sent.  Output of one channel
+ * stays in order; the two interleave a buffer at a time.
  */
 
 
 #ifndef CONSOLE_H
 #define CONSOLE_H
 
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include "stm32f4xx_hal.h"
+#include "microbench.h"
+
+// Set to 0 to transmit console output with one interrupt per character.
+#ifndef CONSOLE_USE_DMA
+#define CONSOLE_USE_DMA (1)
+#endif
+
+// Console baud rate.  115200 is about 11 KB/s; full-rate DSF output from
+// several sensors needs 921600, with the terminal set to match.
+#ifndef CONSOLE_BAUD
+#define CONSOLE_BAUD (115200)
+#endif
+
+// Each of the two bulk tx buffers holds this many milliseconds of output
+// at CONSOLE_BAUD (10 bits per byte), so a bulk writer only blocks once
+// the link is that far behind.
+#ifndef CONSOLE_TX_BUF_MS
+#define CONSOLE_TX_BUF_MS (10)
+#endif
+
+// At least two of the longest sensor lines, formatted in place
+#define CONSOLE_TX_BUFLEN_MIN (256)
+#define CONSOLE_TX_BUFLEN_LINK ((CONSOLE_BAUD / 10) * CONSOLE_TX_BUF_MS / 1000)
+#define CONSOLE_TX_BUFLEN \
+    ((CONSOLE_TX_BUFLEN_LINK > CONSOLE_TX_BUFLEN_MIN) ? \
+     CONSOLE_TX_BUFLEN_LINK : CONSOLE_TX_BUFLEN_MIN)
+
+// Each of the two control tx buffers.  Control output is short and goes
+// first, so it needs less.
+#ifndef CONSOLE_CTRL_BUFLEN
+#define CONSOLE_CTRL_BUFLEN (256)
+#endif
+#if CONSOLE_CTRL_BUFLEN < 64
+#error CONSOLE_CTRL_BUFLEN must hold at least a drop marker and a line.
+#endif
+
+// What a writer does when both tx buffers of its channel are full:
+//   CONSOLE_TX_BLOCK        wait for the UART to free one
+//   CONSOLE_TX_DROP_NEWEST  drop the rest of the write
+//   CONSOLE_TX_DROP_OLDEST  drop the buffer still waiting to be sent
+// Neither drop policy ever blocks the caller (e.g. the sensor task
+// printing reports).  Dropped bytes are counted, and the next output
+// starts with "[N bytes dropped]".  "console" sets it at run time.
+#define CONSOLE_TX_BLOCK (0)
+#define CONSOLE_TX_DROP_NEWEST (1)
+#define CONSOLE_TX_DROP_OLDEST (2)
+#ifndef CONSOLE_TX_POLICY
+#define CONSOLE_TX_POLICY (CONSOLE_TX_BLOCK)
+#endif
+#if (CONSOLE_TX_POLICY < CONSOLE_TX_BLOCK) || (CONSOLE_TX_POLICY > CONSOLE_TX_DROP_OLDEST)
+#error CONSOLE_TX_POLICY must be one of CONSOLE_TX_BLOCK, _DROP_NEWEST or _DROP_OLDEST
+#endif
+
+// Set to 0 to receive with one interrupt per character rather than
+// circular DMA (DMA1 Stream 5) and the line-idle interrupt.
+#ifndef CONSOLE_RX_DMA
+#define CONSOLE_RX_DMA (1)
+#endif
+
+// Receive ring size (power of 2).  Also the circular DMA buffer.
+#ifndef CONSOLE_RX_BUFLEN
+#define CONSOLE_RX_BUFLEN (256)
+#endif
+
+// Set to 0 to always format bulk text on the stack and copy it in with
+// console_write(), rather than in place with console_reserve().
+#ifndef CONSOLE_TX_IN_PLACE
+#define CONSOLE_TX_IN_PLACE (1)
+#endif
 
 void console_init(UART_HandleTypeDef* huart);
 
+// Read one line, echoing it and handling backspace.  CR, LF and CR-LF
+// all end a line; the terminator is not stored.  line is always
+// terminated, excess characters are discarded.  Returns the line length.
+size_t console_readLine(char *line, size_t len);
+
+// Read len bytes without echo or line handling, for binary transfers.
+// Returns fewer if timeout_ms passes first.
+size_t console_readRaw(uint8_t *buf, size_t len, uint32_t timeout_ms);
+
+// Treat a line starting with sync as a binary frame: console_readLine()
+// returns it at once, unechoed, as just the sync byte, and the rest is
+// read with console_readRaw().  0 (the default) turns this off.
+void console_setFrameSync(uint8_t sync);
+
+// Call from USART2_IRQHandler before HAL_UART_IRQHandler.
+void console_uartIrq(void);
+
+// Wake a reader blocked on the console for input that arrived on
+// another link (usb_cdc).  Call from that link's interrupt.
+void console_rxWakeIsr(void);
+
+// UART_OVERSAMPLING_16 if PCLK1 is fast enough for baud, else _8.
+// 16x is preferred: it samples RX more finely and tolerates more noise.
+uint32_t console_overSampling(uint32_t baud);
+
+// Write a block to the bulk channel without LF to CR-LF expansion.
+// Ordered with console_write(), but printf output may overtake it.
+size_t console_writeRaw(const uint8_t *buf, size_t len);
+
+// Write text to the bulk channel as printf would (LF to CR-LF, or to
+// the console ITM port if routed there), for streams formatted by hand.
+size_t console_write(const char *buf, size_t len);
+
+#if CONSOLE_TX_IN_PLACE
+// Reserve len bytes in the bulk channel's fill buffer, the one the
+// UART DMA is not sending, so a line can be formatted straight into it
+// and go out with no copy.  Waits for room as console_write() would.
+// Returns NULL when the output doesn't go to the UART (USB, ITM), or
+// the tx policy would drop the line: format it elsewhere and pass it to
+// console_write(), which counts the drop.  Until console_commit() the
+// caller holds the bulk channel with the console interrupts masked, so
+// it must only format: no blocking, printf or other console output.
+char *console_reserve(size_t len);
+
+// Send the first len bytes of the reservation as console_write() would.
+// On a cooked stream each LF becomes CR-LF in place, so the reservation
+// must have room for one more byte per LF.
+void console_commit(size_t len);
+#else
+#define console_reserve(len) ((char *)0)
+#define console_commit(len)
+#endif
+
+// Console output streams.  CTRL carries printf, putchar and the shell's
+// echo; BULK carries console_write().
+typedef enum {
+    CONSOLE_STREAM_CTRL,
+    CONSOLE_STREAM_BULK,
+} ConsoleStream_t;
+
+// Cooked streams (the default) send each LF as CR-LF, for terminals.
+// Raw streams send every byte as written, so binary data with 0x0A in
+// it can go out through printf or console_write() untouched.
+// console_writeRaw() is always raw, and line input echo always cooked.
+void console_setRaw(ConsoleStream_t stream, bool raw);
+bool console_isRaw(ConsoleStream_t stream);
+
+// Select the tx overflow policy (CONSOLE_TX_BLOCK, ...).
+void console_setTxPolicy(unsigned policy);
+unsigned console_getTxPolicy(void);
+
+// Bytes of output dropped by the tx policy since console_init.
+uint32_t console_txDrops(void);
+
+// Bytes of output sent on the UART since console_init.
+uint32_t console_txBytes(void);
+
+// How full the tx buffers for sensor output are [permille], 0 while
+// USB has the output.
+unsigned console_txFill(void);
+
+#if MICROBENCH
+// Drop console output instead of sending it, so benchmarks can time
+// formatting without the UART.  Counts the bytes dropped.
+void console_setDiscard(bool discard);
+uint32_t console_discarded(void);
+#endif
+
 #endif
@@ -0,0 +1,309 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Core dump on fault
+ */
+
+#include "coredump.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include "stm32f4xx.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "timebase.h"
+#include "trace.h"
+#include "shell.h"
+#include "sysstats.h"
+
+#define CORE_DUMP_MAGIC (0xC0DEDEADu)
+
+// End of the F401xE's 96KB SRAM, stack copies stop there
+#define RAM_END (SRAM1_BASE + 0x18000)
+
+#define STATE_NAME_LEN (12)
+
+// ------------------------------------------------------------------------
+// Private types
+
+typedef struct {
+    char name[configMAX_TASK_NAME_LEN];
+    uint8_t state;              // eTaskState
+    uint8_t priority;
+    uint16_t stackFree;         // words, high water mark
+} DumpTask_t;
+
+typedef struct {
+    char name[STATE_NAME_LEN];
+    uint32_t value;
+} DumpState_t;
+
+typedef struct {
+    uint32_t magic;             // CORE_DUMP_MAGIC once the core part is saved
+    uint32_t size;              // sizeof(CoreDump_t), catches layout changes
+    uint32_t cause;
+    uint32_t uptime_ms;
+
+    // Stacked by the core, and where
+    uint32_t r0, r1, r2, r3, r12, lr, pc, xpsr;
+    uint32_t frame;
+    uint32_t excReturn;
+    uint32_t msp, psp;
+
+    // Fault status
+    uint32_t cfsr, hfsr, mmfar, bfar;
+
+    uint32_t stack[CORE_DUMP_STACK_WORDS];
+    uint32_t stackWords;
+
+    DumpState_t state[CORE_DUMP_MAX_STATE];
+    uint32_t numStates;
+
+    TraceRec_t trace[CORE_DUMP_TRACE];
+    uint32_t numTrace;
+
+    // Filled in last, walking the kernel's lists may fault again
+    DumpTask_t task[CORE_DUMP_MAX_TASKS];
+    uint32_t numTasks;
+} CoreDump_t;
+
+typedef struct {
+    const char *name;
+    const volatile void *p;
+    unsigned size;
+} StateReg_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static uint32_t *findFrame(uint32_t sp);
+static void faultCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static const char * const causeName[CORE_DUMP_NUM_CAUSES] = {
+    "hard fault",
+    "memory management fault",
+    "bus fault",
+    "usage fault",
+};
+
+// Survives reset: not zeroed by the startup code
+static __no_init CoreDump_t dump;
+
+// Taken over from dump at boot
+static CoreDump_t last;
+static bool haveLast;
+
+static StateReg_t stateReg[CORE_DUMP_MAX_STATE];
+static unsigned numStateReg;
+
+static TaskStatus_t taskStatus[CORE_DUMP_MAX_TASKS];
+
+// ------------------------------------------------------------------------
+// Public API
+
+void coredump_init(void)
+{
+    if ((dump.magic == CORE_DUMP_MAGIC) && (dump.size == sizeof(dump))) {
+        last = dump;
+        haveLast = true;
+    }
+    dump.magic = 0;
+
+    // Separate handlers for MemManage, BusFault and UsageFault rather
+    // than escalation to HardFault, and trap divides by zero.
+    SCB->SHCSR |= SCB_SHCSR_USGFAULTENA_Msk | SCB_SHCSR_BUSFAULTENA_Msk |
+                  SCB_SHCSR_MEMFAULTENA_Msk;
+    SCB->CCR |= SCB_CCR_DIV_0_TRP_Msk;
+
+    sysstats_addMemory("core dump", sizeof(dump) + sizeof(last) + sizeof(taskStatus));
+    shell_addCommand("fault", "[clear] core dump saved by the last fault", faultCmd);
+}
+
+int coredump_addState(const char *name, const volatile void *p, unsigned size)
+{
+    if ((numStateReg >= CORE_DUMP_MAX_STATE) ||
+        ((size != 1) && (size != 2) && (size != 4))) {
+        return -1;
+    }
+
+    stateReg[numStateReg].name = name;
+    stateReg[numStateReg].p = p;
+    stateReg[numStateReg].size = size;
+    numStateReg++;
+
+    return 0;
+}
+
+void coredump_report(void)
+{
+    static const char stateChar[] = {'X', 'R', 'B', 'S', 'D'};
+    const CoreDump_t *d = &last;
+
+    if (!haveLast) {
+        return;
+    }
+
+    printf("Reset by %s after %u ms:\n",
+           (d->cause < CORE_DUMP_NUM_CAUSES) ? causeName[d->cause] : "fault",
+           (unsigned)d->uptime_ms);
+    printf("  pc  %08x lr  %08x psr %08x sp  %08x (%s)\n",
+           (unsigned)d->pc, (unsigned)d->lr, (unsigned)d->xpsr, (unsigned)d->frame,
+           (d->excReturn & 0x4) ? "psp" : "msp");
+    printf("  r0  %08x r1  %08x r2  %08x r3  %08x r12 %08x\n",
+           (unsigned)d->r0, (unsigned)d->r1, (unsigned)d->r2, (unsigned)d->r3,
+           (unsigned)d->r12);
+    printf("  cfsr %08x hfsr %08x mmfar %08x bfar %08x\n",
+           (unsigned)d->cfsr, (unsigned)d->hfsr, (unsigned)d->mmfar, (unsigned)d->bfar);
+
+    for (unsigned n = 0; n < d->numStates; n++) {
+        printf("  %-*.*s %u\n", STATE_NAME_LEN, STATE_NAME_LEN, d->state[n].name,
+               (unsigned)d->state[n].value);
+    }
+
+    if (d->numTasks) {
+        printf("  %-*s St Pri Stack free\n", configMAX_TASK_NAME_LEN, "Task");
+    }
+    for (unsigned n = 0; n < d->numTasks; n++) {
+        const DumpTask_t *t = &d->task[n];
+        printf("  %-*.*s %c  %3u %u\n", configMAX_TASK_NAME_LEN, configMAX_TASK_NAME_LEN,
+               t->name, (t->state < sizeof(stateChar)) ? stateChar[t->state] : '?',
+               t->priority, t->stackFree);
+    }
+
+    if (d->numTrace) {
+        printf("  Trace [cycles before fault]:\n");
+    }
+    for (unsigned n = 0; n < d->numTrace; n++) {
+        const TraceRec_t *r = &d->trace[n];
+        printf("  %10u %-12s %u\n",
+               (unsigned)(d->trace[d->numTrace - 1].cycles - r->cycles),
+               trace_eventName(r->event), (unsigned)r->arg);
+    }
+
+    printf("  Stack:");
+    for (unsigned n = 0; n < d->stackWords; n++) {
+        printf("%s %08x", (n % 8) ? "" : "\n   ", (unsigned)d->stack[n]);
+    }
+    printf("\n");
+}
+
+void coredump_fault(CoreDumpCause_t cause, uint32_t excReturn, uint32_t msp)
+{
+    CoreDump_t *d = &dump;
+    uint32_t psp = __get_PSP();
+    uint32_t *frame;
+
+    __disable_irq();
+    d->magic = 0;
+    d->size = sizeof(dump);
+    d->cause = cause;
+    d->uptime_ms = (uint32_t)(timebase_getUs() / 1000);
+    d->excReturn = excReturn;
+    d->msp = msp;
+    d->psp = psp;
+
+    // Frame pushed on entry to the handler
+    frame = (excReturn & 0x4) ? (uint32_t *)(uintptr_t)psp : findFrame(msp);
+    d->frame = (uint32_t)frame;
+    d->r0 = frame[0];
+    d->r1 = frame[1];
+    d->r2 = frame[2];
+    d->r3 = frame[3];
+    d->r12 = frame[4];
+    d->lr = frame[5];
+    d->pc = frame[6];
+    d->xpsr = frame[7];
+
+    d->cfsr = SCB->CFSR;
+    d->hfsr = SCB->HFSR;
+    d->mmfar = SCB->MMFAR;
+    d->bfar = SCB->BFAR;
+
+    d->stackWords = 0;
+    while ((d->stackWords < CORE_DUMP_STACK_WORDS) &&
+           ((uint32_t)&frame[d->stackWords] < RAM_END)) {
+        d->stack[d->stackWords] = frame[d->stackWords];
+        d->stackWords++;
+    }
+
+    d->numStates = numStateReg;
+    for (unsigned n = 0; n < numStateReg; n++) {
+        const StateReg_t *s = &stateReg[n];
+        strncpy(d->state[n].name, s->name, STATE_NAME_LEN);
+        d->state[n].value = (s->size == 1) ? *(const volatile uint8_t *)s->p :
+                            (s->size == 2) ? *(const volatile uint16_t *)s->p :
+                            *(const volatile uint32_t *)s->p;
+    }
+
+    d->numTrace = trace_copy(d->trace, CORE_DUMP_TRACE);
+
+    // The core part is enough to report, even if what follows faults
+    d->numTasks = 0;
+    d->magic = CORE_DUMP_MAGIC;
+
+    if (xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED) {
+        UBaseType_t count = uxTaskGetSystemState(taskStatus, CORE_DUMP_MAX_TASKS, 0);
+        for (unsigned n = 0; n < count; n++) {
+            DumpTask_t *t = &d->task[n];
+            strncpy(t->name, taskStatus[n].pcTaskName, configMAX_TASK_NAME_LEN);
+            t->state = taskStatus[n].eCurrentState;
+            t->priority = taskStatus[n].uxCurrentPriority;
+            t->stackFree = taskStatus[n].usStackHighWaterMark;
+        }
+        d->numTasks = count;
+    }
+
+    NVIC_SystemReset();
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+// A fault in handler mode stacks on MSP, which the handler may have
+// moved on by a few words before passing it.  The frame's xPSR has the
+// Thumb bit set.
+static uint32_t *findFrame(uint32_t sp)
+{
+    uint32_t *p = (uint32_t *)(uintptr_t)sp;
+
+    for (unsigned n = 0; n <= 4; n++) {
+        if ((uint32_t)&p[n + 8] <= RAM_END && (p[n + 7] & (1 << 24))) {
+            return &p[n];
+        }
+    }
+
+    return p;
+}
+
+static void faultCmd(int argc, char *argv[])
+{
+    if ((argc > 1) && (strcmp(argv[1], "clear") == 0)) {
+        haveLast = false;
+        return;
+    }
+
+    if (!haveLast) {
+        printf("No fault since power-up.\n");
+        return;
+    }
+    coredump_report();
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Core dump on fault.
+ * The fault handlers save registers, stack, task states, registered HAL
+ * state and the newest trace records in RAM that survives reset, then
+ * reset.  The next boot reports what was saved.
+ */
+
+#ifndef COREDUMP_H
+#define COREDUMP_H
+
+#include <stdint.h>
+
+// Stack words saved from the exception frame up
+#ifndef CORE_DUMP_STACK_WORDS
+#define CORE_DUMP_STACK_WORDS (32)
+#endif
+
+// Newest trace records saved (see trace.h)
+#ifndef CORE_DUMP_TRACE
+#define CORE_DUMP_TRACE (16)
+#endif
+
+#define CORE_DUMP_MAX_TASKS (10)
+#define CORE_DUMP_MAX_STATE (8)
+
+typedef enum {
+    CORE_DUMP_HARD_FAULT = 0,
+    CORE_DUMP_MEM_MANAGE,
+    CORE_DUMP_BUS_FAULT,
+    CORE_DUMP_USAGE_FAULT,
+    CORE_DUMP_NUM_CAUSES
+} CoreDumpCause_t;
+
+// Take over the last dump, enable the separate fault handlers and
+// register the fault command.  Call early in main().
+void coredump_init(void);
+
+// Save the value of a HAL state variable (1, 2 or 4 bytes) in dumps.
+int coredump_addState(const char *name, const volatile void *p, unsigned size);
+
+// Print the dump saved before the last reset, if there is one.
+void coredump_report(void);
+
+// Called first thing by the fault handlers, with the handler's LR and
+// MSP.  Saves the dump and resets.
+void coredump_fault(CoreDumpCause_t cause, uint32_t excReturn, uint32_t msp);
+
+#endif
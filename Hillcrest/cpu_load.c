@@ -0,0 +1,294 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Synthetic CPU load.  See cpu_load.h.
+ */
+
+#include "cpu_load.h"
+
+#if CPU_LOAD
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "cmsis_os.h"
+#include "stm32f4xx_hal.h"
+#include "sensor_app.h"
+#include "sensor_stats.h"
+#include "cycle_budget.h"
+#include "shell.h"
+#include "rtos_static.h"
+#include "priorities.h"
+
+#ifndef CPU_LOAD_STACK
+#define CPU_LOAD_STACK (192)
+#endif
+
+// A gap this long [cycles] between two reads of the cycle counter in the
+// burn loop means something else ran: it doesn't count as burned
+#define PREEMPT_CYCLES (100)
+
+#define PERIOD_TICKS (CPU_LOAD_PERIOD_MS / portTICK_PERIOD_MS)
+
+// ------------------------------------------------------------------------
+// Private types
+
+// Failure counters, compared between sweep steps
+typedef struct {
+    uint32_t lost;        // reports missing, all sensors
+    uint32_t overflows;   // sensor ring full
+    uint32_t overruns;    // cycle budgets
+} LoadHealth_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void loadTask(const void *params);
+static void burn(uint32_t cycles);
+static void measure(TickType_t now);
+static void sweepStep(TickType_t now);
+static void getHealth(LoadHealth_t *pHealth);
+static void start(uint32_t pct, bool sweep, osPriority prio);
+static bool parsePrio(const char *s, osPriority *pPrio);
+static void loadCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+RTOS_STACK_DEF(loadTaskStack, CPU_LOAD_STACK);
+static osThreadId loadTaskHandle;
+
+static volatile uint32_t sharePct;      // requested, 0: idle
+static volatile bool sweeping;
+static osPriority priority = PRIO_TASK_LOAD;
+
+// Share actually burned over the last second, in tenths of a percent
+static uint64_t windowBurned;
+static TickType_t windowStart;
+static volatile uint32_t achieved;
+
+static TickType_t stepStart;
+static LoadHealth_t stepHealth;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void cpuLoad_init(void)
+{
+    osThreadDef(loadThreadDef, loadTask, PRIO_TASK_LOAD, 0, CPU_LOAD_STACK);
+    loadTaskHandle = rtos_threadCreate(osThread(loadThreadDef), NULL,
+                                       RTOS_STACK(loadTaskStack));
+    if (loadTaskHandle == NULL) {
+        printf("Failed to create load task.\n");
+        return;
+    }
+
+    shell_addCommand("load", "[<pct> [prio] | sweep [prio] | off] synthetic CPU load", loadCmd);
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static void loadTask(const void *params)
+{
+    uint32_t cyclesPerPeriod = (HAL_RCC_GetHCLKFreq() / 1000) * CPU_LOAD_PERIOD_MS;
+
+    for (;;) {
+        if (sharePct == 0) {
+            achieved = 0;
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            windowStart = xTaskGetTickCount();
+            windowBurned = 0;
+            stepStart = windowStart;
+            continue;
+        }
+
+        TickType_t period = xTaskGetTickCount();
+        uint32_t cycles = (uint32_t)(((uint64_t)cyclesPerPeriod * sharePct) / 100);
+        burn(cycles);
+        windowBurned += cycles;
+
+        TickType_t now = xTaskGetTickCount();
+        measure(now);
+        if (sweeping) {
+            sweepStep(now);
+        }
+
+        // Sleep out the period, or until the command changes the load.
+        // A period stretched by higher priorities still sleeps a tick,
+        // so the shell can turn the load off.
+        TickType_t spent = now - period;
+        ulTaskNotifyTake(pdTRUE, (spent < PERIOD_TICKS - 1) ? (PERIOD_TICKS - spent) : 1);
+    }
+}
+
+// Spin until this task has run for the given cycles
+static void burn(uint32_t cycles)
+{
+    uint32_t last = DWT->CYCCNT;
+    uint32_t done = 0;
+
+    while (done < cycles) {
+        uint32_t now = DWT->CYCCNT;
+        uint32_t delta = now - last;
+        if (delta < PREEMPT_CYCLES) {
+            done += delta;
+        }
+        last = now;
+    }
+}
+
+// Update the achieved share once a second
+static void measure(TickType_t now)
+{
+    TickType_t elapsed = now - windowStart;
+
+    if (elapsed >= 1000 / portTICK_PERIOD_MS) {
+        uint64_t total = (uint64_t)(HAL_RCC_GetHCLKFreq() / 1000) * elapsed * portTICK_PERIOD_MS;
+        achieved = (uint32_t)(windowBurned * 1000 / total);
+        windowBurned = 0;
+        windowStart = now;
+    }
+}
+
+// At the end of each step, stop if the pipeline suffered, else go up
+static void sweepStep(TickType_t now)
+{
+    LoadHealth_t h;
+
+    if (now - stepStart < CPU_LOAD_STEP_MS / portTICK_PERIOD_MS) {
+        return;
+    }
+
+    getHealth(&h);
+    uint32_t lost = h.lost - stepHealth.lost;
+    uint32_t overflows = h.overflows - stepHealth.overflows;
+    uint32_t overruns = h.overruns - stepHealth.overruns;
+
+    printf("Load %3u%%: burned %u.%u%%, %u lost, %u ring overflows, %u budget overruns.\n",
+           (unsigned)sharePct, (unsigned)(achieved / 10), (unsigned)(achieved % 10),
+           (unsigned)lost, (unsigned)overflows, (unsigned)overruns);
+
+    if (lost || overflows || overruns) {
+        printf("Headroom: %u%% of CPU at this priority.\n",
+               (unsigned)(sharePct - CPU_LOAD_STEP_PCT));
+        sweeping = false;
+        sharePct = 0;
+    }
+    else if (sharePct + CPU_LOAD_STEP_PCT > CPU_LOAD_MAX_PCT) {
+        printf("Headroom: at least %u%% of CPU at this priority.\n", (unsigned)sharePct);
+        sweeping = false;
+        sharePct = 0;
+    }
+    else {
+        sharePct += CPU_LOAD_STEP_PCT;
+        stepHealth = h;
+        stepStart = now;
+    }
+}
+
+static void getHealth(LoadHealth_t *pHealth)
+{
+    SensorStatsSummary_t sum;
+    uint32_t highWater;
+
+    pHealth->lost = 0;
+    for (unsigned id = 1; id <= SH2_MAX_SENSOR_ID; id++) {
+        if (sensorStats_get((sh2_SensorId_t)id, &sum)) {
+            pHealth->lost += sum.lost;
+        }
+    }
+    sensorApp_getRingStats(&pHealth->overflows, &highWater);
+    pHealth->overruns = cycleBudget_overruns();
+}
+
+static void start(uint32_t pct, bool sweep, osPriority prio)
+{
+    // The task picks the new share up at its next period
+    priority = prio;
+    vTaskPrioritySet(loadTaskHandle, (UBaseType_t)(prio - osPriorityIdle));
+    getHealth(&stepHealth);
+    stepStart = xTaskGetTickCount();
+    sweeping = sweep;
+    sharePct = pct;
+    xTaskNotifyGive(loadTaskHandle);
+}
+
+// Priority by name, as in priorities.h.  Returns false if unknown.
+static bool parsePrio(const char *s, osPriority *pPrio)
+{
+    static const struct {
+        const char *name;
+        osPriority prio;
+    } prios[] = {
+        {"idle", osPriorityIdle},
+        {"low", osPriorityLow},
+        {"below", osPriorityBelowNormal},
+        {"normal", osPriorityNormal},
+        {"above", osPriorityAboveNormal},
+        {"high", osPriorityHigh},
+    };
+
+    for (unsigned n = 0; n < sizeof(prios) / sizeof(prios[0]); n++) {
+        if (strcmp(s, prios[n].name) == 0) {
+            *pPrio = prios[n].prio;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void loadCmd(int argc, char *argv[])
+{
+    osPriority prio = PRIO_TASK_LOAD;
+    unsigned pct;
+
+    if (argc == 1) {
+        printf("Load %u%% at priority %d%s, burned %u.%u%% over the last second.\n",
+               (unsigned)sharePct, (int)(priority - osPriorityIdle),
+               sweeping ? " (sweep)" : "",
+               (unsigned)(achieved / 10), (unsigned)(achieved % 10));
+        return;
+    }
+
+    bool sweep = (strcmp(argv[1], "sweep") == 0);
+    int prioArg = sweep ? 2 : 3;
+    if ((argc > prioArg) && !parsePrio(argv[prioArg], &prio)) {
+        printf("Priority: idle, low, below, normal, above or high.\n");
+        return;
+    }
+
+    if (strcmp(argv[1], "off") == 0) {
+        start(0, false, priority);
+    }
+    else if (sweep) {
+        printf("Sweeping load from %u%%, %u ms a step.\n",
+               (unsigned)CPU_LOAD_STEP_PCT, (unsigned)CPU_LOAD_STEP_MS);
+        start(CPU_LOAD_STEP_PCT, true, prio);
+    }
+    else if ((sscanf(argv[1], "%u", &pct) == 1) && (pct <= CPU_LOAD_MAX_PCT)) {
+        start(pct, false, prio);
+    }
+    else {
+        printf("usage: %s [<pct> [prio] | sweep [prio] | off]\n", argv[0]);
+    }
+}
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Synthetic CPU load, to measure headroom at a sensor configuration.
+ *
+ * A load task burns a set share of the CPU at a chosen priority, in
+ * CPU_LOAD_PERIOD_MS periods, standing in for application code.  Only
+ * the cycles it actually runs count towards the share, so time taken by
+ * interrupts and higher priority tasks doesn't shrink the load.
+ *
+ * "load sweep" raises the share a step at a time while the sensors run
+ * and stops at the first step where reports go missing, the sensor ring
+ * overflows or a cycle budget is overrun: the last clean step is the
+ * headroom.
+ */
+
+#ifndef CPU_LOAD_H
+#define CPU_LOAD_H
+
+// Set to 0 to leave the load task out.
+#ifndef CPU_LOAD
+#define CPU_LOAD (1)
+#endif
+
+// Burn period [ms].  The share is burned at the start of each one.
+#ifndef CPU_LOAD_PERIOD_MS
+#define CPU_LOAD_PERIOD_MS (10)
+#endif
+
+// Sweep: share added per step [%], time held at each step [ms], and the
+// share it gives up at
+#ifndef CPU_LOAD_STEP_PCT
+#define CPU_LOAD_STEP_PCT (5)
+#endif
+#ifndef CPU_LOAD_STEP_MS
+#define CPU_LOAD_STEP_MS (5000)
+#endif
+#ifndef CPU_LOAD_MAX_PCT
+#define CPU_LOAD_MAX_PCT (95)
+#endif
+
+#if CPU_LOAD
+
+// Create the load task, idle, and register the "load" console command.
+void cpuLoad_init(void);
+
+#else
+
+#define cpuLoad_init()
+
+#endif
+
+#endif
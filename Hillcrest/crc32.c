@@ -0,0 +1,76 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "crc32.h"
+
+#include <string.h>
+#if CRC32_HW
+#include "stm32f4xx_hal.h"
+#endif
+
+// ------------------------------------------------------------------------
+// Public API
+
+void crc32_init(void)
+{
+#if CRC32_HW
+    __HAL_RCC_CRC_CLK_ENABLE();
+#endif
+}
+
+uint32_t crc32(const uint8_t *p, unsigned len)
+{
+#if CRC32_HW
+    uint32_t primask = __get_PRIMASK();
+    uint32_t crc;
+
+    __disable_irq();
+    CRC->CR = CRC_CR_RESET;
+    while (len >= 4) {
+        uint32_t w;
+
+        // Frames are byte aligned; the M4 loads unaligned words
+        memcpy(&w, p, 4);
+        CRC->DR = __REV(w);
+        p += 4;
+        len -= 4;
+    }
+    crc = CRC->DR;
+    __set_PRIMASK(primask);
+
+    return crc32_sw(crc, p, len);
+#else
+    return crc32_sw(CRC32_INIT, p, len);
+#endif
+}
+
+uint32_t crc32_sw(uint32_t crc, const uint8_t *p, unsigned len)
+{
+    while (len--) {
+        crc ^= (uint32_t)(*p++) << 24;
+        for (int bit = 0; bit < 8; bit++) {
+            if (crc & 0x80000000) {
+                crc = (crc << 1) ^ 0x04C11DB7;
+            }
+            else {
+                crc = crc << 1;
+            }
+        }
+    }
+
+    return crc;
+}
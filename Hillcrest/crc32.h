@@ -0,0 +1,51 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * CRC-32/MPEG-2 (poly 0x04C11DB7, init 0xFFFFFFFF, not reflected, no
+ * final xor): the one the STM32F4 CRC unit computes.
+ *
+ * crc32() feeds whole words to the CRC unit, byte swapped so that bytes
+ * go in in memory order, and finishes the last 0-3 bytes in software.
+ * A 30 byte frame costs tens of cycles rather than the hundreds of a
+ * bitwise CRC.  The unit has no init register and is shared, so each
+ * call resets it and runs with interrupts off (a microsecond or so for
+ * a frame).  Built for the host (CRC32_HW 0), all of it is software.
+ */
+
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stdint.h>
+
+// Use the CRC unit
+#ifndef CRC32_HW
+#define CRC32_HW (1)
+#endif
+
+#define CRC32_INIT (0xFFFFFFFF)
+
+// Enable the CRC unit's clock.
+void crc32_init(void);
+
+// CRC of len bytes at p, from CRC32_INIT.
+uint32_t crc32(const uint8_t *p, unsigned len);
+
+// Continue crc over len bytes at p in software.  Start with CRC32_INIT.
+uint32_t crc32_sw(uint32_t crc, const uint8_t *p, unsigned len);
+
+#endif
@@ -0,0 +1,200 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Cycle budgets
+ */
+
+#include "cycle_budget.h"
+
+#if CYCLE_BUDGET
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stm32f4xx_hal.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "timebase.h"
+#include "shell.h"
+#include "sysstats.h"
+
+// ------------------------------------------------------------------------
+// Private types
+
+// Overruns of one stage, and the worst of them
+typedef struct {
+    uint32_t overruns;
+    uint32_t worstCycles;
+    uint32_t worstArg;
+    uint32_t worstIrq;        // IRQ number + 1, or 0 in a task
+    const char *worstTask;    // task it ran in, 0 before the scheduler
+    uint64_t worst_uS;
+} BudgetStats_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void budgetCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static const char * const stageName[BUDGET_NUM_STAGES] = {
+    [BUDGET_STAGE_ISR] = "isr",
+    [BUDGET_STAGE_XFER] = "xfer",
+    [BUDGET_STAGE_DECODE] = "decode",
+    [BUDGET_STAGE_DISPATCH] = "dispatch",
+    [BUDGET_STAGE_EKF] = "ekf",
+};
+
+static const uint32_t defaultUs[BUDGET_NUM_STAGES] = {
+    [BUDGET_STAGE_ISR] = CYCLE_BUDGET_ISR_US,
+    [BUDGET_STAGE_XFER] = CYCLE_BUDGET_XFER_US,
+    [BUDGET_STAGE_DECODE] = CYCLE_BUDGET_DECODE_US,
+    [BUDGET_STAGE_DISPATCH] = CYCLE_BUDGET_DISPATCH_US,
+    [BUDGET_STAGE_EKF] = CYCLE_BUDGET_EKF_US,
+};
+
+static BudgetStats_t stats[BUDGET_NUM_STAGES];
+static uint32_t limitUs[BUDGET_NUM_STAGES];
+static uint32_t overruns;    // all stages, for sysstats
+
+// ------------------------------------------------------------------------
+// Public API
+
+uint32_t cycleBudget_limit[BUDGET_NUM_STAGES];
+
+void cycleBudget_init(void)
+{
+    for (unsigned n = 0; n < BUDGET_NUM_STAGES; n++) {
+        cycleBudget_setLimit((BudgetStage_t)n, defaultUs[n]);
+    }
+
+    sysstats_addCounter("budget overruns", &overruns);
+    shell_addCommand("budget", "[clear | <stage> <us>] hot path cycle budgets", budgetCmd);
+}
+
+uint32_t cycleBudget_overruns(void)
+{
+    return overruns;
+}
+
+void cycleBudget_overrun(BudgetStage_t stage, uint32_t cycles, uint32_t arg)
+{
+    BudgetStats_t *s = &stats[stage];
+    uint32_t irq = __get_IPSR() & 0x1FF;
+    const char *task = 0;
+
+    if ((irq == 0) && (xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED)) {
+        task = pcTaskGetTaskName(0);
+    }
+
+    // Stages end in ISRs and tasks alike
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    s->overruns++;
+    overruns++;
+    if (cycles > s->worstCycles) {
+        s->worstCycles = cycles;
+        s->worstArg = arg;
+        s->worstIrq = irq ? (irq - 16 + 1) : 0;
+        s->worstTask = task;
+        s->worst_uS = timebase_getUs();
+    }
+    __set_PRIMASK(primask);
+}
+
+void cycleBudget_setLimit(BudgetStage_t stage, uint32_t us)
+{
+    limitUs[stage] = us;
+    cycleBudget_limit[stage] = us * (HAL_RCC_GetHCLKFreq() / 1000000);
+}
+
+uint32_t cycleBudget_limitUs(BudgetStage_t stage)
+{
+    return limitUs[stage];
+}
+
+uint32_t cycleBudget_worstCycles(BudgetStage_t stage)
+{
+    return stats[stage].worstCycles;
+}
+
+void cycleBudget_clear(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    memset(stats, 0, sizeof(stats));
+    overruns = 0;
+    __set_PRIMASK(primask);
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static void budgetCmd(int argc, char *argv[])
+{
+    if ((argc == 2) && (strcmp(argv[1], "clear") == 0)) {
+        cycleBudget_clear();
+        return;
+    }
+
+    if (argc == 3) {
+        for (unsigned n = 0; n < BUDGET_NUM_STAGES; n++) {
+            if (strcmp(argv[1], stageName[n]) == 0) {
+                cycleBudget_setLimit((BudgetStage_t)n, (uint32_t)strtoul(argv[2], 0, 0));
+                return;
+            }
+        }
+    }
+
+    if (argc != 1) {
+        printf("usage: %s [clear | isr|xfer|decode|dispatch <us>]\n", argv[0]);
+        return;
+    }
+
+    uint32_t cyclesPerUs = HAL_RCC_GetHCLKFreq() / 1000000;
+
+    printf("stage     budget us  overruns  worst us    arg  in           at ms\n");
+    for (unsigned n = 0; n < BUDGET_NUM_STAGES; n++) {
+        BudgetStats_t s;
+
+        __disable_irq();
+        s = stats[n];
+        __enable_irq();
+
+        printf("%-9s %9u %9u", stageName[n], (unsigned)limitUs[n], (unsigned)s.overruns);
+        if (s.overruns == 0) {
+            printf("\n");
+            continue;
+        }
+
+        char where[16];
+        if (s.worstIrq) {
+            snprintf(where, sizeof(where), "irq %u", (unsigned)(s.worstIrq - 1));
+        }
+        else {
+            snprintf(where, sizeof(where), "%s", s.worstTask ? s.worstTask : "main");
+        }
+        printf(" %9u %6u  %-12s %u\n",
+               (unsigned)(s.worstCycles / cyclesPerUs), (unsigned)s.worstArg,
+               where, (unsigned)(s.worst_uS / 1000));
+    }
+}
+
+#endif
@@ -0,0 +1,122 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Cycle budgets for the stages of the sensor report path.
+ *
+ * Each instrumented stage is timed with the DWT cycle counter against a
+ * budget.  Within budget that costs a subtract and a compare; an overrun
+ * is counted, and the worst one is kept with its context (argument,
+ * task or IRQ, time) for the "budget" command.  Unlike the latency
+ * tracer this is meant to stay in release builds.
+ */
+
+#ifndef CYCLE_BUDGET_H
+#define CYCLE_BUDGET_H
+
+#include <stdint.h>
+#include "stm32f4xx.h"
+
+// Set to 0 to compile the checks out.
+#ifndef CYCLE_BUDGET
+#define CYCLE_BUDGET (1)
+#endif
+
+// Budgets at startup [us], converted to cycles at the core clock
+#ifndef CYCLE_BUDGET_ISR_US
+#define CYCLE_BUDGET_ISR_US (10)
+#endif
+#ifndef CYCLE_BUDGET_XFER_US
+#define CYCLE_BUDGET_XFER_US (1000)
+#endif
+#ifndef CYCLE_BUDGET_DECODE_US
+#define CYCLE_BUDGET_DECODE_US (200)
+#endif
+#ifndef CYCLE_BUDGET_DISPATCH_US
+#define CYCLE_BUDGET_DISPATCH_US (300)
+#endif
+#ifndef CYCLE_BUDGET_EKF_US
+#define CYCLE_BUDGET_EKF_US (100)
+#endif
+
+typedef enum {
+    BUDGET_STAGE_ISR = 0,    // EXTI line served, INTN included.  arg: pin
+    BUDGET_STAGE_XFER,       // HAL bus transfer, start to done.  arg: length
+    BUDGET_STAGE_DECODE,     // SHTP and SH-2 decode of a transfer.  arg: length
+    BUDGET_STAGE_DISPATCH,   // sensor task handling one report.  arg: sensor id
+    BUDGET_STAGE_EKF,        // one EKF step (sensor_ekf.h).  arg: sensor id, 0 external
+    BUDGET_NUM_STAGES
+} BudgetStage_t;
+
+#if CYCLE_BUDGET
+
+// Budget of each stage [cycles].  Read by cycleBudget_check().
+extern uint32_t cycleBudget_limit[BUDGET_NUM_STAGES];
+
+// Register the "budget" command and the overrun counter.  Call after the
+// clock is configured.
+void cycleBudget_init(void);
+
+// Overruns of every stage since they were last cleared.
+uint32_t cycleBudget_overruns(void);
+
+// Set and read a stage's budget [us], as "budget <stage> <us>" does.
+// A budget of 0 makes every run an overrun, so the worst is the stage's
+// longest run.
+void cycleBudget_setLimit(BudgetStage_t stage, uint32_t us);
+uint32_t cycleBudget_limitUs(BudgetStage_t stage);
+
+// Longest overrun of stage since the statistics were cleared [cycles],
+// 0 if none.
+uint32_t cycleBudget_worstCycles(BudgetStage_t stage);
+
+// Clear the overrun statistics, as "budget clear" does.
+void cycleBudget_clear(void);
+
+// Use cycleBudget_check() rather than calling this.
+void cycleBudget_overrun(BudgetStage_t stage, uint32_t cycles, uint32_t arg);
+
+// Start timing a stage.
+static inline uint32_t cycleBudget_start(void)
+{
+    return DWT->CYCCNT;
+}
+
+// End a stage started at start, from a task or an ISR.
+static inline void cycleBudget_check(BudgetStage_t stage, uint32_t start, uint32_t arg)
+{
+    uint32_t cycles = DWT->CYCCNT - start;
+
+    if (cycles > cycleBudget_limit[stage]) {
+        cycleBudget_overrun(stage, cycles, arg);
+    }
+}
+
+#else
+
+#define cycleBudget_init()
+#define cycleBudget_overruns() (0)
+#define cycleBudget_setLimit(stage, us)
+#define cycleBudget_limitUs(stage) (0)
+#define cycleBudget_worstCycles(stage) (0)
+#define cycleBudget_clear()
+#define cycleBudget_start() (0)
+#define cycleBudget_check(stage, start, arg) ((void)(start))
+
+#endif
+
+#endif
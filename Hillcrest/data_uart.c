@@ -0,0 +1,243 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Data UART: binary sensor frames on USART1.
+ */
+
+#include "data_uart.h"
+
+#if DATA_UART
+
+#include <stdio.h>
+#include <string.h>
+#include "stm32f4xx_hal.h"
+#include "shell.h"
+#include "sysstats.h"
+#include "power.h"
+#include "placement.h"
+#include "priorities.h"
+
+#define TX_PORT   GPIOB
+#define TX_PIN    GPIO_PIN_6
+
+#define TX_STREAM DMA2_Stream7
+#define TX_FLAGS  (DMA_HIFCR_CTCIF7 | DMA_HIFCR_CHTIF7 | DMA_HIFCR_CTEIF7 | \
+                   DMA_HIFCR_CDMEIF7 | DMA_HIFCR_CFEIF7)
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static uint32_t dataLock(void);
+static void dataUnlock(uint32_t was);
+static void startTx(void);
+static void dataUartCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static bool routed;
+
+// Double buffered output, filled under dataLock()
+DMA_BUF static uint8_t txBuf[2][DATA_UART_BUFLEN];
+static volatile unsigned txLen[2];
+static unsigned phase;                  // buffer being filled, the other may be sending
+static volatile bool txActive;
+
+static uint32_t frames;
+static uint32_t bytes;
+static uint32_t dropped;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void dataUart_init(void)
+{
+    GPIO_InitTypeDef GPIO_InitStruct;
+    uint32_t pclk = HAL_RCC_GetPCLK2Freq();
+
+    __GPIOB_CLK_ENABLE();
+    __USART1_CLK_ENABLE();
+    __DMA2_CLK_ENABLE();
+
+    memset(&GPIO_InitStruct, 0, sizeof(GPIO_InitStruct));
+    GPIO_InitStruct.Pin = TX_PIN;
+    GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+    GPIO_InitStruct.Pull = GPIO_PULLUP;
+    GPIO_InitStruct.Speed = GPIO_SPEED_HIGH;
+    GPIO_InitStruct.Alternate = GPIO_AF7_USART1;
+    HAL_GPIO_Init(TX_PORT, &GPIO_InitStruct);
+
+    // 8N1, 16x oversampling: BRR is PCLK2 / baud, rounded
+    USART1->CR1 = 0;
+    USART1->CR2 = 0;
+    USART1->BRR = (pclk + DATA_UART_BAUD / 2) / DATA_UART_BAUD;
+    USART1->CR3 = USART_CR3_DMAT;
+    USART1->CR1 = USART_CR1_UE | USART_CR1_TE;
+
+    TX_STREAM->CR = 0;
+    while (TX_STREAM->CR & DMA_SxCR_EN) {
+    }
+    DMA2->HIFCR = TX_FLAGS;
+    TX_STREAM->PAR = (uint32_t)&USART1->DR;
+    TX_STREAM->FCR = 0;
+    TX_STREAM->CR = DMA_CHANNEL_4 | DMA_MEMORY_TO_PERIPH | DMA_MINC_ENABLE |
+                    DMA_PRIORITY_LOW | DMA_SxCR_TCIE | DMA_SxCR_TEIE;
+
+    HAL_NVIC_SetPriority(DMA2_Stream7_IRQn, PRIO_IRQ_CONSOLE, 0);
+    HAL_NVIC_EnableIRQ(DMA2_Stream7_IRQn);
+    HAL_NVIC_SetPriority(USART1_IRQn, PRIO_IRQ_CONSOLE, 0);
+    HAL_NVIC_EnableIRQ(USART1_IRQn);
+
+    txLen[0] = 0;
+    txLen[1] = 0;
+    phase = 0;
+    txActive = false;
+    routed = true;
+
+    sysstats_addMemory("data uart buffers", sizeof(txBuf));
+    sysstats_addCounter("data uart drops", &dropped);
+    shell_addCommand("datauart", "[on | off] binary frames on USART1", dataUartCmd);
+}
+
+bool dataUart_active(void)
+{
+    return routed;
+}
+
+HOT_FN bool dataUart_write(const uint8_t *frame, unsigned len)
+{
+    bool queued = false;
+    uint32_t was = dataLock();
+    unsigned fill = txLen[phase];
+
+    if (fill + len <= DATA_UART_BUFLEN) {
+        memcpy(&txBuf[phase][fill], frame, len);
+        txLen[phase] = fill + len;
+        frames++;
+        bytes += len;
+        queued = true;
+
+        if (!txActive) {
+            startTx();
+        }
+    }
+    else {
+        // Both buffers taken: drop the frame whole, never part of one
+        dropped++;
+    }
+
+    dataUnlock(was);
+
+    return queued;
+}
+
+HOT_FN void dataUart_dmaIrq(void)
+{
+    uint32_t isr = DMA2->HISR;
+
+    DMA2->HIFCR = TX_FLAGS;
+    if ((isr & (DMA_HISR_TCIF7 | DMA_HISR_TEIF7)) == 0) {
+        return;
+    }
+
+    if (txLen[phase] != 0) {
+        startTx();
+    }
+    else {
+        // Idle once the last byte leaves the shift register
+        txActive = false;
+        USART1->CR1 |= USART_CR1_TCIE;
+    }
+}
+
+void dataUart_uartIrq(void)
+{
+    if ((USART1->CR1 & USART_CR1_TCIE) && (USART1->SR & USART_SR_TC)) {
+        USART1->CR1 &= ~USART_CR1_TCIE;
+        if (!txActive) {
+            power_release(POWER_HOLD_DATA_UART);
+        }
+    }
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+// Mask the data UART interrupts, and everything at or below the console,
+// as consoleLock() does.  Never lowers a mask already in place.
+static uint32_t dataLock(void)
+{
+    uint32_t was = __get_BASEPRI();
+    uint32_t level = PRIO_IRQ_CONSOLE << (8 - __NVIC_PRIO_BITS);
+
+    if ((was == 0) || (was > level)) {
+        __set_BASEPRI(level);
+        __DSB();
+        __ISB();
+    }
+
+    return was;
+}
+
+static void dataUnlock(uint32_t was)
+{
+    __set_BASEPRI(was);
+}
+
+// Send the buffer being filled and start filling the other.  Called
+// locked, or from the DMA ISR.
+HOT_FN static void startTx(void)
+{
+    unsigned send = phase;
+
+    phase = send ? 0 : 1;
+    txLen[phase] = 0;
+
+    txActive = true;
+    power_hold(POWER_HOLD_DATA_UART);
+
+    // TC is cleared by writing 0, so it marks the end of this transfer
+    USART1->SR = ~USART_SR_TC;
+    DMA2->HIFCR = TX_FLAGS;
+    TX_STREAM->M0AR = (uint32_t)txBuf[send];
+    TX_STREAM->NDTR = txLen[send];
+    TX_STREAM->CR |= DMA_SxCR_EN;
+}
+
+static void dataUartCmd(int argc, char *argv[])
+{
+    if (argc > 1) {
+        if (strcmp(argv[1], "on") == 0) {
+            routed = true;
+        }
+        else if (strcmp(argv[1], "off") == 0) {
+            routed = false;
+        }
+        else {
+            printf("usage: %s [on | off]\n", argv[0]);
+            return;
+        }
+    }
+
+    printf("Data UART %s at %u baud: %u frames, %u bytes, %u dropped\n",
+           routed ? "on" : "off (frames to console or USB)",
+           (unsigned)DATA_UART_BAUD, (unsigned)frames, (unsigned)bytes,
+           (unsigned)dropped);
+}
+
+#endif
@@ -0,0 +1,82 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Data UART: binary sensor frames on a link of their own.
+ *
+ * USART1 sends the BIN_OUTPUT stream (sensor_output.h) and nothing
+ * else, so a logger can read framed samples at full rate while USART2
+ * stays the human console, with no shell output, prompts or drop
+ * markers mixed into the data.  Transmit only, 8N1 at DATA_UART_BAUD.
+ *
+ * Frames are copied whole into one of two buffers while DMA sends the
+ * other.  A writer never waits: a frame that doesn't fit in the buffer
+ * being filled is dropped whole and counted, so the stream on the wire
+ * is always whole frames.  Frames carry their own sequence numbers, so
+ * the reader sees where.
+ *
+ * TX on PB6 (AF7, CN10-17 on the Nucleo), DMA2 Stream 7 channel 4.
+ * "datauart [on | off]" routes the stream here or back to the console
+ * or USB and shows the counts.
+ */
+
+#ifndef DATA_UART_H
+#define DATA_UART_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Build in the data UART
+#ifndef DATA_UART
+#define DATA_UART (1)
+#endif
+
+// Data UART baud rate.  USART1 runs from PCLK2, so rates up to a few
+// Mbaud are exact enough; the reader must match.
+#ifndef DATA_UART_BAUD
+#define DATA_UART_BAUD (921600)
+#endif
+
+// Each of the two tx buffers holds this many milliseconds of output at
+// DATA_UART_BAUD (10 bits per byte).
+#ifndef DATA_UART_BUF_MS
+#define DATA_UART_BUF_MS (10)
+#endif
+
+#define DATA_UART_BUFLEN_MIN (128)
+#define DATA_UART_BUFLEN_LINK ((DATA_UART_BAUD / 10) * DATA_UART_BUF_MS / 1000)
+#define DATA_UART_BUFLEN \
+    ((DATA_UART_BUFLEN_LINK > DATA_UART_BUFLEN_MIN) ? \
+     DATA_UART_BUFLEN_LINK : DATA_UART_BUFLEN_MIN)
+
+// Set up USART1, its pin and DMA stream, and the "datauart" command.
+// The stream is routed here from the start.
+void dataUart_init(void);
+
+// True while binary frames should be written here rather than to the
+// console or USB.
+bool dataUart_active(void);
+
+// Queue one whole frame.  False if it was dropped for want of room.
+// Never blocks; safe from any task.
+bool dataUart_write(const uint8_t *frame, unsigned len);
+
+// Call from DMA2_Stream7_IRQHandler and USART1_IRQHandler.
+void dataUart_dmaIrq(void);
+void dataUart_uartIrq(void);
+
+#endif
@@ -23,10 +23,16 @@
 #include "dbg.h"
 
 #include "stm32f4xx_hal.h"
+#include "itm.h"
+#include "gpio_fast.h"
 
 #define DEBUG_GPIO_PORT GPIOB
 #define DEBUG_GPIO_PIN  GPIO_PIN_3
 
+// With ITM_TRACE, PB3 is SWO and the pulses are dropped.
+#if !ITM_TRACE
+static const GpioPin_t dbgPin = {DEBUG_GPIO_PORT, DEBUG_GPIO_PIN};
+
 void dbgInit()
 {
   GPIO_InitTypeDef GPIO_InitStruct;
@@ -41,20 +47,27 @@ void dbgInit()
 
 void dbgPulse(unsigned count)
 {
+	// One store per edge, so each pulse is a couple of cycles wide
 	for (unsigned n = 0; n < count; n++) {
-		HAL_GPIO_WritePin(DEBUG_GPIO_PORT, DEBUG_GPIO_PIN, GPIO_PIN_SET);
-		HAL_GPIO_WritePin(DEBUG_GPIO_PORT, DEBUG_GPIO_PIN, GPIO_PIN_RESET);
+		gpioFast_set(&dbgPin);
+		gpioFast_clr(&dbgPin);
 	}
 }
 
 void dbgSet()
 {
-	HAL_GPIO_WritePin(DEBUG_GPIO_PORT, DEBUG_GPIO_PIN, GPIO_PIN_SET);
+	gpioFast_set(&dbgPin);
 }
 
 void dbgClr()
 {
-	HAL_GPIO_WritePin(DEBUG_GPIO_PORT, DEBUG_GPIO_PIN, GPIO_PIN_RESET);
+	gpioFast_clr(&dbgPin);
 }
+#else
+void dbgInit() {}
+void dbgPulse(unsigned count) {}
+void dbgSet() {}
+void dbgClr() {}
+#endif
 
      
@@ -0,0 +1,341 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Firmware update of several hubs at once.  See dfu_multi.h.
+ */
+
+#include "dfu_multi.h"
+
+#if DFU_MULTI
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+#include "cmsis_os.h"
+#include "sh2_err.h"
+#include "crc16.h"
+#include "timebase.h"
+#include "rtos_static.h"
+#include "priorities.h"
+
+#ifndef DFU_MULTI_STACK
+#define DFU_MULTI_STACK (256)
+#endif
+
+// The bootloader's longest packet, and its acknowledgement
+#define PACKET_MAX (64)
+#define ACK ('s')
+
+// Times a packet is sent before giving up on the hub
+#define PACKET_TRIES (5)
+
+// Window items before the image: its length, and the packet length
+#define PREAMBLE (2)
+
+// ------------------------------------------------------------------------
+// Private types
+
+// A packet as sent, CRC appended
+typedef struct {
+    uint8_t data[PACKET_MAX + 2];
+    uint8_t len;
+} Packet_t;
+
+// One hub being updated, and the task updating it
+typedef struct {
+    unsigned dev;
+    osThreadId task;
+    volatile uint32_t sent;       // window items acknowledged
+    volatile bool done;
+    DfuMultiResult_t *pResult;
+} Worker_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void workerTask(const void *params);
+static int sendPacket(Worker_t *w, Packet_t *p);
+static int fetch(const HcBin_t *image, uint32_t n);
+static uint32_t slowest(void);
+static void report(void);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static Packet_t window[DFU_MULTI_WINDOW];
+static volatile uint32_t fetched;       // window items read so far
+static volatile bool stopping;          // image unreadable: workers give up
+static uint32_t items;                  // window items in all
+static uint32_t appLen;
+static uint8_t packetLen;
+
+static Worker_t workers[SH2_HAL_MAX_DEVICES];
+static unsigned numWorkers;
+static SemaphoreHandle_t progress;      // given by workers after each packet
+
+// ------------------------------------------------------------------------
+// Public API
+
+int dfuMulti_run(const HcBin_t *image, uint32_t devMask,
+                 DfuMultiResult_t results[SH2_HAL_MAX_DEVICES])
+{
+    osThreadDef(dfuThreadDef, workerTask, PRIO_TASK_DFU, 0, DFU_MULTI_STACK);
+    uint64_t start_uS = timebase_getUs();
+    uint64_t report_uS = start_uS + DFU_MULTI_REPORT_MS * 1000ULL;
+    int status = SH2_OK;
+
+    memset(results, 0, SH2_HAL_MAX_DEVICES * sizeof(results[0]));
+    devMask &= (1u << sh2_hal_numDevices()) - 1;
+    if (devMask == 0) {
+        return SH2_ERR_BAD_PARAM;
+    }
+    for (unsigned dev = 0; dev < SH2_HAL_MAX_DEVICES; dev++) {
+        if (devMask & (1u << dev)) {
+            // Until its worker says otherwise
+            results[dev].status = SH2_ERR;
+        }
+    }
+    if (progress == 0) {
+        progress = xSemaphoreCreateBinary();
+    }
+
+    if (image->open() != 0) {
+        printf("DFU: image won't open\n");
+        return SH2_ERR_IO;
+    }
+    appLen = image->getAppLen();
+    packetLen = PACKET_MAX;
+    if ((image->getPacketLen() != 0) && (image->getPacketLen() < PACKET_MAX)) {
+        packetLen = (uint8_t)image->getPacketLen();
+    }
+    if (appLen == 0) {
+        image->close();
+        return SH2_ERR_BAD_PARAM;
+    }
+    items = PREAMBLE + (appLen + packetLen - 1) / packetLen;
+    fetched = 0;
+    stopping = false;
+
+    numWorkers = 0;
+    for (unsigned dev = 0; dev < SH2_HAL_MAX_DEVICES; dev++) {
+        if ((devMask & (1u << dev)) == 0) {
+            continue;
+        }
+        Worker_t *w = &workers[numWorkers];
+        w->dev = dev;
+        w->sent = 0;
+        w->done = false;
+        w->pResult = &results[dev];
+        w->task = rtos_threadCreate(osThread(dfuThreadDef), w, 0);
+        if (w->task == 0) {
+            continue;
+        }
+        numWorkers++;
+    }
+    printf("DFU: %u bytes to %u hubs\n", (unsigned)appLen, numWorkers);
+
+    while (1) {
+        // Read ahead as far as the slowest hub allows
+        while ((fetched < items) && !stopping && (fetched < slowest() + DFU_MULTI_WINDOW)) {
+            if (fetch(image, fetched) != 0) {
+                printf("DFU: image unreadable at item %u\n", (unsigned)fetched);
+                stopping = true;
+                break;
+            }
+            fetched++;
+            for (unsigned n = 0; n < numWorkers; n++) {
+                xTaskNotifyGive(workers[n].task);
+            }
+        }
+        if (stopping) {
+            for (unsigned n = 0; n < numWorkers; n++) {
+                xTaskNotifyGive(workers[n].task);
+            }
+        }
+
+        bool running = false;
+        for (unsigned n = 0; n < numWorkers; n++) {
+            running |= !workers[n].done;
+        }
+        if (!running) {
+            break;
+        }
+
+        xSemaphoreTake(progress, pdMS_TO_TICKS(DFU_MULTI_REPORT_MS));
+        if (timebase_getUs() >= report_uS) {
+            report();
+            report_uS += DFU_MULTI_REPORT_MS * 1000ULL;
+        }
+    }
+    image->close();
+
+    for (unsigned dev = 0; dev < SH2_HAL_MAX_DEVICES; dev++) {
+        DfuMultiResult_t *r = &results[dev];
+        if ((devMask & (1u << dev)) == 0) {
+            continue;
+        }
+        printf("DFU %s %u: status %d, %u bytes in %u ms, %u packets resent\n",
+               sh2_hal_devName(dev), dev, r->status, (unsigned)r->bytes,
+               (unsigned)(r->time_us / 1000), (unsigned)r->resends);
+        if ((status == SH2_OK) && (r->status != SH2_OK)) {
+            status = r->status;
+        }
+    }
+    if (stopping && (status == SH2_OK)) {
+        status = SH2_ERR_IO;
+    }
+    printf("DFU: all done in %u ms\n", (unsigned)((timebase_getUs() - start_uS) / 1000));
+
+    return status;
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+// Update one hub from the window, then reset it out of the bootloader.
+static void workerTask(const void *params)
+{
+    Worker_t *w = (Worker_t *)params;
+    DfuMultiResult_t *r = w->pResult;
+    uint64_t start_uS = timebase_getUs();
+    int status = sh2_hal_devReset(w->dev, true, 0, 0);
+
+    while ((status == SH2_OK) && (w->sent < items)) {
+        while ((w->sent >= fetched) && !stopping) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        }
+        if (w->sent >= fetched) {
+            status = SH2_ERR_IO;
+            break;
+        }
+
+        Packet_t *p = &window[w->sent % DFU_MULTI_WINDOW];
+        status = sendPacket(w, p);
+        if (status == SH2_OK) {
+            if (w->sent >= PREAMBLE) {
+                r->bytes += p->len - 2;
+            }
+            w->sent++;
+        }
+        xSemaphoreGive(progress);
+    }
+
+    // Into the new firmware, or whatever the hub makes of a partial one
+    sh2_hal_devReset(w->dev, false, 0, 0);
+    r->time_us = (uint32_t)(timebase_getUs() - start_uS);
+    r->status = status;
+    w->done = true;
+    xSemaphoreGive(progress);
+
+    vTaskDelete(NULL);
+}
+
+// Send a packet until the hub acknowledges it.
+static int sendPacket(Worker_t *w, Packet_t *p)
+{
+    int status = SH2_ERR;
+
+    for (int tries = 0; tries < PACKET_TRIES; tries++) {
+        uint8_t ack = 0;
+
+        if (tries > 0) {
+            w->pResult->resends++;
+        }
+        status = sh2_hal_devTx(w->dev, p->data, p->len);
+        if (status == SH2_OK) {
+            status = sh2_hal_devRx(w->dev, &ack, 1);
+        }
+        if ((status == SH2_OK) && (ack == ACK)) {
+            return SH2_OK;
+        }
+        if (status == SH2_OK) {
+            status = SH2_ERR_HUB;
+        }
+    }
+
+    return status;
+}
+
+// Read window item n: the image length, the packet length, then the
+// image a packet at a time.
+static int fetch(const HcBin_t *image, uint32_t n)
+{
+    Packet_t *p = &window[n % DFU_MULTI_WINDOW];
+
+    if (n == 0) {
+        p->data[0] = (uint8_t)(appLen >> 24);
+        p->data[1] = (uint8_t)(appLen >> 16);
+        p->data[2] = (uint8_t)(appLen >> 8);
+        p->data[3] = (uint8_t)appLen;
+        p->len = 4;
+    }
+    else if (n == 1) {
+        p->data[0] = packetLen;
+        p->len = 1;
+    }
+    else {
+        uint32_t offset = (n - PREAMBLE) * packetLen;
+        uint32_t len = appLen - offset;
+
+        if (len > packetLen) {
+            len = packetLen;
+        }
+        if (image->getAppData(p->data, offset, len) != 0) {
+            return -1;
+        }
+        p->len = (uint8_t)len;
+    }
+
+    // CRC-16/CCITT, big-endian
+    uint16_t crc = crc16(CRC16_INIT, p->data, p->len);
+    p->data[p->len++] = (uint8_t)(crc >> 8);
+    p->data[p->len++] = (uint8_t)crc;
+
+    return 0;
+}
+
+// Window items acknowledged by the slowest hub still going
+static uint32_t slowest(void)
+{
+    uint32_t least = fetched;
+
+    for (unsigned n = 0; n < numWorkers; n++) {
+        if (!workers[n].done && (workers[n].sent < least)) {
+            least = workers[n].sent;
+        }
+    }
+
+    return least;
+}
+
+static void report(void)
+{
+    printf("DFU:");
+    for (unsigned n = 0; n < numWorkers; n++) {
+        const Worker_t *w = &workers[n];
+        printf(" %s %u %u%%%s", sh2_hal_devName(w->dev), w->dev,
+               (unsigned)((uint64_t)w->pResult->bytes * 100 / appLen),
+               w->done ? " done" : "");
+    }
+    printf("\n");
+}
+
+#endif
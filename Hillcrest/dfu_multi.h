@@ -0,0 +1,80 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Firmware update of several hubs at once.
+ *
+ * dfu() of the SH-2 library updates the hub behind the sh2_hal API,
+ * device 0, and updating a rig one hub after another takes that long
+ * for each.  dfuMulti_run() speaks the same bootloader protocol (image
+ * length, packet length, then the image a packet at a time, each with
+ * a CRC-16 and acknowledged by the hub) to the devices of a mask
+ * (sh2_hal_registry.h), each from a task of its own.  Hubs on separate
+ * buses transfer at once; hubs sharing an I2C bus take turns, one using
+ * the bus while the other writes its flash (the HAL lets go of the bus
+ * while a busy bootloader NACKs).
+ *
+ * The image is read once, a packet at a time in order, into a window of
+ * DFU_MULTI_WINDOW packets the hubs share, so a source that can only be
+ * read through once (firmware_stream.h) serves them all.  Reading stops
+ * while the slowest hub is a window behind.
+ */
+
+#ifndef DFU_MULTI_H
+#define DFU_MULTI_H
+
+#include <stdint.h>
+
+#include "HcBin.h"
+#include "sh2_hal_registry.h"
+
+// Set to 0 to leave the multi-hub update out: only device 0 is updated.
+#ifndef DFU_MULTI
+#define DFU_MULTI (1)
+#endif
+
+// Packets read ahead of the slowest hub
+#ifndef DFU_MULTI_WINDOW
+#define DFU_MULTI_WINDOW (8)
+#endif
+
+// Interval between progress lines [ms]
+#ifndef DFU_MULTI_REPORT_MS
+#define DFU_MULTI_REPORT_MS (2000)
+#endif
+
+// How one hub's update went
+typedef struct {
+    int status;           // SH2_OK, or the error that stopped it
+    uint32_t bytes;       // of the image acknowledged
+    uint32_t resends;     // packets sent again after a bad acknowledgement
+    uint32_t time_us;     // reset into the bootloader to back out of it
+} DfuMultiResult_t;
+
+#if DFU_MULTI
+
+// Update the devices in devMask (bit n for device n) from image, then
+// reset them into their new firmware.  Prints progress, and each hub's
+// result and the total time at the end.  Returns SH2_OK if every hub
+// was updated, else the first error; results[n] has device n's.  The
+// devices must not be in use: call before SHTP starts, or restart after.
+int dfuMulti_run(const HcBin_t *image, uint32_t devMask,
+                 DfuMultiResult_t results[SH2_HAL_MAX_DEVICES]);
+
+#endif
+
+#endif
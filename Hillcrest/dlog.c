@@ -0,0 +1,311 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Deferred logger.
+ */
+
+#include "dlog.h"
+
+#if DLOG_ENABLE
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "cmsis_os.h"
+#include "priorities.h"
+#include "rtos_static.h"
+#include "sysstats.h"
+#include "spsc.h"
+#include "console.h"
+
+#ifndef LOG_TASK_STACK
+#define LOG_TASK_STACK (384)
+#endif
+
+// Longest conversion specification, e.g. "%-08.3f"
+#define SPEC_LEN (16)
+
+// ------------------------------------------------------------------------
+// Private types
+
+typedef struct {
+    const char *fmt;
+    uint32_t arg[DLOG_MAX_ARGS];
+} DlogRecord_t;
+
+typedef enum {
+    ARG_NONE,     // literal text or %%
+    ARG_INT,      // one word
+    ARG_INT64,    // two words, low first
+    ARG_DOUBLE,   // one word, float bits
+    ARG_STR,      // one word, pointer
+} ArgType_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void logTask(const void *params);
+static const char *nextSpec(const char *p, char *spec, ArgType_t *pType);
+static void formatRecord(char *line, unsigned size, const DlogRecord_t *rec);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+RTOS_STACK_DEF(logTaskStack, LOG_TASK_STACK);
+static osThreadId logTaskHandle;
+
+// Producers fill a slot inside a short critical section, which makes
+// them one producer to the ring; the log task is the only consumer.
+static SPSC_RING(DlogRecord_t, DLOG_RING_LEN) ring;
+static uint32_t drops;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void dlog_init(void)
+{
+    spsc_flush(&ring);
+    drops = 0;
+    sysstats_addMemory("log ring", sizeof(ring));
+
+    osThreadDef(logThreadDef, logTask, PRIO_TASK_LOG, 0, LOG_TASK_STACK);
+    logTaskHandle = rtos_threadCreate(osThread(logThreadDef), NULL, RTOS_STACK(logTaskStack));
+    if (logTaskHandle == NULL) {
+        printf("Failed to create log task.\n");
+    }
+
+    sysstats_addCounter("log drops", &drops);
+}
+
+void dlog_printf(const char *fmt, ...)
+{
+    DlogRecord_t rec;
+    char spec[SPEC_LEN];
+    ArgType_t type;
+    unsigned words = 0;
+    const char *p = fmt;
+    va_list ap;
+
+    va_start(ap, fmt);
+
+    if ((logTaskHandle == NULL) ||
+        (xTaskGetSchedulerState() == taskSCHEDULER_NOT_STARTED)) {
+        // Nobody to hand off to yet
+        vprintf(fmt, ap);
+        va_end(ap);
+        return;
+    }
+
+    // Capture arguments in the form the format string says they have
+    rec.fmt = fmt;
+    while ((*p != 0) && (words < DLOG_MAX_ARGS)) {
+        p = nextSpec(p, spec, &type);
+        switch (type) {
+            case ARG_INT:
+                rec.arg[words++] = va_arg(ap, unsigned);
+                break;
+            case ARG_INT64:
+            {
+                uint64_t v = va_arg(ap, unsigned long long);
+                rec.arg[words++] = (uint32_t)v;
+                if (words < DLOG_MAX_ARGS) {
+                    rec.arg[words++] = (uint32_t)(v >> 32);
+                }
+                break;
+            }
+            case ARG_DOUBLE:
+            {
+                float f = (float)va_arg(ap, double);
+                memcpy(&rec.arg[words++], &f, sizeof(f));
+                break;
+            }
+            case ARG_STR:
+                rec.arg[words++] = (uint32_t)(uintptr_t)va_arg(ap, const char *);
+                break;
+            default:
+                break;
+        }
+    }
+    va_end(ap);
+
+    bool wasEmpty = false;
+    taskENTER_CRITICAL();
+    DlogRecord_t *pSlot = spsc_writeSlot(&ring);
+    if (pSlot == 0) {
+        drops++;
+    }
+    else {
+        wasEmpty = (spsc_count(&ring) == 0);
+        memcpy(pSlot, &rec, offsetof(DlogRecord_t, arg) + words*sizeof(rec.arg[0]));
+        spsc_push(&ring);
+    }
+    taskEXIT_CRITICAL();
+
+    if (wasEmpty) {
+        // Log task may be asleep
+        xTaskNotifyGive(logTaskHandle);
+    }
+}
+
+uint32_t dlog_drops(void)
+{
+    return drops;
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static void logTask(const void *params)
+{
+    static char line[DLOG_LINE_LEN];
+    DlogRecord_t rec;
+    uint32_t reported = 0;
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        DlogRecord_t *pSlot;
+        while ((pSlot = spsc_readSlot(&ring)) != 0) {
+            rec = *pSlot;
+            spsc_pop(&ring);
+
+            // Deferred output streams with the sensor reports, behind
+            // the shell and errors (see console.h)
+            if (drops != reported) {
+                int len = snprintf(line, sizeof(line), "[log: %u dropped]\n",
+                                   (unsigned)(drops - reported));
+                console_write(line, len);
+                reported = drops;
+            }
+
+            formatRecord(line, sizeof(line), &rec);
+            console_write(line, strlen(line));
+        }
+    }
+}
+
+// Copy one piece of fmt into spec: literal text up to the next '%', or one
+// conversion specification.  Returns the position after it.
+static const char *nextSpec(const char *p, char *spec, ArgType_t *pType)
+{
+    unsigned n = 0;
+    unsigned longs = 0;
+
+    *pType = ARG_NONE;
+
+    if (*p != '%') {
+        while ((*p != 0) && (*p != '%') && (n < SPEC_LEN-1)) {
+            spec[n++] = *p++;
+        }
+        spec[n] = 0;
+        return p;
+    }
+
+    spec[n++] = *p++;
+    while ((*p != 0) && (n < SPEC_LEN-1)) {
+        char c = *p++;
+        spec[n++] = c;
+
+        if (c == 'l') {
+            longs++;
+        }
+        else if (strchr("diouxXcp", c)) {
+            *pType = (longs > 1) ? ARG_INT64 : ARG_INT;
+            break;
+        }
+        else if (strchr("fFeEgGaA", c)) {
+            *pType = ARG_DOUBLE;
+            break;
+        }
+        else if (c == 's') {
+            *pType = ARG_STR;
+            break;
+        }
+        else if (c == '%') {
+            break;
+        }
+        // otherwise a flag, width, precision or length modifier
+    }
+    spec[n] = 0;
+
+    return p;
+}
+
+static void formatRecord(char *line, unsigned size, const DlogRecord_t *rec)
+{
+    char spec[SPEC_LEN];
+    ArgType_t type;
+    unsigned words = 0;
+    unsigned len = 0;
+    const char *p = rec->fmt;
+    int n;
+
+    while ((*p != 0) && (len < size-1)) {
+        p = nextSpec(p, spec, &type);
+
+        // Arguments that didn't fit in the record print as zero
+        uint32_t a = (words < DLOG_MAX_ARGS) ? rec->arg[words] : 0;
+
+        switch (type) {
+            case ARG_INT:
+                n = snprintf(line+len, size-len, spec, a);
+                words++;
+                break;
+            case ARG_INT64:
+            {
+                uint32_t hi = (words+1 < DLOG_MAX_ARGS) ? rec->arg[words+1] : 0;
+                n = snprintf(line+len, size-len, spec, ((uint64_t)hi << 32) | a);
+                words += 2;
+                break;
+            }
+            case ARG_DOUBLE:
+            {
+                float f;
+                memcpy(&f, &a, sizeof(f));
+                n = snprintf(line+len, size-len, spec, (double)f);
+                words++;
+                break;
+            }
+            case ARG_STR:
+                n = snprintf(line+len, size-len, spec,
+                             (words < DLOG_MAX_ARGS) ? (const char *)(uintptr_t)a : "");
+                words++;
+                break;
+            default:
+                // Literal text, or %%
+                n = snprintf(line+len, size-len, (spec[0] == '%') ? "%%" : "%s", spec);
+                break;
+        }
+
+        if (n > 0) {
+            len += n;
+        }
+    }
+
+    if (len >= size-1) {
+        // Truncated, keep the line ending
+        line[size-2] = '\n';
+        line[size-1] = 0;
+    }
+}
+
+#endif
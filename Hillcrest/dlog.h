@@ -0,0 +1,76 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Deferred logger.
+ * dlog_printf() stores the format pointer and raw arguments in a ring;
+ * a low priority task formats and prints them later.  Callers never
+ * wait for the console, and records that don't fit are counted and
+ * dropped.  The task writes them to the console's bulk channel.
+ */
+
+#ifndef DLOG_H
+#define DLOG_H
+
+#include <stdint.h>
+
+// Set to 0 to make dlog_printf() a plain printf().
+#ifndef DLOG_ENABLE
+#define DLOG_ENABLE (1)
+#endif
+
+// Number of records the ring holds (power of 2)
+#ifndef DLOG_RING_LEN
+#define DLOG_RING_LEN (64)
+#endif
+
+// Argument words per record.  64-bit integers take two.
+#ifndef DLOG_MAX_ARGS
+#define DLOG_MAX_ARGS (10)
+#endif
+
+// Longest formatted line
+#ifndef DLOG_LINE_LEN
+#define DLOG_LINE_LEN (160)
+#endif
+
+#if DLOG_ENABLE
+
+// Create the logger task.  Call before the scheduler starts.
+void dlog_init(void);
+
+// Queue a printf-style message.  Call from tasks, not ISRs.
+// fmt and any %s arguments are formatted later, so they must stay valid
+// (string literals or static storage).  Floats are kept at single
+// precision.  '*' widths and %n are not supported.
+// Before dlog_init() this prints directly.
+void dlog_printf(const char *fmt, ...);
+
+// Records dropped because the ring was full.
+uint32_t dlog_drops(void);
+
+#else
+
+#include <stdio.h>
+
+#define dlog_init()
+#define dlog_printf printf
+#define dlog_drops() (0)
+
+#endif
+
+#endif
@@ -0,0 +1,123 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * EXTI dispatch: routes each external interrupt line to the handler
+ * registered for it, with the time the edge was taken.
+ */
+
+#include "exti.h"
+
+#include "stm32f4xx_hal.h"
+#include "timebase.h"
+#include "cycle_budget.h"
+#include "sysstats.h"
+#include "placement.h"
+#include "power.h"
+
+// ------------------------------------------------------------------------
+// Private types
+
+typedef struct {
+    uint16_t pinMask;
+    ExtiHandler_t *handler;
+    void *arg;
+} ExtiEntry_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void serve(uint16_t pin);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static ExtiEntry_t entries[EXTI_MAX_HANDLERS];
+static volatile unsigned numEntries;
+static uint16_t claimed;        // lines with a handler
+
+// Edges on lines nobody registered (noise, or a missing handler)
+static uint32_t unclaimed;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void exti_init(void)
+{
+    sysstats_addCounter("EXTI unclaimed", &unclaimed);
+}
+
+int exti_register(uint16_t pinMask, ExtiHandler_t *handler, void *arg)
+{
+    if ((numEntries >= EXTI_MAX_HANDLERS) || (pinMask & claimed)) {
+        return -1;
+    }
+
+    entries[numEntries].pinMask = pinMask;
+    entries[numEntries].handler = handler;
+    entries[numEntries].arg = arg;
+    claimed |= pinMask;
+
+    // Published last: the ISR only looks at the first numEntries
+    numEntries++;
+
+    return 0;
+}
+
+void exti_dispatch(uint16_t lines)
+{
+    uint16_t pending = EXTI->PR & lines;
+
+    // Clear first, so an edge arriving while its handler runs isn't lost
+    EXTI->PR = pending;
+
+    while (pending) {
+        uint16_t pin = pending & -pending;   // lowest line first
+        pending &= ~pin;
+        serve(pin);
+    }
+}
+
+// ------------------------------------------------------------------------
+// Callbacks for ISR
+
+// Lines served through HAL_GPIO_EXTI_IRQHandler()
+HOT_FN void HAL_GPIO_EXTI_Callback(uint16_t n)
+{
+    serve(n);
+}
+
+// ------------------------------------------------------------------------
+// Private functions
+
+HOT_FN static void serve(uint16_t pin)
+{
+    // Stamp before the lookup, as near the edge as we can get (or at the
+    // wake, if the edge woke the MCU from STOP)
+    uint32_t start = cycleBudget_start();
+    uint64_t t_uS = power_edgeUs(pin, timebase_getUs());
+
+    for (unsigned n = 0; n < numEntries; n++) {
+        if (entries[n].pinMask & pin) {
+            entries[n].handler(entries[n].arg, pin, t_uS);
+            cycleBudget_check(BUDGET_STAGE_ISR, start, pin);
+            return;
+        }
+    }
+
+    unclaimed++;
+}
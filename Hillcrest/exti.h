@@ -0,0 +1,49 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * EXTI dispatch: routes each external interrupt line to the handler
+ * registered for it, with the time the edge was taken.
+ */
+
+#ifndef EXTI_H
+#define EXTI_H
+
+#include <stdint.h>
+
+// Handlers that can be registered
+#ifndef EXTI_MAX_HANDLERS
+#define EXTI_MAX_HANDLERS (6)
+#endif
+
+// Called from the EXTI ISR with the arg it was registered with and the
+// timebase_getUs() time at which its line was served.
+typedef void (ExtiHandler_t)(void *arg, uint16_t pin, uint64_t t_uS);
+
+// Register the "EXTI unclaimed" counter.
+void exti_init(void);
+
+// Route the EXTI lines in pinMask (GPIO_PIN_x bits) to handler.  Call
+// before the scheduler starts.  Returns 0, or -1 if the table is full or
+// a line already has a handler.
+int exti_register(uint16_t pinMask, ExtiHandler_t *handler, void *arg);
+
+// Serve and clear the pending lines among lines, in one pass over the
+// pending register.  For EXTI IRQ handlers that share a vector.
+void exti_dispatch(uint16_t lines);
+
+#endif
@@ -16,14 +16,19 @@
  */
 
 /*
- * BNO080 Firmware Stub
+ * BNO080 firmware image provider.
+ *
+ * Serves firmwareData, generated by tools/hcbin2c.py: the default
+ * firmware_data.c is a 64-byte placeholder.
  */
 
-#include "HcBin.h"
+#include "firmware.h"
+#include "firmware_meta.h"
 
+#include <stdio.h>
 #include <string.h>
 
-#define ARRAY_LEN(a) ((sizeof(a))/(sizeof(a[0])))
+#include "stm32f4xx.h"
 
 /* Forward declarations of private functions */
 static int hcbin_open(void);
@@ -32,38 +37,51 @@ static const char * hcbin_getMeta(const char * key);
 static uint32_t hcbin_getAppLen(void);
 static uint32_t hcbin_getPacketLen(void);
 static int hcbin_getAppData(uint8_t *packet, uint32_t offet, uint32_t len);
+static const uint8_t * hcbin_getAppDataPtr(uint32_t offset, uint32_t len);
 
 /* hcbin object to be used by DFU code */
-const HcBin_t firmware = {
-	hcbin_open,
-	hcbin_close,
-	hcbin_getMeta,
-	hcbin_getAppLen,
-	hcbin_getPacketLen,
-	hcbin_getAppData
+const HcBinEx_t firmware = {
+	{
+		hcbin_open,
+		hcbin_close,
+		hcbin_getMeta,
+		hcbin_getAppLen,
+		hcbin_getPacketLen,
+		hcbin_getAppData
+	},
+	hcbin_getAppDataPtr
 };
 
 /* ------------------------------------------------------------------------ */
-/* Private data */
+/* Public functions */
 
-struct HcbinMetadata {
-	const char * key;
-	const char * value;
-};
-static const struct HcbinMetadata hcbinMetadata[] = {
-    {"FW-Format", "BNO_V1"},
-    {"SW-Part-Number", "1000-3608"},
-    {"SW-Version", "1.0.0"},
-    {"SW-Build", "0"},
-    {"Build-Timestamp", "2016-11-14T19:09:51.671350"},
-};
+int firmware_verify(void)
+{
+	const uint32_t *w = firmwareData.words;
+	uint32_t perChunk = firmwareData.packetLen / 4;
+	int status = 0;
+
+	/* The CRC unit takes a word per AHB cycle, much faster than the
+	 * bitwise CRC-32 firmware_check.c runs over streamed images */
+	__HAL_RCC_CRC_CLK_ENABLE();
+	for (uint32_t c = 0; c < firmwareData.numChunks; c++) {
+		CRC->CR = CRC_CR_RESET;
+		for (uint32_t n = 0; n < perChunk; n++) {
+			CRC->DR = *w++;
+		}
+		if (CRC->DR != firmwareData.chunkCrc[c]) {
+			printf("DFU check: chunk %u of %u, CRC %08x, expected %08x\n",
+			       (unsigned)c, (unsigned)firmwareData.numChunks,
+			       (unsigned)CRC->DR, (unsigned)firmwareData.chunkCrc[c]);
+			status = -1;
+			break;
+		}
+	}
+	/* The clock stays on for the frame CRCs (crc32.h).  Those start
+	 * with the sensor stream, after any DFU, so the two never overlap. */
 
-static const uint8_t hcbinFirmware[] = {
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
-};
+	return status;
+}
 
 /* ------------------------------------------------------------------------ */
 /* Private functions */
@@ -82,41 +100,39 @@ static int hcbin_close(void)
 
 static const char * hcbin_getMeta(const char * key)
 {
-	for (int i = 0; i < ARRAY_LEN(hcbinMetadata); i++) {
-		if (strcmp(key, hcbinMetadata[i].key) == 0) {
-			/* Found key, return value */
-			return hcbinMetadata[i].value;
-		}
-	}
-
-	/* Not found */
-	return 0;
+	return firmwareMeta_find(firmwareData.meta, firmwareData.metaLen, key);
 }
 
 static uint32_t hcbin_getAppLen(void)
 {
-	return ARRAY_LEN(hcbinFirmware);
+	return firmwareData.appLen;
 }
 
 static uint32_t hcbin_getPacketLen(void)
 {
-	/* This implementation doesn't have a preferred packet len */
-	return 0;
+	return firmwareData.packetLen;
 }
 
 static int hcbin_getAppData(uint8_t *packet, uint32_t offset, uint32_t len)
 {
-	int index = offset;
-	int copied = 0;
+	const uint8_t *p = hcbin_getAppDataPtr(offset, len);
 
-        if ((offset+len) > ARRAY_LEN(hcbinFirmware)) {
-                /* requested data beyond the end */
-                return -1;
-        }
-
-	while ((copied < len) && (index < ARRAY_LEN(hcbinFirmware))) {
-		packet[copied++] = hcbinFirmware[index++];
+	if (p == 0) {
+		return -1;
 	}
 
+	memcpy(packet, p, len);
+
 	return 0;
 }
+
+static const uint8_t * hcbin_getAppDataPtr(uint32_t offset, uint32_t len)
+{
+	if ((offset > firmwareData.appLen) ||
+	    (len > firmwareData.appLen - offset)) {
+		/* requested data beyond the end */
+		return 0;
+	}
+
+	return (const uint8_t *)firmwareData.words + offset;
+}
@@ -18,8 +18,40 @@
 #ifndef FIRMWARE_H
 #define FIRMWARE_H
 
+#include <stdint.h>
+
 #include "HcBin.h"
+#include "hcbin_ex.h"
+#include "firmware_meta.h"
+
+/* Packet length advertised to the DFU code.  Larger packets mean fewer
+ * per-packet CSN gaps; the DFU code caps this at its own maximum. */
+#ifndef FIRMWARE_PACKET_LEN
+#define FIRMWARE_PACKET_LEN (64)
+#endif
+
+/* Image served by firmware, generated by tools/hcbin2c.py into
+ * firmware_data.c.  The application is stored as words, so it is word
+ * aligned for the CRC unit; chunkCrc holds the STM32 CRC unit's CRC of
+ * each packetLen chunk (the last one padded with 0xFF). */
+typedef struct FirmwareData_s {
+	const FirmwareMeta_t *meta;     /* sorted by key */
+	uint32_t metaLen;
+	const uint32_t *words;
+	uint32_t appLen;                /* bytes */
+	uint32_t packetLen;             /* a multiple of 4 */
+	const uint32_t *chunkCrc;
+	uint32_t numChunks;
+} FirmwareData_t;
+
+extern const FirmwareData_t firmwareData;
+
+/* hcbin object to be used by DFU code: firmwareData, memory-mapped */
+extern const HcBinEx_t firmware;
 
-extern const HcBin_t firmware;
+/* Check each chunk of firmwareData in the CRC unit against its table
+ * entry.  Returns 0, or -1 if a chunk differs (flash corrupted, or the
+ * data file edited by hand). */
+int firmware_verify(void);
 
 #endif
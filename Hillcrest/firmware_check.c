@@ -0,0 +1,153 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Firmware image check before DFU.
+ */
+
+#include "firmware_check.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sh2_err.h"
+#include "firmware_meta.h"
+
+/* Bytes read from the image at a time */
+#define CHECK_BUF_LEN (64)
+
+/* Forward declarations of private functions */
+static int readCrc(const HcBinEx_t *image, uint32_t appLen, uint32_t *pCrc);
+static uint32_t crc32(uint32_t crc, const uint8_t *p, uint32_t len);
+
+/* ------------------------------------------------------------------------ */
+/* Public API */
+
+int firmwareCheck_verify(const HcBinEx_t *image, bool readImage)
+{
+	const HcBin_t *firmware = &image->hcbin;
+	const char *format;
+	const char *want;
+	uint32_t appLen, crc;
+	int status = SH2_OK;
+
+	if (firmware->open() != 0) {
+		printf("DFU check: image won't open\n");
+		return SH2_ERR_IO;
+	}
+
+	format = firmware->getMeta("FW-Format");
+	appLen = firmware->getAppLen();
+	if ((format == 0) || (strcmp(format, FIRMWARE_CHECK_FORMAT) != 0)) {
+		printf("DFU check: format %s, not " FIRMWARE_CHECK_FORMAT "\n",
+		       format ? format : "missing");
+		status = SH2_ERR_BAD_PARAM;
+	}
+	else if ((appLen == 0) || (firmware->getPacketLen() == 0)) {
+		printf("DFU check: empty image\n");
+		status = SH2_ERR_BAD_PARAM;
+	}
+	else if (readImage) {
+		want = firmware->getMeta("App-CRC32");
+		if (readCrc(image, appLen, &crc) != 0) {
+			printf("DFU check: image unreadable\n");
+			status = SH2_ERR_IO;
+		}
+		else if (want == 0) {
+			printf("DFU check: no App-CRC32, CRC %08x not checked\n", crc);
+		}
+		else if (strtoul(want, 0, 16) != crc) {
+			printf("DFU check: CRC %08x, App-CRC32 %s\n", crc, want);
+			status = SH2_ERR_BAD_PARAM;
+		}
+	}
+
+	firmware->close();
+
+	if (status == SH2_OK) {
+		printf("DFU check: %u bytes, OK\n", appLen);
+	}
+	return status;
+}
+
+bool firmwareCheck_matches(const HcBin_t *firmware, const sh2_ProductIds_t *ids)
+{
+	FirmwareVersion_t v;
+	bool match = false;
+
+	if (firmware->open() != 0) {
+		return false;
+	}
+
+	if (firmwareMeta_version(firmware, &v) == 0) {
+		for (int n = 0; (n < SH2_NUM_PROD_ID_ENTRIES) && !match; n++) {
+			const sh2_ProductId_t *id = &ids->entry[n];
+
+			match = (id->swPartNumber == v.partNumber) &&
+			        (id->swVersionMajor == v.major) &&
+			        (id->swVersionMinor == v.minor) &&
+			        (id->swVersionPatch == v.patch) &&
+			        (!v.hasBuild || (id->swBuildNumber == v.build));
+		}
+	}
+
+	firmware->close();
+
+	return match;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Private functions */
+
+static int readCrc(const HcBinEx_t *image, uint32_t appLen, uint32_t *pCrc)
+{
+	uint8_t buf[CHECK_BUF_LEN];
+	uint32_t crc = 0xFFFFFFFF;
+	/* A memory-mapped image is taken in one piece, in place */
+	uint32_t step = (image->getAppDataPtr != 0) ? appLen : sizeof(buf);
+
+	for (uint32_t offset = 0; offset < appLen; offset += step) {
+		uint32_t len = appLen - offset;
+		const uint8_t *p;
+
+		if (len > step) {
+			len = step;
+		}
+		p = hcbinEx_getAppData(image, buf, offset, len);
+		if (p == 0) {
+			return -1;
+		}
+		crc = crc32(crc, p, len);
+	}
+
+	*pCrc = crc ^ 0xFFFFFFFF;
+	return 0;
+}
+
+/* CRC-32 (IEEE, reflected), bitwise: an image is checked once per DFU */
+static uint32_t crc32(uint32_t crc, const uint8_t *p, uint32_t len)
+{
+	while (len--) {
+		crc ^= *p++;
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+		}
+	}
+
+	return crc;
+}
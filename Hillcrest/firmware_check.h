@@ -0,0 +1,64 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Firmware image check before DFU.
+ *
+ * dfu() resets the hub into its bootloader before sending a byte, so a
+ * bad image costs the hub its firmware until a good one goes in.  The
+ * check runs first and touches nothing but the image: format, length,
+ * and with reading enabled, the CRC-32 of the whole application against
+ * the App-CRC32 metadata (hex, as tools/hcbin_pack.py and tools/fwsend.py
+ * write it: zlib's CRC-32 of app.bin).
+ */
+
+#ifndef FIRMWARE_CHECK_H
+#define FIRMWARE_CHECK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "HcBin.h"
+#include "hcbin_ex.h"
+#include "sh2.h"
+
+/* Check images before DFU */
+#ifndef DFU_VERIFY
+#define DFU_VERIFY (1)
+#endif
+
+/* Whole DFU attempts before giving up, after a hub or bus error */
+#ifndef DFU_TRIES
+#define DFU_TRIES (2)
+#endif
+
+/* Format the DFU code accepts */
+#define FIRMWARE_CHECK_FORMAT "BNO_V1"
+
+/* Check firmware.  With readImage, reads it all, in place if it is memory
+ * mapped, and checks its CRC-32; an image without App-CRC32 then only passes the
+ * other checks, with a warning.  Returns SH2_OK, or SH2_ERR_BAD_PARAM if
+ * the image is bad, SH2_ERR_IO if it could not be read. */
+int firmwareCheck_verify(const HcBinEx_t *firmware, bool readImage);
+
+/* True if one of the hub's product ids is the image's: SW-Part-Number
+ * ("1000-3608" is part 10003608), SW-Version ("3.2.4") and, if the image
+ * has it, SW-Build.  An image without part number or version never
+ * matches. */
+bool firmwareCheck_matches(const HcBin_t *firmware, const sh2_ProductIds_t *ids);
+
+#endif
@@ -0,0 +1,273 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Firmware image source that pulls the image from a host over the console.
+ */
+
+#include "firmware_console.h"
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "console.h"
+#include "crc16.h"
+#include "timebase.h"
+
+/* Progress is printed at every step of this many percent */
+#define PROGRESS_STEP (10)
+
+/* Forward declarations of private functions */
+static int con_open(void *cookie);
+static int con_close(void *cookie);
+static const char * con_getMeta(void *cookie, const char * key);
+static uint32_t con_getAppLen(void *cookie);
+static int con_read(void *cookie, uint8_t *dst, uint32_t offset, uint32_t len);
+static int request(uint8_t *dst, uint32_t maxLen, uint32_t *pLen, const char *fmt, ...);
+static int receive(uint8_t *dst, uint32_t maxLen, uint32_t *pLen);
+static void progress(void);
+
+/* Source for firmwareStream_setSource() */
+const FirmwareSource_t firmwareConsole = {
+	con_open,
+	con_close,
+	con_getMeta,
+	con_getAppLen,
+	con_read,
+	0
+};
+
+/* ------------------------------------------------------------------------ */
+/* Private data */
+
+struct MetaValue {
+	char key[FIRMWARE_CONSOLE_META_LEN];
+	char value[FIRMWARE_CONSOLE_META_LEN];
+};
+static struct MetaValue meta[FIRMWARE_CONSOLE_META];
+static unsigned numMeta;
+
+static uint8_t seq;
+static uint32_t appLen;
+static bool opened;                /* link losses may be waited out */
+
+static uint64_t start_uS;
+static uint32_t received;          /* application bytes */
+static uint32_t retries;
+static uint32_t resumes;           /* link losses waited out */
+static unsigned shown;             /* percent last printed */
+
+/* ------------------------------------------------------------------------ */
+/* Public API */
+
+void firmwareConsole_done(int status)
+{
+	uint32_t ms = (uint32_t)((timebase_getUs() - start_uS) / 1000);
+
+	printf("#FW done %d\n", status);
+	printf("DFU image %u of %u bytes in %u ms (%u B/s), %u retries, %u resumed\n",
+	       received, appLen, ms, ms ? (uint32_t)((uint64_t)received * 1000 / ms) : 0,
+	       retries, resumes);
+}
+
+/* ------------------------------------------------------------------------ */
+/* Private functions */
+
+static int con_open(void *cookie)
+{
+	uint8_t len[4];
+	uint32_t got;
+
+	numMeta = 0;
+	opened = false;
+	received = 0;
+	retries = 0;
+	resumes = 0;
+	shown = 0;
+	start_uS = timebase_getUs();
+
+	if ((request(len, sizeof(len), &got, "open") != 0) || (got != sizeof(len))) {
+		return -1;
+	}
+	appLen = len[0] | (len[1] << 8) | (len[2] << 16) | ((uint32_t)len[3] << 24);
+	opened = true;
+	printf("DFU image: %u bytes\n", appLen);
+
+	return 0;
+}
+
+static int con_close(void *cookie)
+{
+	opened = false;
+	return 0;
+}
+
+static const char * con_getMeta(void *cookie, const char * key)
+{
+	struct MetaValue *m;
+	uint32_t got;
+
+	/* dfu() may hold on to values, so each key is fetched once and kept */
+	for (unsigned n = 0; n < numMeta; n++) {
+		if (strcmp(meta[n].key, key) == 0) {
+			return meta[n].value[0] ? meta[n].value : 0;
+		}
+	}
+	if ((numMeta >= FIRMWARE_CONSOLE_META) || (strlen(key) >= FIRMWARE_CONSOLE_META_LEN)) {
+		return 0;
+	}
+
+	m = &meta[numMeta];
+	if (request((uint8_t *)m->value, FIRMWARE_CONSOLE_META_LEN - 1, &got, "meta %s", key) != 0) {
+		return 0;
+	}
+	m->value[got] = 0;
+	strcpy(m->key, key);
+	numMeta++;
+
+	return m->value[0] ? m->value : 0;
+}
+
+static uint32_t con_getAppLen(void *cookie)
+{
+	return appLen;
+}
+
+static int con_read(void *cookie, uint8_t *dst, uint32_t offset, uint32_t len)
+{
+	while (len > 0) {
+		uint32_t n = (len > FIRMWARE_CONSOLE_READ_MAX) ? FIRMWARE_CONSOLE_READ_MAX : len;
+		uint32_t got;
+
+		if ((request(dst, n, &got, "read %u %u", offset, n) != 0) || (got != n)) {
+			return -1;
+		}
+
+		dst += n;
+		offset += n;
+		len -= n;
+		received += n;
+		progress();
+	}
+
+	return 0;
+}
+
+/* Send a request line and wait for its reply, retrying. */
+static int request(uint8_t *dst, uint32_t maxLen, uint32_t *pLen, const char *fmt, ...)
+{
+	char line[FIRMWARE_CONSOLE_META_LEN + 16];
+	va_list args;
+
+	va_start(args, fmt);
+	vsnprintf(line, sizeof(line), fmt, args);
+	va_end(args);
+
+	seq++;
+	for (unsigned tries = 0; tries < FIRMWARE_CONSOLE_TRIES; tries++) {
+		if (tries > 0) {
+			retries++;
+		}
+		printf("#FW %u %s\n", seq, line);
+		if (receive(dst, maxLen, pLen) == 0) {
+			return 0;
+		}
+	}
+
+	if (opened && (FIRMWARE_CONSOLE_RESUME_MS > 0)) {
+		uint64_t giveUp_uS = timebase_getUs() + FIRMWARE_CONSOLE_RESUME_MS * 1000ull;
+
+		printf("DFU: host lost at %u bytes, waiting for fwsend.py -r\n", received);
+		while (timebase_getUs() < giveUp_uS) {
+			printf("#FW %u %s\n", seq, line);
+			if (receive(dst, maxLen, pLen) == 0) {
+				resumes++;
+				printf("DFU: resumed\n");
+				return 0;
+			}
+		}
+	}
+
+	printf("DFU: no reply from host to %s\n", line);
+	return -1;
+}
+
+/* Wait for, and check, the reply frame for seq. */
+static int receive(uint8_t *dst, uint32_t maxLen, uint32_t *pLen)
+{
+	uint8_t hdr[FIRMWARE_CONSOLE_HDR_LEN];
+	uint8_t crc[FIRMWARE_CONSOLE_CRC_LEN];
+	uint64_t deadline_uS = timebase_getUs() + FIRMWARE_CONSOLE_TIMEOUT_MS * 1000ull;
+
+	hdr[1] = 0;
+	while (timebase_getUs() < deadline_uS) {
+		uint32_t len;
+		uint16_t sum;
+
+		/* Hunt for the sync bytes one at a time */
+		hdr[0] = hdr[1];
+		if (console_readRaw(&hdr[1], 1, FIRMWARE_CONSOLE_TIMEOUT_MS) != 1) {
+			return -1;
+		}
+		if ((hdr[0] != FIRMWARE_CONSOLE_SYNC0) || (hdr[1] != FIRMWARE_CONSOLE_SYNC1)) {
+			continue;
+		}
+		hdr[1] = 0;
+		if (console_readRaw(&hdr[2], 3, FIRMWARE_CONSOLE_TIMEOUT_MS) != 3) {
+			return -1;
+		}
+
+		len = hdr[3] | (hdr[4] << 8);
+		if (len > maxLen) {
+			/* Not ours, or damaged: find the next frame */
+			continue;
+		}
+		if ((console_readRaw(dst, len, FIRMWARE_CONSOLE_TIMEOUT_MS) != len) ||
+		    (console_readRaw(crc, sizeof(crc), FIRMWARE_CONSOLE_TIMEOUT_MS) != sizeof(crc))) {
+			return -1;
+		}
+
+		sum = crc16(CRC16_INIT, &hdr[2], FIRMWARE_CONSOLE_HDR_LEN - 2);
+		sum = crc16(sum, dst, len);
+		if ((sum != (crc[0] | (crc[1] << 8))) || (hdr[2] != seq)) {
+			/* Damaged, or the late reply to an earlier try */
+			continue;
+		}
+
+		*pLen = len;
+		return 0;
+	}
+
+	return -1;
+}
+
+static void progress(void)
+{
+	unsigned pct = appLen ? (unsigned)((uint64_t)received * 100 / appLen) : 100;
+	uint32_t ms;
+
+	if (pct < shown + PROGRESS_STEP) {
+		return;
+	}
+	shown = pct - (pct % PROGRESS_STEP);
+
+	ms = (uint32_t)((timebase_getUs() - start_uS) / 1000);
+	printf("DFU %3u%%  %u bytes, %u B/s\n", shown, received,
+	       ms ? (uint32_t)((uint64_t)received * 1000 / ms) : 0);
+}
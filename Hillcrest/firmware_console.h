@@ -0,0 +1,91 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Firmware image source that pulls the image from a host over the console.
+ *
+ * Plugs into firmware_stream.c, so dfu() sees an ordinary HcBin_t while
+ * the image stays on the host: only FIRMWARE_STREAM_CHUNK bytes are held
+ * at a time.  tools/fwsend.py is the host side.
+ *
+ * The MCU asks, the host answers, one request at a time, so the host can
+ * never overrun the console receive buffer.  Requests are text lines the
+ * host picks out of the console output:
+ *   "#FW <seq> open"                 reply: application length (u32 LE)
+ *   "#FW <seq> meta <key>"           reply: value, empty if absent
+ *   "#FW <seq> read <offset> <len>"  reply: len bytes of the application
+ *   "#FW done <status>"              no reply, the transfer is over
+ * Replies are binary frames: sync (0xA5 0x46), seq, length (u16 LE),
+ * payload, CRC-16 (LE) over seq to payload.  A request that gets no valid
+ * reply within FIRMWARE_CONSOLE_TIMEOUT_MS is sent again with the same
+ * seq, up to FIRMWARE_CONSOLE_TRIES times.  Frames with another seq are
+ * stale and skipped.
+ *
+ * Once the image is open, a link that stays silent past the tries is
+ * waited for, the same request repeated, for FIRMWARE_CONSOLE_RESUME_MS:
+ * the host side keeps no state, so "fwsend.py -r" restarted on a
+ * replugged cable carries on from the offset where the transfer stopped.
+ * The hub bootloader is waiting meanwhile, mid-image.
+ */
+
+#ifndef FIRMWARE_CONSOLE_H
+#define FIRMWARE_CONSOLE_H
+
+#include <stdint.h>
+
+#include "firmware_stream.h"
+
+/* Build in the "dfu" console command */
+#ifndef DFU_CONSOLE
+#define DFU_CONSOLE (1)
+#endif
+
+#define FIRMWARE_CONSOLE_SYNC0 (0xA5)
+#define FIRMWARE_CONSOLE_SYNC1 (0x46)
+#define FIRMWARE_CONSOLE_HDR_LEN (5)
+#define FIRMWARE_CONSOLE_CRC_LEN (2)
+
+/* Largest read requested, so a reply frame fits the console rx buffer */
+#ifndef FIRMWARE_CONSOLE_READ_MAX
+#define FIRMWARE_CONSOLE_READ_MAX (128)
+#endif
+
+/* Reply wait, and requests sent before giving up */
+#ifndef FIRMWARE_CONSOLE_TIMEOUT_MS
+#define FIRMWARE_CONSOLE_TIMEOUT_MS (1000)
+#endif
+#ifndef FIRMWARE_CONSOLE_TRIES
+#define FIRMWARE_CONSOLE_TRIES (3)
+#endif
+
+/* How long a transfer waits for the host to come back once the image is
+ * open, 0 to fail after the tries */
+#ifndef FIRMWARE_CONSOLE_RESUME_MS
+#define FIRMWARE_CONSOLE_RESUME_MS (120000)
+#endif
+
+/* Metadata values kept, and the longest value */
+#define FIRMWARE_CONSOLE_META (8)
+#define FIRMWARE_CONSOLE_META_LEN (48)
+
+/* Source for firmwareStream_setSource() */
+extern const FirmwareSource_t firmwareConsole;
+
+/* Tell the host the transfer is over, and print the throughput. */
+void firmwareConsole_done(int status);
+
+#endif
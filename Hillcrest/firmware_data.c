@@ -0,0 +1,29 @@
+/* Generated by tools/hcbin2c.py, do not edit. */
+
+#include "firmware.h"
+
+/* Sorted by key, for firmwareMeta_find() */
+static const FirmwareMeta_t meta[] = {
+    {"App-CRC32", "758d6336"},
+    {"Build-Timestamp", "2016-11-14T19:09:51.671350"},
+    {"FW-Format", "BNO_V1"},
+    {"SW-Build", "0"},
+    {"SW-Part-Number", "1000-3608"},
+    {"SW-Version", "1.0.0"},
+};
+
+static const uint32_t words[] = {
+    0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000,
+    0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000,
+};
+
+static const uint32_t chunkCrc[] = {
+    0x93394e51,
+};
+
+const FirmwareData_t firmwareData = {
+    meta, sizeof(meta) / sizeof(meta[0]),
+    words, 64,
+    64,
+    chunkCrc, sizeof(chunkCrc) / sizeof(chunkCrc[0])
+};
@@ -0,0 +1,219 @@
+/*
+ * Copyright 2016 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Firmware image provider for compressed images.
+ */
+
+#include "firmware_hs.h"
+#include "firmware.h"
+
+#include <string.h>
+
+#define WINDOW_LEN (1 << FIRMWARE_HS_MAX_WINDOW_BITS)
+
+/* Forward declarations of private functions */
+static int hs_open(void);
+static int hs_close(void);
+static const char * hs_getMeta(const char * key);
+static uint32_t hs_getAppLen(void);
+static uint32_t hs_getPacketLen(void);
+static int hs_getAppData(uint8_t *packet, uint32_t offset, uint32_t len);
+static void restart(void);
+static int getBits(uint8_t count, uint32_t *pValue);
+static int nextByte(uint8_t *pByte);
+
+/* hcbin object to be used by DFU code */
+const HcBinEx_t firmwareHs = {
+	{
+		hs_open,
+		hs_close,
+		hs_getMeta,
+		hs_getAppLen,
+		hs_getPacketLen,
+		hs_getAppData
+	},
+	0                          /* no getAppDataPtr: decompressed as read */
+};
+
+/* ------------------------------------------------------------------------ */
+/* Private data */
+
+static const FirmwareHsImage_t *image;
+
+static uint8_t window[WINDOW_LEN];
+static uint32_t windowMask;
+
+static uint32_t inPos;          /* next byte of compressed stream */
+static uint8_t inByte;          /* byte being consumed */
+static uint8_t inMask;          /* next bit of inByte, 0 when used up */
+
+static uint32_t outPos;         /* bytes produced so far */
+static uint32_t refLen;         /* bytes left in current backref */
+static uint32_t refDist;        /* distance back of current backref */
+
+/* ------------------------------------------------------------------------ */
+/* Public API */
+
+void firmwareHs_setImage(const FirmwareHsImage_t *_image)
+{
+	image = _image;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Private functions */
+
+static int hs_open(void)
+{
+	if ((image == 0) ||
+	    (image->windowBits > FIRMWARE_HS_MAX_WINDOW_BITS) ||
+	    (image->lookaheadBits >= image->windowBits)) {
+		/* No image, or it needs more window than we have */
+		return -1;
+	}
+
+	windowMask = (1 << image->windowBits) - 1;
+	restart();
+
+	return 0;
+}
+
+static int hs_close(void)
+{
+	/* Nothing to do */
+	return 0;
+}
+
+static const char * hs_getMeta(const char * key)
+{
+	return firmwareMeta_find(image->meta, image->metaLen, key);
+}
+
+static uint32_t hs_getAppLen(void)
+{
+	return image->appLen;
+}
+
+static uint32_t hs_getPacketLen(void)
+{
+	return FIRMWARE_PACKET_LEN;
+}
+
+static int hs_getAppData(uint8_t *packet, uint32_t offset, uint32_t len)
+{
+	uint32_t end;
+
+	if ((offset > image->appLen) || (len > image->appLen - offset)) {
+		/* requested data beyond the end */
+		return -1;
+	}
+
+	if (offset < outPos) {
+		/* Can't go backwards, start over */
+		restart();
+	}
+
+	end = offset + len;
+	while (outPos < end) {
+		uint8_t c;
+
+		if (nextByte(&c) != 0) {
+			/* Stream ended early or is corrupt */
+			return -1;
+		}
+		if (outPos >= offset) {
+			packet[outPos - offset] = c;
+		}
+		window[outPos & windowMask] = c;
+		outPos++;
+	}
+
+	return 0;
+}
+
+static void restart(void)
+{
+	memset(window, 0, sizeof(window));
+	inPos = 0;
+	inMask = 0;
+	outPos = 0;
+	refLen = 0;
+}
+
+/* Produce the next decompressed byte. */
+static int nextByte(uint8_t *pByte)
+{
+	uint32_t v;
+
+	if (refLen == 0) {
+		if (getBits(1, &v) != 0) {
+			return -1;
+		}
+		if (v) {
+			/* Literal */
+			if (getBits(8, &v) != 0) {
+				return -1;
+			}
+			*pByte = (uint8_t)v;
+			return 0;
+		}
+
+		/* Backref: W bits of distance-1, L bits of length-1 */
+		if (getBits(image->windowBits, &v) != 0) {
+			return -1;
+		}
+		refDist = v + 1;
+		if (getBits(image->lookaheadBits, &v) != 0) {
+			return -1;
+		}
+		refLen = v + 1;
+		if (refDist > outPos) {
+			/* Refers to before the start of the image */
+			return -1;
+		}
+	}
+
+	*pByte = window[(outPos - refDist) & windowMask];
+	refLen--;
+
+	return 0;
+}
+
+/* Read count bits, MSB first. */
+static int getBits(uint8_t count, uint32_t *pValue)
+{
+	uint32_t value = 0;
+
+	while (count > 0) {
+		if (inMask == 0) {
+			if (inPos >= image->dataLen) {
+				return -1;
+			}
+			inByte = image->data[inPos++];
+			inMask = 0x80;
+		}
+		value <<= 1;
+		if (inByte & inMask) {
+			value |= 1;
+		}
+		inMask >>= 1;
+		count--;
+	}
+
+	*pValue = value;
+	return 0;
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2016 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Firmware image provider for compressed images.
+ *
+ * Images are compressed with heatshrink's LZSS bitstream (window 2^W
+ * bytes, lookahead 2^L bytes); tools/hcbin_pack.py produces a C file with
+ * a FirmwareHsImage_t from a raw application binary.  Decompression is
+ * streamed: the only RAM used is the 2^FIRMWARE_HS_MAX_WINDOW_BITS byte
+ * window plus a few words of state, all static.
+ *
+ * Reads are expected to be sequential, as the DFU code does them.  A read
+ * behind the current position restarts decompression from the beginning.
+ */
+
+#ifndef FIRMWARE_HS_H
+#define FIRMWARE_HS_H
+
+#include <stdint.h>
+
+#include "HcBin.h"
+#include "hcbin_ex.h"
+#include "firmware_meta.h"
+
+/* Largest window an image may use.  Sets the window buffer size. */
+#ifndef FIRMWARE_HS_MAX_WINDOW_BITS
+#define FIRMWARE_HS_MAX_WINDOW_BITS (10)
+#endif
+
+/* Metadata, sorted by key */
+typedef FirmwareMeta_t FirmwareHsMeta_t;
+
+typedef struct FirmwareHsImage_s {
+	const FirmwareHsMeta_t *meta;
+	uint32_t metaLen;
+	uint32_t appLen;           /* decompressed length */
+	const uint8_t *data;       /* compressed stream */
+	uint32_t dataLen;
+	uint8_t windowBits;        /* W, at most FIRMWARE_HS_MAX_WINDOW_BITS */
+	uint8_t lookaheadBits;     /* L, less than W */
+} FirmwareHsImage_t;
+
+/* hcbin object to be used by DFU code, valid once an image is set */
+extern const HcBinEx_t firmwareHs;
+
+/* Select the image firmwareHs decompresses.  Call before dfu(). */
+void firmwareHs_setImage(const FirmwareHsImage_t *image);
+
+#endif
@@ -0,0 +1,81 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Firmware image metadata tables.
+ */
+
+#include "firmware_meta.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* ------------------------------------------------------------------------ */
+/* Public API */
+
+const char * firmwareMeta_find(const FirmwareMeta_t *meta, uint32_t len, const char * key)
+{
+	uint32_t lo = 0;
+	uint32_t hi = len;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		int cmp = strcmp(key, meta[mid].key);
+
+		if (cmp == 0) {
+			return meta[mid].value;
+		}
+		if (cmp < 0) {
+			hi = mid;
+		}
+		else {
+			lo = mid + 1;
+		}
+	}
+
+	/* Not found */
+	return 0;
+}
+
+int firmwareMeta_version(const HcBin_t *firmware, FirmwareVersion_t *pVersion)
+{
+	const char *part = firmware->getMeta("SW-Part-Number");
+	const char *version = firmware->getMeta("SW-Version");
+	const char *build = firmware->getMeta("SW-Build");
+	unsigned major, minor, patch;
+
+	if ((part == 0) || (version == 0) ||
+	    (sscanf(version, "%u.%u.%u", &major, &minor, &patch) != 3)) {
+		return -1;
+	}
+
+	/* The part number's digits, without the dash */
+	pVersion->partNumber = 0;
+	for (; *part; part++) {
+		if ((*part >= '0') && (*part <= '9')) {
+			pVersion->partNumber = pVersion->partNumber*10 + (*part - '0');
+		}
+	}
+	pVersion->major = major;
+	pVersion->minor = minor;
+	pVersion->patch = patch;
+	pVersion->hasBuild = (build != 0);
+	pVersion->build = build ? strtoul(build, 0, 10) : 0;
+
+	return 0;
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Firmware image metadata tables.
+ *
+ * Image providers keep their Key=Value metadata in a FirmwareMeta_t table
+ * sorted by key (strcmp order): tools/hcbin_pack.py and tools/hcbin2c.py
+ * emit it sorted.  A lookup is then a binary search, a handful of
+ * compares however many keys an image carries.
+ *
+ * The version fields the update code compares are parsed once into a
+ * FirmwareVersion_t rather than looked up and parsed as text each time.
+ */
+
+#ifndef FIRMWARE_META_H
+#define FIRMWARE_META_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "HcBin.h"
+
+typedef struct FirmwareMeta_s {
+	const char * key;
+	const char * value;
+} FirmwareMeta_t;
+
+/* SW-Part-Number ("1000-3608" is part 10003608), SW-Version ("3.2.4")
+ * and SW-Build of an image, as the hub reports them in its product ids */
+typedef struct FirmwareVersion_s {
+	uint32_t partNumber;
+	uint8_t major;
+	uint8_t minor;
+	uint16_t patch;
+	uint32_t build;
+	bool hasBuild;             /* SW-Build present */
+} FirmwareVersion_t;
+
+/* Value of key in meta (len entries, sorted by key), or 0 if absent. */
+const char * firmwareMeta_find(const FirmwareMeta_t *meta, uint32_t len, const char * key);
+
+/* Parse the version fields of firmware, which must be open.  Returns 0,
+ * or -1 if SW-Part-Number or SW-Version is missing or malformed. */
+int firmwareMeta_version(const HcBin_t *firmware, FirmwareVersion_t *pVersion);
+
+#endif
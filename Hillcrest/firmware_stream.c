@@ -0,0 +1,147 @@
+/*
+ * Copyright 2016 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Firmware image provider for images kept outside MCU flash.
+ */
+
+#include "firmware_stream.h"
+#include "firmware.h"
+
+#include <string.h>
+
+/* Forward declarations of private functions */
+static int stream_open(void);
+static int stream_close(void);
+static const char * stream_getMeta(const char * key);
+static uint32_t stream_getAppLen(void);
+static uint32_t stream_getPacketLen(void);
+static int stream_getAppData(uint8_t *packet, uint32_t offset, uint32_t len);
+
+/* hcbin object to be used by DFU code */
+const HcBinEx_t firmwareStream = {
+	{
+		stream_open,
+		stream_close,
+		stream_getMeta,
+		stream_getAppLen,
+		stream_getPacketLen,
+		stream_getAppData
+	},
+	0                          /* no getAppDataPtr: read through the cache */
+};
+
+/* ------------------------------------------------------------------------ */
+/* Private data */
+
+static const FirmwareSource_t *source;
+static uint32_t appLen;
+
+static uint8_t cache[FIRMWARE_STREAM_CHUNK];
+static uint32_t cacheOffset;               /* image offset of cache[0] */
+static uint32_t cacheLen;                  /* valid bytes in cache */
+
+/* ------------------------------------------------------------------------ */
+/* Public API */
+
+void firmwareStream_setSource(const FirmwareSource_t *_source)
+{
+	source = _source;
+	cacheLen = 0;
+}
+
+/* ------------------------------------------------------------------------ */
+/* Private functions */
+
+static int stream_open(void)
+{
+	int status;
+
+	if (source == 0) {
+		return -1;
+	}
+
+	status = source->open(source->cookie);
+	if (status != 0) {
+		return status;
+	}
+
+	appLen = source->getAppLen(source->cookie);
+	cacheLen = 0;
+
+	return 0;
+}
+
+static int stream_close(void)
+{
+	cacheLen = 0;
+
+	return source->close(source->cookie);
+}
+
+static const char * stream_getMeta(const char * key)
+{
+	return source->getMeta(source->cookie, key);
+}
+
+static uint32_t stream_getAppLen(void)
+{
+	return appLen;
+}
+
+static uint32_t stream_getPacketLen(void)
+{
+	return FIRMWARE_PACKET_LEN;
+}
+
+static int stream_getAppData(uint8_t *packet, uint32_t offset, uint32_t len)
+{
+	uint32_t skip, n;
+
+	if ((offset > appLen) || (len > appLen - offset)) {
+		/* requested data beyond the end */
+		return -1;
+	}
+
+	while (len > 0) {
+		if ((offset < cacheOffset) || (offset >= cacheOffset + cacheLen)) {
+			/* Miss, refill cache with the chunk holding offset */
+			cacheOffset = offset - (offset % FIRMWARE_STREAM_CHUNK);
+			cacheLen = appLen - cacheOffset;
+			if (cacheLen > FIRMWARE_STREAM_CHUNK) {
+				cacheLen = FIRMWARE_STREAM_CHUNK;
+			}
+			if (source->read(source->cookie, cache, cacheOffset, cacheLen) != 0) {
+				cacheLen = 0;
+				return -1;
+			}
+		}
+
+		skip = offset - cacheOffset;
+		n = cacheLen - skip;
+		if (n > len) {
+			n = len;
+		}
+		memcpy(packet, &cache[skip], n);
+
+		packet += n;
+		offset += n;
+		len -= n;
+	}
+
+	return 0;
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright 2016 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Firmware image provider for images kept outside MCU flash.
+ *
+ * Presents an HcBin_t to the DFU code, backed by a FirmwareSource_t that
+ * reads the image in chunks (e.g. from external SPI flash, or from a host
+ * over UART).  The source is read a chunk at a time into a local cache, so
+ * small DFU packet reads don't each cost a source transaction.
+ */
+
+#ifndef FIRMWARE_STREAM_H
+#define FIRMWARE_STREAM_H
+
+#include <stdint.h>
+
+#include "HcBin.h"
+#include "hcbin_ex.h"
+
+/* Size of the chunk cache, and of each read from the source */
+#ifndef FIRMWARE_STREAM_CHUNK
+#define FIRMWARE_STREAM_CHUNK (256)
+#endif
+
+/* Where a streamed image comes from.  All functions return 0 on success,
+ * negative on error, except getMeta (0 if key is absent) and getAppLen.
+ * read() must fill exactly len bytes starting at offset from the start of
+ * the application image. */
+typedef struct FirmwareSource_s {
+	int (*open)(void *cookie);
+	int (*close)(void *cookie);
+	const char * (*getMeta)(void *cookie, const char * key);
+	uint32_t (*getAppLen)(void *cookie);
+	int (*read)(void *cookie, uint8_t *dst, uint32_t offset, uint32_t len);
+	void *cookie;
+} FirmwareSource_t;
+
+/* hcbin object to be used by DFU code, valid once a source is set */
+extern const HcBinEx_t firmwareStream;
+
+/* Select the source firmwareStream reads from.  Call before dfu(). */
+void firmwareStream_setSource(const FirmwareSource_t *source);
+
+#endif
@@ -0,0 +1,134 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Fixed-point to ASCII formatting.
+ */
+
+#include "fixfmt.h"
+
+#include <stdbool.h>
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static char *putNumber(char *p, bool neg, uint64_t whole, uint32_t frac,
+                       unsigned decimals, unsigned width);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static const uint32_t pow10[FIXFMT_MAX_DECIMALS+1] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000,
+};
+
+// ------------------------------------------------------------------------
+// Public API
+
+char *fixfmt_q(char *p, int32_t v, unsigned q, unsigned decimals, unsigned width)
+{
+    bool neg = (v < 0);
+    uint32_t a = neg ? -(uint32_t)v : (uint32_t)v;
+    uint32_t scale;
+    uint32_t whole = a >> q;
+    uint32_t frac;
+
+    if (decimals > FIXFMT_MAX_DECIMALS) {
+        decimals = FIXFMT_MAX_DECIMALS;
+    }
+    scale = pow10[decimals];
+
+    // Fractional bits to decimals digits, rounded to nearest
+    frac = a & ((1u << q) - 1);
+    frac = (uint32_t)((((uint64_t)frac * scale << 1) + (1u << q)) >> (q + 1));
+    if (frac >= scale) {
+        whole++;
+        frac -= scale;
+    }
+
+    return putNumber(p, neg, whole, frac, decimals, width);
+}
+
+char *fixfmt_us(char *p, uint64_t t_uS, unsigned decimals, unsigned width)
+{
+    uint64_t whole = t_uS / 1000000;
+    uint32_t frac = (uint32_t)(t_uS - whole * 1000000);
+
+    if (decimals > FIXFMT_MAX_DECIMALS) {
+        decimals = FIXFMT_MAX_DECIMALS;
+    }
+    if (decimals < FIXFMT_MAX_DECIMALS) {
+        uint32_t div = pow10[FIXFMT_MAX_DECIMALS - decimals];
+        frac = (frac + div/2) / div;
+        if (frac >= pow10[decimals]) {
+            whole++;
+            frac -= pow10[decimals];
+        }
+    }
+
+    return putNumber(p, false, whole, frac, decimals, width);
+}
+
+char *fixfmt_int(char *p, int32_t v)
+{
+    return putNumber(p, (v < 0), (v < 0) ? -(uint32_t)v : (uint32_t)v, 0, 0, 0);
+}
+
+char *fixfmt_str(char *p, const char *s)
+{
+    while (*s != 0) {
+        *p++ = *s++;
+    }
+    return p;
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+// Sign, whole part, and frac as decimals digits, right aligned in width.
+static char *putNumber(char *p, bool neg, uint64_t whole, uint32_t frac,
+                       unsigned decimals, unsigned width)
+{
+    char digits[FIXFMT_MAX_LEN];
+    unsigned n = 0;
+
+    // Digits are produced backwards
+    for (unsigned d = 0; d < decimals; d++) {
+        digits[n++] = '0' + frac % 10;
+        frac /= 10;
+    }
+    if (decimals != 0) {
+        digits[n++] = '.';
+    }
+    do {
+        digits[n++] = '0' + whole % 10;
+        whole /= 10;
+    } while (whole != 0);
+    if (neg) {
+        digits[n++] = '-';
+    }
+
+    while (width > n) {
+        *p++ = ' ';
+        width--;
+    }
+    while (n > 0) {
+        *p++ = digits[--n];
+    }
+
+    return p;
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Fixed-point to ASCII formatting, without printf.
+ *
+ * Each function appends to a caller's buffer and returns the new end,
+ * so a line is built by chaining calls and then written out whole.
+ * No terminator is written.  Output matches printf for the equivalent
+ * conversion, (e.g. "%8.4f") except that exact ties round away from
+ * zero.
+ */
+
+#ifndef FIXFMT_H
+#define FIXFMT_H
+
+#include <stdint.h>
+
+// Most decimals fixfmt_q() and fixfmt_us() produce
+#define FIXFMT_MAX_DECIMALS (6)
+
+// Longest output of one fixfmt_q() or fixfmt_us() call without padding
+#define FIXFMT_MAX_LEN (28)
+
+// v with q fractional bits (q <= 16) as "%<width>.<decimals>f".
+char *fixfmt_q(char *p, int32_t v, unsigned q, unsigned decimals, unsigned width);
+
+// Microseconds as seconds, "%<width>.<decimals>f".
+char *fixfmt_us(char *p, uint64_t t_uS, unsigned decimals, unsigned width);
+
+// Decimal integer, "%d".
+char *fixfmt_int(char *p, int32_t v);
+
+// String, without its terminator.
+char *fixfmt_str(char *p, const char *s);
+
+#endif
@@ -0,0 +1,543 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Sensor stream recorder on SPI-NOR flash.
+ */
+
+#include "flash_log.h"
+
+#if FLASH_LOG
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdbool.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "cmsis_os.h"
+#include "sh2_err.h"
+#include "spi_nor.h"
+#include "console.h"
+#include "shell.h"
+#include "sysstats.h"
+#include "sensor_dispatch.h"
+#include "priorities.h"
+#include "rtos_static.h"
+
+// Directory entries, in sector 0
+#define SESSION_MAGIC (0x474F4C53)      // "SLOG"
+#define ERASED (0xFFFFFFFF)
+#define MAX_SESSIONS (SPI_NOR_SECTOR / sizeof(Session_t))
+#define DATA_START (SPI_NOR_SECTOR)
+
+// Session formats
+#define SESSION_BIN (1)
+#define SESSION_DELTA (2)
+
+// Recorder task events
+#define EVT_PAGE  (1u << 0)     // a page buffer is full
+#define EVT_START (1u << 1)
+#define EVT_STOP  (1u << 2)
+#define EVT_LIST  (1u << 3)
+#define EVT_DUMP  (1u << 4)
+#define EVT_ERASE (1u << 5)
+
+// ------------------------------------------------------------------------
+// Private types
+
+// Directory entry, programmed at start; end is programmed at stop
+typedef struct {
+    uint32_t magic;
+    uint32_t start;             // first byte
+    uint32_t end;               // one past the last, ERASED while recording
+    uint32_t format;
+} Session_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void recTask(const void *params);
+static void recordEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix);
+static unsigned ringFill(void);
+static void put(const uint8_t *p, unsigned len);
+static void scanDirectory(void);
+static uint32_t findEnd(uint32_t start);
+static bool pageErased(uint32_t addr);
+static void startSession(void);
+static void stopSession(const char *why);
+static void flushPages(void);
+static void listSessions(void);
+static void dumpSession(unsigned n);
+static void eraseAll(void);
+static void recCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+RTOS_STACK_DEF(recTaskStack, FLASH_LOG_STACK);
+static osThreadId recTaskHandle;
+static SPI_HandleTypeDef *recHspi;
+
+// Found by the recorder task
+static uint32_t chipBytes;
+static unsigned numSessions;
+static uint32_t nextStart;
+static volatile unsigned dumpIndex;
+
+// Session being recorded, written by the recorder task
+static volatile bool recording;
+static uint32_t sessionStart;
+static uint32_t writeAddr;
+static uint32_t erasedTo;
+
+// Page ring: the sensor task fills buf[filled % FLASH_LOG_BUFS] and
+// counts pages up in filled, the recorder task programs them and counts
+// up flushed.  Both run freely.
+static uint8_t buf[FLASH_LOG_BUFS][SPI_NOR_PAGE];
+static volatile uint32_t filled;
+static volatile uint32_t flushed;
+static unsigned fillPos;
+
+#if FLASH_LOG_DELTA
+static BinDelta_t delta;
+#else
+static uint8_t binSeq;
+#endif
+
+static uint32_t dropped;
+static uint32_t ioErrors;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void flashLog_init(SPI_HandleTypeDef *hspi)
+{
+    recHspi = hspi;
+
+#if FLASH_LOG_DELTA
+    sysstats_addMemory("rec buffers", sizeof(buf) + sizeof(delta));
+#else
+    sysstats_addMemory("rec buffers", sizeof(buf));
+#endif
+    sysstats_addCounter("rec dropped", &dropped);
+    shell_addCommand("rec", "[start | stop | list | dump <n> | erase] record sensors to SPI flash",
+                     recCmd);
+    sensorDispatch_subscribe(SENSOR_DISPATCH_ALL, PRIO_SUB_RECORD, recordEvent, 0);
+    sensorDispatch_addConsumer("rec", ringFill);
+
+    osThreadDef(recThreadDef, recTask, PRIO_TASK_RECORD, 0, FLASH_LOG_STACK);
+    recTaskHandle = rtos_threadCreate(osThread(recThreadDef), NULL, RTOS_STACK(recTaskStack));
+    if (recTaskHandle == NULL) {
+        printf("Failed to create recorder task.\n");
+    }
+}
+
+void flashLog_start(void)
+{
+    xTaskNotify(recTaskHandle, EVT_START, eSetBits);
+}
+
+void flashLog_stop(void)
+{
+    xTaskNotify(recTaskHandle, EVT_STOP, eSetBits);
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static void recTask(const void *params)
+{
+    uint32_t events;
+
+    chipBytes = spiNor_init(recHspi);
+    if (chipBytes == 0) {
+        printf("Rec: no SPI flash (id %06x).\n", (unsigned)spiNor_id());
+    }
+    else {
+        scanDirectory();
+        printf("Rec: %u KB SPI flash (id %06x), %u sessions, %u KB free.\n",
+               (unsigned)(chipBytes / 1024), (unsigned)spiNor_id(), numSessions,
+               (unsigned)((chipBytes - nextStart) / 1024));
+        if (FLASH_LOG_AUTOSTART) {
+            startSession();
+        }
+    }
+
+    for (;;) {
+        xTaskNotifyWait(0, UINT32_MAX, &events, portMAX_DELAY);
+
+        if (chipBytes == 0) {
+            if (events & ~EVT_PAGE) {
+                printf("Rec: no SPI flash.\n");
+            }
+            continue;
+        }
+        if (events & EVT_PAGE) {
+            flushPages();
+        }
+        if (events & EVT_START) {
+            startSession();
+        }
+        if (events & EVT_STOP) {
+            stopSession("stopped");
+        }
+        if (events & EVT_LIST) {
+            listSessions();
+        }
+        if (events & EVT_DUMP) {
+            dumpSession(dumpIndex);
+        }
+        if (events & EVT_ERASE) {
+            eraseAll();
+        }
+    }
+}
+
+// Dispatch callback, in the sensor task
+static void recordEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix)
+{
+    uint8_t frame[BIN_FRAME_MAX];
+    unsigned len;
+
+    if (!recording) {
+        return;
+    }
+
+#if FLASH_LOG_DELTA
+    len = sensorOutput_deltaFrame(&delta, frame, pEvent);
+#else
+    len = sensorOutput_binFrame(frame, &binSeq, pEvent);
+#endif
+    put(frame, len);
+}
+
+// How full the page ring is [permille], for backpressure.  In the
+// sensor task.
+static unsigned ringFill(void)
+{
+    if (!recording) {
+        return 0;
+    }
+    return ((filled - flushed) * SPI_NOR_PAGE + fillPos) * 1000 /
+           (FLASH_LOG_BUFS * SPI_NOR_PAGE);
+}
+
+// Append a frame to the page ring, or drop all of it if it does not fit.
+static void put(const uint8_t *p, unsigned len)
+{
+    unsigned space = (FLASH_LOG_BUFS - (filled - flushed)) * SPI_NOR_PAGE - fillPos;
+
+    if (len > space) {
+        dropped++;
+        return;
+    }
+
+    while (len > 0) {
+        unsigned n = SPI_NOR_PAGE - fillPos;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(&buf[filled % FLASH_LOG_BUFS][fillPos], p, n);
+        p += n;
+        len -= n;
+        fillPos += n;
+
+        if (fillPos == SPI_NOR_PAGE) {
+            fillPos = 0;
+            filled++;
+            xTaskNotify(recTaskHandle, EVT_PAGE, eSetBits);
+        }
+    }
+}
+
+// Count sessions and find where the next one goes, closing one left open.
+static void scanDirectory(void)
+{
+    Session_t s;
+
+    numSessions = 0;
+    nextStart = DATA_START;
+    while (numSessions < MAX_SESSIONS) {
+        if ((spiNor_read(numSessions * sizeof(s), &s, sizeof(s)) != SH2_OK) ||
+            (s.magic != SESSION_MAGIC)) {
+            break;
+        }
+        if (s.end == ERASED) {
+            // Recording when power was lost
+            s.end = findEnd(s.start);
+            spiNor_program(numSessions * sizeof(s) + offsetof(Session_t, end),
+                           &s.end, sizeof(s.end));
+        }
+        numSessions++;
+        nextStart = (s.end + SPI_NOR_SECTOR - 1) & ~(SPI_NOR_SECTOR - 1);
+    }
+}
+
+// End of the session from start: pages are programmed in order and the
+// ones after the last are erased, so binary search for the first erased
+// page.  (The last page may be partly programmed; its rest reads 0xFF and
+// the decoder skips it.)
+static uint32_t findEnd(uint32_t start)
+{
+    uint32_t lo = start / SPI_NOR_PAGE;         // pages below lo are programmed
+    uint32_t hi = chipBytes / SPI_NOR_PAGE;     // pages from hi on are erased
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (pageErased(mid * SPI_NOR_PAGE)) {
+            hi = mid;
+        }
+        else {
+            lo = mid + 1;
+        }
+    }
+    return lo * SPI_NOR_PAGE;
+}
+
+static bool pageErased(uint32_t addr)
+{
+    uint32_t page[SPI_NOR_PAGE / 4];
+
+    if (spiNor_read(addr, page, sizeof(page)) != SH2_OK) {
+        return false;
+    }
+    for (unsigned n = 0; n < SPI_NOR_PAGE / 4; n++) {
+        if (page[n] != ERASED) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void startSession(void)
+{
+    Session_t s;
+
+    if (recording) {
+        printf("Rec: already recording.\n");
+        return;
+    }
+    if (numSessions >= MAX_SESSIONS) {
+        printf("Rec: directory full, rec erase to start over.\n");
+        return;
+    }
+    if (nextStart + SPI_NOR_SECTOR > chipBytes) {
+        printf("Rec: flash full, rec erase to start over.\n");
+        return;
+    }
+
+    if (spiNor_eraseSector(nextStart) != SH2_OK) {
+        ioErrors++;
+        printf("Rec: erase failed.\n");
+        return;
+    }
+
+    s.magic = SESSION_MAGIC;
+    s.start = nextStart;
+    s.end = ERASED;
+    s.format = FLASH_LOG_DELTA ? SESSION_DELTA : SESSION_BIN;
+    if (spiNor_program(numSessions * sizeof(s), &s, sizeof(s)) != SH2_OK) {
+        ioErrors++;
+        printf("Rec: directory write failed.\n");
+        return;
+    }
+
+    sessionStart = nextStart;
+    writeAddr = nextStart;
+    erasedTo = nextStart + SPI_NOR_SECTOR;
+    filled = 0;
+    flushed = 0;
+    fillPos = 0;
+    dropped = 0;
+#if FLASH_LOG_DELTA
+    sensorOutput_deltaReset(&delta);
+#endif
+
+    // The sensor task starts filling buffers from here
+    recording = true;
+    printf("Rec: session %u at 0x%06x.\n", numSessions, (unsigned)sessionStart);
+}
+
+static void stopSession(const char *why)
+{
+    uint32_t end;
+
+    if (!recording) {
+        return;
+    }
+    recording = false;
+
+    // The sensor task outranks this one, so it is never part way through
+    // put() here; with the scheduler suspended it cannot start either.
+    vTaskSuspendAll();
+    end = writeAddr + (filled - flushed) * SPI_NOR_PAGE + fillPos;
+    if (fillPos != 0) {
+        memset(&buf[filled % FLASH_LOG_BUFS][fillPos], 0xFF, SPI_NOR_PAGE - fillPos);
+        fillPos = 0;
+        filled++;
+    }
+    xTaskResumeAll();
+    flushPages();
+
+    // The last pages may not have fit
+    if (end > writeAddr) {
+        end = writeAddr;
+    }
+    spiNor_program(numSessions * sizeof(Session_t) + offsetof(Session_t, end),
+                   &end, sizeof(end));
+    printf("Rec: session %u %s, %u bytes, %u frames dropped.\n",
+           numSessions, why, (unsigned)(end - sessionStart), (unsigned)dropped);
+
+    numSessions++;
+    nextStart = (end + SPI_NOR_SECTOR - 1) & ~(SPI_NOR_SECTOR - 1);
+}
+
+// Program the full pages, keeping one sector erased ahead of the writes.
+static void flushPages(void)
+{
+    while (flushed != filled) {
+        if (writeAddr + SPI_NOR_PAGE > chipBytes) {
+            flushed = filled;
+            stopSession("full");
+            return;
+        }
+
+        // Erase the next sector at the start of this one, so the erase
+        // overlaps a sector's worth of filling
+        while (erasedTo <= writeAddr + SPI_NOR_SECTOR) {
+            if (erasedTo >= chipBytes) {
+                break;
+            }
+            if (spiNor_eraseSector(erasedTo) != SH2_OK) {
+                ioErrors++;
+            }
+            erasedTo += SPI_NOR_SECTOR;
+        }
+
+        if (spiNor_program(writeAddr, buf[flushed % FLASH_LOG_BUFS], SPI_NOR_PAGE) != SH2_OK) {
+            ioErrors++;
+        }
+        writeAddr += SPI_NOR_PAGE;
+        flushed++;
+    }
+}
+
+static void listSessions(void)
+{
+    Session_t s;
+
+    printf("Rec: %u KB flash, %u KB free, %u I/O errors%s\n",
+           (unsigned)(chipBytes / 1024), (unsigned)((chipBytes - nextStart) / 1024),
+           (unsigned)ioErrors, recording ? ", recording" : "");
+    printf("  %3s %8s %10s %6s\n", "n", "start", "bytes", "format");
+    for (unsigned n = 0; n <= numSessions && n < MAX_SESSIONS; n++) {
+        if ((spiNor_read(n * sizeof(s), &s, sizeof(s)) != SH2_OK) ||
+            (s.magic != SESSION_MAGIC)) {
+            break;
+        }
+        if (s.end == ERASED) {
+            s.end = writeAddr;
+        }
+        printf("  %3u %08x %10u %6s\n", n, (unsigned)s.start,
+               (unsigned)(s.end - s.start),
+               (s.format == SESSION_DELTA) ? "delta" : "bin");
+    }
+}
+
+// Write a session raw on the console, as a capture for bin2dsf.py.
+static void dumpSession(unsigned n)
+{
+    Session_t s;
+    uint8_t page[SPI_NOR_PAGE];
+
+    if (recording) {
+        printf("Rec: stop recording first.\n");
+        return;
+    }
+    if ((n >= numSessions) ||
+        (spiNor_read(n * sizeof(s), &s, sizeof(s)) != SH2_OK)) {
+        printf("Rec: no session %u.\n", n);
+        return;
+    }
+
+    for (uint32_t addr = s.start; addr < s.end; addr += sizeof(page)) {
+        unsigned len = (s.end - addr < sizeof(page)) ? s.end - addr : sizeof(page);
+        if (spiNor_read(addr, page, len) != SH2_OK) {
+            ioErrors++;
+            break;
+        }
+        console_writeRaw(page, len);
+    }
+}
+
+static void eraseAll(void)
+{
+    if (recording) {
+        printf("Rec: stop recording first.\n");
+        return;
+    }
+
+    printf("Rec: erasing flash...\n");
+    if (spiNor_eraseChip() != SH2_OK) {
+        ioErrors++;
+        printf("Rec: erase failed.\n");
+    }
+    scanDirectory();
+    printf("Rec: %u KB free.\n", (unsigned)((chipBytes - nextStart) / 1024));
+}
+
+// Shell command: control recording and read sessions back.
+static void recCmd(int argc, char *argv[])
+{
+    if ((argc == 1) || (strcmp(argv[1], "list") == 0)) {
+        xTaskNotify(recTaskHandle, EVT_LIST, eSetBits);
+    }
+    else if (strcmp(argv[1], "start") == 0) {
+        flashLog_start();
+    }
+    else if (strcmp(argv[1], "stop") == 0) {
+        flashLog_stop();
+    }
+    else if ((argc > 2) && (strcmp(argv[1], "dump") == 0)) {
+        dumpIndex = strtoul(argv[2], 0, 0);
+        xTaskNotify(recTaskHandle, EVT_DUMP, eSetBits);
+    }
+    else if (strcmp(argv[1], "erase") == 0) {
+        xTaskNotify(recTaskHandle, EVT_ERASE, eSetBits);
+    }
+    else {
+        printf("usage: %s [start | stop | list | dump <n> | erase]\n", argv[0]);
+    }
+}
+
+#else
+
+void flashLog_init(SPI_HandleTypeDef *hspi)
+{
+}
+
+void flashLog_start(void)
+{
+}
+
+void flashLog_stop(void)
+{
+}
+
+#endif
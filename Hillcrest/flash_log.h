@@ -0,0 +1,78 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Recording of the sensor stream to the SPI-NOR flash (spi_nor.h), for
+ * runs with no host attached.
+ *
+ * Every report the sensor task dispatches is framed as on the console
+ * (delta coded with FLASH_LOG_DELTA, plain binary frames otherwise, see
+ * sensor_output.h) into a ring of page buffers.  The recorder task
+ * programs each full page and erases the next sector while the current
+ * one fills.  The sensor task never waits: when no buffer is free the
+ * frame is dropped and counted, and the decoder resyncs at the sensor's
+ * next keyframe.  Recording does not depend on the console output mode or
+ * its deadband.
+ *
+ * Flash layout: sector 0 holds the session directory; each session
+ * starts on a sector boundary after the last.  A session that was never
+ * stopped (power lost) is closed at the next boot, at its first erased
+ * page.  "rec dump <n>" writes one raw on the console for bin2dsf.py.
+ */
+
+#ifndef FLASH_LOG_H
+#define FLASH_LOG_H
+
+#include "stm32f4xx_hal.h"
+#include "sensor_output.h"
+
+// Build in the recorder
+#ifndef FLASH_LOG
+#define FLASH_LOG (1)
+#endif
+
+// Page buffers between the sensor task and the flash.  They must cover
+// a sector erase (up to ~400 ms) at the recorded data rate.
+#ifndef FLASH_LOG_BUFS
+#define FLASH_LOG_BUFS (8)
+#endif
+
+// Record delta-coded frames (about half the size of plain ones)
+#ifndef FLASH_LOG_DELTA
+#define FLASH_LOG_DELTA (BIN_DELTA)
+#endif
+
+// Start a session at boot, for untethered runs
+#ifndef FLASH_LOG_AUTOSTART
+#define FLASH_LOG_AUTOSTART (0)
+#endif
+
+#ifndef FLASH_LOG_STACK
+#define FLASH_LOG_STACK (384)
+#endif
+
+// Register the "rec" command, subscribe to every sensor and start the
+// recorder task, which looks for the flash on hspi (shared with the hub
+// through spi_bus).
+void flashLog_init(SPI_HandleTypeDef *hspi);
+
+// Start or stop a session.  They return at once; the recorder task does
+// the work and prints the outcome.
+void flashLog_start(void);
+void flashLog_stop(void);
+
+#endif
@@ -0,0 +1,156 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * FRS configuration cache.
+ */
+
+#include "frs_cache.h"
+
+#include <string.h>
+#include "sh2.h"
+#include "sh2_err.h"
+#include "latency.h"
+#include "timebase.h"
+
+// ------------------------------------------------------------------------
+// Private types
+
+typedef struct {
+    bool valid;
+    uint16_t recordId;
+    uint16_t words;
+    uint32_t data[FRS_CACHE_MAX_WORDS];  // what the hub holds
+} FrsCacheEntry_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static FrsCacheEntry_t *lookup(uint16_t recordId);
+static bool matches(const FrsCacheEntry_t *e, const uint32_t *pData, uint16_t words);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static FrsCacheEntry_t cache[FRS_CACHE_ENTRIES];
+static unsigned nextVictim;
+
+// Record read back from the hub
+static uint32_t stored[FRS_CACHE_MAX_WORDS];
+
+// ------------------------------------------------------------------------
+// Public API
+
+int frsCache_set(uint16_t recordId, const uint32_t *pData, uint16_t words, bool *pWritten)
+{
+    FrsCacheEntry_t *e = lookup(recordId);
+    bool same = false;
+    int status;
+
+    if (pWritten != 0) {
+        *pWritten = false;
+    }
+
+    if ((e != 0) && matches(e, pData, words)) {
+        // Known to be on the hub already
+        return SH2_OK;
+    }
+
+    if (words <= FRS_CACHE_MAX_WORDS) {
+        uint16_t storedWords = FRS_CACHE_MAX_WORDS;
+
+        uint64_t start_uS = timebase_getUs();
+        status = sh2_getFrs(recordId, stored, &storedWords);
+        latency_cmd(LAT_CMD_GET_FRS, start_uS);
+        same = (status == SH2_OK) && (storedWords == words) &&
+               (memcmp(stored, pData, words * sizeof(uint32_t)) == 0);
+    }
+
+    if (!same) {
+        // (sh2_setFrs() doesn't modify the data, it just isn't declared const.)
+        uint64_t start_uS = timebase_getUs();
+        status = sh2_setFrs(recordId, (uint32_t *)pData, words);
+        latency_cmd(LAT_CMD_SET_FRS, start_uS);
+        if (status != SH2_OK) {
+            frsCache_invalidate(recordId);
+            return status;
+        }
+        if (pWritten != 0) {
+            *pWritten = true;
+        }
+#if FRS_CACHE_VERIFY
+        if (words <= FRS_CACHE_MAX_WORDS) {
+            uint16_t storedWords = FRS_CACHE_MAX_WORDS;
+
+            start_uS = timebase_getUs();
+            status = sh2_getFrs(recordId, stored, &storedWords);
+            latency_cmd(LAT_CMD_GET_FRS, start_uS);
+            if ((status == SH2_OK) &&
+                ((storedWords != words) ||
+                 (memcmp(stored, pData, words * sizeof(uint32_t)) != 0))) {
+                status = SH2_ERR_IO;
+            }
+            if (status != SH2_OK) {
+                frsCache_invalidate(recordId);
+                return status;
+            }
+        }
+#endif
+    }
+
+    if (words <= FRS_CACHE_MAX_WORDS) {
+        if (e == 0) {
+            e = &cache[nextVictim];
+            nextVictim = (nextVictim + 1) % FRS_CACHE_ENTRIES;
+        }
+        e->recordId = recordId;
+        e->words = words;
+        memcpy(e->data, pData, words * sizeof(uint32_t));
+        e->valid = true;
+    }
+
+    return SH2_OK;
+}
+
+void frsCache_invalidate(uint16_t recordId)
+{
+    FrsCacheEntry_t *e = lookup(recordId);
+
+    if (e != 0) {
+        e->valid = false;
+    }
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static FrsCacheEntry_t *lookup(uint16_t recordId)
+{
+    for (int n = 0; n < FRS_CACHE_ENTRIES; n++) {
+        if (cache[n].valid && (cache[n].recordId == recordId)) {
+            return &cache[n];
+        }
+    }
+
+    return 0;
+}
+
+static bool matches(const FrsCacheEntry_t *e, const uint32_t *pData, uint16_t words)
+{
+    return (e->words == words) &&
+           (memcmp(e->data, pData, words * sizeof(uint32_t)) == 0);
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * FRS configuration cache.
+ *
+ * FRS records live in hub flash: writing one is slow and wears it, and
+ * most configuration is the same from one boot to the next.
+ * frsCache_set() reads the record back and only writes it when it
+ * differs.  Records known to match are remembered, so recovering from a
+ * later hub reset costs neither a read nor a write.
+ *
+ * Like the rest of the SH-2 API, call from the demo task only.
+ */
+
+#ifndef FRS_CACHE_H
+#define FRS_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Number of records remembered, and the largest one that can be
+#ifndef FRS_CACHE_ENTRIES
+#define FRS_CACHE_ENTRIES (4)
+#endif
+#ifndef FRS_CACHE_MAX_WORDS
+#define FRS_CACHE_MAX_WORDS (16)
+#endif
+
+// Read a record back after writing it, and fail the set (SH2_ERR_IO) if
+// the hub doesn't hold what was written.  One more round trip per write.
+#ifndef FRS_CACHE_VERIFY
+#define FRS_CACHE_VERIFY (1)
+#endif
+
+// Make the hub's record recordId hold pData.  *pWritten (if not NULL)
+// tells whether a write was needed.  Returns an SH2_ERR code.
+int frsCache_set(uint16_t recordId, const uint32_t *pData, uint16_t words, bool *pWritten);
+
+// The record was changed behind the cache's back (e.g. by "frs set").
+void frsCache_invalidate(uint16_t recordId);
+
+#endif
@@ -0,0 +1,137 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Low-latency path for Gyro Integrated RV reports.
+ */
+
+#include "girv_fast.h"
+
+#include <stdio.h>
+#include <string.h>
+#include "stm32f4xx.h"
+#include "sh2_err.h"
+#include "sensor_fix.h"
+#include "latency.h"
+#include "timebase.h"
+#include "shell.h"
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void girvCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+// Odd while the HAL task is writing slot
+static volatile uint32_t seq;
+static GirvFastPose_t slot;
+
+// Reads that had to copy again, and that gave up
+static volatile uint32_t retries;
+static volatile uint32_t busy;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void girvFast_init(void)
+{
+    shell_addCommand("girv", "latest GIRV pose from the HAL task fast path", girvCmd);
+}
+
+bool girvFast_publish(const sh2_SensorEvent_t *pEvent, uint64_t intn_uS)
+{
+    SensorFix_t fix;
+
+    if ((pEvent->reportId != SH2_GYRO_INTEGRATED_RV) ||
+        (sensorFix_decode(&fix, pEvent) != SH2_OK)) {
+        return false;
+    }
+
+    seq = seq + 1;
+    // The odd count must be visible before any of the slot changes
+    __DMB();
+    slot.i = fix.un.girv.i;
+    slot.j = fix.un.girv.j;
+    slot.k = fix.un.girv.k;
+    slot.real = fix.un.girv.real;
+    slot.angVelX = fix.un.girv.angVelX;
+    slot.angVelY = fix.un.girv.angVelY;
+    slot.angVelZ = fix.un.girv.angVelZ;
+    slot.intn_uS = intn_uS;
+    slot.timestamp_uS = pEvent->timestamp_uS;
+    slot.count++;
+    __DMB();
+    seq = seq + 1;
+
+    latency_record(LAT_POSE, intn_uS);
+
+    return true;
+}
+
+int girvFast_read(GirvFastPose_t *pPose)
+{
+    for (unsigned n = 0; n < GIRV_FAST_READ_TRIES; n++) {
+        uint32_t before = seq;
+
+        // Read of seq must complete before the slot is read, and the
+        // slot before seq is read again
+        __DMB();
+        *pPose = slot;
+        __DMB();
+
+        if (((before & 1) == 0) && (seq == before)) {
+            return (pPose->count != 0) ? SH2_OK : SH2_ERR;
+        }
+        retries++;
+    }
+
+    busy++;
+    return SH2_ERR_OP_IN_PROGRESS;
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static void girvCmd(int argc, char *argv[])
+{
+    GirvFastPose_t p;
+    int status = girvFast_read(&p);
+
+    if (status == SH2_ERR) {
+        printf("No Gyro Integrated RV reports yet (sub %d <interval us>).\n",
+               SH2_GYRO_INTEGRATED_RV);
+        return;
+    }
+    if (status != SH2_OK) {
+        printf("Error: %d, reading the pose.\n", status);
+        return;
+    }
+
+    printf("r:%6.3f i:%6.3f j:%6.3f k:%6.3f  w: %7.3f %7.3f %7.3f rad/s\n",
+           FIX_TO_FLOAT(SENSORFIX_Q_QUAT, p.real), FIX_TO_FLOAT(SENSORFIX_Q_QUAT, p.i),
+           FIX_TO_FLOAT(SENSORFIX_Q_QUAT, p.j), FIX_TO_FLOAT(SENSORFIX_Q_QUAT, p.k),
+           FIX_TO_FLOAT(SENSORFIX_Q_ANGVEL, p.angVelX),
+           FIX_TO_FLOAT(SENSORFIX_Q_ANGVEL, p.angVelY),
+           FIX_TO_FLOAT(SENSORFIX_Q_ANGVEL, p.angVelZ));
+    printf("sample %u, %u us old; reads retried %u, busy %u\n",
+           p.count, (uint32_t)(timebase_getUs() - p.intn_uS), retries, busy);
+#if GIRV_FAST_ONLY
+    printf("GIRV_FAST_ONLY: GIRV does not reach the sensor task.\n");
+#endif
+}
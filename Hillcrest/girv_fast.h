@@ -0,0 +1,86 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Low-latency path for Gyro Integrated RV reports.
+ *
+ * At 1kHz GIRV is too fast for the generic pipeline: the sensor ring,
+ * hub clock correction, dispatch and console output all sit between
+ * the hub and the pose.  Here sensorHandler(), in the HAL task, decodes
+ * each GIRV report as SHTP delivers it and publishes it into a single
+ * "latest pose" slot guarded by a sequence counter (a seqlock).
+ *
+ * The HAL task is the only writer and never waits for readers.  Readers
+ * copy the slot and retry if the counter shows a write overlapped the
+ * copy, so they never block the writer or each other.  A reader that
+ * preempts the HAL task in the middle of a write (an ISR, or a task of
+ * higher priority) would see that write never finish: it gives up
+ * after GIRV_FAST_READ_TRIES copies.
+ *
+ * The pose is stamped with the INTN edge on the timebase_getUs() clock.
+ * GIRV is sent as soon as the hub computes it, so that edge is the
+ * sample time to within the hub's own processing; the hub timestamp is
+ * kept too, uncorrected.  The "lat" command shows the fast path as its
+ * own stage, from INTN to the pose being readable.
+ */
+
+#ifndef GIRV_FAST_H
+#define GIRV_FAST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sh2.h"
+
+// Build in the fast path
+#ifndef GIRV_FAST
+#define GIRV_FAST (1)
+#endif
+
+// 1 keeps GIRV reports out of the sensor ring altogether: only the fast
+// path sees them (no stats, output, recording or "pose" prediction).
+// For 1kHz GIRV where nothing else needs the stream.
+#ifndef GIRV_FAST_ONLY
+#define GIRV_FAST_ONLY (0)
+#endif
+
+// Copies a reader attempts before reporting the slot busy
+#ifndef GIRV_FAST_READ_TRIES
+#define GIRV_FAST_READ_TRIES (4)
+#endif
+
+// Latest GIRV sample
+typedef struct {
+    int16_t i, j, k, real;              // Q SENSORFIX_Q_QUAT
+    int16_t angVelX, angVelY, angVelZ;  // Q SENSORFIX_Q_ANGVEL
+    uint64_t intn_uS;                   // INTN edge, timebase_getUs() clock
+    uint64_t timestamp_uS;              // hub timestamp, as reported
+    uint32_t count;                     // samples published so far
+} GirvFastPose_t;
+
+// Register the "girv" command.
+void girvFast_init(void);
+
+// Publish pEvent if it is a GIRV report, which arrived with the INTN
+// edge at intn_uS.  Returns true if it was one.  HAL task only.
+bool girvFast_publish(const sh2_SensorEvent_t *pEvent, uint64_t intn_uS);
+
+// Copy the latest sample to *pPose, without blocking.  Safe from any
+// task.  Returns SH2_OK, SH2_ERR if no GIRV sample has been published,
+// or SH2_ERR_OP_IN_PROGRESS if a write kept overlapping the copy.
+int girvFast_read(GirvFastPose_t *pPose);
+
+#endif
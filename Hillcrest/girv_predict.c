@@ -0,0 +1,180 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Orientation prediction from Gyro Integrated RV reports.
+ */
+
+#include "girv_predict.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "sh2_err.h"
+#include "timebase.h"
+#include "shell.h"
+#include "sensor_dispatch.h"
+#include "priorities.h"
+
+// Below this rotation angle, the axis of the angular velocity is noise
+#define MIN_ANGLE (1.0e-6f)
+
+// ------------------------------------------------------------------------
+// Private types
+
+typedef struct {
+    Quat_t q;
+    Vec3_t angVel;    // rad/s, body frame
+    uint64_t t_uS;
+} GirvSample_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static Quat_t extrapolate(const GirvSample_t *s, float dt);
+static void girvEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix);
+static void poseCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+// Written by the sensor task, read by any task: copied in and out under a
+// critical section, since a reader may preempt the writer.
+static GirvSample_t latest;
+static GirvSample_t previous;
+static unsigned samples;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void girvPredict_init(void)
+{
+    samples = 0;
+    shell_addCommand("pose", "[ahead us] GIRV orientation now, or predicted ahead", poseCmd);
+    sensorDispatch_subscribe(SH2_GYRO_INTEGRATED_RV, PRIO_SUB_PREDICT, girvEvent, 0);
+}
+
+void girvPredict_update(const SensorFix_t *fix)
+{
+    GirvSample_t s;
+
+    if (fix->kind != SENSORFIX_GIRV) {
+        return;
+    }
+
+    s.q = quat_fromFix(fix);
+    s.angVel.x = FIX_TO_FLOAT(SENSORFIX_Q_ANGVEL, fix->un.girv.angVelX);
+    s.angVel.y = FIX_TO_FLOAT(SENSORFIX_Q_ANGVEL, fix->un.girv.angVelY);
+    s.angVel.z = FIX_TO_FLOAT(SENSORFIX_Q_ANGVEL, fix->un.girv.angVelZ);
+    s.t_uS = fix->timestamp_uS;
+
+    taskENTER_CRITICAL();
+    previous = latest;
+    latest = s;
+    if (samples < 2) {
+        samples++;
+    }
+    taskEXIT_CRITICAL();
+}
+
+int girvPredict_at(uint64_t t_uS, Quat_t *pQ)
+{
+    GirvSample_t a, b;
+    unsigned n;
+
+    taskENTER_CRITICAL();
+    a = previous;
+    b = latest;
+    n = samples;
+    taskEXIT_CRITICAL();
+
+    if (n == 0) {
+        return SH2_ERR;
+    }
+
+    if (t_uS >= b.t_uS) {
+        // Ahead of the latest sample: integrate its angular velocity
+        uint64_t ahead = t_uS - b.t_uS;
+        if (ahead > GIRV_PREDICT_MAX_US) {
+            ahead = GIRV_PREDICT_MAX_US;
+        }
+        *pQ = extrapolate(&b, ahead * 1.0e-6f);
+    }
+    else if ((n > 1) && (t_uS > a.t_uS) && (b.t_uS > a.t_uS)) {
+        // Between the two samples
+        *pQ = quat_slerp(a.q, b.q, (float)(t_uS - a.t_uS) / (float)(b.t_uS - a.t_uS));
+    }
+    else {
+        // Older than we remember
+        *pQ = (n > 1) ? a.q : b.q;
+    }
+
+    return SH2_OK;
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+// q(t + dt) = q(t) * exp(w dt / 2), for constant body rate w
+static Quat_t extrapolate(const GirvSample_t *s, float dt)
+{
+    Vec3_t w = s->angVel;
+    float rate = sqrtf(w.x*w.x + w.y*w.y + w.z*w.z);
+    float angle = rate * dt;
+    Quat_t dq;
+
+    if (angle < MIN_ANGLE) {
+        return s->q;
+    }
+
+    float k = sinf(0.5f * angle) / rate;
+    dq.w = cosf(0.5f * angle);
+    dq.x = w.x * k;
+    dq.y = w.y * k;
+    dq.z = w.z * k;
+
+    return quat_normalize(quat_mul(s->q, dq));
+}
+
+// Dispatch callback for GIRV events, in the sensor task
+static void girvEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix)
+{
+    if (pFix != 0) {
+        girvPredict_update(pFix);
+    }
+}
+
+static void poseCmd(int argc, char *argv[])
+{
+    uint32_t ahead = (argc > 1) ? strtoul(argv[1], 0, 0) : 0;
+    Quat_t q;
+    Euler_t e;
+    const float toDeg = 180.0f / 3.14159265f;
+
+    if (girvPredict_at(timebase_getUs() + ahead, &q) != SH2_OK) {
+        printf("No Gyro Integrated RV reports yet (sub %d <interval us>).\n",
+               SH2_GYRO_INTEGRATED_RV);
+        return;
+    }
+
+    e = quat_toEuler(q);
+    printf("r:%6.3f i:%6.3f j:%6.3f k:%6.3f  roll %7.2f pitch %7.2f yaw %7.2f deg\n",
+           q.w, q.x, q.y, q.z, e.roll * toDeg, e.pitch * toDeg, e.yaw * toDeg);
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Orientation prediction from Gyro Integrated RV reports.
+ *
+ * Keeps the two latest GIRV samples and answers "what is the orientation
+ * at time t?" for any t on the timebase_getUs() clock: between the two
+ * samples by slerp, after the latest by integrating its angular velocity
+ * forward.  A render loop can ask for the pose at scan-out time.
+ *
+ * This runs on top of any prediction configured in the hub (see
+ * the "hmd" profile in config_profile.c); with hub prediction on, the
+ * samples are already a prediction amount ahead.
+ */
+
+#ifndef GIRV_PREDICT_H
+#define GIRV_PREDICT_H
+
+#include <stdint.h>
+#include "sensor_fix.h"
+#include "quat.h"
+
+// Furthest beyond the latest sample to extrapolate.  Requests further
+// out are predicted to this horizon only.
+#ifndef GIRV_PREDICT_MAX_US
+#define GIRV_PREDICT_MAX_US (50000)
+#endif
+
+// Register the "pose" command and subscribe to GIRV reports.
+void girvPredict_init(void);
+
+// Feed a decoded Gyro Integrated RV report.  Other kinds are ignored.
+// girvPredict_init() subscribes this to dispatched GIRV events; call it
+// directly only for samples from elsewhere.  Only one task may feed it.
+void girvPredict_update(const SensorFix_t *fix);
+
+// Orientation at t_uS.  Safe to call from any task.
+// Returns SH2_OK, or SH2_ERR if no GIRV sample has been seen yet.
+int girvPredict_at(uint64_t t_uS, Quat_t *pQ);
+
+#endif
@@ -0,0 +1,52 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Output pins driven through BSRR: setting or clearing a pin is a single
+ * store, with no read-modify-write to race an ISR on the same port.
+ * A GpioPin_t names the pin, so each device instance keeps its own.
+ */
+
+#ifndef GPIO_FAST_H
+#define GPIO_FAST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "stm32f4xx.h"
+
+typedef struct {
+    GPIO_TypeDef *port;
+    uint16_t pin;           // GPIO_PIN_x mask
+} GpioPin_t;
+
+static inline void gpioFast_set(const GpioPin_t *p)
+{
+    p->port->BSRR = p->pin;
+}
+
+static inline void gpioFast_clr(const GpioPin_t *p)
+{
+    p->port->BSRR = (uint32_t)p->pin << 16;
+}
+
+// Drive the pin high if state, else low.
+static inline void gpioFast_write(const GpioPin_t *p, bool state)
+{
+    p->port->BSRR = state ? p->pin : ((uint32_t)p->pin << 16);
+}
+
+#endif
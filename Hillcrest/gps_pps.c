@@ -0,0 +1,256 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * GPS PPS discipline of the host timebase.
+ */
+
+#include "gps_pps.h"
+
+#if GPS_PPS
+
+#include <stdio.h>
+#include <string.h>
+#include "stm32f4xx_hal.h"
+#include "shell.h"
+#include "sysstats.h"
+#include "timebase.h"
+#include "exti.h"
+#include "isr_stamp.h"
+
+#define US_PER_S (1000000)
+
+// ------------------------------------------------------------------------
+// Private types
+
+typedef enum {
+    PPS_NONE,               // waiting for a first pulse
+    PPS_FREQ,               // one pulse seen, the next gives the frequency
+    PPS_TRACK,              // on the loop
+} PpsState_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void ppsEdge(void *arg, uint16_t pin, uint64_t t_uS);
+static void acquire(uint64_t t_uS, int64_t dt_us, uint32_t k);
+static void track(uint64_t t_uS);
+static void ppsCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+// EXTI ISR only, read unlocked by the shell
+static volatile PpsState_t state;
+static uint64_t last_uS;            // previous pulse
+static int32_t freqPpb;             // integral term: the learned frequency
+static volatile int32_t phase_us;   // at the latest pulse, +: ahead of GPS
+static volatile uint32_t lockCount;
+static IsrStamp_t latest;           // for the shell and gpsPps_locked()
+static GpsPpsWidthFn_t *volatile widthFn;
+static uint64_t rise_uS;            // rising edge of the pulse on the line, 0 if none
+
+static uint32_t pulses;
+static uint32_t glitches;           // under half a second after the last
+static uint32_t gaps;               // more than PPS_MAX_GAP_S missing
+static uint32_t steps;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void gpsPps_init(void)
+{
+    __GPIOB_CLK_ENABLE();
+    gpsPps_setWidthFn(0);
+
+    state = PPS_NONE;
+    exti_register(GPS_PPS_PIN, ppsEdge, 0);
+
+    sysstats_addCounter("PPS pulses", &pulses);
+    shell_addCommand("pps", "GPS PPS timebase discipline", ppsCmd);
+}
+
+bool gpsPps_locked(void)
+{
+    uint32_t count;
+    uint64_t t_uS = isrStamp_read(&latest, &count);
+
+    // A pulse missed is still locked, two are not
+    return (state == PPS_TRACK) && (lockCount >= PPS_LOCK_S) &&
+           (timebase_getUs() - t_uS < 2 * (uint64_t)US_PER_S);
+}
+
+void gpsPps_setWidthFn(GpsPpsWidthFn_t *fn)
+{
+    GPIO_InitTypeDef GPIO_InitStruct;
+
+    rise_uS = 0;
+    widthFn = fn;
+
+    memset(&GPIO_InitStruct, 0, sizeof(GPIO_InitStruct));
+    GPIO_InitStruct.Pin = GPS_PPS_PIN;
+    GPIO_InitStruct.Mode = (fn != 0) ? GPIO_MODE_IT_RISING_FALLING : GPIO_MODE_IT_RISING;
+    GPIO_InitStruct.Pull = GPIO_PULLDOWN;
+    HAL_GPIO_Init(GPS_PPS_PORT, &GPIO_InitStruct);
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+// A rising edge, from the EXTI ISR at PRIO_IRQ_INTN
+static void ppsEdge(void *arg, uint16_t pin, uint64_t t_uS)
+{
+    int64_t dt_us = (int64_t)(t_uS - last_uS);
+    uint32_t k = (uint32_t)((dt_us + US_PER_S/2) / US_PER_S);
+    GpsPpsWidthFn_t *fn = widthFn;
+
+    if ((fn != 0) && (HAL_GPIO_ReadPin(GPS_PPS_PORT, GPS_PPS_PIN) == GPIO_PIN_RESET)) {
+        // Falling edge (pulses are far wider than the ISR's latency)
+        if ((rise_uS != 0) && (state == PPS_TRACK)) {
+            uint32_t secs = fn(rise_uS, (uint32_t)(t_uS - rise_uS));
+
+            if (secs != 0) {
+                timebase_stepUs(secs * US_PER_S);
+                last_uS += (uint64_t)secs * US_PER_S;
+                steps++;
+            }
+        }
+        rise_uS = 0;
+        return;
+    }
+    rise_uS = 0;
+
+    pulses++;
+    isrStamp_write(&latest, t_uS);
+
+    if (state == PPS_NONE) {
+        last_uS = t_uS;
+        state = PPS_FREQ;
+        return;
+    }
+    if (k == 0) {
+        // Too soon for a pulse: noise on the line
+        glitches++;
+        return;
+    }
+    if (k > PPS_MAX_GAP_S) {
+        // Start over from this pulse, holding the frequency meanwhile
+        gaps++;
+        lockCount = 0;
+        last_uS = t_uS;
+        state = PPS_FREQ;
+        return;
+    }
+
+    if (state == PPS_FREQ) {
+        acquire(t_uS, dt_us, k);
+    }
+    else {
+        last_uS = t_uS;
+        track(t_uS);
+    }
+
+    // On the (possibly stepped) count, for the falling edge
+    rise_uS = last_uS;
+}
+
+// Second pulse: take out the frequency error at once, then step onto
+// the second
+static void acquire(uint64_t t_uS, int64_t dt_us, uint32_t k)
+{
+    // +: the count runs fast
+    int32_t errPpb = (int32_t)((dt_us - (int64_t)k * US_PER_S) * 1000 / k);
+    uint32_t ahead = (uint32_t)(t_uS % US_PER_S);
+    uint32_t step = (ahead != 0) ? US_PER_S - ahead : 0;
+
+    freqPpb = timebase_getRatePpb() - errPpb;
+    timebase_setRatePpb(freqPpb);
+    freqPpb = timebase_getRatePpb();
+    timebase_stepUs(step);
+    steps++;
+
+    last_uS = t_uS + step;
+    phase_us = 0;
+    lockCount = 0;
+    state = PPS_TRACK;
+}
+
+// A pulse on the loop
+static void track(uint64_t t_uS)
+{
+    int32_t ph = (int32_t)(t_uS % US_PER_S);
+    int32_t slewPpb;
+
+    if (ph >= US_PER_S/2) {
+        ph -= US_PER_S;
+    }
+    phase_us = ph;
+
+    if (ph < -PPS_RESYNC_US) {
+        // Far behind: step forward onto the second
+        timebase_stepUs(-ph);
+        last_uS = t_uS - ph;
+        steps++;
+        lockCount = 0;
+        return;
+    }
+
+    if ((ph < PPS_LOCK_US) && (ph > -PPS_LOCK_US)) {
+        if (lockCount < PPS_LOCK_S) {
+            lockCount++;
+        }
+    }
+    else {
+        lockCount = 0;
+    }
+
+    // 1us per second is 1000ppb
+    freqPpb -= ph * 1000 / PPS_FREQ_GAIN;
+    if (freqPpb > TIMEBASE_MAX_RATE_PPB) {
+        freqPpb = TIMEBASE_MAX_RATE_PPB;
+    }
+    else if (freqPpb < -TIMEBASE_MAX_RATE_PPB) {
+        freqPpb = -TIMEBASE_MAX_RATE_PPB;
+    }
+    slewPpb = -ph * (1000 / PPS_PHASE_GAIN);
+    if (slewPpb > PPS_MAX_SLEW_PPB) {
+        slewPpb = PPS_MAX_SLEW_PPB;
+    }
+    else if (slewPpb < -PPS_MAX_SLEW_PPB) {
+        slewPpb = -PPS_MAX_SLEW_PPB;
+    }
+    timebase_setRatePpb(freqPpb + slewPpb);
+}
+
+static void ppsCmd(int argc, char *argv[])
+{
+    static const char *const names[] = {"no pulses", "acquiring", "tracking"};
+    uint32_t count;
+    uint64_t since_uS = timebase_getUs() - isrStamp_read(&latest, &count);
+
+    printf("PPS %s%s, rate %ld ppb (frequency %ld ppb), phase %ld us\n",
+           names[state], gpsPps_locked() ? ", locked" : "",
+           (long)timebase_getRatePpb(), (long)freqPpb, (long)phase_us);
+    if (state != PPS_NONE) {
+        printf("  last pulse %lu ms ago\n", (unsigned long)(since_uS / 1000));
+    }
+    printf("  %lu pulses, %lu glitches, %lu gaps, %lu steps\n",
+           (unsigned long)pulses, (unsigned long)glitches,
+           (unsigned long)gaps, (unsigned long)steps);
+}
+
+#endif
@@ -0,0 +1,108 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * GPS PPS discipline of the host timebase.
+ *
+ * The HSI the MCU runs from is only good to about 1%, so over hours of
+ * logging host timestamps wander far from GPS time.  This takes a GPS
+ * receiver's pulse per second on an EXTI line and steers
+ * timebase_getUs() onto it with timebase_setRatePpb(), so every
+ * timestamp taken from it (INTN, the hub reports hub_clock reconciles,
+ * captures) ticks GPS microseconds.
+ *
+ * The first two pulses give the frequency error, and the count steps
+ * forward once so that each pulse falls on a whole second.  From then
+ * on a PI loop on the phase error at each pulse trims the rate: the
+ * proportional term slews the phase out over PPS_PHASE_GAIN seconds, the
+ * integral term learns the frequency over PPS_FREQ_GAIN.  Without pulses
+ * the last frequency is held.  A phase error behind by more than
+ * PPS_RESYNC_US steps forward again; one ahead is always slewed out, so
+ * time never goes backwards.
+ *
+ * Which second a pulse marks is not known here: host timestamps are GPS
+ * time modulo whole seconds, to be labelled from the receiver's own
+ * messages, or from the pulse width (gpsPps_setWidthFn(), as board_sync
+ * does with another board's pulses).  Edges are stamped when the EXTI ISR runs, so interrupt
+ * latency (a few us, more behind a long critical section) is noise the
+ * loop averages out.  "pps" shows the state.
+ */
+
+#ifndef GPS_PPS_H
+#define GPS_PPS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Build in the PPS input (takes the pin's EXTI line)
+#ifndef GPS_PPS
+#define GPS_PPS (1)
+#endif
+
+// PPS input, rising edge: PB15 (CN10-26 on the Nucleo), on the EXTI
+// 15..10 vector with INTN.  Lines 10-12 are INTN and USB.
+#ifndef GPS_PPS_PORT
+#define GPS_PPS_PORT GPIOB
+#define GPS_PPS_PIN GPIO_PIN_15
+#endif
+
+// Loop time constants [s]
+#ifndef PPS_PHASE_GAIN
+#define PPS_PHASE_GAIN (4)
+#endif
+#ifndef PPS_FREQ_GAIN
+#define PPS_FREQ_GAIN (64)
+#endif
+
+// Most the phase term may move the rate off the frequency [ppb]
+#ifndef PPS_MAX_SLEW_PPB
+#define PPS_MAX_SLEW_PPB (500000)
+#endif
+
+// Behind by more than this: step instead of slewing [us]
+#ifndef PPS_RESYNC_US
+#define PPS_RESYNC_US (1000)
+#endif
+
+// Locked: phase error under PPS_LOCK_US for PPS_LOCK_S pulses in a row
+#ifndef PPS_LOCK_US
+#define PPS_LOCK_US (5)
+#endif
+#ifndef PPS_LOCK_S
+#define PPS_LOCK_S (10)
+#endif
+
+// Pulses missing in a row that restart acquisition
+#ifndef PPS_MAX_GAP_S
+#define PPS_MAX_GAP_S (4)
+#endif
+
+// Set up the pin, route its EXTI line here, register the "pps" command.
+// Call before the scheduler starts.
+void gpsPps_init(void);
+
+// Locked to pulses that are still coming.
+bool gpsPps_locked(void);
+
+// Also take the falling edges, and pass each pulse's width to fn once the
+// loop is on the second.  rise_uS is the pulse's rising edge.  fn returns
+// a number of whole seconds to step the count forward by, or 0.  Called
+// from the EXTI ISR at PRIO_IRQ_INTN.  NULL goes back to rising edges only.
+typedef uint32_t (GpsPpsWidthFn_t)(uint64_t rise_uS, uint32_t width_us);
+void gpsPps_setWidthFn(GpsPpsWidthFn_t *fn);
+
+#endif
@@ -0,0 +1,57 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * HcBin_t with direct access to memory-mapped images.
+ *
+ * getAppData() copies every packet into the caller's buffer, even when
+ * the image sits in MCU flash.  An HcBinEx_t adds getAppDataPtr(), which
+ * hands out the address of the data instead, so a reader can CRC it, or
+ * DMA it to the bus, where it lies.  Providers that stream or decompress
+ * their image leave it 0, and readers fall back to getAppData().
+ */
+
+#ifndef HCBIN_EX_H
+#define HCBIN_EX_H
+
+#include <stdint.h>
+
+#include "HcBin.h"
+
+typedef struct HcBinEx_s {
+	HcBin_t hcbin;             /* what dfu() takes */
+
+	/* Address of len bytes of application at offset, or 0 if out of
+	 * range.  0 (no function) for images not memory-mapped. */
+	const uint8_t * (*getAppDataPtr)(uint32_t offset, uint32_t len);
+} HcBinEx_t;
+
+/* len bytes of application at offset: in place if firmware is memory
+ * mapped, else copied into buf.  Returns 0 if they could not be read. */
+static inline const uint8_t * hcbinEx_getAppData(const HcBinEx_t *firmware,
+                                                 uint8_t *buf, uint32_t offset, uint32_t len)
+{
+	if (firmware->getAppDataPtr != 0) {
+		return firmware->getAppDataPtr(offset, len);
+	}
+	if (firmware->hcbin.getAppData(buf, offset, len) != 0) {
+		return 0;
+	}
+	return buf;
+}
+
+#endif
@@ -0,0 +1,164 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * HSI trimming against the hub clock.
+ */
+
+#include "hsi_trim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shell.h"
+#include "clock.h"
+#include "timebase.h"
+#include "hub_clock.h"
+#include "sensor_dispatch.h"
+#include "priorities.h"
+
+#define TRIM_MAX (31)
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void trimEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix);
+static void decide(void);
+static void hsiTrimCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+// Sensor task only, read unlocked by the shell
+static volatile bool autoTrim;
+static uint32_t lastCount;          // hubClock_estimates() last seen
+static uint32_t settled;            // estimates since the last trim
+static int lastDir;                 // of the last trim, 0 before the first
+static int32_t skewBefore;          // skew estimate it was made on
+static volatile int32_t stepPpm = HSI_TRIM_STEP_PPM;
+static uint32_t trims;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void hsiTrim_init(void)
+{
+    autoTrim = HSI_TRIM_AUTO;
+    shell_addCommand("hsitrim", "[on | off | <0-31>] HSI trim against the hub clock", hsiTrimCmd);
+    sensorDispatch_subscribe(SENSOR_DISPATCH_ALL, PRIO_SUB_HSI_TRIM, trimEvent, 0);
+}
+
+void hsiTrim_enable(bool on)
+{
+    settled = 0;
+    lastDir = 0;
+    autoTrim = on;
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+// Dispatch callback, in the sensor task: only does anything when
+// hub_clock has closed a window
+static void trimEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix)
+{
+    uint32_t count = hubClock_estimates();
+
+    if (count == lastCount) {
+        return;
+    }
+    if (count < lastCount) {
+        // Estimate reset: settle again
+        settled = 0;
+        lastDir = 0;
+    }
+    else {
+        settled += count - lastCount;
+    }
+    lastCount = count;
+
+    if (autoTrim && !clock_usingHse() && (timebase_getRatePpb() == 0) &&
+        (settled >= HSI_TRIM_SETTLE)) {
+        decide();
+    }
+}
+
+static void decide(void)
+{
+    int32_t skew = hubClock_skewPpm();
+    unsigned trim = clock_hsiTrim();
+    int dir;
+
+    if (lastDir != 0) {
+        // What the last step really did: +dir made the host faster, which
+        // raised the skew
+        int32_t actual = (skew - skewBefore) * lastDir;
+
+        if ((actual > stepPpm / 4) && (actual < stepPpm * 4)) {
+            stepPpm += (actual - stepPpm) / 2;
+        }
+        lastDir = 0;
+    }
+
+    if (abs(skew) <= stepPpm / 2) {
+        return;
+    }
+
+    // Host fast (positive skew): slow the HSI down
+    dir = (skew > 0) ? -1 : 1;
+    if (((dir < 0) && (trim == 0)) || ((dir > 0) && (trim == TRIM_MAX))) {
+        return;
+    }
+
+    clock_setHsiTrim(trim + dir);
+    hubClock_hostRateChanged(dir * stepPpm);
+    skewBefore = skew;
+    lastDir = dir;
+    settled = 0;
+    trims++;
+}
+
+static void hsiTrimCmd(int argc, char *argv[])
+{
+    if (argc > 1) {
+        if (strcmp(argv[1], "on") == 0) {
+            hsiTrim_enable(true);
+        }
+        else if (strcmp(argv[1], "off") == 0) {
+            hsiTrim_enable(false);
+        }
+        else {
+            unsigned long trim = strtoul(argv[1], 0, 0);
+
+            if (trim > TRIM_MAX) {
+                printf("Usage: hsitrim [on | off | <0-31>]\n");
+                return;
+            }
+            // By hand: the skew estimate catches up over the next
+            // windows, as with any change in the host clock
+            hsiTrim_enable(false);
+            clock_setHsiTrim((unsigned)trim);
+        }
+    }
+
+    printf("HSI trim %u, %s%s, step %ld ppm, %u trims\n",
+           clock_hsiTrim(), autoTrim ? "auto" : "manual",
+           clock_usingHse() ? " (on HSE: idle)" :
+           (timebase_getRatePpb() != 0) ? " (PPS disciplined: idle)" : "",
+           (long)stepPpm, (unsigned)trims);
+    printf("Host vs hub clock: %ld ppm\n", (long)hubClock_skewPpm());
+}
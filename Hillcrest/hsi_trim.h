@@ -0,0 +1,62 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * HSI trimming against the hub clock.
+ *
+ * Without HSE (clock.h) the whole MCU runs from the HSI, good to about
+ * 1% and drifting with temperature, and so do the console baud rate and
+ * the timebase.  The hub's clock is much steadier, and hub_clock already
+ * measures the host clock against it over long windows.  Each time
+ * HSI_TRIM_SETTLE fresh estimates agree that the host is off by more
+ * than half a trim step, this moves RCC HSITRIM one step the other way
+ * and tells hub_clock, which restarts its windows.
+ *
+ * A step is nominally HSI_TRIM_STEP_PPM; what each trim actually did
+ * is measured from the estimates that follow it and learned.  The
+ * trim is left alone on HSE and once the timebase is disciplined by
+ * GPS PPS (gps_pps.h), which the hub comparison would then be measured
+ * against.  "hsitrim" shows and sets it.
+ */
+
+#ifndef HSI_TRIM_H
+#define HSI_TRIM_H
+
+#include <stdbool.h>
+
+// Trim automatically from startup
+#ifndef HSI_TRIM_AUTO
+#define HSI_TRIM_AUTO (1)
+#endif
+
+// Nominal HSI change per trim step [ppm]
+#ifndef HSI_TRIM_STEP_PPM
+#define HSI_TRIM_STEP_PPM (5000)
+#endif
+
+// Hub clock estimates after a trim (or at start) before the next decision
+#ifndef HSI_TRIM_SETTLE
+#define HSI_TRIM_SETTLE (6)
+#endif
+
+// Register the "hsitrim" command and follow hub_clock from the sensor task.
+void hsiTrim_init(void);
+
+// Turn automatic trimming on or off.
+void hsiTrim_enable(bool on);
+
+#endif
@@ -0,0 +1,286 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Hub to host clock reconciliation.
+ */
+
+#include "hub_clock.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include "shell.h"
+
+// Fewer same-transfer sample pairs than this in a window: no estimate.
+// (Ages are counted in 100us steps, so a period needs averaging.)
+#define MIN_HUB_PAIRS (8)
+
+// Same-transfer periods averaged into a sensor's period for re-spacing
+#define PERIOD_AVG (16)
+
+// ------------------------------------------------------------------------
+// Private types
+
+typedef struct {
+    bool seqValid;          // lastSeq is meaningful
+    uint8_t lastSeq;        // sequence number of the previous report
+    uint32_t sample;        // sequence number, extended to 32 bits
+    uint64_t lastIntn_uS;   // INTN time of the previous report
+    uint32_t lastAge_us;    // age of the previous report, hub time
+    bool outValid;          // lastOut_uS is meaningful
+    uint64_t lastOut_uS;    // previous corrected timestamp
+
+    // Current measurement window
+    uint32_t fitSample;     // extended sequence number at the start
+    uint64_t fitStart_uS;   // corrected timestamp at the start
+    uint64_t hubSum_us;     // sum of same-transfer periods, hub time
+    uint32_t hubPairs;      // number of periods in hubSum_us
+
+    float period_us;        // running average of them, 0 until the first
+} HubClockSensor_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void trackPeriod(HubClockSensor_t *s, uint8_t seq, uint64_t t_uS,
+                        uint32_t age_us, uint64_t intn_uS);
+static void estimate(HubClockSensor_t *s, uint64_t t_uS);
+static void startWindow(HubClockSensor_t *s, uint64_t t_uS);
+static void hubClockCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+// Written by the sensor task only, read unlocked by the shell.
+static HubClockSensor_t sensors[SH2_MAX_SENSOR_ID+1];
+static volatile int32_t skewPpm;
+static uint32_t estimates;     // estimates folded into skewPpm
+static uint32_t rejected;      // estimates beyond HUB_CLOCK_MAX_SKEW_PPM
+static uint32_t respaced;      // batched samples re-spaced
+static uint32_t snapped;       // ... too far off, left at their age
+static uint64_t adjustSum_us;  // |re-spaced - age-based| over respaced
+
+// ------------------------------------------------------------------------
+// Public API
+
+void hubClock_init(void)
+{
+    memset(sensors, 0, sizeof(sensors));
+    skewPpm = 0;
+    estimates = 0;
+    rejected = 0;
+    respaced = 0;
+    snapped = 0;
+    adjustSum_us = 0;
+    shell_addCommand("hubclock", "[reset] hub clock skew estimate", hubClockCmd);
+}
+
+void hubClock_restart(void)
+{
+    for (int n = 0; n <= SH2_MAX_SENSOR_ID; n++) {
+        sensors[n].seqValid = false;
+        sensors[n].period_us = 0.0f;    // rates start over too
+    }
+}
+
+void hubClock_correct(sh2_SensorEvent_t *pEvent, uint64_t intn_uS)
+{
+    if (pEvent->reportId > SH2_MAX_SENSOR_ID) {
+        return;
+    }
+
+    HubClockSensor_t *s = &sensors[pEvent->reportId];
+    uint64_t t_uS = pEvent->timestamp_uS;
+    uint32_t age_us = 0;
+
+    if (intn_uS > t_uS) {
+        age_us = (uint32_t)(intn_uS - t_uS);
+        t_uS = intn_uS - age_us - (int64_t)age_us * skewPpm / 1000000;
+    }
+
+    // Gyro Integrated RV reports have no report header, so no sequence number
+    bool batched = false;
+    if ((pEvent->reportId != SH2_GYRO_INTEGRATED_RV) && (pEvent->len > 1)) {
+        uint8_t seq = pEvent->report[1];
+
+        // The next sample of the same transfer as the last one
+        batched = s->seqValid && ((uint8_t)(seq - s->lastSeq) == 1) &&
+                  (intn_uS == s->lastIntn_uS);
+        trackPeriod(s, seq, t_uS, age_us, intn_uS);
+    }
+
+#if HUB_CLOCK_CORRECT
+#if HUB_CLOCK_BATCH_GAIN > 0
+    if (batched && s->outValid && (s->period_us > 0.0f)) {
+        int64_t next_uS = (int64_t)s->lastOut_uS +
+            (int64_t)(s->period_us * (1.0f + (float)skewPpm * 1.0e-6f));
+        int64_t gap_us = (int64_t)t_uS - next_uS;
+
+        if ((gap_us > HUB_CLOCK_BATCH_SNAP_US) || (gap_us < -HUB_CLOCK_BATCH_SNAP_US)) {
+            // Lost samples or a new rate: start over from the age
+            snapped++;
+        }
+        else {
+            uint64_t spaced_uS = (uint64_t)(next_uS + gap_us / HUB_CLOCK_BATCH_GAIN);
+            adjustSum_us += (spaced_uS > t_uS) ? spaced_uS - t_uS : t_uS - spaced_uS;
+            respaced++;
+            t_uS = spaced_uS;
+        }
+    }
+#endif
+    if (s->outValid && (t_uS <= s->lastOut_uS)) {
+        t_uS = s->lastOut_uS + 1;
+    }
+    s->lastOut_uS = t_uS;
+    s->outValid = true;
+    pEvent->timestamp_uS = t_uS;
+#endif
+}
+
+int32_t hubClock_skewPpm(void)
+{
+    return skewPpm;
+}
+
+void hubClock_setSkewPpm(int32_t ppm)
+{
+    if ((ppm > HUB_CLOCK_MAX_SKEW_PPM) || (ppm < -HUB_CLOCK_MAX_SKEW_PPM)) {
+        return;
+    }
+
+    // Counts as one estimate: the next ones refine it rather than replace it
+    skewPpm = ppm;
+    estimates = 1;
+}
+
+uint32_t hubClock_estimates(void)
+{
+    return estimates;
+}
+
+void hubClock_hostRateChanged(int32_t ppm)
+{
+    skewPpm += ppm;
+    for (int n = 0; n <= SH2_MAX_SENSOR_ID; n++) {
+        // The next report opens a new window; periods are in hub time,
+        // so they stand
+        sensors[n].seqValid = false;
+    }
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static void trackPeriod(HubClockSensor_t *s, uint8_t seq, uint64_t t_uS,
+                        uint32_t age_us, uint64_t intn_uS)
+{
+    if (!s->seqValid) {
+        s->sample = 0;
+        startWindow(s, t_uS);
+    }
+    else {
+        uint8_t deltaSeq = seq - s->lastSeq;
+
+        s->sample += deltaSeq;
+
+        // Both ages were counted at the same hub instant, so their
+        // difference is one report period in hub time.
+        if ((deltaSeq == 1) && (intn_uS == s->lastIntn_uS) && (s->lastAge_us > age_us)) {
+            uint32_t period_us = s->lastAge_us - age_us;
+
+            s->hubSum_us += period_us;
+            s->hubPairs++;
+            if (s->period_us == 0.0f) {
+                s->period_us = (float)period_us;
+            }
+            else {
+                s->period_us += ((float)period_us - s->period_us) / PERIOD_AVG;
+            }
+        }
+
+        if (t_uS - s->fitStart_uS >= HUB_CLOCK_FIT_US) {
+            estimate(s, t_uS);
+            startWindow(s, t_uS);
+        }
+    }
+
+    s->lastSeq = seq;
+    s->seqValid = true;
+    s->lastIntn_uS = intn_uS;
+    s->lastAge_us = age_us;
+}
+
+// Compare the period over the window, on the host clock, with the hub's
+// count of it.  The window ends are corrected timestamps, so any error
+// in the current estimate only enters in proportion to age/window.
+static void estimate(HubClockSensor_t *s, uint64_t t_uS)
+{
+    uint32_t periods = s->sample - s->fitSample;
+
+    if ((s->hubPairs < MIN_HUB_PAIRS) || (periods == 0)) {
+        // Not batched (ages are then too small for skew to matter)
+        return;
+    }
+
+    float hostPeriod = (float)(t_uS - s->fitStart_uS) / (float)periods;
+    float hubPeriod = (float)s->hubSum_us / (float)s->hubPairs;
+    int32_t est = (int32_t)((hostPeriod / hubPeriod - 1.0f) * 1.0e6f);
+
+    if ((est > HUB_CLOCK_MAX_SKEW_PPM) || (est < -HUB_CLOCK_MAX_SKEW_PPM)) {
+        // Most likely the hub changed the sensor's rate mid-window
+        rejected++;
+        return;
+    }
+
+    if (estimates == 0) {
+        skewPpm = est;
+    }
+    else {
+        skewPpm += (est - skewPpm) / 4;
+    }
+    estimates++;
+}
+
+static void startWindow(HubClockSensor_t *s, uint64_t t_uS)
+{
+    s->fitSample = s->sample;
+    s->fitStart_uS = t_uS;
+    s->hubSum_us = 0;
+    s->hubPairs = 0;
+}
+
+static void hubClockCmd(int argc, char *argv[])
+{
+    if ((argc > 1) && (strcmp(argv[1], "reset") == 0)) {
+        skewPpm = 0;
+        estimates = 0;
+        rejected = 0;
+        respaced = 0;
+        snapped = 0;
+        adjustSum_us = 0;
+        return;
+    }
+
+    printf("Hub clock skew: %ld ppm (%u estimates, %u rejected)%s\n",
+           (long)skewPpm, (unsigned)estimates, (unsigned)rejected,
+           HUB_CLOCK_CORRECT ? "" : ", correction off");
+    printf("Batched samples: %u re-spaced (mean %u us from their age), %u left at their age\n",
+           (unsigned)respaced,
+           (respaced != 0) ? (unsigned)(adjustSum_us / respaced) : 0,
+           (unsigned)snapped);
+}
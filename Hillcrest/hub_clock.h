@@ -0,0 +1,99 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Hub to host clock reconciliation.
+ *
+ * The SH-2 layer timestamps a report as the host INTN time less the
+ * report's age, as counted by the hub.  The hub oscillator is not the
+ * host's, so the older the sample (i.e. the longer the batch interval),
+ * the further its timestamp is off.  This estimates the hub clock skew
+ * and restates every timestamp on the host timebase (timebase_getUs()):
+ *
+ *   host time = INTN time - age * (1 + skew)
+ *
+ * Skew is measured per batched sensor as the ratio of its report period
+ * seen by the host, over a long window, to the period the hub counts
+ * between samples delivered together.  Corrected timestamps never go
+ * backwards for a sensor.
+ *
+ * Ages come in 100us steps, so the samples of a batch, delivered in one
+ * transfer, are also re-spaced: each follows the one before by the
+ * sensor's period (as the hub counts it, on the host clock), pulled
+ * toward its own age-based time by a fraction of the difference.
+ */
+
+#ifndef HUB_CLOCK_H
+#define HUB_CLOCK_H
+
+#include <stdint.h>
+#include "sh2.h"
+
+// Set to 0 to leave SH-2 timestamps as they are.
+#ifndef HUB_CLOCK_CORRECT
+#define HUB_CLOCK_CORRECT (1)
+#endif
+
+// Host time a sensor's period is measured over for one skew estimate
+#ifndef HUB_CLOCK_FIT_US
+#define HUB_CLOCK_FIT_US (10000000)
+#endif
+
+// Fraction (1/N) of the gap between a batched sample's re-spaced time and
+// its age-based time that is closed at each sample.  0 leaves batched
+// samples at their age-based times.
+#ifndef HUB_CLOCK_BATCH_GAIN
+#define HUB_CLOCK_BATCH_GAIN (8)
+#endif
+
+// Gaps beyond this restart the spacing from the age-based time [us]
+#ifndef HUB_CLOCK_BATCH_SNAP_US
+#define HUB_CLOCK_BATCH_SNAP_US (1000)
+#endif
+
+// Estimates beyond this are taken as rate changes, not skew, and ignored
+#ifndef HUB_CLOCK_MAX_SKEW_PPM
+#define HUB_CLOCK_MAX_SKEW_PPM (20000)
+#endif
+
+// Register the "hubclock" command.
+void hubClock_init(void);
+
+// The hub was reset: sequence numbers and periods start over.
+// The skew estimate is kept, the oscillator is the same.
+void hubClock_restart(void);
+
+// Restate pEvent->timestamp_uS on the host timebase.  intn_uS is the INTN
+// time of the transfer that carried the event.  Called by the sensor task
+// only, before the event is published.
+void hubClock_correct(sh2_SensorEvent_t *pEvent, uint64_t intn_uS);
+
+// Current hub clock skew estimate, parts per million (+: hub runs slow)
+int32_t hubClock_skewPpm(void);
+
+// Start from a skew estimate kept from before (see warm_boot.h)
+void hubClock_setSkewPpm(int32_t ppm);
+
+// Skew estimates made since init; goes up as each window closes.
+uint32_t hubClock_estimates(void);
+
+// The host clock was just made faster by ppm (e.g. an HSI trim): move the
+// estimate by as much and start the measurement windows over, so none
+// spans the change.
+void hubClock_hostRateChanged(int32_t ppm);
+
+#endif
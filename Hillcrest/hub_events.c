@@ -0,0 +1,61 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Asynchronous hub events, on a FreeRTOS event group.
+ */
+
+#include "hub_events.h"
+
+#include "FreeRTOS.h"
+#include "event_groups.h"
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static EventGroupHandle_t events;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void hubEvents_init(void)
+{
+    events = xEventGroupCreate();
+}
+
+void hubEvents_set(uint32_t bits)
+{
+    xEventGroupSetBits(events, (EventBits_t)bits);
+}
+
+void hubEvents_clear(uint32_t bits)
+{
+    xEventGroupClearBits(events, (EventBits_t)bits);
+}
+
+uint32_t hubEvents_wait(uint32_t bits, TickType_t timeout)
+{
+    // Clear on exit, wake on any of the bits
+    EventBits_t set = xEventGroupWaitBits(events, (EventBits_t)bits, pdTRUE, pdFALSE, timeout);
+
+    return (uint32_t)(set & bits);
+}
+
+bool hubEvents_waitReady(TickType_t timeout)
+{
+    return hubEvents_wait(HUB_EVT_RESET, timeout) != 0;
+}
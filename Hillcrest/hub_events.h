@@ -0,0 +1,64 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Asynchronous hub events the application waits on.
+ *
+ * SH-2 callbacks (in the HAL task) and the sensor task set bits in one
+ * FreeRTOS event group, and a task waits for the bits it wants with a
+ * timeout, asleep until they are set.  Bits stay set until a waiter
+ * takes them, so clear a bit before the action that will set it.
+ */
+
+#ifndef HUB_EVENTS_H
+#define HUB_EVENTS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+
+// Wait for the hub reset after sh2_initialize() before complaining [ms].
+// The wait goes on after that; a hub that doesn't start is a wiring or
+// power problem, and there is nothing else the demo can do.
+#ifndef HUB_READY_TIMEOUT_MS
+#define HUB_READY_TIMEOUT_MS (1000)
+#endif
+
+#define HUB_EVT_RESET           (1 << 0)   // SH2_RESET: the hub (re)started
+#define HUB_EVT_FIRST_SAMPLE    (1 << 1)   // first sensor event after a reset
+#define HUB_EVT_FLUSHED         (1 << 2)   // flush completed for every sensor asked
+
+// A hub request (in the slot given) is done: one bit per slot
+#define HUB_EVT_REQ_SLOTS       (8)
+#define HUB_EVT_REQ_DONE(slot)  (1 << (8 + (slot)))
+
+// Create the event group.  Call before sh2_initialize().
+void hubEvents_init(void);
+
+// Set or clear bits (HUB_EVT_*).  Task context only.
+void hubEvents_set(uint32_t bits);
+void hubEvents_clear(uint32_t bits);
+
+// Wait up to timeout for any of bits.  Returns those of them that were
+// set, now cleared, or 0 on timeout.
+uint32_t hubEvents_wait(uint32_t bits, TickType_t timeout);
+
+// Wait up to timeout for the hub to come out of reset.
+bool hubEvents_waitReady(TickType_t timeout);
+
+#endif
@@ -0,0 +1,368 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Hub heartbeat and hub-side loss accounting.  See hub_health.h.
+ */
+
+#include "hub_health.h"
+
+#if HUB_HEALTH
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "cmsis_os.h"
+#include "sh2.h"
+#include "sh2_err.h"
+#include "sh2_client.h"
+#include "sh2_hal_health.h"
+#include "sensor_app.h"
+#include "sensor_stats.h"
+#include "timebase.h"
+#include "sysstats.h"
+#include "shell.h"
+#include "rtos_static.h"
+#include "priorities.h"
+
+#ifndef HUB_HEALTH_STACK
+#define HUB_HEALTH_STACK (256)
+#endif
+
+// How often to look again while polls are off, or the hub is busy [ms]
+#define IDLE_MS (1000)
+
+// Sensors followed at once
+#define MAX_SENSORS (16)
+
+// ------------------------------------------------------------------------
+// Private types
+
+// One sensor's hub counters and host figures at the last poll, and what
+// went missing over the window since the one before
+typedef struct {
+    uint8_t sensorId;                   // 0: free
+    bool valid;                         // last holds a poll
+    sh2_Counts_t last;
+    uint32_t lastReceived;
+    uint32_t lastLost;
+    // The last window
+    uint32_t attempted;
+    uint32_t received;
+    uint32_t lost;
+    uint32_t hub;
+} SensorHealth_t;
+
+// Losses by where they happened
+typedef struct {
+    uint32_t hub;
+    uint32_t bus;
+    uint32_t host;
+    uint32_t seqLost;                   // the host's view, sequence gaps
+} Losses_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void healthTask(const void *params);
+static void poll(void);
+static bool pollErrors(void);
+static bool pollCounts(Losses_t *pWin);
+static SensorHealth_t *slotFor(uint8_t sensorId, bool take);
+static uint32_t delta(uint32_t now, uint32_t then);
+static void healthCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+RTOS_STACK_DEF(healthTaskStack, HUB_HEALTH_STACK);
+static osThreadId healthTaskHandle;
+
+static sh2Client_t client;
+static volatile uint32_t interval_ms = HUB_HEALTH_MS;
+
+static SensorHealth_t sensors[MAX_SENSORS];
+static sh2_ErrorRecord_t errors[HUB_HEALTH_ERRORS];
+static uint8_t lastErrorSeq[HUB_HEALTH_ERRORS];
+static uint16_t lastErrors;
+
+static uint32_t lastOverflows;
+static bool overflowsValid;
+
+static Losses_t window;                 // the last poll's
+static Losses_t total;
+static uint64_t window_uS;              // when it was taken
+
+static uint32_t beats;                  // polls the hub answered
+static uint32_t missed;                 // polls it didn't
+static uint32_t missedRun;              // in a row, now
+static uint32_t hubErrors;              // new error records seen
+static uint32_t asyncEvents;            // other than resets
+static uint32_t lastEventId;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void hubHealth_init(void)
+{
+    sh2Client_open(&client, "health");
+
+    osThreadDef(healthThreadDef, healthTask, PRIO_TASK_HEALTH, 0, HUB_HEALTH_STACK);
+    healthTaskHandle = rtos_threadCreate(osThread(healthThreadDef), NULL,
+                                         RTOS_STACK(healthTaskStack));
+    if (healthTaskHandle == NULL) {
+        printf("Failed to create health task.\n");
+        return;
+    }
+
+    sysstats_addMemory("hub health", sizeof(sensors) + sizeof(errors) + sizeof(lastErrorSeq));
+    sysstats_addCounter("hub heartbeats missed", &missed);
+    sysstats_addCounter("hub errors", &hubErrors);
+    sysstats_addCounter("hub async events", &asyncEvents);
+    shell_addCommand("health", "[ms | off | now] hub heartbeat, errors and where reports are lost",
+                     healthCmd);
+}
+
+void hubHealth_asyncEvent(uint32_t eventId)
+{
+    asyncEvents++;
+    lastEventId = eventId;
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static void healthTask(const void *params)
+{
+    while (1) {
+        uint32_t ms = interval_ms;
+
+        if ((ms == 0) || sensorApp_recovering() || sensorApp_asleep()) {
+            // Counters restart with the hub: take a fresh baseline
+            overflowsValid = false;
+            for (unsigned n = 0; n < MAX_SENSORS; n++) {
+                sensors[n].valid = false;
+            }
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(IDLE_MS));
+            continue;
+        }
+
+        poll();
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ms));
+    }
+}
+
+// One heartbeat: the error list, then the counters
+static void poll(void)
+{
+    Losses_t win;
+
+    sh2Client_begin(&client);
+    bool ok = pollErrors() && pollCounts(&win);
+    sh2Client_end(&client);
+
+    if (!ok) {
+        missed++;
+        missedRun++;
+        printf("Hub heartbeat missed (%u in a row).\n", (unsigned)missedRun);
+        return;
+    }
+    beats++;
+    missedRun = 0;
+
+    window = win;
+    window_uS = timebase_getUs();
+    total.hub += win.hub;
+    total.bus += win.bus;
+    total.host += win.host;
+    total.seqLost += win.seqLost;
+    if (win.hub + win.bus + win.host != 0) {
+        printf("Reports lost: %u on the hub, %u on the bus, %u on the host (%u in sequence gaps).\n",
+               (unsigned)win.hub, (unsigned)win.bus, (unsigned)win.host, (unsigned)win.seqLost);
+    }
+}
+
+// Read the hub's error list and print the records not seen last time.
+// False if the hub didn't answer.
+static bool pollErrors(void)
+{
+    uint16_t numErrors = HUB_HEALTH_ERRORS;
+
+    if (sh2_getErrors(HUB_HEALTH_SEVERITY, errors, &numErrors) != SH2_OK) {
+        return false;
+    }
+
+    for (unsigned n = 0; n < numErrors; n++) {
+        const sh2_ErrorRecord_t *e = &errors[n];
+        bool seen = false;
+
+        for (unsigned m = 0; m < lastErrors; m++) {
+            seen |= (lastErrorSeq[m] == e->sequence);
+        }
+        if (!seen) {
+            hubErrors++;
+            printf("Hub error: severity %u, source %u, error %u, module %u, code %u (seq %u).\n",
+                   e->severity, e->source, e->error, e->module, e->code, e->sequence);
+        }
+    }
+    for (unsigned n = 0; n < numErrors; n++) {
+        lastErrorSeq[n] = errors[n].sequence;
+    }
+    lastErrors = numErrors;
+
+    return true;
+}
+
+// Read the counters of every subscribed sensor and set the window's
+// against the host's figures.  False if the hub didn't answer.
+static bool pollCounts(Losses_t *pWin)
+{
+    uint32_t overflows, highWater;
+    uint32_t attempted = 0, received = 0;
+
+    memset(pWin, 0, sizeof(*pWin));
+
+    for (unsigned id = 1; id <= SH2_MAX_SENSOR_ID; id++) {
+        SensorStatsSummary_t sum;
+        sh2_Counts_t counts;
+
+        SensorHealth_t *s = slotFor(id, sensorApp_interval(id) != 0);
+        if (sensorApp_interval(id) == 0) {
+            // Unsubscribed: free the slot, a new subscription starts over
+            if (s != 0) {
+                s->sensorId = 0;
+            }
+            continue;
+        }
+        if (s == 0) {
+            continue;
+        }
+        if (sh2_getCounts((sh2_SensorId_t)id, &counts) != SH2_OK) {
+            return false;
+        }
+        if (!sensorStats_get((sh2_SensorId_t)id, &sum)) {
+            memset(&sum, 0, sizeof(sum));
+        }
+
+        // Hub counters that went backwards mean the hub reset: start over
+        if (s->valid && (counts.attempted >= s->last.attempted) && (counts.on >= s->last.on)) {
+            s->attempted = counts.attempted - s->last.attempted;
+            s->hub = delta(counts.on - s->last.on, s->attempted);
+            s->received = delta(sum.received, s->lastReceived);
+            s->lost = delta(sum.lost, s->lastLost);
+            attempted += s->attempted;
+            received += s->received;
+            pWin->hub += s->hub;
+            pWin->seqLost += s->lost;
+        }
+        s->last = counts;
+        s->lastReceived = sum.received;
+        s->lastLost = sum.lost;
+        s->valid = true;
+    }
+
+    // Ring overflows are counted for all sensors together
+    sensorApp_getRingStats(&overflows, &highWater);
+    if (overflowsValid) {
+        pWin->host = overflows - lastOverflows;
+    }
+    lastOverflows = overflows;
+    overflowsValid = true;
+    pWin->bus = delta(attempted, received + pWin->host);
+
+    return true;
+}
+
+// sensorId's slot, or with take a free one if it has none.  NULL if
+// there is none.
+static SensorHealth_t *slotFor(uint8_t sensorId, bool take)
+{
+    SensorHealth_t *free = 0;
+
+    for (unsigned n = 0; n < MAX_SENSORS; n++) {
+        if (sensors[n].sensorId == sensorId) {
+            return &sensors[n];
+        }
+        if ((free == 0) && (sensors[n].sensorId == 0)) {
+            free = &sensors[n];
+        }
+    }
+    if (!take) {
+        return 0;
+    }
+    if (free != 0) {
+        memset(free, 0, sizeof(*free));
+        free->sensorId = sensorId;
+    }
+
+    return free;
+}
+
+// now - then, 0 rather than negative
+static uint32_t delta(uint32_t now, uint32_t then)
+{
+    return (now > then) ? (now - then) : 0;
+}
+
+// Shell command: set the interval or poll now, then show the last window.
+static void healthCmd(int argc, char *argv[])
+{
+    if (argc > 1) {
+        if (strcmp(argv[1], "off") == 0) {
+            interval_ms = 0;
+        }
+        else if (strcmp(argv[1], "now") != 0) {
+            interval_ms = strtoul(argv[1], 0, 0);
+        }
+        // Poll now, or at the new interval; "health" shows the result
+        xTaskNotifyGive(healthTaskHandle);
+    }
+
+    if (interval_ms == 0) {
+        printf("Heartbeat off.\n");
+    }
+    else {
+        printf("Heartbeat every %u ms: %u answered, %u missed.  %u hub errors, "
+               "%u async events (last %u).\n",
+               (unsigned)interval_ms, (unsigned)beats, (unsigned)missed,
+               (unsigned)hubErrors, (unsigned)asyncEvents, (unsigned)lastEventId);
+    }
+    if (window_uS == 0) {
+        return;
+    }
+
+    printf("  %4s %9s %9s %9s %9s\n", "id", "attempted", "received", "seq lost", "hub lost");
+    for (unsigned n = 0; n < MAX_SENSORS; n++) {
+        const SensorHealth_t *s = &sensors[n];
+        if ((s->sensorId != 0) && s->valid) {
+            printf("  %4u %9u %9u %9u %9u\n", s->sensorId, (unsigned)s->attempted,
+                   (unsigned)s->received, (unsigned)s->lost, (unsigned)s->hub);
+        }
+    }
+    printf("Lost in the window %u ms ago: hub %u, bus %u, host %u (seq gaps %u).\n",
+           (unsigned)((timebase_getUs() - window_uS) / 1000),
+           (unsigned)window.hub, (unsigned)window.bus, (unsigned)window.host,
+           (unsigned)window.seqLost);
+    printf("Lost in all: hub %u, bus %u, host %u (seq gaps %u).\n",
+           (unsigned)total.hub, (unsigned)total.bus, (unsigned)total.host,
+           (unsigned)total.seqLost);
+}
+
+#endif
@@ -0,0 +1,79 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Hub heartbeat and hub-side loss accounting.
+ *
+ * Every HUB_HEALTH_MS a low priority task asks the hub, through an SH-2
+ * client of its own (sh2_client.h), for its error list and for the
+ * report counters of each subscribed sensor.  The commands double as a
+ * heartbeat: one that fails or times out is a missed beat.
+ *
+ * The counters are set against what the host saw over the same window,
+ * to tell where reports went missing:
+ *   hub    accepted while the sensor was on, never sent (on - attempted)
+ *   bus    sent by the hub, never decoded by the host (attempted -
+ *          received - host)
+ *   host   decoded, then dropped because the sensor ring was full
+ * next to the host's own view, the sequence gaps of sensor_stats.h.
+ * Counters and host figures are read a few reports apart, so a window
+ * can be off by a report or two either way.  New hub errors are printed
+ * as they appear.  "health" shows the last window and the totals.
+ */
+
+#ifndef HUB_HEALTH_H
+#define HUB_HEALTH_H
+
+#include <stdint.h>
+
+// Set to 1 to build in the heartbeat and its task (1.9KB RAM).
+#ifndef HUB_HEALTH
+#define HUB_HEALTH (0)
+#endif
+
+// Interval between polls at startup [ms], 0 for none
+#ifndef HUB_HEALTH_MS
+#define HUB_HEALTH_MS (10000)
+#endif
+
+// Hub error records read per poll
+#ifndef HUB_HEALTH_ERRORS
+#define HUB_HEALTH_ERRORS (8)
+#endif
+
+// Lowest error severity read (0: all)
+#ifndef HUB_HEALTH_SEVERITY
+#define HUB_HEALTH_SEVERITY (0)
+#endif
+
+#if HUB_HEALTH
+
+// Start the heartbeat task and register the "health" command.  Call
+// after sh2Client_init().
+void hubHealth_init(void);
+
+// Count an SH-2 async event other than a reset (from eventHandler).
+void hubHealth_asyncEvent(uint32_t eventId);
+
+#else
+
+#define hubHealth_init()
+#define hubHealth_asyncEvent(eventId)
+
+#endif
+
+#endif
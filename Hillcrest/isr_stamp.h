@@ -0,0 +1,67 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Lock-free timestamp slot, written by one ISR and read by one task.
+ *
+ * A 64-bit store takes two instructions on Cortex-M4, so the writer brackets
+ * it with a sequence count and the reader retries if it was interrupted
+ * part way.  The writer is an ISR, so it can never be interrupted by the
+ * reader.
+ */
+
+#ifndef ISR_STAMP_H
+#define ISR_STAMP_H
+
+#include <stdint.h>
+#include "stm32f4xx.h"
+
+typedef struct {
+    volatile uint32_t seq;       // odd while an update is in progress
+    volatile uint64_t t_uS;      // time of the latest event
+    volatile uint32_t count;     // events since init
+} IsrStamp_t;
+
+// From the ISR: record an event at t_uS.
+static inline void isrStamp_write(IsrStamp_t *s, uint64_t t_uS)
+{
+    s->seq++;
+    __DMB();
+    s->t_uS = t_uS;
+    s->count++;
+    __DMB();
+    s->seq++;
+}
+
+// From the task: latest event time, and event count via pCount.
+static inline uint64_t isrStamp_read(const IsrStamp_t *s, uint32_t *pCount)
+{
+    uint32_t seq;
+    uint64_t t_uS;
+
+    do {
+        seq = s->seq;
+        __DMB();
+        t_uS = s->t_uS;
+        *pCount = s->count;
+        __DMB();
+    } while ((seq & 1) || (seq != s->seq));
+
+    return t_uS;
+}
+
+#endif
@@ -0,0 +1,180 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * ITM/SWO trace sink
+ */
+
+#include "itm.h"
+
+#include <stdio.h>
+#include <string.h>
+#include "stm32f4xx_hal.h"
+#include "shell.h"
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+#if ITM_TRACE
+static bool portLive(ItmPort_t port);
+#endif
+static void itmCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static const char * const portName[ITM_NUM_PORTS] = {
+    "console",
+    "sensor",
+    "latency",
+    "trace",
+};
+
+static volatile uint32_t routed = ITM_ROUTE;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void itm_init(void)
+{
+#if ITM_TRACE
+    GPIO_InitTypeDef GPIO_InitStruct;
+
+    // SWO on PB3
+    __GPIOB_CLK_ENABLE();
+    memset(&GPIO_InitStruct, 0, sizeof(GPIO_InitStruct));
+    GPIO_InitStruct.Pin = GPIO_PIN_3;
+    GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+    GPIO_InitStruct.Pull = GPIO_NOPULL;
+    GPIO_InitStruct.Speed = GPIO_SPEED_HIGH;
+    GPIO_InitStruct.Alternate = GPIO_AF0_TRACE;
+    HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
+
+    // Asynchronous trace, NRZ, straight from the ITM (no formatter)
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DBGMCU->CR |= DBGMCU_CR_TRACE_IOEN;
+    TPI->CSPSR = 1;
+    TPI->SPPR = 2;
+    TPI->ACPR = HAL_RCC_GetHCLKFreq() / ITM_SWO_HZ - 1;
+    TPI->FFCR = 0x100;
+
+    ITM->LAR = 0xC5ACCE55;
+    ITM->TCR = (1 << ITM_TCR_TraceBusID_Pos) | ITM_TCR_SWOENA_Msk |
+               ITM_TCR_SYNCENA_Msk | ITM_TCR_ITMENA_Msk;
+    ITM->TPR = 0;
+    ITM->TER = (1 << ITM_NUM_PORTS) - 1;
+#endif
+
+    shell_addCommand("itm", "[<stream> swo|uart] route streams to SWO", itmCmd);
+}
+
+bool itm_routed(ItmPort_t port)
+{
+#if ITM_TRACE
+    return (routed & (1 << port)) != 0;
+#else
+    return false;
+#endif
+}
+
+void itm_route(ItmPort_t port, bool swo)
+{
+    if (swo) {
+        routed |= (1 << port);
+    }
+    else {
+        routed &= ~(1 << port);
+    }
+}
+
+void itm_write(ItmPort_t port, const void *pData, size_t len)
+{
+#if ITM_TRACE
+    const uint8_t *p = (const uint8_t *)pData;
+
+    if (!portLive(port)) {
+        return;
+    }
+
+    // Whole words where possible: a quarter of the FIFO waits
+    while (len >= 4) {
+        uint32_t w;
+        memcpy(&w, p, 4);
+        while (ITM->PORT[port].u32 == 0) {
+            // FIFO full
+        }
+        ITM->PORT[port].u32 = w;
+        p += 4;
+        len -= 4;
+    }
+    while (len > 0) {
+        while (ITM->PORT[port].u32 == 0) {
+            // FIFO full
+        }
+        ITM->PORT[port].u8 = *p++;
+        len--;
+    }
+#endif
+}
+
+void itm_write32(ItmPort_t port, uint32_t word)
+{
+#if ITM_TRACE
+    if (portLive(port)) {
+        while (ITM->PORT[port].u32 == 0) {
+            // FIFO full
+        }
+        ITM->PORT[port].u32 = word;
+    }
+#endif
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+#if ITM_TRACE
+static bool portLive(ItmPort_t port)
+{
+    return itm_routed(port) &&
+        ((ITM->TCR & ITM_TCR_ITMENA_Msk) != 0) &&
+        ((ITM->TER & (1 << port)) != 0);
+}
+#endif
+
+static void itmCmd(int argc, char *argv[])
+{
+    if (argc > 2) {
+        unsigned port;
+        for (port = 0; port < ITM_NUM_PORTS; port++) {
+            if (strcmp(argv[1], portName[port]) == 0) break;
+        }
+        if (port == ITM_NUM_PORTS) {
+            printf("Unknown stream %s\n", argv[1]);
+            return;
+        }
+        itm_route((ItmPort_t)port, strcmp(argv[2], "swo") == 0);
+    }
+
+#if !ITM_TRACE
+    printf("Built without ITM_TRACE, all output on the UART.\n");
+#endif
+    for (unsigned port = 0; port < ITM_NUM_PORTS; port++) {
+        const char *sink = (port >= ITM_PORT_LATENCY) ? "off" : "uart";
+        printf("  %-8s port %u: %s\n", portName[port], port,
+               itm_routed((ItmPort_t)port) ? "swo" : sink);
+    }
+}
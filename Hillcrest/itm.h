@@ -0,0 +1,69 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * ITM/SWO trace sink.
+ * Each stimulus port carries its own stream out of the SWO pin, with no
+ * interrupts and no locks: a write only waits for room in the ITM FIFO.
+ * Capture with the ST-Link's SWV viewer or any SWO decoder at ITM_SWO_HZ.
+ */
+
+#ifndef ITM_H
+#define ITM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Set to 1 to drive SWO.  PB3 is the SWO pin, so the dbg pulse output
+// that normally uses it is disabled.
+#ifndef ITM_TRACE
+#define ITM_TRACE (0)
+#endif
+
+// SWO bit rate, NRZ.  Must divide HCLK and be within the probe's range.
+#ifndef ITM_SWO_HZ
+#define ITM_SWO_HZ (2000000)
+#endif
+
+// Streams sent to SWO from startup, one bit per ItmPort_t
+#ifndef ITM_ROUTE
+#define ITM_ROUTE (0)
+#endif
+
+typedef enum {
+    ITM_PORT_CONSOLE = 0,  // printf text, instead of the UART
+    ITM_PORT_SENSOR,       // BIN_OUTPUT frames, instead of the UART
+    ITM_PORT_LATENCY,      // one word per latency sample, see latency.c
+    ITM_PORT_TRACE,        // one word per trace point record, see trace.h
+    ITM_NUM_PORTS
+} ItmPort_t;
+
+// Configure the TPIU and ITM and register the itm command.
+void itm_init(void);
+
+// True if the stream goes to SWO.  Always false without ITM_TRACE.
+bool itm_routed(ItmPort_t port);
+void itm_route(ItmPort_t port, bool swo);
+
+// Write to a stimulus port if the stream is routed there.  Writes from
+// different tasks to one port may interleave, so give each producer
+// its own port.
+void itm_write(ItmPort_t port, const void *pData, size_t len);
+void itm_write32(ItmPort_t port, uint32_t word);
+
+#endif
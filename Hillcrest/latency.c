@@ -0,0 +1,468 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Latency tracer for the sensor report path.
+ * Each stage is measured from the INTN edge that started the transfer.
+ */
+
+#include "latency.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stm32f4xx.h"
+#include "timebase.h"
+#include "shell.h"
+#include "sysstats.h"
+#include "itm.h"
+
+// Tags of samples traced to ITM_PORT_LATENCY: stage, or command + 0x10
+#define ITM_TAG_CMD (0x10)
+
+// ------------------------------------------------------------------------
+// Private types
+
+// Phases of a command, as latency.h describes them
+enum {
+    PHASE_BUS = 0,
+    PHASE_HUB,
+    PHASE_WAKE,
+    NUM_PHASES
+};
+
+// Min/avg/max of one phase of one command [us]
+typedef struct {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint32_t sum;
+} LatPhase_t;
+
+// A command in the log.  Times are from its issue [us], 0 if not seen.
+typedef struct {
+    uint32_t start_uS;      // low 32 bits of the issue time
+    uint32_t total_us;
+    uint32_t bus_us;
+    uint32_t response_us;
+    uint8_t cmd;
+} LatCmdEntry_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void addSample(LatHist_t *h, unsigned tag, uint64_t intn_uS, uint64_t t_uS);
+static void printHist(const char *name, const LatHist_t *h);
+static void latCmd(int argc, char *argv[]);
+#if LATENCY_CMDS
+static void addPhase(LatPhase_t *p, uint32_t v);
+#endif
+static void printCmds(void);
+static unsigned bucketOf(uint32_t v);
+static uint32_t bucketTop(unsigned b);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static const char * const stageName[LAT_NUM_STAGES] = {
+    "xfer start",
+    "xfer done",
+    "deliver",
+    "handler",
+    "consume",
+    "girv pose",
+};
+
+#if LATENCY_CMDS
+static const char * const cmdName[LAT_NUM_CMDS] = {
+    "hal tx",
+    "sensor cfg",
+    "get frs",
+    "set frs",
+    "cal cfg",
+    "save dcd",
+    "flush",
+    "prod ids",
+    "get cfg",
+    "reinit",
+};
+
+static const char * const phaseName[NUM_PHASES] = {
+    "bus",
+    "hub",
+    "wake",
+};
+#endif
+
+// Each stage is only written from one context, so no locking is needed.
+static LatHist_t hist[LAT_NUM_STAGES];
+#if LATENCY_CMDS
+static LatHist_t cmdHist[LAT_NUM_CMDS];
+static LatPhase_t cmdPhase[LAT_NUM_CMDS][NUM_PHASES];
+static LatCmdEntry_t cmdLog[LATENCY_CMD_LOG];
+static unsigned cmdLogged;              // commands logged since the reset
+
+// The command being timed: low 32 bits of its issue time, and of the
+// first bus and response marks after it.  Words, so the HAL can mark
+// them from interrupts.
+static volatile bool cmdOpen;
+static volatile bool cmdOverlap;        // another was issued while it was open
+static volatile uint32_t cmdIssue_uS;
+static volatile uint32_t cmdBus_uS;
+static volatile uint32_t cmdResponse_uS;
+static volatile bool cmdBusSeen;
+static volatile bool cmdResponseSeen;
+#endif
+static uint64_t curIntn_uS;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void latency_init(void)
+{
+    latency_reset();
+#if LATENCY_CMDS
+    sysstats_addMemory("latency hists", sizeof(hist) + sizeof(cmdHist) +
+                       sizeof(cmdPhase) + sizeof(cmdLog));
+#else
+    sysstats_addMemory("latency hists", sizeof(hist));
+#endif
+    shell_addCommand("lat", "[reset | load <lines> | cmds] INTN-relative latency per stage", latCmd);
+}
+
+void latency_begin(uint64_t intn_uS)
+{
+    curIntn_uS = intn_uS;
+}
+
+uint64_t latency_intnUs(void)
+{
+    return curIntn_uS;
+}
+
+void latency_mark(LatStage_t stage)
+{
+#if LATENCY_TRACE
+    latency_markAt(stage, timebase_getUs());
+#endif
+}
+
+void latency_markAt(LatStage_t stage, uint64_t t_uS)
+{
+#if LATENCY_TRACE
+    addSample(&hist[stage], stage, curIntn_uS, t_uS);
+#endif
+}
+
+void latency_record(LatStage_t stage, uint64_t intn_uS)
+{
+#if LATENCY_TRACE
+    addSample(&hist[stage], stage, intn_uS, timebase_getUs());
+#endif
+}
+
+void latency_cmd(LatCmd_t cmd, uint64_t start_uS)
+{
+#if LATENCY_CMDS
+    uint64_t now_uS = timebase_getUs();
+    uint32_t total_us = (now_uS > start_uS) ? (uint32_t)(now_uS - start_uS) : 0;
+    LatCmdEntry_t *e = &cmdLog[cmdLogged++ % LATENCY_CMD_LOG];
+
+    addSample(&cmdHist[cmd], ITM_TAG_CMD + cmd, start_uS, now_uS);
+
+    e->cmd = (uint8_t)cmd;
+    e->start_uS = (uint32_t)start_uS;
+    e->total_us = total_us;
+    e->bus_us = 0;
+    e->response_us = 0;
+
+    // Phases, if this is the command being timed and the HAL saw it
+    if (cmdOpen && (cmdOverlap || (cmdIssue_uS == (uint32_t)start_uS))) {
+        cmdOpen = false;
+        if (!cmdOverlap && cmdBusSeen && cmdResponseSeen) {
+            uint32_t bus_us = cmdBus_uS - cmdIssue_uS;
+            uint32_t response_us = cmdResponse_uS - cmdIssue_uS;
+
+            if ((bus_us <= response_us) && (response_us <= total_us)) {
+                e->bus_us = bus_us;
+                e->response_us = response_us;
+                addPhase(&cmdPhase[cmd][PHASE_BUS], bus_us);
+                addPhase(&cmdPhase[cmd][PHASE_HUB], response_us - bus_us);
+                addPhase(&cmdPhase[cmd][PHASE_WAKE], total_us - response_us);
+            }
+        }
+    }
+#endif
+}
+
+uint64_t latency_cmdStart(void)
+{
+    uint64_t now_uS = timebase_getUs();
+
+#if LATENCY_CMDS
+    if (cmdOpen) {
+        // Another command is still out: the marks could be either's
+        cmdOverlap = true;
+        return now_uS;
+    }
+    cmdOverlap = false;
+    cmdBusSeen = false;
+    cmdResponseSeen = false;
+    cmdIssue_uS = (uint32_t)now_uS;
+    cmdOpen = true;
+#endif
+
+    return now_uS;
+}
+
+void latency_cmdBus(void)
+{
+#if LATENCY_CMDS
+    if (cmdOpen && !cmdBusSeen) {
+        cmdBus_uS = (uint32_t)timebase_getUs();
+        cmdBusSeen = true;
+    }
+#endif
+}
+
+void latency_cmdResponse(void)
+{
+#if LATENCY_CMDS
+    if (cmdOpen && cmdBusSeen && !cmdResponseSeen) {
+        cmdResponse_uS = (uint32_t)timebase_getUs();
+        cmdResponseSeen = true;
+    }
+#endif
+}
+
+void latency_histClear(LatHist_t *h)
+{
+    memset(h, 0, sizeof(*h));
+    h->min = UINT32_MAX;
+}
+
+void latency_histAdd(LatHist_t *h, uint32_t v)
+{
+    h->count++;
+    h->sum += v;
+    if (v < h->min) h->min = v;
+    if (v > h->max) h->max = v;
+    h->bucket[bucketOf(v)]++;
+}
+
+uint32_t latency_histPercentile(const LatHist_t *h, unsigned pct)
+{
+    uint32_t target = (uint32_t)(((uint64_t)h->count * pct + 99) / 100);
+    uint32_t seen = 0;
+
+    for (unsigned b = 0; b < LATENCY_BUCKETS; b++) {
+        seen += h->bucket[b];
+        if (seen >= target) {
+            return (bucketTop(b) < h->max) ? bucketTop(b) : h->max;
+        }
+    }
+
+    return h->max;
+}
+
+bool latency_getStage(LatStage_t stage, LatSummary_t *pSum)
+{
+    const LatHist_t *h = &hist[stage];
+
+    if (h->count == 0) {
+        return false;
+    }
+    pSum->count = h->count;
+    pSum->min = h->min;
+    pSum->avg = (uint32_t)(h->sum / h->count);
+    pSum->max = h->max;
+    pSum->p50 = latency_histPercentile(h, 50);
+    pSum->p99 = latency_histPercentile(h, 99);
+    return true;
+}
+
+const char *latency_stageName(LatStage_t stage)
+{
+    return stageName[stage];
+}
+
+void latency_dump(void)
+{
+    printf("Latency from INTN [us]:\n");
+    printf("  %-10s %8s %8s %8s %8s %8s\n", "stage", "count", "min", "avg", "max", "p99<=");
+    for (int n = 0; n < LAT_NUM_STAGES; n++) {
+        printHist(stageName[n], &hist[n]);
+    }
+
+#if LATENCY_CMDS
+    printf("Command round trip [us]:\n");
+    printf("  %-10s %8s %8s %8s %8s %8s %8s\n", "command", "count", "min", "avg", "max", "p50<=", "p99<=");
+    for (int n = 0; n < LAT_NUM_CMDS; n++) {
+        const LatHist_t *h = &cmdHist[n];
+        if (h->count != 0) {
+            printf("  %-10s %8u %8u %8u %8u %8u %8u\n",
+                   cmdName[n], h->count, h->min, (uint32_t)(h->sum / h->count), h->max,
+                   latency_histPercentile(h, 50), latency_histPercentile(h, 99));
+        }
+    }
+    printf("Command phases, min/avg/max [us]:\n");
+    for (int n = 0; n < LAT_NUM_CMDS; n++) {
+        if (cmdPhase[n][PHASE_BUS].count == 0) {
+            continue;
+        }
+        printf("  %-10s %8u", cmdName[n], cmdPhase[n][PHASE_BUS].count);
+        for (int ph = 0; ph < NUM_PHASES; ph++) {
+            const LatPhase_t *p = &cmdPhase[n][ph];
+            printf("  %s %u/%u/%u", phaseName[ph], p->min, p->sum / p->count, p->max);
+        }
+        printf("\n");
+    }
+#endif
+}
+
+void latency_reset(void)
+{
+    for (int n = 0; n < LAT_NUM_STAGES; n++) {
+        latency_histClear(&hist[n]);
+    }
+#if LATENCY_CMDS
+    for (int n = 0; n < LAT_NUM_CMDS; n++) {
+        latency_histClear(&cmdHist[n]);
+    }
+    memset(cmdPhase, 0, sizeof(cmdPhase));
+    for (int n = 0; n < LAT_NUM_CMDS; n++) {
+        for (int ph = 0; ph < NUM_PHASES; ph++) {
+            cmdPhase[n][ph].min = UINT32_MAX;
+        }
+    }
+    cmdLogged = 0;
+#endif
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static void addSample(LatHist_t *h, unsigned tag, uint64_t intn_uS, uint64_t t_uS)
+{
+    uint32_t v = (t_uS > intn_uS) ? (uint32_t)(t_uS - intn_uS) : 0;
+
+    // Tag in the top byte, microseconds (saturated) below
+    itm_write32(ITM_PORT_LATENCY, (tag << 24) | ((v < 0xFFFFFF) ? v : 0xFFFFFF));
+
+    latency_histAdd(h, v);
+}
+
+#if LATENCY_CMDS
+static void addPhase(LatPhase_t *p, uint32_t v)
+{
+    p->count++;
+    p->sum += v;
+    if (v < p->min) p->min = v;
+    if (v > p->max) p->max = v;
+}
+#endif
+
+// The logged commands, oldest first, with their issue time since boot:
+// the configuration steps as they ran.
+static void printCmds(void)
+{
+#if LATENCY_CMDS
+    unsigned n = (cmdLogged < LATENCY_CMD_LOG) ? cmdLogged : LATENCY_CMD_LOG;
+
+    printf("  %10s %-10s %8s %8s %8s\n", "issued ms", "command", "bus", "response", "total");
+    for (unsigned i = cmdLogged - n; i != cmdLogged; i++) {
+        const LatCmdEntry_t *e = &cmdLog[i % LATENCY_CMD_LOG];
+
+        printf("  %10u %-10s", (unsigned)(e->start_uS / 1000), cmdName[e->cmd]);
+        if (e->response_us != 0) {
+            printf(" %8u %8u", (unsigned)e->bus_us, (unsigned)e->response_us);
+        }
+        else {
+            printf(" %8s %8s", "-", "-");
+        }
+        printf(" %8u\n", (unsigned)e->total_us);
+    }
+    printf("%u commands since reset.\n", cmdLogged);
+#else
+    printf("Command latency not built in (LATENCY_CMDS).\n");
+#endif
+}
+
+static void latCmd(int argc, char *argv[])
+{
+    if ((argc > 1) && (strcmp(argv[1], "reset") == 0)) {
+        latency_reset();
+        return;
+    }
+
+    if ((argc > 1) && (strcmp(argv[1], "cmds") == 0)) {
+        printCmds();
+        return;
+    }
+
+    if ((argc > 2) && (strcmp(argv[1], "load") == 0)) {
+        // Measure with the console saturated: the sensor path should not
+        // notice (see priorities.h).
+        unsigned lines = strtoul(argv[2], 0, 0);
+        latency_reset();
+        for (unsigned n = 0; n < lines; n++) {
+            printf("%5u ....................................................................\n", n);
+        }
+    }
+
+    latency_dump();
+}
+
+static unsigned bucketOf(uint32_t v)
+{
+    unsigned b;
+
+    if (v < LATENCY_SUB_BUCKETS) {
+        b = v;
+    }
+    else {
+        // exponent e >= 2, top two bits below the leading one select sub-bucket
+        unsigned e = 31 - __CLZ(v);
+        b = LATENCY_SUB_BUCKETS*(e-1) + ((v >> (e-2)) & (LATENCY_SUB_BUCKETS-1));
+    }
+
+    return (b < LATENCY_BUCKETS) ? b : LATENCY_BUCKETS-1;
+}
+
+// Largest value that falls in bucket b
+static uint32_t bucketTop(unsigned b)
+{
+    if (b < LATENCY_SUB_BUCKETS) {
+        return b;
+    }
+
+    unsigned e = b/LATENCY_SUB_BUCKETS + 1;
+    unsigned m = b % LATENCY_SUB_BUCKETS;
+    return ((LATENCY_SUB_BUCKETS + m + 1) << (e-2)) - 1;
+}
+
+static void printHist(const char *name, const LatHist_t *h)
+{
+    if (h->count == 0) {
+        printf("  %-10s %8u\n", name, 0);
+        return;
+    }
+    printf("  %-10s %8u %8u %8u %8u %8u\n",
+           name, h->count,
+           h->min, (uint32_t)(h->sum / h->count), h->max,
+           latency_histPercentile(h, 99));
+}
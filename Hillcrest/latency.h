@@ -0,0 +1,142 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Latency tracer for the sensor report path.
+ * Each stage is measured from the INTN edge that started the transfer.
+ */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Set to 0 to compile the tracer out.
+#ifndef LATENCY_TRACE
+#define LATENCY_TRACE (1)
+#endif
+
+// Set to 1, with LATENCY_TRACE, to add the command round trip histograms,
+// phases and log (about 4.6KB RAM).
+#ifndef LATENCY_CMDS
+#define LATENCY_CMDS (0)
+#endif
+
+// Commands kept for "lat cmds", the latest first
+#ifndef LATENCY_CMD_LOG
+#define LATENCY_CMD_LOG (32)
+#endif
+
+typedef enum {
+    LAT_XFER_START = 0,  // HAL starts bus transfer (just after CSN on SPI)
+    LAT_XFER_DONE,       // bus transfer complete
+    LAT_DELIVER,         // HAL hands data to SHTP
+    LAT_HANDLER,         // sensor event reaches sensorHandler
+    LAT_CONSUME,         // sensor task takes event from the ring
+    LAT_POSE,            // GIRV fast path publishes the pose (girv_fast.h)
+    LAT_NUM_STAGES
+} LatStage_t;
+
+// Round trips of hub commands, from the call to its return.  Commands
+// issued with latency_cmdStart() are also split in three phases: issue
+// to the first packet on the bus, bus to the response waking the
+// caller (sh2_hal_unblock), and that to the call returning.
+typedef enum {
+    LAT_CMD_HAL_TX = 0,     // SPI HAL: packet queued until it goes on the bus
+    LAT_CMD_SENSOR_CONFIG,  // sh2_setSensorConfig
+    LAT_CMD_GET_FRS,        // sh2_getFrs
+    LAT_CMD_SET_FRS,        // sh2_setFrs
+    LAT_CMD_CAL_CONFIG,     // sh2_getCalConfig, sh2_setCalConfig
+    LAT_CMD_SAVE_DCD,       // sh2_saveDcdNow
+    LAT_CMD_FLUSH,          // sh2_flush
+    LAT_CMD_PROD_IDS,       // sh2_getProdIds
+    LAT_CMD_GET_SENSOR_CONFIG,  // sh2_getSensorConfig
+    LAT_CMD_REINIT,         // sh2_reinitialize
+    LAT_NUM_CMDS
+} LatCmd_t;
+
+// Log-linear histogram of latencies [us]: 4 buckets per power of two,
+// so each bucket is at most 25% wide.  The last bucket collects
+// everything above ~1s.
+#define LATENCY_SUB_BUCKETS (4)
+#define LATENCY_BUCKETS (80)
+typedef struct {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t bucket[LATENCY_BUCKETS];
+} LatHist_t;
+
+// Summary of one stage's samples [us]
+typedef struct {
+    uint32_t count;
+    uint32_t min;
+    uint32_t avg;
+    uint32_t max;
+    uint32_t p50;    // upper bounds of the histogram buckets
+    uint32_t p99;
+} LatSummary_t;
+
+// Register the "lat" console command.
+void latency_init(void);
+
+// Start tracing a transfer triggered by the INTN edge at t_uS.
+void latency_begin(uint64_t intn_uS);
+
+// INTN time of the transfer currently being traced.
+uint64_t latency_intnUs(void);
+
+// Record a stage of the current transfer as happening now, or at t_uS.
+void latency_mark(LatStage_t stage);
+void latency_markAt(LatStage_t stage, uint64_t t_uS);
+
+// Record a stage, now, for a transfer whose INTN time was saved earlier.
+void latency_record(LatStage_t stage, uint64_t intn_uS);
+
+// Record a command that started at start_uS and has just returned.
+void latency_cmd(LatCmd_t cmd, uint64_t start_uS);
+
+// Start timing the phases of a command issued now; returns the time to
+// pass to latency_cmd().  One command is timed at a time: one started
+// while another is open keeps only its round trip.
+uint64_t latency_cmdStart(void);
+
+// From the HAL: a packet went on the bus, and a response woke the
+// command's caller.  Only the first of each after latency_cmdStart()
+// counts.  Safe from interrupts.
+void latency_cmdBus(void);
+void latency_cmdResponse(void);
+
+// Fill *pSum for stage.  Returns false if it has no samples.
+bool latency_getStage(LatStage_t stage, LatSummary_t *pSum);
+
+// Stage name, as "lat" prints it.
+const char *latency_stageName(LatStage_t stage);
+
+// Histograms for other monitors: clear one, add a sample [us], and the
+// upper bound of the bucket holding the pct'th percentile.
+void latency_histClear(LatHist_t *h);
+void latency_histAdd(LatHist_t *h, uint32_t v);
+uint32_t latency_histPercentile(const LatHist_t *h, unsigned pct);
+
+// Print min/avg/max/p99 for every stage and command, and clear statistics.
+void latency_dump(void);
+void latency_reset(void);
+
+#endif
@@ -0,0 +1,569 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * On-target microbenchmarks.  See microbench.h.
+ */
+
+#include "microbench.h"
+
+#if MICROBENCH
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stm32f4xx_hal.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "cmsis_os.h"
+#include "sh2.h"
+#include "sh2_err.h"
+#include "sh2_SensorValue.h"
+#include "sensor_fix.h"
+#include "sensor_output.h"
+#include "sensor_batch.h"
+#include "console.h"
+#include "shell.h"
+#include "rtos_static.h"
+#include "priorities.h"
+#include "placement.h"
+#include "spsc.h"
+#include "crc16.h"
+#include "crc32.h"
+#include "perf_suite.h"
+
+#ifndef BENCH_TASK_STACK
+#define BENCH_TASK_STACK (512)
+#endif
+
+// Depth of the event ring and queue compared
+#define BENCH_RING_LEN (16)
+
+// ------------------------------------------------------------------------
+// Private types
+
+typedef struct {
+    const char *name;
+    MicrobenchFn_t *fn;
+} Stage_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void benchTask(const void *params);
+static void benchCmd(int argc, char *argv[]);
+static void clearResults(void);
+static void printResult(const char *name);
+static void printPerf(void);
+static void makeEvent(void);
+static void benchDecode(unsigned n);
+static void benchFixDecode(unsigned n);
+static void benchOutput(OutputMode_t mode, unsigned n);
+static void benchPrintText(unsigned n);
+static void benchPrintDsf(unsigned n);
+static void benchPrintBin(unsigned n);
+static void benchBatchDot(unsigned n);
+static void benchRawSh2(unsigned n);
+static void benchRawBatch(unsigned n);
+static void benchRawFloat(unsigned n);
+static void benchPutcharDiscard(unsigned n);
+static void benchPutcharUart(unsigned n);
+static void benchSpsc(unsigned n);
+static void benchQueueFromIsr(unsigned n);
+static unsigned crcFrame(uint8_t *frame);
+static void benchCrc16(unsigned n);
+static void benchCrc32Sw(unsigned n);
+static void benchCrc32Hw(unsigned n);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+RTOS_STACK_DEF(benchTaskStack, BENCH_TASK_STACK);
+static osThreadId benchTaskHandle;
+
+static Stage_t stages[MICROBENCH_MAX_STAGES];
+static unsigned numStages;
+
+// Results of the stage being run
+static uint32_t startCycles;
+static uint32_t overhead;       // cycles taken by begin/end themselves
+static uint64_t totalCycles;
+static uint32_t minCycles;
+static uint32_t maxCycles;
+static uint32_t calls;
+static uint64_t bytes;
+
+// Average of each stage, for the PERF block
+static uint32_t avgCycles[MICROBENCH_MAX_STAGES];
+
+// A rotation vector report, as the sh2 library delivers it
+static sh2_SensorEvent_t event;
+
+// A batch of the event's samples, and taps to run over it
+static SensorBatch_t batch;
+SENSOR_BATCH_ALIGN static int16_t taps[SENSOR_BATCH_LEN];
+
+// A hub batch's worth of raw accelerometer reports
+static sh2_SensorEvent_t rawEvents[SENSOR_BATCH_LEN];
+
+// Events passed through a ring, as sensorHandler() and the sensor task
+// do, and through a FreeRTOS queue for comparison
+static SPSC_RING(sh2_SensorEvent_t, BENCH_RING_LEN) ring;
+static QueueHandle_t queue;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void microbench_init(void)
+{
+    numStages = 0;
+    makeEvent();
+
+    microbench_add("sh2_decodeSensorEvent", benchDecode);
+    microbench_add("sensorFix_decode", benchFixDecode);
+    microbench_add("printEvent (text)", benchPrintText);
+    microbench_add("printDsf", benchPrintDsf);
+    microbench_add("printBin", benchPrintBin);
+    microbench_add("sensorBatch_dot", benchBatchDot);
+    microbench_add("raw batch: sh2 decode", benchRawSh2);
+    microbench_add("raw batch: batch decode", benchRawBatch);
+    microbench_add("raw batch: toFloat", benchRawFloat);
+    microbench_add("putchar (no uart)", benchPutcharDiscard);
+    microbench_add("putchar (uart)", benchPutcharUart);
+    queue = xQueueCreate(BENCH_RING_LEN, sizeof(sh2_SensorEvent_t));
+    microbench_add("spsc push + pop", benchSpsc);
+    microbench_add("xQueue*FromISR pair", benchQueueFromIsr);
+    microbench_add("frame crc16 (sw)", benchCrc16);
+    microbench_add("frame crc32 (sw)", benchCrc32Sw);
+    microbench_add("frame crc32 (unit)", benchCrc32Hw);
+
+    // Below the log task, so deferred output is formatted and written
+    // inside the call that queued it, and counts against it.
+    osThreadDef(benchThreadDef, benchTask, PRIO_TASK_BENCH, 0, BENCH_TASK_STACK);
+    benchTaskHandle = rtos_threadCreate(osThread(benchThreadDef), NULL, RTOS_STACK(benchTaskStack));
+    if (benchTaskHandle == NULL) {
+        printf("Failed to create bench task.\n");
+        return;
+    }
+
+    shell_addCommand("bench", "[calls] cycles/call of each sensor path stage", benchCmd);
+}
+
+int microbench_add(const char *name, MicrobenchFn_t *fn)
+{
+    if (numStages >= MICROBENCH_MAX_STAGES) {
+        return SH2_ERR;
+    }
+
+    stages[numStages].name = name;
+    stages[numStages].fn = fn;
+    numStages++;
+
+    return SH2_OK;
+}
+
+void microbench_begin(void)
+{
+    startCycles = DWT->CYCCNT;
+}
+
+void microbench_end(void)
+{
+    uint32_t cycles = DWT->CYCCNT - startCycles;
+
+    cycles = (cycles > overhead) ? cycles - overhead : 0;
+    totalCycles += cycles;
+    if (cycles < minCycles) {
+        minCycles = cycles;
+    }
+    if (cycles > maxCycles) {
+        maxCycles = cycles;
+    }
+    calls++;
+}
+
+void microbench_bytes(uint32_t n)
+{
+    bytes += n;
+}
+
+void microbench_run(unsigned n)
+{
+    // Calibrate out the cost of the timing itself
+    overhead = 0;
+    clearResults();
+    for (unsigned i = 0; i < n; i++) {
+        microbench_begin();
+        microbench_end();
+    }
+    overhead = minCycles;
+
+    printf("\n%u calls per stage at %u MHz, %u cycles timing overhead removed.\n",
+           n, (unsigned)(SystemCoreClock / 1000000), (unsigned)overhead);
+    printf("Hot ISR path runs from %s.\n", HOT_CODE_IN_RAM ? "SRAM" : "flash");
+    printf("%-24s %10s %8s %8s %10s %10s\n",
+           "stage", "cycles", "min", "max", "us", "bytes/s");
+
+    for (unsigned s = 0; s < numStages; s++) {
+        clearResults();
+        stages[s].fn(n);
+        printResult(stages[s].name);
+        avgCycles[s] = calls ? (uint32_t)(totalCycles / calls) : 0;
+    }
+    printPerf();
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static void benchTask(const void *params)
+{
+    uint32_t n = MICROBENCH_ITERATIONS;
+
+    while (1) {
+        microbench_run(n);
+
+        // Wait for the next "bench" command
+        n = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+}
+
+static void benchCmd(int argc, char *argv[])
+{
+    uint32_t n = MICROBENCH_ITERATIONS;
+
+    if (argc > 1) {
+        n = strtoul(argv[1], 0, 0);
+    }
+    if (n == 0) {
+        printf("usage: %s [calls]\n", argv[0]);
+        return;
+    }
+
+    xTaskNotify(benchTaskHandle, n, eSetValueWithOverwrite);
+}
+
+static void clearResults(void)
+{
+    totalCycles = 0;
+    minCycles = 0xFFFFFFFF;
+    maxCycles = 0;
+    calls = 0;
+    bytes = 0;
+}
+
+static void printResult(const char *name)
+{
+    uint32_t avg;
+
+    if (calls == 0) {
+        printf("%-24s %10s\n", name, "-");
+        return;
+    }
+
+    avg = (uint32_t)(totalCycles / calls);
+    printf("%-24s %10u %8u %8u %10.2f", name,
+           (unsigned)avg, (unsigned)minCycles, (unsigned)maxCycles,
+           (double)avg / (SystemCoreClock / 1000000));
+    if ((bytes != 0) && (totalCycles != 0)) {
+        printf(" %10u", (unsigned)(bytes * SystemCoreClock / totalCycles));
+    }
+    printf("\n");
+}
+
+// The table again, for tools/perfcheck.py
+static void printPerf(void)
+{
+    perfSuite_begin("bench");
+    for (unsigned s = 0; s < numStages; s++) {
+        if (avgCycles[s] != 0) {
+            perfSuite_metric("bench", stages[s].name, "cycles", avgCycles[s]);
+        }
+    }
+    perfSuite_end();
+}
+
+static void makeEvent(void)
+{
+    static const uint8_t report[] = {
+        SH2_ROTATION_VECTOR, 0, 3, 0,   // report id, sequence, status, delay
+        0x12, 0x01,  0x34, 0xfe,        // i, j (Q14)
+        0x56, 0x02,  0x9a, 0x3e,        // k, real
+        0x00, 0x02,                     // accuracy (Q12)
+    };
+
+    memset(&event, 0, sizeof(event));
+    event.timestamp_uS = 1000000;
+    event.reportId = SH2_ROTATION_VECTOR;
+    event.len = sizeof(report);
+    memcpy(event.report, report, sizeof(report));
+
+    for (unsigned n = 0; n < SENSOR_BATCH_LEN; n++) {
+        sh2_SensorEvent_t *e = &rawEvents[n];
+
+        memset(e, 0, sizeof(*e));
+        e->timestamp_uS = 1000000 + 2500*n;
+        e->reportId = SH2_RAW_ACCELEROMETER;
+        e->len = 16;
+        e->report[0] = SH2_RAW_ACCELEROMETER;
+        e->report[1] = (uint8_t)n;
+        e->report[4] = (uint8_t)(17*n);         // x, y, z (ADC units), timestamp
+        e->report[7] = 0x01;
+        e->report[8] = 0x3f;
+    }
+}
+
+static void benchDecode(unsigned n)
+{
+    sh2_SensorValue_t value;
+
+    for (unsigned i = 0; i < n; i++) {
+        microbench_begin();
+        sh2_decodeSensorEvent(&value, &event);
+        microbench_end();
+    }
+}
+
+static void benchFixDecode(unsigned n)
+{
+    SensorFix_t fix;
+
+    for (unsigned i = 0; i < n; i++) {
+        microbench_begin();
+        sensorFix_decode(&fix, &event);
+        microbench_end();
+    }
+}
+
+// Output stages format into the void: the UART's own cost is the
+// putchar (uart) stage.
+static void benchOutput(OutputMode_t mode, unsigned n)
+{
+    OutputMode_t wasMode = sensorOutput_getMode();
+    SensorFix_t fix;
+    uint32_t before;
+
+    sensorFix_decode(&fix, &event);
+    console_setDiscard(true);
+    sensorOutput_setMode(mode);
+
+    // DSF headers come out before the first line, leave them out
+    sensorOutput_event(&event, &fix);
+
+    before = console_discarded();
+    for (unsigned i = 0; i < n; i++) {
+        microbench_begin();
+        sensorOutput_event(&event, &fix);
+        microbench_end();
+    }
+    microbench_bytes(console_discarded() - before);
+
+    sensorOutput_setMode(wasMode);
+    console_setDiscard(false);
+}
+
+static void benchPrintText(unsigned n)
+{
+    benchOutput(OUTPUT_TEXT, n);
+}
+
+static void benchPrintDsf(unsigned n)
+{
+    benchOutput(OUTPUT_DSF, n);
+}
+
+static void benchPrintBin(unsigned n)
+{
+    benchOutput(OUTPUT_BIN, n);
+}
+
+// One FIR output over a whole batch channel (SENSOR_BATCH_LEN taps)
+static void benchBatchDot(unsigned n)
+{
+    SensorFix_t fix;
+    volatile int64_t y;
+
+    sensorFix_decode(&fix, &event);
+    sensorBatch_reset(&batch);
+    for (unsigned i = 0; i < SENSOR_BATCH_LEN; i++) {
+        fix.un.vec3.x += 7;
+        sensorBatch_add(&batch, &fix);
+        taps[i] = (int16_t)(FIX_Q(15, 1.0f / SENSOR_BATCH_LEN));
+    }
+
+    for (unsigned i = 0; i < n; i++) {
+        microbench_begin();
+        y = sensorBatch_dot(batch.ch[SENSOR_BATCH_X], taps, SENSOR_BATCH_LEN);
+        microbench_end();
+    }
+    microbench_bytes(n * SENSOR_BATCH_LEN * 2 * sizeof(int16_t));
+    (void)y;
+}
+
+// The raw batch stages each decode SENSOR_BATCH_LEN reports per call:
+// one at a time to floats, as the SH-2 library does ...
+static void benchRawSh2(unsigned n)
+{
+    sh2_SensorValue_t value;
+
+    for (unsigned i = 0; i < n; i++) {
+        microbench_begin();
+        for (unsigned e = 0; e < SENSOR_BATCH_LEN; e++) {
+            sh2_decodeSensorEvent(&value, &rawEvents[e]);
+        }
+        microbench_end();
+    }
+}
+
+// ... into a batch's channel arrays ...
+static void benchRawBatch(unsigned n)
+{
+    for (unsigned i = 0; i < n; i++) {
+        microbench_begin();
+        sensorBatch_reset(&batch);
+        sensorBatch_decode(&batch, rawEvents, SENSOR_BATCH_LEN);
+        microbench_end();
+    }
+}
+
+// ... and from there to floats, all three channels
+static void benchRawFloat(unsigned n)
+{
+    static float out[SENSOR_BATCH_LEN];
+
+    sensorBatch_reset(&batch);
+    sensorBatch_decode(&batch, rawEvents, SENSOR_BATCH_LEN);
+    for (unsigned i = 0; i < n; i++) {
+        microbench_begin();
+        for (unsigned ch = 0; ch < 3; ch++) {
+            sensorBatch_toFloat(&batch, ch, out);
+        }
+        microbench_end();
+    }
+}
+
+static void benchPutcharDiscard(unsigned n)
+{
+    console_setDiscard(true);
+    for (unsigned i = 0; i < n; i++) {
+        microbench_begin();
+        putchar('.');
+        microbench_end();
+    }
+    microbench_bytes(n);
+    console_setDiscard(false);
+}
+
+static void benchPutcharUart(unsigned n)
+{
+    // Runs at the link rate once the tx buffers fill
+    for (unsigned i = 0; i < n; i++) {
+        microbench_begin();
+        putchar('.');
+        microbench_end();
+    }
+    microbench_bytes(n);
+    printf("\n");
+}
+
+// One event into the ring and out again, copied both ways
+static void benchSpsc(unsigned n)
+{
+    sh2_SensorEvent_t out;
+
+    for (unsigned i = 0; i < n; i++) {
+        microbench_begin();
+        sh2_SensorEvent_t *p = spsc_writeSlot(&ring);
+        *p = event;
+        spsc_push(&ring);
+        p = spsc_readSlot(&ring);
+        out = *p;
+        spsc_pop(&ring);
+        microbench_end();
+    }
+    microbench_bytes(n * sizeof(out));
+}
+
+// The same through a queue, with the calls an ISR producer would make
+static void benchQueueFromIsr(unsigned n)
+{
+    sh2_SensorEvent_t out;
+    BaseType_t woken;
+
+    if (queue == 0) {
+        return;
+    }
+    for (unsigned i = 0; i < n; i++) {
+        microbench_begin();
+        xQueueSendFromISR(queue, &event, &woken);
+        xQueueReceiveFromISR(queue, &out, &woken);
+        microbench_end();
+    }
+    microbench_bytes(n * sizeof(out));
+}
+
+// Frame CRCs, over the bytes a binary frame of the test event covers
+static volatile uint32_t crcSink;
+
+static unsigned crcFrame(uint8_t *frame)
+{
+    uint8_t seq = 0;
+
+    return sensorOutput_binFrame(frame, &seq, &event) - 2 - BIN_CRC_LEN;
+}
+
+static void benchCrc16(unsigned n)
+{
+    uint8_t frame[BIN_FRAME_MAX];
+    unsigned len = crcFrame(frame);
+
+    for (unsigned i = 0; i < n; i++) {
+        microbench_begin();
+        crcSink = crc16(CRC16_INIT, &frame[2], len);
+        microbench_end();
+    }
+    microbench_bytes(n * len);
+}
+
+static void benchCrc32Sw(unsigned n)
+{
+    uint8_t frame[BIN_FRAME_MAX];
+    unsigned len = crcFrame(frame);
+
+    for (unsigned i = 0; i < n; i++) {
+        microbench_begin();
+        crcSink = crc32_sw(CRC32_INIT, &frame[2], len);
+        microbench_end();
+    }
+    microbench_bytes(n * len);
+}
+
+static void benchCrc32Hw(unsigned n)
+{
+    uint8_t frame[BIN_FRAME_MAX];
+    unsigned len = crcFrame(frame);
+
+    for (unsigned i = 0; i < n; i++) {
+        microbench_begin();
+        crcSink = crc32(&frame[2], len);
+        microbench_end();
+    }
+    microbench_bytes(n * len);
+}
+
+#endif
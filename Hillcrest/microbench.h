@@ -0,0 +1,71 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * On-target microbenchmarks of the sensor report path.
+ *
+ * Benchmark builds (the sh2-demo-bench configuration, MICROBENCH=1) run
+ * every registered stage at startup instead of the demo, and again on
+ * the "bench" console command.  Each stage times its calls with the DWT
+ * cycle counter, between microbench_begin() and microbench_end().
+ */
+
+#ifndef MICROBENCH_H
+#define MICROBENCH_H
+
+#include <stdint.h>
+
+#ifndef MICROBENCH
+#define MICROBENCH (0)
+#endif
+
+// Calls per stage when the console command doesn't say
+#ifndef MICROBENCH_ITERATIONS
+#define MICROBENCH_ITERATIONS (1000)
+#endif
+
+#define MICROBENCH_MAX_STAGES (24)
+
+// Run the code under test n times.
+typedef void (MicrobenchFn_t)(unsigned n);
+
+#if MICROBENCH
+
+// Create the benchmark task and register the "bench" console command.
+void microbench_init(void);
+
+// Register a stage.
+int microbench_add(const char *name, MicrobenchFn_t *fn);
+
+// Bracket one call of the code under test.
+void microbench_begin(void);
+void microbench_end(void);
+
+// Count bytes moved by the stage, for its bytes/s column.
+void microbench_bytes(uint32_t bytes);
+
+// Run every stage n times and print cycles/call.
+void microbench_run(unsigned n);
+
+#else
+
+#define microbench_init()
+#define microbench_add(name, fn)
+
+#endif
+
+#endif
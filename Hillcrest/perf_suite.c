@@ -0,0 +1,243 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Performance suite.  See perf_suite.h.
+ */
+
+#include "perf_suite.h"
+
+#if PERF_SUITE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "stm32f4xx_hal.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "sh2.h"
+#include "sh2_SensorValue.h"
+#include "sensor_fix.h"
+#include "sensor_stats.h"
+#include "console.h"
+#include "latency.h"
+#include "boot_prof.h"
+#include "cycle_budget.h"
+#include "sysstats.h"
+#include "shell.h"
+
+// Calls per decode measurement
+#define DECODE_CALLS (1000)
+
+// ------------------------------------------------------------------------
+// Private types
+
+// Counters read at both ends of the window
+typedef struct {
+    uint32_t consoleBytes;
+    uint32_t consoleDrops;
+    uint32_t reports;
+    uint32_t overruns;
+} PerfMark_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void perfCmd(int argc, char *argv[]);
+static void getMark(PerfMark_t *pMark);
+static void reportBoot(void);
+static void reportLatency(void);
+static void reportDecode(void);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+// A rotation vector report, as the sh2 library delivers it
+static const uint8_t rvReport[] = {
+    SH2_ROTATION_VECTOR, 0, 3, 0,   // report id, sequence, status, delay
+    0x12, 0x01,  0x34, 0xfe,        // i, j (Q14)
+    0x56, 0x02,  0x9a, 0x3e,        // k, real
+    0x00, 0x02,                     // accuracy (Q12)
+};
+
+// ------------------------------------------------------------------------
+// Public API
+
+void perfSuite_init(void)
+{
+    shell_addCommand("perf", "[s] performance suite, for tools/perfcheck.py", perfCmd);
+}
+
+void perfSuite_begin(const char *suite)
+{
+    printf("PERF begin %s %u\n", suite, (unsigned)(SystemCoreClock / 1000000));
+}
+
+void perfSuite_metric(const char *group, const char *name, const char *unit, uint32_t value)
+{
+    bool sep = false;
+
+    // Runs of anything but letters, digits and dots become one underscore
+    printf("PERF %s.", group);
+    for (const char *p = name; *p; p++) {
+        if (isalnum((unsigned char)*p) || (*p == '.')) {
+            if (sep) {
+                putchar('_');
+            }
+            putchar(*p);
+            sep = false;
+        }
+        else {
+            sep = true;
+        }
+    }
+    printf("_%s %u\n", unit, (unsigned)value);
+}
+
+void perfSuite_end(void)
+{
+    printf("PERF end\n");
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static void perfCmd(int argc, char *argv[])
+{
+    uint32_t secs = PERF_SUITE_SECS;
+    SysstatsLoadMark_t load;
+    PerfMark_t start, end;
+
+    if (argc > 1) {
+        secs = strtoul(argv[1], 0, 0);
+    }
+    if ((argc > 2) || (secs == 0)) {
+        printf("usage: %s [s]\n", argv[0]);
+        return;
+    }
+
+    // Measure the pipeline as it runs, over the window
+    latency_reset();
+    sysstats_cpuLoad(&load);
+    getMark(&start);
+
+    vTaskDelay(pdMS_TO_TICKS(secs * 1000));
+
+    getMark(&end);
+    unsigned loadTenths = sysstats_cpuLoad(&load);
+
+    perfSuite_begin("run");
+    reportBoot();
+    reportLatency();
+    reportDecode();
+    perfSuite_metric("console", "bytes", "per_s", (end.consoleBytes - start.consoleBytes) / secs);
+    perfSuite_metric("console", "drops", "count", end.consoleDrops - start.consoleDrops);
+    perfSuite_metric("sensor", "reports", "per_s", (end.reports - start.reports) / secs);
+    perfSuite_metric("budget", "overruns", "count", end.overruns - start.overruns);
+    perfSuite_metric("cpu", "load", "permille", loadTenths);
+    perfSuite_end();
+}
+
+static void getMark(PerfMark_t *pMark)
+{
+    SensorStatsSummary_t sum;
+
+    pMark->consoleBytes = console_txBytes();
+    pMark->consoleDrops = console_txDrops();
+    pMark->reports = 0;
+    for (unsigned id = 1; id <= SH2_MAX_SENSOR_ID; id++) {
+        if (sensorStats_get((sh2_SensorId_t)id, &sum)) {
+            pMark->reports += sum.received;
+        }
+    }
+    pMark->overruns = cycleBudget_overruns();
+}
+
+static void reportBoot(void)
+{
+    uint32_t t_uS;
+
+    for (unsigned n = BOOT_MAIN + 1; n < BOOT_NUM_PHASES; n++) {
+        if (bootProf_phaseUs((BootPhase_t)n, &t_uS)) {
+            perfSuite_metric("boot", bootProf_phaseName((BootPhase_t)n), "us", t_uS);
+        }
+    }
+}
+
+// Latency percentiles from INTN, and the bus transfer on its own
+static void reportLatency(void)
+{
+    LatSummary_t sum, xferStart;
+    bool haveStart = latency_getStage(LAT_XFER_START, &xferStart);
+
+    for (unsigned n = 0; n < LAT_NUM_STAGES; n++) {
+        const char *name = latency_stageName((LatStage_t)n);
+        char metric[24];
+
+        if (!latency_getStage((LatStage_t)n, &sum)) {
+            continue;
+        }
+        snprintf(metric, sizeof(metric), "%s.p50", name);
+        perfSuite_metric("lat", metric, "us", sum.p50);
+        snprintf(metric, sizeof(metric), "%s.p99", name);
+        perfSuite_metric("lat", metric, "us", sum.p99);
+        snprintf(metric, sizeof(metric), "%s.max", name);
+        perfSuite_metric("lat", metric, "us", sum.max);
+
+        if ((n == LAT_XFER_DONE) && haveStart && (sum.avg >= xferStart.avg)) {
+            uint32_t xfer_us = sum.avg - xferStart.avg;
+            perfSuite_metric("xfer", "time", "us", xfer_us);
+            perfSuite_metric("xfer", "time", "cycles", xfer_us * (SystemCoreClock / 1000000));
+        }
+    }
+}
+
+// Decode cost of one report, through the SH-2 library and to fixed point
+static void reportDecode(void)
+{
+    sh2_SensorEvent_t event;
+    sh2_SensorValue_t value;
+    SensorFix_t fix;
+    uint32_t start, sh2Cycles, fixCycles;
+
+    memset(&event, 0, sizeof(event));
+    event.timestamp_uS = 1000000;
+    event.reportId = SH2_ROTATION_VECTOR;
+    event.len = sizeof(rvReport);
+    memcpy(event.report, rvReport, sizeof(rvReport));
+
+    start = DWT->CYCCNT;
+    for (unsigned n = 0; n < DECODE_CALLS; n++) {
+        sh2_decodeSensorEvent(&value, &event);
+    }
+    sh2Cycles = (DWT->CYCCNT - start) / DECODE_CALLS;
+
+    start = DWT->CYCCNT;
+    for (unsigned n = 0; n < DECODE_CALLS; n++) {
+        sensorFix_decode(&fix, &event);
+    }
+    fixCycles = (DWT->CYCCNT - start) / DECODE_CALLS;
+
+    perfSuite_metric("decode", "sh2", "cycles", sh2Cycles);
+    perfSuite_metric("decode", "fix", "cycles", fixCycles);
+    if (fixCycles != 0) {
+        perfSuite_metric("decode", "fix", "per_s", SystemCoreClock / fixCycles);
+    }
+}
+
+#endif
@@ -0,0 +1,69 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Performance suite: the figures a firmware change must not make worse,
+ * in a form tools/perfcheck.py compares against a stored baseline.
+ *
+ * "perf [secs]" measures the running pipeline over a window: bus
+ * transfer time, decode cycles, console bytes/s, latency percentiles
+ * from INTN, report rate and CPU load, plus the boot profile.  The bench
+ * build (sh2-demo-bench) adds its cycles/call table as a "bench" suite.
+ *
+ * Each suite goes out as lines
+ *   PERF begin <suite> <core MHz>
+ *   PERF <group>.<name>_<unit> <value>
+ *   PERF end
+ * with the unit suffix telling perfcheck.py which way is worse.
+ */
+
+#ifndef PERF_SUITE_H
+#define PERF_SUITE_H
+
+#include <stdint.h>
+
+// Set to 0 to leave the perf command out.
+#ifndef PERF_SUITE
+#define PERF_SUITE (1)
+#endif
+
+// Measurement window when the command doesn't say [s]
+#ifndef PERF_SUITE_SECS
+#define PERF_SUITE_SECS (10)
+#endif
+
+#if PERF_SUITE
+
+// Register the "perf" command.
+void perfSuite_init(void);
+
+// Write a suite: begin, a line per metric, end.  Spaces and punctuation
+// in name go out as underscores.
+void perfSuite_begin(const char *suite);
+void perfSuite_metric(const char *group, const char *name, const char *unit, uint32_t value);
+void perfSuite_end(void);
+
+#else
+
+#define perfSuite_init()
+#define perfSuite_begin(suite)
+#define perfSuite_metric(group, name, unit, value)
+#define perfSuite_end()
+
+#endif
+
+#endif
@@ -0,0 +1,55 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Placement of the hot interrupt path and of DMA buffers.
+ *
+ * HOT_FN before a function definition moves it to section .ramcode,
+ * which EWARM/stm32f401xe_flash.icf copies to SRAM at startup, so the
+ * INTN, SPI completion and console tx interrupts don't wait on flash.
+ * The ST HAL IRQ handlers that call them stay in flash.
+ *
+ * DMA_BUF before a variable moves it to section .dmabuf, one word
+ * aligned block at the start of SRAM.  All of SRAM is reachable by
+ * both DMA controllers on the F401; parts with CCM must keep these
+ * out of it.
+ */
+
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+// Run HOT_FN functions from SRAM.  Off by default: with the ART
+// accelerator on (stm32f4xx_hal_conf.h) flash mostly runs without wait
+// states, and the copy costs RAM.  Compare "bench" in sh2-demo-bench
+// built both ways before turning it on.
+#ifndef HOT_CODE_IN_RAM
+#define HOT_CODE_IN_RAM (0)
+#endif
+
+#if HOT_CODE_IN_RAM && defined(__ICCARM__)
+#define HOT_FN _Pragma("location=\".ramcode\"")
+#else
+#define HOT_FN
+#endif
+
+#if defined(__ICCARM__)
+#define DMA_BUF _Pragma("location=\".dmabuf\"") _Pragma("data_alignment=4")
+#else
+#define DMA_BUF
+#endif
+
+#endif
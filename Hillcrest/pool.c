@@ -0,0 +1,128 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Fixed-size block pools.  See pool.h.
+ */
+
+#include "pool.h"
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include "stm32f4xx.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "shell.h"
+#include "sysstats.h"
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void poolsCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static Pool_t *pools;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void pool_init(Pool_t *pPool, const char *name, void *storage, unsigned blockSize, unsigned blocks)
+{
+    pPool->name = name;
+    pPool->storage = storage;
+    pPool->blockSize = blockSize;
+    pPool->blocks = blocks;
+    pPool->inUse = 0;
+    pPool->maxInUse = 0;
+    pPool->gets = 0;
+    pPool->exhausted = 0;
+
+    // Thread the free list through the blocks, first block first
+    pPool->free = 0;
+    for (unsigned n = blocks; n > 0; n--) {
+        void **pBlock = (void **)(pPool->storage + (n - 1) * blockSize);
+        *pBlock = pPool->free;
+        pPool->free = pBlock;
+    }
+
+    if (pools == 0) {
+        shell_addCommand("pools", "[reset] fixed-block pool use", poolsCmd);
+    }
+    pPool->next = pools;
+    pools = pPool;
+
+    sysstats_addMemory(name, blockSize * blocks);
+}
+
+void *pool_get(Pool_t *pPool)
+{
+    void **pBlock;
+    UBaseType_t mask = portSET_INTERRUPT_MASK_FROM_ISR();
+
+    pPool->gets++;
+    pBlock = pPool->free;
+    if (pBlock == 0) {
+        pPool->exhausted++;
+    }
+    else {
+        pPool->free = *pBlock;
+        pPool->inUse++;
+        if (pPool->inUse > pPool->maxInUse) {
+            pPool->maxInUse = pPool->inUse;
+        }
+    }
+
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+
+    return pBlock;
+}
+
+void pool_put(Pool_t *pPool, void *pBlock)
+{
+    UBaseType_t mask = portSET_INTERRUPT_MASK_FROM_ISR();
+
+    *(void **)pBlock = pPool->free;
+    pPool->free = pBlock;
+    pPool->inUse--;
+
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static void poolsCmd(int argc, char *argv[])
+{
+    bool reset = (argc > 1) && (strcmp(argv[1], "reset") == 0);
+
+    printf("  %-16s %6s %6s %6s %6s %9s %9s\n",
+           "pool", "size", "blocks", "used", "max", "gets", "exhausted");
+    for (Pool_t *pPool = pools; pPool != 0; pPool = pPool->next) {
+        printf("  %-16s %6u %6u %6u %6u %9u %9u\n",
+               pPool->name, pPool->blockSize, pPool->blocks,
+               pPool->inUse, pPool->maxInUse,
+               (unsigned)pPool->gets, (unsigned)pPool->exhausted);
+        if (reset) {
+            pPool->maxInUse = pPool->inUse;
+            pPool->gets = 0;
+            pPool->exhausted = 0;
+        }
+    }
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Fixed-size block pools.
+ *
+ * Each pool hands out blocks of one size from static storage, from a
+ * free list threaded through the free blocks, so get and put take the
+ * same few instructions whatever the pool's state.  Both mask interrupts
+ * (up to configMAX_SYSCALL_INTERRUPT_PRIORITY) for the list update only,
+ * so they can be called from tasks and from ISRs that may call FreeRTOS.
+ * "pools" shows each pool's use, and how often it ran out.
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdint.h>
+
+typedef struct Pool_s {
+    const char *name;
+    uint8_t *storage;
+    uint16_t blockSize;
+    uint16_t blocks;
+    void *free;                 // first free block, 0 when exhausted
+    struct Pool_s *next;        // of all pools
+
+    // Statistics
+    uint16_t inUse;
+    uint16_t maxInUse;
+    uint32_t gets;
+    uint32_t exhausted;         // gets that found no free block
+} Pool_t;
+
+// Storage for count blocks of type, sized and aligned to hold the free
+// list's link too:
+//     static POOL_STORAGE(reqBlocks, HubRequest_t, 4);
+//     pool_init(&reqPool, "hub requests", reqBlocks, sizeof(reqBlocks[0]), 4);
+#define POOL_STORAGE(var, type, count) \
+    union { type block; void *link; } var[count]
+
+// Set up *pPool over storage of blocks of blockSize bytes, all free,
+// and register it for "pools".  Task context, before the pool is used.
+void pool_init(Pool_t *pPool, const char *name, void *storage, unsigned blockSize, unsigned blocks);
+
+// A free block, or 0 if all are in use.
+void *pool_get(Pool_t *pPool);
+
+// Return a block from pool_get() to the pool.
+void pool_put(Pool_t *pPool, void *pBlock);
+
+// Index of a block in its pool's storage, 0 to blocks-1.
+static inline unsigned pool_index(const Pool_t *pPool, const void *pBlock)
+{
+    return (unsigned)(((const uint8_t *)pBlock - pPool->storage) / pPool->blockSize);
+}
+
+#endif
@@ -0,0 +1,514 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Duty-cycled power: STOP mode between sensor reports.
+ */
+
+#include "power.h"
+
+#include <stdio.h>
+#include <string.h>
+#include "stm32f4xx_hal.h"
+#include "task.h"
+#include "clock.h"
+#include "timebase.h"
+#include "shell.h"
+#include "usb_cdc.h"
+#include "priorities.h"
+
+// RTC from the LSE: PREDIV_A 1 halves it, and the sub-second counter
+// counts down from RTC_HZ-1 at RTC_HZ, 61us a step.  The wakeup timer
+// runs from RTCCLK/2, at the same rate.
+#define RTC_HZ (16384)
+#define RTC_PREDIV_A (1)
+#define RTC_WUCKSEL_DIV2 (3)
+
+// One minute of sub-second steps, where the RTC position wraps
+#define RTC_MINUTE (60 * RTC_HZ)
+
+// EXTI lines of the RTC wakeup timer and USART2 RX (PA3)
+#define EXTI_RTC_WKUP (1u << 22)
+#define EXTI_CONSOLE_RX (1u << 3)
+
+// Longest stop the 16-bit wakeup timer can time [ms]
+#define STOP_MAX_MS (65536u * 1000 / RTC_HZ)
+
+// Wake this much ahead of the scheduler's timeout, for the clock [ms]
+#define WAKE_MARGIN_MS (1)
+
+// The MCU wakes on HSI, which cycles count while the clock is restored
+#define HSI_MHZ (16)
+
+// ------------------------------------------------------------------------
+// Private types
+
+typedef struct {
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t sum_us;
+} Lat_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+#if POWER_STOP
+static bool stopAllowed(TickType_t idle);
+static void stop(TickType_t idle);
+static bool rtcReady(void);
+static void rtcConfig(void);
+static void rtcUnlock(void);
+static void rtcLock(void);
+static void rtcWakeupArm(uint32_t ms);
+static void rtcWakeupDisarm(void);
+static void rtcClearWakeup(void);
+static uint32_t rtcPos(void);
+static uint32_t rtcWaitStep(void);
+static void addLat(Lat_t *l, uint32_t us);
+static void printLat(const char *name, const Lat_t *l);
+#endif
+static void powerCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static volatile PowerMode_t mode = POWER_MODE_DEFAULT;
+static volatile uint32_t sensorInterval_us;
+static volatile uint32_t holds;
+static volatile TickType_t awakeUntil;
+
+#if POWER_STOP
+static bool rtcOk;
+
+// Set on each wake, with interrupts disabled.  wokenBy holds the EXTI
+// lines that were pending then, until their ISR takes the wake time.
+static volatile uint64_t wake_uS;
+static volatile uint16_t wokenBy;
+static volatile bool readPending;
+
+static uint32_t stops;
+static uint64_t stopped_us;
+static uint32_t tickRem_us;     // stopped time not yet stepped into the tick
+static uint64_t statsStart_uS;
+static Lat_t restoreLat;
+static Lat_t readLat;
+#endif
+
+// ------------------------------------------------------------------------
+// Public API
+
+void power_init(void)
+{
+#if POWER_STOP
+    uint32_t rtcSel;
+
+    // Start the LSE: it takes up to 2s, STOP waits for it
+    __HAL_RCC_PWR_CLK_ENABLE();
+    PWR->CR |= PWR_CR_DBP;
+    rtcSel = RCC->BDCR & RCC_BDCR_RTCSEL;
+    if ((rtcSel != 0) && (rtcSel != RCC_BDCR_RTCSEL_0)) {
+        // The RTC source only changes with a backup domain reset
+        RCC->BDCR |= RCC_BDCR_BDRST;
+        RCC->BDCR &= ~RCC_BDCR_BDRST;
+    }
+    RCC->BDCR |= RCC_BDCR_LSEON;
+
+    // Console RX (PA3) wakes from STOP on its start bit
+    __HAL_RCC_SYSCFG_CLK_ENABLE();
+    SYSCFG->EXTICR[0] &= ~SYSCFG_EXTICR1_EXTI3;
+    EXTI->FTSR |= EXTI_CONSOLE_RX;
+
+    HAL_NVIC_SetPriority(RTC_WKUP_IRQn, PRIO_IRQ_WAKE, 0);
+    HAL_NVIC_EnableIRQ(RTC_WKUP_IRQn);
+    HAL_NVIC_SetPriority(EXTI3_IRQn, PRIO_IRQ_WAKE, 0);
+    HAL_NVIC_EnableIRQ(EXTI3_IRQn);
+
+    statsStart_uS = timebase_getUs();
+#endif
+
+    // Give the first console user time to type
+    power_keepAwake();
+
+    shell_addCommand("power", "[off | stop | auto | reset] STOP between reports, time awake", powerCmd);
+}
+
+void power_setMode(PowerMode_t newMode)
+{
+    mode = newMode;
+}
+
+PowerMode_t power_getMode(void)
+{
+    return mode;
+}
+
+void power_setSensorInterval(uint32_t interval_us)
+{
+    sensorInterval_us = interval_us;
+}
+
+void power_hold(uint32_t h)
+{
+    UBaseType_t mask = portSET_INTERRUPT_MASK_FROM_ISR();
+    holds |= h;
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+}
+
+void power_release(uint32_t h)
+{
+    UBaseType_t mask = portSET_INTERRUPT_MASK_FROM_ISR();
+    holds &= ~h;
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+}
+
+void power_keepAwake(void)
+{
+    awakeUntil = xTaskGetTickCountFromISR() + pdMS_TO_TICKS(POWER_CONSOLE_AWAKE_MS);
+}
+
+void power_readStarted(void)
+{
+#if POWER_STOP
+    if (readPending) {
+        readPending = false;
+        addLat(&readLat, (uint32_t)(timebase_getUs() - wake_uS));
+    }
+#endif
+}
+
+uint64_t power_edgeUs(uint16_t pin, uint64_t t_uS)
+{
+#if POWER_STOP
+    // EXTI ISRs share a priority, so this is never preempted by another
+    if (wokenBy & pin) {
+        wokenBy &= ~pin;
+        return wake_uS;
+    }
+#endif
+    return t_uS;
+}
+
+void power_preSleep(TickType_t *pIdle)
+{
+#if POWER_STOP
+    if (stopAllowed(*pIdle)) {
+        stop(*pIdle);
+        *pIdle = 0;
+    }
+#endif
+}
+
+void power_wakeIrq(void)
+{
+#if POWER_STOP
+    // Normally cleared on the way out of STOP already
+    rtcClearWakeup();
+    EXTI->PR = EXTI_RTC_WKUP | EXTI_CONSOLE_RX;
+#endif
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+// Shell command: set the mode, or show the power statistics.
+static void powerCmd(int argc, char *argv[])
+{
+    static const char * const modeName[] = {
+        [POWER_MODE_OFF] = "off",
+        [POWER_MODE_STOP] = "stop",
+        [POWER_MODE_AUTO] = "auto",
+    };
+
+    if (argc > 1) {
+        if (strcmp(argv[1], "off") == 0) {
+            power_setMode(POWER_MODE_OFF);
+        }
+        else if (strcmp(argv[1], "stop") == 0) {
+            power_setMode(POWER_MODE_STOP);
+        }
+        else if (strcmp(argv[1], "auto") == 0) {
+            power_setMode(POWER_MODE_AUTO);
+        }
+#if POWER_STOP
+        else if (strcmp(argv[1], "reset") == 0) {
+            taskENTER_CRITICAL();
+            stops = 0;
+            stopped_us = 0;
+            statsStart_uS = timebase_getUs();
+            memset(&restoreLat, 0, sizeof(restoreLat));
+            memset(&readLat, 0, sizeof(readLat));
+            taskEXIT_CRITICAL();
+        }
+#endif
+        else {
+            printf("usage: %s [off | stop | auto | reset]\n", argv[0]);
+            return;
+        }
+    }
+
+#if POWER_STOP
+    uint64_t total_us = timebase_getUs() - statsStart_uS;
+    uint64_t awake_us = total_us - stopped_us;
+    unsigned permille = (total_us != 0) ? (unsigned)(awake_us * 1000 / total_us) : 1000;
+
+    printf("Power mode %s, subscriptions %u us apart (auto stops from %u)\n",
+           modeName[mode], (unsigned)sensorInterval_us, (unsigned)POWER_AUTO_MIN_INTERVAL_US);
+    printf("  awake %u.%u%% of %u s, %u stops, %s\n",
+           permille / 10, permille % 10, (unsigned)(total_us / 1000000),
+           (unsigned)stops, rtcOk ? "RTC on LSE" : "no LSE yet: STOP unavailable");
+    printf("  held by:%s%s%s%s%s%s%s\n",
+           (holds & POWER_HOLD_SPI) ? " spi" : "",
+           (holds >= POWER_HOLD_I2C) ? " i2c" : "",
+           (holds & POWER_HOLD_POLL) ? " hub polling" : "",
+           (holds & POWER_HOLD_CONSOLE) ? " console output" : "",
+           (holds & POWER_HOLD_DATA_UART) ? " data uart" : "",
+           ((int32_t)(awakeUntil - xTaskGetTickCount()) > 0) ? " console input" : "",
+#if USB_CDC
+           usbCdc_busy() ? " usb" : ""
+#else
+           ""
+#endif
+           );
+    printf("  %-14s %8s %8s %8s\n", "[us]", "count", "avg", "max");
+    printLat("clock restore", &restoreLat);
+    printLat("wake to read", &readLat);
+#else
+    printf("Power mode %s (built without STOP)\n", modeName[mode]);
+#endif
+}
+
+#if POWER_STOP
+static bool stopAllowed(TickType_t idle)
+{
+    if ((mode == POWER_MODE_OFF) ||
+        ((mode == POWER_MODE_AUTO) && (sensorInterval_us != 0) &&
+         (sensorInterval_us < POWER_AUTO_MIN_INTERVAL_US))) {
+        return false;
+    }
+    if ((idle < pdMS_TO_TICKS(POWER_STOP_MIN_MS)) || (holds != 0) ||
+        ((int32_t)(awakeUntil - xTaskGetTickCountFromISR()) > 0)) {
+        return false;
+    }
+#if USB_CDC
+    if (usbCdc_busy()) {
+        return false;
+    }
+#endif
+    return rtcReady();
+}
+
+// Stop for up to idle ticks, then restore the clock and account for the
+// time stopped.  Interrupts are disabled throughout: whatever woke the
+// MCU is served once the port re-enables them.
+static void stop(TickType_t idle)
+{
+    uint32_t ms = (idle - 1) * portTICK_PERIOD_MS;
+    uint32_t pos0, pos1, cycles, steps, restore_us, step;
+    uint64_t t0_uS, t1_uS, restored_uS, elapsed_us, adjust_us;
+    uint32_t pending;
+
+    if (ms > STOP_MAX_MS) {
+        ms = STOP_MAX_MS;
+    }
+    rtcWakeupArm(ms - WAKE_MARGIN_MS);
+    EXTI->PR = EXTI_RTC_WKUP | EXTI_CONSOLE_RX;
+    EXTI->IMR |= EXTI_CONSOLE_RX;
+
+    // Start on a step of the RTC, so it times the stop to the microsecond
+    pos0 = rtcWaitStep();
+    t0_uS = timebase_getUs();
+
+    // Low power regulator; SLEEPDEEP makes WFI enter STOP
+    PWR->CR = (PWR->CR & ~PWR_CR_PDDS) | PWR_CR_LPDS;
+    SCB->SCR |= SCB_SCR_SLEEPDEEP_Msk;
+    __DSB();
+    __WFI();
+    __ISB();
+    SCB->SCR &= ~SCB_SCR_SLEEPDEEP_Msk;
+
+    // Back on HSI: HSE and the PLL are off
+    cycles = DWT->CYCCNT;
+    clock_resume();
+    cycles = DWT->CYCCNT - cycles;
+    restored_uS = timebase_getUs();
+
+    // End on a step too.  TIM2 stopped with the clocks, and ran slow on
+    // HSI; whatever it missed goes back on the timebase.
+    pos1 = rtcWaitStep();
+    t1_uS = timebase_getUs();
+    steps = (pos1 + RTC_MINUTE - pos0) % RTC_MINUTE;
+    elapsed_us = (uint64_t)steps * 1000000 / RTC_HZ;
+    adjust_us = (elapsed_us > t1_uS - t0_uS) ? elapsed_us - (t1_uS - t0_uS) : 0;
+    timebase_advanceUs((uint32_t)adjust_us);
+
+    EXTI->IMR &= ~EXTI_CONSOLE_RX;
+    rtcWakeupDisarm();
+    pending = EXTI->PR;
+    EXTI->PR = EXTI_RTC_WKUP | EXTI_CONSOLE_RX;
+    NVIC_ClearPendingIRQ(RTC_WKUP_IRQn);
+    NVIC_ClearPendingIRQ(EXTI3_IRQn);
+
+    // Waking began before the clock restore (most of it on HSI)
+    restore_us = cycles / HSI_MHZ;
+    wake_uS = restored_uS + adjust_us - restore_us;
+    wokenBy = (uint16_t)(pending & ~EXTI_CONSOLE_RX);
+    if (wokenBy != 0) {
+        readPending = true;
+    }
+    if (pending & EXTI_CONSOLE_RX) {
+        // Its first character is gone, but not the ones after
+        power_keepAwake();
+    }
+
+    stops++;
+    stopped_us += adjust_us;
+    addLat(&restoreLat, restore_us);
+
+    // The tick missed the stop too.  The port steps it by what SysTick
+    // counted, a tick at most, so stay within the idle time.
+    tickRem_us += (uint32_t)adjust_us;
+    step = tickRem_us / (1000 * portTICK_PERIOD_MS);
+    tickRem_us -= step * 1000 * portTICK_PERIOD_MS;
+    if (step + 2 > idle) {
+        step = (idle > 2) ? idle - 2 : 0;
+        tickRem_us = 0;
+    }
+    if (step != 0) {
+        vTaskStepTick(step);
+    }
+}
+
+// Configure the RTC once the LSE is up
+static bool rtcReady(void)
+{
+    if (!rtcOk && (RCC->BDCR & RCC_BDCR_LSERDY)) {
+        rtcConfig();
+    }
+    return rtcOk;
+}
+
+static void rtcConfig(void)
+{
+    RCC->BDCR |= RCC_BDCR_RTCSEL_0;
+    RCC->BDCR |= RCC_BDCR_RTCEN;
+
+    rtcUnlock();
+    RTC->ISR |= RTC_ISR_INIT;
+    while ((RTC->ISR & RTC_ISR_INITF) == 0) {
+        // up to two RTCCLK periods
+    }
+    RTC->PRER = RTC_HZ - 1;
+    RTC->PRER |= RTC_PREDIV_A << 16;
+    // Read the counters themselves, not shadows that resync after STOP
+    RTC->CR |= RTC_CR_BYPSHAD;
+    RTC->ISR &= ~RTC_ISR_INIT;
+
+    RTC->CR &= ~RTC_CR_WUTE;
+    while ((RTC->ISR & RTC_ISR_WUTWF) == 0) {
+        // wakeup timer writable
+    }
+    RTC->CR = (RTC->CR & ~RTC_CR_WUCKSEL) | RTC_WUCKSEL_DIV2 | RTC_CR_WUTIE;
+    rtcLock();
+
+    EXTI->RTSR |= EXTI_RTC_WKUP;
+    EXTI->IMR |= EXTI_RTC_WKUP;
+
+    rtcOk = true;
+}
+
+static void rtcUnlock(void)
+{
+    RTC->WPR = 0xCA;
+    RTC->WPR = 0x53;
+}
+
+static void rtcLock(void)
+{
+    RTC->WPR = 0xFF;
+}
+
+static void rtcWakeupArm(uint32_t ms)
+{
+    uint32_t count = ms * RTC_HZ / 1000;
+
+    rtcUnlock();
+    RTC->CR &= ~RTC_CR_WUTE;
+    while ((RTC->ISR & RTC_ISR_WUTWF) == 0) {
+        // up to two RTCCLK periods
+    }
+    RTC->WUTR = (count > 0) ? count - 1 : 0;
+    rtcClearWakeup();
+    RTC->CR |= RTC_CR_WUTE;
+    rtcLock();
+}
+
+static void rtcWakeupDisarm(void)
+{
+    rtcUnlock();
+    RTC->CR &= ~RTC_CR_WUTE;
+    rtcLock();
+    rtcClearWakeup();
+}
+
+static void rtcClearWakeup(void)
+{
+    // Write 0 to WUTF only (the other flags are cleared by writing 0 too)
+    RTC->ISR = (~(RTC_ISR_WUTF | RTC_ISR_INIT) & 0x0000FFFF) | (RTC->ISR & RTC_ISR_INIT);
+}
+
+// RTC position in sub-second steps within the minute
+static uint32_t rtcPos(void)
+{
+    uint32_t ssr, tr;
+
+    // The counters are read directly (BYPSHAD): read until steady
+    do {
+        ssr = RTC->SSR;
+        tr = RTC->TR;
+    } while ((ssr != RTC->SSR) || (tr != RTC->TR));
+
+    uint32_t sec = ((tr & RTC_TR_ST) >> 4) * 10 + (tr & RTC_TR_SU);
+    return sec * RTC_HZ + (RTC_HZ - 1 - (ssr & RTC_SSR_SS));
+}
+
+// Wait for the next RTC step (61us at most) and return its position
+static uint32_t rtcWaitStep(void)
+{
+    uint32_t pos = rtcPos();
+    uint32_t next;
+
+    while ((next = rtcPos()) == pos) {
+        // spin
+    }
+    return next;
+}
+
+static void addLat(Lat_t *l, uint32_t us)
+{
+    l->count++;
+    l->sum_us += us;
+    if (us > l->max_us) {
+        l->max_us = us;
+    }
+}
+
+static void printLat(const char *name, const Lat_t *l)
+{
+    printf("  %-14s %8u %8u %8u\n", name, (unsigned)l->count,
+           (l->count != 0) ? (unsigned)(l->sum_us / l->count) : 0, (unsigned)l->max_us);
+}
+#endif
@@ -0,0 +1,132 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Duty-cycled power: STOP mode between sensor reports.
+ *
+ * When the scheduler idles (tickless idle, FreeRTOSConfig.h), the MCU
+ * normally sleeps with its clocks running.  In STOP mode the clocks and
+ * regulator stop as well, and only EXTI edges wake it:
+ *   - INTN, so the hub's next report is read as before;
+ *   - the RTC wakeup timer, set for the scheduler's next timeout;
+ *   - a falling edge on the console's RX pin (see below).
+ * On waking, the clock profile is restored (HSE and PLL), the timebase
+ * and the RTOS tick are advanced by the time stopped, as the RTC on the
+ * 32.768kHz LSE measured it, and the INTN edge that woke the MCU is
+ * stamped with the wake time, not the later time its ISR ran.
+ *
+ * STOP is only entered when
+ *   - the mode is POWER_MODE_STOP, or POWER_MODE_AUTO and no subscription
+ *     has the hub deliver reports (or batches) less than
+ *     POWER_AUTO_MIN_INTERVAL_US apart;
+ *   - the scheduler expects to idle for at least POWER_STOP_MIN_MS;
+ *   - nothing holds the power on: a sensor bus transfer or console
+ *     output in progress, console input in the last POWER_CONSOLE_AWAKE_MS,
+ *     or a USB bus that isn't suspended;
+ *   - the LSE has started (the RTC needs it; it takes up to 2s after
+ *     reset, and some boards have none).
+ * Otherwise the idle task sleeps as before.
+ *
+ * The UART can't receive in STOP: the character that wakes the MCU is
+ * lost.  Press Enter first; the console then stays awake while in use.
+ *
+ * The "power" command shows the time spent awake (a proxy for average
+ * current), STOP entries, how long restoring the clock takes, and the
+ * time from waking to the HAL starting the read of the report.
+ */
+
+#ifndef POWER_H
+#define POWER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "FreeRTOS.h"
+
+// Build in STOP mode support
+#ifndef POWER_STOP
+#define POWER_STOP (1)
+#endif
+
+// Mode at startup (PowerMode_t)
+#ifndef POWER_MODE_DEFAULT
+#define POWER_MODE_DEFAULT (POWER_MODE_OFF)
+#endif
+
+// POWER_MODE_AUTO stops if reports come at least this far apart [us]
+#ifndef POWER_AUTO_MIN_INTERVAL_US
+#define POWER_AUTO_MIN_INTERVAL_US (20000)
+#endif
+
+// Shortest idle worth stopping for [ms]: waking and restoring the clock
+// takes a few hundred us
+#ifndef POWER_STOP_MIN_MS
+#define POWER_STOP_MIN_MS (4)
+#endif
+
+// Console stays awake this long after each character received [ms]
+#ifndef POWER_CONSOLE_AWAKE_MS
+#define POWER_CONSOLE_AWAKE_MS (10000)
+#endif
+
+typedef enum {
+    POWER_MODE_OFF,             // sleep only
+    POWER_MODE_STOP,            // STOP whenever allowed
+    POWER_MODE_AUTO,            // STOP if the subscriptions are slow enough
+} PowerMode_t;
+
+// Activities that keep the MCU out of STOP while they run
+#define POWER_HOLD_SPI      (1u << 0)   // SPI bus held (spi_bus.c)
+#define POWER_HOLD_CONSOLE  (1u << 1)   // UART output going out
+#define POWER_HOLD_POLL     (1u << 2)   // hub without INTN polled on TIM2
+#define POWER_HOLD_DATA_UART (1u << 3)  // data UART output going out
+#define POWER_HOLD_I2C      (1u << 4)   // I2C bus 0 transfer, bus n at << n
+
+// Start the LSE and register the "power" command.
+void power_init(void);
+
+void power_setMode(PowerMode_t mode);
+PowerMode_t power_getMode(void);
+
+// Shortest time between hub deliveries the subscriptions ask for [us],
+// 0 if none are enabled.  For POWER_MODE_AUTO.
+void power_setSensorInterval(uint32_t interval_us);
+
+// Set or clear POWER_HOLD_ bits.  Safe from tasks and ISRs.
+void power_hold(uint32_t holds);
+void power_release(uint32_t holds);
+
+// Stay awake for POWER_CONSOLE_AWAKE_MS.  Safe from tasks and ISRs.
+void power_keepAwake(void);
+
+// The HAL is starting to read a report: records the wake-to-read time
+// if the MCU has just woken from STOP.
+void power_readStarted(void);
+
+// Time of an edge on EXTI line pin (a GPIO_PIN_x bit) whose ISR ran at
+// t_uS: the wake time, if the edge woke the MCU from STOP.  From the
+// EXTI ISR.
+uint64_t power_edgeUs(uint16_t pin, uint64_t t_uS);
+
+// Tickless idle hook (configPRE_SLEEP_PROCESSING), called with
+// interrupts disabled.  Stops the MCU, if it may, and sets *pIdle to 0
+// so the port skips its own sleep.
+void power_preSleep(TickType_t *pIdle);
+
+// Call from RTC_WKUP_IRQHandler and EXTI3_IRQHandler (console RX wake).
+void power_wakeIrq(void);
+
+#endif
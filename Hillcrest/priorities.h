@@ -0,0 +1,79 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Interrupt and task priorities.
+ *
+ * The sensor path must never wait behind the console:
+ *
+ *   INTN (EXTI)  >  sensor bus (SPI1/I2C1 and their DMA)  >  USB  >  console (USART2)
+ *   HAL task     >  sensor (consumer) task  >  demo (hub control) and shell tasks  >  log and recorder tasks
+ *
+ * Every interrupt here calls FreeRTOS FromISR functions, so none may be
+ * numerically below configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY (5).
+ * Lower numbers preempt higher ones.
+ */
+
+#ifndef PRIORITIES_H
+#define PRIORITIES_H
+
+#define PRIO_IRQ_INTN        (5)    // timestamps INTN, starts the transfer
+#define PRIO_IRQ_SENSOR_BUS  (6)    // SPI1, I2C1, their DMA streams, TIM2 alarm
+#define PRIO_IRQ_RESAMPLE    (7)    // TIM5, fixed-rate resampler grid
+#define PRIO_IRQ_TICK        (7)    // TIM4, sample-locked control tick
+#define PRIO_IRQ_USB         (9)    // OTG_FS, console and sensor stream over USB
+#define PRIO_IRQ_CONSOLE     (10)   // USART2 and its DMA stream, data UART (USART1)
+#define PRIO_IRQ_WAKE        (11)   // RTC wakeup and console RX wake from STOP (power.c)
+
+#define PRIO_TASK_WATCH      (osPriorityHigh)     // pipeline monitor, above what it watches
+#define PRIO_TASK_HAL        (osPriorityAboveNormal)
+#define PRIO_TASK_TICK       (osPriorityAboveNormal) // sample-locked control callback, ahead of the sensor task
+#define PRIO_TASK_SENSOR     (osPriorityNormal)
+#define PRIO_TASK_DEMO       (osPriorityBelowNormal) // waits on the hub: configuration, reset recovery
+#define PRIO_TASK_SHELL      (osPriorityBelowNormal)
+#define PRIO_TASK_RPC        (osPriorityBelowNormal) // binary control requests, as the shell
+#define PRIO_TASK_DFU        (osPriorityBelowNormal) // one per hub in a multi-hub update, as the demo task
+#define PRIO_TASK_LOG        (osPriorityLow)      // formats deferred log output
+#define PRIO_TASK_RECORD     (osPriorityLow)      // programs recorded pages to SPI flash
+#define PRIO_TASK_FFT        (osPriorityLow)      // vibration spectra
+#define PRIO_TASK_TELEMETRY  (osPriorityLow)      // metrics frames in the binary output
+#define PRIO_TASK_HEALTH     (osPriorityLow)      // hub heartbeat, error and counter polls
+#define PRIO_TASK_BENCH      (osPriorityIdle)     // benchmark builds only
+#define PRIO_TASK_LOAD       (osPriorityBelowNormal) // CPU load injector, stands in for application code
+
+// Sensor dispatch order within the sensor task (higher first), so pose
+// consumers see a sample before the console spends time printing it.
+#define PRIO_SUB_LATEST      (35)   // latest value of each sensor
+#define PRIO_SUB_TICK        (33)   // sample-locked control tick, arrival times
+#define PRIO_SUB_PREDICT     (30)   // GIRV pose prediction
+#define PRIO_SUB_CAMSYNC     (28)   // camera trigger poses, after prediction
+#define PRIO_SUB_STROBE      (27)   // sample-locked trigger output
+#define PRIO_SUB_RESAMPLE    (26)   // fixed-rate resampler history
+#define PRIO_SUB_EKF         (25)   // position/velocity fusion
+#define PRIO_SUB_RATE        (25)   // motion-adaptive rate governor
+#define PRIO_SUB_TUNE        (24)   // change-sensitivity tuner
+#define PRIO_SUB_CAL         (22)   // calibration manager, ready signal
+#define PRIO_SUB_STATS       (20)   // per-sensor statistics
+#define PRIO_SUB_HSI_TRIM    (19)   // HSI trim against the hub clock
+#define PRIO_SUB_NOISE       (18)   // streaming noise statistics
+#define PRIO_SUB_FFT         (17)   // vibration spectrum samples
+#define PRIO_SUB_BLACKBOX    (16)   // black-box capture around motion events
+#define PRIO_SUB_RECORD      (15)   // SPI flash recording
+#define PRIO_SUB_BRIDGE      (14)   // SPI slave bridge to an application processor
+#define PRIO_SUB_OUTPUT      (10)   // console report output
+
+#endif
@@ -0,0 +1,206 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Quaternion and vector math for sensor hub orientation outputs.
+ */
+
+#include "quat.h"
+
+#include <math.h>
+
+// Above this |cos(angle)| slerp falls back to normalised lerp, where
+// sinf(angle) is too small to divide by.
+#define SLERP_LINEAR_DOT (0.9995f)
+
+static const Quat_t identity = {1.0f, 0.0f, 0.0f, 0.0f};
+
+// ------------------------------------------------------------------------
+// Public API
+
+Quat_t quat_fromFix(const SensorFix_t *fix)
+{
+    Quat_t q;
+
+    if (fix->kind == SENSORFIX_QUAT) {
+        q.w = FIX_TO_FLOAT(SENSORFIX_Q_QUAT, fix->un.quat.real);
+        q.x = FIX_TO_FLOAT(SENSORFIX_Q_QUAT, fix->un.quat.i);
+        q.y = FIX_TO_FLOAT(SENSORFIX_Q_QUAT, fix->un.quat.j);
+        q.z = FIX_TO_FLOAT(SENSORFIX_Q_QUAT, fix->un.quat.k);
+    }
+    else if (fix->kind == SENSORFIX_GIRV) {
+        q.w = FIX_TO_FLOAT(SENSORFIX_Q_QUAT, fix->un.girv.real);
+        q.x = FIX_TO_FLOAT(SENSORFIX_Q_QUAT, fix->un.girv.i);
+        q.y = FIX_TO_FLOAT(SENSORFIX_Q_QUAT, fix->un.girv.j);
+        q.z = FIX_TO_FLOAT(SENSORFIX_Q_QUAT, fix->un.girv.k);
+    }
+    else {
+        q = identity;
+    }
+
+    return q;
+}
+
+Quat_t quat_mul(Quat_t a, Quat_t b)
+{
+    Quat_t q;
+
+    q.w = a.w*b.w - a.x*b.x - a.y*b.y - a.z*b.z;
+    q.x = a.w*b.x + a.x*b.w + a.y*b.z - a.z*b.y;
+    q.y = a.w*b.y - a.x*b.z + a.y*b.w + a.z*b.x;
+    q.z = a.w*b.z + a.x*b.y - a.y*b.x + a.z*b.w;
+
+    return q;
+}
+
+Quat_t quat_conj(Quat_t q)
+{
+    q.x = -q.x;
+    q.y = -q.y;
+    q.z = -q.z;
+
+    return q;
+}
+
+Quat_t quat_normalize(Quat_t q)
+{
+    float n2 = q.w*q.w + q.x*q.x + q.y*q.y + q.z*q.z;
+
+    if (n2 <= 0.0f) {
+        return identity;
+    }
+
+    // One VSQRT and one VDIV, then multiplies
+    float inv = 1.0f / sqrtf(n2);
+    q.w *= inv;
+    q.x *= inv;
+    q.y *= inv;
+    q.z *= inv;
+
+    return q;
+}
+
+Quat_t quat_relative(Quat_t a, Quat_t b)
+{
+    return quat_mul(quat_conj(a), b);
+}
+
+Quat_t quat_slerp(Quat_t a, Quat_t b, float t)
+{
+    float dot = a.w*b.w + a.x*b.x + a.y*b.y + a.z*b.z;
+    float sa, sb;
+    Quat_t q;
+
+    // q and -q are the same rotation, take the short way round
+    if (dot < 0.0f) {
+        dot = -dot;
+        b.w = -b.w;
+        b.x = -b.x;
+        b.y = -b.y;
+        b.z = -b.z;
+    }
+
+    if (dot > SLERP_LINEAR_DOT) {
+        sa = 1.0f - t;
+        sb = t;
+    }
+    else {
+        float angle = acosf(dot);
+        float inv = 1.0f / sinf(angle);
+        sa = sinf((1.0f - t) * angle) * inv;
+        sb = sinf(t * angle) * inv;
+    }
+
+    q.w = sa*a.w + sb*b.w;
+    q.x = sa*a.x + sb*b.x;
+    q.y = sa*a.y + sb*b.y;
+    q.z = sa*a.z + sb*b.z;
+
+    return quat_normalize(q);
+}
+
+Euler_t quat_toEuler(Quat_t q)
+{
+    Euler_t e;
+    float s = 2.0f * (q.w*q.y - q.z*q.x);
+
+    // Clamp rounding error so asinf stays defined at +/-90 degrees pitch
+    if (s > 1.0f) s = 1.0f;
+    if (s < -1.0f) s = -1.0f;
+
+    e.roll = atan2f(2.0f * (q.w*q.x + q.y*q.z),
+                    1.0f - 2.0f * (q.x*q.x + q.y*q.y));
+    e.pitch = asinf(s);
+    e.yaw = atan2f(2.0f * (q.w*q.z + q.x*q.y),
+                   1.0f - 2.0f * (q.y*q.y + q.z*q.z));
+
+    return e;
+}
+
+Vec3_t quat_rotate(Quat_t q, Vec3_t v)
+{
+    // v' = v + w*t + u x t, with u = (x,y,z) and t = 2 u x v:
+    // 15 multiplies instead of the 28 of two quaternion products.
+    Vec3_t t, r;
+
+    t.x = 2.0f * (q.y*v.z - q.z*v.y);
+    t.y = 2.0f * (q.z*v.x - q.x*v.z);
+    t.z = 2.0f * (q.x*v.y - q.y*v.x);
+
+    r.x = v.x + q.w*t.x + (q.y*t.z - q.z*t.y);
+    r.y = v.y + q.w*t.y + (q.z*t.x - q.x*t.z);
+    r.z = v.z + q.w*t.z + (q.x*t.y - q.y*t.x);
+
+    return r;
+}
+
+Vec3_t quat_linearAccel(Quat_t q, Vec3_t accel)
+{
+    // At rest the accelerometer reads +1g up, the world z axis
+    Vec3_t a = quat_rotate(q, accel);
+    a.z -= QUAT_GRAVITY;
+
+    return a;
+}
+
+void quat_mulN(Quat_t *out, const Quat_t *a, const Quat_t *b, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        out[i] = quat_mul(a[i], b[i]);
+    }
+}
+
+void quat_normalizeN(Quat_t *out, const Quat_t *q, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        out[i] = quat_normalize(q[i]);
+    }
+}
+
+void quat_toEulerN(Euler_t *out, const Quat_t *q, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        out[i] = quat_toEuler(q[i]);
+    }
+}
+
+void quat_rotateN(Vec3_t *out, const Quat_t *q, const Vec3_t *v, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        out[i] = quat_rotate(q[i], v[i]);
+    }
+}
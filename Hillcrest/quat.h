@@ -0,0 +1,83 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Quaternion and vector math for sensor hub orientation outputs.
+ *
+ * Single precision throughout, so everything runs on the M4F FPU.
+ * Types are passed and returned by value: with the hard-float ABI a
+ * Quat_t or Vec3_t travels in s0-s3, not through memory.
+ *
+ * Quaternions follow SH-2: unit quaternions rotating the sensor (body)
+ * frame into the world frame.
+ */
+
+#ifndef QUAT_H
+#define QUAT_H
+
+#include <stddef.h>
+#include "sensor_fix.h"
+
+// Standard gravity [m/s^2]
+#define QUAT_GRAVITY (9.80665f)
+
+typedef struct {
+    float w, x, y, z;
+} Quat_t;
+
+typedef struct {
+    float x, y, z;
+} Vec3_t;
+
+// Tait-Bryan angles, Z-Y-X order [radians]
+typedef struct {
+    float roll;    // about x, -pi..pi
+    float pitch;   // about y, -pi/2..pi/2
+    float yaw;     // about z, -pi..pi
+} Euler_t;
+
+// Orientation from a decoded rotation vector or Gyro Integrated RV.
+// Returns the identity for other report kinds.
+Quat_t quat_fromFix(const SensorFix_t *fix);
+
+Quat_t quat_mul(Quat_t a, Quat_t b);
+Quat_t quat_conj(Quat_t q);
+Quat_t quat_normalize(Quat_t q);
+
+// Rotation r from orientation a to orientation b, in a's body frame:
+// b = a * r, so r = conj(a) * b.
+Quat_t quat_relative(Quat_t a, Quat_t b);
+
+// Spherical interpolation from a (t=0) to b (t=1), shortest path.
+Quat_t quat_slerp(Quat_t a, Quat_t b, float t);
+
+Euler_t quat_toEuler(Quat_t q);
+
+// Rotate body-frame vector v into the world frame.
+Vec3_t quat_rotate(Quat_t q, Vec3_t v);
+
+// World-frame acceleration with gravity removed, from a body-frame
+// accelerometer reading [m/s^2] and the orientation at that time.
+Vec3_t quat_linearAccel(Quat_t q, Vec3_t accel);
+
+// Batch versions, element by element.  out may alias an input.
+void quat_mulN(Quat_t *out, const Quat_t *a, const Quat_t *b, size_t n);
+void quat_normalizeN(Quat_t *out, const Quat_t *q, size_t n);
+void quat_toEulerN(Euler_t *out, const Quat_t *q, size_t n);
+void quat_rotateN(Vec3_t *out, const Quat_t *q, const Vec3_t *v, size_t n);
+
+#endif
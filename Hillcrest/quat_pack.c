@@ -0,0 +1,98 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "quat_pack.h"
+
+#include <stdlib.h>
+#include <math.h>
+
+// 1/sqrt(2) in Q16
+#define RSQRT2_Q16 (46341)
+
+// ------------------------------------------------------------------------
+// Public API
+
+unsigned quatPack_encode(uint8_t *out, const int16_t quat[4], unsigned q, unsigned bits)
+{
+    int32_t half = ((1 << q) * RSQRT2_Q16 + 0x8000) >> 16;
+    int32_t max = (1 << bits) - 1;
+    unsigned big = 0;
+    unsigned len = QUAT_PACK_LEN(bits);
+    unsigned shift = 2;
+    uint64_t packed;
+
+    for (unsigned n = 1; n < 4; n++) {
+        if (abs(quat[n]) > abs(quat[big])) {
+            big = n;
+        }
+    }
+
+    packed = big;
+    for (unsigned n = 0; n < 4; n++) {
+        if (n == big) {
+            continue;
+        }
+        // Flip the sign of all so the one left out is positive
+        int32_t c = (quat[big] < 0) ? -quat[n] : quat[n];
+        int32_t v = ((c + half) * max + half) / (2 * half);
+        if (v < 0) {
+            v = 0;
+        }
+        else if (v > max) {
+            v = max;
+        }
+        packed |= (uint64_t)v << shift;
+        shift += bits;
+    }
+
+    for (unsigned n = 0; n < len; n++) {
+        out[n] = (uint8_t)(packed >> (8*n));
+    }
+
+    return len;
+}
+
+unsigned quatPack_decode(int16_t quat[4], const uint8_t *in, unsigned q, unsigned bits)
+{
+    int32_t one = 1 << q;
+    int32_t half = (one * RSQRT2_Q16 + 0x8000) >> 16;
+    int32_t max = (1 << bits) - 1;
+    unsigned len = QUAT_PACK_LEN(bits);
+    unsigned shift = 2;
+    uint64_t packed = 0;
+    int32_t rest = one * one;
+    unsigned big;
+
+    for (unsigned n = 0; n < len; n++) {
+        packed |= (uint64_t)in[n] << (8*n);
+    }
+
+    big = packed & 0x3;
+    for (unsigned n = 0; n < 4; n++) {
+        if (n == big) {
+            continue;
+        }
+        int32_t v = (packed >> shift) & max;
+        int32_t c = (v * 2 * half + max/2) / max - half;
+        quat[n] = (int16_t)c;
+        rest -= c * c;
+        shift += bits;
+    }
+    quat[big] = (rest > 0) ? (int16_t)(sqrtf((float)rest) + 0.5f) : 0;
+
+    return len;
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * RAM-lean build profile, pre-included by the sh2-demo-lean configuration
+ * (IAR: C/C++ Compiler > Preprocessor > Preinclude file).
+ *
+ * Each value overrides the #ifndef default of the module that owns it.
+ * Stacks are cut towards what the tasks need, with margin for the
+ * deepest SH-2 library call paths, and the heap only has to hold TCBs,
+ * queues, semaphores and the idle task's stack.  Confirm the unused
+ * figures "mem" reports under a full subscription set, and again after
+ * changing tasks, subscriptions or the SH-2 library.
+ */
+
+#ifndef RAM_LEAN_H
+#define RAM_LEAN_H
+
+// FreeRTOS heap (FreeRTOSConfig.h): task stacks are static
+#define configTOTAL_HEAP_SIZE ((size_t)8192)
+
+// Task stacks [words]
+#define SH2_HAL_SPI_STACK (512)
+#define SH2_HAL_I2C_STACK (256)
+#define SENSOR_TASK_STACK (256)
+#define DEMO_TASK_STACK (256)
+#define SHELL_TASK_STACK (256)
+#define LOG_TASK_STACK (256)
+#define FLASH_LOG_STACK (320)
+
+// HAL buffers
+#define SH2_HAL_TX_QUEUE (2)
+
+// Rings and diagnostics
+#define SENSOR_RING_LEN (32)
+#define DLOG_RING_LEN (32)
+#define TRACE_RING_LEN (32)
+#define CONSOLE_RX_BUFLEN (128)
+#define FLASH_LOG_BUFS (4)
+#define USB_CDC_TX_BUFLEN (512)
+
+// Optional stages and their buffers, kept out whatever their defaults
+#define SHTP_CAPTURE (0)
+#define LATENCY_CMDS (0)
+#define SENSOR_LATEST (0)
+#define SENSOR_NOISE (0)
+#define SENSOR_FFT (0)
+#define SENSOR_BLACKBOX (0)
+#define SPI_BRIDGE (0)
+#define RTOS_TRACE (0)
+#define CPU_LOAD (0)
+#define SENSOR_RESAMPLE (0)
+#define HUB_HEALTH (0)
+
+#endif
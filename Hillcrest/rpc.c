@@ -0,0 +1,377 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Binary control protocol.  See rpc.h.
+ */
+
+#include "rpc.h"
+
+#if RPC
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "cmsis_os.h"
+#include "sh2.h"
+#include "sh2_err.h"
+#include "sensor_app.h"
+#include "sensor_stats.h"
+#include "sensor_output.h"
+#include "frs_cache.h"
+#include "sh2_client.h"
+#include "console.h"
+#include "shell.h"
+#include "crc16.h"
+#include "crc32.h"
+#include "pool.h"
+#include "sysstats.h"
+#include "rtos_static.h"
+#include "priorities.h"
+
+#ifndef RPC_STACK
+#define RPC_STACK (256)
+#endif
+
+// Frame layout: sync, then the header the CRC starts at
+#define SYNC_LEN (2)
+#define REQ_HDR_LEN (4)         // request id, opcode, payload len
+#define RSP_HDR_LEN (5)         // request id, opcode, status, payload len
+
+#define FRS_WORDS (RPC_MAX_PAYLOAD / 4)
+
+// ------------------------------------------------------------------------
+// Private types
+
+typedef struct {
+    uint16_t id;
+    uint8_t op;
+    uint8_t len;
+    uint8_t payload[RPC_MAX_PAYLOAD];
+} RpcRequest_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void rpcFrame(void);
+static bool readBody(const uint8_t *hdr, RpcRequest_t *pReq);
+static void rpcTask(const void *params);
+static unsigned run(const RpcRequest_t *pReq, uint8_t *out, int *pStatus);
+static unsigned frsGet(const RpcRequest_t *pReq, uint8_t *out, int *pStatus);
+static int frsSet(const RpcRequest_t *pReq);
+static void respond(uint8_t *frame, uint16_t id, uint8_t op, int status, unsigned len);
+static void discard(void);
+static uint8_t *putU32(uint8_t *p, uint32_t v);
+static uint32_t getU32(const uint8_t *p);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+RTOS_STACK_DEF(rpcTaskStack, RPC_STACK);
+
+static POOL_STORAGE(reqBlocks, RpcRequest_t, RPC_SLOTS);
+static Pool_t reqPool;
+static QueueHandle_t reqQueue;      // of RpcRequest_t *
+
+static sh2Client_t rpcClient;
+
+// Answers the rpc task sends, and FRS records on their way
+static uint8_t rspFrame[SYNC_LEN + RSP_HDR_LEN + RPC_MAX_PAYLOAD + BIN_CRC_LEN];
+static uint32_t frsWords[FRS_WORDS];
+
+static uint32_t requests;
+static uint32_t badFrames;
+static uint32_t busy;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void rpc_init(void)
+{
+    pool_init(&reqPool, "rpc requests", reqBlocks, sizeof(reqBlocks[0]), RPC_SLOTS);
+    reqQueue = xQueueCreate(RPC_SLOTS, sizeof(RpcRequest_t *));
+    sysstats_addQueue("rpc requests", reqQueue, RPC_SLOTS);
+    sh2Client_open(&rpcClient, "rpc");
+
+    osThreadDef(rpcThreadDef, rpcTask, PRIO_TASK_RPC, 0, RPC_STACK);
+    if (rtos_threadCreate(osThread(rpcThreadDef), NULL, RTOS_STACK(rpcTaskStack)) == NULL) {
+        printf("Failed to create rpc task.\n");
+        return;
+    }
+
+    sysstats_addMemory("rpc buffers", sizeof(rspFrame) + sizeof(frsWords));
+    sysstats_addCounter("rpc requests", &requests);
+    sysstats_addCounter("rpc bad frames", &badFrames);
+    sysstats_addCounter("rpc busy", &busy);
+    shell_setFrameHandler(BIN_SYNC0, rpcFrame);
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+// Read the rest of a request frame, its sync byte already read, and
+// queue it.  Shell task.
+static void rpcFrame(void)
+{
+    static RpcRequest_t spare;
+    uint8_t hdr[1 + REQ_HDR_LEN];
+    uint8_t frame[SYNC_LEN + RSP_HDR_LEN + BIN_CRC_LEN];
+
+    if ((console_readRaw(hdr, sizeof(hdr), RPC_FRAME_MS) != sizeof(hdr)) ||
+        (hdr[0] != RPC_REQ_SYNC1) || (hdr[4] > RPC_MAX_PAYLOAD)) {
+        discard();
+        return;
+    }
+
+    // Read into a slot if there is one, so the frame is always consumed
+    RpcRequest_t *pReq = pool_get(&reqPool);
+    RpcRequest_t *pInto = (pReq != 0) ? pReq : &spare;
+
+    if (!readBody(&hdr[1], pInto)) {
+        if (pReq != 0) {
+            pool_put(&reqPool, pReq);
+        }
+        discard();
+        return;
+    }
+
+    requests++;
+    if (pReq == 0) {
+        busy++;
+        respond(frame, pInto->id, pInto->op, SH2_ERR_OP_IN_PROGRESS, 0);
+        return;
+    }
+
+    if (pReq->op == RPC_OP_DFU) {
+        // Run here: nothing else may read the console meanwhile.  Only
+        // returns if the update couldn't start.
+        uint16_t id = pReq->id;
+        pool_put(&reqPool, pReq);
+        respond(frame, id, RPC_OP_DFU, SH2_OK, 0);
+        respond(frame, id, RPC_OP_DFU, sensorApp_dfuConsole(), 0);
+        return;
+    }
+
+    // One queue entry per slot, so there is always room
+    xQueueSend(reqQueue, &pReq, 0);
+}
+
+// Fill in *pReq from the header at hdr (after the sync bytes), and read
+// its payload and CRC.  Returns false if they don't come or don't match.
+static bool readBody(const uint8_t *hdr, RpcRequest_t *pReq)
+{
+    uint8_t crc[BIN_CRC_LEN];
+
+    pReq->id = hdr[0] | (hdr[1] << 8);
+    pReq->op = hdr[2];
+    pReq->len = hdr[3];
+    if ((console_readRaw(pReq->payload, pReq->len, RPC_FRAME_MS) != pReq->len) ||
+        (console_readRaw(crc, sizeof(crc), RPC_FRAME_MS) != sizeof(crc))) {
+        return false;
+    }
+
+#if BIN_CRC32
+    uint32_t expect = crc32_sw(CRC32_INIT, hdr, REQ_HDR_LEN);
+    expect = crc32_sw(expect, pReq->payload, pReq->len);
+    return getU32(crc) == expect;
+#else
+    uint16_t expect = crc16(CRC16_INIT, hdr, REQ_HDR_LEN);
+    expect = crc16(expect, pReq->payload, pReq->len);
+    return (crc[0] | (crc[1] << 8)) == expect;
+#endif
+}
+
+static void rpcTask(const void *params)
+{
+    RpcRequest_t *pReq;
+    int status;
+
+    while (1) {
+        xQueueReceive(reqQueue, &pReq, portMAX_DELAY);
+
+        unsigned len = run(pReq, &rspFrame[SYNC_LEN + RSP_HDR_LEN], &status);
+        respond(rspFrame, pReq->id, pReq->op, status, len);
+        pool_put(&reqPool, pReq);
+    }
+}
+
+// Carry out *pReq, with its answer's payload at out.  Returns the
+// payload length.
+static unsigned run(const RpcRequest_t *pReq, uint8_t *out, int *pStatus)
+{
+    const uint8_t *in = pReq->payload;
+    uint8_t *p = out;
+    SensorStatsSummary_t sum;
+    uint32_t reports, drain_us;
+    char name[16];
+
+    *pStatus = SH2_OK;
+
+    switch (pReq->op) {
+        case RPC_OP_PING:
+            memcpy(out, in, pReq->len);
+            return pReq->len;
+
+        case RPC_OP_SUBSCRIBE:
+            if ((pReq->len == 0) || (pReq->len % 5 != 0)) {
+                break;
+            }
+            for (unsigned n = 0; n < pReq->len; n += 5) {
+                *p++ = (uint8_t)sensorApp_subscribe(in[n], getU32(&in[n + 1]));
+            }
+            return p - out;
+
+        case RPC_OP_PROFILE:
+            if ((pReq->len == 0) || (pReq->len >= sizeof(name))) {
+                break;
+            }
+            memcpy(name, in, pReq->len);
+            name[pReq->len] = 0;
+            *pStatus = sensorApp_profile(name);
+            return 0;
+
+        case RPC_OP_STATS:
+            if ((pReq->len != 1) || !sensorStats_get((sh2_SensorId_t)in[0], &sum)) {
+                break;
+            }
+            p = putU32(p, sum.interval_us);
+            p = putU32(p, sum.received);
+            p = putU32(p, sum.gaps);
+            p = putU32(p, sum.lost);
+            p = putU32(p, (uint32_t)(sum.rate_Hz * 1000.0f + 0.5f));
+            p = putU32(p, sum.minDelta);
+            p = putU32(p, sum.maxDelta);
+            p = putU32(p, sum.jitter_us);
+            return p - out;
+
+        case RPC_OP_FRS_GET:
+            return frsGet(pReq, out, pStatus);
+
+        case RPC_OP_FRS_SET:
+            *pStatus = frsSet(pReq);
+            return 0;
+
+        case RPC_OP_FLUSH:
+            *pStatus = sensorApp_flush(&reports, &drain_us);
+            p = putU32(p, reports);
+            p = putU32(p, drain_us);
+            return p - out;
+
+        default:
+            break;
+    }
+
+    *pStatus = SH2_ERR_BAD_PARAM;
+    return 0;
+}
+
+static unsigned frsGet(const RpcRequest_t *pReq, uint8_t *out, int *pStatus)
+{
+    uint16_t words = FRS_WORDS;
+
+    if (pReq->len != 2) {
+        *pStatus = SH2_ERR_BAD_PARAM;
+        return 0;
+    }
+
+    sh2Client_begin(&rpcClient);
+    *pStatus = sh2_getFrs(pReq->payload[0] | (pReq->payload[1] << 8), frsWords, &words);
+    sh2Client_end(&rpcClient);
+    if (*pStatus != SH2_OK) {
+        return 0;
+    }
+
+    for (unsigned n = 0; n < words; n++) {
+        out = putU32(out, frsWords[n]);
+    }
+    return words * 4;
+}
+
+static int frsSet(const RpcRequest_t *pReq)
+{
+    if ((pReq->len < 2) || ((pReq->len - 2) % 4 != 0)) {
+        return SH2_ERR_BAD_PARAM;
+    }
+
+    uint16_t frsId = pReq->payload[0] | (pReq->payload[1] << 8);
+    uint16_t words = (pReq->len - 2) / 4;
+    for (unsigned n = 0; n < words; n++) {
+        frsWords[n] = getU32(&pReq->payload[2 + 4*n]);
+    }
+
+    sh2Client_begin(&rpcClient);
+    int status = sh2_setFrs(frsId, frsWords, words);
+    frsCache_invalidate(frsId);
+    sh2Client_end(&rpcClient);
+
+    return status;
+}
+
+// Frame an answer, its len byte payload already in place after the
+// header, and send it
+static void respond(uint8_t *frame, uint16_t id, uint8_t op, int status, unsigned len)
+{
+    uint8_t *p = frame;
+
+    *p++ = BIN_SYNC0;
+    *p++ = RPC_RSP_SYNC1;
+    *p++ = (uint8_t)id;
+    *p++ = (uint8_t)(id >> 8);
+    *p++ = op;
+    *p++ = (uint8_t)(int8_t)status;
+    *p++ = (uint8_t)len;
+    p += len;
+
+#if BIN_CRC32
+    p = putU32(p, crc32(&frame[SYNC_LEN], RSP_HDR_LEN + len));
+#else
+    uint16_t crc = crc16(CRC16_INIT, &frame[SYNC_LEN], RSP_HDR_LEN + len);
+    *p++ = (uint8_t)(crc & 0xFF);
+    *p++ = (uint8_t)(crc >> 8);
+#endif
+
+    console_writeRaw(frame, p - frame);
+}
+
+// Drop input until the link goes quiet, to find the next frame or line
+static void discard(void)
+{
+    uint8_t junk[16];
+
+    badFrames++;
+    while (console_readRaw(junk, sizeof(junk), RPC_FRAME_MS) != 0) {
+    }
+}
+
+static uint8_t *putU32(uint8_t *p, uint32_t v)
+{
+    *p++ = (uint8_t)v;
+    *p++ = (uint8_t)(v >> 8);
+    *p++ = (uint8_t)(v >> 16);
+    *p++ = (uint8_t)(v >> 24);
+    return p;
+}
+
+static uint32_t getU32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+#endif
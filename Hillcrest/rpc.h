@@ -0,0 +1,106 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Binary control protocol for test rigs, on the console link alongside
+ * the binary sensor output (tools/rpc.py is a host side).
+ *
+ * Request, host to board:
+ *   sync (BIN_SYNC0 0x5D), request id (16-bit LE), opcode, payload len,
+ *   payload, CRC (LE) over request id to payload.
+ * Response, board to host:
+ *   sync (BIN_SYNC0 0x5E), request id, opcode, status, payload len,
+ *   payload, CRC over request id to payload.
+ * The CRC is the one the data frames carry (BIN_CRC32, sensor_output.h);
+ * status is an SH-2 status (sh2_err.h) as a signed byte.
+ *
+ * A request must start a line, and may follow shell commands or other
+ * requests at once.  The shell task checks it and queues it; the rpc
+ * task runs queued requests in order and answers each once done, on the
+ * bulk channel between data frames, so a host can keep RPC_SLOTS
+ * requests in flight and match answers by request id.  A request that
+ * finds every slot taken is answered SH2_ERR_OP_IN_PROGRESS at once.  A
+ * damaged one isn't answered: input is dropped until the link has been
+ * quiet for RPC_FRAME_MS, and the host times the request out.
+ *
+ * Opcodes, with their payloads in and out (fields LE):
+ *   PING       anything; the same bytes
+ *   SUBSCRIBE  (sensor id, interval us 32-bit) per sensor, interval 0
+ *              to disable; a sensorApp_subscribe() result byte each
+ *   PROFILE    profile name; none
+ *   STATS      sensor id; interval us, received, gaps, lost, rate mHz,
+ *              min and max inter-arrival us, jitter us (32-bit each)
+ *   FRS_GET    record id (16-bit); the record's 32-bit words
+ *   FRS_SET    record id, 32-bit words (none erases it); none
+ *   FLUSH      none; reports drained, drain time us (32-bit each)
+ *   DFU        none; none, then the hub is updated from tools/fwsend.py
+ *              as "dfu" does, and the board restarts.  Should the update
+ *              not start, a second answer carries the error.
+ */
+
+#ifndef RPC_H
+#define RPC_H
+
+#include <stdint.h>
+
+// Set to 0 to leave the protocol out.
+#ifndef RPC
+#define RPC (1)
+#endif
+
+// Requests in flight at once
+#ifndef RPC_SLOTS
+#define RPC_SLOTS (4)
+#endif
+
+// Longest payload, either way [bytes, at most 255]
+#ifndef RPC_MAX_PAYLOAD
+#define RPC_MAX_PAYLOAD (128)
+#endif
+
+// Longest gap within a request frame [ms]
+#ifndef RPC_FRAME_MS
+#define RPC_FRAME_MS (50)
+#endif
+
+#define RPC_REQ_SYNC1 (0x5D)
+#define RPC_RSP_SYNC1 (0x5E)
+
+typedef enum {
+    RPC_OP_PING = 0x01,
+    RPC_OP_SUBSCRIBE = 0x02,
+    RPC_OP_PROFILE = 0x03,
+    RPC_OP_STATS = 0x04,
+    RPC_OP_FRS_GET = 0x05,
+    RPC_OP_FRS_SET = 0x06,
+    RPC_OP_FLUSH = 0x07,
+    RPC_OP_DFU = 0x08,
+} RpcOp_t;
+
+#if RPC
+
+// Start the rpc task and take request frames from the shell.  Call from
+// the demo task, after sh2Client_init().
+void rpc_init(void);
+
+#else
+
+#define rpc_init()
+
+#endif
+
+#endif
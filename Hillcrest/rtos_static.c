@@ -0,0 +1,46 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Task creation with statically allocated stacks.
+ */
+
+#include "rtos_static.h"
+
+#include "task.h"
+#include "sysstats.h"
+
+// ------------------------------------------------------------------------
+// Public API
+
+osThreadId rtos_threadCreate(const osThreadDef_t *thread_def, void *argument,
+                             StackType_t *stack)
+{
+    TaskHandle_t handle;
+
+    // Same priority mapping as osThreadCreate()
+    if (xTaskGenericCreate((TaskFunction_t)thread_def->pthread,
+                           (const portCHAR *)thread_def->name,
+                           thread_def->stacksize, argument,
+                           tskIDLE_PRIORITY + (thread_def->tpriority - osPriorityIdle),
+                           &handle, stack, NULL) != pdPASS) {
+        return NULL;
+    }
+    sysstats_addStack(thread_def->name, handle, thread_def->stacksize, stack != NULL);
+
+    return handle;
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Task creation with statically allocated stacks.
+ *
+ * FreeRTOS 8.2 can place a task's stack in caller-supplied storage (the
+ * TCB always comes from the heap); queues and semaphores have no static
+ * form until FreeRTOS 9.  Stacks are by far the largest allocations, so
+ * with RTOS_STATIC_STACKS set they live in .bss, sized at link time.
+ */
+
+#ifndef RTOS_STATIC_H
+#define RTOS_STATIC_H
+
+#include "FreeRTOS.h"
+#include "cmsis_os.h"
+
+// Set to 0 to take task stacks from the FreeRTOS heap instead.
+#ifndef RTOS_STATIC_STACKS
+#define RTOS_STATIC_STACKS (1)
+#endif
+
+// Define stack storage of words StackType_t for a task, and refer to it.
+#if RTOS_STATIC_STACKS
+#define RTOS_STACK_DEF(name, words) static StackType_t name[words]
+#define RTOS_STACK(name) (name)
+#else
+#define RTOS_STACK_DEF(name, words) extern int name##Unused
+#define RTOS_STACK(name) ((StackType_t *)0)
+#endif
+
+// Like osThreadCreate() but with the given stack, which must hold
+// thread_def->stacksize words.  A null stack is taken from the heap.
+osThreadId rtos_threadCreate(const osThreadDef_t *thread_def, void *argument,
+                             StackType_t *stack);
+
+#endif
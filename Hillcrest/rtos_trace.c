@@ -0,0 +1,149 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Kernel trace
+ */
+
+#include "rtos_trace.h"
+
+#if RTOS_TRACE
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "stm32f4xx_hal.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "shell.h"
+#include "sysstats.h"
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void ktraceCmd(int argc, char *argv[]);
+static void start(bool once);
+static void dump(void);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static RtosTraceRec_t ring[RTOS_TRACE_LEN];
+static volatile uint32_t ringIn;      // runs freely, masked on access
+static volatile uint32_t ringLimit;   // ringIn to stop at, 0 to wrap
+static volatile bool running = true;  // from reset, to catch startup
+
+static TaskStatus_t taskStatus[SYSSTATS_MAX_TASKS];
+
+// ------------------------------------------------------------------------
+// Public API
+
+void rtosTrace_init(void)
+{
+    sysstats_addMemory("kernel trace", sizeof(ring) + sizeof(taskStatus));
+    shell_addCommand("ktrace", "[wrap | once | stop | dump] kernel trace", ktraceCmd);
+}
+
+void rtosTrace_record(uint32_t event, uint32_t arg)
+{
+    // Stamped under the lock too, so records are in time order even
+    // when an ISR cuts in between two of the kernel's
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (running) {
+        RtosTraceRec_t *r = &ring[ringIn & (RTOS_TRACE_LEN - 1)];
+        r->cycles = DWT->CYCCNT;
+        r->word = (event << 24) | (arg & 0xFFFFFF);
+        if (++ringIn == ringLimit) {
+            running = false;
+        }
+    }
+    __set_PRIMASK(primask);
+}
+
+void rtosTrace_isr(uint32_t event)
+{
+    rtosTrace_record(event, (__get_IPSR() & 0x1FF) - 16);
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static void start(bool once)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    ringIn = 0;
+    ringLimit = once ? RTOS_TRACE_LEN : 0;
+    running = true;
+    __set_PRIMASK(primask);
+}
+
+// The task table, then the records oldest first, as tools/ktrace.py
+// expects them
+static void dump(void)
+{
+    // Stop, so the dump doesn't trace the console's own traffic
+    bool wasRunning = running;
+    running = false;
+
+    uint32_t in = ringIn;
+    uint32_t count = (in < RTOS_TRACE_LEN) ? in : RTOS_TRACE_LEN;
+    UBaseType_t tasks = uxTaskGetSystemState(taskStatus, SYSSTATS_MAX_TASKS, 0);
+
+    printf("ktrace begin %u %u\n", (unsigned)HAL_RCC_GetHCLKFreq(), (unsigned)count);
+    for (UBaseType_t n = 0; n < tasks; n++) {
+        printf("task %u %u %s\n", (unsigned)taskStatus[n].xTaskNumber,
+               (unsigned)taskStatus[n].uxBasePriority, taskStatus[n].pcTaskName);
+    }
+    for (uint32_t n = in - count; n != in; n++) {
+        const RtosTraceRec_t *r = &ring[n & (RTOS_TRACE_LEN - 1)];
+        printf("%08x %08x\n", (unsigned)r->cycles, (unsigned)r->word);
+    }
+    printf("ktrace end\n");
+
+    // A one-shot capture stays stopped once full
+    running = wasRunning;
+}
+
+static void ktraceCmd(int argc, char *argv[])
+{
+    if (argc == 1) {
+        uint32_t in = ringIn;
+        printf("Kernel trace %s%s: %u records, %u kept.\n",
+               running ? "running" : "stopped",
+               ringLimit ? ", once" : ", wrap",
+               (unsigned)in, (unsigned)((in < RTOS_TRACE_LEN) ? in : RTOS_TRACE_LEN));
+    }
+    else if (strcmp(argv[1], "wrap") == 0) {
+        start(false);
+    }
+    else if (strcmp(argv[1], "once") == 0) {
+        start(true);
+    }
+    else if (strcmp(argv[1], "stop") == 0) {
+        running = false;
+    }
+    else if (strcmp(argv[1], "dump") == 0) {
+        dump();
+    }
+    else {
+        printf("usage: %s [wrap | once | stop | dump]\n", argv[0]);
+    }
+}
+
+#endif
@@ -0,0 +1,117 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Kernel trace: task switches, tasks made ready, queue and semaphore
+ * traffic and interrupt entry/exit, as (cycle count, event) records in
+ * a RAM ring.  The FreeRTOS trace macros are defined here, and this
+ * header is included by FreeRTOSConfig.h, so it must not include any
+ * FreeRTOS headers itself.
+ *
+ * "ktrace dump" prints the ring with the task names, and
+ * tools/ktrace.py turns a console capture of that into Chrome trace
+ * JSON for chrome://tracing or ui.perfetto.dev.
+ */
+
+#ifndef RTOS_TRACE_H
+#define RTOS_TRACE_H
+
+#include <stdint.h>
+
+// Set to 1 to build in the kernel hooks and their ring (8KB at the
+// default RTOS_TRACE_LEN).
+#ifndef RTOS_TRACE
+#define RTOS_TRACE (0)
+#endif
+
+// Records kept (power of 2), 8 bytes each
+#ifndef RTOS_TRACE_LEN
+#define RTOS_TRACE_LEN (1024)
+#endif
+
+// Event ids, in the top byte of each record's word.  The dump format
+// and tools/ktrace.py depend on these values.
+typedef enum {
+    RTOS_TRACE_NONE = 0,
+    RTOS_TRACE_SWITCH_IN = 1,      // arg: task number
+    RTOS_TRACE_SWITCH_OUT = 2,     // arg: task number
+    RTOS_TRACE_READY = 3,          // arg: task number
+    RTOS_TRACE_ISR_ENTER = 4,      // arg: IRQ number
+    RTOS_TRACE_ISR_EXIT = 5,       // arg: IRQ number
+    RTOS_TRACE_QUEUE_SEND = 6,     // arg: queue address, low 24 bits
+    RTOS_TRACE_QUEUE_RECEIVE = 7,
+    RTOS_TRACE_QUEUE_SEND_ISR = 8,
+    RTOS_TRACE_QUEUE_RECEIVE_ISR = 9,
+    RTOS_TRACE_QUEUE_BLOCK_SEND = 10,
+    RTOS_TRACE_QUEUE_BLOCK_RECEIVE = 11,
+    RTOS_TRACE_PRIO_INHERIT = 12,  // arg: priority << 16 | holder's task number
+} RtosTraceEvent_t;
+
+typedef struct {
+    uint32_t cycles;    // DWT cycle count
+    uint32_t word;      // event << 24 | arg
+} RtosTraceRec_t;
+
+#if RTOS_TRACE
+
+// Register the ktrace command.
+void rtosTrace_init(void);
+
+// Use the trace macros rather than calling these.
+void rtosTrace_record(uint32_t event, uint32_t arg);
+void rtosTrace_isr(uint32_t event);
+
+// Kernel hooks.  Task numbers are the TCB numbers uxTaskGetSystemState()
+// reports as xTaskNumber; pxCurrentTCB is only visible in tasks.c, which
+// is the only file that expands the task hooks.
+#define traceTASK_SWITCHED_IN() \
+    rtosTrace_record(RTOS_TRACE_SWITCH_IN, pxCurrentTCB->uxTCBNumber)
+#define traceTASK_SWITCHED_OUT() \
+    rtosTrace_record(RTOS_TRACE_SWITCH_OUT, pxCurrentTCB->uxTCBNumber)
+#define traceMOVED_TASK_TO_READY_STATE(pxTCB) \
+    rtosTrace_record(RTOS_TRACE_READY, (pxTCB)->uxTCBNumber)
+#define traceTASK_PRIORITY_INHERIT(pxTCBOfMutexHolder, uxInheritedPriority) \
+    rtosTrace_record(RTOS_TRACE_PRIO_INHERIT, \
+                     ((uxInheritedPriority) << 16) | (pxTCBOfMutexHolder)->uxTCBNumber)
+
+#define traceQUEUE_SEND(pxQueue) \
+    rtosTrace_record(RTOS_TRACE_QUEUE_SEND, (uint32_t)(pxQueue))
+#define traceQUEUE_RECEIVE(pxQueue) \
+    rtosTrace_record(RTOS_TRACE_QUEUE_RECEIVE, (uint32_t)(pxQueue))
+#define traceQUEUE_SEND_FROM_ISR(pxQueue) \
+    rtosTrace_record(RTOS_TRACE_QUEUE_SEND_ISR, (uint32_t)(pxQueue))
+#define traceQUEUE_RECEIVE_FROM_ISR(pxQueue) \
+    rtosTrace_record(RTOS_TRACE_QUEUE_RECEIVE_ISR, (uint32_t)(pxQueue))
+#define traceBLOCKING_ON_QUEUE_SEND(pxQueue) \
+    rtosTrace_record(RTOS_TRACE_QUEUE_BLOCK_SEND, (uint32_t)(pxQueue))
+#define traceBLOCKING_ON_QUEUE_RECEIVE(pxQueue) \
+    rtosTrace_record(RTOS_TRACE_QUEUE_BLOCK_RECEIVE, (uint32_t)(pxQueue))
+
+// FreeRTOS 8.2 has no interrupt hooks, so the handlers in
+// stm32f4xx_it.c call these (named as in later kernels) themselves.
+#define traceISR_ENTER() rtosTrace_isr(RTOS_TRACE_ISR_ENTER)
+#define traceISR_EXIT() rtosTrace_isr(RTOS_TRACE_ISR_EXIT)
+
+#else
+
+#define rtosTrace_init()
+#define traceISR_ENTER()
+#define traceISR_EXIT()
+
+#endif
+
+#endif
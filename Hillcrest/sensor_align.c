@@ -0,0 +1,273 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Time alignment of several sensors into one frame.
+ */
+
+#include "sensor_align.h"
+
+#include <stdbool.h>
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "sh2_err.h"
+#include "quat.h"
+#include "sysstats.h"
+
+#define HIST_MASK (SENSOR_ALIGN_HISTORY-1)
+
+// ------------------------------------------------------------------------
+// Private types
+
+// Latest samples of one sensor; head runs freely
+typedef struct {
+    SensorFix_t fix[SENSOR_ALIGN_HISTORY];
+    uint32_t head;
+} History_t;
+
+typedef struct {
+    uint8_t sensorId[SENSOR_ALIGN_SENSORS];
+    unsigned count;
+    SensorAlignFn_t *fn;
+    void *cookie;
+
+    History_t hist[SENSOR_ALIGN_SENSORS];
+    uint32_t refNext;           // next reference sample to deliver
+    SensorAlignFrame_t frame;
+} Align_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void alignEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix);
+static void deliver(Align_t *a);
+static bool sampleAt(SensorFix_t *out, const History_t *h, uint64_t t_uS);
+static void interpolate(SensorFix_t *out, const SensorFix_t *a, const SensorFix_t *b, uint64_t t_uS);
+static int16_t lerp(int16_t a, int16_t b, float w);
+static int16_t toQuat(float v);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+// Each aligner is only touched by the sensor task once it has been
+// subscribed; numAligns is claimed in a critical section.
+static Align_t aligns[SENSOR_ALIGN_MAX];
+static unsigned numAligns;
+static uint32_t dropped;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void sensorAlign_init(void)
+{
+    sysstats_addMemory("aligners", sizeof(aligns));
+    sysstats_addCounter("align dropped", &dropped);
+}
+
+int sensorAlign_subscribe(const uint8_t *sensorIds, unsigned count, int prio,
+                          SensorAlignFn_t *fn, void *cookie)
+{
+    Align_t *a = 0;
+    int status = SH2_OK;
+
+    if ((count < 2) || (count > SENSOR_ALIGN_SENSORS) || (fn == 0)) {
+        return SH2_ERR_BAD_PARAM;
+    }
+    for (unsigned n = 0; n < count; n++) {
+        if ((sensorIds[n] == SENSOR_DISPATCH_ALL) || (sensorIds[n] > SH2_MAX_SENSOR_ID)) {
+            return SH2_ERR_BAD_PARAM;
+        }
+        for (unsigned m = 0; m < n; m++) {
+            if (sensorIds[m] == sensorIds[n]) {
+                return SH2_ERR_BAD_PARAM;
+            }
+        }
+    }
+
+    taskENTER_CRITICAL();
+    if (numAligns < SENSOR_ALIGN_MAX) {
+        a = &aligns[numAligns++];
+    }
+    taskEXIT_CRITICAL();
+
+    if (a == 0) {
+        return SH2_ERR;
+    }
+
+    memset(a, 0, sizeof(*a));
+    memcpy(a->sensorId, sensorIds, count);
+    a->count = count;
+    a->fn = fn;
+    a->cookie = cookie;
+
+    for (unsigned n = 0; (n < count) && (status == SH2_OK); n++) {
+        status = sensorDispatch_subscribe(sensorIds[n], prio, alignEvent, a);
+    }
+
+    return status;
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+// Dispatch callback, in the sensor task
+static void alignEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix)
+{
+    Align_t *a = (Align_t *)cookie;
+    unsigned n = 0;
+
+    if (pFix == 0) {
+        return;
+    }
+
+    while ((n < a->count) && (a->sensorId[n] != pFix->sensorId)) {
+        n++;
+    }
+    if (n == a->count) {
+        return;
+    }
+
+    History_t *h = &a->hist[n];
+    h->fix[h->head & HIST_MASK] = *pFix;
+    h->head++;
+
+    if ((n == 0) && (h->head - a->refNext > SENSOR_ALIGN_HISTORY)) {
+        // The oldest waiting reference sample was just overwritten
+        a->refNext = h->head - SENSOR_ALIGN_HISTORY;
+        dropped++;
+    }
+
+    deliver(a);
+}
+
+// Deliver a frame for each waiting reference sample every sensor has
+// reported past.
+static void deliver(Align_t *a)
+{
+    const History_t *ref = &a->hist[0];
+
+    while (a->refNext != ref->head) {
+        const SensorFix_t *r = &ref->fix[a->refNext & HIST_MASK];
+        SensorAlignFrame_t *f = &a->frame;
+
+        for (unsigned n = 1; n < a->count; n++) {
+            if (!sampleAt(&f->fix[n], &a->hist[n], r->timestamp_uS)) {
+                // Wait for this sensor
+                return;
+            }
+        }
+
+        f->timestamp_uS = r->timestamp_uS;
+        f->count = a->count;
+        f->fix[0] = *r;
+        a->refNext++;
+
+        a->fn(a->cookie, f);
+    }
+}
+
+// The value of the sensor in h at t_uS, from the samples either side.
+// False if it has not reported at or after t_uS yet.
+static bool sampleAt(SensorFix_t *out, const History_t *h, uint64_t t_uS)
+{
+    uint32_t kept = (h->head < SENSOR_ALIGN_HISTORY) ? h->head : SENSOR_ALIGN_HISTORY;
+    uint32_t i = h->head;
+
+    if ((kept == 0) || (h->fix[(i - 1) & HIST_MASK].timestamp_uS < t_uS)) {
+        return false;
+    }
+
+    // Oldest sample at or after t_uS
+    while ((kept > 1) && (h->fix[(i - 2) & HIST_MASK].timestamp_uS >= t_uS)) {
+        i--;
+        kept--;
+    }
+
+    const SensorFix_t *after = &h->fix[(i - 1) & HIST_MASK];
+    if (kept == 1) {
+        // Nothing kept before t_uS
+        *out = *after;
+        out->timestamp_uS = t_uS;
+        return true;
+    }
+
+    interpolate(out, &h->fix[(i - 2) & HIST_MASK], after, t_uS);
+    return true;
+}
+
+// out = the sample at t_uS between a and b (a before, b at or after)
+static void interpolate(SensorFix_t *out, const SensorFix_t *a, const SensorFix_t *b, uint64_t t_uS)
+{
+    uint64_t span = b->timestamp_uS - a->timestamp_uS;
+    float w;
+
+    if ((span == 0) || (span > SENSOR_ALIGN_MAX_GAP_US)) {
+        // Too far apart to say anything about between them
+        *out = (t_uS - a->timestamp_uS < b->timestamp_uS - t_uS) ? *a : *b;
+        out->timestamp_uS = t_uS;
+        return;
+    }
+    w = (float)(t_uS - a->timestamp_uS) / (float)span;
+
+    *out = (w < 0.5f) ? *a : *b;
+    out->timestamp_uS = t_uS;
+
+    if ((a->kind == SENSORFIX_QUAT) || (a->kind == SENSORFIX_GIRV)) {
+        Quat_t q = quat_slerp(quat_fromFix(a), quat_fromFix(b), w);
+
+        if (a->kind == SENSORFIX_QUAT) {
+            out->un.quat.real = toQuat(q.w);
+            out->un.quat.i = toQuat(q.x);
+            out->un.quat.j = toQuat(q.y);
+            out->un.quat.k = toQuat(q.z);
+            out->un.quat.accuracy = lerp(a->un.quat.accuracy, b->un.quat.accuracy, w);
+        }
+        else {
+            out->un.girv.real = toQuat(q.w);
+            out->un.girv.i = toQuat(q.x);
+            out->un.girv.j = toQuat(q.y);
+            out->un.girv.k = toQuat(q.z);
+            out->un.girv.angVelX = lerp(a->un.girv.angVelX, b->un.girv.angVelX, w);
+            out->un.girv.angVelY = lerp(a->un.girv.angVelY, b->un.girv.angVelY, w);
+            out->un.girv.angVelZ = lerp(a->un.girv.angVelZ, b->un.girv.angVelZ, w);
+        }
+    }
+    else {
+        out->un.vec3.x = lerp(a->un.vec3.x, b->un.vec3.x, w);
+        out->un.vec3.y = lerp(a->un.vec3.y, b->un.vec3.y, w);
+        out->un.vec3.z = lerp(a->un.vec3.z, b->un.vec3.z, w);
+    }
+}
+
+// a + w*(b - a), rounded.  w is 0..1, so no saturation is needed.
+static int16_t lerp(int16_t a, int16_t b, float w)
+{
+    float f = (float)a + w * (float)(b - a);
+
+    f += (f >= 0.0f) ? 0.5f : -0.5f;
+    return (int16_t)f;
+}
+
+// Unit quaternion component to SENSORFIX_Q_QUAT, rounded
+static int16_t toQuat(float v)
+{
+    float f = v * (float)(1 << SENSORFIX_Q_QUAT);
+
+    f += (f >= 0.0f) ? 0.5f : -0.5f;
+    return (int16_t)f;
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Time alignment of several sensors into one frame.
+ *
+ * An aligner takes a set of sensor ids, the first of which sets the
+ * pace.  For every sample of that reference sensor it delivers one
+ * frame: the reference sample as is, and each other sensor's value at
+ * the reference timestamp, interpolated between its samples either side
+ * (linearly, and by slerp for orientations).  Sequence and status come
+ * from the nearer of the two samples.
+ *
+ * A frame is delivered once every other sensor has reported past its
+ * timestamp, so it lags the reference by up to one of their intervals.
+ * A sensor with no sample before the timestamp (just enabled) or whose
+ * samples either side are more than SENSOR_ALIGN_MAX_GAP_US apart gives
+ * its nearest sample instead.  Reference samples waiting on a sensor
+ * that stopped are dropped, oldest first ("align dropped" in stats).
+ * Reports without a fixed-point decoding are ignored.
+ *
+ * Events should come in timestamp order per sensor, as the hub sends
+ * them; see sensor_merge.h for ordering across sensors.
+ */
+
+#ifndef SENSOR_ALIGN_H
+#define SENSOR_ALIGN_H
+
+#include <stdint.h>
+#include "sensor_dispatch.h"
+
+// Number of aligners
+#ifndef SENSOR_ALIGN_MAX
+#define SENSOR_ALIGN_MAX (2)
+#endif
+
+// Sensors per aligner.  Each takes a dispatch subscriber slot.
+#ifndef SENSOR_ALIGN_SENSORS
+#define SENSOR_ALIGN_SENSORS (3)
+#endif
+
+// Samples kept per sensor (power of 2): how far the reference may get
+// ahead of the slowest sensor before its samples are dropped
+#ifndef SENSOR_ALIGN_HISTORY
+#define SENSOR_ALIGN_HISTORY (4)
+#endif
+
+// Widest gap to interpolate across [us]
+#ifndef SENSOR_ALIGN_MAX_GAP_US
+#define SENSOR_ALIGN_MAX_GAP_US (100000)
+#endif
+
+// One aligned frame: fix[n] is sensor n of the subscription, all
+// stamped with timestamp_uS.
+typedef struct {
+    uint64_t timestamp_uS;
+    unsigned count;
+    SensorFix_t fix[SENSOR_ALIGN_SENSORS];
+} SensorAlignFrame_t;
+
+// Called in the sensor task.  pFrame is only valid during the call.
+// Must not block.
+typedef void (SensorAlignFn_t)(void *cookie, const SensorAlignFrame_t *pFrame);
+
+// Register the aligners' memory and counters.
+void sensorAlign_init(void);
+
+// Call fn with one aligned frame per sample of sensorIds[0], holding
+// all count sensors (2..SENSOR_ALIGN_SENSORS, each a single sensor id).
+// prio orders the aligner among the dispatch subscribers, as for
+// sensorDispatch_subscribe().
+// Returns SH2_OK, SH2_ERR_BAD_PARAM, or SH2_ERR if no aligner (or
+// dispatch slot) is free.
+int sensorAlign_subscribe(const uint8_t *sensorIds, unsigned count, int prio,
+                          SensorAlignFn_t *fn, void *cookie);
+
+#endif
@@ -22,96 +22,757 @@
 
 // Sensor Application
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "FreeRTOS.h"
 #include "task.h"
 #include "semphr.h"
+#include "queue.h"
+#include "stm32f4xx.h"
+#include "cmsis_os.h"
 
 #include "sensor_app.h"
+#include "shell.h"
+#include "console.h"
+#include "usb_cdc.h"
+#include "latency.h"
+#include "cycle_budget.h"
+#include "sensor_stats.h"
+#include "sensor_noise.h"
+#include "sensor_fft.h"
+#include "sensor_blackbox.h"
+#include "sensor_camsync.h"
+#include "sensor_strobe.h"
+#include "sensor_resample.h"
+#include "sensor_tick.h"
+#include "sensor_ekf.h"
+#include "hsi_trim.h"
+#include "board_sync.h"
+#include "spi_bridge.h"
+#include "sensor_sweep.h"
+#include "sensor_fix.h"
+#include "girv_predict.h"
+#include "girv_fast.h"
+#include "sensor_latest.h"
+#include "sensor_watch.h"
+#include "sensor_dispatch.h"
+#include "sensor_decim.h"
+#include "sensor_merge.h"
+#include "sensor_align.h"
+#include "sensor_batch.h"
+#include "sensor_rate.h"
+#include "sensor_tune.h"
+#include "sensor_cal.h"
+#include "config_profile.h"
+#include "config_policy.h"
+#include "sensor_output.h"
+#include "sensor_budget.h"
+#include "sensor_meta.h"
+#include "rpc.h"
+#include "telemetry.h"
+#include "warm_boot.h"
+#include "config_store.h"
+#include "hub_clock.h"
+#include "hub_events.h"
+#include "frs_cache.h"
+#include "sh2_client.h"
+#include "spsc.h"
+#include "sensor_sample.h"
+#include "pool.h"
+#include "boot_prof.h"
+#include "wcet.h"
+#include "hub_health.h"
+#include "priorities.h"
+#include "rtos_static.h"
+#include "timebase.h"
+#include "sysstats.h"
+#include "clock.h"
+#include "power.h"
+#include "coredump.h"
+#include "art_bench.h"
 #include "sh2.h"
 #include "shtp.h"
 #include "sh2_hal.h"
+#include "sh2_hal_health.h"
 #include "sh2_err.h"
-#include "sh2_SensorValue.h"
 
-// Define this to produce DSF data for logging
-// #define DSF_OUTPUT
+// Get reports going sooner after a hub reset: the subscriptions go out
+// first, back to back with their read-backs left for later, then the
+// hub is configured, the granted intervals read back and, at power-up,
+// the product ids reported, while samples are already flowing.  The
+// SH-2 library has one command in flight at a time, so moving commands
+// off the way to the first sample is as far as they overlap.  (A GIRV
+// configuration that had to be written to FRS then applies from the
+// next time GIRV is enabled.)  Set to 0 to configure the hub first.
+#ifndef STARTUP_OVERLAP
+#define STARTUP_OVERLAP (1)
+#endif
 
 // Define this to perform fimware update at startup.
 // #define PERFORM_DFU
 
-#ifdef PERFORM_DFU
+// Define this as well to update from a compressed image (firmwareHsImage,
+// generated by tools/hcbin_pack.py) rather than firmware_data.c.
+// #define DFU_COMPRESSED
+
+// With PERFORM_DFU, the hub's product ids are first compared with the
+// image metadata, and the update only runs (after a restart) if they
+// differ.  Set this to 1 to update on every boot regardless.
+#ifndef DFU_ALWAYS
+#define DFU_ALWAYS (0)
+#endif
+
+// Restarts to update a hub that still differs from the image afterwards
+#define DFU_AUTO_TRIES (1)
+
+// Without either, the "dfu" command (DFU_CONSOLE) updates the hub from an
+// image sent by tools/fwsend.py over the console.
+#include "firmware_console.h"
+
+#ifdef SH2_HAL_I2C
+#include "sh2_hal_i2c.h"
+#endif
+#ifdef SH2_HAL_SPI
+#include "sh2_hal_spi.h"
+#endif
+
+// The demo's hub is on I2C unless the SPI HAL is built too (see main.c)
+#if defined(SH2_HAL_I2C) && !defined(SH2_HAL_SPI)
+#define SH2_APP_ON_I2C (1)
+#else
+#define SH2_APP_ON_I2C (0)
+#endif
+
+#if defined(PERFORM_DFU) || DFU_CONSOLE
 #include "dfu.h"
+#include "dfu_multi.h"
 #include "firmware.h"
+#include "firmware_check.h"
+#endif
+#ifdef PERFORM_DFU
+#define DFU_IMAGE_RQ_MAGIC (0x44465552)   // "DFUR"
+#ifdef DFU_COMPRESSED
+#include "firmware_hs.h"
+extern const FirmwareHsImage_t firmwareHsImage;
+#endif
+#endif
+
+// Depth of the sensor event ring between sensorHandler and the sensor task.
+// With batching, a whole hub FIFO drain arrives as one burst, so size this
+// for the largest batch expected.  (Must be a power of 2.)
+#ifndef SENSOR_RING_LEN
+#define SENSOR_RING_LEN (64)
+#endif
+
+// The sensor task consumes the ring in batches of at most
+// SENSOR_BATCH_EVENTS events or SENSOR_BATCH_US [us].  With a backlog
+// left it then sleeps SENSOR_BATCH_YIELD_TICKS, so lower priority tasks
+// get their share under load (0: only yield to tasks of its priority).
+#ifndef SENSOR_BATCH_EVENTS
+#define SENSOR_BATCH_EVENTS (32)
+#endif
+#ifndef SENSOR_BATCH_US
+#define SENSOR_BATCH_US (2000)
+#endif
+#ifndef SENSOR_BATCH_YIELD_TICKS
+#define SENSOR_BATCH_YIELD_TICKS (1)
+#endif
+#if (SENSOR_BATCH_EVENTS < 1) || (SENSOR_BATCH_EVENTS > SENSOR_RING_LEN)
+#error SENSOR_BATCH_EVENTS must be 1 to SENSOR_RING_LEN
+#endif
+
+// I2C bus speeds to try at startup, fastest first.  The first one at which
+// I2C_PROBE_TRIES product id queries all succeed is kept.
+#define I2C_PROBE_SPEEDS {400000, 200000, 100000}
+#define I2C_PROBE_TRIES (3)
+
+// Number of entries in the sensor subscription table
+#define MAX_SUBSCRIPTIONS (8)
+
+#if WARM_BOOT && (WARM_BOOT_SUBS < MAX_SUBSCRIPTIONS)
+#error WARM_BOOT_SUBS must hold the subscription table
+#endif
+
+// Longest the state kept for a warm boot goes unsaved, while the hub
+// clock skew estimate settles [ms]
+#ifndef WARM_BOOT_SAVE_MS
+#define WARM_BOOT_SAVE_MS (30000)
+#endif
+
+// Read each sensor's configuration back after setting it, to learn the
+// interval the hub granted: it runs its sensors at the rates they
+// support, not always the one asked for.  One more round trip each.
+#ifndef SENSOR_READBACK
+#define SENSOR_READBACK (1)
+#endif
+
+// Largest FRS record the "frs" command handles.  "frs get" prints a
+// record as a "frs set" line, which must fit in a shell line.
+#define FRS_MAX_WORDS (20)
+
+// How long the shell waits for the demo task to run a hub request
+#define HUB_REQ_TIMEOUT_MS (2000)
+
+// Longest a hub FIFO flush may take to drain [ms], and how long without
+// a report counts as drained should a flush completion go missing [ms]
+#ifndef FLUSH_TIMEOUT_MS
+#define FLUSH_TIMEOUT_MS (1000)
+#endif
+#ifndef FLUSH_QUIET_MS
+#define FLUSH_QUIET_MS (50)
 #endif
 
-#define FIX_Q(n, x) ((int32_t)(x * (float)(1 << n)))
-const float scaleDegToRad = 3.14159265358 / 180.0;
+// Flush completed meta report: the SH-2 library passes it on as a sensor
+// event, with the flushed sensor's id in byte 1
+#define FLUSH_COMPLETED_ID (0xEF)
 
-// Uncomment this line to set up BNO080 for HMD use.
-// #define CONFIGURE_HMD
-#define GIRV_REF_6AG  (0x0207)  // 6 axis Game Rotation Vector 
-#define GIRV_REF_9AGM (0x0204)  // 9 axis Absolute Rotation Vector
-#define HMD_SYNC_INTERVAL (10000)                     // sync interval: 10000 uS (100Hz)
-#define HMD_MAX_ERR FIX_Q(29, (30.0 * scaleDegToRad)) // max error: 30 degrees
-#define HMD_PRED_AMT FIX_Q(10, 0.028)                 // prediction amt: 28ms
-#define HMD_ALPHA FIX_Q(20, 0.303072543909142)        // pred param alpha
-#define HMD_BETA  FIX_Q(20, 0.113295896384921)        // pred param beta
-#define HMD_GAMMA FIX_Q(20, 0.002776219713054)        // pred param gamma
+// Hub requests that can be queued or running at once
+#ifndef HUB_REQ_SLOTS
+#define HUB_REQ_SLOTS (4)
+#endif
+#if HUB_REQ_SLOTS > HUB_EVT_REQ_SLOTS
+#error HUB_REQ_SLOTS is limited by HUB_EVT_REQ_SLOTS
+#endif
+
+// Deep sleep ("sleep on"): time without a report from a wakeup
+// subscription before the streams stop [ms]
+#ifndef SLEEP_IDLE_MS
+#define SLEEP_IDLE_MS (30000)
+#endif
 
-#define DFLT_SYNC_INTERVAL (10000)                     // sync interval: 10000 uS (100Hz)
-#define DFLT_MAX_ERR FIX_Q(29, (30.0 * scaleDegToRad)) // max error: 30 degrees
-#define DFLT_PRED_AMT FIX_Q(10, 0.0)                   // prediction amt: 0ms = prediction disabled
-#define DFLT_ALPHA FIX_Q(20, 0.303072543909142)        // pred param alpha (factory default)
-#define DFLT_BETA  FIX_Q(20, 0.113295896384921)        // pred param beta (factory default)
-#define DFLT_GAMMA FIX_Q(20, 0.002776219713054)        // pred param gamma (factory default)
+#ifndef SENSOR_TASK_STACK
+#define SENSOR_TASK_STACK (256)  /* words */
+#endif
 
 // --- Forward declarations -------------------------------------------
 
 static void reportProdIds(void);
-static void configureForHmd(void);
-static void configureForDefault(void);
+static void restoreWarm(void);
+static void saveWarm(void);
+#if CONFIG_STORE
+static void restoreStored(void);
+static void configCmd(int argc, char *argv[]);
+#endif
+#if SH2_APP_ON_I2C
+static void probeI2cSpeed(void);
+#endif
+static void configureHub(const ConfigProfile_t *p);
+static void loadProfile(const ConfigProfile_t *p);
+static int applyProfile(const ConfigProfile_t *p);
+static void profileCmd(int argc, char *argv[]);
+static void applyPolicy(const ConfigPolicy_t *p);
+static void policyCmd(int argc, char *argv[]);
 static void startReports(void);
+static void recoverStep(void);
+static void sensorTaskStart(const void *params);
+static void applySubscriptions(bool all);
+static int configureSensor(int sensorId, uint32_t interval_us, uint32_t batch_us,
+                           uint16_t sensitivity, bool wakeup);
+static void updatePowerInterval(void);
+static void rateChanged(void);
+static void calSaveRequest(void);
+static void calSave(void);
+static void applyRates(void);
+static void subCmd(int argc, char *argv[]);
+static void subscribeDsf(void);
+static bool isWakeup(uint8_t sensorId);
+static bool isWakeupAny(void);
+static TickType_t sleepWait(void);
+static void sleepEnter(void);
+static void sleepLeave(bool resume);
+static void sleepCmd(int argc, char *argv[]);
+static void flushCmd(int argc, char *argv[]);
+static int flushHub(uint32_t *pReports, uint32_t *pDrain_us);
+#if defined(PERFORM_DFU) || DFU_CONSOLE
+static int dfuRun(const HcBinEx_t *image, bool readImage);
+static int dfuHubs(const HcBin_t *image, uint32_t *pDevMask);
+static void dfuReport(int status);
+#endif
+#ifdef PERFORM_DFU
+static bool dfuAtBoot(void);
+#endif
+#if defined(PERFORM_DFU) && !DFU_ALWAYS
+static void dfuIfDifferent(const HcBin_t *image);
+#endif
+#if DFU_CONSOLE
+static void dfuConsole(void);
+static void dfuCmd(int argc, char *argv[]);
+#endif
+static void calCmd(int argc, char *argv[]);
+static void frsCmd(int argc, char *argv[]);
+typedef struct HubRequest_s HubRequest_t;
+typedef void (HubReqCallback_t)(HubRequest_t *pReq);
+static int hubRequest(HubRequest_t *pReq);
+static int hubRequestWait(HubRequest_t *pReq, TickType_t wait);
+static uint32_t hubRequestAsync(const HubRequest_t *pReq, HubReqCallback_t *onDone);
+static HubRequest_t *hubReqSubmit(const HubRequest_t *pReq, HubReqCallback_t *onDone);
+static void calSaveDone(HubRequest_t *pReq);
+static void serviceHubRequest(void);
 static void eventHandler(void * cookie, sh2_AsyncEvent_t *pEvent);
-static void printDsfHeaders(void);
-static void printDsf(const sh2_SensorEvent_t * event);
-static void printEvent(const sh2_SensorEvent_t *pEvent);
 static void sensorHandler(void * cookie, sh2_SensorEvent_t *pEvent);
 
 // --- Private data ---------------------------------------------------
 
+#if CONFIG_STORE
+// CONFIG_KEY_TUNE value
+typedef struct {
+    uint32_t target;
+    uint8_t bytes;
+} StoredTune_t;
+#endif
+
 sh2_ProductIds_t prodIds;
+bool prodIdsValid = false;
+
+// Dynamic calibration enabled after each reset: the profile's, or as
+// last set by "cal"
+uint8_t calConfig;
+
+// When the warm boot state was last saved
+TickType_t warmSaved_tick;
 
-SemaphoreHandle_t wakeSensorTask;
+SemaphoreHandle_t wakeSensorTask;  // sensor events to consume
+SemaphoreHandle_t wakeDemoTask;    // resets and shell requests for the hub
 
 volatile bool resetPerformed = false;
 volatile bool startedReports = false;
 
-volatile bool sensorReceived = false;
-sh2_SensorEvent_t sensorEvent;
+// Recovery after a hub reset.  The demo task runs one step per pass of
+// its loop, so a reset arriving mid-way starts it over, and shell
+// requests are served in between.  Sensor events keep flowing through
+// the sensor task meanwhile.
+typedef enum {
+    RECOVER_IDLE,          // reports running
+    RECOVER_CONFIGURE,     // FRS and calibration set-up
+    RECOVER_SUBSCRIBE,     // resend the subscription table
+    RECOVER_READBACK,      // granted intervals, left out while subscribing
+    RECOVER_WAIT_SAMPLE,   // waiting for the first sensor event
+} RecoverState_t;
+#if STARTUP_OVERLAP
+#define RECOVER_FIRST_STEP      (RECOVER_SUBSCRIBE)
+#define RECOVER_AFTER_SUBSCRIBE (RECOVER_CONFIGURE)
+#define RECOVER_AFTER_CONFIGURE (RECOVER_READBACK)
+#else
+#define RECOVER_FIRST_STEP      (RECOVER_CONFIGURE)
+#define RECOVER_AFTER_CONFIGURE (RECOVER_SUBSCRIBE)
+#define RECOVER_AFTER_SUBSCRIBE (RECOVER_WAIT_SAMPLE)
+#endif
+typedef struct {
+    RecoverState_t state;             // demo task only
+    volatile uint64_t reset_uS;       // when the hub reported the reset
+    volatile uint32_t generation;     // count of resets handled
+    volatile bool awaitingSample;     // sensor task records the next event
+    volatile uint64_t firstSample_uS; // INTN time of that event
+    uint32_t configure_us;            // time taken by RECOVER_CONFIGURE
+    uint32_t readBack_us;             // time taken by RECOVER_READBACK
+    bool deferReadBack;               // subscribing: read-backs wait
+    bool booted;                      // first recovery, at power-up, done
+    uint32_t resets;                  // resets reported by the hub
+} Recovery_t;
+Recovery_t recovery;
+
+RTOS_STACK_DEF(sensorTaskStack, SENSOR_TASK_STACK);
+
+// Single-producer (sensorHandler), single-consumer (sensor task) event
+// ring, of compact samples with the INTN time for latency tracing
+typedef struct {
+    SPSC_RING(SensorSample_t, SENSOR_RING_LEN) ring;
+    volatile uint32_t overflows;  // events dropped because the ring was full
+    uint32_t oversize;            // events dropped as longer than a sample holds
+    volatile uint32_t highWater;  // max number of events seen in the ring
+    uint32_t yields;              // batches that left a backlog behind
+} SensorRing_t;
+SensorRing_t sensorRing;
+
+// Sensor subscriptions, applied after each reset.
+// Edited by the shell task, applied by the demo task.
+typedef struct {
+    int sensorId;                 // 0 marks an unused entry
+    uint32_t reportInterval_us;   // 0 disables the sensor
+    uint32_t batchInterval_us;
+    uint16_t changeSensitivity;   // 0 disables change sensitivity
+    bool wakeup;                  // reports through deep sleep, and ends it
+    bool dirty;                   // needs to be sent to the hub
+    uint32_t granted_us;          // interval the hub runs it at, 0 if not known
+    uint32_t grantedBatch_us;
+} Subscription_t;
+static uint32_t runInterval(const Subscription_t *sub);
+static uint32_t liveInterval(const Subscription_t *sub);
+static void readBack(int sensorId, uint32_t interval_us, uint32_t batch_us);
+static void readBackAll(void);
+static void checkRing(void);
+static int setSubscription(const Subscription_t *pSub);
+static void planBudget(SensorBudget_t *pBudget, const Subscription_t *pSub);
+static void printBudget(const SensorBudget_t *pBudget);
+// Loaded from the startup profile.
+Subscription_t subscriptions[MAX_SUBSCRIPTIONS];
+volatile bool subscriptionsChanged = false;
+
+// Configuration profile in use (config_profile.h); written by the demo task
+const ConfigProfile_t *activeProfile;
+
+// Runtime policy in use (config_policy.h); written by the shell
+static const ConfigPolicy_t *volatile activePolicy;
+
+// Set when the rate governor (sensor_rate.h) moves the intervals
+volatile bool ratesChanged = false;
+
+// Set by sensorApp_restartReports() to resend the subscription table
+volatile bool restartRequested = false;
+
+// Deep sleep.  With it on, SLEEP_IDLE_MS without a report from a wakeup
+// subscription disables every other subscription on the hub and lets
+// the MCU STOP (power.h).  The wakeup sensors stay on, with the hub's
+// wakeup and always-on flags, and the next report from one resends the
+// whole table: streaming resumes.  The demo task enters and leaves.
+typedef struct {
+    volatile bool enabled;            // "sleep on"
+    volatile bool asleep;             // streams disabled on the hub
+    volatile bool woken;              // a wakeup report came in asleep
+    volatile TickType_t lastWake_tick; // of the last wakeup report
+    volatile uint32_t idle_ms;
+    PowerMode_t awakePower;           // mode to restore on waking
+    uint64_t sleepStart_uS;
+    uint64_t asleep_us;               // total time asleep
+    uint32_t sleeps;
+} DeepSleep_t;
+DeepSleep_t deepSleep = {
+    .idle_ms = SLEEP_IDLE_MS,
+};
+
+// Hub FIFO flush in progress: completions still to come, and sensor
+// events received since it started (written by the HAL task)
+volatile uint32_t flushPending = 0;
+volatile uint32_t flushReports = 0;
+
+// Set by the calibration manager (sensor_cal.h) to have the DCD saved
+volatile bool calSaveRequested = false;
+
+// SH-2 calls made on behalf of other tasks.  The demo task owns the SH-2
+// API, whose calls block on the bus, so requests queue to it.  A client
+// fills in a request and either waits for it (hubRequest) or leaves a
+// callback the demo task calls once it is done (hubRequestAsync).  Up to
+// HUB_REQ_SLOTS requests are in flight, copied into slots, and run in
+// order, one per pass of the demo task's loop so recovery steps go on in
+// between.
+typedef enum {
+    HUB_REQ_GET_CAL,
+    HUB_REQ_SET_CAL,
+    HUB_REQ_SAVE_DCD,
+    HUB_REQ_PROFILE,
+    HUB_REQ_DFU,
+    HUB_REQ_FLUSH,
+} HubReqOp_t;
+typedef enum {
+    HUB_REQ_QUEUED,      // submitted, or running
+    HUB_REQ_DONE,        // results ready for the waiter
+} HubReqState_t;
+struct HubRequest_s {
+    HubReqOp_t op;
+    uint8_t calSensors;
+    const ConfigProfile_t *profile;
+    uint32_t reports;           // HUB_REQ_FLUSH: events drained
+    uint32_t drain_us;          // and how long it took
+    int status;
+    uint32_t id;                // in order of submission
+    // Slot bookkeeping
+    HubReqCallback_t *onDone;   // 0: a task waits in hubRequestWait()
+    volatile uint8_t state;
+    volatile bool abandoned;    // waiter gave up, free once done
+};
+POOL_STORAGE(hubReqBlocks, HubRequest_t, HUB_REQ_SLOTS);
+Pool_t hubReqPool;
+QueueHandle_t hubReqQueue;      // of HubRequest_t *
+uint32_t hubReqLastId;
+
+// Tasks calling the SH-2 API (sh2_client.h).  The shell calls it itself
+// for requests that don't touch the demo task's state.
+sh2Client_t demoClient;
+sh2Client_t shellClient;
+
+#if defined(PERFORM_DFU) && !DFU_ALWAYS
+// Update requested by the boot before: survives the restart, not zeroed
+// by the startup code.  Power-up leaves a random magic.
+typedef struct {
+    uint32_t magic;    // DFU_IMAGE_RQ_MAGIC: update before starting SH-2
+    uint32_t tries;    // restarts made to update
+} DfuRequest_t;
+static __no_init DfuRequest_t dfuRequest;
+#endif
 
 
 // --- Public methods -------------------------------------------------
 
+void sensorApp_getRingStats(uint32_t *pOverflows, uint32_t *pHighWater)
+{
+    *pOverflows = sensorRing.overflows;
+    *pHighWater = sensorRing.highWater;
+}
+
+int sensorApp_subscribe(uint8_t sensorId, uint32_t interval_us)
+{
+    Subscription_t sub;
+
+    if ((sensorId == 0) || (sensorId > SH2_MAX_SENSOR_ID)) {
+        return -1;
+    }
+
+    sub.sensorId = sensorId;
+    sub.reportInterval_us = interval_us;
+    sub.batchInterval_us = 0;
+    sub.changeSensitivity = 0;
+    sub.wakeup = false;
+    sub.dirty = true;
+
+    return setSubscription(&sub);
+}
+
+int sensorApp_flush(uint32_t *pReports, uint32_t *pDrain_us)
+{
+    static HubRequest_t req;
+
+    req.op = HUB_REQ_FLUSH;
+    int status = hubRequestWait(&req, pdMS_TO_TICKS(HUB_REQ_TIMEOUT_MS + FLUSH_TIMEOUT_MS));
+    if (pReports != 0) {
+        *pReports = req.reports;
+    }
+    if (pDrain_us != 0) {
+        *pDrain_us = req.drain_us;
+    }
+
+    return status;
+}
+
+int sensorApp_profile(const char *name)
+{
+    HubRequest_t req;
+
+    req.op = HUB_REQ_PROFILE;
+    req.profile = configProfile_find(name);
+    if (req.profile == 0) {
+        return SH2_ERR_BAD_PARAM;
+    }
+
+    return hubRequest(&req);
+}
+
+int sensorApp_dfuConsole(void)
+{
+#if DFU_CONSOLE
+    HubRequest_t req;
+
+    // Only returns if the request could not be posted
+    req.op = HUB_REQ_DFU;
+    return hubRequestWait(&req, portMAX_DELAY);
+#else
+    return SH2_ERR_BAD_PARAM;
+#endif
+}
+
+uint32_t sensorApp_interval(uint8_t sensorId)
+{
+    for (int n = 0; n < MAX_SUBSCRIPTIONS; n++) {
+        if (subscriptions[n].sensorId == sensorId) {
+            return subscriptions[n].reportInterval_us;
+        }
+    }
+
+    return 0;
+}
+
+uint32_t sensorApp_grantedInterval(uint8_t sensorId)
+{
+    for (int n = 0; n < MAX_SUBSCRIPTIONS; n++) {
+        if (subscriptions[n].sensorId == sensorId) {
+            return liveInterval(&subscriptions[n]);
+        }
+    }
+
+    return 0;
+}
+
+uint32_t sensorApp_quietLimit(uint8_t sensorId)
+{
+    for (int n = 0; n < MAX_SUBSCRIPTIONS; n++) {
+        const Subscription_t *sub = &subscriptions[n];
+
+        if ((sub->sensorId != sensorId) || (sub->reportInterval_us == 0)) {
+            continue;
+        }
+        if (sub->wakeup ? (sub->changeSensitivity != 0) :
+                          (sensorTune_sensitivity(sensorId, sub->changeSensitivity) != 0)) {
+            // Quiet for as long as nothing changes
+            return 0;
+        }
+        uint32_t run_us = liveInterval(sub);
+        uint32_t batch_us = (sub->granted_us != 0) ? sub->grantedBatch_us :
+                            configPolicy_batch(activePolicy, sub->batchInterval_us);
+        return (batch_us > run_us) ? batch_us : run_us;
+    }
+
+    return 0;
+}
+
+bool sensorApp_recovering(void)
+{
+    return recovery.state != RECOVER_IDLE;
+}
+
+bool sensorApp_asleep(void)
+{
+    return deepSleep.asleep;
+}
+
+void sensorApp_restartReports(void)
+{
+    restartRequested = true;
+    xSemaphoreGive(wakeDemoTask);
+}
+
 
 void demoTaskStart(const void * params)
 {
-    static uint32_t sensors = 0;
+    bootProf_mark(BOOT_APP);
 
     printf("\n\nHillcrest SH-2 Demo.\n");
+    printf("Clock: %s\n", clock_describe());
+    artBench_report();
+    coredump_report();
 
     wakeSensorTask = xSemaphoreCreateBinary();
+    wakeDemoTask = xSemaphoreCreateBinary();
+    pool_init(&hubReqPool, "hub requests", hubReqBlocks, sizeof(hubReqBlocks[0]), HUB_REQ_SLOTS);
+    hubReqQueue = xQueueCreate(HUB_REQ_SLOTS, sizeof(HubRequest_t *));
+    sysstats_addQueue("hub requests", hubReqQueue, HUB_REQ_SLOTS);
+    hubEvents_init();
+    sh2Client_init();
+    sh2Client_open(&demoClient, "demo");
+    sh2Client_open(&shellClient, "shell");
+
+    // The demo task holds the API from here, except while it waits
+    sh2Client_begin(&demoClient);
+
+    shell_addCommand("sub", "[<sensor> <interval us> [batch us] [sensitivity] | dsf] list/set subscriptions",
+                     subCmd);
+    shell_addCommand("flush", "drain batched samples from the hub FIFO", flushCmd);
+    shell_addCommand("cal", "[<agmp> | - | save] show/set dynamic calibration, save DCD", calCmd);
+    shell_addCommand("frs", "get <id> | set <id> [words...] read/write an FRS record", frsCmd);
+    shell_addCommand("profile", "[<name>] list or switch configuration profiles", profileCmd);
+    shell_addCommand("policy", "[<name>] list or switch latency/throughput policies", policyCmd);
+#if CONFIG_STORE
+    shell_addCommand("config", "[save | erase] show/save the startup configuration in flash",
+                     configCmd);
+#endif
+#if DFU_CONSOLE
+    shell_addCommand("dfu", "update hub firmware from tools/fwsend.py, then restart", dfuCmd);
+#endif
+    shell_addCommand("sleep", "[on [idle s] | off | now] deep sleep until a wakeup sensor reports",
+                     sleepCmd);
+    sensorDispatch_init(rateChanged);
+    sensorDecim_init();
+    sensorAlign_init();
+    sensorBatch_init();
+    sensorRate_init(rateChanged);
+    sensorTune_init(rateChanged);
+    sensorCal_init(calSaveRequest);
+#if SENSOR_MERGE
+    sensorMerge_init();
+#endif
+    sensorStats_init();
+#if SENSOR_NOISE
+    sensorNoise_init();
+#endif
+#if SENSOR_FFT
+    sensorFft_init();
+#endif
+#if SENSOR_BLACKBOX
+    sensorBlackbox_init();
+#endif
+#if SENSOR_SWEEP
+    sensorSweep_init();
+#endif
+#if SENSOR_LATEST
+    sensorLatest_init();
+#endif
+    sensorWatch_init();
+    rpc_init();
+    hubHealth_init();
+    telemetry_init();
+    girvPredict_init();
+#if SENSOR_CAMSYNC
+    sensorCamsync_init();
+#endif
+#if SENSOR_STROBE
+    sensorStrobe_init();
+#endif
+    sensorResample_init();
+    sensorTick_init();
+    sensorEkf_init();
+#if BOARD_SYNC
+    boardSync_init();
+#endif
+#if GIRV_FAST
+    girvFast_init();
+#endif
+    hubClock_init();
+    hsiTrim_init();
+#if SPI_BRIDGE
+    spiBridge_init();
+#endif
+    bootProf_init();
+    sensorOutput_init();
+    sensorMeta_init();
+    sysstats_addCounter("hub resets", &recovery.resets);
+
+    activeProfile = configProfile_find(CONFIG_PROFILE);
+    if (activeProfile == 0) {
+        printf("No profile %s, using %s.\n", CONFIG_PROFILE, configProfile_get(0)->name);
+        activeProfile = configProfile_get(0);
+    }
+    loadProfile(activeProfile);
+    calConfig = activeProfile->calSensors;
+    const ConfigPolicy_t *policy = configPolicy_find(CONFIG_POLICY);
+    if (policy == 0) {
+        printf("No policy %s, using %s.\n", CONFIG_POLICY, configPolicy_get(0)->name);
+        policy = configPolicy_get(0);
+    }
+    applyPolicy(policy);
+#if CONFIG_STORE
+    // Saved settings over the built-in ones, and a warm reset's over both
+    configStore_init();
+    restoreStored();
+#endif
+    if (warmBoot_init()) {
+        // Carry on with what the last run was set to
+        restoreWarm();
+    }
+    sysstats_addMemory("sensor ring", sizeof(sensorRing));
+    sysstats_addCounter("sensor batch yields", &sensorRing.yields);
+    sysstats_addCounter("sensor oversize drops", &sensorRing.oversize);
 
 #ifdef PERFORM_DFU
-    // Perform DFU
-    printf("Starting DFU process\n");
-    int status = dfu(&firmware);
-    
-    printf("DFU completed with status: %d\n", status);
+#ifdef DFU_COMPRESSED
+    firmwareHs_setImage(&firmwareHsImage);
+    const HcBinEx_t *dfuImage = &firmwareHs;
+#else
+    const HcBinEx_t *dfuImage = &firmware;
+#endif
+    if (dfuAtBoot()) {
+        // Perform DFU
+        printf("Starting DFU process\n");
+#ifdef DFU_COMPRESSED
+        int status = dfuRun(dfuImage, true);
+#else
+        // The chunk CRC table checks the image word-wise in the CRC unit,
+        // so firmware_check need not read it through for its CRC-32
+        int status = (firmware_verify() == 0) ? dfuRun(dfuImage, false)
+                                              : SH2_ERR_BAD_PARAM;
+#endif
 
-    if (status == SH2_OK) {
-        // DFU Succeeded.  Need to pause a bit to let flash writes complete
-        vTaskDelay(10);  // 10ms pause
+        if (status == SH2_OK) {
+            // DFU Succeeded.  Need to pause a bit to let flash writes complete
+            vTaskDelay(10);  // 10ms pause
+        }
     }
 #endif
 
@@ -120,6 +781,7 @@ void demoTaskStart(const void * params)
 
     resetPerformed = false;
     startedReports = false;
+    hubEvents_clear(HUB_EVT_RESET);
 
     // init SH2 layer
     sh2_initialize(eventHandler, NULL);
@@ -127,53 +789,277 @@ void demoTaskStart(const void * params)
     // Register event listener
     sh2_setSensorCallback(sensorHandler, NULL);
 
-    while (!resetPerformed) {
-        vTaskDelay(1);
+    // The hub announces itself with a reset once it runs
+    while (!hubEvents_waitReady(pdMS_TO_TICKS(HUB_READY_TIMEOUT_MS))) {
+        sh2_hal_Health_t health;
+
+        sh2_hal_getHealth(&health);
+        printf("No reset from the hub after %u ms (%u INTNs), still waiting.\n",
+               HUB_READY_TIMEOUT_MS, (unsigned)health.intns);
     }
 
-#ifdef DSF_OUTPUT
-    // Print DSF file headers
-    printDsfHeaders();
-#else
-    // Read and display BNO080 product ids
-    reportProdIds();
+#if SH2_APP_ON_I2C
+    if (warmBoot_warm() && (warmBoot_state()->i2cHz != 0)) {
+        // Probed before the warm reset, the board hasn't changed
+        sh2_hal_setI2cSpeed(warmBoot_state()->i2cHz);
+        printf("I2C bus speed: %u Hz (kept)\n", sh2_hal_getI2cSpeed());
+    }
+    else {
+        // Find the fastest I2C rate this board handles reliably
+        probeI2cSpeed();
+    }
 #endif
 
-    // Process sensors forever
+#if defined(PERFORM_DFU) && !DFU_ALWAYS
+    // Restarts to update if the hub doesn't run the image already
+    dfuIfDifferent(&dfuImage->hcbin);
+#endif
+
+#if !STARTUP_OVERLAP
+    if (sensorOutput_getMode() == OUTPUT_TEXT) {
+        // Read and display BNO080 product ids
+        reportProdIds();
+    }
+#endif
+
+    // Sensor events are consumed in a task of their own, so they keep
+    // flowing while this one waits on the hub.
+    osThreadDef(sensorThreadDef, sensorTaskStart, PRIO_TASK_SENSOR, 0, SENSOR_TASK_STACK);
+    rtos_threadCreate(osThread(sensorThreadDef), NULL, RTOS_STACK(sensorTaskStack));
+
+    // Run the hub forever
     while (1) {
-        // Wait until something happens
-        xSemaphoreTake(wakeSensorTask, portMAX_DELAY);
-                             
-        if (sensorReceived) {
-            sensorReceived = false;
-            sensors++;
-#ifdef DSF_OUTPUT
-            printDsf(&sensorEvent);
-#else
-            printEvent(&sensorEvent);
+        // Wait until something happens, unless recovery or queued hub
+        // requests have work to do
+        if (!resetPerformed && !restartRequested &&
+            (uxQueueMessagesWaiting(hubReqQueue) == 0) &&
+            ((recovery.state == RECOVER_IDLE) ||
+             (recovery.state == RECOVER_WAIT_SAMPLE))) {
+            TickType_t wait = sleepWait();
+#if WARM_BOOT
+            if (wait > pdMS_TO_TICKS(WARM_BOOT_SAVE_MS)) {
+                wait = pdMS_TO_TICKS(WARM_BOOT_SAVE_MS);
+            }
 #endif
+            sh2Client_end(&demoClient);
+            xSemaphoreTake(wakeDemoTask, wait);
+            sh2Client_begin(&demoClient);
         }
+
         if (resetPerformed) {
             resetPerformed = false;
-          
-#ifdef CONFIGURE_HMD
-            // Configure BNO080 for optimal HMD operation
-            // (Enable prediction for Gyro Integrated Rotation Vector)
-            configureForHmd();
+            // Recovery resends the whole table: the streams run again
+            if (deepSleep.asleep) {
+                sleepLeave(false);
+            }
+            recovery.awaitingSample = false;
+            recovery.generation++;
+            recovery.state = RECOVER_FIRST_STEP;
+        }
+        else if (restartRequested && (recovery.state == RECOVER_IDLE)) {
+            // As after a reset, without one: the whole table again
+            restartRequested = false;
+            if (deepSleep.asleep) {
+                sleepLeave(false);
+            }
+            recovery.reset_uS = timebase_getUs();
+            recovery.state = RECOVER_SUBSCRIBE;
+        }
+
+        if (recovery.state != RECOVER_IDLE) {
+            recoverStep();
+        }
+        else if (deepSleep.asleep && (deepSleep.woken || !deepSleep.enabled)) {
+            sleepLeave(true);
+        }
+        else if (subscriptionsChanged) {
+            subscriptionsChanged = false;
+            applySubscriptions(false);
+        }
+        else if (ratesChanged) {
+            ratesChanged = false;
+            applyRates();
+        }
+        else if (!deepSleep.asleep && (sleepWait() == 0)) {
+            sleepEnter();
+        }
+        if (calSaveRequested) {
+            calSaveRequested = false;
+            calSave();
+        }
+        if (uxQueueMessagesWaiting(hubReqQueue) != 0) {
+            serviceHubRequest();
+        }
+        if (WARM_BOOT && (recovery.state == RECOVER_IDLE) &&
+            (xTaskGetTickCount() - warmSaved_tick >= pdMS_TO_TICKS(WARM_BOOT_SAVE_MS))) {
+            saveWarm();
+        }
+    }
+}
+
+// --- Private methods ----------------------------------------------
+
+// Consume sensor events: publish each one from the ring to its subscribers,
+// through the timestamp merge
+static void sensorTaskStart(const void *params)
+{
+    static uint32_t sensors = 0;
+    uint32_t generation = recovery.generation;
+    TickType_t wait = portMAX_DELAY;
+
+    while (1) {
+        // Wait until something happens, or held events fall due
+        xSemaphoreTake(wakeSensorTask, wait);
+
+        if (recovery.generation != generation) {
+            // The hub was reset: sequence numbers start over
+            generation = recovery.generation;
+#if SENSOR_MERGE
+            sensorMerge_flush();
+#endif
+            sensorStats_restart();
+            sensorCal_restart(recovery.reset_uS);
+            hubClock_restart();
+        }
+
+        // Consume everything that arrived since the last wake-up, a
+        // bounded batch at a time
+        SensorSample_t *pSample;
+        uint64_t batch_uS = timebase_getUs();
+        unsigned batch = 0;
+        while ((pSample = spsc_readSlot(&sensorRing.ring)) != 0) {
+            if ((batch >= SENSOR_BATCH_EVENTS) ||
+                (timebase_getUs() - batch_uS >= SENSOR_BATCH_US)) {
+                // Still a backlog: step aside, then carry on with it
+                sensorRing.yields++;
+#if SENSOR_BATCH_YIELD_TICKS > 0
+                vTaskDelay(SENSOR_BATCH_YIELD_TICKS);
 #else
-            // Configure BNO080 for default operation
-            // (Disable prediction for Gyro Integrated Rotation Vector)
-            configureForDefault();
+                taskYIELD();
 #endif
-          
+                batch_uS = timebase_getUs();
+                batch = 0;
+            }
+            batch++;
 
-            // Enable reports from Rotation Vector.
-            startReports();
+            sh2_SensorEvent_t event;
+            sh2_SensorEvent_t *pEvent = &event;
+            uint64_t intn_uS = sensorSample_intnUs(pSample, timebase_getUs());
+            uint32_t start = cycleBudget_start();
+
+            // The slot is the HAL's again once copied out
+            sensorSample_unpack(pEvent, pSample);
+            spsc_pop(&sensorRing.ring);
+
+            latency_record(LAT_CONSUME, intn_uS);
+            sensorWatch_sample(pEvent->reportId, intn_uS);
+            sensors++;
+
+            if (recovery.awaitingSample && (intn_uS >= recovery.reset_uS)) {
+                bootProf_mark(BOOT_FIRST_SAMPLE);
+                wcet_heapFreeze();
+                recovery.firstSample_uS = intn_uS;
+                recovery.awaitingSample = false;
+                hubEvents_set(HUB_EVT_FIRST_SAMPLE);
+                xSemaphoreGive(wakeDemoTask);
+            }
+
+            if (deepSleep.enabled && isWakeup(pEvent->reportId)) {
+                deepSleep.lastWake_tick = xTaskGetTickCount();
+                if (deepSleep.asleep && !deepSleep.woken) {
+                    deepSleep.woken = true;
+                    xSemaphoreGive(wakeDemoTask);
+                }
+            }
+
+            // Subscribers all see timestamps on the host timebase
+            hubClock_correct(pEvent, intn_uS);
+#if SENSOR_MERGE
+            sensorMerge_push(pEvent);
+#else
+            sensorDispatch_publish(pEvent);
+#endif
+            cycleBudget_check(BUDGET_STAGE_DISPATCH, start, pEvent->reportId);
         }
+
+#if SENSOR_MERGE
+        wait = sensorMerge_release();
+#endif
     }
 }
 
-// --- Private methods ----------------------------------------------
+// Run the next step of reset recovery.  Called from the demo task.
+static void recoverStep(void)
+{
+    uint64_t start_uS;
+
+    switch (recovery.state) {
+        case RECOVER_CONFIGURE:
+            start_uS = timebase_getUs();
+            // GIRV prediction and calibration of the active profile
+            configureHub(activeProfile);
+            // First boot, and after DFU
+            sensorMeta_load();
+            recovery.configure_us = (uint32_t)(timebase_getUs() - start_uS);
+            bootProf_mark(BOOT_CONFIGURED);
+            recovery.state = RECOVER_AFTER_CONFIGURE;
+            break;
+
+        case RECOVER_SUBSCRIBE:
+            // Armed first: the first sample may beat startReports() back
+            recovery.awaitingSample = true;
+            recovery.deferReadBack = STARTUP_OVERLAP;
+            startReports();
+            recovery.deferReadBack = false;
+            bootProf_mark(BOOT_SUBSCRIBED);
+            recovery.state = RECOVER_AFTER_SUBSCRIBE;
+            break;
+
+        case RECOVER_READBACK:
+            start_uS = timebase_getUs();
+            readBackAll();
+            recovery.readBack_us = (uint32_t)(timebase_getUs() - start_uS);
+            recovery.state = RECOVER_WAIT_SAMPLE;
+            break;
+
+        case RECOVER_WAIT_SAMPLE:
+            if (!recovery.awaitingSample) {
+                bool first = !recovery.booted;
+
+                recovery.booted = true;
+#if STARTUP_OVERLAP
+                uint32_t prodIds_us = 0;
+                if (first && (sensorOutput_getMode() == OUTPUT_TEXT)) {
+                    // Deferred from startup
+                    start_uS = timebase_getUs();
+                    reportProdIds();
+                    prodIds_us = (uint32_t)(timebase_getUs() - start_uS);
+                }
+#endif
+                printf("First sample %u ms after reset (configuration %u ms).\n",
+                       (unsigned)((recovery.firstSample_uS - recovery.reset_uS) / 1000),
+                       (unsigned)(recovery.configure_us / 1000));
+#if STARTUP_OVERLAP
+                // What the first sample would have waited for, hub
+                // configured first
+                printf("About %u ms sooner: configuration, read-backs %u ms "
+                       "and product ids %u ms came after the subscriptions.\n",
+                       (unsigned)((recovery.configure_us + recovery.readBack_us + prodIds_us) / 1000),
+                       (unsigned)(recovery.readBack_us / 1000),
+                       (unsigned)(prodIds_us / 1000));
+#endif
+                if (first) {
+                    bootProf_dump();
+                }
+                recovery.state = RECOVER_IDLE;
+            }
+            break;
+
+        default:
+            recovery.state = RECOVER_IDLE;
+            break;
+    }
+}
 
 static void eventHandler(void * cookie, sh2_AsyncEvent_t *pEvent)
 {
@@ -181,15 +1067,62 @@ static void eventHandler(void * cookie, sh2_AsyncEvent_t *pEvent)
         printf("SH2 Reset.\n");
 
         // Signal main loop to handle this.
+        bootProf_mark(BOOT_HUB_RESET);
+        recovery.reset_uS = timebase_getUs();
+        recovery.resets++;
         resetPerformed = true;
-        xSemaphoreGive(wakeSensorTask);
+        hubEvents_set(HUB_EVT_RESET);
+        xSemaphoreGive(wakeDemoTask);
+    }
+    else {
+        hubHealth_asyncEvent(pEvent->eventId);
     }
 }
 
 static void sensorHandler(void * cookie, sh2_SensorEvent_t *pEvent)
 {
-    sensorEvent = *pEvent;
-    sensorReceived = true;
+    SensorSample_t *pSample;
+
+    latency_mark(LAT_HANDLER);
+
+    if (flushPending != 0) {
+        if (pEvent->reportId == FLUSH_COMPLETED_ID) {
+            // HAL task only writes here while the demo task waits
+            if (--flushPending == 0) {
+                hubEvents_set(HUB_EVT_FLUSHED);
+            }
+            return;
+        }
+        flushReports++;
+    }
+    if (pEvent->reportId == FLUSH_COMPLETED_ID) {
+        // Late, or from a flush someone else asked for
+        return;
+    }
+
+#if GIRV_FAST
+    // GIRV pose straight from the HAL task, ahead of the ring
+    if (girvFast_publish(pEvent, latency_intnUs()) && GIRV_FAST_ONLY) {
+        return;
+    }
+#endif
+
+    pSample = spsc_writeSlot(&sensorRing.ring);
+    if (pSample == 0) {
+        // No room, drop this event
+        sensorRing.overflows++;
+    }
+    else if (!sensorSample_pack(pSample, pEvent, latency_intnUs())) {
+        sensorRing.oversize++;
+    }
+    else {
+        spsc_push(&sensorRing.ring);
+
+        uint32_t used = spsc_count(&sensorRing.ring);
+        if (used > sensorRing.highWater) {
+            sensorRing.highWater = used;
+        }
+    }
 
     xSemaphoreGive(wakeSensorTask);
 }
@@ -198,12 +1131,21 @@ static void reportProdIds(void)
 {
     int status;
     
-    memset(&prodIds, 0, sizeof(prodIds));
-    status = sh2_getProdIds(&prodIds);
-    
-    if (status < 0) {
-        printf("Error from sh2_getProdIds.\n");
-        return;
+    if (!prodIdsValid) {
+        memset(&prodIds, 0, sizeof(prodIds));
+        uint64_t start_uS = latency_cmdStart();
+        status = sh2_getProdIds(&prodIds);
+        latency_cmd(LAT_CMD_PROD_IDS, start_uS);
+
+        if (status < 0) {
+            printf("Error from sh2_getProdIds.\n");
+            return;
+        }
+        prodIdsValid = true;
+    }
+    else {
+        // Kept over a warm reset: the hub runs the same firmware
+        printf("Product ids kept from before the reset:\n");
     }
 
     // Report the results
@@ -214,325 +1156,1564 @@ static void reportProdIds(void)
                prodIds.entry[n].swVersionPatch, prodIds.entry[n].swBuildNumber);
     }
 
+    bootProf_mark(BOOT_PROD_IDS);
 }
 
-static void configureForDefault(void)
+#if SH2_APP_ON_I2C
+static void probeI2cSpeed(void)
 {
-    int status = SH2_OK;
-    uint32_t config[7];
-    
-    // Configure prediction parameters for Gyro-Integrated Rotation Vector.
-    // See section 4.3.24 of the SH-2 Reference Manual for a full explanation.
-    // ...
-    config[0] = GIRV_REF_6AG;           // Reference Data Type
-    config[1] = (uint32_t)0;            // Synchronization Interval (0 disables prediction)
-    config[2] = (uint32_t)DFLT_MAX_ERR;  // Maximum error
-    config[3] = (uint32_t)DFLT_PRED_AMT; // Prediction Amount
-    config[4] = (uint32_t)DFLT_ALPHA;    // Alpha
-    config[5] = (uint32_t)DFLT_BETA;     // Beta
-    config[6] = (uint32_t)DFLT_GAMMA;    // Gamma
-    status = sh2_setFrs(FRS_ID_META_GYRO_INTEGRATED_RV, config, sizeof(config)/sizeof(uint32_t));
-    if (status != SH2_OK) {
-        printf("Error: %d, from sh2_setFrs() in configureForDefault.\n", status);
-    }
+    static const uint32_t speeds[] = I2C_PROBE_SPEEDS;
+    const unsigned numSpeeds = sizeof(speeds)/sizeof(speeds[0]);
 
-    // Note: The configuration step performed above updates a non-volatile FRS record
-    // so it will remain in effect even after the sensor hub reboots.  It's not strictly
-    // necessary to repeat this step every time the system starts up as we are doing
-    // in this example code.
-    //
-    // The calibration config performed below, however, is not retained in non-volatile
-    // storage.  It only remains in effect until the sensor hub reboots.
+    for (unsigned n = 0; n < numSpeeds; n++) {
+        int tries;
 
-    // Enable dynamic calibration for A, G and M sensors
-    status = sh2_setCalConfig(SH2_CAL_ACCEL | SH2_CAL_GYRO | SH2_CAL_MAG);
-    if (status != SH2_OK) {
-        printf("Error: %d, from sh2_setCalConfig() in configureForDefault.\n", status);
+        sh2_hal_setI2cSpeed(speeds[n]);
+        for (tries = 0; tries < I2C_PROBE_TRIES; tries++) {
+            uint64_t start_uS = latency_cmdStart();
+            int status = sh2_getProdIds(&prodIds);
+            latency_cmd(LAT_CMD_PROD_IDS, start_uS);
+            if (status != SH2_OK) {
+                break;
+            }
+        }
+
+        if (tries == I2C_PROBE_TRIES) {
+            printf("I2C bus speed: %u Hz\n", sh2_hal_getI2cSpeed());
+            return;
+        }
     }
+
+    // Nothing was reliable, stay at the slowest rate
+    printf("I2C bus unreliable, using %u Hz\n", sh2_hal_getI2cSpeed());
 }
+#endif
 
-static void configureForHmd(void)
+// Set the hub up for profile p: GIRV prediction, mounting orientation
+// and dynamic calibration.
+static void configureHub(const ConfigProfile_t *p)
 {
-    int status = SH2_OK;
-    uint32_t config[7];
-    
+    int status;
+    bool written;
+    bool orient = false;
+
     // Configure prediction parameters for Gyro-Integrated Rotation Vector.
     // See section 4.3.24 of the SH-2 Reference Manual for a full explanation.
-    // ...
-    config[0] = GIRV_REF_6AG;           // Reference Data Type
-    config[1] = (uint32_t)HMD_SYNC_INTERVAL; // Synchronization Interval
-    config[2] = (uint32_t)HMD_MAX_ERR;  // Maximum error
-    config[3] = (uint32_t)HMD_PRED_AMT; // Prediction Amount
-    config[4] = (uint32_t)HMD_ALPHA;    // Alpha
-    config[5] = (uint32_t)HMD_BETA;     // Beta
-    config[6] = (uint32_t)HMD_GAMMA;    // Gamma
-    status = sh2_setFrs(FRS_ID_META_GYRO_INTEGRATED_RV, config, sizeof(config)/sizeof(uint32_t));
+    status = frsCache_set(FRS_ID_META_GYRO_INTEGRATED_RV, p->girv, CONFIG_GIRV_WORDS, &written);
     if (status != SH2_OK) {
-        printf("Error: %d, from sh2_setFrs() in configureForHmd.\n", status);
+        printf("Error: %d, from sh2_setFrs() in configureHub.\n", status);
+    }
+    else if (written) {
+        printf("GIRV configuration written to FRS.\n");
+    }
+
+    // Rotate outputs into the product frame on the hub, so no consumer
+    // has to.  The hub reads the record as it initializes: one that had
+    // to be written takes a reinitialization, after which it matches.
+    for (int n = 0; n < CONFIG_ORIENT_WORDS; n++) {
+        orient |= (p->orientation[n] != 0);
+    }
+    if (orient) {
+        status = frsCache_set(SYSTEM_ORIENTATION, p->orientation, CONFIG_ORIENT_WORDS, &written);
+        if (status != SH2_OK) {
+            printf("Error: %d, setting system orientation in configureHub.\n", status);
+        }
+        else if (written) {
+            printf("System orientation written to FRS, reinitializing hub.\n");
+            uint64_t start_uS = latency_cmdStart();
+            status = sh2_reinitialize();
+            latency_cmd(LAT_CMD_REINIT, start_uS);
+            if (status != SH2_OK) {
+                printf("Error: %d, from sh2_reinitialize() in configureHub.\n", status);
+            }
+            // Recovery starts over: the table is resent
+            resetPerformed = true;
+        }
     }
 
     // Note: The configuration step performed above updates a non-volatile FRS record
-    // so it will remain in effect even after the sensor hub reboots.  It's not strictly
-    // necessary to repeat this step every time the system starts up as we are doing
-    // in this example code.
+    // so it will remain in effect even after the sensor hub reboots.  It is only
+    // written when the stored record differs, so a reset doesn't cost a flash write.
     //
     // The calibration config performed below, however, is not retained in non-volatile
     // storage.  It only remains in effect until the sensor hub reboots.
 
-    // Enable dynamic calibration for A, G and M sensors
-    status = sh2_setCalConfig(SH2_CAL_ACCEL | SH2_CAL_GYRO | SH2_CAL_MAG);
+    // Enable dynamic calibration for the profile's sensors
+    uint64_t start_uS = latency_cmdStart();
+    status = sh2_setCalConfig(calConfig);
+    latency_cmd(LAT_CMD_CAL_CONFIG, start_uS);
+    if (status != SH2_OK) {
+        printf("Error: %d, from sh2_setCalConfig() in configureHub.\n", status);
+    }
+}
+
+// Pick the last run's state up after a warm reset (see warm_boot.h):
+// called at startup, before the hub is brought up
+static void restoreWarm(void)
+{
+    const WarmState_t *w = warmBoot_state();
+    const ConfigProfile_t *profile = configProfile_find(w->profile);
+    const ConfigPolicy_t *policy = configPolicy_find(w->policy);
+
+    if (profile != 0) {
+        activeProfile = profile;
+    }
+    if (policy != 0) {
+        applyPolicy(policy);
+    }
+
+    // The table as it was, not the profile's: shell edits carry over
+    taskENTER_CRITICAL();
+    memset(subscriptions, 0, sizeof(subscriptions));
+    for (int n = 0; n < MAX_SUBSCRIPTIONS; n++) {
+        subscriptions[n].sensorId = w->sub[n].sensorId;
+        subscriptions[n].reportInterval_us = w->sub[n].reportInterval_us;
+        subscriptions[n].batchInterval_us = w->sub[n].batchInterval_us;
+        subscriptions[n].changeSensitivity = w->sub[n].changeSensitivity;
+        subscriptions[n].wakeup = w->sub[n].wakeup;
+        subscriptions[n].dirty = (w->sub[n].sensorId != 0);
+    }
+    taskEXIT_CRITICAL();
+
+    calConfig = w->calSensors;
+    hubClock_setSkewPpm(w->skewPpm);
+    sensorMeta_import(w->metaId, w->meta, w->numMeta);
+    if (w->haveProdIds) {
+        prodIds = w->prodIds;
+        prodIdsValid = true;
+    }
+
+    printf("Warm boot: profile %s, policy %s, %u sensor records kept.\n",
+           activeProfile->name, activePolicy->name, w->numMeta);
+}
+
+// Record the state a warm reset should resume from.  Demo task only.
+static void saveWarm(void)
+{
+#if WARM_BOOT
+    WarmState_t *w = warmBoot_state();
+
+    w->haveProdIds = prodIdsValid;
+    w->prodIds = prodIds;
+#if SH2_APP_ON_I2C
+    w->i2cHz = sh2_hal_getI2cSpeed();
+#else
+    w->i2cHz = 0;
+#endif
+    strncpy(w->profile, activeProfile->name, sizeof(w->profile) - 1);
+    w->profile[sizeof(w->profile) - 1] = 0;
+    strncpy(w->policy, activePolicy->name, sizeof(w->policy) - 1);
+    w->policy[sizeof(w->policy) - 1] = 0;
+    w->calSensors = calConfig;
+    w->skewPpm = hubClock_skewPpm();
+
+    memset(w->sub, 0, sizeof(w->sub));
+    taskENTER_CRITICAL();
+    for (int n = 0, m = 0; n < MAX_SUBSCRIPTIONS; n++) {
+        const Subscription_t *sub = &subscriptions[n];
+
+        if ((sub->sensorId != 0) && (sub->reportInterval_us != 0)) {
+            w->sub[m].sensorId = (uint8_t)sub->sensorId;
+            w->sub[m].reportInterval_us = sub->reportInterval_us;
+            w->sub[m].batchInterval_us = sub->batchInterval_us;
+            w->sub[m].changeSensitivity = sub->changeSensitivity;
+            w->sub[m].wakeup = sub->wakeup;
+            m++;
+        }
+    }
+    taskEXIT_CRITICAL();
+    w->numMeta = (uint8_t)sensorMeta_export(w->metaId, w->meta, SENSOR_META_MAX);
+
+    warmBoot_save();
+#endif
+    warmSaved_tick = xTaskGetTickCount();
+}
+
+#if CONFIG_STORE
+// Take the settings saved by "config save" (see config_store.h), over the
+// build's defaults: called at startup, before the hub is brought up
+static void restoreStored(void)
+{
+    char name[WARM_BOOT_NAME_LEN];
+    WarmSub_t sub[MAX_SUBSCRIPTIONS];
+    StoredTune_t tune;
+    uint8_t cal;
+    int len;
+
+    len = configStore_get(CONFIG_KEY_PROFILE, name, sizeof(name) - 1);
+    if (len > 0) {
+        name[(len < (int)sizeof(name)) ? len : (int)sizeof(name) - 1] = 0;
+        const ConfigProfile_t *p = configProfile_find(name);
+        if (p != 0) {
+            activeProfile = p;
+            loadProfile(p);
+            calConfig = p->calSensors;
+        }
+    }
+    len = configStore_get(CONFIG_KEY_POLICY, name, sizeof(name) - 1);
+    if (len > 0) {
+        name[(len < (int)sizeof(name)) ? len : (int)sizeof(name) - 1] = 0;
+        const ConfigPolicy_t *p = configPolicy_find(name);
+        if (p != 0) {
+            applyPolicy(p);
+        }
+    }
+
+    // The table as saved, shell edits included
+    len = configStore_get(CONFIG_KEY_SUBS, sub, sizeof(sub));
+    if ((len > 0) && (len % sizeof(WarmSub_t) == 0) && (len <= (int)sizeof(sub))) {
+        taskENTER_CRITICAL();
+        memset(subscriptions, 0, sizeof(subscriptions));
+        for (int n = 0; n < len / (int)sizeof(WarmSub_t); n++) {
+            subscriptions[n].sensorId = sub[n].sensorId;
+            subscriptions[n].reportInterval_us = sub[n].reportInterval_us;
+            subscriptions[n].batchInterval_us = sub[n].batchInterval_us;
+            subscriptions[n].changeSensitivity = sub[n].changeSensitivity;
+            subscriptions[n].wakeup = sub[n].wakeup;
+            subscriptions[n].dirty = (sub[n].sensorId != 0);
+        }
+        taskEXIT_CRITICAL();
+    }
+
+    if (configStore_get(CONFIG_KEY_CAL, &cal, sizeof(cal)) == sizeof(cal)) {
+        calConfig = cal;
+    }
+    if (configStore_get(CONFIG_KEY_TUNE, &tune, sizeof(tune)) == sizeof(tune)) {
+        sensorTune_setTarget(tune.target, tune.bytes != 0);
+    }
+}
+
+// Shell command: save the running configuration as the startup one,
+// erase it, or show what is saved.
+static void configCmd(int argc, char *argv[])
+{
+    int status = SH2_OK;
+
+    if ((argc > 1) && (strcmp(argv[1], "save") == 0)) {
+        WarmSub_t sub[MAX_SUBSCRIPTIONS];
+        StoredTune_t tune;
+        bool bytes;
+        uint8_t cal = calConfig;
+        int n = 0;
+
+        memset(sub, 0, sizeof(sub));
+        taskENTER_CRITICAL();
+        for (int m = 0; m < MAX_SUBSCRIPTIONS; m++) {
+            const Subscription_t *s = &subscriptions[m];
+
+            if ((s->sensorId != 0) && (s->reportInterval_us != 0)) {
+                sub[n].sensorId = (uint8_t)s->sensorId;
+                sub[n].reportInterval_us = s->reportInterval_us;
+                sub[n].batchInterval_us = s->batchInterval_us;
+                sub[n].changeSensitivity = s->changeSensitivity;
+                sub[n].wakeup = s->wakeup;
+                n++;
+            }
+        }
+        taskEXIT_CRITICAL();
+        memset(&tune, 0, sizeof(tune));
+        tune.target = sensorTune_target(&bytes);
+        tune.bytes = bytes;
+
+        status = configStore_put(CONFIG_KEY_PROFILE, activeProfile->name, strlen(activeProfile->name));
+        if (status == SH2_OK) {
+            status = configStore_put(CONFIG_KEY_POLICY, activePolicy->name, strlen(activePolicy->name));
+        }
+        if (status == SH2_OK) {
+            status = configStore_put(CONFIG_KEY_SUBS, sub, n * sizeof(WarmSub_t));
+        }
+        if (status == SH2_OK) {
+            status = configStore_put(CONFIG_KEY_CAL, &cal, sizeof(cal));
+        }
+        if (status == SH2_OK) {
+            status = configStore_put(CONFIG_KEY_TUNE, &tune, sizeof(tune));
+        }
+    }
+    else if ((argc > 1) && (strcmp(argv[1], "erase") == 0)) {
+        status = configStore_erase();
+    }
     if (status != SH2_OK) {
-        printf("Error: %d, from sh2_setCalConfig() in configureForHmd.\n", status);
+        printf("Error: %d, writing the config store.\n", status);
+    }
+
+    char name[WARM_BOOT_NAME_LEN];
+    uint32_t used, records, compactions;
+    int len;
+
+    configStore_usage(&used, &records, &compactions);
+    printf("Config store: %u of %u bytes used, %u records, %u compactions.\n",
+           used, CONFIG_STORE_SECTOR_LEN, records, compactions);
+    len = configStore_get(CONFIG_KEY_PROFILE, name, sizeof(name) - 1);
+    if (len > 0) {
+        name[(len < (int)sizeof(name)) ? len : (int)sizeof(name) - 1] = 0;
+        printf("  profile %s\n", name);
+    }
+    len = configStore_get(CONFIG_KEY_POLICY, name, sizeof(name) - 1);
+    if (len > 0) {
+        name[(len < (int)sizeof(name)) ? len : (int)sizeof(name) - 1] = 0;
+        printf("  policy %s\n", name);
+    }
+    len = configStore_get(CONFIG_KEY_SUBS, 0, 0);
+    if (len >= 0) {
+        printf("  %u subscriptions\n", (unsigned)(len / sizeof(WarmSub_t)));
+    }
+}
+#endif
+
+// Replace the subscription table with profile p's.  Entries the profile
+// doesn't have are disabled (and dropped once the hub has been told).
+static void loadProfile(const ConfigProfile_t *p)
+{
+    taskENTER_CRITICAL();
+    for (int n = 0; n < MAX_SUBSCRIPTIONS; n++) {
+        if (subscriptions[n].sensorId != 0) {
+            subscriptions[n].reportInterval_us = 0;
+            subscriptions[n].dirty = true;
+        }
+    }
+    for (int m = 0; (m < CONFIG_PROFILE_SUBS) && (p->sub[m].sensorId != 0); m++) {
+        int slot = -1;
+
+        for (int n = 0; n < MAX_SUBSCRIPTIONS; n++) {
+            if (subscriptions[n].sensorId == p->sub[m].sensorId) {
+                slot = n;
+                break;
+            }
+            if ((slot < 0) && (subscriptions[n].sensorId == 0)) {
+                slot = n;
+            }
+        }
+        if (slot >= 0) {
+            subscriptions[slot].sensorId = p->sub[m].sensorId;
+            subscriptions[slot].reportInterval_us = p->sub[m].reportInterval_us;
+            subscriptions[slot].batchInterval_us = p->sub[m].batchInterval_us;
+            subscriptions[slot].changeSensitivity = 0;
+            subscriptions[slot].wakeup = false;
+            subscriptions[slot].dirty = true;
+            subscriptions[slot].granted_us = 0;
+            subscriptions[slot].grantedBatch_us = 0;
+        }
+    }
+    taskEXIT_CRITICAL();
+}
+
+// Switch to profile p at run time.  Called from the demo task.
+static int applyProfile(const ConfigProfile_t *p)
+{
+    activeProfile = p;
+    calConfig = p->calSensors;
+    configureHub(p);
+    loadProfile(p);
+    applySubscriptions(false);
+    sensorOutput_setMode(p->output);
+    power_setMode(p->power);
+
+    // Profiles are sent as they are, but one that can't stream is noticed
+    SensorBudget_t budget;
+    planBudget(&budget, 0);
+    if (sensorBudget_over(&budget)) {
+        printf("Profile %s over budget: ", p->name);
+        printBudget(&budget);
     }
+
+    return SH2_OK;
 }
 
 static void startReports(void)
+{
+    printf("Starting Sensor Reports.\n");
+
+    applySubscriptions(true);
+}
+
+// Send subscription table entries to the hub.
+// (all: every entry, as after a reset; otherwise only the edited ones.)
+static void applySubscriptions(bool all)
+{
+    Subscription_t sub;
+        
+    for (int n = 0; n < MAX_SUBSCRIPTIONS; n++) {
+        // Take a consistent copy of the entry
+        taskENTER_CRITICAL();
+        sub = subscriptions[n];
+        subscriptions[n].dirty = false;
+        if (subscriptions[n].reportInterval_us == 0) {
+            // Disabled entries are dropped once the hub has been told
+            subscriptions[n].sensorId = 0;
+        }
+        taskEXIT_CRITICAL();
+
+        if ((sub.sensorId == 0) || !(all || sub.dirty)) {
+            continue;
+        }
+        if (all && (sub.reportInterval_us == 0)) {
+            // Nothing running after a reset, nothing to disable
+            continue;
+        }
+        if (deepSleep.asleep && !sub.wakeup) {
+            // Edited in deep sleep: sent on waking
+            continue;
+        }
+
+        configureSensor(sub.sensorId, runInterval(&sub), sub.batchInterval_us,
+                        sub.changeSensitivity, sub.wakeup);
+    }
+
+    updatePowerInterval();
+    checkRing();
+    saveWarm();
+}
+
+// Interval to run a subscription at: slower while the rate governor
+// finds the device still, and while consumers fall behind, except for
+// wakeup subscriptions
+static uint32_t runInterval(const Subscription_t *sub)
+{
+    if (sub->wakeup) {
+        return sub->reportInterval_us;
+    }
+    return sensorDispatch_interval(sub->sensorId,
+                                   sensorRate_interval(sub->sensorId, sub->reportInterval_us));
+}
+
+// Interval a subscription's reports actually come at: as granted by the
+// hub, or as asked for until it has said
+static uint32_t liveInterval(const Subscription_t *sub)
+{
+    return (sub->granted_us != 0) ? sub->granted_us : runInterval(sub);
+}
+
+// Rate governor, sensitivity tuner and backpressure callback, in the
+// sensor or shell task
+static void rateChanged(void)
+{
+    ratesChanged = true;
+    xSemaphoreGive(wakeDemoTask);
+}
+
+// Resend the running subscriptions at the governor's intervals.
+// Called from the demo task.
+static void applyRates(void)
+{
+    Subscription_t sub;
+
+    if (deepSleep.asleep) {
+        // Waking resends them all anyway
+        return;
+    }
+
+    for (int n = 0; n < MAX_SUBSCRIPTIONS; n++) {
+        taskENTER_CRITICAL();
+        sub = subscriptions[n];
+        taskEXIT_CRITICAL();
+
+        if ((sub.sensorId == 0) || (sub.reportInterval_us == 0) || sub.wakeup) {
+            continue;
+        }
+        configureSensor(sub.sensorId, runInterval(&sub), sub.batchInterval_us,
+                        sub.changeSensitivity, false);
+    }
+
+    updatePowerInterval();
+}
+
+// Send one sensor's configuration to the hub.  Wakeup sensors are also
+// always on: they keep running and report while the host sleeps.
+static int configureSensor(int sensorId, uint32_t interval_us, uint32_t batch_us,
+                           uint16_t sensitivity, bool wakeup)
 {
     static sh2_SensorConfig_t config;
     int status;
-    int sensorId;
-        
-    printf("Starting Sensor Reports.\n");
 
-    config.changeSensitivityEnabled = false;
-    config.wakeupEnabled = false;
+    if (!wakeup) {
+        // Raised by the tuner to meet its bandwidth target
+        sensitivity = sensorTune_sensitivity(sensorId, sensitivity);
+    }
+
+    config.changeSensitivityEnabled = (sensitivity != 0);
+    config.wakeupEnabled = wakeup;
     config.changeSensitivityRelative = false;
-    config.alwaysOnEnabled = false;
-    config.changeSensitivity = 0;
-    config.reportInterval_us = 10000;  // microseconds (100Hz)
-    // config.reportInterval_us = 1000;   // microseconds (1000Hz)
-    config.batchInterval_us = 0;
-
-    sensorId = SH2_LINEAR_ACCELERATION;
-    // sensorId = SH2_GYRO_INTEGRATED_RV;
+    config.alwaysOnEnabled = wakeup;
+    config.changeSensitivity = sensitivity;
+    config.reportInterval_us = interval_us;
+    config.batchInterval_us = configPolicy_batch(activePolicy, batch_us);
+
+    uint64_t start_uS = latency_cmdStart();
     status = sh2_setSensorConfig(sensorId, &config);
+    latency_cmd(LAT_CMD_SENSOR_CONFIG, start_uS);
     if (status != 0) {
         printf("Error while enabling sensor %d\n", sensorId);
     }
-    // Add second reporting
-    sensorId = SH2_GEOMAGNETIC_ROTATION_VECTOR;
-    // sensorId = SH2_GYRO_INTEGRATED_RV;
-    status = sh2_setSensorConfig(sensorId, &config);
-    if (status != 0) {
-        printf("Error while enabling sensor %d\n", sensorId);
+    else if (!recovery.deferReadBack) {
+        readBack(sensorId, interval_us, config.batchInterval_us);
     }
-    
-    // Add second reporting
-    sensorId = SH2_GYROSCOPE_CALIBRATED;
-    // sensorId = SH2_GYRO_INTEGRATED_RV;
-    status = sh2_setSensorConfig(sensorId, &config);
-    if (status != 0) {
-        printf("Error while enabling sensor %d\n", sensorId);
+
+    return status;
+}
+
+// Record the interval the hub granted sensorId, asked for interval_us
+// and batch_us, in its subscription and the statistics
+static void readBack(int sensorId, uint32_t interval_us, uint32_t batch_us)
+{
+    uint32_t granted_us = interval_us;
+    uint32_t grantedBatch_us = batch_us;
+
+#if SENSOR_READBACK
+    static sh2_SensorConfig_t actual;
+
+    if (interval_us != 0) {
+        uint64_t start_uS = latency_cmdStart();
+        int status = sh2_getSensorConfig(sensorId, &actual);
+        latency_cmd(LAT_CMD_GET_SENSOR_CONFIG, start_uS);
+        if (status == SH2_OK) {
+            granted_us = actual.reportInterval_us;
+            grantedBatch_us = actual.batchInterval_us;
+        }
     }
-    
+#endif
+
+    bool differs = false;
+    taskENTER_CRITICAL();
+    for (int n = 0; n < MAX_SUBSCRIPTIONS; n++) {
+        if (subscriptions[n].sensorId == sensorId) {
+            // Only news once per change of grant
+            differs = (granted_us != interval_us) && (granted_us != subscriptions[n].granted_us);
+            subscriptions[n].granted_us = granted_us;
+            subscriptions[n].grantedBatch_us = grantedBatch_us;
+        }
+    }
+    taskEXIT_CRITICAL();
+
+    if (differs) {
+        printf("Sensor %d granted %u us (asked %u us)\n",
+               sensorId, (unsigned)granted_us, (unsigned)interval_us);
+    }
+    sensorStats_setInterval(sensorId, granted_us);
 }
 
-static void printDsfHeaders(void)
+// Read back the running subscriptions, as configureSensor() would have
+// but for recovery.deferReadBack
+static void readBackAll(void)
 {
-    printf("+%d TIME[x]{s}, SAMPLE_ID[x]{samples}, ANG_POS_GLOBAL[rijk]{quaternion}, ANG_POS_ACCURACY[x]{rad}\n",
-           SH2_ROTATION_VECTOR);
-    printf("+%d TIME[x]{s}, SAMPLE_ID[x]{samples}, RAW_ACCELEROMETER[xyz]{adc units}\n",
-           SH2_RAW_ACCELEROMETER);
-    printf("+%d TIME[x]{s}, SAMPLE_ID[x]{samples}, RAW_MAGNETOMETER[xyz]{adc units}\n",
-           SH2_RAW_MAGNETOMETER);
-    printf("+%d TIME[x]{s}, SAMPLE_ID[x]{samples}, RAW_GYROSCOPE[xyz]{adc units}\n",
-           SH2_RAW_GYROSCOPE);
-    printf("+%d TIME[x]{s}, SAMPLE_ID[x]{samples}, ACCELEROMETER[xyz]{m/s^2}\n",
-           SH2_ACCELEROMETER);
-    printf("+%d TIME[x]{s}, SAMPLE_ID[x]{samples}, MAG_FIELD[xyz]{uTesla}, STATUS[x]{enum}\n",
-           SH2_MAGNETIC_FIELD_CALIBRATED);
-    printf("+%d TIME[x]{s}, ANG_VEL_GYRO_RV[xyz]{rad/s}, ANG_POS_GYRO_RV[wxyz]{quaternion}\n",
-           SH2_GYRO_INTEGRATED_RV);
+    Subscription_t sub;
+
+    for (int n = 0; n < MAX_SUBSCRIPTIONS; n++) {
+        taskENTER_CRITICAL();
+        sub = subscriptions[n];
+        taskEXIT_CRITICAL();
+
+        if ((sub.sensorId == 0) || (sub.reportInterval_us == 0) ||
+            (deepSleep.asleep && !sub.wakeup)) {
+            continue;
+        }
+        readBack(sub.sensorId, runInterval(&sub),
+                 configPolicy_batch(activePolicy, sub.batchInterval_us));
+    }
 }
 
-static void printDsf(const sh2_SensorEvent_t * event)
+// Warn if a hub FIFO drain of the granted batches can outgrow the ring
+static void checkRing(void)
 {
-    float t, r, i, j, k, acc_rad;
-    float angVelX, angVelY, angVelZ;
-    static uint32_t lastSequence[SH2_MAX_SENSOR_ID+1];  // last sequence number for each sensor
-    sh2_SensorValue_t value;
+    uint32_t burst = 0;
 
-    // Convert event to value
-    sh2_decodeSensorEvent(&value, event);
-    
-    // Compute new sample_id
-    uint8_t deltaSeq = value.sequence - (lastSequence[value.sensorId] & 0xFF);
-    lastSequence[value.sensorId] += deltaSeq;
+    for (int n = 0; n < MAX_SUBSCRIPTIONS; n++) {
+        const Subscription_t *sub = &subscriptions[n];
 
-    // Get time as float
-    t = value.timestamp / 1000000.0;
-    
-    switch (value.sensorId) {
-        case SH2_RAW_ACCELEROMETER:
-            printf(".%d %0.6f, %d, %d, %d, %d\n",
-                   SH2_RAW_ACCELEROMETER,
-                   t,
-                   lastSequence[value.sensorId],
-                   value.un.rawAccelerometer.x,
-                   value.un.rawAccelerometer.y,
-                   value.un.rawAccelerometer.z);
-            break;
-        
-        case SH2_RAW_MAGNETOMETER:
-            printf(".%d %0.6f, %d, %d, %d, %d\n",
-                   SH2_RAW_MAGNETOMETER,
-                   t,
-                   lastSequence[value.sensorId],
-                   value.un.rawMagnetometer.x,
-                   value.un.rawMagnetometer.y,
-                   value.un.rawMagnetometer.z);
-            break;
-        
-        case SH2_RAW_GYROSCOPE:
-            printf(".%d %0.6f, %d, %d, %d, %d\n",
-                   SH2_RAW_GYROSCOPE,
-                   t,
-                   lastSequence[value.sensorId],
-                   value.un.rawGyroscope.x,
-                   value.un.rawGyroscope.y,
-                   value.un.rawGyroscope.z);
-            break;
+        if ((sub->sensorId != 0) && (sub->granted_us != 0) && (sub->grantedBatch_us != 0)) {
+            burst += sub->grantedBatch_us / sub->granted_us + 1;
+        }
+    }
+    if (burst > SENSOR_RING_LEN) {
+        printf("Batches of up to %u events, sensor ring holds %u: raise SENSOR_RING_LEN\n",
+               (unsigned)burst, (unsigned)SENSOR_RING_LEN);
+    }
+}
 
-        case SH2_MAGNETIC_FIELD_CALIBRATED:
-            printf(".%d %0.6f, %d, %0.3f, %0.3f, %0.3f, %u\n",
-                   SH2_MAGNETIC_FIELD_CALIBRATED,
-                   t,
-                   lastSequence[value.sensorId],
-                   value.un.magneticField.x,
-                   value.un.magneticField.y,
-                   value.un.magneticField.z,
-                   value.status & 0x3
-                );
-            break;
-        
-        case SH2_ACCELEROMETER:
-            printf(".%d %0.6f, %d, %0.3f, %0.3f, %0.3f\n",
-                   SH2_ACCELEROMETER,
-                   t,
-                   lastSequence[value.sensorId],
-                   value.un.accelerometer.x,
-                   value.un.accelerometer.y,
-                   value.un.accelerometer.z);
-            break;
-               
-        case SH2_ROTATION_VECTOR:
-            r = value.un.rotationVector.real;
-            i = value.un.rotationVector.i;
-            j = value.un.rotationVector.j;
-            k = value.un.rotationVector.k;
-            acc_rad = value.un.rotationVector.accuracy;
-            printf(".%d %0.6f, %d, %0.3f, %0.3f, %0.3f, %0.3f, %0.3f\n",
-                   SH2_ROTATION_VECTOR,
-                   t,
-                   lastSequence[value.sensorId],
-                   r, i, j, k,
-                   acc_rad);
-            break;
-        
-        case SH2_GYRO_INTEGRATED_RV:
-            angVelX = value.un.gyroIntegratedRV.angVelX;
-            angVelY = value.un.gyroIntegratedRV.angVelY;
-            angVelZ = value.un.gyroIntegratedRV.angVelZ;
-            r = value.un.gyroIntegratedRV.real;
-            i = value.un.gyroIntegratedRV.i;
-            j = value.un.gyroIntegratedRV.j;
-            k = value.un.gyroIntegratedRV.k;
-            printf(".%d %0.6f, %0.6f, %0.6f, %0.6f, %0.6f, %0.6f, %0.6f, %0.6f\n",
-                   SH2_GYRO_INTEGRATED_RV,
-                   t,
-                   angVelX, angVelY, angVelZ,
-                   r, i, j, k);
+// Tell the power profile how often the hub will deliver: a batched
+// sensor only at its batch interval, and in deep sleep only the wakeup
+// sensors.
+static void updatePowerInterval(void)
+{
+    uint32_t interval_us = 0;
+
+    for (int n = 0; n < MAX_SUBSCRIPTIONS; n++) {
+        const Subscription_t *sub = &subscriptions[n];
+
+        if ((sub->sensorId == 0) || (sub->reportInterval_us == 0) ||
+            (deepSleep.asleep && !sub->wakeup)) {
+            continue;
+        }
+        uint32_t run_us = liveInterval(sub);
+        uint32_t batch_us = (sub->granted_us != 0) ? sub->grantedBatch_us :
+                            configPolicy_batch(activePolicy, sub->batchInterval_us);
+        uint32_t every_us = (batch_us > run_us) ? batch_us : run_us;
+        if ((interval_us == 0) || (every_us < interval_us)) {
+            interval_us = every_us;
+        }
+    }
+
+    power_setSensorInterval(interval_us);
+#if defined(SH2_HAL_I2C) && SH2_HAL_I2C_POLL
+    // A hub without INTN is polled at the same interval
+    sh2_hal_i2cSetPollInterval(interval_us);
+#endif
+}
+
+// Shell command: list subscriptions or add/modify/remove one.
+static void subCmd(int argc, char *argv[])
+{
+    if (argc == 1) {
+        for (int n = 0; n < MAX_SUBSCRIPTIONS; n++) {
+            if (subscriptions[n].sensorId != 0) {
+                printf("  sensor %d: interval %u us, batch %u us, sensitivity %u%s",
+                       subscriptions[n].sensorId,
+                       subscriptions[n].reportInterval_us,
+                       subscriptions[n].batchInterval_us,
+                       subscriptions[n].changeSensitivity,
+                       subscriptions[n].wakeup ? ", wakeup" : "");
+                if (subscriptions[n].granted_us != 0) {
+                    printf(" (granted %u us, batch %u us)",
+                           (unsigned)subscriptions[n].granted_us,
+                           (unsigned)subscriptions[n].grantedBatch_us);
+                }
+                printf("\n");
+            }
+        }
+
+        SensorBudget_t budget;
+        planBudget(&budget, 0);
+        printf("  budget: ");
+        printBudget(&budget);
+        return;
+    }
+
+    if ((argc == 2) && (strcmp(argv[1], "dsf") == 0)) {
+        subscribeDsf();
+        return;
+    }
+
+    // A trailing "wake" makes it a wakeup subscription (see "sleep")
+    bool wakeup = (argc > 3) && (strcmp(argv[argc-1], "wake") == 0);
+    if (wakeup) {
+        argc--;
+    }
+
+    if ((argc < 3) || (argc > 5)) {
+        printf("usage: %s <sensor> <interval us> [batch us] [sensitivity] [wake]\n", argv[0]);
+        return;
+    }
+
+    int sensorId = strtol(argv[1], 0, 0);
+    if ((sensorId <= 0) || (sensorId > SH2_MAX_SENSOR_ID)) {
+        printf("Invalid sensor id: %s\n", argv[1]);
+        return;
+    }
+
+    Subscription_t sub;
+    sub.sensorId = sensorId;
+    sub.reportInterval_us = strtoul(argv[2], 0, 0);
+    sub.batchInterval_us = (argc > 3) ? strtoul(argv[3], 0, 0) : 0;
+    sub.changeSensitivity = (argc > 4) ? strtoul(argv[4], 0, 0) : 0;
+    sub.wakeup = wakeup;
+    sub.dirty = true;
+
+    if (setSubscription(&sub) == -1) {
+        printf("Subscription table full.\n");
+    }
+}
+
+// Set up a DSF capture: subscribe exactly the sensors the DSF table in
+// sensor_output.c logs, at its rates, and nothing else, then switch the
+// output to DSF.  Sensors are dropped before the output changes and
+// added after, so the budget is planned for DSF without them.
+static void subscribeDsf(void)
+{
+    unsigned logged = 0;
+
+    for (int id = 1; id <= SH2_MAX_SENSOR_ID; id++) {
+        if ((sensorOutput_dsfInterval(id) == 0) && (sensorApp_interval(id) != 0)) {
+            sensorApp_subscribe(id, 0);
+        }
+    }
+
+    // Disabled entries keep their slots until the demo task takes them
+    TickType_t start = xTaskGetTickCount();
+    while (subscriptionsChanged &&
+           (xTaskGetTickCount() - start < pdMS_TO_TICKS(HUB_REQ_TIMEOUT_MS))) {
+        vTaskDelay(1);
+    }
+
+    sensorOutput_setMode(OUTPUT_DSF);
+
+    for (int id = 1; id <= SH2_MAX_SENSOR_ID; id++) {
+        uint32_t interval_us = sensorOutput_dsfInterval(id);
+        if (interval_us == 0) {
+            continue;
+        }
+        int status = sensorApp_subscribe(id, interval_us);
+        if (status == -1) {
+            printf("Subscription table full.\n");
             break;
-        default:
-            printf("Unknown sensor: %d\n", value.sensorId);
+        }
+        if (status == 0) {
+            logged++;
+        }
+    }
+
+    printf("DSF capture: %u sensors.\n", logged);
+}
+
+// Plan the subscription table against the hub bus and console as they
+// are set now, with pSub (if not NULL) in place of its sensor's entry
+static void planBudget(SensorBudget_t *pBudget, const Subscription_t *pSub)
+{
+    uint32_t out = CONSOLE_BAUD / 10;
+#if USB_CDC
+    if (usbCdc_active()) {
+        out = SENSOR_BUDGET_USB_BPS;
+    }
+#endif
+
+#if SH2_APP_ON_I2C
+    sensorBudget_init(pBudget, BUDGET_BUS_I2C, sh2_hal_getI2cSpeed(),
+                      sensorOutput_getMode(), out);
+#else
+    sensorBudget_init(pBudget, BUDGET_BUS_SPI, sh2_hal_spiGetSpeed(),
+                      sensorOutput_getMode(), out);
+#endif
+
+    for (int n = 0; n < MAX_SUBSCRIPTIONS; n++) {
+        const Subscription_t *sub = &subscriptions[n];
+
+        if ((pSub != 0) && (sub->sensorId == pSub->sensorId)) {
+            continue;
+        }
+        if ((sub->sensorId != 0) && (sub->granted_us != 0)) {
+            sensorBudget_add(pBudget, sub->sensorId, sub->granted_us, sub->grantedBatch_us);
+        }
+        else if (sub->sensorId != 0) {
+            sensorBudget_add(pBudget, sub->sensorId, sub->reportInterval_us,
+                             configPolicy_batch(activePolicy, sub->batchInterval_us));
+        }
+    }
+    if (pSub != 0) {
+        // The hub runs no sensor faster than its metadata allows
+        uint32_t interval_us = pSub->reportInterval_us;
+        const SensorMeta_t *m = sensorMeta_get(pSub->sensorId);
+        if ((m != 0) && (interval_us != 0) && (interval_us < m->minPeriod_us)) {
+            interval_us = m->minPeriod_us;
+        }
+        sensorBudget_add(pBudget, pSub->sensorId, interval_us,
+                         configPolicy_batch(activePolicy, pSub->batchInterval_us));
+    }
+}
+
+static void printBudget(const SensorBudget_t *pBudget)
+{
+    printf("hub bus %u of %u B/s (%u%%), output %u of %u B/s (%u%%)\n",
+           (unsigned)pBudget->busLoad, (unsigned)pBudget->busCap,
+           sensorBudget_busPct(pBudget),
+           (unsigned)pBudget->outLoad, (unsigned)pBudget->outCap,
+           sensorBudget_outPct(pBudget));
+}
+
+// Update the sensor's entry, or take a free one, and have the demo task
+// apply it.  Returns -1 if the table is full.
+static int setSubscription(const Subscription_t *pSub)
+{
+    SensorBudget_t budget;
+    int slot = -1;
+
+    // Catch a table the links can't carry before the hub sees it
+    planBudget(&budget, pSub);
+    if (sensorBudget_over(&budget)) {
+        printf("Sensor %d over budget: ", pSub->sensorId);
+        printBudget(&budget);
+        if (SENSOR_BUDGET_REJECT) {
+            return -2;
+        }
+    }
+
+    taskENTER_CRITICAL();
+    for (int n = 0; n < MAX_SUBSCRIPTIONS; n++) {
+        if (subscriptions[n].sensorId == pSub->sensorId) {
+            slot = n;
             break;
+        }
+        if ((slot < 0) && (subscriptions[n].sensorId == 0)) {
+            slot = n;
+        }
+    }
+    if (slot >= 0) {
+        subscriptions[slot] = *pSub;
+        subscriptions[slot].granted_us = 0;
+        subscriptions[slot].grantedBatch_us = 0;
     }
+    taskEXIT_CRITICAL();
+
+    if (slot < 0) {
+        return -1;
+    }
+
+    // Demo task owns the SH-2 API, let it apply the change.
+    subscriptionsChanged = true;
+    xSemaphoreGive(wakeDemoTask);
+
+    return 0;
+}
+
+// True if sensorId has a wakeup subscription
+static bool isWakeup(uint8_t sensorId)
+{
+    for (int n = 0; n < MAX_SUBSCRIPTIONS; n++) {
+        if ((subscriptions[n].sensorId == sensorId) && subscriptions[n].wakeup &&
+            (subscriptions[n].reportInterval_us != 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// True if any subscription is an enabled wakeup one
+static bool isWakeupAny(void)
+{
+    for (int n = 0; n < MAX_SUBSCRIPTIONS; n++) {
+        if ((subscriptions[n].sensorId != 0) && subscriptions[n].wakeup &&
+            (subscriptions[n].reportInterval_us != 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// How long the demo task may wait before deep sleep falls due
+static TickType_t sleepWait(void)
+{
+    if (!deepSleep.enabled || deepSleep.asleep) {
+        return portMAX_DELAY;
+    }
+
+    TickType_t idle = pdMS_TO_TICKS(deepSleep.idle_ms);
+    TickType_t since = xTaskGetTickCount() - deepSleep.lastWake_tick;
+    return (since < idle) ? idle - since : 0;
 }
 
-static void printEvent(const sh2_SensorEvent_t * event)
+// Disable every subscription but the wakeup ones, and let the MCU STOP.
+// Called from the demo task.
+static void sleepEnter(void)
 {
-    int rc;
-    sh2_SensorValue_t value;
-    float scaleRadToDeg = 180.0 / 3.14159265358;
-    float r, i, j, k, acc_deg, x, y, z, acc_rad;
-    float t;
+    Subscription_t sub;
 
-    rc = sh2_decodeSensorEvent(&value, event);
+    if (!isWakeupAny()) {
+        printf("Deep sleep off: no wakeup subscription left.\n");
+        deepSleep.enabled = false;
+        return;
+    }
+
+    // Empty the hub FIFO first, so no batch is held over the sleep
+    int rc = flushHub(0, 0);
     if (rc != SH2_OK) {
-        printf("Error decoding sensor event: %d\n", rc);
+        printf("Error: %d, flushing the hub FIFO before sleep\n", rc);
+    }
+
+    // From here a wakeup report ends it, even one that beats the
+    // reconfiguration back
+    deepSleep.woken = false;
+    deepSleep.asleep = true;
+    deepSleep.sleepStart_uS = timebase_getUs();
+    deepSleep.sleeps++;
+    printf("Deep sleep: streams stopped.\n");
+
+    for (int n = 0; n < MAX_SUBSCRIPTIONS; n++) {
+        taskENTER_CRITICAL();
+        sub = subscriptions[n];
+        taskEXIT_CRITICAL();
+
+        if ((sub.sensorId == 0) || (sub.reportInterval_us == 0)) {
+            continue;
+        }
+        if (sub.wakeup) {
+            // Again: this re-arms one-shot sensors (significant motion)
+            configureSensor(sub.sensorId, sub.reportInterval_us, sub.batchInterval_us,
+                            sub.changeSensitivity, true);
+        }
+        else {
+            configureSensor(sub.sensorId, 0, 0, 0, false);
+        }
+    }
+
+    deepSleep.awakePower = power_getMode();
+    power_setMode(POWER_MODE_STOP);
+    updatePowerInterval();
+}
+
+// End deep sleep.  resume: resend the subscription table (not needed
+// after a hub reset, whose recovery does it).  Called from the demo task.
+static void sleepLeave(bool resume)
+{
+    deepSleep.asleep = false;
+    deepSleep.woken = false;
+    deepSleep.lastWake_tick = xTaskGetTickCount();
+    deepSleep.asleep_us += timebase_getUs() - deepSleep.sleepStart_uS;
+    power_setMode(deepSleep.awakePower);
+
+    if (resume) {
+        printf("Deep sleep: woken, streaming.\n");
+        applySubscriptions(true);
+    }
+}
+
+// Shell command: turn deep sleep on or off, or show it.
+static void sleepCmd(int argc, char *argv[])
+{
+    if (argc > 1) {
+        if (strcmp(argv[1], "off") == 0) {
+            deepSleep.enabled = false;
+        }
+        else if ((strcmp(argv[1], "on") == 0) || (strcmp(argv[1], "now") == 0)) {
+            bool now = (strcmp(argv[1], "now") == 0);
+
+            if (!isWakeupAny()) {
+                printf("No wakeup subscription: sub <sensor> <interval us> ... wake\n");
+                return;
+            }
+            if (!now && (argc > 2)) {
+                deepSleep.idle_ms = strtoul(argv[2], 0, 0) * 1000;
+            }
+            deepSleep.lastWake_tick = xTaskGetTickCount();
+            if (now) {
+                // "now": as if the last wakeup report was idle_ms ago
+                deepSleep.lastWake_tick -= pdMS_TO_TICKS(deepSleep.idle_ms);
+            }
+            deepSleep.enabled = true;
+        }
+        else {
+            printf("usage: %s [on [idle s] | off | now]\n", argv[0]);
+            return;
+        }
+
+        // Demo task owns the SH-2 API, let it enter or leave
+        xSemaphoreGive(wakeDemoTask);
         return;
     }
 
-    t = value.timestamp / 1000000.0;  // time in seconds.
-    
-    switch (value.sensorId) {
-        case SH2_RAW_ACCELEROMETER:
-            printf("Raw acc: %d %d %d\n",
-                   value.un.rawAccelerometer.x,
-                   value.un.rawAccelerometer.y, value.un.rawAccelerometer.z);
+    uint64_t asleep_us = deepSleep.asleep_us;
+    if (deepSleep.asleep) {
+        asleep_us += timebase_getUs() - deepSleep.sleepStart_uS;
+    }
+    printf("Deep sleep %s after %u s without a wakeup report, %s\n",
+           deepSleep.enabled ? "on" : "off", (unsigned)(deepSleep.idle_ms / 1000),
+           deepSleep.asleep ? "asleep" : "streaming");
+    printf("  %u sleeps, %u s asleep\n",
+           (unsigned)deepSleep.sleeps, (unsigned)(asleep_us / 1000000));
+}
+
+// Calibration manager callback, in the sensor task
+static void calSaveRequest(void)
+{
+    calSaveRequested = true;
+    xSemaphoreGive(wakeDemoTask);
+}
+
+// Save the DCD for the calibration manager.  Called from the demo task.
+static void calSave(void)
+{
+    uint64_t start_uS = latency_cmdStart();
+    int status = sh2_saveDcdNow();
+    latency_cmd(LAT_CMD_SAVE_DCD, start_uS);
+    if (status != SH2_OK) {
+        printf("Error: %d, from sh2_saveDcdNow()\n", status);
+    }
+    sensorCal_saved(status);
+}
+
+// Shell command: list the configuration profiles, or switch to one.
+static void profileCmd(int argc, char *argv[])
+{
+    if (argc > 1) {
+        const ConfigProfile_t *p = configProfile_find(argv[1]);
+        if (p == 0) {
+            printf("No profile %s.\n", argv[1]);
+            return;
+        }
+
+        static HubRequest_t req;
+        req.op = HUB_REQ_PROFILE;
+        req.profile = p;
+        int status = hubRequest(&req);
+        if (status != SH2_OK) {
+            printf("Error: %d, switching to profile %s\n", status, p->name);
+        }
+        return;
+    }
+
+    for (unsigned n = 0; n < configProfile_count(); n++) {
+        const ConfigProfile_t *p = configProfile_get(n);
+        printf("%c %-10s %s\n", (p == activeProfile) ? '*' : ' ', p->name, p->description);
+    }
+}
+
+// Switch the host side to policy p: HAL, output and console settings
+// take effect at once, batching as the subscriptions are resent.
+static void applyPolicy(const ConfigPolicy_t *p)
+{
+    activePolicy = p;
+
+#if SH2_APP_ON_I2C
+    sh2_hal_setI2cSpeed(p->i2cHz);
+#endif
+#ifdef SH2_HAL_SPI
+#if SH2_HAL_SPI_MODERATE
+    sh2_hal_spiSetModeration(p->spiModerate_us);
+#endif
+    sh2_hal_spiSetWake(p->spiWake, SH2_HAL_SPI_WAKE_HOLD_US);
+#endif
+    if (p->setOutput) {
+        sensorOutput_setMode(p->output);
+    }
+    console_setTxPolicy(p->consoleTx);
+
+    // Demo task owns the SH-2 API: have it resend what is running
+    taskENTER_CRITICAL();
+    for (int n = 0; n < MAX_SUBSCRIPTIONS; n++) {
+        if ((subscriptions[n].sensorId != 0) && (subscriptions[n].reportInterval_us != 0)) {
+            subscriptions[n].dirty = true;
+        }
+    }
+    taskEXIT_CRITICAL();
+    subscriptionsChanged = true;
+    xSemaphoreGive(wakeDemoTask);
+}
+
+// Shell command: list the runtime policies, or switch to one.
+static void policyCmd(int argc, char *argv[])
+{
+    if (argc > 1) {
+        const ConfigPolicy_t *p = configPolicy_find(argv[1]);
+        if (p == 0) {
+            printf("No policy %s.\n", argv[1]);
+            return;
+        }
+        applyPolicy(p);
+        return;
+    }
+
+    for (unsigned n = 0; n < configPolicy_count(); n++) {
+        const ConfigPolicy_t *p = configPolicy_get(n);
+        printf("%c %-10s %s\n", (p == activePolicy) ? '*' : ' ', p->name, p->description);
+    }
+}
+
+#if defined(PERFORM_DFU) || DFU_CONSOLE
+// Check image, then update the hub from it.  A failed update is tried
+// again, from the start: the bootloader can't pick up mid-image.
+static int dfuRun(const HcBinEx_t *image, bool readImage)
+{
+    int status = SH2_OK;
+
+#if DFU_VERIFY
+    status = firmwareCheck_verify(image, readImage);
+    if (status != SH2_OK) {
+        // Nothing sent, the hub keeps its firmware
+        printf("DFU skipped, image failed its check.\n");
+        return status;
+    }
+#endif
+
+    // No reports while the hub is in its bootloader
+    sensorWatch_hold(true);
+    uint32_t devMask = (1u << sh2_hal_numDevices()) - 1;
+    for (int tries = 0; tries < DFU_TRIES; tries++) {
+        if (tries > 0) {
+            printf("Retrying DFU.\n");
+        }
+        status = dfuHubs(&image->hcbin, &devMask);
+        dfuReport(status);
+        if (status == SH2_OK) {
+            // New firmware, maybe new metadata and product ids
+            sensorMeta_invalidate();
+            warmBoot_clear();
+            prodIdsValid = false;
             break;
+        }
+    }
+    sensorWatch_hold(false);
+
+    return status;
+}
 
-        case SH2_ACCELEROMETER:
-            printf("Acc: %f %f %f\n",
-                   value.un.accelerometer.x,
-                   value.un.accelerometer.y,
-                   value.un.accelerometer.z);
+// Update the hubs in *pDevMask, leaving in it the ones that failed.
+// With more than one hub they are updated at once, from one read of
+// the image.
+static int dfuHubs(const HcBin_t *image, uint32_t *pDevMask)
+{
+#if DFU_MULTI
+    if (sh2_hal_numDevices() > 1) {
+        DfuMultiResult_t results[SH2_HAL_MAX_DEVICES];
+        int status = dfuMulti_run(image, *pDevMask, results);
+
+        for (unsigned dev = 0; dev < SH2_HAL_MAX_DEVICES; dev++) {
+            if (results[dev].status == SH2_OK) {
+                *pDevMask &= ~(1u << dev);
+            }
+        }
+        return status;
+    }
+#endif
+
+    return dfu(image);
+}
+
+#ifdef PERFORM_DFU
+// Whether to update before starting SH-2: always, or if the boot before
+// found the hub's firmware differs from the image.
+static bool dfuAtBoot(void)
+{
+#if DFU_ALWAYS
+    return true;
+#else
+    if (dfuRequest.magic != DFU_IMAGE_RQ_MAGIC) {
+        // Compared with the hub's firmware once SH-2 is up
+        dfuRequest.tries = 0;
+        return false;
+    }
+
+    dfuRequest.magic = 0;
+    return true;
+#endif
+}
+#endif
+
+#if defined(PERFORM_DFU) && !DFU_ALWAYS
+// Compare the hub's firmware with image, and if they differ, restart to
+// update before SH-2 starts: dfu() takes the HAL over from SHTP, which
+// can't be started a second time.
+static void dfuIfDifferent(const HcBin_t *image)
+{
+    uint64_t start_uS = latency_cmdStart();
+    int status = sh2_getProdIds(&prodIds);
+    latency_cmd(LAT_CMD_PROD_IDS, start_uS);
+    if (status != SH2_OK) {
+        printf("Error: %d, from sh2_getProdIds, DFU skipped.\n", status);
+        return;
+    }
+
+    if (firmwareCheck_matches(image, &prodIds)) {
+        printf("Hub runs the DFU image (%s %s), no update needed.\n",
+               image->getMeta("SW-Part-Number"), image->getMeta("SW-Version"));
+        return;
+    }
+    if (dfuRequest.tries >= DFU_AUTO_TRIES) {
+        printf("Hub firmware still differs from the DFU image, not retrying.\n");
+        return;
+    }
+
+    printf("Hub firmware differs from the DFU image, restarting to update.\n");
+    dfuRequest.magic = DFU_IMAGE_RQ_MAGIC;
+    dfuRequest.tries++;
+    vTaskDelay(100);
+    NVIC_SystemReset();
+}
+#endif
+
+static void dfuReport(int status)
+{
+    printf("DFU completed with status: %d\n", status);
+#ifdef SH2_HAL_SPI
+    {
+        sh2_hal_DfuStats_t stats;
+
+        sh2_hal_getDfuStats(&stats);
+        printf("DFU tx %u pkts/%u bytes, rx %u pkts/%u bytes\n",
+               stats.txPackets, stats.txBytes, stats.rxPackets, stats.rxBytes);
+        printf("DFU time (ms): bus %u, cs gap %u, wait %u, caller %u\n",
+               (unsigned)(stats.busUs / 1000), (unsigned)(stats.gapUs / 1000),
+               (unsigned)(stats.waitUs / 1000), (unsigned)(stats.callerUs / 1000));
+    }
+#elif defined(SH2_HAL_I2C)
+    {
+        sh2_hal_I2cDfuStats_t stats;
+
+        sh2_hal_getI2cDfuStats(&stats);
+        printf("DFU tx %u pkts/%u bytes, rx %u pkts/%u bytes, %u busy NACKs\n",
+               stats.txPackets, stats.txBytes, stats.rxPackets, stats.rxBytes,
+               stats.busyNacks);
+        printf("DFU time (ms): boot %u, tx %u (slowest packet %u us), rx %u, wait %u, caller %u\n",
+               (unsigned)(stats.bootUs / 1000), (unsigned)(stats.txUs / 1000),
+               (unsigned)stats.maxTxUs, (unsigned)(stats.rxUs / 1000),
+               (unsigned)(stats.waitUs / 1000), (unsigned)(stats.callerUs / 1000));
+    }
+#endif
+}
+#endif
+
+#if DFU_CONSOLE
+// Update the hub from the console, then restart the MCU.  Called from the
+// demo task; the shell task is waiting in dfuCmd, so the console input is
+// free.  dfu() takes the HAL from SHTP and leaves the hub in new firmware,
+// so SH-2 starts over with a restart rather than picking up mid-way.
+static void dfuConsole(void)
+{
+    power_setMode(POWER_MODE_OFF);
+
+    // Reading the image to check its CRC would double the transfer, and
+    // each frame is CRC checked as it arrives
+    firmwareStream_setSource(&firmwareConsole);
+    int status = dfuRun(&firmwareStream, false);
+    firmwareConsole_done(status);
+
+    // Let hub flash writes complete and the console drain
+    printf("Restarting.\n");
+    vTaskDelay(100);
+    NVIC_SystemReset();
+}
+
+// Shell command: update hub firmware over the console.
+static void dfuCmd(int argc, char *argv[])
+{
+    printf("Waiting for tools/fwsend.py.\n");
+
+    int status = sensorApp_dfuConsole();
+    printf("Error: %d, starting DFU\n", status);
+}
+#endif
+
+// Shell command: drain the hub FIFO for all batched subscriptions.
+static void flushCmd(int argc, char *argv[])
+{
+    uint32_t reports;
+    uint32_t drain_us;
+    int status = sensorApp_flush(&reports, &drain_us);
+
+    if (status != SH2_OK) {
+        printf("Error: %d, flushing the hub FIFO\n", status);
+        return;
+    }
+    printf("Flushed %u reports in %u us.\n", (unsigned)reports, (unsigned)drain_us);
+}
+
+// Ask the hub to deliver every batched sample now, and wait until it
+// has.  The reports come back through sensorHandler in FIFO order like
+// any other batch, read back to back (SH2_HAL_SPI_BURST).  Drained once
+// each sensor's flush completed report is in, or, should one go
+// missing, FLUSH_QUIET_MS passes without a report.  Demo task only.
+static int flushHub(uint32_t *pReports, uint32_t *pDrain_us)
+{
+    uint64_t start_uS = timebase_getUs();
+    uint32_t asked = 0;
+    int status = SH2_OK;
+
+    hubEvents_clear(HUB_EVT_FLUSHED);
+    taskENTER_CRITICAL();
+    flushReports = 0;
+    flushPending = 0;
+    taskEXIT_CRITICAL();
+
+    for (int n = 0; n < MAX_SUBSCRIPTIONS; n++) {
+        if ((subscriptions[n].sensorId != 0) &&
+            (subscriptions[n].batchInterval_us != 0)) {
+            // Counted first: the completion may beat sh2_flush() back
+            taskENTER_CRITICAL();
+            flushPending++;
+            taskEXIT_CRITICAL();
+
+            uint64_t cmd_uS = latency_cmdStart();
+            int rc = sh2_flush(subscriptions[n].sensorId);
+            latency_cmd(LAT_CMD_FLUSH, cmd_uS);
+            if (rc != SH2_OK) {
+                printf("Error: %d, from sh2_flush() for sensor %d\n",
+                       rc, subscriptions[n].sensorId);
+                taskENTER_CRITICAL();
+                flushPending--;
+                taskEXIT_CRITICAL();
+                status = rc;
+            }
+            else {
+                asked++;
+            }
+        }
+    }
+
+    if (asked != 0) {
+        uint32_t seen = 0;
+        bool drained = false;
+
+        while (!drained && (timebase_getUs() - start_uS < FLUSH_TIMEOUT_MS * 1000ULL)) {
+            drained = (hubEvents_wait(HUB_EVT_FLUSHED, pdMS_TO_TICKS(FLUSH_QUIET_MS)) != 0) ||
+                      (flushReports == seen);
+            seen = flushReports;
+        }
+        if (!drained && (status == SH2_OK)) {
+            status = SH2_ERR_TIMEOUT;
+        }
+    }
+
+    taskENTER_CRITICAL();
+    flushPending = 0;
+    taskEXIT_CRITICAL();
+
+    if (pReports != 0) {
+        *pReports = flushReports;
+    }
+    if (pDrain_us != 0) {
+        *pDrain_us = (uint32_t)(timebase_getUs() - start_uS);
+    }
+
+    return status;
+}
+
+// Shell command: show or set which sensors calibrate dynamically.
+static void calCmd(int argc, char *argv[])
+{
+    static HubRequest_t req;
+    int status;
+
+    if ((argc > 1) && (strcmp(argv[1], "save") == 0)) {
+        // Takes the hub a while: the result is printed when it is done
+        req.op = HUB_REQ_SAVE_DCD;
+        uint32_t id = hubRequestAsync(&req, calSaveDone);
+        if (id == 0) {
+            printf("Error: %d, from sh2_saveDcdNow()\n", SH2_ERR_OP_IN_PROGRESS);
+        }
+        else {
+            printf("DCD save queued (request %u).\n", (unsigned)id);
+        }
+        return;
+    }
+
+    if (argc > 1) {
+        uint8_t sensors = 0;
+        for (const char *p = argv[1]; *p != 0; p++) {
+            switch (*p) {
+                case 'a': sensors |= SH2_CAL_ACCEL; break;
+                case 'g': sensors |= SH2_CAL_GYRO; break;
+                case 'm': sensors |= SH2_CAL_MAG; break;
+                case 'p': sensors |= SH2_CAL_PLANAR; break;
+                case '-': break;  // "cal -" disables all
+                default:
+                    printf("usage: %s [<agmp> | - | save]\n", argv[0]);
+                    return;
+            }
+        }
+        req.op = HUB_REQ_SET_CAL;
+        req.calSensors = sensors;
+        status = hubRequest(&req);
+        if (status != SH2_OK) {
+            printf("Error: %d, from sh2_setCalConfig()\n", status);
+            return;
+        }
+    }
+
+    req.op = HUB_REQ_GET_CAL;
+    status = hubRequest(&req);
+    if (status != SH2_OK) {
+        printf("Error: %d, from sh2_getCalConfig()\n", status);
+        return;
+    }
+    printf("Dynamic calibration: accel %s, gyro %s, mag %s, planar %s\n",
+           (req.calSensors & SH2_CAL_ACCEL) ? "on" : "off",
+           (req.calSensors & SH2_CAL_GYRO) ? "on" : "off",
+           (req.calSensors & SH2_CAL_MAG) ? "on" : "off",
+           (req.calSensors & SH2_CAL_PLANAR) ? "on" : "off");
+}
+
+// Result of "cal save", called by the demo task
+static void calSaveDone(HubRequest_t *pReq)
+{
+    if (pReq->status != SH2_OK) {
+        printf("Error: %d, from sh2_saveDcdNow() (request %u)\n",
+               pReq->status, (unsigned)pReq->id);
+    }
+    else {
+        printf("DCD saved (request %u).\n", (unsigned)pReq->id);
+    }
+}
+
+// Shell command: read or write an FRS record.  "frs get" prints the
+// record as the "frs set" command that restores it.  "frs set <id>" with
+// no words erases the record.
+static void frsCmd(int argc, char *argv[])
+{
+    static uint32_t data[FRS_MAX_WORDS];
+    uint16_t words;
+    int status;
+
+    if ((argc < 3) ||
+        !((strcmp(argv[1], "get") == 0) || (strcmp(argv[1], "set") == 0))) {
+        printf("usage: %s get <id> | set <id> [words...]\n", argv[0]);
+        return;
+    }
+
+    uint16_t frsId = strtoul(argv[2], 0, 0);
+
+    if (strcmp(argv[1], "get") == 0) {
+        words = FRS_MAX_WORDS;
+        sh2Client_begin(&shellClient);
+        uint64_t start_uS = latency_cmdStart();
+        status = sh2_getFrs(frsId, data, &words);
+        latency_cmd(LAT_CMD_GET_FRS, start_uS);
+        sh2Client_end(&shellClient);
+        if (status != SH2_OK) {
+            printf("Error: %d, from sh2_getFrs()\n", status);
+            return;
+        }
+        printf("frs set 0x%04x", frsId);
+        for (int n = 0; n < words; n++) {
+            printf(" 0x%08x", data[n]);
+        }
+        printf("\n");
+        return;
+    }
+
+    if (argc - 3 > FRS_MAX_WORDS) {
+        printf("At most %d words.\n", FRS_MAX_WORDS);
+        return;
+    }
+    words = argc - 3;
+    for (int n = 0; n < words; n++) {
+        data[n] = strtoul(argv[3+n], 0, 0);
+    }
+    sh2Client_begin(&shellClient);
+    uint64_t start_uS = latency_cmdStart();
+    status = sh2_setFrs(frsId, data, words);
+    latency_cmd(LAT_CMD_SET_FRS, start_uS);
+    frsCache_invalidate(frsId);
+    sh2Client_end(&shellClient);
+    if (status != SH2_OK) {
+        printf("Error: %d, from sh2_setFrs()\n", status);
+    }
+}
+
+// Have the demo task, which owns the SH-2 API, run *pReq, and copy the
+// results back into it.  Returns the SH-2 status.
+static int hubRequest(HubRequest_t *pReq)
+{
+    return hubRequestWait(pReq, HUB_REQ_TIMEOUT_MS);
+}
+
+// As hubRequest(), for requests that take longer: waits up to wait ticks.
+// A request that times out still runs, and frees its slot once done.
+static int hubRequestWait(HubRequest_t *pReq, TickType_t wait)
+{
+    HubRequest_t *pSlot = hubReqSubmit(pReq, 0);
+    bool done;
+
+    if (pSlot == 0) {
+        return SH2_ERR_OP_IN_PROGRESS;
+    }
+
+    if (hubEvents_wait(HUB_EVT_REQ_DONE(pool_index(&hubReqPool, pSlot)), wait) == 0) {
+        taskENTER_CRITICAL();
+        done = (pSlot->state == HUB_REQ_DONE);
+        pSlot->abandoned = !done;
+        taskEXIT_CRITICAL();
+        if (!done) {
+            return SH2_ERR_TIMEOUT;
+        }
+    }
+
+    *pReq = *pSlot;
+    pool_put(&hubReqPool, pSlot);
+
+    return pReq->status;
+}
+
+// Queue *pReq without waiting for it.  The demo task calls onDone with
+// the results, in its own context.  Returns the request id, or 0 if all
+// slots are in use.
+static uint32_t hubRequestAsync(const HubRequest_t *pReq, HubReqCallback_t *onDone)
+{
+    HubRequest_t *pSlot = hubReqSubmit(pReq, onDone);
+
+    return (pSlot != 0) ? pSlot->id : 0;
+}
+
+// Copy *pReq into a free slot and queue it to the demo task
+static HubRequest_t *hubReqSubmit(const HubRequest_t *pReq, HubReqCallback_t *onDone)
+{
+    HubRequest_t *pSlot = pool_get(&hubReqPool);
+
+    if (pSlot != 0) {
+        *pSlot = *pReq;
+        pSlot->status = SH2_ERR;
+        pSlot->onDone = onDone;
+        pSlot->abandoned = false;
+        pSlot->state = HUB_REQ_QUEUED;
+        taskENTER_CRITICAL();
+        pSlot->id = ++hubReqLastId;
+        taskEXIT_CRITICAL();
+
+        // Discard a completion left by the slot's last request
+        hubEvents_clear(HUB_EVT_REQ_DONE(pool_index(&hubReqPool, pSlot)));
+
+        // One queue entry per slot, so there is always room
+        xQueueSend(hubReqQueue, &pSlot, 0);
+        xSemaphoreGive(wakeDemoTask);
+    }
+
+    return pSlot;
+}
+
+// Run the next queued hub request.  Called from the demo task.
+static void serviceHubRequest(void)
+{
+    HubRequest_t *pReq;
+    bool abandoned;
+
+    if (xQueueReceive(hubReqQueue, &pReq, 0) != pdTRUE) {
+        return;
+    }
+
+    uint64_t start_uS = latency_cmdStart();
+
+    switch (pReq->op) {
+        case HUB_REQ_GET_CAL:
+            pReq->status = sh2_getCalConfig(&pReq->calSensors);
+            latency_cmd(LAT_CMD_CAL_CONFIG, start_uS);
+            break;
+        case HUB_REQ_SET_CAL:
+            pReq->status = sh2_setCalConfig(pReq->calSensors);
+            latency_cmd(LAT_CMD_CAL_CONFIG, start_uS);
+            if (pReq->status == SH2_OK) {
+                // Reapplied after each reset, and over a warm one
+                calConfig = pReq->calSensors;
+                saveWarm();
+            }
+            break;
+        case HUB_REQ_SAVE_DCD:
+            pReq->status = sh2_saveDcdNow();
+            latency_cmd(LAT_CMD_SAVE_DCD, start_uS);
             break;
-        case SH2_ROTATION_VECTOR:
-            r = value.un.rotationVector.real;
-            i = value.un.rotationVector.i;
-            j = value.un.rotationVector.j;
-            k = value.un.rotationVector.k;
-            acc_deg = scaleRadToDeg * 
-                value.un.rotationVector.accuracy;
-            printf("%8.4f Rotation Vector: "
-                   "r:%5.3f i:%5.3f j:%5.3f k:%5.3f (acc: %5.3f deg)\n",
-                   t,
-                   r, i, j, k, acc_deg);
+        case HUB_REQ_PROFILE:
+            pReq->status = applyProfile(pReq->profile);
             break;
-        case SH2_GYRO_INTEGRATED_RV:
-            r = value.un.gyroIntegratedRV.real;
-            i = value.un.gyroIntegratedRV.i;
-            j = value.un.gyroIntegratedRV.j;
-            k = value.un.gyroIntegratedRV.k;
-            x = value.un.gyroIntegratedRV.angVelX;
-            y = value.un.gyroIntegratedRV.angVelY;
-            z = value.un.gyroIntegratedRV.angVelZ;
-            printf("%8.4f Gyro Integrated RV: "
-                   "r:%5.3f i:%5.3f j:%5.3f k:%5.3f x:%5.3f y:%5.3f z:%5.3f\n",
-                   t,
-                   r, i, j, k,
-                   x, y, z);
+        case HUB_REQ_FLUSH:
+            pReq->status = flushHub(&pReq->reports, &pReq->drain_us);
             break;
-// Modifications:
-    case SH2_GEOMAGNETIC_ROTATION_VECTOR:
-            r = value.un.geoMagRotationVector.real;
-            i = value.un.geoMagRotationVector.i;
-            j = value.un.geoMagRotationVector.j;
-            k = value.un.geoMagRotationVector.k;
-            acc_rad = value.un.geoMagRotationVector.accuracy;
-            printf("Rotation Vector: "
-                   "r:%5.3f i:%5.3f j:%5.3f k:%5.3f (acc: %5.3f deg)\n",
-                   r, i, j, k, acc_rad);
-      break;
-    case SH2_GYROSCOPE_CALIBRATED:
-          i=value.un.gyroscope.x;
-          j=value.un.gyroscope.y;
-          k=value.un.gyroscope.z;
-          printf("Gyroscope: x:%5.3f y:%5.3f z:%5.3f\n", 
-                 i,j,k);
-      break;
-    case SH2_LINEAR_ACCELERATION:
-      printf("Accelration: x:%5.3f y:%5.3f z:%5.3f\n",
-               value.un.linearAcceleration.x,
-               value.un.linearAcceleration.y,
-               value.un.linearAcceleration.z);
-        break;
-  
+#if DFU_CONSOLE
+        case HUB_REQ_DFU:
+            dfuConsole();
+            break;
+#endif
         default:
-            printf("Unknown sensor: %d\n", value.sensorId);
+            pReq->status = SH2_ERR_BAD_PARAM;
             break;
     }
-}
 
+    taskENTER_CRITICAL();
+    pReq->state = HUB_REQ_DONE;
+    abandoned = pReq->abandoned;
+    taskEXIT_CRITICAL();
 
+    if (pReq->onDone != 0) {
+        pReq->onDone(pReq);
+        pool_put(&hubReqPool, pReq);
+    }
+    else if (abandoned) {
+        // Its waiter timed out
+        pool_put(&hubReqPool, pReq);
+    }
+    else {
+        hubEvents_set(HUB_EVT_REQ_DONE(pool_index(&hubReqPool, pReq)));
+    }
+}
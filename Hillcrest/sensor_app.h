@@ -22,6 +22,59 @@
 #ifndef SENSOR_APP_H
 #define SENSOR_APP_H
 
+#include <stdint.h>
+#include <stdbool.h>
+
 void demoTaskStart(const void * params);
 
+// Overflow and high-water counts of the sensor event ring
+void sensorApp_getRingStats(uint32_t *pOverflows, uint32_t *pHighWater);
+
+// Subscribe sensorId at interval_us (0 disables it), as "sub" does,
+// without batching or change sensitivity.  The demo task applies it
+// shortly after.  Returns 0, -1 for a bad id or a full table, or -2
+// if the links can't carry it and SENSOR_BUDGET_REJECT is set (see
+// sensor_budget.h).
+int sensorApp_subscribe(uint8_t sensorId, uint32_t interval_us);
+
+// Flush the hub FIFO: have every batched sensor deliver its samples now,
+// and return once they are all in (or after FLUSH_TIMEOUT_MS, with
+// SH2_ERR_TIMEOUT).  *pReports is the number of sensor events that came
+// in meanwhile, *pDrain_us how long it took; either may be NULL.
+// Returns an SH-2 status.  Any task but the demo task.
+int sensorApp_flush(uint32_t *pReports, uint32_t *pDrain_us);
+
+// Switch to the configuration profile called name, as "profile" does.
+// Returns an SH-2 status, SH2_ERR_BAD_PARAM if there is no such profile.
+// Any task but the demo task.
+int sensorApp_profile(const char *name);
+
+// Update the hub from an image tools/fwsend.py sends over the console,
+// as "dfu" does, then restart.  Returns an SH-2 status only if the
+// update couldn't be started.  Call from the task that reads the
+// console, which must not read it meanwhile.
+int sensorApp_dfuConsole(void);
+
+// Subscribed report interval of sensorId [us], 0 if none.
+uint32_t sensorApp_interval(uint8_t sensorId);
+
+// Interval sensorId's reports come at [us], as the hub granted it once
+// it has been configured (see SENSOR_READBACK), 0 if not subscribed.
+// Consumers decimating to a rate of their own divide by this.
+uint32_t sensorApp_grantedInterval(uint8_t sensorId);
+
+// Longest a running subscription of sensorId goes between reports [us]:
+// its interval or, batched, its batch interval.  0 if it isn't
+// subscribed or only reports on change (change sensitivity).
+uint32_t sensorApp_quietLimit(uint8_t sensorId);
+
+// True while the hub is being configured after a reset, or while deep
+// sleep has the streams turned off: reports aren't expected then.
+bool sensorApp_recovering(void);
+bool sensorApp_asleep(void);
+
+// Resend the whole subscription table, as after a hub reset, without
+// resetting it.  Any task.
+void sensorApp_restartReports(void);
+
 #endif
@@ -0,0 +1,319 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Structure-of-arrays batches of one sensor's samples.
+ */
+
+#include "sensor_batch.h"
+
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "sh2_err.h"
+#include "sensor_dispatch.h"
+#include "sysstats.h"
+#if SENSOR_BATCH_SIMD
+#include "stm32f4xx.h"
+#endif
+
+// Report id, sequence, status and delay ahead of the fields
+#define REPORT_HDR_LEN (4)
+
+#if (SENSOR_BATCH_LEN % 2) != 0
+#error "SENSOR_BATCH_LEN must be even"
+#endif
+
+// ------------------------------------------------------------------------
+// Private types
+
+typedef struct {
+    SensorBatchFn_t *fn;
+    void *cookie;
+    SensorBatch_t batch;
+} Sub_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void batchEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix);
+static bool matches(const SensorBatch_t *pBatch, const SensorFix_t *pFix);
+static unsigned channelsOf(const SensorFix_t *pFix);
+static unsigned qOf(const SensorBatch_t *pBatch, unsigned ch);
+static int16_t read16(const uint8_t *p);
+#if SENSOR_BATCH_SIMD
+static uint32_t read32(const int16_t *p);
+#endif
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+// Each batch is only touched by the sensor task once it has been
+// subscribed; numSubs is claimed in a critical section.
+static Sub_t subs[SENSOR_BATCH_MAX];
+static unsigned numSubs;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void sensorBatch_init(void)
+{
+    sysstats_addMemory("batches", sizeof(subs));
+}
+
+void sensorBatch_reset(SensorBatch_t *pBatch)
+{
+    pBatch->count = 0;
+}
+
+bool sensorBatch_add(SensorBatch_t *pBatch, const SensorFix_t *pFix)
+{
+    unsigned n = pBatch->count;
+    uint64_t dt;
+
+    if ((n >= SENSOR_BATCH_LEN) || ((n != 0) && !matches(pBatch, pFix))) {
+        n = 0;
+    }
+    dt = pFix->timestamp_uS - pBatch->t0_uS;
+    if (n == 0) {
+        pBatch->sensorId = pFix->sensorId;
+        pBatch->kind = pFix->kind;
+        pBatch->q = pFix->q;
+        pBatch->channels = channelsOf(pFix);
+        pBatch->t0_uS = pFix->timestamp_uS;
+        dt = 0;
+    }
+
+    pBatch->t[n] = (uint32_t)dt;
+    switch (pFix->kind) {
+        case SENSORFIX_QUAT:
+            pBatch->ch[SENSOR_BATCH_I][n] = pFix->un.quat.i;
+            pBatch->ch[SENSOR_BATCH_J][n] = pFix->un.quat.j;
+            pBatch->ch[SENSOR_BATCH_K][n] = pFix->un.quat.k;
+            pBatch->ch[SENSOR_BATCH_REAL][n] = pFix->un.quat.real;
+            pBatch->ch[SENSOR_BATCH_ACCURACY][n] = pFix->un.quat.accuracy;
+            break;
+        case SENSORFIX_GIRV:
+            pBatch->ch[SENSOR_BATCH_I][n] = pFix->un.girv.i;
+            pBatch->ch[SENSOR_BATCH_J][n] = pFix->un.girv.j;
+            pBatch->ch[SENSOR_BATCH_K][n] = pFix->un.girv.k;
+            pBatch->ch[SENSOR_BATCH_REAL][n] = pFix->un.girv.real;
+            pBatch->ch[SENSOR_BATCH_ANGVEL_X][n] = pFix->un.girv.angVelX;
+            pBatch->ch[SENSOR_BATCH_ANGVEL_Y][n] = pFix->un.girv.angVelY;
+            pBatch->ch[SENSOR_BATCH_ANGVEL_Z][n] = pFix->un.girv.angVelZ;
+            break;
+        default:
+            pBatch->ch[SENSOR_BATCH_X][n] = pFix->un.vec3.x;
+            pBatch->ch[SENSOR_BATCH_Y][n] = pFix->un.vec3.y;
+            pBatch->ch[SENSOR_BATCH_Z][n] = pFix->un.vec3.z;
+            break;
+    }
+    pBatch->count = n + 1;
+
+    return pBatch->count >= SENSOR_BATCH_LEN;
+}
+
+unsigned sensorBatch_decode(SensorBatch_t *pBatch, const sh2_SensorEvent_t *pEvents, unsigned n)
+{
+    SensorFix_t fix;
+    unsigned done;
+
+    for (done = 0; (done < n) && (pBatch->count < SENSOR_BATCH_LEN); done++) {
+        const sh2_SensorEvent_t *e = &pEvents[done];
+        unsigned i = pBatch->count;
+
+        if ((i != 0) && (pBatch->channels == 3) && (e->reportId == pBatch->sensorId) &&
+            (e->len >= REPORT_HDR_LEN + 6) &&
+            (e->timestamp_uS >= pBatch->t0_uS) &&
+            (e->timestamp_uS - pBatch->t0_uS <= UINT32_MAX)) {
+            // Same vector sensor as the batch: kind and Q point follow
+            const uint8_t *p = &e->report[REPORT_HDR_LEN];
+
+            pBatch->t[i] = (uint32_t)(e->timestamp_uS - pBatch->t0_uS);
+            pBatch->ch[SENSOR_BATCH_X][i] = read16(p);
+            pBatch->ch[SENSOR_BATCH_Y][i] = read16(p+2);
+            pBatch->ch[SENSOR_BATCH_Z][i] = read16(p+4);
+            pBatch->count = i + 1;
+            continue;
+        }
+
+        if ((sensorFix_decode(&fix, e) != SH2_OK) ||
+            ((i != 0) && !matches(pBatch, &fix))) {
+            break;
+        }
+        sensorBatch_add(pBatch, &fix);
+    }
+
+    return done;
+}
+
+void sensorBatch_toFloat(const SensorBatch_t *pBatch, unsigned ch, float *out)
+{
+    const int16_t *x = pBatch->ch[ch];
+    float k = FIX_TO_FLOAT(qOf(pBatch, ch), 1);
+
+    // VCVT and VMUL per sample on the M4's FPU
+    for (unsigned n = 0; n < pBatch->count; n++) {
+        out[n] = (float)x[n] * k;
+    }
+}
+
+int32_t sensorBatch_sum(const SensorBatch_t *pBatch, unsigned ch)
+{
+    const int16_t *x = pBatch->ch[ch];
+    unsigned n = 0;
+    int32_t sum = 0;
+
+#if SENSOR_BATCH_SIMD
+    // Both halves times one, added to sum
+    for (; n + 1 < pBatch->count; n += 2) {
+        sum = (int32_t)__SMLAD(read32(&x[n]), 0x00010001, (uint32_t)sum);
+    }
+#endif
+    for (; n < pBatch->count; n++) {
+        sum += x[n];
+    }
+    return sum;
+}
+
+int64_t sensorBatch_sumSquares(const SensorBatch_t *pBatch, unsigned ch)
+{
+    const int16_t *x = pBatch->ch[ch];
+    unsigned n = 0;
+    int64_t sum = 0;
+
+#if SENSOR_BATCH_SIMD
+    for (; n + 1 < pBatch->count; n += 2) {
+        uint32_t v = read32(&x[n]);
+        sum = (int64_t)__SMLALD(v, v, (uint64_t)sum);
+    }
+#endif
+    for (; n < pBatch->count; n++) {
+        sum += (int32_t)x[n] * x[n];
+    }
+    return sum;
+}
+
+int64_t sensorBatch_dot(const int16_t *x, const int16_t *h, unsigned n)
+{
+    unsigned i = 0;
+    int64_t sum = 0;
+
+#if SENSOR_BATCH_SIMD
+    for (; i + 1 < n; i += 2) {
+        sum = (int64_t)__SMLALD(read32(&x[i]), read32(&h[i]), (uint64_t)sum);
+    }
+#endif
+    for (; i < n; i++) {
+        sum += (int32_t)x[i] * h[i];
+    }
+    return sum;
+}
+
+int sensorBatch_subscribe(uint8_t sensorId, int prio, SensorBatchFn_t *fn, void *cookie)
+{
+    Sub_t *s = 0;
+
+    if ((sensorId == SENSOR_DISPATCH_ALL) || (sensorId > SH2_MAX_SENSOR_ID) || (fn == 0)) {
+        return SH2_ERR_BAD_PARAM;
+    }
+
+    taskENTER_CRITICAL();
+    if (numSubs < SENSOR_BATCH_MAX) {
+        s = &subs[numSubs++];
+    }
+    taskEXIT_CRITICAL();
+
+    if (s == 0) {
+        return SH2_ERR;
+    }
+
+    memset(s, 0, sizeof(*s));
+    s->fn = fn;
+    s->cookie = cookie;
+
+    return sensorDispatch_subscribe(sensorId, prio, batchEvent, s);
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+// Dispatch callback, in the sensor task
+static void batchEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix)
+{
+    Sub_t *s = (Sub_t *)cookie;
+
+    if (pFix == 0) {
+        // No channels to batch
+        return;
+    }
+
+    if (sensorBatch_add(&s->batch, pFix)) {
+        s->fn(s->cookie, &s->batch);
+        sensorBatch_reset(&s->batch);
+    }
+}
+
+// Whether pFix can go in pBatch, which holds other samples
+static bool matches(const SensorBatch_t *pBatch, const SensorFix_t *pFix)
+{
+    return (pFix->sensorId == pBatch->sensorId) && (pFix->kind == pBatch->kind) &&
+           (pFix->q == pBatch->q) && (channelsOf(pFix) == pBatch->channels) &&
+           (pFix->timestamp_uS >= pBatch->t0_uS) &&
+           (pFix->timestamp_uS - pBatch->t0_uS <= UINT32_MAX);
+}
+
+static unsigned channelsOf(const SensorFix_t *pFix)
+{
+    switch (pFix->kind) {
+        case SENSORFIX_QUAT:
+            return pFix->un.quat.hasAccuracy ? 5 : 4;
+        case SENSORFIX_GIRV:
+            return 7;
+        default:
+            return 3;
+    }
+}
+
+// Q point of channel ch
+static unsigned qOf(const SensorBatch_t *pBatch, unsigned ch)
+{
+    if ((pBatch->kind == SENSORFIX_QUAT) && (ch == SENSOR_BATCH_ACCURACY)) {
+        return SENSORFIX_Q_ACCURACY;
+    }
+    if ((pBatch->kind == SENSORFIX_GIRV) && (ch >= SENSOR_BATCH_ANGVEL_X)) {
+        return SENSORFIX_Q_ANGVEL;
+    }
+    return pBatch->q;
+}
+
+static int16_t read16(const uint8_t *p)
+{
+    return (int16_t)(p[0] | (p[1] << 8));
+}
+
+#if SENSOR_BATCH_SIMD
+// Two adjacent int16 samples as one word, low address in the low half
+static uint32_t read32(const int16_t *p)
+{
+    uint32_t v;
+
+    // A single LDR: p is word aligned
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+#endif
@@ -0,0 +1,142 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Structure-of-arrays batches of one sensor's samples.
+ *
+ * A batch keeps each channel of a sensor's fixed-point decode in its own
+ * contiguous int16 array, and the sample times in another, so kernels
+ * over many samples walk memory linearly and, on the Cortex-M4, take
+ * two samples per instruction with the packed 16-bit multiply
+ * accumulates (SMLAD, SMLALD).  Channels are numbered by kind:
+ *   - SENSORFIX_VEC3, SENSORFIX_RAW: x, y, z.
+ *   - SENSORFIX_QUAT: i, j, k, real, then accuracy if the report has it.
+ *   - SENSORFIX_GIRV: i, j, k, real, then angular velocity x, y, z.
+ *
+ * Fill a batch with sensorBatch_add(), or have sensorBatch_subscribe()
+ * fill one from dispatch and hand it over each time it is full.
+ */
+
+#ifndef SENSOR_BATCH_H
+#define SENSOR_BATCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sensor_fix.h"
+
+// Samples per batch.  Even, so every channel array starts word aligned.
+#ifndef SENSOR_BATCH_LEN
+#define SENSOR_BATCH_LEN (32)
+#endif
+
+// Batches filled from dispatch.  Each also takes a dispatch subscriber slot.
+#ifndef SENSOR_BATCH_MAX
+#define SENSOR_BATCH_MAX (2)
+#endif
+
+// Use the Cortex-M4 packed 16-bit instructions (else plain C)
+#ifndef SENSOR_BATCH_SIMD
+#if defined(__ICCARM__) || defined(__ARM_FEATURE_DSP)
+#define SENSOR_BATCH_SIMD (1)
+#else
+#define SENSOR_BATCH_SIMD (0)
+#endif
+#endif
+
+// Put before the declaration of an int16 tap table for sensorBatch_dot()
+#if defined(__ICCARM__)
+#define SENSOR_BATCH_ALIGN _Pragma("data_alignment=4")
+#elif defined(__GNUC__)
+#define SENSOR_BATCH_ALIGN __attribute__((aligned(4)))
+#else
+#define SENSOR_BATCH_ALIGN
+#endif
+
+// Channels of the widest kind (GIRV)
+#define SENSOR_BATCH_CHANNELS (7)
+
+// Channel numbers
+#define SENSOR_BATCH_X (0)
+#define SENSOR_BATCH_Y (1)
+#define SENSOR_BATCH_Z (2)
+#define SENSOR_BATCH_I (0)
+#define SENSOR_BATCH_J (1)
+#define SENSOR_BATCH_K (2)
+#define SENSOR_BATCH_REAL (3)
+#define SENSOR_BATCH_ACCURACY (4)
+#define SENSOR_BATCH_ANGVEL_X (4)
+#define SENSOR_BATCH_ANGVEL_Y (5)
+#define SENSOR_BATCH_ANGVEL_Z (6)
+
+typedef struct {
+    uint8_t sensorId;
+    SensorFixKind_t kind;
+    uint8_t q;                  // Q point of the vec3 or quaternion channels
+    uint8_t channels;           // channels in use
+    unsigned count;             // samples held
+    uint64_t t0_uS;             // first sample's time
+    uint32_t t[SENSOR_BATCH_LEN];  // each sample's time after t0_uS [us]
+    int16_t ch[SENSOR_BATCH_CHANNELS][SENSOR_BATCH_LEN];
+} SensorBatch_t;
+
+// Called with a full batch, in the sensor task.  The batch is emptied
+// when fn returns.
+typedef void (SensorBatchFn_t)(void *cookie, const SensorBatch_t *pBatch);
+
+// Register the dispatch batches' memory.
+void sensorBatch_init(void);
+
+// Empty pBatch.
+void sensorBatch_reset(SensorBatch_t *pBatch);
+
+// Append pFix to pBatch.  An empty batch takes on pFix's sensor, kind
+// and Q point; a sample that doesn't match them, or comes more than
+// 2^32 us after the first, starts the batch over.  Returns true if the
+// batch is now full.
+bool sensorBatch_add(SensorBatch_t *pBatch, const SensorFix_t *pFix);
+
+// Decode up to n consecutive reports of one sensor from pEvents and
+// append them to pBatch, until it is full.  Vector reports (calibrated
+// and raw accelerometer, gyroscope and magnetometer) are read straight
+// into the channel arrays after the first, without a SensorFix_t each;
+// others go through sensorFix_decode().  Stops at a report of another
+// sensor, kind or Q point than the batch holds, or one sensorFix_decode()
+// can't decode.  Returns the reports consumed.
+unsigned sensorBatch_decode(SensorBatch_t *pBatch, const sh2_SensorEvent_t *pEvents, unsigned n);
+
+// Convert channel ch of pBatch to real values in out (count floats).
+void sensorBatch_toFloat(const SensorBatch_t *pBatch, unsigned ch, float *out);
+
+// Sum of channel ch over the batch.
+int32_t sensorBatch_sum(const SensorBatch_t *pBatch, unsigned ch);
+
+// Sum of squares of channel ch over the batch, for its variance.
+int64_t sensorBatch_sumSquares(const SensorBatch_t *pBatch, unsigned ch);
+
+// Dot product of n int16 samples x with taps h (an FIR output when h
+// is the time-reversed impulse response).  x and h must be word aligned,
+// as channel arrays are; declare tap tables with SENSOR_BATCH_ALIGN.
+int64_t sensorBatch_dot(const int16_t *x, const int16_t *h, unsigned n);
+
+// Fill a batch from sensorId's dispatched events and call fn each time
+// it is full.  prio orders fn among the dispatch subscribers, as for
+// sensorDispatch_subscribe().
+// Returns SH2_OK, SH2_ERR_BAD_PARAM, or SH2_ERR if no batch (or
+// dispatch slot) is free.
+int sensorBatch_subscribe(uint8_t sensorId, int prio, SensorBatchFn_t *fn, void *cookie);
+
+#endif
@@ -0,0 +1,226 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Black-box capture around motion events.
+ */
+
+#include "sensor_blackbox.h"
+
+#if SENSOR_BLACKBOX
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "shell.h"
+#include "console.h"
+#include "sysstats.h"
+#include "sensor_dispatch.h"
+#include "sensor_output.h"
+#include "sensor_sample.h"
+#include "priorities.h"
+
+// Reports recorded after the trigger
+#define POST_EVENTS (SENSOR_BLACKBOX_EVENTS - \
+                     (SENSOR_BLACKBOX_EVENTS * SENSOR_BLACKBOX_PRE_PCT) / 100)
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void bbEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix);
+static bool triggers(const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix);
+static void dump(void);
+static void bbCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+// Written by the sensor task while armed or triggered, read by the
+// shell once frozen
+static SensorSample_t ring[SENSOR_BLACKBOX_EVENTS];
+static uint32_t written;            // reports since armed
+static uint32_t postLeft;
+static uint32_t triggerAt;          // written at the trigger
+static uint8_t triggerId;           // sensor that triggered (0: "bb trigger")
+
+static volatile BlackboxState_t state;
+static volatile bool restartNeeded;
+static volatile bool triggerNeeded;
+static volatile uint32_t accelThreshold = SENSOR_BLACKBOX_ACCEL;  // [m/s^2]
+
+// ------------------------------------------------------------------------
+// Public API
+
+void sensorBlackbox_init(void)
+{
+    sysstats_addMemory("black box", sizeof(ring));
+    shell_addCommand("bb", "[arm | off | trigger | dump | accel <m/s^2>] capture around motion events",
+                     bbCmd);
+    sensorDispatch_subscribe(SENSOR_DISPATCH_ALL, PRIO_SUB_BLACKBOX, bbEvent, 0);
+    sensorBlackbox_arm(SENSOR_BLACKBOX_ARMED);
+}
+
+void sensorBlackbox_arm(bool arm)
+{
+    // The sensor task clears the ring before it writes again
+    taskENTER_CRITICAL();
+    restartNeeded = true;
+    triggerNeeded = false;
+    state = arm ? BLACKBOX_ARMED : BLACKBOX_OFF;
+    taskEXIT_CRITICAL();
+}
+
+void sensorBlackbox_trigger(void)
+{
+    triggerNeeded = true;
+}
+
+BlackboxState_t sensorBlackbox_state(void)
+{
+    return state;
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+// Dispatch callback, in the sensor task
+static void bbEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix)
+{
+    BlackboxState_t s = state;
+
+    if ((s != BLACKBOX_ARMED) && (s != BLACKBOX_TRIGGERED)) {
+        return;
+    }
+    if (restartNeeded) {
+        restartNeeded = false;
+        written = 0;
+    }
+
+    // One too long to keep can still trigger
+    if (sensorSample_pack(&ring[written % SENSOR_BLACKBOX_EVENTS], pEvent, 0)) {
+        written++;
+    }
+
+    if (s == BLACKBOX_ARMED) {
+        if (triggerNeeded || triggers(pEvent, pFix)) {
+            triggerId = triggerNeeded ? 0 : pEvent->reportId;
+            triggerNeeded = false;
+            triggerAt = written;
+            postLeft = POST_EVENTS;
+            s = BLACKBOX_TRIGGERED;
+        }
+    }
+    else if (postLeft > 0) {
+        postLeft--;
+    }
+
+    if ((s == BLACKBOX_TRIGGERED) && (postLeft == 0)) {
+        s = BLACKBOX_FROZEN;
+    }
+
+    // Unless the shell changed it meanwhile
+    taskENTER_CRITICAL();
+    if (!restartNeeded) {
+        state = s;
+    }
+    taskEXIT_CRITICAL();
+    if (s == BLACKBOX_FROZEN) {
+        printf("Black box: captured around sensor %u, \"bb dump\" to read.\n", triggerId);
+    }
+}
+
+// A motion event: a hub detector's report, or an acceleration over the
+// threshold
+static bool triggers(const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix)
+{
+    uint8_t id = pEvent->reportId;
+
+    if ((id == SH2_TAP_DETECTOR) || (id == SH2_SHAKE_DETECTOR)) {
+        return true;
+    }
+    if ((accelThreshold == 0) || (pFix == 0) ||
+        ((id != SH2_ACCELEROMETER) && (id != SH2_LINEAR_ACCELERATION))) {
+        return false;
+    }
+
+    // Compare squares, in LSBs
+    int64_t x = pFix->un.vec3.x;
+    int64_t y = pFix->un.vec3.y;
+    int64_t z = pFix->un.vec3.z;
+    uint64_t t = (uint64_t)accelThreshold << pFix->q;
+    return (uint64_t)(x*x + y*y + z*z) > t*t;
+}
+
+// Send the frozen capture, oldest first, in binary frames
+static void dump(void)
+{
+    uint32_t n = (written < SENSOR_BLACKBOX_EVENTS) ? written : SENSOR_BLACKBOX_EVENTS;
+    uint32_t first = written - n;
+    uint8_t frame[BIN_FRAME_MAX];
+    uint8_t seq = 0;
+    sh2_SensorEvent_t event;
+
+    printf("Black box: %u reports, %u before the trigger.\n",
+           (unsigned)n, (unsigned)(triggerAt - 1 - first));
+    for (uint32_t i = first; i < written; i++) {
+        sensorSample_unpack(&event, &ring[i % SENSOR_BLACKBOX_EVENTS]);
+        unsigned len = sensorOutput_binFrame(frame, &seq, &event);
+        console_writeRaw(frame, len);
+    }
+}
+
+// Shell command: arm, stop, trigger by hand, read out, or show the state.
+static void bbCmd(int argc, char *argv[])
+{
+    static const char * const stateName[] = { "off", "armed", "triggered", "frozen" };
+
+    if (argc > 1) {
+        if (strcmp(argv[1], "arm") == 0) {
+            sensorBlackbox_arm(true);
+        }
+        else if (strcmp(argv[1], "off") == 0) {
+            sensorBlackbox_arm(false);
+        }
+        else if (strcmp(argv[1], "trigger") == 0) {
+            sensorBlackbox_trigger();
+        }
+        else if ((strcmp(argv[1], "accel") == 0) && (argc > 2)) {
+            accelThreshold = strtoul(argv[2], 0, 0);
+        }
+        else if (strcmp(argv[1], "dump") == 0) {
+            if (state != BLACKBOX_FROZEN) {
+                printf("Black box: nothing captured.\n");
+            }
+            else {
+                dump();
+            }
+            return;
+        }
+        else {
+            printf("usage: %s [arm | off | trigger | dump | accel <m/s^2>]\n", argv[0]);
+            return;
+        }
+    }
+
+    printf("Black box %s: %u reports, %u after the trigger, trigger at %u m/s^2\n",
+           stateName[state], SENSOR_BLACKBOX_EVENTS, (unsigned)POST_EVENTS,
+           (unsigned)accelThreshold);
+}
+
+#endif
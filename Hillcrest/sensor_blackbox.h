@@ -0,0 +1,91 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Black-box capture of the reports around a motion event.
+ *
+ * While armed, every report of every subscribed sensor goes into a RAM
+ * ring of SENSOR_BLACKBOX_EVENTS reports, written over continuously.  A
+ * trigger (acceleration magnitude over a threshold, or any tap or shake
+ * detector report from the hub, or "bb trigger") keeps the ring going
+ * until SENSOR_BLACKBOX_PRE_PCT of it is before the trigger and the
+ * rest after, then freezes it.  "bb dump" sends the frozen capture in
+ * the binary output framing (sensor_output.h, tools/bin2dsf.py decodes
+ * it) as slowly as the console takes it, and "bb arm" starts over.
+ *
+ * The capture spans SENSOR_BLACKBOX_EVENTS over the total report rate:
+ * at 3 sensors of 200Hz, 512 reports are ~0.85s.  Full-rate data is
+ * only sent around the events that matter.
+ */
+
+#ifndef SENSOR_BLACKBOX_H
+#define SENSOR_BLACKBOX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sh2.h"
+
+// Set to 1 to build in the capture.  Its ring takes 40 bytes per report,
+// 20KB at the default SENSOR_BLACKBOX_EVENTS, more than the default
+// build can spare beside the F401's other users of its 96KB.
+#ifndef SENSOR_BLACKBOX
+#define SENSOR_BLACKBOX (0)
+#endif
+
+// Reports kept
+#ifndef SENSOR_BLACKBOX_EVENTS
+#define SENSOR_BLACKBOX_EVENTS (512)
+#endif
+
+// Share of the capture before the trigger [%]
+#ifndef SENSOR_BLACKBOX_PRE_PCT
+#define SENSOR_BLACKBOX_PRE_PCT (50)
+#endif
+#if SENSOR_BLACKBOX_PRE_PCT > 100
+#error SENSOR_BLACKBOX_PRE_PCT is at most 100
+#endif
+
+// Acceleration magnitude that triggers [m/s^2] (accelerometer or linear
+// acceleration reports), 0 for none
+#ifndef SENSOR_BLACKBOX_ACCEL
+#define SENSOR_BLACKBOX_ACCEL (30)
+#endif
+
+// Armed at startup
+#ifndef SENSOR_BLACKBOX_ARMED
+#define SENSOR_BLACKBOX_ARMED (0)
+#endif
+
+typedef enum {
+    BLACKBOX_OFF,
+    BLACKBOX_ARMED,         // recording, waiting for a trigger
+    BLACKBOX_TRIGGERED,     // recording what follows the trigger
+    BLACKBOX_FROZEN,        // holding a capture
+} BlackboxState_t;
+
+// Register the "bb" command and subscribe to every sensor.
+void sensorBlackbox_init(void);
+
+// Start recording afresh, or stop (discarding any capture).
+void sensorBlackbox_arm(bool arm);
+
+// Trigger now, as a motion event would.
+void sensorBlackbox_trigger(void);
+
+BlackboxState_t sensorBlackbox_state(void);
+
+#endif
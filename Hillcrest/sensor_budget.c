@@ -0,0 +1,199 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Bandwidth budget of a subscription set.
+ */
+
+#include "sensor_budget.h"
+#include "quat_pack.h"
+
+// Added to each hub transfer: the SHTP header and the base timestamp
+// reference heading the reports.  I2C also reads the header on its own
+// first, and addresses the hub for both legs.
+#define XFER_OVERHEAD (4 + 5)
+#define I2C_XFER_OVERHEAD (4 + 2)
+
+// Bits on the wire per byte: I2C adds an ack bit
+#define SPI_BITS (8)
+#define I2C_BITS (9)
+
+// Typical text and DSF line lengths: fixed part (label or id, time,
+// sample id), and per 16-bit field of the report
+#define TEXT_FIXED (24)
+#define TEXT_FIELD (9)
+#define DSF_FIXED (20)
+#define DSF_FIELD (8)
+
+// Report header ahead of the fields: id, sequence, status, delay
+#define REPORT_HDR_LEN (4)
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+// Report lengths from the SH-2 Reference Manual, report id included
+static const uint8_t reportLen[SH2_MAX_SENSOR_ID+1] = {
+    [SH2_ACCELEROMETER] = 10,
+    [SH2_GYROSCOPE_CALIBRATED] = 10,
+    [SH2_MAGNETIC_FIELD_CALIBRATED] = 10,
+    [SH2_LINEAR_ACCELERATION] = 10,
+    [SH2_ROTATION_VECTOR] = 14,
+    [SH2_GRAVITY] = 10,
+    [SH2_GYROSCOPE_UNCALIBRATED] = 16,
+    [SH2_GAME_ROTATION_VECTOR] = 12,
+    [SH2_GEOMAGNETIC_ROTATION_VECTOR] = 14,
+    [SH2_PRESSURE] = 8,
+    [SH2_AMBIENT_LIGHT] = 8,
+    [SH2_HUMIDITY] = 6,
+    [SH2_PROXIMITY] = 6,
+    [SH2_TEMPERATURE] = 6,
+    [SH2_MAGNETIC_FIELD_UNCALIBRATED] = 16,
+    [SH2_TAP_DETECTOR] = 5,
+    [SH2_STEP_COUNTER] = 12,
+    [SH2_SIGNIFICANT_MOTION] = 6,
+    [SH2_STABILITY_CLASSIFIER] = 6,
+    [SH2_RAW_ACCELEROMETER] = 16,
+    [SH2_RAW_GYROSCOPE] = 16,
+    [SH2_RAW_MAGNETOMETER] = 14,
+    [SH2_STEP_DETECTOR] = 8,
+    [SH2_SHAKE_DETECTOR] = 6,
+    [SH2_FLIP_DETECTOR] = 6,
+    [SH2_PICKUP_DETECTOR] = 6,
+    [SH2_STABILITY_DETECTOR] = 6,
+    [SH2_PERSONAL_ACTIVITY_CLASSIFIER] = 16,
+    [SH2_SLEEP_DETECTOR] = 12,
+    [SH2_TILT_DETECTOR] = 6,
+    [SH2_POCKET_DETECTOR] = 6,
+    [SH2_CIRCLE_DETECTOR] = 6,
+    [SH2_HEART_RATE_MONITOR] = 6,
+    [SH2_ARVR_STABILIZED_RV] = 14,
+    [SH2_ARVR_STABILIZED_GRV] = 12,
+    [SH2_GYRO_INTEGRATED_RV] = 14,
+};
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static unsigned pct(uint32_t load, uint32_t cap);
+
+// ------------------------------------------------------------------------
+// Public API
+
+void sensorBudget_init(SensorBudget_t *pBudget, BudgetBus_t bus, uint32_t busHz,
+                       OutputMode_t mode, uint32_t outBytes_s)
+{
+    pBudget->bus = bus;
+    pBudget->mode = mode;
+    pBudget->busCap = busHz / ((bus == BUDGET_BUS_I2C) ? I2C_BITS : SPI_BITS);
+    pBudget->outCap = outBytes_s;
+    pBudget->busLoad = 0;
+    pBudget->outLoad = 0;
+}
+
+void sensorBudget_add(SensorBudget_t *pBudget, uint8_t sensorId,
+                      uint32_t interval_us, uint32_t batch_us)
+{
+    if (interval_us == 0) {
+        return;
+    }
+
+    // Reports every interval, transfers at most that often: a batch
+    // shares one transfer's overhead among its reports
+    uint32_t xfer_us = (batch_us > interval_us) ? batch_us : interval_us;
+    unsigned overhead = XFER_OVERHEAD;
+    if (pBudget->bus == BUDGET_BUS_I2C) {
+        overhead += I2C_XFER_OVERHEAD;
+    }
+
+    pBudget->busLoad += (1000000u * sensorBudget_reportLen(sensorId)) / interval_us +
+                        (1000000u * overhead) / xfer_us;
+    pBudget->outLoad += (1000000u * sensorBudget_outputLen(sensorId, pBudget->mode)) / interval_us;
+}
+
+unsigned sensorBudget_reportLen(uint8_t sensorId)
+{
+    return (sensorId <= SH2_MAX_SENSOR_ID) ? reportLen[sensorId] : 0;
+}
+
+unsigned sensorBudget_outputLen(uint8_t sensorId, OutputMode_t mode)
+{
+    unsigned len = sensorBudget_reportLen(sensorId);
+    unsigned fields;
+
+    if (len == 0) {
+        // Unknown to the output stage too: "Unknown sensor" text, no frame
+        return (mode == OUTPUT_TEXT) ? TEXT_FIXED : 0;
+    }
+    fields = (sensorId == SH2_GYRO_INTEGRATED_RV) ? len/2 : (len - REPORT_HDR_LEN)/2;
+
+    switch (mode) {
+        case OUTPUT_TEXT:
+            return TEXT_FIXED + TEXT_FIELD*fields;
+        case OUTPUT_DSF:
+            return DSF_FIXED + DSF_FIELD*fields;
+        case OUTPUT_BIN:
+        case OUTPUT_DELTA:
+            // Keyframes are about a plain frame's size, deltas less
+            return BIN_HDR_LEN + len + BIN_CRC_LEN;
+#if BIN_POSE
+        case OUTPUT_POSE:
+            switch (sensorId) {
+                case SH2_ROTATION_VECTOR:
+                case SH2_GEOMAGNETIC_ROTATION_VECTOR:
+                case SH2_ARVR_STABILIZED_RV:
+                case SH2_GAME_ROTATION_VECTOR:
+                case SH2_ARVR_STABILIZED_GRV:
+                case SH2_GYRO_INTEGRATED_RV:
+                    // Packed quaternion, then the fields after it raw
+                    return BIN_POSE_HDR_LEN + QUAT_PACK_LEN(BIN_POSE_BITS) +
+                           2*(fields - 4) + BIN_CRC_LEN;
+                default:
+                    return BIN_HDR_LEN + len + BIN_CRC_LEN;
+            }
+#endif
+        default:
+            return 0;
+    }
+}
+
+unsigned sensorBudget_busPct(const SensorBudget_t *pBudget)
+{
+    return pct(pBudget->busLoad, pBudget->busCap);
+}
+
+unsigned sensorBudget_outPct(const SensorBudget_t *pBudget)
+{
+    return pct(pBudget->outLoad, pBudget->outCap);
+}
+
+bool sensorBudget_over(const SensorBudget_t *pBudget)
+{
+    return (sensorBudget_busPct(pBudget) > SENSOR_BUDGET_PCT) ||
+           (sensorBudget_outPct(pBudget) > SENSOR_BUDGET_PCT);
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static unsigned pct(uint32_t load, uint32_t cap)
+{
+    if (cap == 0) {
+        return (load != 0) ? 100 : 0;
+    }
+
+    return (unsigned)(((uint64_t)load * 100 + cap - 1) / cap);
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Bandwidth budget of a subscription set.
+ *
+ * Estimates the bytes per second a set of subscriptions puts on the hub
+ * bus (SPI or I2C) and on the output link (UART or USB console), from
+ * the SH-2 report length of each sensor and the output format, so a
+ * table the links can't carry is caught before it reaches the hub
+ * instead of showing up as missing samples.
+ *
+ * The figures are upper bounds for steady streaming: every report at
+ * its subscribed interval, the rate governor and deadband left out,
+ * delta frames counted as plain binary ones, and text lines at a typical
+ * length.  Batching only saves the per-transfer overhead: the hub sends
+ * each report either way.
+ */
+
+#ifndef SENSOR_BUDGET_H
+#define SENSOR_BUDGET_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sensor_output.h"
+
+// Share of a link's raw capacity a subscription set may plan for [%];
+// the rest is left to commands, retries and the SHTP control channels
+#ifndef SENSOR_BUDGET_PCT
+#define SENSOR_BUDGET_PCT (80)
+#endif
+
+// Refuse subscriptions over budget (1), or only warn about them (0)
+#ifndef SENSOR_BUDGET_REJECT
+#define SENSOR_BUDGET_REJECT (0)
+#endif
+
+// Output capacity of the USB console [bytes/s], full speed bulk
+#ifndef SENSOR_BUDGET_USB_BPS
+#define SENSOR_BUDGET_USB_BPS (500000)
+#endif
+
+#if (SENSOR_BUDGET_PCT < 1) || (SENSOR_BUDGET_PCT > 100)
+#error SENSOR_BUDGET_PCT must be 1 to 100
+#endif
+
+// Hub bus the reports come in over
+typedef enum {
+    BUDGET_BUS_SPI,
+    BUDGET_BUS_I2C,
+} BudgetBus_t;
+
+// Planned load and capacity of both links [bytes/s]
+typedef struct {
+    BudgetBus_t bus;
+    OutputMode_t mode;
+    uint32_t busCap;
+    uint32_t outCap;
+    uint32_t busLoad;
+    uint32_t outLoad;
+} SensorBudget_t;
+
+// Start an empty plan.  busHz is the hub bus clock, outBytes_s the
+// output link's capacity (e.g. CONSOLE_BAUD/10).
+void sensorBudget_init(SensorBudget_t *pBudget, BudgetBus_t bus, uint32_t busHz,
+                       OutputMode_t mode, uint32_t outBytes_s);
+
+// Add one subscription to the plan; interval 0 (disabled) adds nothing.
+void sensorBudget_add(SensorBudget_t *pBudget, uint8_t sensorId,
+                      uint32_t interval_us, uint32_t batch_us);
+
+// Report length on the hub bus, report id included, 0 if unknown
+unsigned sensorBudget_reportLen(uint8_t sensorId);
+
+// Bytes output per report in mode
+unsigned sensorBudget_outputLen(uint8_t sensorId, OutputMode_t mode);
+
+// Planned load of the bus and output as a share of capacity [%]
+unsigned sensorBudget_busPct(const SensorBudget_t *pBudget);
+unsigned sensorBudget_outPct(const SensorBudget_t *pBudget);
+
+// True if either link is planned above SENSOR_BUDGET_PCT
+bool sensorBudget_over(const SensorBudget_t *pBudget);
+
+#endif
@@ -0,0 +1,263 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Calibration manager: accuracy tracking, time to accuracy and DCD saves.
+ */
+
+#include "sensor_cal.h"
+
+#include <stdio.h>
+#include <string.h>
+#include "task.h"
+#include "event_groups.h"
+#include "sh2.h"
+#include "sh2_err.h"
+#include "shell.h"
+#include "timebase.h"
+#include "sensor_dispatch.h"
+#include "priorities.h"
+
+#define STATUS_HIGH (3)
+
+// Ready bit of the event group
+#define EVT_READY (1 << 0)
+
+// ------------------------------------------------------------------------
+// Private types
+
+typedef struct {
+    uint8_t sensorId;
+    const char *name;
+    bool hasEstimate;           // rotation vector: accuracy estimate too
+} Tracked_t;
+
+typedef struct {
+    bool seen;                  // reported since the reset
+    uint8_t status;             // accuracy status, bits 1:0
+    int16_t estimate;           // Q SENSORFIX_Q_ACCURACY rad
+    uint64_t ready_uS;          // first reached ready, 0 if not yet
+} Track_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void calEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix);
+static bool isReady(const Tracked_t *t, const Track_t *s);
+static void update(uint64_t t_uS);
+static void accCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static const Tracked_t tracked[] = {
+    { SH2_ACCELEROMETER,               "accel",   false },
+    { SH2_GYROSCOPE_CALIBRATED,        "gyro",    false },
+    { SH2_MAGNETIC_FIELD_CALIBRATED,   "mag",     false },
+    { SH2_ROTATION_VECTOR,             "rv",      true },
+    { SH2_GEOMAGNETIC_ROTATION_VECTOR, "geo rv",  true },
+};
+#define NUM_TRACKED (sizeof(tracked) / sizeof(tracked[0]))
+
+static const char * const statusName[] = {
+    "unreliable", "low", "medium", "high",
+};
+
+// Written by the sensor task; the shell reads a snapshot
+static Track_t track[NUM_TRACKED];
+static uint64_t reset_uS;
+static uint64_t ready_uS;       // first ready since the reset, 0 if not yet
+static int16_t estimateLimit;   // SENSOR_CAL_READY_RV_DEG, Q SENSORFIX_Q_ACCURACY
+
+static SensorCalSaveFn_t *requestSaveFn;
+static volatile bool savePending;
+static uint64_t lastSave_uS;    // of the last save since the reset, 0 if none
+static uint32_t saves;
+static uint32_t saveErrors;
+
+static EventGroupHandle_t events;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void sensorCal_init(SensorCalSaveFn_t *requestSave)
+{
+    requestSaveFn = requestSave;
+    estimateLimit = (int16_t)(SENSOR_CAL_READY_RV_DEG * (3.14159265f / 180.0f) *
+                              (float)(1 << SENSORFIX_Q_ACCURACY));
+    events = xEventGroupCreate();
+
+    shell_addCommand("acc", "sensor accuracy, time to accuracy after reset, DCD saves", accCmd);
+    sensorDispatch_subscribe(SENSOR_DISPATCH_ALL, PRIO_SUB_CAL, calEvent, 0);
+}
+
+void sensorCal_restart(uint64_t t_uS)
+{
+    taskENTER_CRITICAL();
+    memset(track, 0, sizeof(track));
+    reset_uS = t_uS;
+    ready_uS = 0;
+    lastSave_uS = 0;
+    taskEXIT_CRITICAL();
+
+    xEventGroupClearBits(events, EVT_READY);
+}
+
+void sensorCal_saved(int status)
+{
+    if (status == SH2_OK) {
+        saves++;
+    }
+    else {
+        saveErrors++;
+    }
+    savePending = false;
+}
+
+bool sensorCal_ready(void)
+{
+    return (xEventGroupGetBits(events) & EVT_READY) != 0;
+}
+
+bool sensorCal_waitReady(TickType_t timeout)
+{
+    return (xEventGroupWaitBits(events, EVT_READY, pdFALSE, pdTRUE, timeout) & EVT_READY) != 0;
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+// Dispatch callback, in the sensor task
+static void calEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix)
+{
+    if (pFix == 0) {
+        return;
+    }
+
+    for (unsigned n = 0; n < NUM_TRACKED; n++) {
+        if (tracked[n].sensorId == pEvent->reportId) {
+            Track_t *s = &track[n];
+
+            taskENTER_CRITICAL();
+            s->seen = true;
+            s->status = pFix->status & 0x3;
+            if (tracked[n].hasEstimate && pFix->un.quat.hasAccuracy) {
+                s->estimate = pFix->un.quat.accuracy;
+            }
+            if ((s->ready_uS == 0) && isReady(&tracked[n], s)) {
+                s->ready_uS = pFix->timestamp_uS;
+            }
+            taskEXIT_CRITICAL();
+
+            update(pFix->timestamp_uS);
+            return;
+        }
+    }
+}
+
+static bool isReady(const Tracked_t *t, const Track_t *s)
+{
+    return (s->status >= SENSOR_CAL_READY_STATUS) &&
+           (!t->hasEstimate || (s->estimate <= estimateLimit));
+}
+
+// Re-evaluate the ready signal and whether the DCD is worth saving
+static void update(uint64_t t_uS)
+{
+    bool any = false;
+    bool ready = true;
+    bool high = true;
+
+    for (unsigned n = 0; n < NUM_TRACKED; n++) {
+        if (!track[n].seen) {
+            continue;
+        }
+        any = true;
+        ready = ready && isReady(&tracked[n], &track[n]);
+        high = high && (track[n].status == STATUS_HIGH);
+    }
+    ready = ready && any;
+    high = high && ready;
+
+    if (ready && (ready_uS == 0)) {
+        ready_uS = t_uS;
+        printf("Calibration ready %u ms after reset.\n", (unsigned)((t_uS - reset_uS) / 1000));
+    }
+    if (ready != sensorCal_ready()) {
+        if (ready) {
+            xEventGroupSetBits(events, EVT_READY);
+        }
+        else {
+            xEventGroupClearBits(events, EVT_READY);
+        }
+    }
+
+    if (high && !savePending && (requestSaveFn != 0) &&
+        ((lastSave_uS == 0) || (t_uS - lastSave_uS >= (uint64_t)SENSOR_CAL_SAVE_INTERVAL_MS * 1000))) {
+        savePending = true;
+        lastSave_uS = t_uS;
+        requestSaveFn();
+    }
+}
+
+// Shell command: show accuracy and time to accuracy per sensor.
+static void accCmd(int argc, char *argv[])
+{
+    Track_t s[NUM_TRACKED];
+    uint64_t reset, ready, lastSave;
+
+    taskENTER_CRITICAL();
+    memcpy(s, track, sizeof(s));
+    reset = reset_uS;
+    ready = ready_uS;
+    lastSave = lastSave_uS;
+    taskEXIT_CRITICAL();
+
+    uint64_t now_uS = timebase_getUs();
+    if (ready != 0) {
+        printf("Calibration %s, ready %u ms after reset\n",
+               sensorCal_ready() ? "ready" : "not ready now", (unsigned)((ready - reset) / 1000));
+    }
+    else {
+        printf("Calibration not ready, %u s since reset\n", (unsigned)((now_uS - reset) / 1000000));
+    }
+    printf("  DCD saves %u (errors %u)", (unsigned)saves, (unsigned)saveErrors);
+    if (lastSave != 0) {
+        printf(", last %u s ago", (unsigned)((now_uS - lastSave) / 1000000));
+    }
+    printf("\n");
+
+    printf("  %-8s %-10s %9s %10s\n", "sensor", "status", "estimate", "ready [ms]");
+    for (unsigned n = 0; n < NUM_TRACKED; n++) {
+        if (!s[n].seen) {
+            continue;
+        }
+        printf("  %-8s %-10s ", tracked[n].name, statusName[s[n].status]);
+        if (tracked[n].hasEstimate) {
+            printf("%5.1f deg ", s[n].estimate * (180.0f / 3.14159265f) / (float)(1 << SENSORFIX_Q_ACCURACY));
+        }
+        else {
+            printf("%9s ", "");
+        }
+        if (s[n].ready_uS != 0) {
+            printf("%10u\n", (unsigned)((s[n].ready_uS - reset) / 1000));
+        }
+        else {
+            printf("%10s\n", "-");
+        }
+    }
+}
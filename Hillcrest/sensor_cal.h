@@ -0,0 +1,81 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Calibration manager: accuracy tracking, time to accuracy and DCD saves.
+ *
+ * The hub's dynamic calibration (cal command) starts over from the
+ * last saved DCD after each reset, and accuracy is poor until it
+ * converges.  The manager follows the accuracy status of accelerometer,
+ * gyroscope and magnetometer reports, and the accuracy estimate of the
+ * rotation vectors, and:
+ *   - declares orientation ready once every tracked sensor that
+ *     reports has at least SENSOR_CAL_READY_STATUS (and the rotation
+ *     vectors an estimate within SENSOR_CAL_READY_RV_DEG).  Consumers
+ *     poll sensorCal_ready() or block in sensorCal_waitReady().
+ *   - measures time to ready, and to each sensor's own readiness,
+ *     from the hub reset.
+ *   - has the DCD saved when everything reports high accuracy: the
+ *     first time after each reset, then at most every
+ *     SENSOR_CAL_SAVE_INTERVAL_MS.  So the next warm start begins from
+ *     a converged calibration, never from one saved while poor.
+ * The "acc" command shows it all.
+ */
+
+#ifndef SENSOR_CAL_H
+#define SENSOR_CAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "FreeRTOS.h"
+
+// Accuracy status the ready signal needs (0 unreliable .. 3 high)
+#ifndef SENSOR_CAL_READY_STATUS
+#define SENSOR_CAL_READY_STATUS (2)
+#endif
+
+// Rotation vector accuracy estimate the ready signal needs [deg]
+#ifndef SENSOR_CAL_READY_RV_DEG
+#define SENSOR_CAL_READY_RV_DEG (10.0f)
+#endif
+
+// Shortest time between DCD saves while accuracy stays high [ms]
+#ifndef SENSOR_CAL_SAVE_INTERVAL_MS
+#define SENSOR_CAL_SAVE_INTERVAL_MS (300000)
+#endif
+
+// Called in the sensor task to have the DCD saved.  The owner of the
+// SH-2 API saves it and reports back through sensorCal_saved().
+typedef void (SensorCalSaveFn_t)(void);
+
+// Register the "acc" command and subscribe to every sensor.
+void sensorCal_init(SensorCalSaveFn_t *requestSave);
+
+// The hub was reset at reset_uS: calibration starts over.  Called by
+// the sensor task.
+void sensorCal_restart(uint64_t reset_uS);
+
+// Result of the save requested (SH2_OK or an error).
+void sensorCal_saved(int status);
+
+// True while orientation can be trusted
+bool sensorCal_ready(void);
+
+// Wait up to timeout for sensorCal_ready(); returns it.
+bool sensorCal_waitReady(TickType_t timeout);
+
+#endif
@@ -0,0 +1,222 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Camera shutter sync: a pose for every trigger edge.
+ */
+
+#include "sensor_camsync.h"
+
+#if SENSOR_CAMSYNC
+
+#include <stdio.h>
+#include <string.h>
+#include "stm32f4xx_hal.h"
+#include "sh2_err.h"
+#include "shell.h"
+#include "sysstats.h"
+#include "timebase.h"
+#include "spsc.h"
+#include "girv_predict.h"
+#include "sensor_dispatch.h"
+#include "priorities.h"
+
+// ------------------------------------------------------------------------
+// Private types
+
+typedef SPSC_RING(uint64_t, SENSOR_CAMSYNC_PENDING) StampRing_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void edge(uint64_t t_uS);
+static void girvEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix);
+static void publishPose(uint64_t t_uS, uint8_t status);
+static void putQ14(uint8_t *p, float v);
+static void camCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+// Edge times, from the TIM2 ISR to the sensor task
+static StampRing_t pending;
+
+static volatile bool enabled;
+static volatile bool flushNeeded;
+
+// The two latest GIRV sample times, as girv_predict holds them
+static uint64_t previous_uS;
+static uint64_t latest_uS;
+
+static uint8_t seq;
+static uint64_t lastEdge_uS;
+static volatile uint32_t lastInterval_uS;
+
+static uint32_t edges;
+static uint32_t poses;
+static uint32_t stale;
+static uint32_t full;               // edges with no room to wait
+static volatile uint32_t lost;      // edges the ISR missed (overcapture)
+
+// ------------------------------------------------------------------------
+// Public API
+
+void sensorCamsync_init(void)
+{
+    GPIO_InitTypeDef GPIO_InitStruct;
+
+    memset(&GPIO_InitStruct, 0, sizeof(GPIO_InitStruct));
+    __GPIOA_CLK_ENABLE();
+    GPIO_InitStruct.Pin = SENSOR_CAMSYNC_PIN;
+    GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+    GPIO_InitStruct.Pull = GPIO_PULLDOWN;
+    GPIO_InitStruct.Speed = GPIO_SPEED_LOW;
+    GPIO_InitStruct.Alternate = GPIO_AF1_TIM2;
+    HAL_GPIO_Init(SENSOR_CAMSYNC_PORT, &GPIO_InitStruct);
+
+    sysstats_addMemory("camera sync", sizeof(pending));
+    sysstats_addCounter("cam edges lost", (const uint32_t *)&lost);
+    shell_addCommand("cam", "[on | off] camera trigger poses", camCmd);
+    sensorDispatch_subscribe(SH2_GYRO_INTEGRATED_RV, PRIO_SUB_CAMSYNC, girvEvent, 0);
+    sensorCamsync_enable(SENSOR_CAMSYNC_ON);
+}
+
+void sensorCamsync_enable(bool on)
+{
+    if (!on) {
+        // The sensor task drops what is still waiting
+        flushNeeded = true;
+    }
+    enabled = on;
+    timebase_setCapture(on ? edge : 0, &lost);
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+// Capture callback, in the TIM2 ISR
+static void edge(uint64_t t_uS)
+{
+    uint64_t *p = spsc_writeSlot(&pending);
+
+    edges++;
+    lastInterval_uS = (lastEdge_uS != 0) ? (uint32_t)(t_uS - lastEdge_uS) : 0;
+    lastEdge_uS = t_uS;
+
+    if (p == 0) {
+        full++;
+        return;
+    }
+    *p = t_uS;
+    spsc_push(&pending);
+}
+
+// Dispatch callback, in the sensor task, after girv_predict has the sample
+static void girvEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix)
+{
+    uint64_t *p;
+
+    if (pFix == 0) {
+        return;
+    }
+    previous_uS = latest_uS;
+    latest_uS = pFix->timestamp_uS;
+
+    if (flushNeeded) {
+        flushNeeded = false;
+        spsc_flush(&pending);
+    }
+
+    // Edges up to this sample now have one on either side
+    while ((p = spsc_readSlot(&pending)) != 0) {
+        uint64_t t = *p;
+
+        if (t > latest_uS) {
+            break;
+        }
+        spsc_pop(&pending);
+        publishPose(t, (t < previous_uS) ? CAMSYNC_STALE : 0);
+    }
+}
+
+static void publishPose(uint64_t t_uS, uint8_t status)
+{
+    sh2_SensorEvent_t event;
+    Quat_t q;
+
+    if (girvPredict_at(t_uS, &q) != SH2_OK) {
+        return;
+    }
+
+    memset(&event, 0, sizeof(event));
+    event.timestamp_uS = t_uS;
+    event.reportId = CAMSYNC_REPORT_ID;
+    event.len = CAMSYNC_REPORT_LEN;
+    event.report[0] = CAMSYNC_REPORT_ID;
+    event.report[1] = seq++;
+    event.report[2] = status;
+    putQ14(&event.report[4], q.x);
+    putQ14(&event.report[6], q.y);
+    putQ14(&event.report[8], q.z);
+    putQ14(&event.report[10], q.w);
+
+    poses++;
+    if (status & CAMSYNC_STALE) {
+        stale++;
+    }
+
+    // Dispatch is re-entrant: the later subscribers of this GIRV sample
+    // run after every subscriber has seen the pose.
+    sensorDispatch_publish(&event);
+}
+
+static void putQ14(uint8_t *p, float v)
+{
+    int32_t x = (int32_t)(v * (float)(1 << 14) + ((v >= 0) ? 0.5f : -0.5f));
+
+    // |v| <= 1 on a unit quaternion, but 1.0 itself is just out of range
+    if (x > INT16_MAX) x = INT16_MAX;
+    if (x < INT16_MIN) x = INT16_MIN;
+    p[0] = (uint8_t)(x & 0xFF);
+    p[1] = (uint8_t)((x >> 8) & 0xFF);
+}
+
+static void camCmd(int argc, char *argv[])
+{
+    if (argc > 1) {
+        if (strcmp(argv[1], "on") == 0) {
+            sensorCamsync_enable(true);
+        }
+        else if (strcmp(argv[1], "off") == 0) {
+            sensorCamsync_enable(false);
+        }
+        else {
+            printf("Usage: cam [on | off]\n");
+            return;
+        }
+    }
+
+    printf("Camera sync %s (TIM2_CH1)\n", enabled ? "on" : "off");
+    printf("  edges %u, poses %u (%u stale), waiting %u\n",
+           edges, poses, stale, spsc_count(&pending));
+    printf("  dropped %u waiting, %u missed by the ISR\n", full, lost);
+    if (lastInterval_uS != 0) {
+        printf("  last interval %u us\n", lastInterval_uS);
+    }
+}
+
+#endif
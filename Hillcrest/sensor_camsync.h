@@ -0,0 +1,86 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Camera shutter sync: a pose for every trigger edge.
+ *
+ * A camera's trigger (or strobe) output on TIM2_CH1 is captured by the
+ * timer itself (timebase_setCapture()), so each edge is timestamped on
+ * the same microsecond clock as INTN and the sensor reports, without
+ * interrupt latency in the stamp.  Once a Gyro Integrated RV sample at
+ * or after the edge is in, the orientation at the edge is interpolated
+ * between the two samples either side (girvPredict_at()) and published
+ * through sensor_dispatch as a report of its own, CAMSYNC_REPORT_ID,
+ * timestamped at the edge.  It goes out on the console in every output
+ * format and into recordings like any other report.
+ *
+ * The report is not an SH-2 one: its id is outside the hub's range, so
+ * subscribe to SENSOR_DISPATCH_ALL and pick it out by id.  It has a
+ * standard 4-byte report header and no fixed-point decode (pFix NULL):
+ *   [0] CAMSYNC_REPORT_ID   [1] trigger seq   [2] status   [3] 0
+ *   [4..11] i, j, k, real (16-bit LE, Q14, as the rotation vector)
+ * CAMSYNC_STALE in status marks a trigger older than both samples held,
+ * whose pose is the older sample's rather than interpolated.
+ *
+ * Alignment is set by the GIRV rate: at 1kHz the edge falls between two
+ * samples 1ms apart, and the slerp between them carries the rest.
+ * Needs GIRV enabled; edges in STOP mode are missed.
+ */
+
+#ifndef SENSOR_CAMSYNC_H
+#define SENSOR_CAMSYNC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Build in camera sync (takes TIM2_CH1 and its pin)
+#ifndef SENSOR_CAMSYNC
+#define SENSOR_CAMSYNC (1)
+#endif
+
+// Trigger input, TIM2_CH1 in AF1: PA0 (A0 on the Nucleo), or PA15 where
+// the board has it free
+#ifndef SENSOR_CAMSYNC_PORT
+#define SENSOR_CAMSYNC_PORT GPIOA
+#define SENSOR_CAMSYNC_PIN GPIO_PIN_0
+#endif
+
+// Edges waiting for a GIRV sample after them (a power of two)
+#ifndef SENSOR_CAMSYNC_PENDING
+#define SENSOR_CAMSYNC_PENDING (8)
+#endif
+
+// Capturing at startup, else "cam on"
+#ifndef SENSOR_CAMSYNC_ON
+#define SENSOR_CAMSYNC_ON (0)
+#endif
+
+// Report id of the trigger poses.  Above the SH-2 sensor ids, and below
+// BIN_DELTA_KEY, so it frames in either binary output.
+#define CAMSYNC_REPORT_ID (0x70)
+#define CAMSYNC_REPORT_LEN (12)
+
+// Report status bits
+#define CAMSYNC_STALE (0x01)
+
+// Register the "cam" command and subscribe to GIRV reports.
+void sensorCamsync_init(void);
+
+// Start or stop capturing trigger edges.
+void sensorCamsync_enable(bool on);
+
+#endif
@@ -0,0 +1,315 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Per-subscriber decimation of dispatched sensor events.
+ */
+
+#include "sensor_decim.h"
+
+#include <stdbool.h>
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "sh2_err.h"
+#include "quat.h"
+#include "sysstats.h"
+
+#define IIR_ALPHA (1.0f / (float)(1 << SENSOR_DECIM_IIR_SHIFT))
+
+// ------------------------------------------------------------------------
+// Private types
+
+// One sample in float: the orientation of quaternion kinds, and up to
+// three other channels (vec3, RV accuracy or GIRV angular velocity).
+typedef struct {
+    Quat_t q;
+    float v[3];
+} Sample_t;
+
+typedef struct {
+    uint8_t sensorId;
+    unsigned factor;
+    SensorDecimFilter_t filter;
+    SensorDispatchFn_t *fn;
+    void *cookie;
+
+    unsigned count;          // inputs since the last output
+    Sample_t acc;            // AVERAGE sum, or IIR state
+    bool primed;             // IIR state valid
+    uint64_t t0_uS;          // AVERAGE: first sample's time
+    uint64_t tSum_uS;        // ... and the sum of times after it
+    Sample_t window[SENSOR_DECIM_BOXCAR_TAPS];
+    unsigned windowFill;
+    unsigned windowIdx;      // where the next sample goes
+} Decim_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void decimEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix);
+static bool isQuatKind(const SensorFix_t *fix);
+static void toSample(Sample_t *s, const SensorFix_t *fix);
+static void fromSample(SensorFix_t *fix, const Sample_t *s);
+static void scale(Sample_t *s, float k);
+static void accumulate(Sample_t *sum, const Sample_t *x, bool isQuat, float w);
+static int16_t toFix(float v, unsigned q);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+// Each decimator is only touched by the sensor task once it has been
+// subscribed; numDecims is claimed in a critical section.
+static Decim_t decims[SENSOR_DECIM_MAX];
+static unsigned numDecims;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void sensorDecim_init(void)
+{
+    sysstats_addMemory("decimators", sizeof(decims));
+}
+
+int sensorDecim_subscribe(uint8_t sensorId, int prio, unsigned factor,
+                          SensorDecimFilter_t filter,
+                          SensorDispatchFn_t *fn, void *cookie)
+{
+    Decim_t *d = 0;
+
+    if ((sensorId == SENSOR_DISPATCH_ALL) || (sensorId > SH2_MAX_SENSOR_ID) ||
+        (factor == 0) || (filter > SENSOR_DECIM_IIR) || (fn == 0)) {
+        return SH2_ERR_BAD_PARAM;
+    }
+
+    taskENTER_CRITICAL();
+    if (numDecims < SENSOR_DECIM_MAX) {
+        d = &decims[numDecims++];
+    }
+    taskEXIT_CRITICAL();
+
+    if (d == 0) {
+        return SH2_ERR;
+    }
+
+    memset(d, 0, sizeof(*d));
+    d->sensorId = sensorId;
+    d->factor = factor;
+    d->filter = filter;
+    d->fn = fn;
+    d->cookie = cookie;
+
+    return sensorDispatch_subscribe(sensorId, prio, decimEvent, d);
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+// Dispatch callback, in the sensor task
+static void decimEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix)
+{
+    Decim_t *d = (Decim_t *)cookie;
+    SensorFix_t out;
+    Sample_t x, y;
+    bool isQuat;
+
+    if (pFix == 0) {
+        // Nothing to filter, just thin out
+        if (++d->count >= d->factor) {
+            d->count = 0;
+            d->fn(d->cookie, pEvent, 0);
+        }
+        return;
+    }
+
+    toSample(&x, pFix);
+    isQuat = isQuatKind(pFix);
+
+    switch (d->filter) {
+        case SENSOR_DECIM_AVERAGE:
+            if (d->count == 0) {
+                memset(&d->acc, 0, sizeof(d->acc));
+                d->t0_uS = pFix->timestamp_uS;
+                d->tSum_uS = 0;
+            }
+            accumulate(&d->acc, &x, isQuat, 1.0f);
+            d->tSum_uS += pFix->timestamp_uS - d->t0_uS;
+            break;
+        case SENSOR_DECIM_BOXCAR:
+            d->window[d->windowIdx] = x;
+            d->windowIdx = (d->windowIdx + 1) % SENSOR_DECIM_BOXCAR_TAPS;
+            if (d->windowFill < SENSOR_DECIM_BOXCAR_TAPS) {
+                d->windowFill++;
+            }
+            break;
+        case SENSOR_DECIM_IIR:
+            if (!d->primed) {
+                d->acc = x;
+                d->primed = true;
+            }
+            else {
+                // acc += alpha * (x - acc)
+                scale(&d->acc, 1.0f - IIR_ALPHA);
+                accumulate(&d->acc, &x, isQuat, IIR_ALPHA);
+                if (isQuat) {
+                    d->acc.q = quat_normalize(d->acc.q);
+                }
+            }
+            break;
+        default:
+            break;
+    }
+
+    if (++d->count < d->factor) {
+        return;
+    }
+    d->count = 0;
+
+    out = *pFix;
+    switch (d->filter) {
+        case SENSOR_DECIM_AVERAGE:
+            y = d->acc;
+            scale(&y, 1.0f / (float)d->factor);
+            out.timestamp_uS = d->t0_uS + d->tSum_uS / d->factor;
+            break;
+        case SENSOR_DECIM_BOXCAR:
+            // Newest first, so every sample turns to its hemisphere
+            memset(&y, 0, sizeof(y));
+            for (unsigned n = 1; n <= d->windowFill; n++) {
+                unsigned i = (d->windowIdx + SENSOR_DECIM_BOXCAR_TAPS - n) % SENSOR_DECIM_BOXCAR_TAPS;
+                accumulate(&y, &d->window[i], isQuat, 1.0f);
+            }
+            scale(&y, 1.0f / (float)d->windowFill);
+            break;
+        case SENSOR_DECIM_IIR:
+            y = d->acc;
+            break;
+        default:
+            y = x;
+            break;
+    }
+    fromSample(&out, &y);
+
+    d->fn(d->cookie, pEvent, &out);
+}
+
+static bool isQuatKind(const SensorFix_t *fix)
+{
+    return (fix->kind == SENSORFIX_QUAT) || (fix->kind == SENSORFIX_GIRV);
+}
+
+static void toSample(Sample_t *s, const SensorFix_t *fix)
+{
+    memset(s, 0, sizeof(*s));
+
+    switch (fix->kind) {
+        case SENSORFIX_QUAT:
+            s->q = quat_fromFix(fix);
+            if (fix->un.quat.hasAccuracy) {
+                s->v[0] = FIX_TO_FLOAT(SENSORFIX_Q_ACCURACY, fix->un.quat.accuracy);
+            }
+            break;
+        case SENSORFIX_GIRV:
+            s->q = quat_fromFix(fix);
+            s->v[0] = FIX_TO_FLOAT(SENSORFIX_Q_ANGVEL, fix->un.girv.angVelX);
+            s->v[1] = FIX_TO_FLOAT(SENSORFIX_Q_ANGVEL, fix->un.girv.angVelY);
+            s->v[2] = FIX_TO_FLOAT(SENSORFIX_Q_ANGVEL, fix->un.girv.angVelZ);
+            break;
+        default:
+            s->v[0] = FIX_TO_FLOAT(fix->q, fix->un.vec3.x);
+            s->v[1] = FIX_TO_FLOAT(fix->q, fix->un.vec3.y);
+            s->v[2] = FIX_TO_FLOAT(fix->q, fix->un.vec3.z);
+            break;
+    }
+}
+
+// Store s into fix, whose kind and Q point say where
+static void fromSample(SensorFix_t *fix, const Sample_t *s)
+{
+    Quat_t q = quat_normalize(s->q);
+
+    switch (fix->kind) {
+        case SENSORFIX_QUAT:
+            fix->un.quat.real = toFix(q.w, SENSORFIX_Q_QUAT);
+            fix->un.quat.i = toFix(q.x, SENSORFIX_Q_QUAT);
+            fix->un.quat.j = toFix(q.y, SENSORFIX_Q_QUAT);
+            fix->un.quat.k = toFix(q.z, SENSORFIX_Q_QUAT);
+            if (fix->un.quat.hasAccuracy) {
+                fix->un.quat.accuracy = toFix(s->v[0], SENSORFIX_Q_ACCURACY);
+            }
+            break;
+        case SENSORFIX_GIRV:
+            fix->un.girv.real = toFix(q.w, SENSORFIX_Q_QUAT);
+            fix->un.girv.i = toFix(q.x, SENSORFIX_Q_QUAT);
+            fix->un.girv.j = toFix(q.y, SENSORFIX_Q_QUAT);
+            fix->un.girv.k = toFix(q.z, SENSORFIX_Q_QUAT);
+            fix->un.girv.angVelX = toFix(s->v[0], SENSORFIX_Q_ANGVEL);
+            fix->un.girv.angVelY = toFix(s->v[1], SENSORFIX_Q_ANGVEL);
+            fix->un.girv.angVelZ = toFix(s->v[2], SENSORFIX_Q_ANGVEL);
+            break;
+        default:
+            fix->un.vec3.x = toFix(s->v[0], fix->q);
+            fix->un.vec3.y = toFix(s->v[1], fix->q);
+            fix->un.vec3.z = toFix(s->v[2], fix->q);
+            break;
+    }
+}
+
+static void scale(Sample_t *s, float k)
+{
+    s->q.w *= k;
+    s->q.x *= k;
+    s->q.y *= k;
+    s->q.z *= k;
+    for (unsigned n = 0; n < 3; n++) {
+        s->v[n] *= k;
+    }
+}
+
+// sum += w * x, with the quaternion turned into sum's hemisphere
+static void accumulate(Sample_t *sum, const Sample_t *x, bool isQuat, float w)
+{
+    float wq = w;
+
+    if (isQuat &&
+        ((sum->q.w*x->q.w + sum->q.x*x->q.x + sum->q.y*x->q.y + sum->q.z*x->q.z) < 0.0f)) {
+        wq = -w;
+    }
+
+    sum->q.w += wq * x->q.w;
+    sum->q.x += wq * x->q.x;
+    sum->q.y += wq * x->q.y;
+    sum->q.z += wq * x->q.z;
+    for (unsigned n = 0; n < 3; n++) {
+        sum->v[n] += w * x->v[n];
+    }
+}
+
+// Round v to a Q-point int16, saturating
+static int16_t toFix(float v, unsigned q)
+{
+    float f = v * (float)(1 << q);
+
+    f += (f >= 0.0f) ? 0.5f : -0.5f;
+    if (f >= 32767.0f) {
+        return 32767;
+    }
+    if (f <= -32768.0f) {
+        return -32768;
+    }
+    return (int16_t)f;
+}
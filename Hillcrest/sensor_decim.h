@@ -0,0 +1,85 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Per-subscriber decimation of dispatched sensor events.
+ *
+ * Subscribe the hub at the highest rate any consumer needs; each
+ * decimator then passes one event in every factor to its callback,
+ * filtered so the slower stream isn't aliased:
+ *   - SENSOR_DECIM_AVERAGE: mean of each factor samples (a boxcar of
+ *     factor taps, evaluated once per output).
+ *   - SENSOR_DECIM_BOXCAR: mean of the last SENSOR_DECIM_BOXCAR_TAPS
+ *     samples, whatever the factor.
+ *   - SENSOR_DECIM_IIR: one-pole low pass, coefficient
+ *     1/2^SENSOR_DECIM_IIR_SHIFT, updated on every sample.
+ *   - SENSOR_DECIM_NONE: just every factor'th sample.
+ *
+ * Quaternions are averaged by summing with the sign of each sample
+ * flipped to agree with the rest (q and -q are the same rotation) and
+ * normalizing, which is the least-squares mean for the closely spaced
+ * orientations of one sensor.  Vectors, the accuracy estimate
+ * and GIRV angular velocity are averaged per component.
+ *
+ * The callback gets the latest input event as pEvent, unfiltered, and
+ * the filtered values in pFix, stamped with the mean time of the
+ * samples averaged (SENSOR_DECIM_AVERAGE) or the latest's.  Reports
+ * without a fixed-point decoding are decimated but not filtered.
+ */
+
+#ifndef SENSOR_DECIM_H
+#define SENSOR_DECIM_H
+
+#include <stdint.h>
+#include "sensor_dispatch.h"
+
+// Number of decimators.  Each also takes a dispatch subscriber slot.
+#ifndef SENSOR_DECIM_MAX
+#define SENSOR_DECIM_MAX (4)
+#endif
+
+// Length of the SENSOR_DECIM_BOXCAR window
+#ifndef SENSOR_DECIM_BOXCAR_TAPS
+#define SENSOR_DECIM_BOXCAR_TAPS (4)
+#endif
+
+// SENSOR_DECIM_IIR time constant, in input samples, is 2^shift
+#ifndef SENSOR_DECIM_IIR_SHIFT
+#define SENSOR_DECIM_IIR_SHIFT (2)
+#endif
+
+typedef enum {
+    SENSOR_DECIM_NONE,
+    SENSOR_DECIM_AVERAGE,
+    SENSOR_DECIM_BOXCAR,
+    SENSOR_DECIM_IIR,
+} SensorDecimFilter_t;
+
+// Register the decimators' memory.
+void sensorDecim_init(void);
+
+// Call fn with one filtered event for every factor events from
+// sensorId, which must be a single sensor, not SENSOR_DISPATCH_ALL.
+// prio orders fn among the dispatch subscribers, as for
+// sensorDispatch_subscribe().
+// Returns SH2_OK, SH2_ERR_BAD_PARAM, or SH2_ERR if no decimator (or
+// dispatch slot) is free.
+int sensorDecim_subscribe(uint8_t sensorId, int prio, unsigned factor,
+                          SensorDecimFilter_t filter,
+                          SensorDispatchFn_t *fn, void *cookie);
+
+#endif
@@ -0,0 +1,363 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Sensor event dispatch.
+ */
+
+#include "sensor_dispatch.h"
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "task.h"
+#include "sh2_err.h"
+#include "sysstats.h"
+#if SENSOR_DISPATCH_BACKPRESSURE
+#include "shell.h"
+#include "priorities.h"
+#endif
+
+// Sensors with a subscriber of their own at this prio or above keep
+// their rate under backpressure
+#ifndef SENSOR_DISPATCH_CRITICAL_PRIO
+#define SENSOR_DISPATCH_CRITICAL_PRIO (PRIO_SUB_RATE)
+#endif
+
+// ------------------------------------------------------------------------
+// Private types
+
+typedef struct Subscriber_s {
+    struct Subscriber_s * volatile next;  // next lower (or equal) prio
+    uint8_t sensorId;                     // or SENSOR_DISPATCH_ALL
+    int prio;
+    SensorDispatchFn_t *fn;               // NULL for a queue subscriber
+    void *cookie;
+    QueueHandle_t queue;
+} Subscriber_t;
+
+#if SENSOR_DISPATCH_BACKPRESSURE
+// A consumer whose fill is watched: a callback's fill function, or a
+// queue subscriber's queue
+typedef struct {
+    const char *name;
+    SensorDispatchFillFn_t *fill;
+    QueueHandle_t queue;
+    uint16_t fill_permille;         // at the last reading
+    uint16_t peak_permille;
+    uint32_t pressured;             // readings above the high mark
+} Consumer_t;
+#endif
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static int addSubscriber(uint8_t sensorId, int prio,
+                         SensorDispatchFn_t *fn, void *cookie, QueueHandle_t queue);
+#if SENSOR_DISPATCH_BACKPRESSURE
+static int addConsumer(const char *name, SensorDispatchFillFn_t *fill, QueueHandle_t queue);
+static void checkPressure(TickType_t now);
+static bool critical(uint8_t sensorId);
+static void pressureCmd(int argc, char *argv[]);
+#endif
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+// Subscribers in descending prio order.  Entries are filled in before
+// being linked, and the link is a single store, so the sensor task can walk
+// the list while another task subscribes.  Subscribing tasks are
+// serialized by a critical section.
+static Subscriber_t subs[SENSOR_DISPATCH_MAX_SUBS];
+static unsigned numSubs;
+static Subscriber_t * volatile head;
+
+static uint32_t queueDrops;
+
+#if SENSOR_DISPATCH_BACKPRESSURE
+// Filled in before being counted, as the subscribers
+static Consumer_t consumers[SENSOR_DISPATCH_MAX_CONSUMERS];
+static volatile unsigned numConsumers;
+
+static SensorDispatchChangedFn_t *changedFn;
+static TickType_t nextCheck;
+static bool high;                   // some consumer above the high mark ...
+static bool clear;                  // ... or all of them below the low one
+static TickType_t since;            // ... from then
+static volatile unsigned steps;     // halvings of the non-critical rates
+static uint32_t slowdowns;
+#endif
+
+// ------------------------------------------------------------------------
+// Public API
+
+void sensorDispatch_init(SensorDispatchChangedFn_t *changed)
+{
+    sysstats_addCounter("dispatch q drops", &queueDrops);
+#if SENSOR_DISPATCH_BACKPRESSURE
+    changedFn = changed;
+    sysstats_addCounter("dispatch slowdowns", &slowdowns);
+    shell_addCommand("pressure", "consumer fill and backpressure on the sensor rates",
+                     pressureCmd);
+#endif
+}
+
+int sensorDispatch_subscribe(uint8_t sensorId, int prio,
+                             SensorDispatchFn_t *fn, void *cookie)
+{
+    return addSubscriber(sensorId, prio, fn, cookie, 0);
+}
+
+int sensorDispatch_subscribeQueue(uint8_t sensorId, int prio, QueueHandle_t queue)
+{
+    int status = addSubscriber(sensorId, prio, 0, 0, queue);
+
+#if SENSOR_DISPATCH_BACKPRESSURE
+    if (status == SH2_OK) {
+        addConsumer("queue", 0, queue);
+    }
+#endif
+    return status;
+}
+
+void sensorDispatch_publish(const sh2_SensorEvent_t *pEvent)
+{
+    SensorFix_t fix;
+    const SensorFix_t *pFix = 0;
+    bool decoded = false;
+
+#if SENSOR_DISPATCH_BACKPRESSURE
+    TickType_t now = xTaskGetTickCount();
+    if ((TickType_t)(now - nextCheck) < portMAX_DELAY / 2) {
+        nextCheck = now + pdMS_TO_TICKS(SENSOR_DISPATCH_CHECK_MS);
+        checkPressure(now);
+    }
+#endif
+
+    for (Subscriber_t *s = head; s != 0; s = s->next) {
+        if ((s->sensorId != SENSOR_DISPATCH_ALL) && (s->sensorId != pEvent->reportId)) {
+            continue;
+        }
+
+        if (s->fn == 0) {
+            if (xQueueSendToBack(s->queue, pEvent, 0) != pdPASS) {
+                queueDrops++;
+            }
+            continue;
+        }
+
+        // Decode once, on behalf of all callbacks
+        if (!decoded) {
+            decoded = true;
+            if (sensorFix_decode(&fix, pEvent) == SH2_OK) {
+                pFix = &fix;
+            }
+        }
+        s->fn(s->cookie, pEvent, pFix);
+    }
+}
+
+#if SENSOR_DISPATCH_BACKPRESSURE
+int sensorDispatch_addConsumer(const char *name, SensorDispatchFillFn_t *fill)
+{
+    return addConsumer(name, fill, 0);
+}
+
+uint32_t sensorDispatch_interval(uint8_t sensorId, uint32_t interval_us)
+{
+    unsigned n = steps;
+
+    if ((n == 0) || (interval_us == 0) || critical(sensorId)) {
+        return interval_us;
+    }
+
+    uint64_t slow_us = (uint64_t)interval_us << n;
+    if (slow_us > SENSOR_DISPATCH_MAX_INTERVAL_US) {
+        // Never speed a subscription up that was slower already
+        slow_us = (interval_us > SENSOR_DISPATCH_MAX_INTERVAL_US) ?
+                  interval_us : SENSOR_DISPATCH_MAX_INTERVAL_US;
+    }
+    return (uint32_t)slow_us;
+}
+#endif
+
+// ------------------------------------------------------------------------
+// Private functions
+
+static int addSubscriber(uint8_t sensorId, int prio,
+                         SensorDispatchFn_t *fn, void *cookie, QueueHandle_t queue)
+{
+    int status = SH2_OK;
+
+    if (sensorId > SH2_MAX_SENSOR_ID) {
+        return SH2_ERR_BAD_PARAM;
+    }
+
+    taskENTER_CRITICAL();
+    if (numSubs >= SENSOR_DISPATCH_MAX_SUBS) {
+        status = SH2_ERR;
+    }
+    else {
+        Subscriber_t *s = &subs[numSubs++];
+        Subscriber_t * volatile *pLink = &head;
+
+        s->sensorId = sensorId;
+        s->prio = prio;
+        s->fn = fn;
+        s->cookie = cookie;
+        s->queue = queue;
+
+        // After every subscriber of equal or higher prio
+        while ((*pLink != 0) && ((*pLink)->prio >= prio)) {
+            pLink = &(*pLink)->next;
+        }
+        s->next = *pLink;
+        *pLink = s;
+    }
+    taskEXIT_CRITICAL();
+
+    if (status != SH2_OK) {
+        printf("Sensor dispatch table full.\n");
+    }
+    return status;
+}
+
+#if SENSOR_DISPATCH_BACKPRESSURE
+static int addConsumer(const char *name, SensorDispatchFillFn_t *fill, QueueHandle_t queue)
+{
+    int status = SH2_OK;
+
+    taskENTER_CRITICAL();
+    if (numConsumers >= SENSOR_DISPATCH_MAX_CONSUMERS) {
+        status = SH2_ERR;
+    }
+    else {
+        Consumer_t *c = &consumers[numConsumers];
+
+        c->name = name;
+        c->fill = fill;
+        c->queue = queue;
+        numConsumers++;
+    }
+    taskEXIT_CRITICAL();
+
+    if (status != SH2_OK) {
+        printf("Sensor dispatch consumer table full.\n");
+    }
+    return status;
+}
+
+// Read every consumer's fill, and step the rates down after sustained
+// pressure or back up once it has cleared.  In the sensor task.
+static void checkPressure(TickType_t now)
+{
+    bool anyHigh = false;
+    bool allLow = true;
+    int step = 0;
+
+    for (unsigned n = 0; n < numConsumers; n++) {
+        Consumer_t *c = &consumers[n];
+        unsigned fill;
+
+        if (c->queue != 0) {
+            UBaseType_t used = uxQueueMessagesWaiting(c->queue);
+            UBaseType_t size = used + uxQueueSpacesAvailable(c->queue);
+            fill = (size != 0) ? (unsigned)(used * 1000 / size) : 0;
+        }
+        else {
+            fill = c->fill();
+        }
+        if (fill > 1000) {
+            fill = 1000;
+        }
+        c->fill_permille = (uint16_t)fill;
+        if (fill > c->peak_permille) {
+            c->peak_permille = (uint16_t)fill;
+        }
+        if (fill >= SENSOR_DISPATCH_HIGH_PERMILLE) {
+            c->pressured++;
+            anyHigh = true;
+        }
+        if (fill > SENSOR_DISPATCH_LOW_PERMILLE) {
+            allLow = false;
+        }
+    }
+
+    if ((anyHigh != high) || (allLow != clear)) {
+        // A new spell, timed from here
+        high = anyHigh;
+        clear = allLow;
+        since = now;
+        return;
+    }
+
+    if (high && (steps < SENSOR_DISPATCH_MAX_STEPS) &&
+        (now - since >= pdMS_TO_TICKS(SENSOR_DISPATCH_SUSTAIN_MS))) {
+        step = 1;
+    }
+    else if (clear && (steps > 0) &&
+             (now - since >= pdMS_TO_TICKS(SENSOR_DISPATCH_CLEAR_MS))) {
+        step = -1;
+    }
+    if (step == 0) {
+        return;
+    }
+
+    // The next step waits as long again
+    since = now;
+    steps += step;
+    if (step > 0) {
+        slowdowns++;
+    }
+    if (changedFn != 0) {
+        changedFn();
+    }
+}
+
+// True if sensorId keeps its rate: it has a subscriber of its own at
+// SENSOR_DISPATCH_CRITICAL_PRIO or above
+static bool critical(uint8_t sensorId)
+{
+    for (Subscriber_t *s = head; s != 0; s = s->next) {
+        if (s->prio < SENSOR_DISPATCH_CRITICAL_PRIO) {
+            // Descending prio: none further on
+            break;
+        }
+        if (s->sensorId == sensorId) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Shell command: show each consumer's fill and the backpressure.
+static void pressureCmd(int argc, char *argv[])
+{
+    printf("Backpressure: rates of non-critical sensors /%u (%u steps of %u), %u slowdowns\n",
+           1u << steps, steps, SENSOR_DISPATCH_MAX_STEPS, (unsigned)slowdowns);
+    printf("  above %u permille for %u ms slows, below %u for %u ms restores\n",
+           SENSOR_DISPATCH_HIGH_PERMILLE, SENSOR_DISPATCH_SUSTAIN_MS,
+           SENSOR_DISPATCH_LOW_PERMILLE, SENSOR_DISPATCH_CLEAR_MS);
+    printf("  %-12s %8s %8s %10s\n", "consumer", "fill", "peak", "pressured");
+    for (unsigned n = 0; n < numConsumers; n++) {
+        const Consumer_t *c = &consumers[n];
+        printf("  %-12s %8u %8u %10u\n", c->name, c->fill_permille, c->peak_permille,
+               (unsigned)c->pressured);
+    }
+    printf("  (fill in permille, pressured in readings every %u ms)\n",
+           SENSOR_DISPATCH_CHECK_MS);
+}
+#endif
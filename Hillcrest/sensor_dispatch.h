@@ -0,0 +1,154 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Sensor event dispatch.
+ *
+ * Modules subscribe to the sensor ids they want; the sensor task publishes
+ * each event from the sensor ring once and every matching subscriber is
+ * called in turn, highest subscriber priority first.  Callbacks get the
+ * ring slot and one shared fixed-point decode, so nothing is copied per
+ * subscriber.  A consumer running in its own task subscribes a queue
+ * instead and receives a copy of each event.
+ *
+ * Backpressure: every SENSOR_DISPATCH_CHECK_MS the dispatcher reads how
+ * full each consumer is, a queue subscriber by its queue, a callback
+ * that buffers for a slower link (console, SPI flash recorder) by the
+ * fill function it registered.  Once a consumer has stayed above
+ * SENSOR_DISPATCH_HIGH_PERMILLE for SENSOR_DISPATCH_SUSTAIN_MS, the
+ * non-critical subscriptions run at half their rate, and at half again
+ * each SENSOR_DISPATCH_SUSTAIN_MS it lasts, up to
+ * SENSOR_DISPATCH_MAX_STEPS times.  Once every consumer has stayed
+ * below SENSOR_DISPATCH_LOW_PERMILLE for SENSOR_DISPATCH_CLEAR_MS, the
+ * rates double back a step at a time.  The hub then sends fewer
+ * samples, evenly spaced, rather than consumers dropping whichever
+ * ones find their buffer full.  A sensor is critical if it has a
+ * subscriber of its own, not SENSOR_DISPATCH_ALL, with a prio of at
+ * least SENSOR_DISPATCH_CRITICAL_PRIO (pose prediction, fusion, the
+ * rate governor); wakeup subscriptions are left alone too.  The sensor
+ * app resends the subscriptions on each step (sensorDispatch_interval()).
+ */
+
+#ifndef SENSOR_DISPATCH_H
+#define SENSOR_DISPATCH_H
+
+#include <stdint.h>
+#include "FreeRTOS.h"
+#include "queue.h"
+#include "sh2.h"
+#include "sensor_fix.h"
+
+// Subscribe to every sensor id
+#define SENSOR_DISPATCH_ALL (0)
+
+// Size of the subscriber table.  Subscriptions are never removed.
+#ifndef SENSOR_DISPATCH_MAX_SUBS
+#define SENSOR_DISPATCH_MAX_SUBS (32)
+#endif
+
+// Set to 0 to leave backpressure out: consumers drop what doesn't fit.
+#ifndef SENSOR_DISPATCH_BACKPRESSURE
+#define SENSOR_DISPATCH_BACKPRESSURE (1)
+#endif
+
+// Consumers measured, queue subscribers included
+#ifndef SENSOR_DISPATCH_MAX_CONSUMERS
+#define SENSOR_DISPATCH_MAX_CONSUMERS (8)
+#endif
+
+// Interval between fill readings [ms]
+#ifndef SENSOR_DISPATCH_CHECK_MS
+#define SENSOR_DISPATCH_CHECK_MS (50)
+#endif
+
+// Fill above which a consumer is under pressure, and below which it is
+// clear of it [permille]
+#ifndef SENSOR_DISPATCH_HIGH_PERMILLE
+#define SENSOR_DISPATCH_HIGH_PERMILLE (750)
+#endif
+#ifndef SENSOR_DISPATCH_LOW_PERMILLE
+#define SENSOR_DISPATCH_LOW_PERMILLE (250)
+#endif
+
+// How long pressure lasts before each halving of the rates, and how
+// long it is clear before each doubling back [ms]
+#ifndef SENSOR_DISPATCH_SUSTAIN_MS
+#define SENSOR_DISPATCH_SUSTAIN_MS (500)
+#endif
+#ifndef SENSOR_DISPATCH_CLEAR_MS
+#define SENSOR_DISPATCH_CLEAR_MS (2000)
+#endif
+
+// Halvings at most, and the longest interval they slow a sensor to [us]
+#ifndef SENSOR_DISPATCH_MAX_STEPS
+#define SENSOR_DISPATCH_MAX_STEPS (3)
+#endif
+#ifndef SENSOR_DISPATCH_MAX_INTERVAL_US
+#define SENSOR_DISPATCH_MAX_INTERVAL_US (1000000)
+#endif
+
+// Called in the sensor task.  pEvent and pFix are shared by all subscribers
+// and only valid during the call.  pFix is NULL for reports with no
+// fixed-point decoding (see sensorFix_decode()).  Must not block.
+typedef void (SensorDispatchFn_t)(void *cookie,
+                                  const sh2_SensorEvent_t *pEvent,
+                                  const SensorFix_t *pFix);
+
+// How full a consumer's buffer is [permille].  Called in the sensor task.
+typedef unsigned (SensorDispatchFillFn_t)(void);
+
+// Called when the intervals sensorDispatch_interval() returns change,
+// from the sensor task.
+typedef void (SensorDispatchChangedFn_t)(void);
+
+// Register the "dispatch q drops" counter and the "pressure" command.
+void sensorDispatch_init(SensorDispatchChangedFn_t *changed);
+
+// Call fn for events from sensorId (or SENSOR_DISPATCH_ALL).  Subscribers
+// with a higher prio are called first; equal prios in subscription order.
+// Safe while events are being published.
+// Returns SH2_OK, SH2_ERR_BAD_PARAM for an unknown sensor id, or SH2_ERR
+// if the subscriber table is full.
+int sensorDispatch_subscribe(uint8_t sensorId, int prio,
+                             SensorDispatchFn_t *fn, void *cookie);
+
+// Post events from sensorId to queue, whose items are sh2_SensorEvent_t.
+// The sensor task never waits on it: a full queue drops the event.
+int sensorDispatch_subscribeQueue(uint8_t sensorId, int prio, QueueHandle_t queue);
+
+// Deliver one event to its subscribers.  Called by the sensor task only.
+void sensorDispatch_publish(const sh2_SensorEvent_t *pEvent);
+
+#if SENSOR_DISPATCH_BACKPRESSURE
+
+// Measure a callback consumer by its buffer's fill, for backpressure.
+// Queue subscribers are measured without this.  Returns SH2_OK, or
+// SH2_ERR if the consumer table is full.
+int sensorDispatch_addConsumer(const char *name, SensorDispatchFillFn_t *fill);
+
+// Interval to run sensorId at for a subscription of interval_us under
+// the current backpressure (0, disabled, stays 0).
+uint32_t sensorDispatch_interval(uint8_t sensorId, uint32_t interval_us);
+
+#else
+
+#define sensorDispatch_addConsumer(name, fill) ((void)(fill))
+#define sensorDispatch_interval(sensorId, interval_us) (interval_us)
+
+#endif
+
+#endif
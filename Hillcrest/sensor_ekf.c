@@ -0,0 +1,480 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Extended Kalman filter fusing hub output with external sensors.  See
+ * sensor_ekf.h.
+ */
+
+#include "sensor_ekf.h"
+
+#if SENSOR_EKF
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "sh2.h"
+#include "sh2_err.h"
+#include "quat.h"
+#include "shell.h"
+#include "sysstats.h"
+#include "cycle_budget.h"
+#include "sensor_dispatch.h"
+#include "priorities.h"
+
+#define N (SENSOR_EKF_STATES)
+
+// State layout
+#define POS (0)
+#define VEL (3)
+#define BIAS (6)
+
+// ------------------------------------------------------------------------
+// Private types
+
+typedef enum {
+    MEAS_POSITION,
+    MEAS_VELOCITY,
+    MEAS_SPEED,
+} MeasKind_t;
+
+typedef struct {
+    MeasKind_t kind;
+    float z[3];
+    float sigma;
+} Meas_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void ekfEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix);
+static void restart(void);
+static void drain(void);
+static void apply(const Meas_t *m);
+static void predict(const float accel[3], float dt);
+static bool update(const float H[N], float innov, float r);
+static void rotation(Quat_t q);
+static void publish(uint64_t t_uS);
+static int inject(MeasKind_t kind, const float *z, float sigma);
+static void ekfCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+// Filter, sensor task only
+static float x[N];
+static float P[N][N];
+static float R[3][3];               // body to world, from the last orientation
+static bool haveOrient;
+static uint64_t last_uS;            // last prediction, 0 to start the integration
+
+static QueueHandle_t measQueue;     // of Meas_t
+static volatile bool resetNeeded;
+
+// Costs, sensor task only
+static uint64_t predictSum;
+static uint64_t updateSum;
+
+// Published by the sensor task in a critical section
+static SensorEkfState_t est;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void sensorEkf_init(void)
+{
+    measQueue = xQueueCreate(SENSOR_EKF_QUEUE_LEN, sizeof(Meas_t));
+    restart();
+
+    sysstats_addMemory("ekf", sizeof(x) + sizeof(P) + sizeof(est));
+    sysstats_addCounter("ekf rejects", &est.rejects);
+    shell_addCommand("ekf", "[reset | pos <x> <y> <z> <sigma> | vel <x> <y> <z> <sigma> | speed <v> <sigma>] fused position",
+                     ekfCmd);
+    sensorDispatch_subscribe(SENSOR_EKF_ORIENT_ID, PRIO_SUB_EKF, ekfEvent, 0);
+    sensorDispatch_subscribe(SH2_LINEAR_ACCELERATION, PRIO_SUB_EKF, ekfEvent, 0);
+}
+
+void sensorEkf_reset(void)
+{
+    resetNeeded = true;
+}
+
+int sensorEkf_injectPosition(const float pos[3], float sigma_m)
+{
+    return inject(MEAS_POSITION, pos, sigma_m);
+}
+
+int sensorEkf_injectVelocity(const float vel[3], float sigma_mps)
+{
+    return inject(MEAS_VELOCITY, vel, sigma_mps);
+}
+
+int sensorEkf_injectSpeed(float speed_mps, float sigma_mps)
+{
+    return inject(MEAS_SPEED, &speed_mps, sigma_mps);
+}
+
+void sensorEkf_get(SensorEkfState_t *pState)
+{
+    taskENTER_CRITICAL();
+    *pState = est;
+    taskEXIT_CRITICAL();
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+// Dispatch callback for orientation and linear acceleration, in the
+// sensor task
+static void ekfEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix)
+{
+    if (pFix == 0) {
+        return;
+    }
+    if (resetNeeded) {
+        resetNeeded = false;
+        restart();
+    }
+
+    if (pEvent->reportId == SENSOR_EKF_ORIENT_ID) {
+        rotation(quat_fromFix(pFix));
+        haveOrient = true;
+        drain();
+        publish(pFix->timestamp_uS);
+        return;
+    }
+
+    // Linear acceleration: measurements first, then the step to now
+    drain();
+    uint64_t t_uS = pFix->timestamp_uS;
+    if (!haveOrient || (last_uS == 0) || (t_uS <= last_uS) ||
+        (t_uS - last_uS > SENSOR_EKF_MAX_DT_US)) {
+        last_uS = t_uS;
+        return;
+    }
+
+    float accel[3] = {
+        FIX_TO_FLOAT(pFix->q, pFix->un.vec3.x),
+        FIX_TO_FLOAT(pFix->q, pFix->un.vec3.y),
+        FIX_TO_FLOAT(pFix->q, pFix->un.vec3.z),
+    };
+    float dt = (float)(t_uS - last_uS) * 1e-6f;
+    last_uS = t_uS;
+
+    uint32_t start = DWT->CYCCNT;
+    predict(accel, dt);
+    uint32_t cycles = DWT->CYCCNT - start;
+    cycleBudget_check(BUDGET_STAGE_EKF, start, pEvent->reportId);
+
+    est.predicts++;
+    est.predictCycles = cycles;
+    if (cycles > est.predictMaxCycles) {
+        est.predictMaxCycles = cycles;
+    }
+    predictSum += cycles;
+    publish(t_uS);
+}
+
+// At the origin, at rest, with the initial uncertainty
+static void restart(void)
+{
+    memset(x, 0, sizeof(x));
+    memset(P, 0, sizeof(P));
+    for (unsigned i = 0; i < 3; i++) {
+        P[POS+i][POS+i] = SENSOR_EKF_INIT_POS * SENSOR_EKF_INIT_POS;
+        P[VEL+i][VEL+i] = SENSOR_EKF_INIT_VEL * SENSOR_EKF_INIT_VEL;
+#if SENSOR_EKF_ACCEL_BIAS
+        P[BIAS+i][BIAS+i] = SENSOR_EKF_INIT_BIAS * SENSOR_EKF_INIT_BIAS;
+#endif
+    }
+    last_uS = 0;
+    predictSum = 0;
+    updateSum = 0;
+
+    taskENTER_CRITICAL();
+    memset(&est, 0, sizeof(est));
+    taskEXIT_CRITICAL();
+}
+
+// Apply the measurements injected since the last step
+static void drain(void)
+{
+    Meas_t m;
+
+    while (xQueueReceive(measQueue, &m, 0) == pdTRUE) {
+        apply(&m);
+    }
+}
+
+// One measurement, a scalar update per component
+static void apply(const Meas_t *m)
+{
+    float H[N];
+    float r = m->sigma * m->sigma;
+    unsigned comps = (m->kind == MEAS_SPEED) ? 1 : 3;
+
+    for (unsigned c = 0; c < comps; c++) {
+        float innov;
+
+        memset(H, 0, sizeof(H));
+        if (m->kind == MEAS_POSITION) {
+            H[POS+c] = 1.0f;
+            innov = m->z[c] - x[POS+c];
+        }
+        else if (m->kind == MEAS_VELOCITY) {
+            H[VEL+c] = 1.0f;
+            innov = m->z[c] - x[VEL+c];
+        }
+        else {
+            // Forward speed: velocity along body x, which the orientation
+            // puts in the world as R's first column
+            if (!haveOrient) {
+                return;
+            }
+            innov = m->z[0];
+            for (unsigned j = 0; j < 3; j++) {
+                H[VEL+j] = R[j][0];
+                innov -= R[j][0] * x[VEL+j];
+            }
+        }
+
+        uint32_t start = DWT->CYCCNT;
+        bool applied = update(H, innov, r);
+        uint32_t cycles = DWT->CYCCNT - start;
+        cycleBudget_check(BUDGET_STAGE_EKF, start, 0);
+
+        if (!applied) {
+            est.rejects++;
+            continue;
+        }
+        est.updates++;
+        est.updateCycles = cycles;
+        if (cycles > est.updateMaxCycles) {
+            est.updateMaxCycles = cycles;
+        }
+        updateSum += cycles;
+    }
+}
+
+// Integrate the world acceleration over dt and grow the covariance:
+// P = F P F' + Q
+static void predict(const float accel[3], float dt)
+{
+    static float F[N][N];
+    static float FP[N][N];
+    float a[3];
+    float dt2 = 0.5f * dt * dt;
+
+    // Acceleration in the world, less the bias
+    for (unsigned i = 0; i < 3; i++) {
+        a[i] = 0.0f;
+        for (unsigned j = 0; j < 3; j++) {
+#if SENSOR_EKF_ACCEL_BIAS
+            a[i] += R[i][j] * (accel[j] - x[BIAS+j]);
+#else
+            a[i] += R[i][j] * accel[j];
+#endif
+        }
+    }
+    for (unsigned i = 0; i < 3; i++) {
+        x[POS+i] += x[VEL+i] * dt + a[i] * dt2;
+        x[VEL+i] += a[i] * dt;
+    }
+
+    memset(F, 0, sizeof(F));
+    for (unsigned i = 0; i < N; i++) {
+        F[i][i] = 1.0f;
+    }
+    for (unsigned i = 0; i < 3; i++) {
+        F[POS+i][VEL+i] = dt;
+#if SENSOR_EKF_ACCEL_BIAS
+        for (unsigned j = 0; j < 3; j++) {
+            F[POS+i][BIAS+j] = -dt2 * R[i][j];
+            F[VEL+i][BIAS+j] = -dt * R[i][j];
+        }
+#endif
+    }
+
+    for (unsigned i = 0; i < N; i++) {
+        for (unsigned j = 0; j < N; j++) {
+            float s = 0.0f;
+            for (unsigned k = 0; k < N; k++) {
+                s += F[i][k] * P[k][j];
+            }
+            FP[i][j] = s;
+        }
+    }
+    for (unsigned i = 0; i < N; i++) {
+        for (unsigned j = i; j < N; j++) {
+            float s = 0.0f;
+            for (unsigned k = 0; k < N; k++) {
+                s += FP[i][k] * F[j][k];
+            }
+            P[i][j] = P[j][i] = s;
+        }
+    }
+
+    // White acceleration noise on position and velocity, a random walk
+    // on the bias
+    float q = SENSOR_EKF_ACCEL_NOISE * SENSOR_EKF_ACCEL_NOISE;
+    for (unsigned i = 0; i < 3; i++) {
+        P[POS+i][POS+i] += q * dt * dt * dt * (1.0f / 3.0f);
+        P[POS+i][VEL+i] += q * dt2;
+        P[VEL+i][POS+i] += q * dt2;
+        P[VEL+i][VEL+i] += q * dt;
+#if SENSOR_EKF_ACCEL_BIAS
+        P[BIAS+i][BIAS+i] += SENSOR_EKF_BIAS_WALK * SENSOR_EKF_BIAS_WALK * dt;
+#endif
+    }
+}
+
+// Scalar update with measurement row H, innovation and variance r.
+// False, and nothing changed, if the innovation is outside the gate.
+static bool update(const float H[N], float innov, float r)
+{
+    float PHt[N];
+    float S = r;
+
+    for (unsigned i = 0; i < N; i++) {
+        float s = 0.0f;
+        for (unsigned j = 0; j < N; j++) {
+            s += P[i][j] * H[j];
+        }
+        PHt[i] = s;
+        S += H[i] * s;
+    }
+    if ((S <= 0.0f) || (innov * innov > SENSOR_EKF_GATE * SENSOR_EKF_GATE * S)) {
+        return false;
+    }
+
+    float invS = 1.0f / S;
+    for (unsigned i = 0; i < N; i++) {
+        float k = PHt[i] * invS;
+        x[i] += k * innov;
+        for (unsigned j = 0; j < N; j++) {
+            P[i][j] -= k * PHt[j];
+        }
+    }
+    return true;
+}
+
+// Body to world rotation matrix of an orientation
+static void rotation(Quat_t q)
+{
+    R[0][0] = 1.0f - 2.0f*(q.y*q.y + q.z*q.z);
+    R[0][1] = 2.0f*(q.x*q.y - q.w*q.z);
+    R[0][2] = 2.0f*(q.x*q.z + q.w*q.y);
+    R[1][0] = 2.0f*(q.x*q.y + q.w*q.z);
+    R[1][1] = 1.0f - 2.0f*(q.x*q.x + q.z*q.z);
+    R[1][2] = 2.0f*(q.y*q.z - q.w*q.x);
+    R[2][0] = 2.0f*(q.x*q.z - q.w*q.y);
+    R[2][1] = 2.0f*(q.y*q.z + q.w*q.x);
+    R[2][2] = 1.0f - 2.0f*(q.x*q.x + q.y*q.y);
+}
+
+// Copy the estimate out for readers
+static void publish(uint64_t t_uS)
+{
+    SensorEkfState_t s;
+
+    taskENTER_CRITICAL();
+    s = est;
+    taskEXIT_CRITICAL();
+
+    s.t_uS = t_uS;
+    for (unsigned i = 0; i < 3; i++) {
+        s.pos[i] = x[POS+i];
+        s.vel[i] = x[VEL+i];
+#if SENSOR_EKF_ACCEL_BIAS
+        s.bias[i] = x[BIAS+i];
+#endif
+        s.posSigma[i] = sqrtf(P[POS+i][POS+i]);
+        s.velSigma[i] = sqrtf(P[VEL+i][VEL+i]);
+    }
+    s.predictMeanCycles = (s.predicts != 0) ? (uint32_t)(predictSum / s.predicts) : 0;
+    s.updateMeanCycles = (s.updates != 0) ? (uint32_t)(updateSum / s.updates) : 0;
+
+    taskENTER_CRITICAL();
+    // drops is counted by the injecting tasks meanwhile
+    s.drops = est.drops;
+    est = s;
+    taskEXIT_CRITICAL();
+}
+
+static int inject(MeasKind_t kind, const float *z, float sigma)
+{
+    Meas_t m;
+
+    memset(&m, 0, sizeof(m));
+    m.kind = kind;
+    memcpy(m.z, z, ((kind == MEAS_SPEED) ? 1 : 3) * sizeof(float));
+    m.sigma = sigma;
+
+    if (xQueueSend(measQueue, &m, 0) != pdTRUE) {
+        taskENTER_CRITICAL();
+        est.drops++;
+        taskEXIT_CRITICAL();
+        return SH2_ERR;
+    }
+    return SH2_OK;
+}
+
+// Shell command: inject a measurement by hand, restart, or show the
+// estimate and the costs.
+static void ekfCmd(int argc, char *argv[])
+{
+    SensorEkfState_t s;
+    float z[3];
+
+    if ((argc > 1) && (strcmp(argv[1], "reset") == 0)) {
+        sensorEkf_reset();
+    }
+    else if ((argc == 6) && ((strcmp(argv[1], "pos") == 0) || (strcmp(argv[1], "vel") == 0))) {
+        for (unsigned i = 0; i < 3; i++) {
+            z[i] = strtof(argv[2+i], 0);
+        }
+        inject((argv[1][0] == 'p') ? MEAS_POSITION : MEAS_VELOCITY, z, strtof(argv[5], 0));
+    }
+    else if ((argc == 4) && (strcmp(argv[1], "speed") == 0)) {
+        sensorEkf_injectSpeed(strtof(argv[2], 0), strtof(argv[3], 0));
+    }
+    else if (argc > 1) {
+        printf("Usage: ekf [reset | pos <x> <y> <z> <sigma> | vel <x> <y> <z> <sigma> | speed <v> <sigma>]\n");
+        return;
+    }
+
+    sensorEkf_get(&s);
+    printf("EKF, %u states: %s\n", N, haveOrient ? "running" : "waiting for orientation");
+    printf("  pos  %9.3f %9.3f %9.3f m     +/- %.3f %.3f %.3f\n",
+           s.pos[0], s.pos[1], s.pos[2], s.posSigma[0], s.posSigma[1], s.posSigma[2]);
+    printf("  vel  %9.3f %9.3f %9.3f m/s   +/- %.3f %.3f %.3f\n",
+           s.vel[0], s.vel[1], s.vel[2], s.velSigma[0], s.velSigma[1], s.velSigma[2]);
+#if SENSOR_EKF_ACCEL_BIAS
+    printf("  bias %9.3f %9.3f %9.3f m/s^2\n", s.bias[0], s.bias[1], s.bias[2]);
+#endif
+    printf("  %u predicts, %u updates, %u rejected, %u dropped\n",
+           (unsigned)s.predicts, (unsigned)s.updates, (unsigned)s.rejects, (unsigned)s.drops);
+    printf("  predict cycles %u (mean %u, max %u), update %u (mean %u, max %u)\n",
+           (unsigned)s.predictCycles, (unsigned)s.predictMeanCycles, (unsigned)s.predictMaxCycles,
+           (unsigned)s.updateCycles, (unsigned)s.updateMeanCycles, (unsigned)s.updateMaxCycles);
+}
+
+#endif
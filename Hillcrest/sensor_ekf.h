@@ -0,0 +1,154 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Extended Kalman filter fusing hub output with external sensors.
+ *
+ * Estimates position and velocity in a local world frame (the hub's:
+ * x east, y north, z up, metres from wherever the filter started), and
+ * with SENSOR_EKF_ACCEL_BIAS an accelerometer bias in the body frame.
+ * The state size is fixed at build time (SENSOR_EKF_STATES), and the
+ * filter runs in single precision on the FPU in the sensor task:
+ *
+ *   - Rotation vector reports (SENSOR_EKF_ORIENT_ID) set the orientation
+ *     the filter uses.  It is taken as known, not estimated.
+ *   - Each linear acceleration report predicts: the acceleration, less
+ *     the bias, rotated into the world and integrated over the time
+ *     since the last one.  This runs at the IMU rate.
+ *   - External measurements, injected from any task and applied before
+ *     the next prediction: a position (GPS, already converted to the
+ *     local frame by the caller), a world velocity, or a forward speed
+ *     (wheel odometry), which depends on the orientation and is
+ *     linearized about it.  Each measurement component is a scalar
+ *     update, so no matrix is inverted, and one whose innovation is over
+ *     SENSOR_EKF_GATE sigma is rejected.
+ *
+ * A prediction at 9 states takes ~1500 multiply-adds, ~25us at 84MHz,
+ * and a scalar update ~200, so at 200Hz linear acceleration the filter
+ * takes ~0.5% of the CPU.  Every step is timed: "ekf" shows the
+ * cycles of the last, mean and worst predict and update, and the steps
+ * are checked against the "ekf" cycle budget (CYCLE_BUDGET_EKF_US).
+ * Measurements are applied when processed, not retrodicted to their
+ * timestamp, so keep their latency well under the time the state takes
+ * to change by their sigma.
+ */
+
+#ifndef SENSOR_EKF_H
+#define SENSOR_EKF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Build in the filter
+#ifndef SENSOR_EKF
+#define SENSOR_EKF (1)
+#endif
+
+// Estimate an accelerometer bias: 9 states rather than 6
+#ifndef SENSOR_EKF_ACCEL_BIAS
+#define SENSOR_EKF_ACCEL_BIAS (1)
+#endif
+
+#define SENSOR_EKF_STATES (SENSOR_EKF_ACCEL_BIAS ? 9 : 6)
+
+// Orientation source: SH2_ROTATION_VECTOR (0x05), or a game rotation
+// vector (0x08) where the magnetic field can't be trusted
+#ifndef SENSOR_EKF_ORIENT_ID
+#define SENSOR_EKF_ORIENT_ID (0x05)
+#endif
+
+// Process noise: acceleration white noise [m/s^2 / sqrt(Hz)], and the
+// bias random walk [m/s^2 / sqrt(s)]
+#ifndef SENSOR_EKF_ACCEL_NOISE
+#define SENSOR_EKF_ACCEL_NOISE (0.35f)
+#endif
+#ifndef SENSOR_EKF_BIAS_WALK
+#define SENSOR_EKF_BIAS_WALK (0.002f)
+#endif
+
+// Initial standard deviations: position [m], velocity [m/s], bias [m/s^2]
+#ifndef SENSOR_EKF_INIT_POS
+#define SENSOR_EKF_INIT_POS (10.0f)
+#endif
+#ifndef SENSOR_EKF_INIT_VEL
+#define SENSOR_EKF_INIT_VEL (1.0f)
+#endif
+#ifndef SENSOR_EKF_INIT_BIAS
+#define SENSOR_EKF_INIT_BIAS (0.2f)
+#endif
+
+// Innovation gate [sigma]
+#ifndef SENSOR_EKF_GATE
+#define SENSOR_EKF_GATE (5.0f)
+#endif
+
+// Prediction steps longer than this restart the integration instead
+// [us], e.g. after the sensor was off
+#ifndef SENSOR_EKF_MAX_DT_US
+#define SENSOR_EKF_MAX_DT_US (100000)
+#endif
+
+// External measurements waiting for the sensor task
+#ifndef SENSOR_EKF_QUEUE_LEN
+#define SENSOR_EKF_QUEUE_LEN (8)
+#endif
+
+// Estimate and costs
+typedef struct {
+    uint64_t t_uS;            // of the last step
+    float pos[3];             // [m]
+    float vel[3];             // [m/s]
+    float bias[3];            // [m/s^2], 0 without SENSOR_EKF_ACCEL_BIAS
+    float posSigma[3];
+    float velSigma[3];
+    uint32_t predicts;
+    uint32_t updates;         // scalar updates applied
+    uint32_t rejects;         // ... and gated out
+    uint32_t drops;           // injections lost to a full queue
+    uint32_t predictCycles;   // last prediction
+    uint32_t predictMaxCycles;
+    uint32_t predictMeanCycles;
+    uint32_t updateCycles;    // last scalar update
+    uint32_t updateMaxCycles;
+    uint32_t updateMeanCycles;
+} SensorEkfState_t;
+
+#if SENSOR_EKF
+
+// Register the "ekf" command and subscribe to rotation vector and
+// linear acceleration.
+void sensorEkf_init(void);
+
+// Start over from the origin at rest.  From any task.
+void sensorEkf_reset(void);
+
+// Measurements, from any task; sigma is the standard deviation of each
+// component.  Returns SH2_OK, or SH2_ERR if the queue is full.
+int sensorEkf_injectPosition(const float pos[3], float sigma_m);
+int sensorEkf_injectVelocity(const float vel[3], float sigma_mps);
+int sensorEkf_injectSpeed(float speed_mps, float sigma_mps);
+
+// Copy the estimate.  From any task.
+void sensorEkf_get(SensorEkfState_t *pState);
+
+#else
+
+#define sensorEkf_init()
+
+#endif
+
+#endif
@@ -0,0 +1,389 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Vibration spectrum on the MCU.
+ */
+
+#include "sensor_fft.h"
+
+#if SENSOR_FFT
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "stm32f4xx.h"
+#include "arm_math.h"
+#include "arm_const_structs.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "cmsis_os.h"
+#include "shell.h"
+#include "sysstats.h"
+#include "timebase.h"
+#include "sensor_dispatch.h"
+#include "priorities.h"
+#include "rtos_static.h"
+
+#if (SENSOR_FFT_HOP < 1) || (SENSOR_FFT_HOP > SENSOR_FFT_LEN)
+#error SENSOR_FFT_HOP must be from 1 to SENSOR_FFT_LEN
+#endif
+
+#define BINS (SENSOR_FFT_LEN / 2)
+
+// Mean square of the Hann window, which the band RMS is corrected for
+#define HANN_POWER (0.375f)
+
+// The real FFT of SENSOR_FFT_LEN is a complex one of half that length.
+// Set up from the tables directly: arm_rfft_fast_init_f32() refers to
+// every length's, which would link them all.
+#if SENSOR_FFT_LEN == 128
+#define CFFT_INSTANCE arm_cfft_sR_f32_len64
+#define RFFT_TWIDDLE twiddleCoef_rfft_128
+#elif SENSOR_FFT_LEN == 256
+#define CFFT_INSTANCE arm_cfft_sR_f32_len128
+#define RFFT_TWIDDLE twiddleCoef_rfft_256
+#elif SENSOR_FFT_LEN == 512
+#define CFFT_INSTANCE arm_cfft_sR_f32_len256
+#define RFFT_TWIDDLE twiddleCoef_rfft_512
+#else
+#define CFFT_INSTANCE arm_cfft_sR_f32_len512
+#define RFFT_TWIDDLE twiddleCoef_rfft_1024
+#endif
+
+// ------------------------------------------------------------------------
+// Private types
+
+typedef struct {
+    float freq_Hz;
+    float amplitude;
+} FftPeak_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void fftEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix);
+static void fftTask(const void *params);
+static void analyse(void);
+static void summarize(void);
+static void printSummary(void);
+static void fftCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+RTOS_STACK_DEF(fftTaskStack, SENSOR_FFT_STACK);
+static osThreadId fftTaskHandle;
+
+static arm_rfft_fast_instance_f32 rfft;
+static float window[SENSOR_FFT_LEN];
+
+// Channel watched, set by the shell
+static volatile uint8_t watchId;
+static volatile SensorFftAxis_t watchAxis;
+static volatile bool restartNeeded;
+
+// Sample ring, written by the sensor task
+static float ring[SENSOR_FFT_LEN];
+static volatile uint32_t samples;   // since the last restart
+static uint64_t last_uS;
+static volatile float interval_us;  // smoothed report interval
+static uint8_t q;
+
+// FFT task
+static float block[SENSOR_FFT_LEN];
+static float spectrum[SENSOR_FFT_LEN];
+static float power[BINS];           // summed over the blocks of a period
+static uint32_t blocks;
+static uint64_t period_uS;
+static uint32_t overruns;           // blocks not analysed: the task was late
+static uint32_t lastDone;           // samples count of the last block
+
+// Last summary, for "fft"
+static uint8_t sumId;
+static SensorFftAxis_t sumAxis;
+static float sumRate_Hz;
+static float band[SENSOR_FFT_BANDS];
+static FftPeak_t peak[SENSOR_FFT_PEAKS];
+static uint32_t lastCycles;
+static uint32_t maxCycles;
+
+static const char axisName[] = "xyzn";
+
+// ------------------------------------------------------------------------
+// Public API
+
+void sensorFft_init(void)
+{
+    rfft.Sint = CFFT_INSTANCE;
+    rfft.fftLenRFFT = SENSOR_FFT_LEN;
+    rfft.pTwiddleRFFT = (float32_t *)RFFT_TWIDDLE;
+    for (int n = 0; n < SENSOR_FFT_LEN; n++) {
+        window[n] = 0.5f - 0.5f * cosf(2.0f * PI * n / SENSOR_FFT_LEN);
+    }
+
+    sysstats_addMemory("sensor fft", sizeof(window) + sizeof(ring) + sizeof(block) +
+                       sizeof(spectrum) + sizeof(power));
+    shell_addCommand("fft", "[<sensor> [x | y | z | norm] | off] vibration bands and peaks",
+                     fftCmd);
+    sensorDispatch_subscribe(SENSOR_DISPATCH_ALL, PRIO_SUB_FFT, fftEvent, 0);
+
+    osThreadDef(fftThreadDef, fftTask, PRIO_TASK_FFT, 0, SENSOR_FFT_STACK);
+    fftTaskHandle = rtos_threadCreate(osThread(fftThreadDef), NULL, RTOS_STACK(fftTaskStack));
+    if (fftTaskHandle == NULL) {
+        printf("Failed to create FFT task.\n");
+    }
+}
+
+void sensorFft_watch(sh2_SensorId_t sensorId, SensorFftAxis_t axis)
+{
+    taskENTER_CRITICAL();
+    watchId = sensorId;
+    watchAxis = axis;
+    restartNeeded = true;
+    taskEXIT_CRITICAL();
+}
+
+// The DSP_Lib snapshot in Drivers/CMSIS has no arm_bitreversal2.S, the
+// assembly arm_cfft_f32() calls this from: the same swaps, in C.
+void arm_bitreversal_32(uint32_t *pSrc, const uint16_t bitRevLen, const uint16_t *pBitRevTab)
+{
+    for (unsigned i = 0; i + 1 < bitRevLen; i += 2) {
+        uint32_t a = pBitRevTab[i] >> 2;
+        uint32_t b = pBitRevTab[i + 1] >> 2;
+        uint32_t tmp;
+
+        tmp = pSrc[a];
+        pSrc[a] = pSrc[b];
+        pSrc[b] = tmp;
+        tmp = pSrc[a + 1];
+        pSrc[a + 1] = pSrc[b + 1];
+        pSrc[b + 1] = tmp;
+    }
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+// Dispatch callback, in the sensor task
+static void fftEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix)
+{
+    if ((pFix == 0) || (pFix->sensorId != watchId) ||
+        ((pFix->kind != SENSORFIX_VEC3) && (pFix->kind != SENSORFIX_RAW))) {
+        return;
+    }
+    if (restartNeeded) {
+        restartNeeded = false;
+        samples = 0;
+        interval_us = 0;
+    }
+
+    float v;
+    switch (watchAxis) {
+        case SENSOR_FFT_X: v = pFix->un.vec3.x; break;
+        case SENSOR_FFT_Y: v = pFix->un.vec3.y; break;
+        case SENSOR_FFT_Z: v = pFix->un.vec3.z; break;
+        default:
+            v = sqrtf((float)pFix->un.vec3.x * pFix->un.vec3.x +
+                      (float)pFix->un.vec3.y * pFix->un.vec3.y +
+                      (float)pFix->un.vec3.z * pFix->un.vec3.z);
+            break;
+    }
+
+    if (samples != 0) {
+        float dt = (float)(pFix->timestamp_uS - last_uS);
+        interval_us = (interval_us == 0) ? dt : interval_us + (dt - interval_us) / 16;
+    }
+    last_uS = pFix->timestamp_uS;
+    q = pFix->q;
+
+    ring[samples % SENSOR_FFT_LEN] = v;
+    samples++;
+    if ((samples >= SENSOR_FFT_LEN) && ((samples - SENSOR_FFT_LEN) % SENSOR_FFT_HOP == 0)) {
+        xTaskNotifyGive(fftTaskHandle);
+    }
+}
+
+static void fftTask(const void *params)
+{
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        analyse();
+    }
+}
+
+// Spectrum of the latest block, into the period's average
+static void analyse(void)
+{
+    uint32_t n;
+
+    // Copy the block out without the sensor task writing over it
+    vTaskSuspendAll();
+    n = samples;
+    for (unsigned i = 0; (n >= SENSOR_FFT_LEN) && (i < SENSOR_FFT_LEN); i++) {
+        block[i] = ring[(n + i) % SENSOR_FFT_LEN];
+    }
+    xTaskResumeAll();
+    if (n < SENSOR_FFT_LEN) {
+        // Restarted since
+        blocks = 0;
+        return;
+    }
+    if ((lastDone != 0) && (n > lastDone) && (n - lastDone > SENSOR_FFT_HOP)) {
+        overruns += (n - lastDone) / SENSOR_FFT_HOP - 1;
+    }
+    if (blocks == 0) {
+        memset(power, 0, sizeof(power));
+        period_uS = timebase_getUs();
+    }
+    lastDone = n;
+
+    uint64_t start = timebase_getCycles();
+
+    float mean;
+    arm_mean_f32(block, SENSOR_FFT_LEN, &mean);
+    for (unsigned i = 0; i < SENSOR_FFT_LEN; i++) {
+        block[i] = (block[i] - mean) * window[i];
+    }
+
+    // spectrum[0] is DC, [1] Nyquist, then real and imaginary per bin
+    arm_rfft_fast_f32(&rfft, block, spectrum, 0);
+    for (unsigned k = 1; k < BINS; k++) {
+        float re = spectrum[2*k];
+        float im = spectrum[2*k + 1];
+        power[k] += re*re + im*im;
+    }
+    blocks++;
+
+    lastCycles = (uint32_t)(timebase_getCycles() - start);
+    if (lastCycles > maxCycles) {
+        maxCycles = lastCycles;
+    }
+
+    if (timebase_getUs() - period_uS >= (uint64_t)SENSOR_FFT_PERIOD_MS * 1000) {
+        summarize();
+        printSummary();
+        blocks = 0;
+    }
+}
+
+// Bands and peaks of the period's average spectrum
+static void summarize(void)
+{
+    float scale = 1.0f / (float)(1 << q);
+    float rate_Hz = (interval_us > 0) ? 1e6f / interval_us : 0;
+
+    for (unsigned k = 1; k < BINS; k++) {
+        power[k] /= blocks;
+    }
+
+    // One-sided Parseval, undoing the window's loss of power
+    for (unsigned b = 0; b < SENSOR_FFT_BANDS; b++) {
+        unsigned from = 1 + b * (BINS - 1) / SENSOR_FFT_BANDS;
+        unsigned to = 1 + (b + 1) * (BINS - 1) / SENSOR_FFT_BANDS;
+        float sum = 0;
+
+        for (unsigned k = from; k < to; k++) {
+            sum += power[k];
+        }
+        band[b] = sqrtf(2.0f * sum / HANN_POWER) / SENSOR_FFT_LEN * scale;
+    }
+
+    // Strongest local maxima, refined by a parabola through their neighbours
+    memset(peak, 0, sizeof(peak));
+    for (unsigned k = 2; k + 1 < BINS; k++) {
+        if ((power[k] <= power[k - 1]) || (power[k] < power[k + 1])) {
+            continue;
+        }
+        float a = sqrtf(power[k - 1]);
+        float m = sqrtf(power[k]);
+        float c = sqrtf(power[k + 1]);
+        float d = a - 2*m + c;
+        float offset = (d != 0) ? 0.5f * (a - c) / d : 0;
+        // A sinusoid of amplitude A peaks at A*N/4 through the Hann window
+        float amplitude = 4.0f * m / SENSOR_FFT_LEN * scale;
+
+        for (unsigned p = 0; p < SENSOR_FFT_PEAKS; p++) {
+            if (amplitude > peak[p].amplitude) {
+                memmove(&peak[p + 1], &peak[p], (SENSOR_FFT_PEAKS - 1 - p) * sizeof(peak[0]));
+                peak[p].freq_Hz = (k + offset) * rate_Hz / SENSOR_FFT_LEN;
+                peak[p].amplitude = amplitude;
+                break;
+            }
+        }
+    }
+
+    sumId = watchId;
+    sumAxis = watchAxis;
+    sumRate_Hz = rate_Hz;
+}
+
+static void printSummary(void)
+{
+    printf("fft %u.%c: %.1f Hz, bands", sumId, axisName[sumAxis], sumRate_Hz);
+    for (unsigned b = 0; b < SENSOR_FFT_BANDS; b++) {
+        printf(" %.3g", band[b]);
+    }
+    printf(", peaks");
+    for (unsigned p = 0; (p < SENSOR_FFT_PEAKS) && (peak[p].amplitude > 0); p++) {
+        printf(" %.1f Hz %.3g", peak[p].freq_Hz, peak[p].amplitude);
+    }
+    printf("\n");
+}
+
+// Shell command: watch a channel, stop, or show the last summary.
+static void fftCmd(int argc, char *argv[])
+{
+    if ((argc > 1) && (strcmp(argv[1], "off") == 0)) {
+        sensorFft_watch(0, SENSOR_FFT_NORM);
+        return;
+    }
+    if (argc > 1) {
+        unsigned id = strtoul(argv[1], 0, 0);
+        SensorFftAxis_t axis = SENSOR_FFT_NORM;
+
+        if (argc > 2) {
+            const char *p = strchr(axisName, argv[2][0]);
+            if ((p == 0) || (*p == 0)) {
+                id = 0;
+            }
+            else {
+                axis = (SensorFftAxis_t)(p - axisName);
+            }
+        }
+        if ((id == 0) || (id > SH2_MAX_SENSOR_ID)) {
+            printf("usage: %s [<sensor> [x | y | z | norm] | off]\n", argv[0]);
+            return;
+        }
+        sensorFft_watch((sh2_SensorId_t)id, axis);
+        return;
+    }
+
+    if (watchId == 0) {
+        printf("FFT off\n");
+        return;
+    }
+    printf("FFT of %u samples, hop %u: %u cycles per block (max %u), %u blocks skipped\n",
+           SENSOR_FFT_LEN, SENSOR_FFT_HOP, (unsigned)lastCycles, (unsigned)maxCycles,
+           (unsigned)overruns);
+    if (sumId != 0) {
+        printSummary();
+    }
+}
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Vibration spectrum of one accelerometer or gyro channel, on the MCU.
+ *
+ * The sensor task copies the watched channel (an axis, or the vector's
+ * norm) into a ring of SENSOR_FFT_LEN samples.  Every SENSOR_FFT_HOP
+ * samples, the FFT task takes the latest block, removes its mean,
+ * applies a Hann window and runs the CMSIS-DSP real FFT
+ * (arm_rfft_fast_f32) over it, and adds the power spectrum to an
+ * average.  Every SENSOR_FFT_PERIOD_MS it prints the RMS in
+ * SENSOR_FFT_BANDS equal bands up to Nyquist and the SENSOR_FFT_PEAKS
+ * strongest peaks (frequency interpolated between bins, amplitude),
+ * instead of the samples that would have to go off-board for it.
+ *
+ * Frequencies follow the report rate measured from the timestamps, and
+ * values are in the report's units.  "fft" shows the last summary and
+ * the cycles each block took.  The sensor must be subscribed.
+ */
+
+#ifndef SENSOR_FFT_H
+#define SENSOR_FFT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sh2.h"
+
+// Set to 1 to build in the spectrum stage (RAM for four blocks of floats
+// and a task, 5.8KB at the default SENSOR_FFT_LEN)
+#ifndef SENSOR_FFT
+#define SENSOR_FFT (0)
+#endif
+
+// Samples per FFT block: 128, 256, 512 or 1024
+#ifndef SENSOR_FFT_LEN
+#define SENSOR_FFT_LEN (256)
+#endif
+#if (SENSOR_FFT_LEN != 128) && (SENSOR_FFT_LEN != 256) && \
+    (SENSOR_FFT_LEN != 512) && (SENSOR_FFT_LEN != 1024)
+#error SENSOR_FFT_LEN must be 128, 256, 512 or 1024
+#endif
+
+// New samples between blocks (half a block: 50% overlap)
+#ifndef SENSOR_FFT_HOP
+#define SENSOR_FFT_HOP (SENSOR_FFT_LEN / 2)
+#endif
+
+// Bands and peaks in each summary
+#ifndef SENSOR_FFT_BANDS
+#define SENSOR_FFT_BANDS (8)
+#endif
+#ifndef SENSOR_FFT_PEAKS
+#define SENSOR_FFT_PEAKS (3)
+#endif
+
+// Spectra averaged into each summary [ms]
+#ifndef SENSOR_FFT_PERIOD_MS
+#define SENSOR_FFT_PERIOD_MS (1000)
+#endif
+
+#ifndef SENSOR_FFT_STACK
+#define SENSOR_FFT_STACK (256)  /* words */
+#endif
+
+// Channel of the watched sensor
+typedef enum {
+    SENSOR_FFT_X,
+    SENSOR_FFT_Y,
+    SENSOR_FFT_Z,
+    SENSOR_FFT_NORM,
+} SensorFftAxis_t;
+
+// Register the "fft" command, subscribe to every sensor and start the
+// FFT task.
+void sensorFft_init(void);
+
+// Analyse sensorId's axis from a fresh block, or nothing (sensorId 0).
+void sensorFft_watch(sh2_SensorId_t sensorId, SensorFftAxis_t axis);
+
+#endif
@@ -0,0 +1,173 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Fixed-point sensor report decode.
+ */
+
+#include "sensor_fix.h"
+
+#include "sh2_err.h"
+
+// Offset of the first data field, after report id, sequence, status and
+// delay.  Gyro Integrated RV reports have no such header.
+#define REPORT_HDR_LEN (4)
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static int16_t read16(const uint8_t *p);
+static int decodeHeader(SensorFix_t *fix, const sh2_SensorEvent_t *event, unsigned dataLen);
+static int decodeVec3(SensorFix_t *fix, const sh2_SensorEvent_t *event,
+                      SensorFixKind_t kind, uint8_t q);
+static int decodeQuat(SensorFix_t *fix, const sh2_SensorEvent_t *event, bool hasAccuracy);
+static int decodeGirv(SensorFix_t *fix, const sh2_SensorEvent_t *event);
+static uint8_t qOf(uint8_t sensorId, uint8_t q);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+// Q point of each sensor's fields from the hub's metadata, 0 for default
+static uint8_t qPoint[SH2_MAX_SENSOR_ID+1];
+
+// ------------------------------------------------------------------------
+// Public API
+
+int sensorFix_decode(SensorFix_t *fix, const sh2_SensorEvent_t *event)
+{
+    fix->sensorId = event->reportId;
+    fix->timestamp_uS = event->timestamp_uS;
+
+    switch (event->reportId) {
+        case SH2_ACCELEROMETER:
+        case SH2_LINEAR_ACCELERATION:
+        case SH2_GRAVITY:
+            return decodeVec3(fix, event, SENSORFIX_VEC3, SENSORFIX_Q_ACCEL);
+        case SH2_GYROSCOPE_CALIBRATED:
+            return decodeVec3(fix, event, SENSORFIX_VEC3, SENSORFIX_Q_GYRO);
+        case SH2_MAGNETIC_FIELD_CALIBRATED:
+            return decodeVec3(fix, event, SENSORFIX_VEC3, SENSORFIX_Q_MAG);
+        case SH2_RAW_ACCELEROMETER:
+        case SH2_RAW_GYROSCOPE:
+        case SH2_RAW_MAGNETOMETER:
+            return decodeVec3(fix, event, SENSORFIX_RAW, 0);
+        case SH2_ROTATION_VECTOR:
+        case SH2_GEOMAGNETIC_ROTATION_VECTOR:
+        case SH2_ARVR_STABILIZED_RV:
+            return decodeQuat(fix, event, true);
+        case SH2_GAME_ROTATION_VECTOR:
+        case SH2_ARVR_STABILIZED_GRV:
+            return decodeQuat(fix, event, false);
+        case SH2_GYRO_INTEGRATED_RV:
+            return decodeGirv(fix, event);
+        default:
+            return SH2_ERR_BAD_PARAM;
+    }
+}
+
+void sensorFix_setQ(uint8_t sensorId, uint8_t q)
+{
+    if ((sensorId <= SH2_MAX_SENSOR_ID) && (q < 16)) {
+        qPoint[sensorId] = q;
+    }
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static uint8_t qOf(uint8_t sensorId, uint8_t q)
+{
+    return (qPoint[sensorId] != 0) ? qPoint[sensorId] : q;
+}
+
+static int16_t read16(const uint8_t *p)
+{
+    return (int16_t)(p[0] | (p[1] << 8));
+}
+
+static int decodeHeader(SensorFix_t *fix, const sh2_SensorEvent_t *event, unsigned dataLen)
+{
+    if (event->len < REPORT_HDR_LEN + dataLen) {
+        return SH2_ERR_BAD_PARAM;
+    }
+
+    fix->sequence = event->report[1];
+    fix->status = event->report[2];
+
+    return SH2_OK;
+}
+
+static int decodeVec3(SensorFix_t *fix, const sh2_SensorEvent_t *event,
+                      SensorFixKind_t kind, uint8_t q)
+{
+    const uint8_t *p = &event->report[REPORT_HDR_LEN];
+
+    if (decodeHeader(fix, event, 6) != SH2_OK) {
+        return SH2_ERR_BAD_PARAM;
+    }
+
+    fix->kind = kind;
+    fix->q = (kind == SENSORFIX_RAW) ? 0 : qOf(fix->sensorId, q);
+    fix->un.vec3.x = read16(p);
+    fix->un.vec3.y = read16(p+2);
+    fix->un.vec3.z = read16(p+4);
+
+    return SH2_OK;
+}
+
+static int decodeQuat(SensorFix_t *fix, const sh2_SensorEvent_t *event, bool hasAccuracy)
+{
+    const uint8_t *p = &event->report[REPORT_HDR_LEN];
+
+    if (decodeHeader(fix, event, hasAccuracy ? 10 : 8) != SH2_OK) {
+        return SH2_ERR_BAD_PARAM;
+    }
+
+    fix->kind = SENSORFIX_QUAT;
+    fix->q = qOf(fix->sensorId, SENSORFIX_Q_QUAT);
+    fix->un.quat.i = read16(p);
+    fix->un.quat.j = read16(p+2);
+    fix->un.quat.k = read16(p+4);
+    fix->un.quat.real = read16(p+6);
+    fix->un.quat.accuracy = hasAccuracy ? read16(p+8) : 0;
+    fix->un.quat.hasAccuracy = hasAccuracy;
+
+    return SH2_OK;
+}
+
+static int decodeGirv(SensorFix_t *fix, const sh2_SensorEvent_t *event)
+{
+    const uint8_t *p = event->report;
+
+    if (event->len < 14) {
+        return SH2_ERR_BAD_PARAM;
+    }
+
+    fix->sequence = 0;
+    fix->status = 0;
+    fix->kind = SENSORFIX_GIRV;
+    fix->q = qOf(fix->sensorId, SENSORFIX_Q_QUAT);
+    fix->un.girv.i = read16(p);
+    fix->un.girv.j = read16(p+2);
+    fix->un.girv.k = read16(p+4);
+    fix->un.girv.real = read16(p+6);
+    fix->un.girv.angVelX = read16(p+8);
+    fix->un.girv.angVelY = read16(p+10);
+    fix->un.girv.angVelZ = read16(p+12);
+
+    return SH2_OK;
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Fixed-point sensor report decode.
+ *
+ * sensorFix_decode() pulls the Q-format integers straight out of a
+ * sensor event, without the float conversion sh2_decodeSensorEvent()
+ * does for every field.  Use it for binary streaming and control loops;
+ * FIX_TO_FLOAT() converts a single field when a real value is needed.
+ */
+
+#ifndef SENSOR_FIX_H
+#define SENSOR_FIX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sh2.h"
+
+// Q points of SH-2 report fields
+#define SENSORFIX_Q_ACCEL     (8)    // m/s^2: accelerometer, linear accel, gravity
+#define SENSORFIX_Q_GYRO      (9)    // rad/s: calibrated gyroscope
+#define SENSORFIX_Q_MAG       (4)    // uTesla: calibrated magnetic field
+#define SENSORFIX_Q_QUAT      (14)   // rotation vector quaternions
+#define SENSORFIX_Q_ACCURACY  (12)   // rad: rotation vector accuracy estimate
+#define SENSORFIX_Q_ANGVEL    (10)   // rad/s: gyro integrated RV angular velocity
+
+// Fixed-point value of real x with n fractional bits (for constants)
+#define FIX_Q(n, x) ((int32_t)((x) * (float)(1 << (n))))
+
+// Real value of fixed-point v with n fractional bits
+#define FIX_TO_FLOAT(n, v) ((float)(v) * (1.0f / (float)(1 << (n))))
+
+typedef enum {
+    SENSORFIX_VEC3,   // un.vec3 at q
+    SENSORFIX_RAW,    // un.vec3, ADC units (q is 0)
+    SENSORFIX_QUAT,   // un.quat, accuracy valid if hasAccuracy
+    SENSORFIX_GIRV,   // un.girv
+} SensorFixKind_t;
+
+typedef struct {
+    uint8_t sensorId;
+    uint8_t sequence;        // 0 for Gyro Integrated RV, which has none
+    uint8_t status;          // report status, accuracy in bits 1:0
+    uint64_t timestamp_uS;
+    SensorFixKind_t kind;
+    uint8_t q;               // Q point of the vec3 or quaternion fields,
+                             // use it rather than the SENSORFIX_Q_ default
+    union {
+        struct {
+            int16_t x, y, z;
+        } vec3;
+        struct {
+            int16_t i, j, k, real;
+            int16_t accuracy;    // Q SENSORFIX_Q_ACCURACY
+            bool hasAccuracy;
+        } quat;
+        struct {
+            int16_t i, j, k, real;
+            int16_t angVelX, angVelY, angVelZ;  // Q SENSORFIX_Q_ANGVEL
+        } girv;
+    } un;
+} SensorFix_t;
+
+// Decode the report in event.  Returns SH2_OK, or SH2_ERR_BAD_PARAM for
+// sensors without a fixed-point decoding here (use sh2_decodeSensorEvent).
+int sensorFix_decode(SensorFix_t *fix, const sh2_SensorEvent_t *event);
+
+// Decode sensorId's fields at Q point q, as the hub's metadata gives it
+// (see sensor_meta.h), instead of the SENSORFIX_Q_ default; 0 restores
+// the default.  Raw sensors stay at 0.
+void sensorFix_setQ(uint8_t sensorId, uint8_t q);
+
+#endif
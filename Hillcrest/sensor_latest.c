@@ -0,0 +1,170 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Latest value of every sensor.
+ */
+
+#include "sensor_latest.h"
+
+#if SENSOR_LATEST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "stm32f4xx.h"
+#include "sh2_err.h"
+#include "timebase.h"
+#include "shell.h"
+#include "sysstats.h"
+#include "sensor_dispatch.h"
+#include "priorities.h"
+
+// ------------------------------------------------------------------------
+// Private types
+
+typedef struct {
+    volatile uint32_t seq;      // odd while the sensor task writes
+    uint32_t count;             // events from this sensor
+    sh2_SensorEvent_t event;
+} Latest_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void latestEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix);
+static void latestCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+// Written by the sensor task only, read by any task
+static Latest_t latest[SH2_MAX_SENSOR_ID+1];
+
+// Reads that had to copy again, and that gave up
+static volatile uint32_t retries;
+static volatile uint32_t busy;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void sensorLatest_init(void)
+{
+    sysstats_addMemory("latest values", sizeof(latest));
+    shell_addCommand("latest", "[sensor] newest event of each sensor", latestCmd);
+    sensorDispatch_subscribe(SENSOR_DISPATCH_ALL, PRIO_SUB_LATEST, latestEvent, 0);
+}
+
+int sensorLatest_get(uint8_t sensorId, sh2_SensorEvent_t *pEvent, uint32_t *pCount)
+{
+    if (sensorId > SH2_MAX_SENSOR_ID) {
+        return SH2_ERR_BAD_PARAM;
+    }
+
+    const Latest_t *l = &latest[sensorId];
+    for (unsigned n = 0; n < SENSOR_LATEST_READ_TRIES; n++) {
+        uint32_t seq = l->seq;
+        uint32_t count;
+
+        // Read of seq must complete before the entry is read, and the
+        // entry before seq is read again
+        __DMB();
+        *pEvent = l->event;
+        count = l->count;
+        __DMB();
+
+        if (((seq & 1) == 0) && (seq == l->seq)) {
+            if (pCount != 0) {
+                *pCount = count;
+            }
+            return (count != 0) ? SH2_OK : SH2_ERR;
+        }
+        retries++;
+    }
+
+    busy++;
+    return SH2_ERR_OP_IN_PROGRESS;
+}
+
+int sensorLatest_getFix(uint8_t sensorId, SensorFix_t *pFix)
+{
+    sh2_SensorEvent_t event;
+    int status = sensorLatest_get(sensorId, &event, 0);
+
+    if (status != SH2_OK) {
+        return status;
+    }
+    return sensorFix_decode(pFix, &event);
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+// Dispatch callback for every event, in the sensor task
+static void latestEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix)
+{
+    if (pEvent->reportId > SH2_MAX_SENSOR_ID) {
+        return;
+    }
+
+    Latest_t *l = &latest[pEvent->reportId];
+    l->seq = l->seq + 1;
+    // The odd count must be visible before any of the entry changes
+    __DMB();
+    l->event = *pEvent;
+    l->count++;
+    __DMB();
+    l->seq = l->seq + 1;
+}
+
+static void latestCmd(int argc, char *argv[])
+{
+    unsigned first = 0;
+    unsigned last = SH2_MAX_SENSOR_ID;
+    uint64_t now_uS = timebase_getUs();
+
+    if (argc > 1) {
+        first = last = strtoul(argv[1], 0, 0);
+    }
+
+    printf("  %-4s %10s %10s  %s\n", "id", "events", "age [us]", "report");
+    for (unsigned id = first; id <= last; id++) {
+        sh2_SensorEvent_t event;
+        uint32_t count;
+        int status = sensorLatest_get(id, &event, &count);
+
+        if (status == SH2_ERR) {
+            if (argc > 1) {
+                printf("  %-4u no reports\n", id);
+            }
+            continue;
+        }
+        if (status != SH2_OK) {
+            printf("  %-4u error %d\n", id, status);
+            continue;
+        }
+
+        printf("  %-4u %10u %10u  ", id, count,
+               (now_uS > event.timestamp_uS) ? (uint32_t)(now_uS - event.timestamp_uS) : 0);
+        for (unsigned n = 0; (n < event.len) && (n < sizeof(event.report)); n++) {
+            printf("%02x", event.report[n]);
+        }
+        printf("\n");
+    }
+    printf("Reads retried %u, busy %u\n", retries, busy);
+}
+
+#endif
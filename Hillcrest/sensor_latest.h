@@ -0,0 +1,66 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Latest value of every sensor.
+ *
+ * A dispatch subscriber to all sensors keeps the newest event of each
+ * sensor id in a table, so a consumer that only wants current state
+ * (a control loop sampling at its own rate) reads it in O(1) instead of
+ * running its own queue.  Timestamps are on the MCU timebase, as
+ * dispatched.
+ *
+ * Each entry has a sequence counter, odd while the sensor task writes
+ * it.  Readers copy the entry and retry if the count moved, so they take
+ * no lock and never hold up the sensor task or the HAL.  A reader that
+ * preempts the sensor task mid-write (the HAL task, an ISR) would wait
+ * for a write that can't finish: it gives up after
+ * SENSOR_LATEST_READ_TRIES copies.
+ */
+
+#ifndef SENSOR_LATEST_H
+#define SENSOR_LATEST_H
+
+#include <stdint.h>
+#include "sh2.h"
+#include "sensor_fix.h"
+
+// Set to 1 to build in the table (RAM for one event per sensor id, 3.8KB)
+#ifndef SENSOR_LATEST
+#define SENSOR_LATEST (0)
+#endif
+
+// Copies a reader attempts before reporting the entry busy
+#ifndef SENSOR_LATEST_READ_TRIES
+#define SENSOR_LATEST_READ_TRIES (4)
+#endif
+
+// Register the "latest" command and subscribe to every sensor.
+void sensorLatest_init(void);
+
+// Copy the newest event of sensorId to *pEvent, and if pCount isn't
+// NULL, the number of events seen from it.  Safe from any task.
+// Returns SH2_OK, SH2_ERR if the sensor hasn't reported,
+// SH2_ERR_BAD_PARAM for an unknown id, or SH2_ERR_OP_IN_PROGRESS if a
+// write kept overlapping the copy.
+int sensorLatest_get(uint8_t sensorId, sh2_SensorEvent_t *pEvent, uint32_t *pCount);
+
+// As sensorLatest_get(), decoded by sensorFix_decode().  Also returns
+// SH2_ERR_BAD_PARAM for sensors without a fixed-point decoding.
+int sensorLatest_getFix(uint8_t sensorId, SensorFix_t *pFix);
+
+#endif
@@ -0,0 +1,239 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Timestamp-ordered merge of sensor events.
+ */
+
+#include "sensor_merge.h"
+
+#if SENSOR_MERGE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "sensor_dispatch.h"
+#include "sensor_sample.h"
+#include "timebase.h"
+#include "shell.h"
+#include "sysstats.h"
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void insert(const sh2_SensorEvent_t *pEvent);
+static void releaseOldest(void);
+static bool before(unsigned a, unsigned b);
+static void siftUp(unsigned n);
+static void siftDown(unsigned n);
+static void mergeCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static volatile uint32_t windowUs = SENSOR_MERGE_WINDOW_US;
+
+// Held events.  heap[0..held) index them as a min-heap on (timestamp,
+// arrival); heap[held..SENSOR_MERGE_DEPTH) are the free slots.
+static SensorSample_t slot[SENSOR_MERGE_DEPTH];
+static uint32_t arrival[SENSOR_MERGE_DEPTH];
+static uint8_t heap[SENSOR_MERGE_DEPTH];
+static unsigned held;
+static uint32_t arrivals;
+
+// Timestamp of the last event published from the heap
+static uint64_t lastOut_uS;
+
+static uint32_t late;
+static uint32_t forced;
+static unsigned maxHeld;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void sensorMerge_init(void)
+{
+    for (unsigned n = 0; n < SENSOR_MERGE_DEPTH; n++) {
+        heap[n] = n;
+    }
+    held = 0;
+
+    sysstats_addMemory("merge heap", sizeof(slot) + sizeof(arrival) + sizeof(heap));
+    sysstats_addCounter("merge late", &late);
+    sysstats_addCounter("merge forced", &forced);
+    shell_addCommand("merge", "[<window us>] order sensor events by timestamp", mergeCmd);
+}
+
+void sensorMerge_setWindow(uint32_t window_us)
+{
+    // The sensor task flushes what it holds on its next event
+    windowUs = window_us;
+}
+
+void sensorMerge_push(const sh2_SensorEvent_t *pEvent)
+{
+    if (windowUs == 0) {
+        // Just switched off: what is held goes first, in order
+        sensorMerge_flush();
+        sensorDispatch_publish(pEvent);
+        return;
+    }
+
+    if (pEvent->timestamp_uS < lastOut_uS) {
+        // Later ones are already out
+        late++;
+        return;
+    }
+
+    if (held == SENSOR_MERGE_DEPTH) {
+        forced++;
+        releaseOldest();
+    }
+    insert(pEvent);
+}
+
+TickType_t sensorMerge_release(void)
+{
+    uint32_t window = windowUs;
+    uint64_t now_uS = timebase_getUs();
+
+    if (window == 0) {
+        sensorMerge_flush();
+        return portMAX_DELAY;
+    }
+
+    while ((held != 0) && (slot[heap[0]].t_uS + window <= now_uS)) {
+        releaseOldest();
+    }
+
+    if (held == 0) {
+        return portMAX_DELAY;
+    }
+
+    // Round up, so the wake-up finds the oldest due
+    uint64_t due_uS = slot[heap[0]].t_uS + window - now_uS;
+    return pdMS_TO_TICKS((uint32_t)((due_uS + 999) / 1000)) + 1;
+}
+
+void sensorMerge_flush(void)
+{
+    while (held != 0) {
+        releaseOldest();
+    }
+
+    // A restarted stream may not follow on from the old one
+    lastOut_uS = 0;
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static void insert(const sh2_SensorEvent_t *pEvent)
+{
+    unsigned s = heap[held];
+
+    if (!sensorSample_pack(&slot[s], pEvent, 0)) {
+        // Too long to hold: out now, if out of order
+        sensorDispatch_publish(pEvent);
+        return;
+    }
+    arrival[s] = arrivals++;
+    held++;
+    siftUp(held - 1);
+
+    if (held > maxHeld) {
+        maxHeld = held;
+    }
+}
+
+// Publish the oldest event held
+static void releaseOldest(void)
+{
+    unsigned s = heap[0];
+    sh2_SensorEvent_t event;
+
+    held--;
+    heap[0] = heap[held];
+    heap[held] = s;
+    siftDown(0);
+
+    lastOut_uS = slot[s].t_uS;
+    sensorSample_unpack(&event, &slot[s]);
+    sensorDispatch_publish(&event);
+}
+
+// True if heap entry a goes out before heap entry b
+static bool before(unsigned a, unsigned b)
+{
+    const SensorSample_t *pA = &slot[heap[a]];
+    const SensorSample_t *pB = &slot[heap[b]];
+
+    if (pA->t_uS != pB->t_uS) {
+        return pA->t_uS < pB->t_uS;
+    }
+
+    // Arrival numbers wrap, their difference doesn't
+    return (int32_t)(arrival[heap[a]] - arrival[heap[b]]) < 0;
+}
+
+static void siftUp(unsigned n)
+{
+    while (n > 0) {
+        unsigned parent = (n - 1) / 2;
+        if (!before(n, parent)) {
+            break;
+        }
+        uint8_t t = heap[n];
+        heap[n] = heap[parent];
+        heap[parent] = t;
+        n = parent;
+    }
+}
+
+static void siftDown(unsigned n)
+{
+    while (1) {
+        unsigned child = 2*n + 1;
+        if (child >= held) {
+            break;
+        }
+        if ((child + 1 < held) && before(child + 1, child)) {
+            child++;
+        }
+        if (!before(child, n)) {
+            break;
+        }
+        uint8_t t = heap[n];
+        heap[n] = heap[child];
+        heap[child] = t;
+        n = child;
+    }
+}
+
+// Shell command: show or set the merge window.
+static void mergeCmd(int argc, char *argv[])
+{
+    if (argc > 1) {
+        sensorMerge_setWindow(strtoul(argv[1], 0, 0));
+    }
+
+    printf("Merge window %u us, %u of %u events held (most %u), %u late, %u forced\n",
+           (unsigned)windowUs, held, SENSOR_MERGE_DEPTH, maxHeld,
+           (unsigned)late, (unsigned)forced);
+}
+
+#endif
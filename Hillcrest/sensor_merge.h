@@ -0,0 +1,78 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Timestamp-ordered merge of sensor events ahead of dispatch.
+ *
+ * The hub sends reports in its own transmission order, which with
+ * batching is not timestamp order across sensors.  The sensor task
+ * pushes each event here instead of publishing it; events wait in a
+ * small min-heap until they are window microseconds old on the host
+ * timebase (see hub_clock.h), then are published oldest first.  Any
+ * event that arrives within the window of an earlier timestamped one is
+ * put back in order.  Equal timestamps keep their arrival order.
+ *
+ * Subscribers then see non-decreasing timestamps.  An event older than
+ * one already published arrived too late for the window and is dropped
+ * ("merge late" in stats); a full heap publishes its oldest event early
+ * ("merge forced").  A window of 0 (the default) publishes every event
+ * as it arrives, without delay.  Set it to the longest batch interval
+ * subscribed, with "merge <us>" at run time.
+ */
+
+#ifndef SENSOR_MERGE_H
+#define SENSOR_MERGE_H
+
+#include <stdint.h>
+#include "FreeRTOS.h"
+#include "sh2.h"
+
+// Build in the merge stage
+#ifndef SENSOR_MERGE
+#define SENSOR_MERGE (1)
+#endif
+
+// Events held at once (at most 255)
+#ifndef SENSOR_MERGE_DEPTH
+#define SENSOR_MERGE_DEPTH (16)
+#endif
+
+// Lookahead window at startup [us], 0 for none
+#ifndef SENSOR_MERGE_WINDOW_US
+#define SENSOR_MERGE_WINDOW_US (0)
+#endif
+
+// Register the "merge" command and the merge counters.
+void sensorMerge_init(void);
+
+// Set the lookahead window [us], 0 to publish events as they arrive.
+void sensorMerge_setWindow(uint32_t window_us);
+
+// Take one event, with its timestamp on the host timebase, and publish
+// it with sensorDispatch_publish() once it is due.  The event is copied.
+// Called by the sensor task only.
+void sensorMerge_push(const sh2_SensorEvent_t *pEvent);
+
+// Publish every event now due, and return how long the sensor task may
+// wait before the next one is (portMAX_DELAY if none is held).
+TickType_t sensorMerge_release(void);
+
+// Publish everything held and start the order over, e.g. when a hub
+// reset restarts the streams.
+void sensorMerge_flush(void);
+
+#endif
@@ -0,0 +1,211 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Sensor metadata cache.
+ */
+
+#include "sensor_meta.h"
+
+#include <stdio.h>
+#include <string.h>
+#include "sh2.h"
+#include "sh2_err.h"
+#include "shell.h"
+#include "sysstats.h"
+#include "sensor_fix.h"
+#include "sensor_set.h"
+
+// No table entry
+#define NO_ENTRY (0xFF)
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void metaCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+// Sensors read at load: the ones the output stage formats
+static const uint8_t metaSensors[] = {
+#if SENSOR_SET_ACCELEROMETER
+    SH2_ACCELEROMETER,
+#endif
+#if SENSOR_SET_GYROSCOPE_CALIBRATED
+    SH2_GYROSCOPE_CALIBRATED,
+#endif
+#if SENSOR_SET_MAGNETIC_FIELD_CALIBRATED
+    SH2_MAGNETIC_FIELD_CALIBRATED,
+#endif
+#if SENSOR_SET_LINEAR_ACCELERATION
+    SH2_LINEAR_ACCELERATION,
+#endif
+#if SENSOR_SET_ROTATION_VECTOR
+    SH2_ROTATION_VECTOR,
+#endif
+#if SENSOR_SET_GEOMAGNETIC_ROTATION_VECTOR
+    SH2_GEOMAGNETIC_ROTATION_VECTOR,
+#endif
+#if SENSOR_SET_RAW_ACCELEROMETER
+    SH2_RAW_ACCELEROMETER,
+#endif
+#if SENSOR_SET_RAW_GYROSCOPE
+    SH2_RAW_GYROSCOPE,
+#endif
+#if SENSOR_SET_RAW_MAGNETOMETER
+    SH2_RAW_MAGNETOMETER,
+#endif
+#if SENSOR_SET_GYRO_INTEGRATED_RV
+    SH2_GYRO_INTEGRATED_RV,
+#endif
+    0,
+};
+
+// Table entry of each sensor id, NO_ENTRY if none.  The shell reads
+// without locking; only the demo task writes.
+static uint8_t entryOf[SH2_MAX_SENSOR_ID+1];
+static SensorMeta_t meta[SENSOR_META_MAX];
+static unsigned entries;
+static bool loaded;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void sensorMeta_init(void)
+{
+    sensorMeta_invalidate();
+    sysstats_addMemory("sensor meta", sizeof(entryOf) + sizeof(meta));
+    shell_addCommand("meta", "hub metadata of the sensors output", metaCmd);
+}
+
+int sensorMeta_load(void)
+{
+    // Big, and only needed while loading
+    static sh2_SensorMetadata_t md;
+    int failed = 0;
+
+    if (loaded) {
+        return 0;
+    }
+
+    for (unsigned n = 0; metaSensors[n] != 0; n++) {
+        uint8_t id = metaSensors[n];
+
+        if (entryOf[id] != NO_ENTRY) {
+            continue;
+        }
+        if ((entries >= SENSOR_META_MAX) || (sh2_getMetadata(id, &md) != SH2_OK)) {
+            failed++;
+            continue;
+        }
+
+        SensorMeta_t *m = &meta[entries];
+        m->minPeriod_us = md.minPeriod_uS;
+        m->range = md.range;
+        m->resolution = md.resolution;
+        m->fifoMax = md.fifoMax;
+        m->power_mA = md.power_mA;
+        m->qPoint1 = (uint8_t)md.qPoint1;
+        m->qPoint2 = (uint8_t)md.qPoint2;
+        m->qPoint3 = (uint8_t)md.qPoint3;
+        entryOf[id] = (uint8_t)entries++;
+
+        sensorFix_setQ(id, m->qPoint1);
+    }
+
+    // Retried on the next load if any failed (e.g. a reset got in the way)
+    loaded = (failed == 0);
+    if (failed != 0) {
+        printf("Sensor metadata: %d records not read\n", failed);
+    }
+
+    return failed;
+}
+
+const SensorMeta_t *sensorMeta_get(uint8_t sensorId)
+{
+    if ((sensorId > SH2_MAX_SENSOR_ID) || (entryOf[sensorId] == NO_ENTRY)) {
+        return 0;
+    }
+
+    return &meta[entryOf[sensorId]];
+}
+
+void sensorMeta_invalidate(void)
+{
+    memset(entryOf, NO_ENTRY, sizeof(entryOf));
+    entries = 0;
+    loaded = false;
+    for (unsigned n = 0; metaSensors[n] != 0; n++) {
+        sensorFix_setQ(metaSensors[n], 0);
+    }
+}
+
+unsigned sensorMeta_export(uint8_t *ids, SensorMeta_t *m, unsigned max)
+{
+    unsigned n = 0;
+
+    for (int id = 1; (id <= SH2_MAX_SENSOR_ID) && (n < max); id++) {
+        if (entryOf[id] != NO_ENTRY) {
+            ids[n] = (uint8_t)id;
+            m[n++] = meta[entryOf[id]];
+        }
+    }
+
+    return n;
+}
+
+void sensorMeta_import(const uint8_t *ids, const SensorMeta_t *m, unsigned n)
+{
+    sensorMeta_invalidate();
+    for (unsigned k = 0; (k < n) && (entries < SENSOR_META_MAX); k++) {
+        if ((ids[k] == 0) || (ids[k] > SH2_MAX_SENSOR_ID) || (entryOf[ids[k]] != NO_ENTRY)) {
+            continue;
+        }
+        meta[entries] = m[k];
+        entryOf[ids[k]] = (uint8_t)entries++;
+        sensorFix_setQ(ids[k], m[k].qPoint1);
+    }
+
+    // Whatever the set has that wasn't kept is read on the next load
+    loaded = false;
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static void metaCmd(int argc, char *argv[])
+{
+    if (entries == 0) {
+        printf("No sensor metadata read yet\n");
+        return;
+    }
+
+    printf("  %6s %10s %10s %10s %6s %6s %s\n",
+           "sensor", "min us", "range", "resol", "fifo", "mA", "q");
+    for (int id = 1; id <= SH2_MAX_SENSOR_ID; id++) {
+        const SensorMeta_t *m = sensorMeta_get(id);
+        if (m == 0) {
+            continue;
+        }
+        printf("  %6d %10u %10u %10u %6u %6.2f %u/%u/%u\n",
+               id, (unsigned)m->minPeriod_us, (unsigned)m->range,
+               (unsigned)m->resolution, (unsigned)m->fifoMax,
+               m->power_mA / 1024.0f, m->qPoint1, m->qPoint2, m->qPoint3);
+    }
+}
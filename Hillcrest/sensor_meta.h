@@ -0,0 +1,74 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Sensor metadata cache.
+ *
+ * The hub describes each sensor in an FRS metadata record: Q points,
+ * range, resolution, minimum period, FIFO share.  Reading one takes
+ * several FRS round trips, so sensorMeta_load() reads the records of the
+ * sensors the output stage formats (sensor_set.h) once, into a compact
+ * table, and lookups are O(1) from then on.  The records only change
+ * with the hub firmware: sensorMeta_invalidate() after DFU has them
+ * read again on the next load.
+ *
+ * Each sensor's Q point is passed on to sensorFix_setQ(), so reports are
+ * decoded (and DSF printed) at the scale the hub uses.
+ */
+
+#ifndef SENSOR_META_H
+#define SENSOR_META_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Sensors whose metadata is kept
+#ifndef SENSOR_META_MAX
+#define SENSOR_META_MAX (12)
+#endif
+
+// One sensor's metadata, as read from the hub
+typedef struct {
+    uint32_t minPeriod_us;    // fastest report interval, 0 for on change
+    uint32_t range;           // at qPoint1
+    uint32_t resolution;      // at qPoint1
+    uint32_t fifoMax;         // FIFO entries the sensor may take
+    uint16_t power_mA;        // Q10
+    uint8_t qPoint1;          // Q point of the report fields
+    uint8_t qPoint2;          // of the accuracy or bias fields
+    uint8_t qPoint3;          // of change sensitivity
+} SensorMeta_t;
+
+// Register the "meta" command.
+void sensorMeta_init(void);
+
+// Read the metadata not read yet.  Calls the SH-2 API: demo task only.
+// Returns the number of records that could not be read.
+int sensorMeta_load(void);
+
+// Metadata of sensorId, or NULL if it isn't cached.
+const SensorMeta_t *sensorMeta_get(uint8_t sensorId);
+
+// Forget the table (the hub firmware changed).
+void sensorMeta_invalidate(void);
+
+// Copy the table out to ids and m (up to max entries), for keeping over
+// a warm reset (warm_boot.h), and back in.  Returns the entries copied.
+unsigned sensorMeta_export(uint8_t *ids, SensorMeta_t *m, unsigned max);
+void sensorMeta_import(const uint8_t *ids, const SensorMeta_t *m, unsigned n);
+
+#endif
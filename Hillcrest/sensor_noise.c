@@ -0,0 +1,334 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Streaming noise statistics.
+ */
+
+#include "sensor_noise.h"
+
+#if SENSOR_NOISE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "shell.h"
+#include "sysstats.h"
+#include "sensor_dispatch.h"
+#include "priorities.h"
+
+// ------------------------------------------------------------------------
+// Private types
+
+// One Allan variance bin of a field
+typedef struct {
+    float held;             // first average of a pair, from the bin below
+    float prev;             // this bin's last average
+    double sumSq;           // sum of squared differences of its averages
+    uint32_t count;         // differences summed
+    uint8_t haveHeld;
+    uint8_t havePrev;
+} NoiseBin_t;
+
+typedef struct {
+    double mean;            // [LSB]
+    double m2;              // sum of squared differences from the mean
+    int16_t min;
+    int16_t max;
+    NoiseBin_t bin[SENSOR_NOISE_AVAR_BINS];
+} NoiseField_t;
+
+typedef struct {
+    volatile uint8_t sensorId;      // 0: slot free
+    volatile bool restart;          // set by the shell, cleared here
+    uint8_t fields;
+    uint8_t q;
+    uint32_t n;
+    uint64_t first_uS;
+    uint64_t last_uS;
+    NoiseField_t field[SENSOR_NOISE_FIELDS];
+} NoiseSensor_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void noiseEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix);
+static unsigned fields(const SensorFix_t *pFix, int16_t *v);
+static void addSample(NoiseField_t *f, uint32_t n, int16_t v);
+static void addAverage(NoiseField_t *f, unsigned b, float avg);
+static void restart(NoiseSensor_t *s);
+static void printSummary(const NoiseSensor_t *s);
+static void noiseCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+// Written by the sensor task; the shell reads without locking
+static NoiseSensor_t sensors[SENSOR_NOISE_SENSORS];
+static uint64_t summary_uS;         // hub time of the last summaries
+static volatile uint32_t period_s = SENSOR_NOISE_PERIOD_S;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void sensorNoise_init(void)
+{
+    sysstats_addMemory("sensor noise", sizeof(sensors));
+    shell_addCommand("noise", "[<sensor>... | off | every <s>] streaming noise and Allan deviation",
+                     noiseCmd);
+    sensorDispatch_subscribe(SENSOR_DISPATCH_ALL, PRIO_SUB_NOISE, noiseEvent, 0);
+}
+
+bool sensorNoise_watch(sh2_SensorId_t sensorId)
+{
+    NoiseSensor_t *slot = 0;
+
+    taskENTER_CRITICAL();
+    for (int n = 0; n < SENSOR_NOISE_SENSORS; n++) {
+        if (sensors[n].sensorId == sensorId) {
+            slot = &sensors[n];
+            break;
+        }
+        if ((sensors[n].sensorId == 0) && (slot == 0)) {
+            slot = &sensors[n];
+        }
+    }
+    if (slot != 0) {
+        slot->restart = true;
+        slot->sensorId = sensorId;
+    }
+    taskEXIT_CRITICAL();
+
+    return (slot != 0);
+}
+
+void sensorNoise_clear(void)
+{
+    for (int n = 0; n < SENSOR_NOISE_SENSORS; n++) {
+        sensors[n].sensorId = 0;
+    }
+}
+
+void sensorNoise_dump(void)
+{
+    bool any = false;
+
+    for (int n = 0; n < SENSOR_NOISE_SENSORS; n++) {
+        const NoiseSensor_t *s = &sensors[n];
+        double scale = 1.0 / (double)(1 << s->q);
+
+        if ((s->sensorId == 0) || s->restart) {
+            continue;
+        }
+        any = true;
+        printSummary(s);
+        if (s->n < 2) {
+            continue;
+        }
+
+        // Allan deviation against averaging time, one column per field
+        double tau0 = (double)(s->last_uS - s->first_uS) / (1e6 * (s->n - 1));
+        printf("  %10s", "tau [s]");
+        for (unsigned f = 0; f < s->fields; f++) {
+            printf("   adev[%u]", f);
+        }
+        printf("\n");
+        for (unsigned b = 0; b < SENSOR_NOISE_AVAR_BINS; b++) {
+            if (s->field[0].bin[b].count == 0) {
+                break;
+            }
+            printf("  %10.4f", tau0 * (1 << b));
+            for (unsigned f = 0; f < s->fields; f++) {
+                const NoiseBin_t *nb = &s->field[f].bin[b];
+                printf(" %10.3e", sqrt(0.5 * nb->sumSq / nb->count) * scale);
+            }
+            printf("\n");
+        }
+    }
+
+    if (!any) {
+        printf("No sensors watched.\n");
+    }
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+// Dispatch callback, in the sensor task
+static void noiseEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix)
+{
+    if (pFix != 0) {
+        for (int n = 0; n < SENSOR_NOISE_SENSORS; n++) {
+            NoiseSensor_t *s = &sensors[n];
+            int16_t v[SENSOR_NOISE_FIELDS];
+
+            if (s->sensorId != pFix->sensorId) {
+                continue;
+            }
+            if (s->restart) {
+                s->restart = false;
+                restart(s);
+            }
+
+            s->fields = (uint8_t)fields(pFix, v);
+            s->q = pFix->q;
+            if (pFix->kind == SENSORFIX_GIRV) {
+                s->q = SENSORFIX_Q_ANGVEL;
+            }
+            if (s->n == 0) {
+                s->first_uS = pFix->timestamp_uS;
+            }
+            s->last_uS = pFix->timestamp_uS;
+            s->n++;
+            for (unsigned f = 0; f < s->fields; f++) {
+                addSample(&s->field[f], s->n, v[f]);
+            }
+        }
+    }
+
+    if ((period_s != 0) &&
+        (pEvent->timestamp_uS - summary_uS >= (uint64_t)period_s * 1000000)) {
+        if (summary_uS != 0) {
+            for (int n = 0; n < SENSOR_NOISE_SENSORS; n++) {
+                if ((sensors[n].sensorId != 0) && !sensors[n].restart) {
+                    printSummary(&sensors[n]);
+                }
+            }
+        }
+        summary_uS = pEvent->timestamp_uS;
+    }
+}
+
+// The fields watched, in v
+static unsigned fields(const SensorFix_t *pFix, int16_t *v)
+{
+    switch (pFix->kind) {
+        case SENSORFIX_QUAT:
+            v[0] = pFix->un.quat.i;
+            v[1] = pFix->un.quat.j;
+            v[2] = pFix->un.quat.k;
+            v[3] = pFix->un.quat.real;
+            return 4;
+        case SENSORFIX_GIRV:
+            // The rate is what drifts
+            v[0] = pFix->un.girv.angVelX;
+            v[1] = pFix->un.girv.angVelY;
+            v[2] = pFix->un.girv.angVelZ;
+            return 3;
+        default:
+            v[0] = pFix->un.vec3.x;
+            v[1] = pFix->un.vec3.y;
+            v[2] = pFix->un.vec3.z;
+            return 3;
+    }
+}
+
+// Sample n (from 1) of field f
+static void addSample(NoiseField_t *f, uint32_t n, int16_t v)
+{
+    // Welford: stable however long it runs
+    double delta = v - f->mean;
+    f->mean += delta / n;
+    f->m2 += delta * (v - f->mean);
+
+    if ((n == 1) || (v < f->min)) f->min = v;
+    if ((n == 1) || (v > f->max)) f->max = v;
+
+    addAverage(f, 0, (float)v);
+}
+
+// A new average over 2^b samples for bin b
+static void addAverage(NoiseField_t *f, unsigned b, float avg)
+{
+    NoiseBin_t *nb = &f->bin[b];
+
+    if (nb->havePrev) {
+        float d = avg - nb->prev;
+        nb->sumSq += d * d;
+        nb->count++;
+    }
+    nb->prev = avg;
+    nb->havePrev = true;
+
+    if (b + 1 < SENSOR_NOISE_AVAR_BINS) {
+        if (nb->haveHeld) {
+            nb->haveHeld = false;
+            addAverage(f, b + 1, 0.5f * (nb->held + avg));
+        }
+        else {
+            nb->held = avg;
+            nb->haveHeld = true;
+        }
+    }
+}
+
+static void restart(NoiseSensor_t *s)
+{
+    uint8_t sensorId = s->sensorId;
+
+    memset(s, 0, sizeof(*s));
+    s->sensorId = sensorId;
+}
+
+// One line per field: samples, mean, standard deviation, min and max
+static void printSummary(const NoiseSensor_t *s)
+{
+    double scale = 1.0 / (double)(1 << s->q);
+
+    for (unsigned f = 0; f < s->fields; f++) {
+        const NoiseField_t *nf = &s->field[f];
+        double sd = (s->n > 1) ? sqrt(nf->m2 / (s->n - 1)) : 0.0;
+
+        printf("noise %u.%u: n %u mean %.6g sd %.4g min %.6g max %.6g\n",
+               s->sensorId, f, (unsigned)s->n,
+               nf->mean * scale, sd * scale, nf->min * scale, nf->max * scale);
+    }
+}
+
+// Shell command: watch sensors, stop, set the summary interval, or print.
+static void noiseCmd(int argc, char *argv[])
+{
+    if ((argc > 1) && (strcmp(argv[1], "off") == 0)) {
+        sensorNoise_clear();
+        return;
+    }
+    if ((argc > 2) && (strcmp(argv[1], "every") == 0)) {
+        period_s = strtoul(argv[2], 0, 0);
+        return;
+    }
+    if (argc > 1) {
+        for (int n = 1; n < argc; n++) {
+            unsigned id = strtoul(argv[n], 0, 0);
+            if ((id == 0) || (id > SH2_MAX_SENSOR_ID)) {
+                printf("usage: %s [<sensor>... | off | every <s>]\n", argv[0]);
+                return;
+            }
+            if (!sensorNoise_watch((sh2_SensorId_t)id)) {
+                printf("Watching %d sensors already.\n", SENSOR_NOISE_SENSORS);
+                return;
+            }
+        }
+        return;
+    }
+
+    sensorNoise_dump();
+}
+
+#endif
@@ -0,0 +1,81 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Streaming noise statistics, for noise and drift characterization.
+ *
+ * For each watched sensor, every report field's running mean and
+ * variance (Welford's update: no samples are kept), minimum and maximum,
+ * and its Allan variance at averaging times of 1, 2, 4 ... 2^(bins-1)
+ * report intervals.  Allan bins are non-overlapping and cascaded: each
+ * one averages pairs of the bin below's averages, so a report costs a
+ * few float operations per field and bin.
+ *
+ * Every SENSOR_NOISE_PERIOD_S, one summary line per watched field goes
+ * out on the console, instead of the reports at full rate: hours of
+ * characterization in a few bytes per second.  "noise" prints the whole
+ * table, Allan deviations included.  Fields are in the units of the
+ * report (the Q point of its fixed-point decode); angular velocity for
+ * the Gyro Integrated RV.  The sensors must be subscribed: this only
+ * watches their reports.
+ */
+
+#ifndef SENSOR_NOISE_H
+#define SENSOR_NOISE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sh2.h"
+
+// Set to 1 to build in the statistics (about 1.3KB RAM per sensor in
+// SENSOR_NOISE_SENSORS)
+#ifndef SENSOR_NOISE
+#define SENSOR_NOISE (0)
+#endif
+
+// Sensors watched at once
+#ifndef SENSOR_NOISE_SENSORS
+#define SENSOR_NOISE_SENSORS (3)
+#endif
+
+// Allan variance bins: averaging times up to 2^(bins-1) reports
+#ifndef SENSOR_NOISE_AVAR_BINS
+#define SENSOR_NOISE_AVAR_BINS (12)
+#endif
+
+// Interval between summaries on the console [s], 0 for none
+#ifndef SENSOR_NOISE_PERIOD_S
+#define SENSOR_NOISE_PERIOD_S (60)
+#endif
+
+// Fields of a report watched, at most (a quaternion has 4)
+#define SENSOR_NOISE_FIELDS (4)
+
+// Register the "noise" command and subscribe to every sensor.
+void sensorNoise_init(void);
+
+// Watch sensorId, from no samples.  Returns false if SENSOR_NOISE_SENSORS
+// are watched already.
+bool sensorNoise_watch(sh2_SensorId_t sensorId);
+
+// Stop watching every sensor.
+void sensorNoise_clear(void);
+
+// Print every watched sensor's statistics.
+void sensorNoise_dump(void);
+
+#endif
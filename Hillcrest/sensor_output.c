@@ -0,0 +1,1127 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Sensor report output on the console.
+ */
+
+#include "sensor_output.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "sh2_err.h"
+#include "sh2_SensorValue.h"
+#include "crc16.h"
+#include "crc32.h"
+#include "quat_pack.h"
+#include "console.h"
+#include "itm.h"
+#include "dlog.h"
+#include "shell.h"
+#include "sensor_dispatch.h"
+#include "priorities.h"
+#include "sysstats.h"
+#include "fixfmt.h"
+#include "usb_cdc.h"
+#include "data_uart.h"
+#include "sensor_set.h"
+#include "sensor_camsync.h"
+
+// Define this to produce DSF data for logging
+// #define DSF_OUTPUT
+
+// Define this to stream compact binary frames instead. (tools/bin2dsf.py
+// converts a capture of this stream back to DSF.)
+// #define BIN_OUTPUT
+
+// Define this to stream delta-coded binary frames (BIN_DELTA), which
+// bin2dsf.py also converts.
+// #define DELTA_OUTPUT
+
+// (Any of these only selects the output mode at startup, the "out" shell
+// command switches it at run time.)
+
+// Longest text or DSF line: GIRV, 7 fields and the timestamp
+#define TEXT_LINE_LEN (128)
+
+// Rotation vector accuracy estimate, radians to degrees
+#define RAD_TO_DEG_Q10 FIX_Q(10, 57.2957795f)
+
+// ------------------------------------------------------------------------
+// Private types
+
+// Format one report as text at p, returning the end of the text
+typedef char *TextFn_t(char *p, const SensorFix_t *pFix);
+
+// Format the fields of one report's DSF line after its timestamp at p,
+// returning the end of the text; sample is its extended sequence number
+typedef char *DsfFn_t(char *p, uint32_t sample, const SensorFix_t *pFix);
+
+// One row of the DSF table: it formats the sensor's lines, names their
+// columns, and says whether "sub dsf" logs the sensor
+typedef struct {
+    DsfFn_t *fn;
+    const char *header;         // column definitions after "+<id> "
+    uint32_t interval_us;       // "sub dsf" rate, 0: not subscribed
+} DsfFormat_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void outputEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix);
+static void outCmd(int argc, char *argv[]);
+static void printDsfHeader(unsigned id, const char *header);
+static void printDsf(const sh2_SensorEvent_t * event, const SensorFix_t *pFix);
+static char *putDsfStart(char *p, unsigned id, uint64_t t_uS);
+static char *putDsfField(char *p, int32_t v, unsigned q, unsigned decimals);
+static char *putField(char *p, const char *label, int32_t v, unsigned q);
+static char *lineBuffer(char *line);
+static void writeLine(const char *line, const char *start, const char *end);
+static void printEvent(const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix);
+#if SENSOR_SET_RAW_ACCELEROMETER || SENSOR_SET_RAW_MAGNETOMETER || SENSOR_SET_RAW_GYROSCOPE
+static DsfFn_t dsfRaw;
+#endif
+#if SENSOR_SET_MAGNETIC_FIELD_CALIBRATED
+static DsfFn_t dsfMag;
+#endif
+#if SENSOR_SET_ACCELEROMETER || SENSOR_SET_LINEAR_ACCELERATION || SENSOR_SET_GYROSCOPE_CALIBRATED
+static DsfFn_t dsfVec3;
+#endif
+#if SENSOR_SET_ACCELEROMETER
+static TextFn_t textAccel;
+#endif
+#if SENSOR_SET_ROTATION_VECTOR || SENSOR_SET_GEOMAGNETIC_ROTATION_VECTOR
+static DsfFn_t dsfRv;
+#endif
+#if SENSOR_SET_ROTATION_VECTOR
+static TextFn_t textRv;
+#endif
+#if SENSOR_SET_GAME_ROTATION_VECTOR
+static DsfFn_t dsfGameRv;
+static TextFn_t textGameRv;
+#endif
+#if SENSOR_SET_GYRO_INTEGRATED_RV
+static DsfFn_t dsfGirv;
+static TextFn_t textGirv;
+#endif
+#if SENSOR_SET_RAW_ACCELEROMETER
+static TextFn_t textRawAccel;
+#endif
+#if SENSOR_SET_GEOMAGNETIC_ROTATION_VECTOR
+static TextFn_t textGeoRv;
+#endif
+#if SENSOR_SET_GYROSCOPE_CALIBRATED
+static TextFn_t textGyro;
+#endif
+#if SENSOR_SET_LINEAR_ACCELERATION
+static TextFn_t textLinAccel;
+#endif
+static uint8_t *frameBuffer(uint8_t *frame);
+static void writeFrame(const uint8_t *stack, const uint8_t *frame, unsigned len);
+static uint8_t *putCrc(uint8_t *p, const uint8_t *data, unsigned len);
+#if BIN_DELTA
+static BinDeltaSensor_t *deltaSlot(BinDelta_t *pDelta, uint8_t sensorId);
+static uint8_t *putVarint(uint8_t *p, uint64_t v);
+static uint64_t zigzag(int64_t v);
+#endif
+#if OUTPUT_DEADBAND
+static bool changed(const SensorFix_t *pFix);
+#endif
+#if SENSOR_CAMSYNC
+static int16_t reportField(const sh2_SensorEvent_t *event, unsigned offset);
+static void dsfCamsync(const sh2_SensorEvent_t *event);
+static void textCamsync(const sh2_SensorEvent_t *event);
+#endif
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+#if defined(DELTA_OUTPUT) && BIN_DELTA
+static volatile OutputMode_t outputMode = OUTPUT_DELTA;
+#elif defined(BIN_OUTPUT)
+static volatile OutputMode_t outputMode = OUTPUT_BIN;
+#elif defined(DSF_OUTPUT)
+static volatile OutputMode_t outputMode = OUTPUT_DSF;
+#else
+static volatile OutputMode_t outputMode = OUTPUT_TEXT;
+#endif
+
+// Formatters of the sensors built in (sensor_set.h), by sensor id.  A
+// report with no entry prints as unknown.
+static TextFn_t * const textFormat[SH2_MAX_SENSOR_ID+1] = {
+#if SENSOR_SET_RAW_ACCELEROMETER
+    [SH2_RAW_ACCELEROMETER] = textRawAccel,
+#endif
+#if SENSOR_SET_ACCELEROMETER
+    [SH2_ACCELEROMETER] = textAccel,
+#endif
+#if SENSOR_SET_ROTATION_VECTOR
+    [SH2_ROTATION_VECTOR] = textRv,
+#endif
+#if SENSOR_SET_GYRO_INTEGRATED_RV
+    [SH2_GYRO_INTEGRATED_RV] = textGirv,
+#endif
+#if SENSOR_SET_GEOMAGNETIC_ROTATION_VECTOR
+    [SH2_GEOMAGNETIC_ROTATION_VECTOR] = textGeoRv,
+#endif
+#if SENSOR_SET_GYROSCOPE_CALIBRATED
+    [SH2_GYROSCOPE_CALIBRATED] = textGyro,
+#endif
+#if SENSOR_SET_LINEAR_ACCELERATION
+    [SH2_LINEAR_ACCELERATION] = textLinAccel,
+#endif
+#if SENSOR_SET_GAME_ROTATION_VECTOR
+    [SH2_GAME_ROTATION_VECTOR] = textGameRv,
+#endif
+};
+
+// Every sensor DSF can print.  Its headers go out for the sensors
+// reported, each before its first line, and "sub dsf" subscribes exactly
+// those with an interval: the raw and calibrated sensor data.
+static const DsfFormat_t dsfFormat[SH2_MAX_SENSOR_ID+1] = {
+#if SENSOR_SET_RAW_ACCELEROMETER
+    [SH2_RAW_ACCELEROMETER] = {dsfRaw,
+        "TIME[x]{s}, SAMPLE_ID[x]{samples}, RAW_ACCELEROMETER[xyz]{adc units}",
+        DSF_LOG_INTERVAL_US},
+#endif
+#if SENSOR_SET_RAW_GYROSCOPE
+    [SH2_RAW_GYROSCOPE] = {dsfRaw,
+        "TIME[x]{s}, SAMPLE_ID[x]{samples}, RAW_GYROSCOPE[xyz]{adc units}",
+        DSF_LOG_INTERVAL_US},
+#endif
+#if SENSOR_SET_RAW_MAGNETOMETER
+    [SH2_RAW_MAGNETOMETER] = {dsfRaw,
+        "TIME[x]{s}, SAMPLE_ID[x]{samples}, RAW_MAGNETOMETER[xyz]{adc units}",
+        DSF_LOG_INTERVAL_US},
+#endif
+#if SENSOR_SET_ACCELEROMETER
+    [SH2_ACCELEROMETER] = {dsfVec3,
+        "TIME[x]{s}, SAMPLE_ID[x]{samples}, ACCELEROMETER[xyz]{m/s^2}",
+        DSF_LOG_INTERVAL_US},
+#endif
+#if SENSOR_SET_GYROSCOPE_CALIBRATED
+    [SH2_GYROSCOPE_CALIBRATED] = {dsfVec3,
+        "TIME[x]{s}, SAMPLE_ID[x]{samples}, ANG_VEL[xyz]{rad/s}",
+        DSF_LOG_INTERVAL_US},
+#endif
+#if SENSOR_SET_MAGNETIC_FIELD_CALIBRATED
+    [SH2_MAGNETIC_FIELD_CALIBRATED] = {dsfMag,
+        "TIME[x]{s}, SAMPLE_ID[x]{samples}, MAG_FIELD[xyz]{uTesla}, STATUS[x]{enum}",
+        DSF_LOG_INTERVAL_US},
+#endif
+#if SENSOR_SET_LINEAR_ACCELERATION
+    [SH2_LINEAR_ACCELERATION] = {dsfVec3,
+        "TIME[x]{s}, SAMPLE_ID[x]{samples}, LINEAR_ACCELERATION[xyz]{m/s^2}",
+        0},
+#endif
+#if SENSOR_SET_ROTATION_VECTOR
+    [SH2_ROTATION_VECTOR] = {dsfRv,
+        "TIME[x]{s}, SAMPLE_ID[x]{samples}, ANG_POS_GLOBAL[rijk]{quaternion}, ANG_POS_ACCURACY[x]{rad}",
+        0},
+#endif
+#if SENSOR_SET_GEOMAGNETIC_ROTATION_VECTOR
+    [SH2_GEOMAGNETIC_ROTATION_VECTOR] = {dsfRv,
+        "TIME[x]{s}, SAMPLE_ID[x]{samples}, ANG_POS_GLOBAL[rijk]{quaternion}, ANG_POS_ACCURACY[x]{rad}",
+        0},
+#endif
+#if SENSOR_SET_GAME_ROTATION_VECTOR
+    [SH2_GAME_ROTATION_VECTOR] = {dsfGameRv,
+        "TIME[x]{s}, SAMPLE_ID[x]{samples}, ANG_POS_GAME[rijk]{quaternion}",
+        0},
+#endif
+#if SENSOR_SET_GYRO_INTEGRATED_RV
+    [SH2_GYRO_INTEGRATED_RV] = {dsfGirv,
+        "TIME[x]{s}, ANG_VEL_GYRO_RV[xyz]{rad/s}, ANG_POS_GYRO_RV[wxyz]{quaternion}",
+        0},
+#endif
+};
+
+// A DSF capture starting over sends each sensor's header again
+static volatile bool dsfHeadersNeeded = true;
+static bool dsfHeaderSent[SH2_MAX_SENSOR_ID+1];
+#if SENSOR_CAMSYNC
+static bool camsyncHeaderSent;
+#endif
+
+// Last sequence number for each sensor, extended to 32 bits for DSF
+static uint32_t lastSequence[SH2_MAX_SENSOR_ID+1];
+#if SENSOR_CAMSYNC
+static uint32_t camsyncSequence;
+#endif
+
+#if OUTPUT_DEADBAND
+// Fields of the last report output for each sensor
+#define DEADBAND_FIELDS (7)
+
+typedef struct {
+    int16_t v[DEADBAND_FIELDS];
+    uint8_t status;
+    bool valid;
+    uint32_t output_ms;
+} Emitted_t;
+
+static Emitted_t emitted[SH2_MAX_SENSOR_ID+1];
+static volatile uint16_t deadbandLsb = OUTPUT_DEADBAND_LSB;
+static volatile uint32_t keepAliveMs = OUTPUT_KEEPALIVE_MS;
+static uint32_t suppressed;
+#endif
+
+static uint8_t binSeq;
+#if BIN_POSE
+static volatile uint8_t poseBits = BIN_POSE_BITS;
+#endif
+
+#if BIN_DELTA
+static BinDelta_t delta;
+
+// Reset delta (in the sensor task) so every sensor starts with a keyframe
+static volatile bool deltaReset = true;
+#endif
+
+// ------------------------------------------------------------------------
+// Public API
+
+void sensorOutput_init(void)
+{
+    shell_addCommand("out", "[text | dsf | bin | delta | pose [bits] | none | deadband <lsb> [keep-alive ms]] report output format",
+                     outCmd);
+    sysstats_addMemory("DSF sequence", sizeof(lastSequence));
+#if OUTPUT_DEADBAND
+    sysstats_addMemory("output deadband", sizeof(emitted));
+    sysstats_addCounter("out suppressed", &suppressed);
+#endif
+#if BIN_DELTA
+    sysstats_addMemory("delta state", sizeof(delta));
+#endif
+    sensorDispatch_subscribe(SENSOR_DISPATCH_ALL, PRIO_SUB_OUTPUT, outputEvent, 0);
+    sensorDispatch_addConsumer("console", console_txFill);
+}
+
+OutputMode_t sensorOutput_getMode(void)
+{
+    return outputMode;
+}
+
+uint32_t sensorOutput_dsfInterval(uint8_t sensorId)
+{
+    return (sensorId <= SH2_MAX_SENSOR_ID) ? dsfFormat[sensorId].interval_us : 0;
+}
+
+void sensorOutput_setMode(OutputMode_t mode)
+{
+    if ((mode == OUTPUT_DSF) && (outputMode != OUTPUT_DSF)) {
+        // A DSF capture starting here needs its headers
+        dsfHeadersNeeded = true;
+    }
+#if BIN_DELTA
+    if ((mode == OUTPUT_DELTA) && (outputMode != OUTPUT_DELTA)) {
+        // A capture starting here needs a keyframe of each sensor
+        deltaReset = true;
+    }
+#else
+    if (mode == OUTPUT_DELTA) {
+        mode = OUTPUT_BIN;
+    }
+#endif
+#if !BIN_POSE
+    if (mode == OUTPUT_POSE) {
+        mode = OUTPUT_BIN;
+    }
+#endif
+    outputMode = mode;
+}
+
+void sensorOutput_setDeadband(unsigned lsb, unsigned keepAlive_ms)
+{
+#if OUTPUT_DEADBAND
+    deadbandLsb = (lsb < UINT16_MAX) ? lsb : UINT16_MAX;
+    keepAliveMs = keepAlive_ms;
+#endif
+}
+
+unsigned sensorOutput_binFrame(uint8_t *frame, uint8_t *pSeq, const sh2_SensorEvent_t *event)
+{
+    uint8_t len = event->len;
+    uint64_t t = event->timestamp_uS;
+
+    if (len > sizeof(event->report)) {
+        len = sizeof(event->report);
+    }
+
+    frame[0] = BIN_SYNC0;
+    frame[1] = BIN_SYNC1;
+    frame[2] = event->reportId;
+    frame[3] = (*pSeq)++;
+    frame[4] = len;
+    for (int n = 0; n < 8; n++) {
+        frame[5+n] = (uint8_t)(t >> (8*n));
+    }
+    memcpy(&frame[BIN_HDR_LEN], event->report, len);
+
+    putCrc(&frame[BIN_HDR_LEN + len], &frame[2], BIN_HDR_LEN - 2 + len);
+
+    return BIN_HDR_LEN + len + BIN_CRC_LEN;
+}
+
+#if BIN_DELTA
+void sensorOutput_deltaReset(BinDelta_t *pDelta)
+{
+    memset(pDelta, 0, sizeof(*pDelta));
+}
+
+unsigned sensorOutput_deltaFrame(BinDelta_t *pDelta, uint8_t *frame, const sh2_SensorEvent_t *event)
+{
+    uint8_t *p = &frame[5];
+    const uint8_t *r = event->report;
+    BinDeltaSensor_t *s;
+    uint8_t len = event->len;
+    unsigned hdr = (event->reportId == SH2_GYRO_INTEGRATED_RV) ? 0 : 4;
+    unsigned n;
+    uint64_t t = event->timestamp_uS;
+    int64_t dt = 0;
+    bool key;
+
+    if (len > sizeof(event->report)) {
+        len = sizeof(event->report);
+    }
+    if (hdr > len) {
+        hdr = len;
+    }
+
+    s = deltaSlot(pDelta, event->reportId);
+    key = (s == 0) || (s->sensorId == 0) || (s->toKey == 0) || (s->len != len);
+    if (!key) {
+        dt = (int64_t)(t - s->t_uS);
+    }
+
+    frame[0] = BIN_SYNC0;
+    frame[1] = BIN_DELTA_SYNC1;
+    frame[2] = event->reportId | (key ? BIN_DELTA_KEY : 0);
+    frame[3] = (event->reportId <= SH2_MAX_SENSOR_ID) ? pDelta->seq[event->reportId]++ : 0;
+    if (key) {
+        *p++ = len;
+        p = putVarint(p, t);
+    }
+    else {
+        p = putVarint(p, zigzag(dt - s->dt_uS));
+    }
+
+    // Report header, but not the report id (it is the sensor id)
+    for (n = 1; n < hdr; n++) {
+        *p++ = r[n];
+    }
+    for (n = hdr; n + 1 < len; n += 2) {
+        int32_t v = (int16_t)(r[n] | (r[n+1] << 8));
+        if (!key) {
+            v -= (int16_t)(s->report[n] | (s->report[n+1] << 8));
+        }
+        p = putVarint(p, zigzag(v));
+    }
+    if (n < len) {
+        *p++ = r[n];
+    }
+
+    frame[4] = (uint8_t)(p - &frame[5]);
+    p = putCrc(p, &frame[2], p - &frame[2]);
+
+    pDelta->rawBytes += BIN_HDR_LEN + len + BIN_CRC_LEN;
+    pDelta->bytes += p - frame;
+
+    if (s != 0) {
+        s->sensorId = event->reportId;
+        s->len = len;
+        s->toKey = key ? BIN_KEYFRAME_INTERVAL - 1 : s->toKey - 1;
+        s->t_uS = t;
+        s->dt_uS = dt;
+        memcpy(s->report, r, len);
+    }
+    return p - frame;
+}
+#endif
+
+#if BIN_POSE
+unsigned sensorOutput_poseFrame(uint8_t *frame, uint8_t *pSeq, const sh2_SensorEvent_t *event,
+                                const SensorFix_t *pFix, unsigned bits)
+{
+    uint8_t *p = &frame[5];
+    uint32_t t = (uint32_t)event->timestamp_uS;
+    int16_t quat[4];
+    int16_t tail[3];
+    unsigned tailLen = 0;
+
+    if ((pFix == 0) || ((pFix->kind != SENSORFIX_QUAT) && (pFix->kind != SENSORFIX_GIRV))) {
+        return sensorOutput_binFrame(frame, pSeq, event);
+    }
+
+    if (pFix->kind == SENSORFIX_QUAT) {
+        quat[0] = pFix->un.quat.i;
+        quat[1] = pFix->un.quat.j;
+        quat[2] = pFix->un.quat.k;
+        quat[3] = pFix->un.quat.real;
+        if (pFix->un.quat.hasAccuracy) {
+            tail[tailLen++] = pFix->un.quat.accuracy;
+        }
+    }
+    else {
+        quat[0] = pFix->un.girv.i;
+        quat[1] = pFix->un.girv.j;
+        quat[2] = pFix->un.girv.k;
+        quat[3] = pFix->un.girv.real;
+        tail[tailLen++] = pFix->un.girv.angVelX;
+        tail[tailLen++] = pFix->un.girv.angVelY;
+        tail[tailLen++] = pFix->un.girv.angVelZ;
+    }
+
+    frame[0] = BIN_SYNC0;
+    frame[1] = BIN_POSE_SYNC1;
+    frame[2] = event->reportId;
+    frame[3] = (*pSeq)++;
+    for (int n = 0; n < 4; n++) {
+        *p++ = (uint8_t)(t >> (8*n));
+    }
+    *p++ = pFix->sequence;
+    *p++ = (uint8_t)((bits << 2) | (pFix->status & 0x3));
+    p += quatPack_encode(p, quat, pFix->q, bits);
+    for (unsigned n = 0; n < tailLen; n++) {
+        *p++ = (uint8_t)tail[n];
+        *p++ = (uint8_t)((uint16_t)tail[n] >> 8);
+    }
+
+    frame[4] = (uint8_t)(p - &frame[5]);
+    p = putCrc(p, &frame[2], p - &frame[2]);
+
+    return p - frame;
+}
+#endif
+
+
+void sensorOutput_event(const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix)
+{
+    uint8_t frame[BIN_FRAME_MAX];
+    uint8_t *p;
+
+#if OUTPUT_DEADBAND
+    if ((deadbandLsb != 0) && (pFix != 0) && !changed(pFix)) {
+        suppressed++;
+        return;
+    }
+#endif
+
+    switch (outputMode) {
+        case OUTPUT_BIN:
+            p = frameBuffer(frame);
+            if (p != 0) {
+                writeFrame(frame, p, sensorOutput_binFrame(p, &binSeq, pEvent));
+            }
+            break;
+#if BIN_DELTA
+        case OUTPUT_DELTA:
+            if (deltaReset) {
+                deltaReset = false;
+                sensorOutput_deltaReset(&delta);
+            }
+            // A frame USB has no room for is never coded, so the deltas
+            // of the next one still decode.
+            p = frameBuffer(frame);
+            if (p != 0) {
+                writeFrame(frame, p, sensorOutput_deltaFrame(&delta, p, pEvent));
+            }
+            break;
+#endif
+#if BIN_POSE
+        case OUTPUT_POSE:
+            p = frameBuffer(frame);
+            if (p != 0) {
+                writeFrame(frame, p, sensorOutput_poseFrame(p, &binSeq, pEvent, pFix, poseBits));
+            }
+            break;
+#endif
+        case OUTPUT_DSF:
+            if (dsfHeadersNeeded) {
+                dsfHeadersNeeded = false;
+                memset(dsfHeaderSent, 0, sizeof(dsfHeaderSent));
+#if SENSOR_CAMSYNC
+                camsyncHeaderSent = false;
+#endif
+            }
+            printDsf(pEvent, pFix);
+            break;
+        case OUTPUT_NONE:
+            break;
+        default:
+            printEvent(pEvent, pFix);
+            break;
+    }
+}
+
+void sensorOutput_writeFrame(const uint8_t *frame, unsigned len)
+{
+    writeFrame(frame, frame, len);
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+// Dispatch callback, in the sensor task
+static void outputEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix)
+{
+    sensorOutput_event(pEvent, pFix);
+}
+
+// Shell command: show or switch the report output format.
+static void outCmd(int argc, char *argv[])
+{
+    static const char * const modeName[] = {"text", "dsf", "bin", "delta", "none", "pose"};
+
+    if (argc == 1) {
+        printf("Output: %s\n", modeName[outputMode]);
+#if BIN_POSE
+        if (outputMode == OUTPUT_POSE) {
+            printf("Pose: %u bits per component\n", (unsigned)poseBits);
+        }
+#endif
+#if OUTPUT_DEADBAND
+        if (deadbandLsb != 0) {
+            printf("Deadband: %u LSB, keep-alive %u ms, %u suppressed\n",
+                   (unsigned)deadbandLsb, (unsigned)keepAliveMs, (unsigned)suppressed);
+        }
+#endif
+#if BIN_DELTA
+        if (delta.rawBytes != 0) {
+            printf("Delta: %u bytes for %u as bin (%u%%)\n",
+                   (unsigned)delta.bytes, (unsigned)delta.rawBytes,
+                   (unsigned)(((uint64_t)delta.bytes * 100 + delta.rawBytes/2) / delta.rawBytes));
+        }
+#endif
+        return;
+    }
+
+#if OUTPUT_DEADBAND
+    if ((argc > 2) && (strcmp(argv[1], "deadband") == 0)) {
+        unsigned ms = (argc > 3) ? strtoul(argv[3], 0, 0) : keepAliveMs;
+        sensorOutput_setDeadband(strtoul(argv[2], 0, 0), ms);
+        return;
+    }
+#endif
+
+#if BIN_POSE
+    if ((argc > 2) && (strcmp(argv[1], "pose") == 0)) {
+        unsigned bits = strtoul(argv[2], 0, 0);
+        if ((bits < QUAT_PACK_BITS_MIN) || (bits > QUAT_PACK_BITS_MAX)) {
+            printf("Pose bits %u to %u\n", QUAT_PACK_BITS_MIN, QUAT_PACK_BITS_MAX);
+            return;
+        }
+        poseBits = bits;
+    }
+#endif
+
+    for (int n = 0; n < sizeof(modeName)/sizeof(modeName[0]); n++) {
+        if (strcmp(argv[1], modeName[n]) == 0) {
+            sensorOutput_setMode((OutputMode_t)n);
+            return;
+        }
+    }
+
+    printf("usage: %s [text | dsf | bin | delta | pose [bits] | none | deadband <lsb> [keep-alive ms]]\n", argv[0]);
+}
+
+#if OUTPUT_DEADBAND
+// Whether pFix should be output, and if so remember it as the last one.
+static bool changed(const SensorFix_t *pFix)
+{
+    Emitted_t *e = &emitted[pFix->sensorId];
+    int16_t v[DEADBAND_FIELDS];
+    unsigned n = 0;
+    uint32_t now_ms = (uint32_t)(pFix->timestamp_uS / 1000);
+    bool moved;
+
+    switch (pFix->kind) {
+        case SENSORFIX_QUAT:
+            v[n++] = pFix->un.quat.i;
+            v[n++] = pFix->un.quat.j;
+            v[n++] = pFix->un.quat.k;
+            v[n++] = pFix->un.quat.real;
+            break;
+        case SENSORFIX_GIRV:
+            v[n++] = pFix->un.girv.i;
+            v[n++] = pFix->un.girv.j;
+            v[n++] = pFix->un.girv.k;
+            v[n++] = pFix->un.girv.real;
+            v[n++] = pFix->un.girv.angVelX;
+            v[n++] = pFix->un.girv.angVelY;
+            v[n++] = pFix->un.girv.angVelZ;
+            break;
+        default:
+            v[n++] = pFix->un.vec3.x;
+            v[n++] = pFix->un.vec3.y;
+            v[n++] = pFix->un.vec3.z;
+            break;
+    }
+
+    moved = !e->valid ||
+            ((e->status & 0x3) != (pFix->status & 0x3)) ||
+            ((now_ms - e->output_ms) >= keepAliveMs);
+    for (unsigned i = 0; (i < n) && !moved; i++) {
+        moved = (abs(v[i] - e->v[i]) > deadbandLsb);
+    }
+
+    if (moved) {
+        memcpy(e->v, v, n * sizeof(v[0]));
+        e->status = pFix->status;
+        e->output_ms = now_ms;
+        e->valid = true;
+    }
+    return moved;
+}
+#endif
+
+// "+<id> <header>", through console_write() as the lines are, so it
+// goes out ahead of them
+static void printDsfHeader(unsigned id, const char *header)
+{
+    char line[TEXT_LINE_LEN];
+    char *start = lineBuffer(line);
+    char *p;
+
+    p = fixfmt_str(start, "+");
+    p = fixfmt_int(p, id);
+    p = fixfmt_str(p, " ");
+    p = fixfmt_str(p, header);
+    *p++ = '\n';
+    writeLine(line, start, p);
+}
+
+// DSF lines, formatted from the fixed-point decode as text lines are.
+// The timestamp is split into whole seconds and microseconds with
+// integer arithmetic, so it keeps microsecond resolution however long
+// the session runs.
+static void printDsf(const sh2_SensorEvent_t * event, const SensorFix_t *pFix)
+{
+    char line[TEXT_LINE_LEN];
+    const DsfFormat_t *f;
+    char *p;
+
+#if SENSOR_CAMSYNC
+    if (event->reportId == CAMSYNC_REPORT_ID) {
+        dsfCamsync(event);
+        return;
+    }
+#endif
+
+    f = (pFix != 0) ? &dsfFormat[pFix->sensorId] : 0;
+    if ((f == 0) || (f->fn == 0)) {
+        dlog_printf("Unknown sensor: %d\n", event->reportId);
+        return;
+    }
+    
+    if (!dsfHeaderSent[pFix->sensorId]) {
+        dsfHeaderSent[pFix->sensorId] = true;
+        printDsfHeader(pFix->sensorId, f->header);
+    }
+
+    // Compute new sample_id
+    uint8_t deltaSeq = pFix->sequence - (lastSequence[pFix->sensorId] & 0xFF);
+    lastSequence[pFix->sensorId] += deltaSeq;
+
+    char *start = lineBuffer(line);
+    p = putDsfStart(start, pFix->sensorId, pFix->timestamp_uS);
+    p = f->fn(p, lastSequence[pFix->sensorId], pFix);
+    *p++ = '\n';
+    writeLine(line, start, p);
+}
+
+// Append ".<id> " and the timestamp as "%0.6f" seconds
+static char *putDsfStart(char *p, unsigned id, uint64_t t_uS)
+{
+    p = fixfmt_str(p, ".");
+    p = fixfmt_int(p, id);
+    p = fixfmt_str(p, " ");
+    return fixfmt_us(p, t_uS, 6, 0);
+}
+
+// Append ", " and v as "%0.<decimals>f"
+static char *putDsfField(char *p, int32_t v, unsigned q, unsigned decimals)
+{
+    p = fixfmt_str(p, ", ");
+    return fixfmt_q(p, v, q, decimals, 0);
+}
+
+#if SENSOR_SET_RAW_ACCELEROMETER || SENSOR_SET_RAW_MAGNETOMETER || SENSOR_SET_RAW_GYROSCOPE
+static char *dsfRaw(char *p, uint32_t sample, const SensorFix_t *pFix)
+{
+    p = putDsfField(p, sample, 0, 0);
+    p = putDsfField(p, pFix->un.vec3.x, 0, 0);
+    p = putDsfField(p, pFix->un.vec3.y, 0, 0);
+    return putDsfField(p, pFix->un.vec3.z, 0, 0);
+}
+#endif
+
+#if SENSOR_SET_MAGNETIC_FIELD_CALIBRATED
+static char *dsfMag(char *p, uint32_t sample, const SensorFix_t *pFix)
+{
+    p = putDsfField(p, sample, 0, 0);
+    p = putDsfField(p, pFix->un.vec3.x, pFix->q, 3);
+    p = putDsfField(p, pFix->un.vec3.y, pFix->q, 3);
+    p = putDsfField(p, pFix->un.vec3.z, pFix->q, 3);
+    return putDsfField(p, pFix->status & 0x3, 0, 0);
+}
+#endif
+
+#if SENSOR_SET_ACCELEROMETER || SENSOR_SET_LINEAR_ACCELERATION || SENSOR_SET_GYROSCOPE_CALIBRATED
+static char *dsfVec3(char *p, uint32_t sample, const SensorFix_t *pFix)
+{
+    p = putDsfField(p, sample, 0, 0);
+    p = putDsfField(p, pFix->un.vec3.x, pFix->q, 3);
+    p = putDsfField(p, pFix->un.vec3.y, pFix->q, 3);
+    return putDsfField(p, pFix->un.vec3.z, pFix->q, 3);
+}
+#endif
+
+#if SENSOR_SET_ROTATION_VECTOR || SENSOR_SET_GEOMAGNETIC_ROTATION_VECTOR
+static char *dsfRv(char *p, uint32_t sample, const SensorFix_t *pFix)
+{
+    p = putDsfField(p, sample, 0, 0);
+    p = putDsfField(p, pFix->un.quat.real, pFix->q, 3);
+    p = putDsfField(p, pFix->un.quat.i, pFix->q, 3);
+    p = putDsfField(p, pFix->un.quat.j, pFix->q, 3);
+    p = putDsfField(p, pFix->un.quat.k, pFix->q, 3);
+    return putDsfField(p, pFix->un.quat.accuracy, SENSORFIX_Q_ACCURACY, 3);
+}
+#endif
+
+#if SENSOR_SET_GAME_ROTATION_VECTOR
+static char *dsfGameRv(char *p, uint32_t sample, const SensorFix_t *pFix)
+{
+    // No accuracy estimate without the magnetometer
+    p = putDsfField(p, sample, 0, 0);
+    p = putDsfField(p, pFix->un.quat.real, pFix->q, 3);
+    p = putDsfField(p, pFix->un.quat.i, pFix->q, 3);
+    p = putDsfField(p, pFix->un.quat.j, pFix->q, 3);
+    return putDsfField(p, pFix->un.quat.k, pFix->q, 3);
+}
+#endif
+
+#if SENSOR_SET_GYRO_INTEGRATED_RV
+static char *dsfGirv(char *p, uint32_t sample, const SensorFix_t *pFix)
+{
+    // No sample id: GIRV reports carry no sequence number
+    p = putDsfField(p, pFix->un.girv.angVelX, SENSORFIX_Q_ANGVEL, 6);
+    p = putDsfField(p, pFix->un.girv.angVelY, SENSORFIX_Q_ANGVEL, 6);
+    p = putDsfField(p, pFix->un.girv.angVelZ, SENSORFIX_Q_ANGVEL, 6);
+    p = putDsfField(p, pFix->un.girv.real, pFix->q, 6);
+    p = putDsfField(p, pFix->un.girv.i, pFix->q, 6);
+    p = putDsfField(p, pFix->un.girv.j, pFix->q, 6);
+    return putDsfField(p, pFix->un.girv.k, pFix->q, 6);
+}
+#endif
+
+// Append label and v as "%5.3f"
+static char *putField(char *p, const char *label, int32_t v, unsigned q)
+{
+    p = fixfmt_str(p, label);
+    return fixfmt_q(p, v, q, 3, 5);
+}
+
+// Human-readable text, formatted from the fixed-point decode straight
+// into a line and written to the console, without printf or floats.
+static void printEvent(const sh2_SensorEvent_t * event, const SensorFix_t *pFix)
+{
+    char line[TEXT_LINE_LEN];
+    TextFn_t *fn;
+    char *p;
+
+#if SENSOR_CAMSYNC
+    if (event->reportId == CAMSYNC_REPORT_ID) {
+        textCamsync(event);
+        return;
+    }
+#endif
+
+    fn = (pFix != 0) ? textFormat[pFix->sensorId] : 0;
+    if (fn == 0) {
+        dlog_printf("Unknown sensor: %d\n", event->reportId);
+        return;
+    }
+
+    char *start = lineBuffer(line);
+    p = fn(start, pFix);
+    *p++ = '\n';
+    writeLine(line, start, p);
+}
+
+#if SENSOR_SET_RAW_ACCELEROMETER
+static char *textRawAccel(char *p, const SensorFix_t *pFix)
+{
+    p = fixfmt_str(p, "Raw acc: ");
+    p = fixfmt_int(p, pFix->un.vec3.x);
+    p = fixfmt_str(p, " ");
+    p = fixfmt_int(p, pFix->un.vec3.y);
+    p = fixfmt_str(p, " ");
+    return fixfmt_int(p, pFix->un.vec3.z);
+}
+#endif
+
+#if SENSOR_SET_ACCELEROMETER
+static char *textAccel(char *p, const SensorFix_t *pFix)
+{
+    p = fixfmt_str(p, "Acc: ");
+    p = fixfmt_q(p, pFix->un.vec3.x, pFix->q, 6, 0);
+    p = fixfmt_str(p, " ");
+    p = fixfmt_q(p, pFix->un.vec3.y, pFix->q, 6, 0);
+    p = fixfmt_str(p, " ");
+    return fixfmt_q(p, pFix->un.vec3.z, pFix->q, 6, 0);
+}
+#endif
+
+#if SENSOR_SET_ROTATION_VECTOR
+static char *textRv(char *p, const SensorFix_t *pFix)
+{
+    p = fixfmt_us(p, pFix->timestamp_uS, 4, 8);
+    p = putField(p, " Rotation Vector: r:", pFix->un.quat.real, pFix->q);
+    p = putField(p, " i:", pFix->un.quat.i, pFix->q);
+    p = putField(p, " j:", pFix->un.quat.j, pFix->q);
+    p = putField(p, " k:", pFix->un.quat.k, pFix->q);
+    p = putField(p, " (acc: ",
+                 (pFix->un.quat.accuracy * RAD_TO_DEG_Q10) >> 10,
+                 SENSORFIX_Q_ACCURACY);
+    return fixfmt_str(p, " deg)");
+}
+#endif
+
+#if SENSOR_SET_GYRO_INTEGRATED_RV
+static char *textGirv(char *p, const SensorFix_t *pFix)
+{
+    p = fixfmt_us(p, pFix->timestamp_uS, 4, 8);
+    p = putField(p, " Gyro Integrated RV: r:", pFix->un.girv.real, pFix->q);
+    p = putField(p, " i:", pFix->un.girv.i, pFix->q);
+    p = putField(p, " j:", pFix->un.girv.j, pFix->q);
+    p = putField(p, " k:", pFix->un.girv.k, pFix->q);
+    p = putField(p, " x:", pFix->un.girv.angVelX, SENSORFIX_Q_ANGVEL);
+    p = putField(p, " y:", pFix->un.girv.angVelY, SENSORFIX_Q_ANGVEL);
+    return putField(p, " z:", pFix->un.girv.angVelZ, SENSORFIX_Q_ANGVEL);
+}
+#endif
+
+#if SENSOR_SET_GEOMAGNETIC_ROTATION_VECTOR
+static char *textGeoRv(char *p, const SensorFix_t *pFix)
+{
+    p = putField(p, "Rotation Vector: r:", pFix->un.quat.real, pFix->q);
+    p = putField(p, " i:", pFix->un.quat.i, pFix->q);
+    p = putField(p, " j:", pFix->un.quat.j, pFix->q);
+    p = putField(p, " k:", pFix->un.quat.k, pFix->q);
+    p = putField(p, " (acc: ", pFix->un.quat.accuracy, SENSORFIX_Q_ACCURACY);
+    return fixfmt_str(p, " deg)");
+}
+#endif
+
+#if SENSOR_SET_GYROSCOPE_CALIBRATED
+static char *textGyro(char *p, const SensorFix_t *pFix)
+{
+    p = putField(p, "Gyroscope: x:", pFix->un.vec3.x, pFix->q);
+    p = putField(p, " y:", pFix->un.vec3.y, pFix->q);
+    return putField(p, " z:", pFix->un.vec3.z, pFix->q);
+}
+#endif
+
+#if SENSOR_SET_LINEAR_ACCELERATION
+static char *textLinAccel(char *p, const SensorFix_t *pFix)
+{
+    p = putField(p, "Accelration: x:", pFix->un.vec3.x, pFix->q);
+    p = putField(p, " y:", pFix->un.vec3.y, pFix->q);
+    return putField(p, " z:", pFix->un.vec3.z, pFix->q);
+}
+#endif
+
+#if SENSOR_SET_GAME_ROTATION_VECTOR
+static char *textGameRv(char *p, const SensorFix_t *pFix)
+{
+    p = fixfmt_us(p, pFix->timestamp_uS, 4, 8);
+    p = putField(p, " Game Rotation Vector: r:", pFix->un.quat.real, pFix->q);
+    p = putField(p, " i:", pFix->un.quat.i, pFix->q);
+    p = putField(p, " j:", pFix->un.quat.j, pFix->q);
+    return putField(p, " k:", pFix->un.quat.k, pFix->q);
+}
+#endif
+
+// Where to build a frame: in place in the USB transmit ring when the
+// stream goes there (no copy on the way out), else in frame.  NULL if
+// USB has no room: the frame is dropped and counted as a USB drop.
+static uint8_t *frameBuffer(uint8_t *frame)
+{
+#if DATA_UART
+    if (dataUart_active()) {
+        return frame;
+    }
+#endif
+#if USB_CDC
+    if (!itm_routed(ITM_PORT_SENSOR) && usbCdc_active()) {
+        return usbCdc_reserve(BIN_FRAME_MAX);
+    }
+#endif
+    return frame;
+}
+
+// Send a frame built where frameBuffer() said; stack is the caller's buffer.
+static void writeFrame(const uint8_t *stack, const uint8_t *frame, unsigned len)
+{
+#if USB_CDC
+    if (frame != stack) {
+        usbCdc_commit(len);
+        return;
+    }
+#endif
+
+#if DATA_UART
+    if (dataUart_active()) {
+        dataUart_write(frame, len);
+        return;
+    }
+#endif
+    if (itm_routed(ITM_PORT_SENSOR)) {
+        itm_write(ITM_PORT_SENSOR, frame, len);
+    }
+    else {
+        console_writeRaw(frame, len);
+    }
+}
+
+// Where to format a text or DSF line: in place in the console's bulk tx
+// buffer when it goes to the UART (no copy on the way out), else in
+// line.  Room for TEXT_LINE_LEN and the CR of its LF.
+static char *lineBuffer(char *line)
+{
+    char *p = console_reserve(TEXT_LINE_LEN + 1);
+
+    return (p != 0) ? p : line;
+}
+
+// Send the line from start to end, formatted where lineBuffer() said;
+// line is the caller's buffer.
+static void writeLine(const char *line, const char *start, const char *end)
+{
+    if (start != line) {
+        console_commit(end - start);
+        return;
+    }
+    console_write(line, end - line);
+}
+
+// Frame CRC of len bytes at data, little endian at p.  Returns the end.
+static uint8_t *putCrc(uint8_t *p, const uint8_t *data, unsigned len)
+{
+#if BIN_CRC32
+    uint32_t crc = crc32(data, len);
+
+    *p++ = (uint8_t)crc;
+    *p++ = (uint8_t)(crc >> 8);
+    *p++ = (uint8_t)(crc >> 16);
+    *p++ = (uint8_t)(crc >> 24);
+#else
+    uint16_t crc = crc16(CRC16_INIT, data, len);
+
+    *p++ = (uint8_t)(crc & 0xFF);
+    *p++ = (uint8_t)(crc >> 8);
+#endif
+    return p;
+}
+
+#if BIN_DELTA
+// State of sensorId, a free slot for it, or NULL when all are taken
+static BinDeltaSensor_t *deltaSlot(BinDelta_t *pDelta, uint8_t sensorId)
+{
+    BinDeltaSensor_t *pFree = 0;
+
+    for (unsigned n = 0; n < BIN_DELTA_SENSORS; n++) {
+        if (pDelta->sensor[n].sensorId == sensorId) {
+            return &pDelta->sensor[n];
+        }
+        if ((pDelta->sensor[n].sensorId == 0) && (pFree == 0)) {
+            pFree = &pDelta->sensor[n];
+        }
+    }
+    return pFree;
+}
+
+static uint8_t *putVarint(uint8_t *p, uint64_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+// Small magnitudes of either sign to small unsigned values: 0, -1, 1, -2 ...
+static uint64_t zigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+#endif
+
+#if SENSOR_CAMSYNC
+// Camera trigger poses have no fixed-point decode (sensor_camsync.h)
+static int16_t reportField(const sh2_SensorEvent_t *event, unsigned offset)
+{
+    return (int16_t)(event->report[offset] | (event->report[offset+1] << 8));
+}
+
+static void dsfCamsync(const sh2_SensorEvent_t *event)
+{
+    char line[TEXT_LINE_LEN];
+    uint8_t deltaSeq = event->report[1] - (camsyncSequence & 0xFF);
+    char *p;
+
+    if (!camsyncHeaderSent) {
+        camsyncHeaderSent = true;
+        printDsfHeader(CAMSYNC_REPORT_ID,
+                       "TIME[x]{s}, SAMPLE_ID[x]{samples}, CAMERA_POSE[rijk]{quaternion}, STATUS[x]{enum}");
+    }
+
+    camsyncSequence += deltaSeq;
+    char *start = lineBuffer(line);
+    p = putDsfStart(start, CAMSYNC_REPORT_ID, event->timestamp_uS);
+    p = putDsfField(p, camsyncSequence, 0, 0);
+    p = putDsfField(p, reportField(event, 10), SENSORFIX_Q_QUAT, 3);
+    p = putDsfField(p, reportField(event, 4), SENSORFIX_Q_QUAT, 3);
+    p = putDsfField(p, reportField(event, 6), SENSORFIX_Q_QUAT, 3);
+    p = putDsfField(p, reportField(event, 8), SENSORFIX_Q_QUAT, 3);
+    p = putDsfField(p, event->report[2], 0, 0);
+    *p++ = '\n';
+    writeLine(line, start, p);
+}
+
+static void textCamsync(const sh2_SensorEvent_t *event)
+{
+    char line[TEXT_LINE_LEN];
+    char *start = lineBuffer(line);
+    char *p;
+
+    p = fixfmt_us(start, event->timestamp_uS, 4, 8);
+    p = putField(p, " Camera sync: r:", reportField(event, 10), SENSORFIX_Q_QUAT);
+    p = putField(p, " i:", reportField(event, 4), SENSORFIX_Q_QUAT);
+    p = putField(p, " j:", reportField(event, 6), SENSORFIX_Q_QUAT);
+    p = putField(p, " k:", reportField(event, 8), SENSORFIX_Q_QUAT);
+    if (event->report[2] & CAMSYNC_STALE) {
+        p = fixfmt_str(p, " (stale)");
+    }
+    *p++ = '\n';
+    writeLine(line, start, p);
+}
+#endif
@@ -0,0 +1,222 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Sensor report output on the console: text, DSF or binary frames.
+ *
+ * The output stage subscribes to every sensor through sensor_dispatch.
+ * It only depends on the console through console_write(),
+ * console_writeRaw() and dlog_printf(), so it builds on the host too
+ * (see tools/hostsim).
+ *
+ * With OUTPUT_DEADBAND, a report is only output when a field moved by
+ * more than the deadband since the last one output for that sensor, its
+ * status changed, or the keep-alive interval passed.  The deadband is in
+ * LSBs of the report's own fields (e.g. 1/16384 for quaternions), and
+ * "out deadband" sets it at run time.  0 outputs everything.
+ */
+
+#ifndef SENSOR_OUTPUT_H
+#define SENSOR_OUTPUT_H
+
+#include "sh2.h"
+#include "sensor_fix.h"
+
+// Binary output framing:
+//   sync (0xA5 0x5A), sensor id, frame seq, payload len,
+//   timestamp (uS, 64-bit LE), raw report payload, CRC-16 (LE).
+// CRC-16/CCITT (poly 0x1021, init 0xFFFF) covers sensor id through payload.
+// With BIN_CRC32 the first sync byte is 0xA6 and the CRC is a CRC-32
+// (LE) over the same bytes, from the CRC unit (crc32.h).
+#ifndef BIN_CRC32
+#define BIN_CRC32 (1)
+#endif
+#if BIN_CRC32
+#define BIN_SYNC0 (0xA6)
+#define BIN_CRC_LEN (4)
+#else
+#define BIN_SYNC0 (0xA5)
+#define BIN_CRC_LEN (2)
+#endif
+#define BIN_SYNC1 (0x5A)
+#define BIN_HDR_LEN (13)
+
+// Delta-coded binary output ("out delta"), same sync and CRC:
+//   sync (BIN_SYNC0 0x5B), sensor id (| BIN_DELTA_KEY on keyframes),
+//   per-sensor frame seq, body len, body, CRC (LE) over id to body.
+// Keyframe body: report len, timestamp (uS, varint), report header raw
+//   (seq, status, delay: none on GIRV), 16-bit fields as zig-zag varints.
+// Delta body: second difference of the timestamp (zig-zag varint), report
+//   header raw, then each 16-bit field's difference from the previous
+//   report of that sensor (zig-zag varint, decoded modulo 2^16).
+// The report id byte is not sent, and an odd trailing byte is sent raw.
+// Varints are 7 bits per byte, least significant first, top bit set on
+// all but the last.  A decoder that sees a gap in a sensor's frame seq
+// drops its deltas until the next keyframe of that sensor.
+#define BIN_DELTA_SYNC1 (0x5B)
+#define BIN_DELTA_KEY (0x80)
+
+// Build in the delta-coded output (RAM for BIN_DELTA_SENSORS reports)
+#ifndef BIN_DELTA
+#define BIN_DELTA (1)
+#endif
+
+// Sensors that can be delta coded at once; others only send keyframes
+#ifndef BIN_DELTA_SENSORS
+#define BIN_DELTA_SENSORS (8)
+#endif
+
+// Frames of each sensor between keyframes, bounding the loss after
+// a dropped frame
+#ifndef BIN_KEYFRAME_INTERVAL
+#define BIN_KEYFRAME_INTERVAL (64)
+#endif
+
+// Pose-packed binary output ("out pose [bits]"): rotation vectors and
+// GIRV with their quaternion packed smallest-three (quat_pack.h), every
+// other sensor as a plain frame, in one stream with one frame seq:
+//   sync (BIN_SYNC0 0x5C), sensor id, frame seq, body len,
+//   timestamp (uS, low 32 bits LE), report seq, info, packed quaternion,
+//   the rest of the report raw (accuracy, or GIRV angular velocity), CRC.
+// info is the precision in bits 7..2 and the report's status accuracy in
+// bits 1..0.  Decoders extend the timestamp from the frame before; there
+// must be one at least every 71 minutes.  At 10 bits a rotation vector
+// frame is 21 bytes against 31 plain.
+#define BIN_POSE_SYNC1 (0x5C)
+#define BIN_POSE_HDR_LEN (11)
+
+// Telemetry frames (telemetry.h), between the others, same sync and CRC:
+//   sync (BIN_SYNC0 0x5F), kind, frame seq of their own, body len, body,
+//   CRC (LE) over kind to body.
+// Values body (kind 0): timestamp (uS, varint), then a key and a value,
+//   both varints, per metric.
+// Names body (kind 1): per key, the key (varint), name len and name.
+#define BIN_METRICS_SYNC1 (0x5F)
+
+// Build in the pose-packed output
+#ifndef BIN_POSE
+#define BIN_POSE (1)
+#endif
+
+// Bits per packed component at startup
+#ifndef BIN_POSE_BITS
+#define BIN_POSE_BITS (10)
+#endif
+
+// Build in deadband suppression (RAM for one report per sensor id)
+#ifndef OUTPUT_DEADBAND
+#define OUTPUT_DEADBAND (1)
+#endif
+
+// Deadband at startup [LSB], 0 for none
+#ifndef OUTPUT_DEADBAND_LSB
+#define OUTPUT_DEADBAND_LSB (0)
+#endif
+
+// Longest gap between outputs of a sensor while suppressing [ms]
+#ifndef OUTPUT_KEEPALIVE_MS
+#define OUTPUT_KEEPALIVE_MS (1000)
+#endif
+
+// Longest report carried in a frame
+#define BIN_REPORT_MAX (sizeof(((sh2_SensorEvent_t *)0)->report))
+
+// Longest frame of either format: a delta body has at most the len byte,
+// a 10-byte timestamp varint and 3 bytes for each 16-bit field
+#define BIN_FRAME_MAX (5 + 11 + 2*BIN_REPORT_MAX + BIN_CRC_LEN)
+
+#if BIN_DELTA
+// Last report framed of a delta-coded sensor
+typedef struct {
+    uint8_t sensorId;           // 0: free
+    uint8_t len;
+    uint8_t toKey;              // frames until the next keyframe
+    uint64_t t_uS;
+    int64_t dt_uS;              // 0 after a keyframe
+    uint8_t report[BIN_REPORT_MAX];
+} BinDeltaSensor_t;
+
+// Encoder state of one delta-coded stream
+typedef struct {
+    BinDeltaSensor_t sensor[BIN_DELTA_SENSORS];
+    uint8_t seq[SH2_MAX_SENSOR_ID+1];   // frame seq of each sensor
+    uint32_t rawBytes;                  // the frames' size as plain binary
+    uint32_t bytes;                     // and as delta frames
+} BinDelta_t;
+#endif
+
+// Report interval of the raw and calibrated sensors a DSF capture ("sub
+// dsf") logs
+#ifndef DSF_LOG_INTERVAL_US
+#define DSF_LOG_INTERVAL_US (10000)
+#endif
+
+// Format of sensor reports on the console
+typedef enum {
+    OUTPUT_TEXT,
+    OUTPUT_DSF,
+    OUTPUT_BIN,
+    OUTPUT_DELTA,
+    OUTPUT_NONE,        // reports are still dispatched, just not printed
+    OUTPUT_POSE,
+} OutputMode_t;
+
+// Register the "out" command and subscribe to every sensor.
+void sensorOutput_init(void);
+
+OutputMode_t sensorOutput_getMode(void);
+void sensorOutput_setMode(OutputMode_t mode);
+
+// Report interval [us] "sub dsf" subscribes sensorId at for a DSF
+// capture, 0 if the capture leaves it out.
+uint32_t sensorOutput_dsfInterval(uint8_t sensorId);
+
+// Set the deadband [LSB] (0: none) and keep-alive interval [ms].
+void sensorOutput_setDeadband(unsigned lsb, unsigned keepAlive_ms);
+
+// Build the binary frame of pEvent in frame (BIN_FRAME_MAX bytes), and
+// return its length.  *pSeq is the stream's frame seq, advanced by one.
+unsigned sensorOutput_binFrame(uint8_t *frame, uint8_t *pSeq, const sh2_SensorEvent_t *pEvent);
+
+#if BIN_DELTA
+// Start a delta-coded stream over: each sensor's next frame is a keyframe.
+void sensorOutput_deltaReset(BinDelta_t *pDelta);
+
+// Build the delta-coded frame of pEvent in the stream pDelta, which must
+// carry every frame built, and return its length.
+unsigned sensorOutput_deltaFrame(BinDelta_t *pDelta, uint8_t *frame, const sh2_SensorEvent_t *pEvent);
+#endif
+
+#if BIN_POSE
+// Build the pose-packed frame of pEvent, with its quaternion at bits per
+// component, in frame (BIN_FRAME_MAX bytes) and return its length.  A
+// plain frame if pFix is not a rotation vector or GIRV.  *pSeq as for
+// sensorOutput_binFrame().
+unsigned sensorOutput_poseFrame(uint8_t *frame, uint8_t *pSeq, const sh2_SensorEvent_t *pEvent,
+                                const SensorFix_t *pFix, unsigned bits);
+#endif
+
+// Send a whole frame built elsewhere (telemetry) wherever the binary
+// sensor frames go.  Any task.
+void sensorOutput_writeFrame(const uint8_t *frame, unsigned len);
+
+// Print one event in the current format, unless the deadband holds it
+// back.  pFix is its fixed-point decode, or NULL if it has none (those
+// are always output).  Called by the sensor task.
+void sensorOutput_event(const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix);
+
+#endif
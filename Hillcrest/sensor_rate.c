@@ -0,0 +1,271 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Motion-adaptive report rate.
+ */
+
+#include "sensor_rate.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "sh2.h"
+#include "shell.h"
+#include "timebase.h"
+#include "sensor_dispatch.h"
+#include "priorities.h"
+
+// Stability classifier report: classification byte after the header
+#define STABILITY_CLASS_OFFSET (4)
+#define STABILITY_ON_TABLE   (1)
+#define STABILITY_STATIONARY (2)
+#define STABILITY_STABLE     (3)
+#define STABILITY_MOTION     (4)
+
+// Calibrated gyroscope fields are Q9 rad/s
+#define GYRO_Q (9)
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void gyroEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix);
+static void stabilityEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix);
+static void observe(bool quiet, bool moving, uint64_t t_uS);
+static void setStill(bool still, uint64_t t_uS);
+static uint32_t squaredThreshold(float dps);
+static uint8_t sourceSensor(SensorRateSource_t s);
+static void rateCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static SensorRateChangedFn_t *changedFn;
+static volatile SensorRateSource_t source = SENSOR_RATE_DEFAULT;
+static volatile unsigned factor = SENSOR_RATE_STILL_FACTOR;
+static float stillDps = SENSOR_RATE_STILL_DPS;
+static float movingDps = SENSOR_RATE_MOVING_DPS;
+
+// Squared angular velocity thresholds, in Q9 rad/s squared
+static volatile uint32_t stillThreshold;
+static volatile uint32_t movingThreshold;
+
+// Written by the sensor task, and by the shell task changing source
+static volatile bool still;
+static uint64_t quietSince_uS;      // 0: the source isn't quiet
+static uint64_t stillSince_uS;
+static uint64_t stillTotal_us;
+static uint32_t changes;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void sensorRate_init(SensorRateChangedFn_t *changed)
+{
+    changedFn = changed;
+    stillThreshold = squaredThreshold(stillDps);
+    movingThreshold = squaredThreshold(movingDps);
+
+    shell_addCommand("rate", "[off | gyro [still dps] [moving dps] | stability | factor <n>] motion-adaptive rates",
+                     rateCmd);
+    sensorDispatch_subscribe(SH2_GYROSCOPE_CALIBRATED, PRIO_SUB_RATE, gyroEvent, 0);
+    sensorDispatch_subscribe(SH2_STABILITY_CLASSIFIER, PRIO_SUB_RATE, stabilityEvent, 0);
+}
+
+void sensorRate_setSource(SensorRateSource_t s)
+{
+    taskENTER_CRITICAL();
+    source = s;
+    quietSince_uS = 0;
+    taskEXIT_CRITICAL();
+
+    // Start from full rate: the new source has to find stillness itself
+    setStill(false, timebase_getUs());
+}
+
+bool sensorRate_still(void)
+{
+    return still;
+}
+
+uint32_t sensorRate_interval(uint8_t sensorId, uint32_t interval_us)
+{
+    if (!still || (interval_us == 0) || (sensorId == sourceSensor(source))) {
+        return interval_us;
+    }
+
+    uint64_t slow_us = (uint64_t)interval_us * factor;
+    if (slow_us > SENSOR_RATE_MAX_INTERVAL_US) {
+        // Never speed a subscription up that was slower already
+        slow_us = (interval_us > SENSOR_RATE_MAX_INTERVAL_US) ? interval_us : SENSOR_RATE_MAX_INTERVAL_US;
+    }
+    return (uint32_t)slow_us;
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+// Dispatch callback, in the sensor task
+static void gyroEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix)
+{
+    if ((source != SENSOR_RATE_GYRO) || (pFix == 0)) {
+        return;
+    }
+
+    // Each square is at most 2^30, so the sum fits
+    int32_t x = pFix->un.vec3.x, y = pFix->un.vec3.y, z = pFix->un.vec3.z;
+    uint32_t mag2 = (uint32_t)(x*x) + (uint32_t)(y*y) + (uint32_t)(z*z);
+
+    observe(mag2 < stillThreshold, mag2 > movingThreshold, pFix->timestamp_uS);
+}
+
+// Dispatch callback, in the sensor task
+static void stabilityEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix)
+{
+    if ((source != SENSOR_RATE_STABILITY) || (pEvent->len <= STABILITY_CLASS_OFFSET)) {
+        return;
+    }
+
+    uint8_t c = pEvent->report[STABILITY_CLASS_OFFSET];
+    observe((c == STABILITY_ON_TABLE) || (c == STABILITY_STATIONARY) || (c == STABILITY_STABLE),
+            c == STABILITY_MOTION, pEvent->timestamp_uS);
+}
+
+// One sample of the source: quiet (below the still threshold) or moving
+// (above the moving one), or in the band between, which changes nothing.
+static void observe(bool quiet, bool moving, uint64_t t_uS)
+{
+    if (moving) {
+        quietSince_uS = 0;
+        if (still) {
+            setStill(false, t_uS);
+        }
+        return;
+    }
+    if (!quiet) {
+        // Not still, but not enough movement to speed up again
+        quietSince_uS = 0;
+        return;
+    }
+
+    if (quietSince_uS == 0) {
+        quietSince_uS = t_uS;
+    }
+    if (!still && (t_uS - quietSince_uS >= (uint64_t)SENSOR_RATE_STILL_MS * 1000)) {
+        setStill(true, t_uS);
+    }
+}
+
+static void setStill(bool s, uint64_t t_uS)
+{
+    bool changed = false;
+
+    taskENTER_CRITICAL();
+    if (s != still) {
+        if (still) {
+            stillTotal_us += t_uS - stillSince_uS;
+        }
+        else {
+            stillSince_uS = t_uS;
+        }
+        still = s;
+        changes++;
+        changed = true;
+    }
+    taskEXIT_CRITICAL();
+
+    if (changed && (changedFn != 0)) {
+        changedFn();
+    }
+}
+
+static uint32_t squaredThreshold(float dps)
+{
+    float q = dps * (3.14159265f / 180.0f) * (float)(1 << GYRO_Q);
+    return (uint32_t)(q * q);
+}
+
+// Sensor the governor watches, which keeps its own rate
+static uint8_t sourceSensor(SensorRateSource_t s)
+{
+    switch (s) {
+        case SENSOR_RATE_GYRO:
+            return SH2_GYROSCOPE_CALIBRATED;
+        case SENSOR_RATE_STABILITY:
+            return SH2_STABILITY_CLASSIFIER;
+        default:
+            return 0;
+    }
+}
+
+// Shell command: set the source, thresholds or factor, or show the state.
+static void rateCmd(int argc, char *argv[])
+{
+    static const char * const sourceName[] = {
+        [SENSOR_RATE_OFF] = "off",
+        [SENSOR_RATE_GYRO] = "gyro",
+        [SENSOR_RATE_STABILITY] = "stability",
+    };
+
+    if (argc > 1) {
+        if (strcmp(argv[1], "off") == 0) {
+            sensorRate_setSource(SENSOR_RATE_OFF);
+        }
+        else if (strcmp(argv[1], "gyro") == 0) {
+            float s = (argc > 2) ? strtof(argv[2], 0) : stillDps;
+            float m = (argc > 3) ? strtof(argv[3], 0) : movingDps;
+            if ((s <= 0.0f) || (m < s)) {
+                printf("Need 0 < still dps <= moving dps\n");
+                return;
+            }
+            stillDps = s;
+            movingDps = m;
+            stillThreshold = squaredThreshold(s);
+            movingThreshold = squaredThreshold(m);
+            sensorRate_setSource(SENSOR_RATE_GYRO);
+        }
+        else if (strcmp(argv[1], "stability") == 0) {
+            sensorRate_setSource(SENSOR_RATE_STABILITY);
+        }
+        else if ((strcmp(argv[1], "factor") == 0) && (argc > 2) && (atoi(argv[2]) >= 1)) {
+            factor = atoi(argv[2]);
+            if (still && (changedFn != 0)) {
+                changedFn();
+            }
+        }
+        else {
+            printf("usage: %s [off | gyro [still dps] [moving dps] | stability | factor <n>]\n", argv[0]);
+            return;
+        }
+    }
+
+    uint64_t now_uS = timebase_getUs();
+    taskENTER_CRITICAL();
+    uint64_t still_us = stillTotal_us + (still ? now_uS - stillSince_uS : 0);
+    bool s = still;
+    uint32_t n = changes;
+    taskEXIT_CRITICAL();
+
+    printf("Rate governor %s", sourceName[source]);
+    if (source == SENSOR_RATE_GYRO) {
+        printf(" (still below %.1f, moving above %.1f deg/s)", stillDps, movingDps);
+    }
+    printf(": %s, %ux slower when still\n", s ? "still" : "moving", factor);
+    printf("  %u changes, %u s still\n", (unsigned)n, (unsigned)(still_us / 1000000));
+}
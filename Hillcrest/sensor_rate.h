@@ -0,0 +1,95 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Motion-adaptive report rate.
+ *
+ * The governor watches one motion source and decides whether the
+ * device is still or moving:
+ *   - SENSOR_RATE_GYRO: the calibrated gyroscope's angular velocity.
+ *     Still once it has stayed below SENSOR_RATE_STILL_DPS for
+ *     SENSOR_RATE_STILL_MS, moving again as soon as a sample exceeds
+ *     SENSOR_RATE_MOVING_DPS.
+ *   - SENSOR_RATE_STABILITY: the hub's stability classifier.  Still once
+ *     it has reported on table, stationary or stable for
+ *     SENSOR_RATE_STILL_MS, moving on its first motion report.
+ * The source itself must be subscribed (sub 2 ... or sub 19 ...).
+ *
+ * While still, every other subscription runs SENSOR_RATE_STILL_FACTOR
+ * times slower (at most SENSOR_RATE_MAX_INTERVAL_US apart), so
+ * bandwidth, CPU and power follow the motion.  The source keeps its
+ * rate, so motion is noticed as fast as before.  The sensor app
+ * resends the subscriptions on each change (sensorRate_interval()).
+ */
+
+#ifndef SENSOR_RATE_H
+#define SENSOR_RATE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Source at startup (SensorRateSource_t)
+#ifndef SENSOR_RATE_DEFAULT
+#define SENSOR_RATE_DEFAULT (SENSOR_RATE_OFF)
+#endif
+
+// Still below this angular velocity, moving above the next [deg/s]
+#ifndef SENSOR_RATE_STILL_DPS
+#define SENSOR_RATE_STILL_DPS (1.5f)
+#endif
+#ifndef SENSOR_RATE_MOVING_DPS
+#define SENSOR_RATE_MOVING_DPS (4.0f)
+#endif
+
+// How long the source must look still before the rates drop [ms]
+#ifndef SENSOR_RATE_STILL_MS
+#define SENSOR_RATE_STILL_MS (2000)
+#endif
+
+// Subscriptions slow down by this factor while still
+#ifndef SENSOR_RATE_STILL_FACTOR
+#define SENSOR_RATE_STILL_FACTOR (10)
+#endif
+
+// ... but no further than this [us]
+#ifndef SENSOR_RATE_MAX_INTERVAL_US
+#define SENSOR_RATE_MAX_INTERVAL_US (1000000)
+#endif
+
+typedef enum {
+    SENSOR_RATE_OFF,          // fixed rates
+    SENSOR_RATE_GYRO,         // angular velocity magnitude
+    SENSOR_RATE_STABILITY,    // stability classifier
+} SensorRateSource_t;
+
+// Called when the intervals sensorRate_interval() returns change, from
+// the sensor task (motion) or the shell task (rate command).
+typedef void (SensorRateChangedFn_t)(void);
+
+// Register the "rate" command and subscribe to the motion sources.
+void sensorRate_init(SensorRateChangedFn_t *changed);
+
+void sensorRate_setSource(SensorRateSource_t source);
+
+// True while the governor has the rates lowered
+bool sensorRate_still(void);
+
+// Interval to run sensorId at for a subscription of interval_us
+// (0, disabled, stays 0).
+uint32_t sensorRate_interval(uint8_t sensorId, uint32_t interval_us);
+
+#endif
@@ -0,0 +1,490 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Fixed-rate resampling of sensor reports.  See sensor_resample.h.
+ */
+
+#include "sensor_resample.h"
+
+#if SENSOR_RESAMPLE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stm32f4xx_hal.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "sh2_err.h"
+#include "quat.h"
+#include "spsc.h"
+#include "shell.h"
+#include "sysstats.h"
+#include "timebase.h"
+#include "sensor_dispatch.h"
+#include "priorities.h"
+
+// Reports kept per sensor: enough to span SENSOR_RESAMPLE_DELAY_US at
+// the fastest report rates
+#define HIST (8)
+
+// Grid instants caught up on in one interrupt; further behind (after
+// STOP, or a long critical section) the rest are skipped
+#define MAX_CATCHUP (4)
+
+// Copies a reader attempts before reporting the output busy
+#define READ_TRIES (4)
+
+// ------------------------------------------------------------------------
+// Private types
+
+// One report in float: the orientation of quaternion kinds, and up to
+// three other channels (vec3, RV accuracy or GIRV angular velocity).
+typedef struct {
+    Quat_t q;
+    float v[3];
+} Sample_t;
+
+typedef struct {
+    uint8_t sensorId;              // 0: channel unused
+
+    // Written by the sensor task with TIM5 masked, read by the ISR
+    SensorFix_t hist[HIST];
+    unsigned head;                 // where the next report goes
+    unsigned count;
+
+    // Written by the ISR, read by any task
+    volatile uint32_t seq;         // odd while the ISR writes
+    SensorFix_t out;
+    uint32_t outputs;
+    uint32_t held;                 // instants without a report after them
+    uint32_t stale;                // instants with no recent report
+} Channel_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void resampleEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix);
+static void timerStart(uint32_t period_us);
+static void timerStop(void);
+static void produce(Channel_t *c, uint64_t t_uS);
+static void interpolate(SensorFix_t *out, const SensorFix_t *a, const SensorFix_t *b,
+                        uint64_t t_uS);
+static bool isQuatKind(const SensorFix_t *fix);
+static void toSample(Sample_t *s, const SensorFix_t *fix);
+static void fromSample(SensorFix_t *fix, const Sample_t *s);
+static int16_t toFix(float v, unsigned q);
+static void resampleCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static Channel_t channels[SENSOR_RESAMPLE_SENSORS];
+
+// Grid, set by the shell with TIM5 stopped
+static volatile uint32_t period_us;     // 0: off
+static uint64_t nextGrid_uS;            // next instant to interpolate, ISR only
+
+static SPSC_RING(SensorFix_t, SENSOR_RESAMPLE_RING_LEN) ring;
+
+static uint32_t overflows;              // outputs dropped, ring full
+static uint32_t skipped;                // grid instants not caught up on
+static volatile uint32_t retries;
+static volatile uint32_t busy;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void sensorResample_init(void)
+{
+    __TIM5_CLK_ENABLE();
+    HAL_NVIC_SetPriority(TIM5_IRQn, PRIO_IRQ_RESAMPLE, 0);
+    HAL_NVIC_EnableIRQ(TIM5_IRQn);
+
+    sysstats_addMemory("resampler", sizeof(channels) + sizeof(ring));
+    sysstats_addCounter("resample overflows", &overflows);
+    sysstats_addCounter("resample skipped", &skipped);
+    shell_addCommand("resample", "[<hz> <sensor>... | off] sensors on an exact output grid",
+                     resampleCmd);
+    sensorDispatch_subscribe(SENSOR_DISPATCH_ALL, PRIO_SUB_RESAMPLE, resampleEvent, 0);
+}
+
+int sensorResample_set(uint32_t hz, const uint8_t *ids, unsigned n)
+{
+    if ((hz > 1000000) || ((hz != 0) && ((1000000 % hz) != 0)) ||
+        (n > SENSOR_RESAMPLE_SENSORS)) {
+        return SH2_ERR_BAD_PARAM;
+    }
+    for (unsigned i = 0; i < n; i++) {
+        if ((ids[i] == 0) || (ids[i] > SH2_MAX_SENSOR_ID)) {
+            return SH2_ERR_BAD_PARAM;
+        }
+    }
+
+    timerStop();
+
+    // Nothing of the old grid is left to read, nor half written
+    taskENTER_CRITICAL();
+    period_us = 0;
+    memset(channels, 0, sizeof(channels));
+    for (unsigned i = 0; i < n; i++) {
+        channels[i].sensorId = ids[i];
+    }
+    spsc_flush(&ring);
+    taskEXIT_CRITICAL();
+
+    if (hz != 0) {
+        uint32_t period = 1000000 / hz;
+
+        // The first whole instant from now
+        nextGrid_uS = (timebase_getUs() / period + 1) * period;
+        period_us = period;
+        timerStart(period);
+    }
+
+    return SH2_OK;
+}
+
+int sensorResample_get(uint8_t sensorId, SensorFix_t *pFix)
+{
+    const Channel_t *c = 0;
+
+    for (unsigned n = 0; n < SENSOR_RESAMPLE_SENSORS; n++) {
+        if ((sensorId != 0) && (channels[n].sensorId == sensorId)) {
+            c = &channels[n];
+        }
+    }
+    if (c == 0) {
+        return SH2_ERR_BAD_PARAM;
+    }
+
+    for (unsigned n = 0; n < READ_TRIES; n++) {
+        uint32_t seq = c->seq;
+        uint32_t outputs;
+
+        // Read of seq must complete before the output is read, and the
+        // output before seq is read again
+        __DMB();
+        *pFix = c->out;
+        outputs = c->outputs;
+        __DMB();
+
+        if (((seq & 1) == 0) && (seq == c->seq)) {
+            return (outputs != 0) ? SH2_OK : SH2_ERR;
+        }
+        retries++;
+    }
+
+    busy++;
+    return SH2_ERR_OP_IN_PROGRESS;
+}
+
+bool sensorResample_read(SensorFix_t *pFix)
+{
+    SensorFix_t *p = spsc_readSlot(&ring);
+
+    if (p == 0) {
+        return false;
+    }
+    *pFix = *p;
+    spsc_pop(&ring);
+    return true;
+}
+
+void sensorResample_irq(void)
+{
+    TIM5->SR = ~TIM_SR_UIF;
+
+    uint32_t period = period_us;
+    uint64_t now_uS = timebase_getUs();
+    if ((period == 0) || (now_uS < SENSOR_RESAMPLE_DELAY_US)) {
+        return;
+    }
+
+    // The instants due: up to the one SENSOR_RESAMPLE_DELAY_US ago
+    uint64_t last_uS = now_uS - SENSOR_RESAMPLE_DELAY_US;
+    if (last_uS < nextGrid_uS) {
+        return;
+    }
+    uint32_t behind = (uint32_t)((last_uS - nextGrid_uS) / period) + 1;
+    if (behind > MAX_CATCHUP) {
+        skipped += behind - MAX_CATCHUP;
+        nextGrid_uS += (uint64_t)(behind - MAX_CATCHUP) * period;
+    }
+
+    while (nextGrid_uS <= last_uS) {
+        for (unsigned n = 0; n < SENSOR_RESAMPLE_SENSORS; n++) {
+            if (channels[n].sensorId != 0) {
+                produce(&channels[n], nextGrid_uS);
+            }
+        }
+        nextGrid_uS += period;
+    }
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+// Dispatch callback, in the sensor task
+static void resampleEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix)
+{
+    if ((pFix == 0) || (period_us == 0)) {
+        return;
+    }
+
+    for (unsigned n = 0; n < SENSOR_RESAMPLE_SENSORS; n++) {
+        Channel_t *c = &channels[n];
+
+        if (c->sensorId != pEvent->reportId) {
+            continue;
+        }
+        if ((c->count != 0) &&
+            (pFix->timestamp_uS <= c->hist[(c->head + HIST - 1) % HIST].timestamp_uS)) {
+            // Interpolation needs time to move on
+            return;
+        }
+        taskENTER_CRITICAL();
+        c->hist[c->head] = *pFix;
+        c->head = (c->head + 1) % HIST;
+        if (c->count < HIST) {
+            c->count++;
+        }
+        taskEXIT_CRITICAL();
+        return;
+    }
+}
+
+// TIM5 counts microseconds and updates every period_us.  TIM5 is on
+// APB1, its clock is doubled when APB1 is divided.
+static void timerStart(uint32_t period)
+{
+    uint32_t timClk = HAL_RCC_GetPCLK1Freq();
+
+    if ((RCC->CFGR & RCC_CFGR_PPRE1) != RCC_CFGR_PPRE1_DIV1) {
+        timClk *= 2;
+    }
+
+    TIM5->CR1 = 0;
+    TIM5->PSC = timClk / 1000000 - 1;
+    TIM5->ARR = period - 1;
+    TIM5->CNT = 0;
+    TIM5->EGR = TIM_EGR_UG;
+    TIM5->SR = 0;
+    TIM5->DIER = TIM_DIER_UIE;
+    TIM5->CR1 = TIM_CR1_CEN;
+}
+
+static void timerStop(void)
+{
+    TIM5->CR1 = 0;
+    TIM5->DIER = 0;
+    TIM5->SR = 0;
+    NVIC_ClearPendingIRQ(TIM5_IRQn);
+}
+
+// Output channel c at grid instant t_uS, in the ISR
+static void produce(Channel_t *c, uint64_t t_uS)
+{
+    SensorFix_t fix;
+    unsigned newest = (c->head + HIST - 1) % HIST;
+
+    if (c->count == 0) {
+        return;
+    }
+
+    if (t_uS >= c->hist[newest].timestamp_uS) {
+        // Nothing after the instant yet: hold the newest, if recent
+        if (t_uS - c->hist[newest].timestamp_uS > SENSOR_RESAMPLE_STALE_US) {
+            c->stale++;
+            return;
+        }
+        if (t_uS != c->hist[newest].timestamp_uS) {
+            c->held++;
+        }
+        fix = c->hist[newest];
+    }
+    else {
+        // The two reports either side of the instant, newest first
+        unsigned b = newest;
+        unsigned k;
+        for (k = 1; k < c->count; k++) {
+            unsigned a = (b + HIST - 1) % HIST;
+            if (c->hist[a].timestamp_uS <= t_uS) {
+                interpolate(&fix, &c->hist[a], &c->hist[b], t_uS);
+                break;
+            }
+            b = a;
+        }
+        if (k == c->count) {
+            // Before the reports kept: just started
+            return;
+        }
+    }
+    fix.timestamp_uS = t_uS;
+
+    c->seq = c->seq + 1;
+    // The odd count must be visible before any of the output changes
+    __DMB();
+    c->out = fix;
+    c->outputs++;
+    __DMB();
+    c->seq = c->seq + 1;
+
+    SensorFix_t *p = spsc_writeSlot(&ring);
+    if (p == 0) {
+        overflows++;
+        return;
+    }
+    *p = fix;
+    spsc_push(&ring);
+}
+
+// out at t_uS, between reports a and b: slerp for the orientation,
+// linear for the rest.  Sequence and status are the nearer report's.
+static void interpolate(SensorFix_t *out, const SensorFix_t *a, const SensorFix_t *b,
+                        uint64_t t_uS)
+{
+    float f = (float)(t_uS - a->timestamp_uS) / (float)(b->timestamp_uS - a->timestamp_uS);
+    Sample_t sa, sb, s;
+
+    toSample(&sa, a);
+    toSample(&sb, b);
+    s = sa;
+    if (isQuatKind(a)) {
+        s.q = quat_slerp(sa.q, sb.q, f);
+    }
+    for (unsigned n = 0; n < 3; n++) {
+        s.v[n] = sa.v[n] + f * (sb.v[n] - sa.v[n]);
+    }
+
+    *out = (f < 0.5f) ? *a : *b;
+    fromSample(out, &s);
+}
+
+static bool isQuatKind(const SensorFix_t *fix)
+{
+    return (fix->kind == SENSORFIX_QUAT) || (fix->kind == SENSORFIX_GIRV);
+}
+
+static void toSample(Sample_t *s, const SensorFix_t *fix)
+{
+    memset(s, 0, sizeof(*s));
+
+    switch (fix->kind) {
+        case SENSORFIX_QUAT:
+            s->q = quat_fromFix(fix);
+            if (fix->un.quat.hasAccuracy) {
+                s->v[0] = FIX_TO_FLOAT(SENSORFIX_Q_ACCURACY, fix->un.quat.accuracy);
+            }
+            break;
+        case SENSORFIX_GIRV:
+            s->q = quat_fromFix(fix);
+            s->v[0] = FIX_TO_FLOAT(SENSORFIX_Q_ANGVEL, fix->un.girv.angVelX);
+            s->v[1] = FIX_TO_FLOAT(SENSORFIX_Q_ANGVEL, fix->un.girv.angVelY);
+            s->v[2] = FIX_TO_FLOAT(SENSORFIX_Q_ANGVEL, fix->un.girv.angVelZ);
+            break;
+        default:
+            s->v[0] = FIX_TO_FLOAT(fix->q, fix->un.vec3.x);
+            s->v[1] = FIX_TO_FLOAT(fix->q, fix->un.vec3.y);
+            s->v[2] = FIX_TO_FLOAT(fix->q, fix->un.vec3.z);
+            break;
+    }
+}
+
+// Store s into fix, whose kind and Q point say where
+static void fromSample(SensorFix_t *fix, const Sample_t *s)
+{
+    Quat_t q = s->q;
+
+    switch (fix->kind) {
+        case SENSORFIX_QUAT:
+            fix->un.quat.real = toFix(q.w, SENSORFIX_Q_QUAT);
+            fix->un.quat.i = toFix(q.x, SENSORFIX_Q_QUAT);
+            fix->un.quat.j = toFix(q.y, SENSORFIX_Q_QUAT);
+            fix->un.quat.k = toFix(q.z, SENSORFIX_Q_QUAT);
+            if (fix->un.quat.hasAccuracy) {
+                fix->un.quat.accuracy = toFix(s->v[0], SENSORFIX_Q_ACCURACY);
+            }
+            break;
+        case SENSORFIX_GIRV:
+            fix->un.girv.real = toFix(q.w, SENSORFIX_Q_QUAT);
+            fix->un.girv.i = toFix(q.x, SENSORFIX_Q_QUAT);
+            fix->un.girv.j = toFix(q.y, SENSORFIX_Q_QUAT);
+            fix->un.girv.k = toFix(q.z, SENSORFIX_Q_QUAT);
+            fix->un.girv.angVelX = toFix(s->v[0], SENSORFIX_Q_ANGVEL);
+            fix->un.girv.angVelY = toFix(s->v[1], SENSORFIX_Q_ANGVEL);
+            fix->un.girv.angVelZ = toFix(s->v[2], SENSORFIX_Q_ANGVEL);
+            break;
+        default:
+            fix->un.vec3.x = toFix(s->v[0], fix->q);
+            fix->un.vec3.y = toFix(s->v[1], fix->q);
+            fix->un.vec3.z = toFix(s->v[2], fix->q);
+            break;
+    }
+}
+
+static int16_t toFix(float v, unsigned q)
+{
+    float f = v * (float)(1 << q);
+
+    f += (f >= 0.0f) ? 0.5f : -0.5f;
+    if (f >= 32767.0f) {
+        return 32767;
+    }
+    if (f <= -32768.0f) {
+        return -32768;
+    }
+    return (int16_t)f;
+}
+
+// Shell command: set the grid, or show each sensor's outputs.
+static void resampleCmd(int argc, char *argv[])
+{
+    if (argc > 1) {
+        uint8_t ids[SENSOR_RESAMPLE_SENSORS];
+        unsigned n = 0;
+        uint32_t hz = (strcmp(argv[1], "off") == 0) ? 0 : strtoul(argv[1], 0, 0);
+
+        for (int i = 2; (i < argc) && (n < SENSOR_RESAMPLE_SENSORS); i++) {
+            ids[n++] = (uint8_t)strtoul(argv[i], 0, 0);
+        }
+        if (((hz != 0) && (n == 0)) || (sensorResample_set(hz, ids, n) != SH2_OK)) {
+            printf("Usage: resample [<hz> <sensor>... | off], 1000000 a multiple of hz, "
+                   "up to %u sensors\n", SENSOR_RESAMPLE_SENSORS);
+            return;
+        }
+    }
+
+    if (period_us == 0) {
+        printf("Resampling off\n");
+        return;
+    }
+    printf("Resampling every %u us, %u us behind\n",
+           (unsigned)period_us, (unsigned)SENSOR_RESAMPLE_DELAY_US);
+    printf("  %-4s %10s %8s %8s\n", "id", "outputs", "held", "stale");
+    for (unsigned n = 0; n < SENSOR_RESAMPLE_SENSORS; n++) {
+        const Channel_t *c = &channels[n];
+        if (c->sensorId != 0) {
+            printf("  %-4u %10u %8u %8u\n", c->sensorId, (unsigned)c->outputs,
+                   (unsigned)c->held, (unsigned)c->stale);
+        }
+    }
+    printf("%u overflows, %u skipped, reads retried %u, busy %u\n",
+           (unsigned)overflows, (unsigned)skipped, (unsigned)retries, (unsigned)busy);
+}
+
+#endif
@@ -0,0 +1,109 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Fixed-rate resampling of sensor reports onto an exact time grid.
+ *
+ * Hub reports come with some jitter and now and then a gap; a control
+ * loop wants them at exactly 1kHz or 500Hz.  A dispatch subscriber keeps
+ * the last few reports of up to SENSOR_RESAMPLE_SENSORS sensors, and
+ * the TIM5 update interrupt, at the grid rate, interpolates each of them
+ * at the grid instants k * period on the timebase_getUs() clock:
+ * linearly for vectors (and the accuracy estimate and GIRV angular
+ * velocity), by slerp for quaternions.  The timer only paces the work:
+ * which instants are due comes from timebase_getUs(), so the output
+ * grid is exact whatever the timer's clock does.
+ *
+ * Each instant is interpolated SENSOR_RESAMPLE_DELAY_US after it, when
+ * the report following it has normally arrived.  One that hasn't (a gap
+ * longer than the delay) holds the newest report's value, and a sensor
+ * with nothing newer than SENSOR_RESAMPLE_STALE_US before the instant
+ * has no output for it.
+ *
+ * Outputs are SensorFix_t, stamped with the grid instant.  The newest of
+ * each sensor is kept as in sensor_latest.h (sensorResample_get(), from
+ * any task), and all of them go into a ring for one consumer task
+ * (sensorResample_read()), so consumers get a regular stream without
+ * buffering of their own.  "resample" sets the rate and sensors.
+ */
+
+#ifndef SENSOR_RESAMPLE_H
+#define SENSOR_RESAMPLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sensor_fix.h"
+
+// Set to 1 to build in the resampler (2.9KB RAM; takes TIM5 and its
+// interrupt)
+#ifndef SENSOR_RESAMPLE
+#define SENSOR_RESAMPLE (0)
+#endif
+
+// Sensors resampled at once
+#ifndef SENSOR_RESAMPLE_SENSORS
+#define SENSOR_RESAMPLE_SENSORS (4)
+#endif
+
+// Time after a grid instant it is interpolated [us]
+#ifndef SENSOR_RESAMPLE_DELAY_US
+#define SENSOR_RESAMPLE_DELAY_US (3000)
+#endif
+
+// Age of the newest report, at a grid instant, past which a sensor has
+// no output [us]
+#ifndef SENSOR_RESAMPLE_STALE_US
+#define SENSOR_RESAMPLE_STALE_US (50000)
+#endif
+
+// Outputs in the ring (a power of two)
+#ifndef SENSOR_RESAMPLE_RING_LEN
+#define SENSOR_RESAMPLE_RING_LEN (32)
+#endif
+
+#if SENSOR_RESAMPLE
+
+// Set up TIM5, register the "resample" command and subscribe to every
+// sensor.
+void sensorResample_init(void);
+
+// Resample the sensors in ids[0..n) (sensorFix_decode() kinds only) at
+// hz, 0 to stop.  Restarts the grid and empties the ring.  Returns
+// SH2_OK, or SH2_ERR_BAD_PARAM for a rate that doesn't divide 1000000,
+// too many sensors or an id out of range.
+int sensorResample_set(uint32_t hz, const uint8_t *ids, unsigned n);
+
+// Copy the output of sensorId at the latest grid instant to *pFix.  Safe
+// from any task.  Returns SH2_OK, SH2_ERR if it has none yet,
+// SH2_ERR_BAD_PARAM if it isn't resampled, or SH2_ERR_OP_IN_PROGRESS if
+// the interrupt kept overlapping the copy.
+int sensorResample_get(uint8_t sensorId, SensorFix_t *pFix);
+
+// Take the oldest output from the ring.  For one consumer task only.
+// False if the ring is empty.
+bool sensorResample_read(SensorFix_t *pFix);
+
+// Call from TIM5_IRQHandler.
+void sensorResample_irq(void);
+
+#else
+
+#define sensorResample_init()
+
+#endif
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Compact sensor sample, as the pipeline keeps reports between the HAL
+ * and the subscribers.
+ *
+ * sh2_SensorEvent_t has room for the longest report the library knows
+ * (SH2_MAX_SENSOR_EVENT_LEN), a full 64-bit INTN time goes with it in
+ * the sensor ring, and every copy moves the lot: ~80 bytes for a 10-byte
+ * accelerometer report.  A SensorSample_t is a 14-byte header (hub
+ * timestamp, low half of the INTN time, report id, length) and the
+ * report itself in up to SENSOR_SAMPLE_MAX bytes, 40 bytes in all.  The
+ * sensor ring, the merge heap (sensor_merge.h) and the black box
+ * (sensor_blackbox.h) hold these, and only as many report bytes as the
+ * report has are copied in and out.  Subscribers still get an
+ * sh2_SensorEvent_t, filled in on the sensor task's stack as it is
+ * published.
+ */
+
+#ifndef SENSOR_SAMPLE_H
+#define SENSOR_SAMPLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "sh2.h"
+
+// Longest report kept [bytes]: the sensor reports the demo subscribes
+// to are at most 20 with their status and delay bytes.  Longer ones are
+// dropped and counted, so raise it for a longer one.  26 keeps the
+// sample at 40 bytes.
+#ifndef SENSOR_SAMPLE_MAX
+#define SENSOR_SAMPLE_MAX (26)
+#endif
+
+typedef struct {
+    uint64_t t_uS;                // report timestamp
+    uint32_t intn_uS;             // INTN time, low 32 bits (sensorSample_intnUs())
+    uint8_t reportId;
+    uint8_t len;                  // of report[]
+    uint8_t report[SENSOR_SAMPLE_MAX];
+} SensorSample_t;
+
+// Pack an event and its INTN time into a sample.  False, and the sample
+// untouched, if the report is longer than SENSOR_SAMPLE_MAX.
+static inline bool sensorSample_pack(SensorSample_t *s, const sh2_SensorEvent_t *e,
+                                     uint64_t intn_uS)
+{
+    if (e->len > SENSOR_SAMPLE_MAX) {
+        return false;
+    }
+    s->t_uS = e->timestamp_uS;
+    s->intn_uS = (uint32_t)intn_uS;
+    s->reportId = e->reportId;
+    s->len = e->len;
+    memcpy(s->report, e->report, e->len);
+    return true;
+}
+
+// Fill in the fields of an event a sample has.  report[] past len is
+// left as it was.
+static inline void sensorSample_unpack(sh2_SensorEvent_t *e, const SensorSample_t *s)
+{
+    e->timestamp_uS = s->t_uS;
+    e->reportId = s->reportId;
+    e->len = s->len;
+    memcpy(e->report, s->report, s->len);
+}
+
+// The full INTN time of a sample taken less than 2^32 us (71 min)
+// before now_uS.
+static inline uint64_t sensorSample_intnUs(const SensorSample_t *s, uint64_t now_uS)
+{
+    return now_uS - (uint32_t)((uint32_t)now_uS - s->intn_uS);
+}
+
+#endif
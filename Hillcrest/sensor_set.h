@@ -0,0 +1,79 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Sensors the console output can format.
+ *
+ * Each SENSOR_SET_<sensor> builds in the text and DSF formatters of that
+ * sensor; set it to 0 (e.g. from a pre-included profile, as ram_lean.h
+ * does for RAM) for a sensor the product never enables, and its
+ * formatters and DSF header are left out of the image.  Reports of a
+ * sensor left out print as "Unknown sensor" in text and DSF; the binary
+ * formats carry every sensor regardless.
+ *
+ * sensor_output.c dispatches through tables indexed by sensor id,
+ * with an entry for each sensor built in.
+ */
+
+#ifndef SENSOR_SET_H
+#define SENSOR_SET_H
+
+#ifndef SENSOR_SET_ACCELEROMETER
+#define SENSOR_SET_ACCELEROMETER (1)
+#endif
+
+#ifndef SENSOR_SET_GYROSCOPE_CALIBRATED
+#define SENSOR_SET_GYROSCOPE_CALIBRATED (1)
+#endif
+
+#ifndef SENSOR_SET_MAGNETIC_FIELD_CALIBRATED
+#define SENSOR_SET_MAGNETIC_FIELD_CALIBRATED (1)
+#endif
+
+#ifndef SENSOR_SET_LINEAR_ACCELERATION
+#define SENSOR_SET_LINEAR_ACCELERATION (1)
+#endif
+
+#ifndef SENSOR_SET_ROTATION_VECTOR
+#define SENSOR_SET_ROTATION_VECTOR (1)
+#endif
+
+#ifndef SENSOR_SET_GEOMAGNETIC_ROTATION_VECTOR
+#define SENSOR_SET_GEOMAGNETIC_ROTATION_VECTOR (1)
+#endif
+
+#ifndef SENSOR_SET_RAW_ACCELEROMETER
+#define SENSOR_SET_RAW_ACCELEROMETER (1)
+#endif
+
+#ifndef SENSOR_SET_RAW_GYROSCOPE
+#define SENSOR_SET_RAW_GYROSCOPE (1)
+#endif
+
+#ifndef SENSOR_SET_RAW_MAGNETOMETER
+#define SENSOR_SET_RAW_MAGNETOMETER (1)
+#endif
+
+#ifndef SENSOR_SET_GAME_ROTATION_VECTOR
+#define SENSOR_SET_GAME_ROTATION_VECTOR (1)
+#endif
+
+#ifndef SENSOR_SET_GYRO_INTEGRATED_RV
+#define SENSOR_SET_GYRO_INTEGRATED_RV (1)
+#endif
+
+#endif
@@ -0,0 +1,212 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Per-sensor report statistics: received count, sequence gaps, effective
+ * rate against the subscribed interval, and inter-arrival jitter.
+ */
+
+#include "sensor_stats.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include "shell.h"
+#include "sysstats.h"
+#include "sensor_dispatch.h"
+#include "priorities.h"
+
+// Jitter is smoothed as in RFC 3550: J += (|D| - J)/16, with J kept
+// scaled by 16 so the update stays in integers.
+#define JITTER_SHIFT (4)
+
+// ------------------------------------------------------------------------
+// Private types
+
+typedef struct {
+    uint32_t interval_us;  // subscribed report interval, 0 if not subscribed
+    uint32_t received;     // events seen
+    uint32_t gaps;         // sequence discontinuities
+    uint32_t lost;         // reports missing across those gaps
+    uint8_t lastSeq;       // sequence number of the previous report
+    bool seqValid;         // lastSeq is meaningful
+    uint64_t first_uS;     // timestamp of the first event
+    uint64_t last_uS;      // timestamp of the previous event
+    uint32_t minDelta;     // inter-arrival time bounds [us]
+    uint32_t maxDelta;
+    uint32_t jitter16;     // smoothed |delta - interval|, scaled by 16
+} SensorStats_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void statsCmd(int argc, char *argv[]);
+static void statsEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix);
+static void clearCounts(SensorStats_t *s);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+// Written by the sensor task only.  The shell reads without locking; a
+// dump that races an update may be off by one sample.
+static SensorStats_t stats[SH2_MAX_SENSOR_ID+1];
+
+// ------------------------------------------------------------------------
+// Public API
+
+void sensorStats_init(void)
+{
+    sensorStats_reset();
+    sysstats_addMemory("sensor stats", sizeof(stats));
+    shell_addCommand("stats", "[reset] per-sensor count, gaps, rate and jitter", statsCmd);
+    sensorDispatch_subscribe(SENSOR_DISPATCH_ALL, PRIO_SUB_STATS, statsEvent, 0);
+}
+
+void sensorStats_setInterval(sh2_SensorId_t sensorId, uint32_t interval_us)
+{
+    if (sensorId > SH2_MAX_SENSOR_ID) {
+        return;
+    }
+
+    // Rate and jitter are measured against the new interval from here on
+    clearCounts(&stats[sensorId]);
+    stats[sensorId].interval_us = interval_us;
+}
+
+void sensorStats_restart(void)
+{
+    for (int n = 0; n <= SH2_MAX_SENSOR_ID; n++) {
+        stats[n].seqValid = false;
+    }
+}
+
+bool sensorStats_get(sh2_SensorId_t sensorId, SensorStatsSummary_t *pSum)
+{
+    if ((sensorId > SH2_MAX_SENSOR_ID) || (stats[sensorId].received == 0)) {
+        return false;
+    }
+
+    const SensorStats_t *s = &stats[sensorId];
+    pSum->interval_us = s->interval_us;
+    pSum->received = s->received;
+    pSum->gaps = s->gaps;
+    pSum->lost = s->lost;
+    pSum->rate_Hz = 0.0;
+    if (s->last_uS > s->first_uS) {
+        pSum->rate_Hz = (s->received - 1) * 1000000.0 / (float)(s->last_uS - s->first_uS);
+    }
+    pSum->minDelta = (s->received > 1) ? s->minDelta : 0;
+    pSum->maxDelta = s->maxDelta;
+    pSum->jitter_us = s->jitter16 >> JITTER_SHIFT;
+
+    return true;
+}
+
+void sensorStats_dump(void)
+{
+    SensorStatsSummary_t sum;
+
+    printf("  %4s %8s %6s %6s %9s %9s %8s %8s %8s\n",
+           "id", "rcvd", "gaps", "lost", "rate Hz", "subs Hz", "dt min", "dt max", "jitter");
+    for (int n = 0; n <= SH2_MAX_SENSOR_ID; n++) {
+        float subsRate = 0.0;
+
+        if (!sensorStats_get(n, &sum)) {
+            continue;
+        }
+        if (sum.interval_us != 0) {
+            subsRate = 1000000.0 / (float)sum.interval_us;
+        }
+        printf("  %4d %8u %6u %6u %9.2f %9.2f %8u %8u %8u\n",
+               n, sum.received, sum.gaps, sum.lost, sum.rate_Hz, subsRate,
+               sum.minDelta, sum.maxDelta, sum.jitter_us);
+    }
+}
+
+void sensorStats_reset(void)
+{
+    for (int n = 0; n <= SH2_MAX_SENSOR_ID; n++) {
+        clearCounts(&stats[n]);
+    }
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+// Clear the counters, but keep the subscription and sequence tracking
+static void clearCounts(SensorStats_t *s)
+{
+    s->received = 0;
+    s->gaps = 0;
+    s->lost = 0;
+    s->first_uS = 0;
+    s->last_uS = 0;
+    s->minDelta = UINT32_MAX;
+    s->maxDelta = 0;
+    s->jitter16 = 0;
+}
+
+// Account for one sensor event (dispatch callback, in the sensor task)
+static void statsEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix)
+{
+    if (pEvent->reportId > SH2_MAX_SENSOR_ID) {
+        return;
+    }
+
+    SensorStats_t *s = &stats[pEvent->reportId];
+    uint64_t t_uS = pEvent->timestamp_uS;
+
+    // Gyro Integrated RV reports have no report header, so no sequence number
+    if ((pEvent->reportId != SH2_GYRO_INTEGRATED_RV) && (pEvent->len > 1)) {
+        uint8_t seq = pEvent->report[1];
+        uint8_t deltaSeq = seq - s->lastSeq;
+
+        if (s->seqValid && (deltaSeq != 1)) {
+            // A repeated sequence number is a gap, but nothing was lost
+            s->gaps++;
+            if (deltaSeq != 0) {
+                s->lost += deltaSeq - 1;
+            }
+        }
+        s->lastSeq = seq;
+        s->seqValid = true;
+    }
+
+    if (s->received == 0) {
+        s->first_uS = t_uS;
+    }
+    else if (t_uS >= s->last_uS) {
+        uint32_t delta = (uint32_t)(t_uS - s->last_uS);
+        uint32_t dev = (delta > s->interval_us) ? delta - s->interval_us : s->interval_us - delta;
+
+        if (delta < s->minDelta) s->minDelta = delta;
+        if (delta > s->maxDelta) s->maxDelta = delta;
+        s->jitter16 += dev - (s->jitter16 >> JITTER_SHIFT);
+    }
+    s->last_uS = t_uS;
+    s->received++;
+}
+
+static void statsCmd(int argc, char *argv[])
+{
+    if ((argc > 1) && (strcmp(argv[1], "reset") == 0)) {
+        sensorStats_reset();
+        return;
+    }
+
+    sensorStats_dump();
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Per-sensor report statistics: received count, sequence gaps, effective
+ * rate against the subscribed interval, and inter-arrival jitter.
+ * Printed by the "stats" shell command.
+ */
+
+#ifndef SENSOR_STATS_H
+#define SENSOR_STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sh2.h"
+
+// One sensor's statistics since they were last cleared
+typedef struct {
+    uint32_t interval_us;  // subscribed, 0 if not subscribed
+    uint32_t received;
+    uint32_t gaps;
+    uint32_t lost;
+    float rate_Hz;         // received over the time they span
+    uint32_t minDelta;     // inter-arrival time bounds [us]
+    uint32_t maxDelta;
+    uint32_t jitter_us;    // smoothed |delta - interval|
+} SensorStatsSummary_t;
+
+// Register the "stats" command and subscribe to every sensor.
+void sensorStats_init(void);
+
+// Record the report interval a sensor was subscribed at (0: disabled).
+void sensorStats_setInterval(sh2_SensorId_t sensorId, uint32_t interval_us);
+
+// The hub was reset: sequence numbers start over, don't count a gap.
+void sensorStats_restart(void);
+
+// Fill *pSum for sensorId.  Returns false if none of its events were seen.
+bool sensorStats_get(sh2_SensorId_t sensorId, SensorStatsSummary_t *pSum);
+
+// Print statistics for every sensor seen, or clear them.
+void sensorStats_dump(void);
+void sensorStats_reset(void);
+
+#endif
@@ -0,0 +1,302 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Trigger output phase-locked to a sensor's sample clock.
+ */
+
+#include "sensor_strobe.h"
+
+#if SENSOR_STROBE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "stm32f4xx_hal.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "shell.h"
+#include "sysstats.h"
+#include "timebase.h"
+#include "sensor_dispatch.h"
+#include "priorities.h"
+#include "board_sync.h"
+
+// Times in the loop are in 1/256 us, so the period keeps its fraction
+#define Q8 (8)
+
+// Least time ahead a pulse is set for [us]
+#define MIN_AHEAD_US (20)
+
+// Samples missing in a row that unlock the loop
+#define MAX_GAP (8)
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void strobeEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix);
+static void track(uint64_t t_uS);
+static uint64_t nextPulse(void);
+static void pulseFn(void);
+static void strobeCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+// Settings, from the shell
+static volatile uint8_t strobeId;
+static volatile uint32_t strobeEvery = 1;
+static volatile int32_t strobeOffset_uS;
+static volatile uint32_t strobeWidth_uS = SENSOR_STROBE_WIDTH_US;
+static volatile bool restartNeeded;
+
+// Loop model, written by the sensor task with the TIM2 ISR masked and
+// read by the ISR: sample anchorIdx was at anchor, the next ones follow
+// every period.
+static uint64_t anchor_q8;
+static uint64_t anchorIdx;
+static uint32_t period_q8;
+static volatile bool running;       // pulses going out
+
+// Loop state, sensor task only
+static uint64_t first_uS;           // first sample, 0 until seen
+static unsigned lockCount;
+static volatile int32_t lastErr_uS;
+static volatile uint32_t maxErr_uS; // since locked
+
+// TIM2 ISR only
+static uint64_t pulseIdx;           // sample of the last pulse set
+
+static uint32_t pulses;
+static uint32_t unlocks;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void sensorStrobe_init(void)
+{
+    GPIO_InitTypeDef GPIO_InitStruct;
+
+    // Low before the timer gets the pin
+    timebase_cancelPulse();
+
+    memset(&GPIO_InitStruct, 0, sizeof(GPIO_InitStruct));
+    __GPIOA_CLK_ENABLE();
+    GPIO_InitStruct.Pin = SENSOR_STROBE_PIN;
+    GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+    GPIO_InitStruct.Pull = GPIO_NOPULL;
+    GPIO_InitStruct.Speed = GPIO_SPEED_HIGH;
+    GPIO_InitStruct.Alternate = GPIO_AF1_TIM2;
+    HAL_GPIO_Init(SENSOR_STROBE_PORT, &GPIO_InitStruct);
+
+    sysstats_addCounter("strobe pulses", &pulses);
+    shell_addCommand("strobe", "[<sensor> [every <n>] [offset <us>] [width <us>] | off] sample-locked trigger output",
+                     strobeCmd);
+    sensorDispatch_subscribe(SENSOR_DISPATCH_ALL, PRIO_SUB_STROBE, strobeEvent, 0);
+}
+
+void sensorStrobe_set(uint8_t sensorId, uint32_t every, int32_t offset_uS, uint32_t width_uS)
+{
+    // Stop now; the sensor task locks on afresh
+    running = false;
+    timebase_cancelPulse();
+
+    strobeEvery = (every != 0) ? every : 1;
+    strobeOffset_uS = offset_uS;
+    strobeWidth_uS = (width_uS != 0) ? width_uS : 1;
+    strobeId = sensorId;
+    restartNeeded = true;
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+// Dispatch callback, in the sensor task
+static void strobeEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix)
+{
+    if (restartNeeded) {
+        restartNeeded = false;
+        first_uS = 0;
+        period_q8 = 0;
+        lockCount = 0;
+    }
+    if ((strobeId == 0) || (pEvent->reportId != strobeId)) {
+        return;
+    }
+
+    track(pEvent->timestamp_uS);
+}
+
+// One sample of the locked sensor at t_uS
+static void track(uint64_t t_uS)
+{
+    uint64_t t_q8 = t_uS << Q8;
+    int64_t err_q8;
+    uint64_t k;
+    bool wasRunning = running;
+
+    if (period_q8 == 0) {
+        // The first period seeds the loop
+        if ((first_uS == 0) || (t_uS <= first_uS)) {
+            first_uS = t_uS;
+            return;
+        }
+        taskENTER_CRITICAL();
+        period_q8 = (uint32_t)((t_uS - first_uS) << Q8);
+        anchor_q8 = t_q8;
+        anchorIdx = 0;
+        taskEXIT_CRITICAL();
+        return;
+    }
+
+    // Periods since the anchor, to the nearest
+    if (t_q8 <= anchor_q8) {
+        return;
+    }
+    k = (t_q8 - anchor_q8 + period_q8/2) / period_q8;
+    if ((k == 0) || (k > MAX_GAP)) {
+        // A rate change or a gap: start over
+        if (wasRunning) {
+            running = false;
+            timebase_cancelPulse();
+            unlocks++;
+        }
+        first_uS = t_uS;
+        period_q8 = 0;
+        lockCount = 0;
+        return;
+    }
+
+    err_q8 = (int64_t)(t_q8 - (anchor_q8 + k * period_q8));
+
+    taskENTER_CRITICAL();
+    anchor_q8 = t_q8 - err_q8 + err_q8 / SENSOR_STROBE_PHASE_GAIN;
+    anchorIdx += k;
+    period_q8 += (int32_t)(err_q8 / (SENSOR_STROBE_FREQ_GAIN * (int64_t)k));
+    taskEXIT_CRITICAL();
+
+    lastErr_uS = (int32_t)(err_q8 / (1 << Q8));
+    if (abs(lastErr_uS) < SENSOR_STROBE_LOCK_US) {
+        if (lockCount < SENSOR_STROBE_LOCK_SAMPLES) {
+            lockCount++;
+        }
+    }
+    else {
+        lockCount = 0;
+    }
+
+    if ((lockCount >= SENSOR_STROBE_LOCK_SAMPLES) && !wasRunning) {
+        // Locked: the ISR keeps the pulses going from here
+        maxErr_uS = 0;
+        taskENTER_CRITICAL();
+        running = true;
+        pulseIdx = 0;
+        timebase_setPulse(nextPulse(), strobeWidth_uS, pulseFn);
+        taskEXIT_CRITICAL();
+    }
+    else if ((lockCount == 0) && wasRunning) {
+        running = false;
+        timebase_cancelPulse();
+        unlocks++;
+    }
+    else if (wasRunning && ((uint32_t)abs(lastErr_uS) > maxErr_uS)) {
+        maxErr_uS = abs(lastErr_uS);
+    }
+}
+
+// Time of the next pulse: the first sample due at least MIN_AHEAD_US from
+// now that is a multiple of strobeEvery and after the last pulse's.
+// With the TIM2 ISR masked, or in it.
+static uint64_t nextPulse(void)
+{
+    int64_t ahead_q8 = (int64_t)((timebase_getUs() + MIN_AHEAD_US - strobeOffset_uS) << Q8) -
+                       (int64_t)anchor_q8;
+    uint64_t idx = anchorIdx;
+    uint32_t every = strobeEvery;
+
+    if (ahead_q8 > 0) {
+        idx += (ahead_q8 + period_q8 - 1) / period_q8;
+    }
+    if (idx <= pulseIdx) {
+        idx = pulseIdx + 1;
+    }
+    idx += (every - (idx % every)) % every;
+    pulseIdx = idx;
+
+    return ((anchor_q8 + (idx - anchorIdx) * period_q8) >> Q8) + strobeOffset_uS;
+}
+
+// Rising edge of a pulse, in the TIM2 ISR
+static void pulseFn(void)
+{
+    pulses++;
+    if (running) {
+        timebase_setPulse(nextPulse(), strobeWidth_uS, pulseFn);
+    }
+}
+
+static void strobeCmd(int argc, char *argv[])
+{
+    if (argc > 1) {
+        uint32_t every = 1;
+        int32_t offset = 0;
+        uint32_t width = SENSOR_STROBE_WIDTH_US;
+        unsigned long id = 0;
+
+#if BOARD_SYNC
+        if (boardSync_isMaster()) {
+            printf("Trigger output in use by the board sync master\n");
+            return;
+        }
+#endif
+
+        if (strcmp(argv[1], "off") != 0) {
+            id = strtoul(argv[1], 0, 0);
+            if ((id == 0) || (id > SH2_MAX_SENSOR_ID)) {
+                printf("Usage: strobe [<sensor> [every <n>] [offset <us>] [width <us>] | off]\n");
+                return;
+            }
+        }
+        for (int n = 2; n + 1 < argc; n += 2) {
+            if (strcmp(argv[n], "every") == 0) {
+                every = strtoul(argv[n+1], 0, 0);
+            }
+            else if (strcmp(argv[n], "offset") == 0) {
+                offset = strtol(argv[n+1], 0, 0);
+            }
+            else if (strcmp(argv[n], "width") == 0) {
+                width = strtoul(argv[n+1], 0, 0);
+            }
+        }
+        sensorStrobe_set((uint8_t)id, every, offset, width);
+    }
+
+    if (strobeId == 0) {
+        printf("Strobe off\n");
+        return;
+    }
+    printf("Strobe on sensor %u every %u, offset %d us, width %u us: %s\n",
+           strobeId, strobeEvery, strobeOffset_uS, strobeWidth_uS,
+           running ? "locked" : "locking");
+    printf("  period %u.%03u us, phase error %d us (max %u since lock)\n",
+           period_q8 >> Q8, ((period_q8 & ((1 << Q8) - 1)) * 1000) >> Q8,
+           lastErr_uS, maxErr_uS);
+    printf("  %u pulses, %u unlocks\n", pulses, unlocks);
+}
+
+#endif
@@ -0,0 +1,81 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Trigger output phase-locked to a sensor's sample clock.
+ *
+ * Drives a pulse on TIM2_CH2 at the instants the hub samples a chosen
+ * sensor, or every Nth of them, so cameras and lidars triggered by it
+ * expose in step with the IMU and need no interpolation.  The sample
+ * instants are the sensor's report timestamps, on the host timebase
+ * after hub_clock's correction; a second-order loop tracks their
+ * period and phase, and the timer puts each rising edge out at the
+ * predicted time of its sample (plus an offset, e.g. to centre an
+ * exposure on it), so the edge has no interrupt latency in it.
+ *
+ * Pulses only go out while the loop is locked: the phase error stayed
+ * under SENSOR_STROBE_LOCK_US for SENSOR_STROBE_LOCK_SAMPLES samples.
+ * A rate change or a gap in the reports unlocks it until it settles
+ * again.  "strobe" shows the period, the phase error and the counts.
+ */
+
+#ifndef SENSOR_STROBE_H
+#define SENSOR_STROBE_H
+
+#include <stdint.h>
+
+// Build in the trigger output (takes TIM2_CH2 and its pin)
+#ifndef SENSOR_STROBE
+#define SENSOR_STROBE (1)
+#endif
+
+// Output pin, TIM2_CH2 in AF1: PA1 (A1 on the Nucleo); PB3 is SWO
+#ifndef SENSOR_STROBE_PORT
+#define SENSOR_STROBE_PORT GPIOA
+#define SENSOR_STROBE_PIN GPIO_PIN_1
+#endif
+
+// Pulse width [us]
+#ifndef SENSOR_STROBE_WIDTH_US
+#define SENSOR_STROBE_WIDTH_US (100)
+#endif
+
+// Loop gains: 1/N of each phase error corrects the phase, 1/N of it
+// the period
+#ifndef SENSOR_STROBE_PHASE_GAIN
+#define SENSOR_STROBE_PHASE_GAIN (8)
+#endif
+#ifndef SENSOR_STROBE_FREQ_GAIN
+#define SENSOR_STROBE_FREQ_GAIN (64)
+#endif
+
+// Lock: phase error under LOCK_US for LOCK_SAMPLES samples in a row
+#ifndef SENSOR_STROBE_LOCK_US
+#define SENSOR_STROBE_LOCK_US (50)
+#endif
+#ifndef SENSOR_STROBE_LOCK_SAMPLES
+#define SENSOR_STROBE_LOCK_SAMPLES (16)
+#endif
+
+// Register the "strobe" command and subscribe to every sensor.
+void sensorStrobe_init(void);
+
+// Pulse on every `every`th sample of sensorId (0: off), offset_uS after
+// it (negative: before), width_uS long.
+void sensorStrobe_set(uint8_t sensorId, uint32_t every, int32_t offset_uS, uint32_t width_uS);
+
+#endif
@@ -0,0 +1,171 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Report rate sweep.
+ */
+
+#include "sensor_sweep.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "sh2.h"
+#include "sh2_hal_registry.h"
+#include "shell.h"
+#include "sysstats.h"
+#include "sensor_app.h"
+#include "sensor_stats.h"
+#include "sensor_output.h"
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void sweepCmd(int argc, char *argv[]);
+static unsigned parseSensors(char *list, uint8_t *ids);
+static uint32_t stepInterval(uint32_t from_us, uint32_t to_us, unsigned step, unsigned steps);
+static void measureStep(const uint8_t *ids, unsigned numIds, uint32_t interval_us, uint32_t dwell_ms);
+
+// ------------------------------------------------------------------------
+// Public API
+
+void sensorSweep_init(void)
+{
+    shell_addCommand("sweep", "<sensor>[,<sensor>...] [from us] [to us] [steps] [dwell ms] rate sweep",
+                     sweepCmd);
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static void sweepCmd(int argc, char *argv[])
+{
+    uint8_t ids[SENSOR_SWEEP_MAX_SENSORS];
+    uint32_t prevInterval[SENSOR_SWEEP_MAX_SENSORS];
+    unsigned numIds = (argc > 1) ? parseSensors(argv[1], ids) : 0;
+    uint32_t from_us = (argc > 2) ? strtoul(argv[2], 0, 0) : SENSOR_SWEEP_FROM_US;
+    uint32_t to_us = (argc > 3) ? strtoul(argv[3], 0, 0) : SENSOR_SWEEP_TO_US;
+    unsigned steps = (argc > 4) ? strtoul(argv[4], 0, 0) : SENSOR_SWEEP_STEPS;
+    uint32_t dwell_ms = (argc > 5) ? strtoul(argv[5], 0, 0) : SENSOR_SWEEP_DWELL_MS;
+
+    if ((numIds == 0) || (to_us == 0) || (from_us < to_us) ||
+        (steps == 0) || (steps > SENSOR_SWEEP_MAX_STEPS) || (dwell_ms == 0)) {
+        printf("usage: %s <sensor>[,<sensor>...] [from us] [to us] [steps] [dwell ms]\n", argv[0]);
+        printf("  up to %d sensors and %d steps, from us >= to us\n",
+               SENSOR_SWEEP_MAX_SENSORS, SENSOR_SWEEP_MAX_STEPS);
+        return;
+    }
+
+    for (unsigned n = 0; n < numIds; n++) {
+        prevInterval[n] = sensorApp_interval(ids[n]);
+    }
+    OutputMode_t prevMode = sensorOutput_getMode();
+    sensorOutput_setMode(OUTPUT_NONE);
+
+    printf("Sweep over %s, %u steps from %u to %u us, %u ms each:\n",
+           sh2_hal_devName(0), steps, (unsigned)from_us, (unsigned)to_us, (unsigned)dwell_ms);
+    printf("  %8s %4s %9s %9s %6s %6s %8s %8s %6s %6s\n",
+           "intvl us", "id", "subs Hz", "rate Hz", "gaps", "lost",
+           "dt max", "jitter", "ovfl", "cpu%");
+    for (unsigned step = 0; step < steps; step++) {
+        measureStep(ids, numIds, stepInterval(from_us, to_us, step, steps), dwell_ms);
+    }
+
+    for (unsigned n = 0; n < numIds; n++) {
+        sensorApp_subscribe(ids[n], prevInterval[n]);
+    }
+    sensorOutput_setMode(prevMode);
+}
+
+// Parse "2,5,42" into ids, returning how many (0 if any is bad)
+static unsigned parseSensors(char *list, uint8_t *ids)
+{
+    unsigned numIds = 0;
+    char *p = list;
+
+    while (*p != 0) {
+        char *end;
+        long id = strtol(p, &end, 0);
+
+        if ((end == p) || (id <= 0) || (id > SH2_MAX_SENSOR_ID) ||
+            (numIds >= SENSOR_SWEEP_MAX_SENSORS)) {
+            printf("Bad sensor list: %s\n", list);
+            return 0;
+        }
+        ids[numIds++] = (uint8_t)id;
+        p = (*end == ',') ? end + 1 : end;
+        if ((*end != ',') && (*end != 0)) {
+            printf("Bad sensor list: %s\n", list);
+            return 0;
+        }
+    }
+
+    return numIds;
+}
+
+// Interval of a step, geometric from from_us to to_us
+static uint32_t stepInterval(uint32_t from_us, uint32_t to_us, unsigned step, unsigned steps)
+{
+    if (steps < 2) {
+        return from_us;
+    }
+
+    float ratio = (float)to_us / (float)from_us;
+    return (uint32_t)(from_us * powf(ratio, (float)step / (float)(steps - 1)) + 0.5f);
+}
+
+// Run the sensors at interval_us, let the hub settle, then measure for
+// dwell_ms and print a row per sensor.
+static void measureStep(const uint8_t *ids, unsigned numIds, uint32_t interval_us, uint32_t dwell_ms)
+{
+    SysstatsLoadMark_t mark;
+    SensorStatsSummary_t sum;
+    uint32_t ovflStart, ovflEnd, highWater;
+
+    for (unsigned n = 0; n < numIds; n++) {
+        if (sensorApp_subscribe(ids[n], interval_us) != 0) {
+            printf("  Subscription table full for sensor %u.\n", ids[n]);
+        }
+    }
+    vTaskDelay(pdMS_TO_TICKS(SENSOR_SWEEP_SETTLE_MS));
+
+    // Counts start over here; the sensor task may add one event mid-way
+    sensorStats_reset();
+    sensorApp_getRingStats(&ovflStart, &highWater);
+    sysstats_cpuLoad(&mark);
+
+    vTaskDelay(pdMS_TO_TICKS(dwell_ms));
+
+    unsigned load = sysstats_cpuLoad(&mark);
+    sensorApp_getRingStats(&ovflEnd, &highWater);
+
+    for (unsigned n = 0; n < numIds; n++) {
+        if (!sensorStats_get(ids[n], &sum)) {
+            printf("  %8u %4u  no reports\n", (unsigned)interval_us, ids[n]);
+            continue;
+        }
+        printf("  %8u %4u %9.2f %9.2f %6u %6u %8u %8u %6u %4u.%u\n",
+               (unsigned)interval_us, ids[n],
+               (sum.interval_us != 0) ? 1000000.0 / (float)sum.interval_us : 0.0,
+               sum.rate_Hz, (unsigned)sum.gaps, (unsigned)sum.lost,
+               (unsigned)sum.maxDelta, (unsigned)sum.jitter_us,
+               (unsigned)(ovflEnd - ovflStart), load / 10, load % 10);
+    }
+}
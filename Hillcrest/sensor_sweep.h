@@ -0,0 +1,77 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Report rate sweep, to qualify a board and transport.
+ *
+ * "sweep" subscribes a set of sensors at report intervals stepping down
+ * geometrically (10 ms to 1 ms by default) and, at each step, prints per
+ * sensor the delivered rate, sequence gaps and lost reports, the longest
+ * inter-arrival time and the jitter (sensor_stats.h), with the sensor
+ * ring overflows and the CPU load over the step.  Console report output
+ * is off meanwhile, so the link isn't what's measured.  Run it once per
+ * transport (the table is labelled with the hub's).
+ *
+ * The sweep runs in the shell task, which it holds for
+ * steps * (SENSOR_SWEEP_SETTLE_MS + dwell).  The swept sensors' previous
+ * subscriptions and the output mode are restored after.  With the rate
+ * governor (sensor_rate.h) on, "subs Hz" shows the interval it ran at.
+ */
+
+#ifndef SENSOR_SWEEP_H
+#define SENSOR_SWEEP_H
+
+// Build in the "sweep" command
+#ifndef SENSOR_SWEEP
+#define SENSOR_SWEEP (1)
+#endif
+
+// Sensors swept together
+#ifndef SENSOR_SWEEP_MAX_SENSORS
+#define SENSOR_SWEEP_MAX_SENSORS (4)
+#endif
+
+// Default range [us] and number of intervals, ends included
+#ifndef SENSOR_SWEEP_FROM_US
+#define SENSOR_SWEEP_FROM_US (10000)
+#endif
+#ifndef SENSOR_SWEEP_TO_US
+#define SENSOR_SWEEP_TO_US (1000)
+#endif
+#ifndef SENSOR_SWEEP_STEPS
+#define SENSOR_SWEEP_STEPS (5)
+#endif
+#define SENSOR_SWEEP_MAX_STEPS (32)
+
+// Default time measured at each interval [ms]
+#ifndef SENSOR_SWEEP_DWELL_MS
+#define SENSOR_SWEEP_DWELL_MS (3000)
+#endif
+
+// Time allowed at each step for the hub to take the new interval [ms]
+#ifndef SENSOR_SWEEP_SETTLE_MS
+#define SENSOR_SWEEP_SETTLE_MS (500)
+#endif
+
+#if SENSOR_SWEEP_STEPS > SENSOR_SWEEP_MAX_STEPS
+#error SENSOR_SWEEP_STEPS is more than SENSOR_SWEEP_MAX_STEPS
+#endif
+
+// Register the "sweep" command.
+void sensorSweep_init(void);
+
+#endif
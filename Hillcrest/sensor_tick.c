@@ -0,0 +1,453 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Control-loop tick phase-locked to a sensor's samples.
+ */
+
+#include "sensor_tick.h"
+
+#if SENSOR_TICK
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stm32f4xx_hal.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "cmsis_os.h"
+#include "shell.h"
+#include "sysstats.h"
+#include "timebase.h"
+#include "sensor_dispatch.h"
+#include "rtos_static.h"
+#include "priorities.h"
+
+// Times in the loop are in 1/256 us, so the period keeps its fraction
+#define Q8 (8)
+
+// Least time ahead a tick is set for [us]
+#define MIN_AHEAD_US (20)
+
+// Samples missing in a row that re-anchor the loop
+#define MAX_GAP (8)
+
+// Longest TIM4 wait: it counts 16 bits of microseconds
+#define TIMER_MAX_US (0xFFFF)
+
+// Arrival latency taken for the auto offset at most [us]
+#define LATENCY_MAX_US (20000)
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void tickEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix);
+static void track(uint64_t t_uS);
+static void tickTask(const void *params);
+static int32_t offsetUs(void);
+static uint64_t nextTick(uint64_t *pSample_uS);
+static void timerArm(uint32_t us);
+static void measure(uint64_t now_uS, uint64_t sample_uS);
+static void tickCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+RTOS_STACK_DEF(tickTaskStack, SENSOR_TICK_STACK);
+static osThreadId tickTaskHandle;
+
+// Settings
+static volatile uint8_t tickId;
+static volatile uint32_t tickEvery = 1;
+static volatile int32_t tickOffset_us = SENSOR_TICK_OFFSET_AUTO;
+static SensorTickFn_t * volatile tickFn;
+static void * volatile tickCookie;
+static volatile bool restartNeeded;
+
+// Loop model, written by the sensor task in a critical section and read
+// by the tick task: sample anchorIdx was at anchor, the next ones follow
+// every period.
+static uint64_t anchor_q8;
+static uint64_t anchorIdx;
+static uint32_t period_q8;
+static volatile bool running;       // ticks going out
+static volatile bool startNeeded;   // tick task to set the first tick
+
+// Loop state, sensor task only
+static uint64_t first_uS;           // first sample, 0 until seen
+static unsigned lockCount;
+static volatile int32_t lastErr_uS;
+static volatile uint64_t lastSample_uS;
+static volatile uint32_t latency_us;  // decaying maximum of arrival - sample
+
+// Tick task, and the TIM4 ISR for target
+static uint64_t tickIdx;            // sample of the last tick set
+static volatile uint64_t target_uS;
+
+static SensorTickStats_t stats;
+static uint64_t ageSum_us;
+static uint32_t unlocks;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void sensorTick_init(void)
+{
+    osThreadDef(tickThreadDef, tickTask, PRIO_TASK_TICK, 0, SENSOR_TICK_STACK);
+    tickTaskHandle = rtos_threadCreate(osThread(tickThreadDef), NULL, RTOS_STACK(tickTaskStack));
+    if (tickTaskHandle == NULL) {
+        printf("Failed to create tick task.\n");
+        return;
+    }
+
+    __TIM4_CLK_ENABLE();
+    TIM4->CR1 = 0;
+    TIM4->DIER = 0;
+    HAL_NVIC_SetPriority(TIM4_IRQn, PRIO_IRQ_TICK, 0);
+    HAL_NVIC_EnableIRQ(TIM4_IRQn);
+
+    sysstats_addCounter("tick late samples", &stats.late);
+    shell_addCommand("tick", "[<sensor> [every <n>] [offset <us> | auto] | off] sample-locked control tick",
+                     tickCmd);
+    sensorDispatch_subscribe(SENSOR_DISPATCH_ALL, PRIO_SUB_TICK, tickEvent, 0);
+}
+
+void sensorTick_start(uint8_t sensorId, uint32_t every, int32_t offset_us,
+                      SensorTickFn_t *fn, void *cookie)
+{
+    // Stop now; the sensor task locks on afresh
+    running = false;
+    TIM4->CR1 = 0;
+
+    tickEvery = (every != 0) ? every : 1;
+    tickOffset_us = offset_us;
+    tickFn = fn;
+    tickCookie = cookie;
+    tickId = sensorId;
+    restartNeeded = true;
+}
+
+void sensorTick_getStats(SensorTickStats_t *pStats)
+{
+    taskENTER_CRITICAL();
+    *pStats = stats;
+    taskEXIT_CRITICAL();
+
+    pStats->meanAge_us = (pStats->ticks != 0) ? (uint32_t)(ageSum_us / pStats->ticks) : 0;
+    pStats->offset_us = offsetUs();
+    pStats->locked = running && (lockCount >= SENSOR_TICK_LOCK_SAMPLES);
+}
+
+void sensorTick_irq(void)
+{
+    BaseType_t woken = pdFALSE;
+    uint64_t now_uS = timebase_getUs();
+
+    TIM4->SR = ~TIM_SR_UIF;
+
+    // Long waits go in TIMER_MAX_US pieces
+    if (now_uS + 2 < target_uS) {
+        timerArm((uint32_t)(target_uS - now_uS));
+        return;
+    }
+    vTaskNotifyGiveFromISR(tickTaskHandle, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+// Dispatch callback, in the sensor task
+static void tickEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix)
+{
+    if (restartNeeded) {
+        restartNeeded = false;
+        first_uS = 0;
+        period_q8 = 0;
+        lockCount = 0;
+        lastSample_uS = 0;
+        latency_us = 0;
+        taskENTER_CRITICAL();
+        memset(&stats, 0, sizeof(stats));
+        ageSum_us = 0;
+        taskEXIT_CRITICAL();
+    }
+    if ((tickId == 0) || (pEvent->reportId != tickId)) {
+        return;
+    }
+
+    uint64_t t_uS = pEvent->timestamp_uS;
+    uint64_t now_uS = timebase_getUs();
+    if ((now_uS > t_uS) && (now_uS - t_uS < LATENCY_MAX_US)) {
+        uint32_t lat = (uint32_t)(now_uS - t_uS);
+        uint32_t decayed = latency_us - (latency_us >> 6);
+        latency_us = (lat > decayed) ? lat : decayed;
+    }
+    lastSample_uS = t_uS;
+
+    track(t_uS);
+}
+
+// One sample of the followed sensor at t_uS
+static void track(uint64_t t_uS)
+{
+    uint64_t t_q8 = t_uS << Q8;
+    int64_t err_q8;
+    uint64_t k;
+
+    if (period_q8 == 0) {
+        // The first period seeds the loop
+        if ((first_uS == 0) || (t_uS <= first_uS)) {
+            first_uS = t_uS;
+            return;
+        }
+        taskENTER_CRITICAL();
+        period_q8 = (uint32_t)((t_uS - first_uS) << Q8);
+        anchor_q8 = t_q8;
+        anchorIdx = 0;
+        taskEXIT_CRITICAL();
+        return;
+    }
+
+    // Periods since the anchor, to the nearest
+    if (t_q8 <= anchor_q8) {
+        return;
+    }
+    k = (t_q8 - anchor_q8 + period_q8/2) / period_q8;
+    if (k == 0) {
+        // Faster than the period: a rate change, start over
+        if (running) {
+            running = false;
+            TIM4->CR1 = 0;
+            unlocks++;
+        }
+        first_uS = t_uS;
+        period_q8 = 0;
+        lockCount = 0;
+        return;
+    }
+    if (k > MAX_GAP) {
+        // A gap: ticks carry on at the period, from this sample's phase
+        taskENTER_CRITICAL();
+        anchor_q8 = t_q8;
+        anchorIdx += k;
+        taskEXIT_CRITICAL();
+        if (lockCount >= SENSOR_TICK_LOCK_SAMPLES) {
+            unlocks++;
+        }
+        lockCount = 0;
+        return;
+    }
+
+    err_q8 = (int64_t)(t_q8 - (anchor_q8 + k * period_q8));
+
+    taskENTER_CRITICAL();
+    anchor_q8 = t_q8 - err_q8 + err_q8 / SENSOR_TICK_PHASE_GAIN;
+    anchorIdx += k;
+    period_q8 += (int32_t)(err_q8 / (SENSOR_TICK_FREQ_GAIN * (int64_t)k));
+    taskEXIT_CRITICAL();
+
+    lastErr_uS = (int32_t)(err_q8 / (1 << Q8));
+    if (abs(lastErr_uS) < SENSOR_TICK_LOCK_US) {
+        if (lockCount < SENSOR_TICK_LOCK_SAMPLES) {
+            lockCount++;
+        }
+    }
+    else {
+        if (lockCount >= SENSOR_TICK_LOCK_SAMPLES) {
+            unlocks++;
+        }
+        lockCount = 0;
+    }
+
+    if ((lockCount >= SENSOR_TICK_LOCK_SAMPLES) && !running) {
+        // Locked: the tick task keeps the ticks going from here
+        running = true;
+        startNeeded = true;
+        xTaskNotifyGive(tickTaskHandle);
+    }
+}
+
+static void tickTask(const void *params)
+{
+    uint64_t sample_uS = 0;
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if (!running) {
+            continue;
+        }
+
+        if (startNeeded) {
+            startNeeded = false;
+            tickIdx = 0;
+        }
+        else {
+            uint64_t now_uS = timebase_getUs();
+            SensorTickFn_t *fn = tickFn;
+
+            measure(now_uS, sample_uS);
+            if (fn != 0) {
+                fn(tickCookie, sample_uS);
+            }
+        }
+
+        target_uS = nextTick(&sample_uS);
+        uint64_t now_uS = timebase_getUs();
+        timerArm((target_uS > now_uS) ? (uint32_t)(target_uS - now_uS) : 0);
+    }
+}
+
+static int32_t offsetUs(void)
+{
+    int32_t offset = tickOffset_us;
+
+    if (offset == SENSOR_TICK_OFFSET_AUTO) {
+        offset = (int32_t)latency_us + SENSOR_TICK_MARGIN_US;
+    }
+    return offset;
+}
+
+// Time of the next tick: the first sample due at least MIN_AHEAD_US from
+// now, less the offset, that is a multiple of tickEvery and after the
+// last tick's.  Its sample's instant goes to *pSample_uS.
+static uint64_t nextTick(uint64_t *pSample_uS)
+{
+    int32_t offset = offsetUs();
+    uint32_t every = tickEvery;
+    uint64_t anchor, idx;
+    uint32_t period;
+
+    taskENTER_CRITICAL();
+    anchor = anchor_q8;
+    idx = anchorIdx;
+    period = period_q8;
+    taskEXIT_CRITICAL();
+
+    int64_t ahead_q8 = (int64_t)((timebase_getUs() + MIN_AHEAD_US - offset) << Q8) -
+                       (int64_t)anchor;
+    uint64_t base = idx;
+    if (ahead_q8 > 0) {
+        idx += (ahead_q8 + period - 1) / period;
+    }
+    if (idx <= tickIdx) {
+        idx = tickIdx + 1;
+    }
+    idx += (every - (idx % every)) % every;
+    tickIdx = idx;
+
+    *pSample_uS = (anchor + (idx - base) * period) >> Q8;
+    return *pSample_uS + offset;
+}
+
+// Interrupt in us (at least 2us), or in TIMER_MAX_US and again from there.
+// TIM4 is on APB1, its clock is doubled when APB1 is divided.
+static void timerArm(uint32_t us)
+{
+    uint32_t timClk = HAL_RCC_GetPCLK1Freq();
+
+    if ((RCC->CFGR & RCC_CFGR_PPRE1) != RCC_CFGR_PPRE1_DIV1) {
+        timClk *= 2;
+    }
+    if (us > TIMER_MAX_US) {
+        us = TIMER_MAX_US;
+    }
+    if (us < 2) {
+        us = 2;
+    }
+
+    // One pulse; the update loading PSC doesn't flag
+    TIM4->CR1 = TIM_CR1_OPM | TIM_CR1_URS;
+    TIM4->PSC = timClk / 1000000 - 1;
+    TIM4->ARR = us - 1;
+    TIM4->CNT = 0;
+    TIM4->EGR = TIM_EGR_UG;
+    TIM4->SR = 0;
+    TIM4->DIER = TIM_DIER_UIE;
+    TIM4->CR1 |= TIM_CR1_CEN;
+}
+
+// Age of the newest sample at a tick for the one at sample_uS
+static void measure(uint64_t now_uS, uint64_t sample_uS)
+{
+    uint64_t last_uS = lastSample_uS;
+    uint32_t age = (now_uS > last_uS) ? (uint32_t)(now_uS - last_uS) : 0;
+    uint32_t halfPeriod = (period_q8 >> Q8) / 2;
+
+    taskENTER_CRITICAL();
+    if (last_uS + halfPeriod < sample_uS) {
+        stats.late++;
+    }
+    if ((stats.ticks == 0) || (age < stats.minAge_us)) {
+        stats.minAge_us = age;
+    }
+    if (age > stats.maxAge_us) {
+        stats.maxAge_us = age;
+    }
+    stats.lastAge_us = age;
+    stats.ticks++;
+    ageSum_us += age;
+    taskEXIT_CRITICAL();
+}
+
+// Shell command: follow a sensor (measuring only), stop, or show the
+// loop and the sample ages.
+static void tickCmd(int argc, char *argv[])
+{
+    SensorTickStats_t s;
+
+    if (argc > 1) {
+        uint32_t every = 1;
+        int32_t offset = SENSOR_TICK_OFFSET_AUTO;
+        unsigned long id = 0;
+
+        if (strcmp(argv[1], "off") != 0) {
+            id = strtoul(argv[1], 0, 0);
+            if ((id == 0) || (id > SH2_MAX_SENSOR_ID)) {
+                printf("Usage: tick [<sensor> [every <n>] [offset <us> | auto] | off]\n");
+                return;
+            }
+        }
+        for (int n = 2; n + 1 < argc; n += 2) {
+            if (strcmp(argv[n], "every") == 0) {
+                every = strtoul(argv[n+1], 0, 0);
+            }
+            else if ((strcmp(argv[n], "offset") == 0) && (strcmp(argv[n+1], "auto") != 0)) {
+                offset = strtol(argv[n+1], 0, 0);
+            }
+        }
+        sensorTick_start((uint8_t)id, every, offset, 0, 0);
+    }
+
+    if (tickId == 0) {
+        printf("Tick off\n");
+        return;
+    }
+    sensorTick_getStats(&s);
+    printf("Tick on sensor %u every %u, offset %d us%s: %s\n",
+           tickId, (unsigned)tickEvery, (int)s.offset_us,
+           (tickOffset_us == SENSOR_TICK_OFFSET_AUTO) ? " (auto)" : "",
+           s.locked ? "locked" : (running ? "coasting" : "locking"));
+    printf("  period %u.%03u us, phase error %d us, arrival latency %u us\n",
+           (unsigned)(period_q8 >> Q8), (unsigned)(((period_q8 & ((1 << Q8) - 1)) * 1000) >> Q8),
+           (int)lastErr_uS, (unsigned)latency_us);
+    printf("  %u ticks, sample age %u us (min %u, mean %u, max %u), %u late, %u unlocks\n",
+           (unsigned)s.ticks, (unsigned)s.lastAge_us, (unsigned)s.minAge_us,
+           (unsigned)s.meanAge_us, (unsigned)s.maxAge_us, (unsigned)s.late, (unsigned)unlocks);
+}
+
+#endif
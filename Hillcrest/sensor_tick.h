@@ -0,0 +1,121 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Control-loop tick phase-locked to a sensor's samples.
+ *
+ * A control task on a timer of its own drifts against the hub's sample
+ * clock, so the sample it picks up is anywhere from fresh to a whole
+ * interval old.  This service calls a callback once per sample (or every
+ * Nth) of a chosen sensor, a fixed offset after the instant the hub
+ * takes it, so the newest sample is always just in and always equally
+ * old.
+ *
+ * As in sensor_strobe.h, the sample instants are the sensor's report
+ * timestamps on the host timebase, and a second-order loop tracks their
+ * period and phase.  TIM4 wakes the tick task at each predicted instant
+ * plus the offset, and the task calls the callback.  The offset should
+ * cover the INTN to sensor task latency; in auto mode it follows that
+ * latency (a decaying maximum of the arrival times) plus
+ * SENSOR_TICK_MARGIN_US.
+ *
+ * Ticks start once the loop has locked (as the strobe) and carry on at
+ * the tracked period through gaps, re-locking on the samples after; a
+ * rate change stops them until the loop settles again.  At each tick
+ * the age of the sensor's newest sample is measured: "tick" shows its
+ * mean and spread, and the ticks that found the sample not yet in.
+ */
+
+#ifndef SENSOR_TICK_H
+#define SENSOR_TICK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Build in the tick service (takes TIM4 and its interrupt)
+#ifndef SENSOR_TICK
+#define SENSOR_TICK (1)
+#endif
+
+// Margin over the measured arrival latency in auto mode [us]
+#ifndef SENSOR_TICK_MARGIN_US
+#define SENSOR_TICK_MARGIN_US (100)
+#endif
+
+// Loop gains: 1/N of each phase error corrects the phase, 1/N of it
+// the period
+#ifndef SENSOR_TICK_PHASE_GAIN
+#define SENSOR_TICK_PHASE_GAIN (8)
+#endif
+#ifndef SENSOR_TICK_FREQ_GAIN
+#define SENSOR_TICK_FREQ_GAIN (64)
+#endif
+
+// Lock: phase error under LOCK_US for LOCK_SAMPLES samples in a row
+#ifndef SENSOR_TICK_LOCK_US
+#define SENSOR_TICK_LOCK_US (50)
+#endif
+#ifndef SENSOR_TICK_LOCK_SAMPLES
+#define SENSOR_TICK_LOCK_SAMPLES (16)
+#endif
+
+#ifndef SENSOR_TICK_STACK
+#define SENSOR_TICK_STACK (256)
+#endif
+
+// Offset that follows the arrival latency
+#define SENSOR_TICK_OFFSET_AUTO (INT32_MIN)
+
+// Callback, in the tick task: sample_uS is the instant of the sample
+// this tick follows, on the timebase_getUs() clock.
+typedef void (SensorTickFn_t)(void *cookie, uint64_t sample_uS);
+
+// Age of the newest sample at the ticks since the last start
+typedef struct {
+    uint32_t ticks;
+    uint32_t late;            // the sample ticked for wasn't in yet
+    uint32_t lastAge_us;
+    uint32_t minAge_us;
+    uint32_t maxAge_us;
+    uint32_t meanAge_us;
+    int32_t offset_us;        // in use
+    bool locked;
+} SensorTickStats_t;
+
+#if SENSOR_TICK
+
+// Start the tick task, register the "tick" command and subscribe to
+// every sensor.
+void sensorTick_init(void);
+
+// Call fn (NULL: only measure) offset_us after every `every`th sample
+// of sensorId, 0 to stop.  offset_us may be SENSOR_TICK_OFFSET_AUTO.
+void sensorTick_start(uint8_t sensorId, uint32_t every, int32_t offset_us,
+                      SensorTickFn_t *fn, void *cookie);
+
+void sensorTick_getStats(SensorTickStats_t *pStats);
+
+// Call from TIM4_IRQHandler.
+void sensorTick_irq(void);
+
+#else
+
+#define sensorTick_init()
+
+#endif
+
+#endif
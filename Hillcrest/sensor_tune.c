@@ -0,0 +1,298 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Change-sensitivity tuner.
+ */
+
+#include "sensor_tune.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "sh2.h"
+#include "shell.h"
+#include "sysstats.h"
+#include "sensor_dispatch.h"
+#include "sensor_output.h"
+#include "sensor_budget.h"
+#include "priorities.h"
+
+// Scale factors are Q8, and a step at most halves or doubles
+#define SCALE_ONE (256)
+
+// ------------------------------------------------------------------------
+// Private types
+
+typedef struct {
+    uint32_t reports;       // this window
+    uint32_t residualSum;   // largest field change between reports [LSB]
+    int16_t last[4];        // fields of the previous report
+    bool lastValid;
+    bool tunable;           // decoded fields to compare, sensitivity applies
+    volatile uint16_t sensitivity;
+} TuneSensor_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void tuneEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix);
+static unsigned fields(const SensorFix_t *pFix, int16_t *v);
+static void adjust(uint32_t elapsed_ms);
+static void restart(void);
+static void tuneCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static SensorTuneChangedFn_t *changedFn;
+static volatile uint32_t target = SENSOR_TUNE_TARGET;
+static volatile bool targetBytes = SENSOR_TUNE_BYTES;
+static volatile bool restartNeeded = true;
+
+// Written by the sensor task; the shell reads without locking
+static TuneSensor_t tune[SH2_MAX_SENSOR_ID+1];
+static uint64_t windowStart_uS;     // 0: no window open
+static uint32_t lastLoad;           // per second, in the last window
+static uint32_t adjustments;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void sensorTune_init(SensorTuneChangedFn_t *changed)
+{
+    changedFn = changed;
+    sysstats_addMemory("sensor tune", sizeof(tune));
+    shell_addCommand("tune", "[off | <target> [reports]] change sensitivity for a bandwidth target",
+                     tuneCmd);
+    sensorDispatch_subscribe(SENSOR_DISPATCH_ALL, PRIO_SUB_TUNE, tuneEvent, 0);
+}
+
+void sensorTune_setTarget(uint32_t t, bool bytes)
+{
+    taskENTER_CRITICAL();
+    target = t;
+    targetBytes = bytes;
+    taskEXIT_CRITICAL();
+
+    // The sensor task clears the window and the sensitivities
+    restartNeeded = true;
+    for (int n = 0; n <= SH2_MAX_SENSOR_ID; n++) {
+        tune[n].sensitivity = 0;
+    }
+    if (changedFn != 0) {
+        changedFn();
+    }
+}
+
+uint32_t sensorTune_target(bool *pBytes)
+{
+    taskENTER_CRITICAL();
+    uint32_t t = target;
+    *pBytes = targetBytes;
+    taskEXIT_CRITICAL();
+
+    return t;
+}
+
+uint16_t sensorTune_sensitivity(uint8_t sensorId, uint16_t sensitivity)
+{
+    if ((target == 0) || (sensorId > SH2_MAX_SENSOR_ID)) {
+        return sensitivity;
+    }
+
+    uint16_t tuned = tune[sensorId].sensitivity;
+    return (tuned > sensitivity) ? tuned : sensitivity;
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+// Dispatch callback, in the sensor task
+static void tuneEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix)
+{
+    if (target == 0) {
+        return;
+    }
+    if (restartNeeded) {
+        restartNeeded = false;
+        restart();
+    }
+    if (pEvent->reportId > SH2_MAX_SENSOR_ID) {
+        return;
+    }
+
+    TuneSensor_t *s = &tune[pEvent->reportId];
+    int16_t v[4];
+    unsigned n = (pFix != 0) ? fields(pFix, v) : 0;
+
+    s->reports++;
+    s->tunable = (n != 0);
+    if (n != 0) {
+        if (s->lastValid) {
+            uint32_t residual = 0;
+            for (unsigned f = 0; f < n; f++) {
+                uint32_t d = abs(v[f] - s->last[f]);
+                if (d > residual) {
+                    residual = d;
+                }
+            }
+            s->residualSum += residual;
+        }
+        memcpy(s->last, v, n * sizeof(v[0]));
+        s->lastValid = true;
+    }
+
+    if (windowStart_uS == 0) {
+        windowStart_uS = pEvent->timestamp_uS;
+    }
+    else if (pEvent->timestamp_uS - windowStart_uS >= (uint64_t)SENSOR_TUNE_WINDOW_MS * 1000) {
+        adjust((uint32_t)((pEvent->timestamp_uS - windowStart_uS) / 1000));
+        windowStart_uS = pEvent->timestamp_uS;
+    }
+}
+
+// The fields change sensitivity is judged on, in v; 0 if none
+static unsigned fields(const SensorFix_t *pFix, int16_t *v)
+{
+    switch (pFix->kind) {
+        case SENSORFIX_VEC3:
+        case SENSORFIX_RAW:
+            v[0] = pFix->un.vec3.x;
+            v[1] = pFix->un.vec3.y;
+            v[2] = pFix->un.vec3.z;
+            return 3;
+        case SENSORFIX_QUAT:
+            v[0] = pFix->un.quat.i;
+            v[1] = pFix->un.quat.j;
+            v[2] = pFix->un.quat.k;
+            v[3] = pFix->un.quat.real;
+            return 4;
+        default:
+            // GIRV has no change sensitivity on the hub
+            return 0;
+    }
+}
+
+// End of a window: move the sensitivities towards the target
+static void adjust(uint32_t elapsed_ms)
+{
+    OutputMode_t mode = sensorOutput_getMode();
+    uint64_t units = 0;
+    bool changed = false;
+
+    for (int n = 1; n <= SH2_MAX_SENSOR_ID; n++) {
+        units += (uint64_t)tune[n].reports *
+                 (targetBytes ? sensorBudget_outputLen(n, mode) : 1);
+    }
+    lastLoad = (uint32_t)(units * 1000 / elapsed_ms);
+
+    uint32_t t = target;
+    uint32_t scale = (t != 0) ? (uint32_t)(((uint64_t)lastLoad * SCALE_ONE) / t) : SCALE_ONE;
+    bool up = (uint64_t)lastLoad * 100 > (uint64_t)t * (100 + SENSOR_TUNE_HYST_PCT);
+    bool down = (uint64_t)lastLoad * 100 < (uint64_t)t * (100 - SENSOR_TUNE_HYST_PCT);
+    if (scale > 2*SCALE_ONE) scale = 2*SCALE_ONE;
+    if (scale < SCALE_ONE/2) scale = SCALE_ONE/2;
+
+    for (int n = 1; n <= SH2_MAX_SENSOR_ID; n++) {
+        TuneSensor_t *s = &tune[n];
+        uint32_t sens = s->sensitivity;
+
+        if (!s->tunable) {
+            continue;
+        }
+        if (up && (s->reports > 1)) {
+            if (sens == 0) {
+                // Start from the residual: about half the reports go
+                sens = s->residualSum / (2 * (s->reports - 1));
+                if (sens == 0) {
+                    sens = 1;
+                }
+            }
+            else {
+                uint32_t next = (sens * scale + SCALE_ONE - 1) / SCALE_ONE;
+                sens = (next > sens) ? next : sens + 1;
+            }
+        }
+        else if (down && (sens != 0)) {
+            sens = (sens * scale) / SCALE_ONE;
+        }
+        if (sens > SENSOR_TUNE_MAX) {
+            sens = SENSOR_TUNE_MAX;
+        }
+
+        if (sens != s->sensitivity) {
+            s->sensitivity = (uint16_t)sens;
+            changed = true;
+        }
+    }
+    for (int n = 1; n <= SH2_MAX_SENSOR_ID; n++) {
+        tune[n].reports = 0;
+        tune[n].residualSum = 0;
+    }
+
+    if (changed) {
+        adjustments++;
+        if (changedFn != 0) {
+            changedFn();
+        }
+    }
+}
+
+static void restart(void)
+{
+    for (int n = 0; n <= SH2_MAX_SENSOR_ID; n++) {
+        tune[n].reports = 0;
+        tune[n].residualSum = 0;
+        tune[n].lastValid = false;
+    }
+    windowStart_uS = 0;
+    lastLoad = 0;
+}
+
+// Shell command: set the target, or show the tuned sensitivities.
+static void tuneCmd(int argc, char *argv[])
+{
+    if (argc > 1) {
+        if (strcmp(argv[1], "off") == 0) {
+            sensorTune_setTarget(0, targetBytes);
+        }
+        else if (strtoul(argv[1], 0, 0) != 0) {
+            bool reports = (argc > 2) && (strcmp(argv[2], "reports") == 0);
+            sensorTune_setTarget(strtoul(argv[1], 0, 0), !reports);
+        }
+        else {
+            printf("usage: %s [off | <target> [reports]]\n", argv[0]);
+            return;
+        }
+    }
+
+    const char *unit = targetBytes ? "bytes/s" : "reports/s";
+    if (target == 0) {
+        printf("Sensitivity tuner off\n");
+        return;
+    }
+    printf("Sensitivity tuner: target %u %s, last %u, %u adjustments\n",
+           (unsigned)target, unit, (unsigned)lastLoad, (unsigned)adjustments);
+    for (int n = 1; n <= SH2_MAX_SENSOR_ID; n++) {
+        if (tune[n].tunable) {
+            printf("  sensor %d: %u LSB\n", n, tune[n].sensitivity);
+        }
+    }
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Change-sensitivity tuner.
+ *
+ * Holds the reports output within a target, in bytes per second on the
+ * output link (sensor_budget.h sizes each report in the current format)
+ * or in reports per second, by raising each sensor's absolute change
+ * sensitivity on the hub: a report at the subscribed interval is only
+ * sent once a field moved by more than that many LSBs.  Slow-changing
+ * sensors then stop repeating themselves, and the link carries the
+ * samples that moved.
+ *
+ * Every SENSOR_TUNE_WINDOW_MS of reports, the load seen is compared to
+ * the target.  Over it, each tuned sensor's sensitivity is scaled up by
+ * load/target (at most doubled); a sensor still at 0 starts at half the
+ * mean change between its reports, its residual.  Well under target,
+ * they scale down again, to 0.  Sensors with no fixed-point decode, the
+ * Gyro Integrated RV and wakeup subscriptions are left alone.  The
+ * sensor app resends the subscriptions on each change
+ * (sensorTune_sensitivity()).
+ */
+
+#ifndef SENSOR_TUNE_H
+#define SENSOR_TUNE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Target at startup: 0 for off
+#ifndef SENSOR_TUNE_TARGET
+#define SENSOR_TUNE_TARGET (0)
+#endif
+
+// ... in output bytes per second (1), or in reports per second (0)
+#ifndef SENSOR_TUNE_BYTES
+#define SENSOR_TUNE_BYTES (1)
+#endif
+
+// Reports observed per adjustment [ms]
+#ifndef SENSOR_TUNE_WINDOW_MS
+#define SENSOR_TUNE_WINDOW_MS (1000)
+#endif
+
+// Band around the target left alone [%]
+#ifndef SENSOR_TUNE_HYST_PCT
+#define SENSOR_TUNE_HYST_PCT (10)
+#endif
+
+// Highest sensitivity set [LSB]
+#ifndef SENSOR_TUNE_MAX
+#define SENSOR_TUNE_MAX (4096)
+#endif
+
+// Called when sensorTune_sensitivity() changes, from the sensor task
+// (an adjustment) or the shell task ("tune").
+typedef void (SensorTuneChangedFn_t)(void);
+
+// Register the "tune" command and subscribe to every sensor.
+void sensorTune_init(SensorTuneChangedFn_t *changed);
+
+// Aim for target bytes (or reports, bytes false) per second, 0 for off.
+// Tuned sensitivities restart from 0.
+void sensorTune_setTarget(uint32_t target, bool bytes);
+
+// The target (0: off), and in *pBytes whether it is in bytes per second.
+uint32_t sensorTune_target(bool *pBytes);
+
+// Sensitivity to configure sensorId with, for a subscription asking for
+// sensitivity [LSB]: the larger of the two while tuning.
+uint16_t sensorTune_sensitivity(uint8_t sensorId, uint16_t sensitivity);
+
+#endif
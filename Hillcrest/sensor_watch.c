@@ -0,0 +1,396 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Pipeline liveness and latency monitor.  See sensor_watch.h.
+ */
+
+#include "sensor_watch.h"
+
+#if SENSOR_WATCH
+
+#include <stdio.h>
+#include <string.h>
+#include "stm32f4xx.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "cmsis_os.h"
+#include "sh2.h"
+#include "sh2_err.h"
+#include "sh2_hal_registry.h"
+#include "sensor_app.h"
+#include "latency.h"
+#include "timebase.h"
+#include "shell.h"
+#include "sysstats.h"
+#include "rtos_static.h"
+#include "priorities.h"
+
+#ifndef SENSOR_WATCH_STACK
+#define SENSOR_WATCH_STACK (192)
+#endif
+
+#define PERIOD_TICKS (pdMS_TO_TICKS(SENSOR_WATCH_PERIOD_MS))
+
+// IWDG keys, and the prescaler: LSI (~32kHz) / 64, 2ms a count
+#define IWDG_KEY_UNLOCK  (0x5555)
+#define IWDG_KEY_RELOAD  (0xAAAA)
+#define IWDG_KEY_START   (0xCCCC)
+#define IWDG_PR_DIV64    (IWDG_PR_PR_2)
+#define IWDG_MS_PER_COUNT (2)
+
+// ------------------------------------------------------------------------
+// Private types
+
+typedef enum {
+    STEP_NONE = 0,
+    STEP_RESTART,         // resend the subscriptions
+    STEP_HUB_RESET,       // HAL and hub
+    STEP_MCU_RESET,       // watchdog
+} WatchStep_t;
+
+typedef enum {
+    BREACH_NONE = 0,
+    BREACH_STALE,         // a sensor stopped reporting
+    BREACH_P50,           // latency objectives missed
+    BREACH_P99,
+    BREACH_RECOVERY,      // the hub didn't come back from a reset
+} Breach_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void watchTask(const void *params);
+static Breach_t check(TickType_t now, uint8_t *pSensor);
+static Breach_t checkLatency(void);
+static void escalate(Breach_t breach, uint8_t sensorId);
+static void iwdgStart(void);
+static void iwdgRefresh(void);
+static void watchCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static const char * const breachName[] = {
+    [BREACH_NONE] = "none",
+    [BREACH_STALE] = "stale",
+    [BREACH_P50] = "p50",
+    [BREACH_P99] = "p99",
+    [BREACH_RECOVERY] = "recovery",
+};
+
+static const char * const stepName[] = {
+    [STEP_NONE] = "none",
+    [STEP_RESTART] = "restart reports",
+    [STEP_HUB_RESET] = "hub reset",
+    [STEP_MCU_RESET] = "mcu reset",
+};
+
+RTOS_STACK_DEF(watchTaskStack, SENSOR_WATCH_STACK);
+
+// Written by the sensor task.  seen is cleared by the watch task while
+// the pipeline isn't running, so sensors are only held to their limits
+// once they have reported again.
+static volatile TickType_t lastTick[SH2_MAX_SENSOR_ID + 1];
+static volatile bool seen[SH2_MAX_SENSOR_ID + 1];
+
+// Latency over the current period, and the one before: the sensor task
+// adds to hist[cur], the watch task reads the other.  A sample added
+// just as they swap may land in either.
+static LatHist_t hist[2];
+static volatile unsigned cur;
+
+static volatile bool held;
+static bool running;              // reports expected
+static TickType_t runningSince;
+static TickType_t stoppedSince;
+
+// Escalation
+static unsigned strikes;
+static WatchStep_t step;
+static TickType_t stepTick;       // of the last step taken
+static TickType_t healthyTick;    // of the last breach, or step
+
+// For the command
+static Breach_t lastBreach;
+static uint8_t lastSensor;
+static uint32_t lastBreach_ms;
+static uint32_t lastP50, lastP99;
+static uint32_t breaches;
+static uint32_t restarts;
+static uint32_t hubResets;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void sensorWatch_init(void)
+{
+    latency_histClear(&hist[0]);
+    latency_histClear(&hist[1]);
+
+    osThreadDef(watchThreadDef, watchTask, PRIO_TASK_WATCH, 0, SENSOR_WATCH_STACK);
+    if (rtos_threadCreate(osThread(watchThreadDef), NULL, RTOS_STACK(watchTaskStack)) == NULL) {
+        printf("Failed to create watch task.\n");
+        return;
+    }
+
+    sysstats_addMemory("watch hists", sizeof(hist));
+    sysstats_addCounter("watch breaches", &breaches);
+    sysstats_addCounter("watch restarts", &restarts);
+    sysstats_addCounter("watch hub resets", &hubResets);
+    shell_addCommand("watch", "pipeline liveness and latency objectives", watchCmd);
+}
+
+void sensorWatch_sample(uint8_t sensorId, uint64_t intn_uS)
+{
+    uint64_t now_uS = timebase_getUs();
+
+    if (sensorId <= SH2_MAX_SENSOR_ID) {
+        lastTick[sensorId] = xTaskGetTickCount();
+        seen[sensorId] = true;
+    }
+    latency_histAdd(&hist[cur], (now_uS > intn_uS) ? (uint32_t)(now_uS - intn_uS) : 0);
+}
+
+void sensorWatch_hold(bool hold)
+{
+    held = hold;
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static void watchTask(const void *params)
+{
+    TickType_t wake = xTaskGetTickCount();
+
+    healthyTick = wake;
+    stoppedSince = wake;
+    iwdgStart();
+
+    for (;;) {
+        vTaskDelayUntil(&wake, PERIOD_TICKS);
+        iwdgRefresh();
+
+        TickType_t now = xTaskGetTickCount();
+        uint8_t sensorId = 0;
+        Breach_t breach = check(now, &sensorId);
+
+        if (breach == BREACH_NONE) {
+            strikes = 0;
+            if ((step != STEP_NONE) &&
+                (now - healthyTick >= pdMS_TO_TICKS(SENSOR_WATCH_CLEAR_MS))) {
+                step = STEP_NONE;
+            }
+            continue;
+        }
+
+        breaches++;
+        healthyTick = now;
+        lastBreach = breach;
+        lastSensor = sensorId;
+        lastBreach_ms = (uint32_t)(timebase_getUs() / 1000);
+
+        // Give the last step time to work
+        if ((step != STEP_NONE) &&
+            (now - stepTick < pdMS_TO_TICKS(SENSOR_WATCH_SETTLE_MS))) {
+            continue;
+        }
+        if (++strikes >= SENSOR_WATCH_STRIKES) {
+            strikes = 0;
+            escalate(breach, sensorId);
+            stepTick = now;
+        }
+    }
+}
+
+// Judge the last period.  Returns the first breach found, and the sensor
+// if it is one going stale.
+static Breach_t check(TickType_t now, uint8_t *pSensor)
+{
+    bool wasRunning = running;
+
+    // The latency window closes whatever happens to it
+    Breach_t latency = checkLatency();
+
+    running = !sensorApp_recovering() && !sensorApp_asleep();
+    if (!running) {
+        if (wasRunning) {
+            stoppedSince = now;
+        }
+        memset((void *)seen, 0, sizeof(seen));
+        if (!held && !sensorApp_asleep() &&
+            (now - stoppedSince >= pdMS_TO_TICKS(SENSOR_WATCH_RECOVER_MS))) {
+            return BREACH_RECOVERY;
+        }
+        return BREACH_NONE;
+    }
+    if (!wasRunning) {
+        runningSince = now;
+    }
+    if (held) {
+        return BREACH_NONE;
+    }
+
+    for (unsigned id = 1; id <= SH2_MAX_SENSOR_ID; id++) {
+        uint32_t quiet_us = sensorApp_quietLimit((uint8_t)id);
+
+        if (quiet_us == 0) {
+            // Not subscribed, or on change: start over if it comes back
+            seen[id] = false;
+            continue;
+        }
+        if (!seen[id]) {
+            continue;
+        }
+
+        uint32_t limit_ms = (quiet_us / 1000) * SENSOR_WATCH_STALE_X;
+        if (limit_ms < SENSOR_WATCH_STALE_MIN_MS) {
+            limit_ms = SENSOR_WATCH_STALE_MIN_MS;
+        }
+        TickType_t last = lastTick[id];
+        if ((now - runningSince) < (now - last)) {
+            last = runningSince;
+        }
+        if (now - last > pdMS_TO_TICKS(limit_ms)) {
+            *pSensor = (uint8_t)id;
+            return BREACH_STALE;
+        }
+    }
+
+    return latency;
+}
+
+// Swap the latency windows and judge the one just closed
+static Breach_t checkLatency(void)
+{
+    LatHist_t *h = &hist[cur];
+    Breach_t breach = BREACH_NONE;
+
+    cur ^= 1;
+    if (h->count >= SENSOR_WATCH_MIN_SAMPLES) {
+        lastP50 = latency_histPercentile(h, 50);
+        lastP99 = latency_histPercentile(h, 99);
+        if (lastP50 > SENSOR_WATCH_SLO_P50_US) {
+            breach = BREACH_P50;
+        }
+        else if (lastP99 > SENSOR_WATCH_SLO_P99_US) {
+            breach = BREACH_P99;
+        }
+    }
+    latency_histClear(h);
+
+    return running ? breach : BREACH_NONE;
+}
+
+// Take the next recovery step
+static void escalate(Breach_t breach, uint8_t sensorId)
+{
+    if (step < STEP_MCU_RESET) {
+        step = (WatchStep_t)(step + 1);
+    }
+
+    printf("Watch: %s breach", breachName[breach]);
+    if (breach == BREACH_STALE) {
+        printf(" (sensor %u)", sensorId);
+    }
+    printf(", %s.\n", stepName[step]);
+
+    switch (step) {
+        case STEP_RESTART:
+            restarts++;
+            sensorApp_restartReports();
+            break;
+
+        case STEP_HUB_RESET:
+            hubResets++;
+            if (sh2_hal_devRestart(0) != SH2_OK) {
+                printf("Watch: hub reset failed.\n");
+            }
+            break;
+
+        default:
+            // Let the console drain, then stop feeding the watchdog
+            vTaskDelay(pdMS_TO_TICKS(100));
+#if SENSOR_WATCH_IWDG
+            for (;;) {
+                vTaskDelay(portMAX_DELAY);
+            }
+#else
+            NVIC_SystemReset();
+#endif
+            break;
+    }
+}
+
+static void iwdgStart(void)
+{
+#if SENSOR_WATCH_IWDG
+    // Stop the count while the core is halted in the debugger
+    DBGMCU->APB1FZ |= DBGMCU_APB1_FZ_DBG_IWDG_STOP;
+
+    IWDG->KR = IWDG_KEY_UNLOCK;
+    IWDG->PR = IWDG_PR_DIV64;
+    IWDG->RLR = SENSOR_WATCH_IWDG_MS / IWDG_MS_PER_COUNT;
+    IWDG->KR = IWDG_KEY_RELOAD;
+    IWDG->KR = IWDG_KEY_START;
+#endif
+}
+
+static void iwdgRefresh(void)
+{
+#if SENSOR_WATCH_IWDG
+    IWDG->KR = IWDG_KEY_RELOAD;
+#endif
+}
+
+static void watchCmd(int argc, char *argv[])
+{
+    TickType_t now = xTaskGetTickCount();
+
+    printf("Pipeline %s%s, step %s, %u breaches (%u restarts, %u hub resets).\n",
+           running ? "running" : "stopped", held ? " (held)" : "",
+           stepName[step], (unsigned)breaches, (unsigned)restarts, (unsigned)hubResets);
+    printf("Latency p50 %u us (objective %u), p99 %u us (objective %u).\n",
+           (unsigned)lastP50, (unsigned)SENSOR_WATCH_SLO_P50_US,
+           (unsigned)lastP99, (unsigned)SENSOR_WATCH_SLO_P99_US);
+    if (lastBreach != BREACH_NONE) {
+        printf("Last breach: %s", breachName[lastBreach]);
+        if (lastBreach == BREACH_STALE) {
+            printf(" (sensor %u)", lastSensor);
+        }
+        printf(" at %u ms.\n", (unsigned)lastBreach_ms);
+    }
+
+    printf("sensor  quiet us   age ms\n");
+    for (unsigned id = 1; id <= SH2_MAX_SENSOR_ID; id++) {
+        uint32_t quiet_us = sensorApp_quietLimit((uint8_t)id);
+
+        if (quiet_us == 0) {
+            continue;
+        }
+        if (seen[id]) {
+            printf("%6u %9u %8u\n", id, (unsigned)quiet_us,
+                   (unsigned)((now - lastTick[id]) * portTICK_PERIOD_MS));
+        }
+        else {
+            printf("%6u %9u %8s\n", id, (unsigned)quiet_us, "-");
+        }
+    }
+}
+
+#endif
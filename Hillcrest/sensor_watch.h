@@ -0,0 +1,129 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Pipeline liveness and latency monitor.
+ *
+ * A watch task checks every SENSOR_WATCH_PERIOD_MS that
+ *   - each subscribed sensor has reported within SENSOR_WATCH_STALE_X
+ *     of its quiet limit (interval, or batch interval) and at least
+ *     SENSOR_WATCH_STALE_MIN_MS; sensors that only report on change,
+ *     and sensors not yet heard from since the last reset, aren't held
+ *     to it;
+ *   - INTN to sensor task latency over the period meets the p50 and
+ *     p99 objectives (given enough samples to tell);
+ *   - reset recovery doesn't take longer than SENSOR_WATCH_RECOVER_MS.
+ * Nothing is expected while the hub is configured or in deep sleep.
+ *
+ * SENSOR_WATCH_STRIKES breached checks in a row take one recovery step,
+ * each stronger than the last:
+ *   1. resend the subscription table;
+ *   2. reset the HAL and the hub (sh2_hal_devRestart());
+ *   3. reset the MCU: the watch stops refreshing the independent
+ *      watchdog, which also fires if the watch task itself stops
+ *      running.  A warm boot then resumes where it was.
+ * After a step, the pipeline has SENSOR_WATCH_SETTLE_MS to come back
+ * before it is judged again; SENSOR_WATCH_CLEAR_MS without a breach
+ * steps back down.  "watch" shows the state.
+ */
+
+#ifndef SENSOR_WATCH_H
+#define SENSOR_WATCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Set to 0 to leave the monitor out.
+#ifndef SENSOR_WATCH
+#define SENSOR_WATCH (1)
+#endif
+
+// Check period [ms], also the latency window
+#ifndef SENSOR_WATCH_PERIOD_MS
+#define SENSOR_WATCH_PERIOD_MS (500)
+#endif
+
+// Freshness: quiet limits a sensor may miss, and the least time [ms]
+#ifndef SENSOR_WATCH_STALE_X
+#define SENSOR_WATCH_STALE_X (4)
+#endif
+#ifndef SENSOR_WATCH_STALE_MIN_MS
+#define SENSOR_WATCH_STALE_MIN_MS (500)
+#endif
+
+// Latency objectives, INTN to the sensor task [us], and the samples a
+// window needs for them to be judged
+#ifndef SENSOR_WATCH_SLO_P50_US
+#define SENSOR_WATCH_SLO_P50_US (2000)
+#endif
+#ifndef SENSOR_WATCH_SLO_P99_US
+#define SENSOR_WATCH_SLO_P99_US (10000)
+#endif
+#ifndef SENSOR_WATCH_MIN_SAMPLES
+#define SENSOR_WATCH_MIN_SAMPLES (20)
+#endif
+
+// Longest reset recovery, hub reset to streaming [ms]
+#ifndef SENSOR_WATCH_RECOVER_MS
+#define SENSOR_WATCH_RECOVER_MS (5000)
+#endif
+
+// Escalation: breached checks in a row per step, time given to each
+// step to work [ms], and time without a breach to step back down [ms]
+#ifndef SENSOR_WATCH_STRIKES
+#define SENSOR_WATCH_STRIKES (3)
+#endif
+#ifndef SENSOR_WATCH_SETTLE_MS
+#define SENSOR_WATCH_SETTLE_MS (5000)
+#endif
+#ifndef SENSOR_WATCH_CLEAR_MS
+#define SENSOR_WATCH_CLEAR_MS (30000)
+#endif
+
+// Run the independent watchdog, refreshed by the watch task, with this
+// timeout [ms, at most 8000].  Frozen while the debugger halts the core.
+// Without it the last step is a software reset.
+#ifndef SENSOR_WATCH_IWDG
+#define SENSOR_WATCH_IWDG (1)
+#endif
+#ifndef SENSOR_WATCH_IWDG_MS
+#define SENSOR_WATCH_IWDG_MS (2000)
+#endif
+
+#if SENSOR_WATCH
+
+// Start the watch task and the watchdog, and register the "watch"
+// command.  Call from the demo task, before the hub is started.
+void sensorWatch_init(void);
+
+// A report of sensorId, whose INTN was at intn_uS, reached the sensor
+// task.  Sensor task only.
+void sensorWatch_sample(uint8_t sensorId, uint64_t intn_uS);
+
+// Stop judging the pipeline while hold is set (DFU, long hub
+// operations).  The watchdog is still refreshed.
+void sensorWatch_hold(bool hold);
+
+#else
+
+#define sensorWatch_init()
+#define sensorWatch_sample(sensorId, intn_uS)
+#define sensorWatch_hold(hold)
+
+#endif
+
+#endif
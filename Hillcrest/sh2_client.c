@@ -0,0 +1,133 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Clients of the SH-2 API: a mutex in front of the library, and a block
+ * semaphore per client.
+ */
+
+#include "sh2_client.h"
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include "task.h"
+#include "shell.h"
+#include "timebase.h"
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void clientsCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static SemaphoreHandle_t apiMutex;
+static sh2Client_t * volatile owner;     // client holding apiMutex
+static sh2Client_t *clients;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void sh2Client_init(void)
+{
+    apiMutex = xSemaphoreCreateMutex();
+    shell_addCommand("clients", "[reset] tasks using the SH-2 API, and their waits", clientsCmd);
+}
+
+void sh2Client_open(sh2Client_t *pClient, const char *name)
+{
+    pClient->name = name;
+    pClient->blockSem = xSemaphoreCreateBinary();
+    pClient->uses = 0;
+    pClient->contended = 0;
+    pClient->maxWait_us = 0;
+    pClient->maxHold_us = 0;
+
+    taskENTER_CRITICAL();
+    pClient->next = clients;
+    clients = pClient;
+    taskEXIT_CRITICAL();
+}
+
+void sh2Client_begin(sh2Client_t *pClient)
+{
+    uint64_t start_uS = timebase_getUs();
+    bool contended = false;
+
+    if (xSemaphoreTake(apiMutex, 0) != pdTRUE) {
+        contended = true;
+        xSemaphoreTake(apiMutex, portMAX_DELAY);
+    }
+    pClient->begin_uS = timebase_getUs();
+
+    // Drop an unblock left over from a response that came in late
+    xSemaphoreTake(pClient->blockSem, 0);
+    owner = pClient;
+
+    pClient->uses++;
+    if (contended) {
+        uint32_t wait_us = (uint32_t)(pClient->begin_uS - start_uS);
+
+        pClient->contended++;
+        if (wait_us > pClient->maxWait_us) {
+            pClient->maxWait_us = wait_us;
+        }
+    }
+}
+
+void sh2Client_end(sh2Client_t *pClient)
+{
+    uint32_t hold_us = (uint32_t)(timebase_getUs() - pClient->begin_uS);
+
+    if (hold_us > pClient->maxHold_us) {
+        pClient->maxHold_us = hold_us;
+    }
+
+    owner = 0;
+    xSemaphoreGive(apiMutex);
+}
+
+SemaphoreHandle_t sh2Client_blockSem(void)
+{
+    sh2Client_t *pClient = owner;
+
+    return (pClient != 0) ? pClient->blockSem : 0;
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static void clientsCmd(int argc, char *argv[])
+{
+    bool reset = (argc > 1) && (strcmp(argv[1], "reset") == 0);
+
+    printf("  %-10s %8s %9s %10s %10s\n", "client", "uses", "contended", "max wait", "max hold");
+    for (sh2Client_t *pClient = clients; pClient != 0; pClient = pClient->next) {
+        printf("  %-10s %8u %9u %8uus %8uus%s\n",
+               pClient->name, (unsigned)pClient->uses, (unsigned)pClient->contended,
+               (unsigned)pClient->maxWait_us, (unsigned)pClient->maxHold_us,
+               (pClient == owner) ? " *" : "");
+        if (reset) {
+            pClient->uses = 0;
+            pClient->contended = 0;
+            pClient->maxWait_us = 0;
+            pClient->maxHold_us = 0;
+        }
+    }
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Clients of the SH-2 API in more than one task.
+ *
+ * The SH-2 library has one command in flight at a time and blocks its
+ * caller in sh2_hal_block() until the response comes in.  A task that
+ * calls it opens a client once, then brackets its calls with
+ * sh2Client_begin() and sh2Client_end().  Clients queue for the API on a
+ * mutex, in priority order with priority inheritance, and each one
+ * blocks on a semaphore of its own, so a response only wakes the client
+ * whose command it answers.  Calls made outside a client (at startup,
+ * before any is open) block on the shared semaphore as before.
+ */
+
+#ifndef SH2_CLIENT_H
+#define SH2_CLIENT_H
+
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+#include "semphr.h"
+
+typedef struct sh2Client_s {
+    const char *name;
+    SemaphoreHandle_t blockSem;     // sh2_hal_block() of this client
+    struct sh2Client_s *next;       // of all clients opened
+
+    // Statistics, for "clients"
+    uint32_t uses;                  // sh2Client_begin() calls
+    uint32_t contended;             // of those that waited for another client
+    uint32_t maxWait_us;            // longest wait for the API
+    uint32_t maxHold_us;            // longest time between begin and end
+    uint64_t begin_uS;
+} sh2Client_t;
+
+// Create the API lock and register the "clients" command.  Call before
+// any other task opens a client.
+void sh2Client_init(void);
+
+// Set up *pClient, which must stay valid from now on.
+void sh2Client_open(sh2Client_t *pClient, const char *name);
+
+// Wait for the SH-2 API, then call it freely until sh2Client_end().
+// Nests only across different clients: don't begin twice.
+void sh2Client_begin(sh2Client_t *pClient);
+void sh2Client_end(sh2Client_t *pClient);
+
+// Semaphore sh2_hal_block() waits on: the client holding the API's own,
+// or 0 outside any client.  sh2_hal_unblock() gives the same one.
+SemaphoreHandle_t sh2Client_blockSem(void);
+
+#endif
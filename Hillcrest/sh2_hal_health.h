@@ -0,0 +1,73 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * HAL health counters, common to the SPI and I2C HALs.
+ * Nonzero merge, collapse or error counts mean the host is falling behind
+ * the hub, or the bus is unreliable, and the report stream may have gaps.
+ * The bus meter shows how much of the bus the hub's traffic takes: busy
+ * time over the time since the counters were cleared is the headroom
+ * left before adding sensors or raising rates ("util" prints it).
+ */
+
+#ifndef SH2_HAL_HEALTH_H
+#define SH2_HAL_HEALTH_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    typedef struct {
+        uint32_t intns;          // INTN assertions seen
+        uint32_t intnMerged;     // INTNs merged before halTask saw them
+        uint32_t intnCollapsed;  // INTNs folded into one pending transfer (SPI)
+        uint32_t intnRescued;    // INTN found still asserted after a transfer
+                                 // with no edge seen for it, read anyway
+        uint32_t busErrors;      // failed SPI/I2C operations
+        uint32_t truncated;      // packets too long for one transfer, read
+                                 // as continuations
+        uint32_t invalidLen;     // headers with the invalid 0x7FFF length
+
+        // Bus meter
+        uint64_t busyUs;         // CSN asserted (SPI), START to STOP (I2C)
+        uint32_t transfers;
+        uint32_t txBytes;        // host to hub
+        uint32_t rxBytes;        // hub to host (SPI: all bytes clocked in)
+        uint64_t since_uS;       // of the last clear, 0 from boot
+    } sh2_hal_Health_t;
+
+    // For the HALs: count one transfer in the bus meter.
+    static inline void sh2_hal_meter(sh2_hal_Health_t *pHealth, uint32_t busy_uS,
+                                     uint32_t txBytes, uint32_t rxBytes)
+    {
+        pHealth->busyUs += busy_uS;
+        pHealth->transfers++;
+        pHealth->txBytes += txBytes;
+        pHealth->rxBytes += rxBytes;
+    }
+
+    // Snapshot of the counters since init or the last clear.
+    void sh2_hal_getHealth(sh2_hal_Health_t *pHealth);
+    void sh2_hal_clearHealth(void);
+
+#ifdef __cplusplus
+}    // end of extern "C"
+#endif
+
+#endif
@@ -26,9 +26,24 @@
 #include <string.h>
 
 #include "sh2_hal_i2c.h"
+#include "sh2_hal_registry.h"
 #include "sh2_hal.h"
 #include "shtp.h"
 #include "sh2_err.h"
+#include "timebase.h"
+#include "sysstats.h"
+#include "placement.h"
+#include "isr_stamp.h"
+#include "latency.h"
+#include "cycle_budget.h"
+#include "shtp_capture.h"
+#include "rtos_static.h"
+#include "priorities.h"
+#include "shell.h"
+#include "trace.h"
+#include "coredump.h"
+#include "power.h"
+#include "pool.h"
 
 #include "stm32f4xx_hal.h"
 #include "cmsis_os.h"
@@ -37,383 +52,1336 @@
 #include "queue.h"
 #include "semphr.h"
 
-#define DFU_BOOT_DELAY (200) // [mS]
-#define RESET_DELAY    (10) // [mS]
+#define DFU_BOOT_DELAY (200) // [mS] worst case
+#define DFU_BOOT_MIN_DELAY (5) // [mS] before polling for the bootloader
 
-#define MAX_EVENTS (16)
 #define SHTP_HEADER_LEN (4)
 
+// Number of recent packet lengths the read size predictor looks at
+#define LEN_HISTORY (8)
+
 #define ADDR_DFU_0 (0x28)
 #define ADDR_DFU_1 (0x29)
 #define ADDR_SH2_0 (0x4A)
 #define ADDR_SH2_1 (0x4B)
 
+// Device 0: the demo shield's BNO080.  When the SPI HAL is linked too it
+// drives the shield, and device 0 is an auxiliary BNO080 on free pins.
+#if defined(SH2_HAL_SPI)
+#define RSTN_GPIO_PORT GPIOC
+#define RSTN_GPIO_PIN  GPIO_PIN_8
+
+#define BOOTN_GPIO_PORT GPIOC
+#define BOOTN_GPIO_PIN  GPIO_PIN_6
+
+#define INTN_GPIO_PORT GPIOB
+#define INTN_GPIO_PIN  GPIO_PIN_12
+#else
 #define RSTN_GPIO_PORT GPIOB
 #define RSTN_GPIO_PIN  GPIO_PIN_4
 
 #define BOOTN_GPIO_PORT GPIOB
 #define BOOTN_GPIO_PIN  GPIO_PIN_5
 
-// ----------------------------------------------------------------------------------
-// Forward declarations
-// ----------------------------------------------------------------------------------
-static void halTask(const void *params);
-static void i2cReset(void);
-static int i2cBlockingRx(unsigned addr, uint8_t* pData, unsigned len);
-static int i2cBlockingTx(unsigned addr, uint8_t* pData, unsigned len);
-static void rstn0(bool state);
-static void bootn0(bool state);
+#define INTN_GPIO_PORT GPIOA
+#define INTN_GPIO_PIN  GPIO_PIN_10
+#endif
+
+// INTN lines served by EXTI15_10_IRQHandler
+#define INTN_PINS_ALLOWED (GPIO_PIN_10 | GPIO_PIN_11 | GPIO_PIN_12 | \
+                           GPIO_PIN_13 | GPIO_PIN_14 | GPIO_PIN_15)
+
+// Polling a hub without INTN: the phase moves in steps of 1/POLL_STEPS
+// of the interval, and the first poll waits out the hub's boot.
+#define POLL_STEPS (16)
+#define POLL_RESET_US (50000)
 
 // ----------------------------------------------------------------------------------
-// Private data
+// Private types
 // ----------------------------------------------------------------------------------
 
-// I2C Bus access
-static I2C_HandleTypeDef *hi2c;
-static SemaphoreHandle_t i2cMutex;
-static SemaphoreHandle_t i2cBlockSem;
-int i2cStatus;
-bool i2cResetNeeded;
-
-// HAL Queue and Task
-static QueueHandle_t evtQueue = 0;
-osThreadId halTaskHandle;
+// One I2C bus and the HAL task that runs its transfers
+typedef struct {
+    I2C_HandleTypeDef *hi2c;
+    SemaphoreHandle_t mutex;
+    SemaphoreHandle_t blockSem;
+    volatile int status;
+    volatile uint64_t done_uS;  // end of the last transfer
+    bool resetNeeded;
+    uint32_t speed;
+    osThreadId task;
+
+    // SCL and SDA, for clocking out a stuck slave (sclPin 0: unknown)
+    GPIO_TypeDef *pinPort;
+    uint16_t sclPin;
+    uint16_t sdaPin;
+
+    // Bus recovery
+    uint32_t timeouts;     // transfers that never completed
+    uint32_t recoveries;   // clock-out and re-init sequences
+    uint64_t lostUs;       // from start of a failed transfer to recovery
+    uint32_t maxLostUs;
+
+#if SH2_HAL_I2C_COMBINED
+    // Combined read in progress (see SH2_HAL_I2C_COMBINED)
+    uint8_t *combBuf;
+    uint16_t combMax;       // longest read that fits
+    volatile uint16_t combLen;  // length read, once the header is in
+    uint32_t combReads;
+#endif
+} I2cBus_t;
+
+// DFU transfers of one device.  With SH2_HAL_I2C_DFU_FAST a tx copies
+// its packet to txBuf, starts it on DMA and returns holding the bus; the
+// next call waits for it and reports how it went.  Each device has its
+// own, so hubs can be updated at once (dfu_multi.h).
+typedef struct {
+    bool active;                     // in DFU mode
+    sh2_hal_I2cDfuStats_t stats;
+    uint64_t return_uS;              // last return to caller
+#if SH2_HAL_I2C_DFU_FAST
+    uint8_t txBuf[SH2_HAL_MAX_TRANSFER];
+    bool pending;                    // packet in flight, bus held
+    int rc;                          // HAL result of starting it
+    unsigned len;
+    uint64_t start_uS;
+#endif
+} I2cDfu_t;
 
 typedef struct {
-    void (*rstn)(bool);
-    void (*bootn)(bool);
+    sh2_hal_I2cDevice_t wiring;
+    I2cBus_t *bus;
     sh2_rxCallback_t *onRx;
     void *onRxCookie;
     uint16_t addr;
     uint8_t rxBuf[SH2_HAL_MAX_TRANSFER];
     uint16_t rxRemaining;
-    SemaphoreHandle_t blockSem;
+    uint16_t maxTransfer;
+    IsrStamp_t intnStamp;
+    uint32_t intnSeen;
+    unsigned devNum;  // in the registry
+
+    // Read size predictor
+    uint16_t lenHistory[LEN_HISTORY];
+    unsigned lenHistoryIdx;
+    uint32_t readHits;
+    uint32_t readMisses;
+    uint32_t readWasted;
+
+#if SH2_HAL_I2C_REASSEMBLE
+    // Packet being gathered from several reads (0: none)
+    uint8_t *reasm;
+    uint16_t reasmLen;
+    uint64_t reasmT_uS;       // of its first read
+    uint32_t reasmPackets;    // delivered whole
+    uint32_t reasmBroken;     // dropped part way
+    uint32_t reasmPassed;     // continuations delivered as read
+#endif
+
+    I2cDfu_t dfu;
 } Sh2Hal_t;
-Sh2Hal_t sh2Hal;
-
-typedef enum {
-    EVT_INTN,
-} EventId_t;
 
+#if SH2_HAL_I2C_REASSEMBLE
 typedef struct {
-    uint32_t t_ms;
-    EventId_t id;
-} Event_t;
+    uint8_t data[SH2_HAL_I2C_MAX_PACKET];
+} ReasmBuf_t;
+#endif
+
+// ----------------------------------------------------------------------------------
+// Forward declarations
+// ----------------------------------------------------------------------------------
+static int devReset(unsigned unit, bool dfuMode, sh2_rxCallback_t *onRx, void *cookie);
+static int devTx(unsigned unit, uint8_t *pData, uint32_t len);
+static int devRx(unsigned unit, uint8_t *pData, uint32_t len);
+static void getHealth(sh2_hal_Health_t *pHealth);
+static void clearHealth(void);
+static void onIntn(unsigned unit, uint64_t t_uS);
+static void halTask(const void *params);
+static I2cBus_t *addBus(I2C_HandleTypeDef *hi2c);
+static I2cBus_t *findBus(I2C_HandleTypeDef *hi2c);
+static void serviceIntn(Sh2Hal_t *pDev);
+static void recheckIntn(Sh2Hal_t *pDev);
+static void i2cReset(I2cBus_t *pBus);
+static int i2cBlockingRx(Sh2Hal_t *pDev, uint8_t* pData, unsigned len);
+static int i2cBlockingTx(Sh2Hal_t *pDev, uint8_t* pData, unsigned len);
+#if SH2_HAL_I2C_COMBINED
+static int i2cCombinedRx(Sh2Hal_t *pDev, uint8_t *pData, unsigned *pLen);
+static int combinedStart(I2cBus_t *pBus, uint16_t addr);
+static void combinedHdrCplt(DMA_HandleTypeDef *hdma);
+static void combinedCplt(DMA_HandleTypeDef *hdma);
+static void combinedError(DMA_HandleTypeDef *hdma);
+static I2cBus_t *findBusByDma(DMA_HandleTypeDef *hdma);
+#endif
+static int i2cWait(I2cBus_t *pBus, int rc, unsigned len, uint64_t start_uS);
+static void meterXfer(I2cBus_t *pBus, int status, uint64_t start_uS, unsigned txLen, unsigned rxLen);
+static void i2cRecover(I2cBus_t *pBus, uint64_t start_uS);
+static void i2cClockOut(I2cBus_t *pBus);
+static void opDone(I2C_HandleTypeDef *hi2c, int status);
+static void rstn(Sh2Hal_t *pDev, bool state);
+static void bootn(Sh2Hal_t *pDev, bool state);
+static unsigned predictReadLen(Sh2Hal_t *pDev);
+#if SH2_HAL_I2C_REASSEMBLE
+static bool reassemble(Sh2Hal_t *pDev, bool cont, unsigned cargoLen,
+                       uint8_t **ppData, unsigned *pLen, uint64_t *pT_uS);
+static void reasmDrop(Sh2Hal_t *pDev);
+#endif
+static void learnCargoLen(Sh2Hal_t *pDev, unsigned cargoLen, unsigned readLen);
+static void i2cCmd(int argc, char *argv[]);
+static int dfuTx(Sh2Hal_t *pDev, uint8_t *pData, unsigned len);
+static int dfuRx(Sh2Hal_t *pDev, uint8_t *pData, unsigned len);
+static int dfuFinish(Sh2Hal_t *pDev);
+static void dfuWaitBoot(Sh2Hal_t *pDev);
+static void dfuEnter(Sh2Hal_t *pDev);
+static int dfuLeave(Sh2Hal_t *pDev, int status);
+#if SH2_HAL_I2C_POLL
+static void pollAlarm(void);
+static void pollStart(void);
+static void pollStop(void);
+static void pollNext(bool hit);
+#endif
+
+// ----------------------------------------------------------------------------------
+// Private data
+// ----------------------------------------------------------------------------------
+
+static I2cBus_t buses[SH2_HAL_I2C_MAX_BUSES];
+static unsigned numBuses;
+
+// Bus 0's task has a static stack, others come from the heap
+#define HAL_TASK_STACK (SH2_HAL_I2C_STACK)
+RTOS_STACK_DEF(halTaskStack, HAL_TASK_STACK);
+
+DMA_BUF static Sh2Hal_t sh2Hal[SH2_HAL_I2C_MAX_DEVICES];
+static unsigned numDevices;
+
+static sh2_hal_Health_t health;
+static uint32_t busRecoveries;    // all buses
+
+#if SH2_HAL_I2C_REASSEMBLE
+static POOL_STORAGE(reasmBlocks, ReasmBuf_t, SH2_HAL_I2C_REASM_BUFS);
+static Pool_t reasmPool;
+#endif
+
+static const sh2_hal_Transport_t i2cTransport = {
+    .name = "i2c",
+    .reset = devReset,
+    .tx = devTx,
+    .rx = devRx,
+    .getHealth = getHealth,
+    .clearHealth = clearHealth,
+    .onIntn = onIntn,
+};
+
+// Device last reset into DFU mode, for sh2_hal_getI2cDfuStats()
+static Sh2Hal_t *dfuLast = &sh2Hal[0];
+
+#if SH2_HAL_I2C_POLL
+// The device without INTN, read when TIM2's alarm stands in for it.
+// Each cycle starts with a poll at the phase.  Data there is drained by
+// polls back to back, then the next phase comes a quarter step earlier
+// than one interval on.  An empty phase poll is retried a step later,
+// backing off while the hub stays quiet, which moves the phase out.
+static Sh2Hal_t *pollDev;
+static volatile uint32_t pollInterval_us = SH2_HAL_I2C_POLL_IDLE_US;
+static uint64_t pollPhase_uS;        // phase poll of this cycle
+static bool pollDraining;
+static unsigned pollMissRun;         // empty phase polls in a row
+static uint32_t polls;
+static uint32_t pollHits;            // polls that read data
+static uint32_t pollEarly;           // phase polls that found none
+#endif
+
+// Notification bits from ISRs to halTask: one per device
+#define EVT_INTN(unit) (1 << (unit))
+#define EVT_ALL        ((1 << SH2_HAL_I2C_MAX_DEVICES) - 1)
 
 // ----------------------------------------------------------------------------------
 // Public API
 // ----------------------------------------------------------------------------------
 // Initialize SH-2 HAL subsystem
-void sh2_hal_init(I2C_HandleTypeDef* _hi2c) 
+void sh2_hal_i2cInit(I2C_HandleTypeDef* _hi2c) 
 {
-    // Store reference to I2C peripheral
-    hi2c = _hi2c;
+    sh2_hal_I2cDevice_t dev0;
+
+    numBuses = 0;
+    numDevices = 0;
+    memset(buses, 0, sizeof(buses));
+    memset(sh2Hal, 0, sizeof(sh2Hal));
+
+    sysstats_addCounter("I2C INTNs", &health.intns);
+    sysstats_addCounter("I2C INTNs merged", &health.intnMerged);
+    sysstats_addCounter("I2C INTNs collapsed", &health.intnCollapsed);
+    sysstats_addCounter("I2C INTNs rescued", &health.intnRescued);
+    sysstats_addCounter("I2C bus errors", &health.busErrors);
+    sysstats_addCounter("I2C truncated", &health.truncated);
+    sysstats_addCounter("I2C invalid len", &health.invalidLen);
+    sysstats_addCounter("I2C recoveries", &busRecoveries);
+
+    sysstats_addMemory("I2C HAL buffers", sizeof(sh2Hal));
+#if SH2_HAL_I2C_REASSEMBLE
+    pool_init(&reasmPool, "I2C reassembly", reasmBlocks, sizeof(reasmBlocks[0]), SH2_HAL_I2C_REASM_BUFS);
+    sysstats_addMemory("I2C reassembly", sizeof(reasmBlocks));
+#endif
+
+    coredump_addState("I2C status", &buses[0].status, sizeof(buses[0].status));
+    coredump_addState("I2C rx left", &sh2Hal[0].rxRemaining, sizeof(sh2Hal[0].rxRemaining));
+
+    shell_addCommand("i2c", "adaptive read and bus recovery statistics", i2cCmd);
+
+    dev0.hi2c = _hi2c;
+    dev0.rstnPort = RSTN_GPIO_PORT;
+    dev0.rstnPin = RSTN_GPIO_PIN;
+    dev0.bootnPort = BOOTN_GPIO_PORT;
+    dev0.bootnPin = BOOTN_GPIO_PIN;
+    dev0.intnPort = INTN_GPIO_PORT;
+    dev0.intnPin = INTN_GPIO_PIN;
+    dev0.sa0 = 0;
+    dev0.maxTransfer = 0;
+    if (sh2_hal_i2cAddDevice(&dev0) < 0) {
+        printf("Failed to create SH-2 HAL task.\n");
+    }
+}
 
-    // Need to init I2C peripheral before first use.
-    i2cResetNeeded = true;
-    
-    // Initialize SH2 HAL data structure
-    memset(&sh2Hal, 0, sizeof(sh2Hal));
+int sh2_hal_i2cAddDevice(const sh2_hal_I2cDevice_t *pDevice)
+{
+    GPIO_InitTypeDef GPIO_InitStruct;
+    Sh2Hal_t *pDev;
+    I2cBus_t *pBus;
+    int devNum;
+
+    if ((numDevices >= SH2_HAL_I2C_MAX_DEVICES) ||
+        ((pDevice->intnPin & ~INTN_PINS_ALLOWED) != 0)) {
+        return SH2_ERR;
+    }
+    if (pDevice->intnPin == 0) {
+#if SH2_HAL_I2C_POLL
+        if (pollDev != 0) {
+            // One alarm, so one polled device
+            return SH2_ERR;
+        }
+#else
+        return SH2_ERR;
+#endif
+    }
+    for (unsigned n = 0; n < numDevices; n++) {
+        const sh2_hal_I2cDevice_t *other = &sh2Hal[n].wiring;
+        if ((other->hi2c == pDevice->hi2c) && (other->sa0 == pDevice->sa0)) {
+            // Same address on the same bus
+            return SH2_ERR;
+        }
+    }
 
-    // Semaphore to block clients with block/unblock API
-    sh2Hal.blockSem = xSemaphoreCreateBinary();
-    
-    sh2Hal.rstn = rstn0;
-    sh2Hal.bootn = bootn0;
+    pBus = findBus(pDevice->hi2c);
+    if (pBus == 0) {
+        pBus = addBus(pDevice->hi2c);
+        if (pBus == 0) {
+            return SH2_ERR;
+        }
+    }
+
+    pDev = &sh2Hal[numDevices];
+    pDev->wiring = *pDevice;
+    pDev->bus = pBus;
+    pDev->maxTransfer = SH2_HAL_MAX_TRANSFER;
+    if ((pDevice->maxTransfer >= SHTP_HEADER_LEN) &&
+        (pDevice->maxTransfer < SH2_HAL_MAX_TRANSFER)) {
+        pDev->maxTransfer = pDevice->maxTransfer;
+    }
+
+    // (Repeats MX_GPIO_Init for the shield's pins, harmlessly.)
+    memset(&GPIO_InitStruct, 0, sizeof(GPIO_InitStruct));
+    GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_PP;
+    GPIO_InitStruct.Pull = GPIO_NOPULL;
+    GPIO_InitStruct.Speed = GPIO_SPEED_LOW;
+    GPIO_InitStruct.Pin = pDevice->rstnPin;
+    HAL_GPIO_Init(pDevice->rstnPort, &GPIO_InitStruct);
+    GPIO_InitStruct.Pin = pDevice->bootnPin;
+    HAL_GPIO_Init(pDevice->bootnPort, &GPIO_InitStruct);
+
+    if (pDevice->intnPin != 0) {
+        GPIO_InitStruct.Pin = pDevice->intnPin;
+        GPIO_InitStruct.Mode = GPIO_MODE_IT_FALLING;
+        GPIO_InitStruct.Pull = GPIO_PULLUP;
+        HAL_GPIO_Init(pDevice->intnPort, &GPIO_InitStruct);
+    }
 
     // Put SH2 device in reset
-    sh2Hal.rstn(false);  // Hold in reset
-    sh2Hal.bootn(true);  // SH-2, not DFU
+    rstn(pDev, false);  // Hold in reset
+    bootn(pDev, true);  // SH-2, not DFU
 
-    // init mutex for i2c bus
-    i2cMutex = xSemaphoreCreateMutex();
-    i2cBlockSem = xSemaphoreCreateBinary();
+    // The registry rejects an EXTI line already in use
+    devNum = sh2_hal_addDevice(&i2cTransport, numDevices, pDevice->intnPin);
+    if (devNum < 0) {
+        return SH2_ERR;
+    }
+    pDev->devNum = devNum;
+    numDevices++;
+#if SH2_HAL_I2C_POLL
+    if (pDevice->intnPin == 0) {
+        pollDev = pDev;
+    }
+#endif
+
+    return devNum;
+}
+
+void sh2_hal_setI2cSpeed(uint32_t hz)
+{
+    I2cBus_t *pBus = sh2Hal[0].bus;
 
-    // Create queue to pass events from ISRs to task context.
-    evtQueue = xQueueCreate(MAX_EVENTS, sizeof(Event_t));
-    if (evtQueue == NULL) {
-        printf("The queue could not be created.\n");
+    if (hz > SH2_HAL_I2C_MAX_HZ) {
+        hz = SH2_HAL_I2C_MAX_HZ;
     }
 
-    // Create task
-    osThreadDef(halThreadDef, halTask, osPriorityNormal, 0, 256);
-    halTaskHandle = osThreadCreate(osThread(halThreadDef), NULL);
-    if (halTaskHandle == NULL) {
-        printf("Failed to create SH-2 HAL task.\n");
+    xSemaphoreTake(pBus->mutex, portMAX_DELAY);
+    pBus->speed = hz;
+    pBus->resetNeeded = true;
+    xSemaphoreGive(pBus->mutex);
+}
+
+uint32_t sh2_hal_getI2cSpeed(void)
+{
+    return sh2Hal[0].bus->speed;
+}
+
+void sh2_hal_getI2cDfuStats(sh2_hal_I2cDfuStats_t *pStats)
+{
+    *pStats = dfuLast->dfu.stats;
+}
+
+#if SH2_HAL_I2C_POLL
+void sh2_hal_i2cSetPollInterval(uint32_t interval_us)
+{
+    if (interval_us == 0) {
+        interval_us = SH2_HAL_I2C_POLL_IDLE_US;
+    }
+    if (interval_us < SH2_HAL_I2C_POLL_MIN_US) {
+        interval_us = SH2_HAL_I2C_POLL_MIN_US;
     }
+
+    // Takes effect as the next cycle is scheduled
+    pollInterval_us = interval_us;
+}
+#endif
+
+void sh2_hal_getReadStats(uint32_t *pHits, uint32_t *pMisses, uint32_t *pWasted)
+{
+    *pHits = sh2Hal[0].readHits;
+    *pMisses = sh2Hal[0].readMisses;
+    *pWasted = sh2Hal[0].readWasted;
 }
 
+// ----------------------------------------------------------------------------------
+// Transport, called through the registry
+// ----------------------------------------------------------------------------------
+
 // Reset an SH-2 module (into DFU mode, if flag is true)
 // The onRx callback function is registered with the HAL at the same time.
-int sh2_hal_reset(bool dfuMode,
-                  sh2_rxCallback_t *onRx,
-                  void *cookie)
+static int devReset(unsigned unit, bool dfuMode, sh2_rxCallback_t *onRx, void *cookie)
 {
+    Sh2Hal_t *pDev = &sh2Hal[unit];
+
+    // A DFU packet still in flight goes out before the reset
+    if (pDev->dfu.active) {
+        dfuFinish(pDev);
+        pDev->dfu.active = false;
+    }
+
     // Get exclusive access to i2c bus (blocking until we do.)
-    xSemaphoreTake(i2cMutex, portMAX_DELAY);
+    xSemaphoreTake(pDev->bus->mutex, portMAX_DELAY);
 
     // Store params for later reference
-    sh2Hal.onRxCookie = cookie;
-    sh2Hal.onRx = onRx;
+    pDev->onRxCookie = cookie;
+    pDev->onRx = onRx;
+    pDev->rxRemaining = 0;
+#if SH2_HAL_I2C_REASSEMBLE
+    if (pDev->reasm != 0) {
+        reasmDrop(pDev);
+    }
+#endif
 
     // Set addr to use in this mode
-    sh2Hal.addr = dfuMode ? ADDR_DFU_0<<1 : ADDR_SH2_0<<1;
+    if (dfuMode) {
+        pDev->addr = (pDev->wiring.sa0 ? ADDR_DFU_1 : ADDR_DFU_0) << 1;
+    }
+    else {
+        pDev->addr = (pDev->wiring.sa0 ? ADDR_SH2_1 : ADDR_SH2_0) << 1;
+    }
     
     // Assert reset
-    sh2Hal.rstn(0);
+    rstn(pDev, 0);
     
     // Set BOOTN according to dfuMode
-    sh2Hal.bootn(dfuMode ? 0 : 1);
+    bootn(pDev, dfuMode ? 0 : 1);
 
 
     // Wait for reset to take effect
-    vTaskDelay(RESET_DELAY); 
+    timebase_delayUs(SH2_HAL_RESET_HOLD_US);
        
-    // Deassert reset
-    sh2Hal.rstn(1);
+    // Deassert reset.  SH-2 mode needs no wait: its first INTN starts the
+    // first read.
+    rstn(pDev, 1);
+    sh2_hal_resetReleased(pDev->devNum);
 
-    // If reset into DFU mode, wait until bootloader should be ready
+    // If reset into DFU mode, wait until bootloader is ready
     if (dfuMode) {
-        vTaskDelay(DFU_BOOT_DELAY);
+        memset(&pDev->dfu.stats, 0, sizeof(pDev->dfu.stats));
+        pDev->dfu.return_uS = 0;
+        dfuWaitBoot(pDev);
+        pDev->dfu.active = true;
+        dfuLast = pDev;
     }
 
     // Will need to reset the i2c peripheral after this.
-    i2cResetNeeded = true;
+    pDev->bus->resetNeeded = true;
+
+#if SH2_HAL_I2C_POLL
+    // The bootloader only talks when spoken to: no polls in DFU mode
+    if (pDev == pollDev) {
+        if (dfuMode) {
+            pollStop();
+        }
+        else {
+            pollStart();
+        }
+    }
+#endif
     
     // Give up ownership of i2c bus.
-    xSemaphoreGive(i2cMutex);
+    xSemaphoreGive(pDev->bus->mutex);
 
     return SH2_OK;
 }
 
 // Send data to SH-2
-int sh2_hal_tx(uint8_t *pData, uint32_t len)
+static int devTx(unsigned unit, uint8_t *pData, uint32_t len)
 {
     // Do nothing if len is zero
     if (len == 0) {
         return SH2_OK;
     }
 
+    if (sh2Hal[unit].dfu.active) {
+        return dfuTx(&sh2Hal[unit], pData, len);
+    }
+
     // Do tx, and return when done
-    return i2cBlockingTx(sh2Hal.addr, pData, len);
+    return i2cBlockingTx(&sh2Hal[unit], pData, len);
 }
 
 // Initiate a read of <len> bytes from SH-2
 // This is a blocking read, pData will contain read data on return
 // if return value was SH2_OK.
-int sh2_hal_rx(uint8_t* pData, uint32_t len)
+static int devRx(unsigned unit, uint8_t *pData, uint32_t len)
 {
     // Do nothing if len is zero
     if (len == 0) {
         return SH2_OK;
     }
 
+    if (sh2Hal[unit].dfu.active) {
+        return dfuRx(&sh2Hal[unit], pData, len);
+    }
+
     // do rx and return when done
-    return i2cBlockingRx(sh2Hal.addr, pData, len);
+    return i2cBlockingRx(&sh2Hal[unit], pData, len);
 }
 
-int sh2_hal_block(void)
+static void getHealth(sh2_hal_Health_t *pHealth)
 {
-    xSemaphoreTake(sh2Hal.blockSem, portMAX_DELAY);
-
-    return SH2_OK;
+    *pHealth = health;
 }
 
-int sh2_hal_unblock(void)
+static void clearHealth(void)
 {
-    xSemaphoreGive(sh2Hal.blockSem);
-
-    return SH2_OK;
+    memset(&health, 0, sizeof(health));
+    health.since_uS = timebase_getUs();
 }
 
 // ----------------------------------------------------------------------------------
 // Callbacks for ISR, I2C Operations
 // ----------------------------------------------------------------------------------
 
-void HAL_GPIO_EXTI_Callback(uint16_t n)
+static void onIntn(unsigned unit, uint64_t t_uS)
 {
     BaseType_t woken= pdFALSE;
-    Event_t event;
-        
-    event.t_ms = xTaskGetTickCount();
-    event.id = EVT_INTN;
-    
-    xQueueSendFromISR(evtQueue, &event, &woken);
+
+    isrStamp_write(&sh2Hal[unit].intnStamp, t_uS);
+    xTaskNotifyFromISR(sh2Hal[unit].bus->task, EVT_INTN(unit), eSetBits, &woken);
+
     portEND_SWITCHING_ISR(woken);
 }
 
 void HAL_I2C_MasterTxCpltCallback(I2C_HandleTypeDef * hi2c)
 {
-    BaseType_t woken= pdFALSE;
-
-    // Set status from this operation
-    i2cStatus = SH2_OK;
-
-    // Unblock the caller
-    xSemaphoreGiveFromISR(i2cBlockSem, &woken);
-    
-    portEND_SWITCHING_ISR(woken);
+    opDone(hi2c, SH2_OK);
 }
 
 void HAL_I2C_MasterRxCpltCallback(I2C_HandleTypeDef * hi2c)
 {
-    BaseType_t woken= pdFALSE;
-
-    // Set status from this operation
-    i2cStatus = SH2_OK;
-
-    // Unblock the caller
-    xSemaphoreGiveFromISR(i2cBlockSem, &woken);
-    
-    portEND_SWITCHING_ISR(woken);
+    opDone(hi2c, SH2_OK);
 }
 
 void HAL_I2C_ErrorCallback(I2C_HandleTypeDef * hi2c)
 {
-    BaseType_t woken= pdFALSE;
-
-    // Set status from this operation
-    i2cStatus = SH2_ERR_IO;
-
-    // Unblock the caller
-    xSemaphoreGiveFromISR(i2cBlockSem, &woken);
-    
-    portEND_SWITCHING_ISR(woken);
+    opDone(hi2c, SH2_ERR_IO);
 }
 
 // ----------------------------------------------------------------------------------
 // Private functions
 // ----------------------------------------------------------------------------------
 
+// One HAL task per bus.  Devices sharing the bus are served in turn,
+// lowest number first when INTNs coincide.
 static void halTask(const void *params)
 {
-    Event_t event;
-    unsigned readLen = 0;
-    unsigned cargoLen = 0;
+    I2cBus_t *pBus = (I2cBus_t *)params;
+    uint32_t events;
 
     while (1) {
         // Block until there is work to do
-        xQueueReceive(evtQueue, &event, portMAX_DELAY);
-
-        // Handle the event
-        switch (event.id) {
-            case EVT_INTN:
-                // If no RX callback registered, don't bother trying to read
-                if (sh2Hal.onRx != 0) {
-                    // Compute read length
-                    readLen = sh2Hal.rxRemaining;
-                    if (readLen < SHTP_HEADER_LEN) {
-                        // always read at least the SHTP header
-                        readLen = SHTP_HEADER_LEN;
-                    }
-                    if (readLen > SH2_HAL_MAX_TRANSFER) {
-                        // limit reads to transfer size
-                        readLen = SH2_HAL_MAX_TRANSFER;
-                    }
-
-                    // Read i2c
-                    i2cBlockingRx(sh2Hal.addr, sh2Hal.rxBuf, readLen);
-
-                    // Get total cargo length from SHTP header
-                    cargoLen = ((sh2Hal.rxBuf[1] << 8) + (sh2Hal.rxBuf[0])) & (~0x8000);
-                
-                    // Re-Evaluate rxRemaining
-                    if (cargoLen > readLen) {
-                        // More to read.
-                        sh2Hal.rxRemaining = (cargoLen - readLen) + SHTP_HEADER_LEN;
-                    }
-                    else {
-                        // All done, next read should be header only.
-                        sh2Hal.rxRemaining = 0;
-                    }
-
-                    // Deliver via onRx callback
-                    sh2Hal.onRx(sh2Hal.onRxCookie, sh2Hal.rxBuf, readLen, event.t_ms * 1000);
-                }
-
-                break;
-            default:
-                // Unknown event type.  Ignore.
-                break;
+        xTaskNotifyWait(0, EVT_ALL, &events, portMAX_DELAY);
+
+        for (unsigned unit = 0; unit < numDevices; unit++) {
+            if ((events & EVT_INTN(unit)) && (sh2Hal[unit].bus == pBus)) {
+                serviceIntn(&sh2Hal[unit]);
+            }
+        }
+    }
+}
+
+static I2cBus_t *addBus(I2C_HandleTypeDef *hi2c)
+{
+    I2cBus_t *pBus;
+
+    if (numBuses >= SH2_HAL_I2C_MAX_BUSES) {
+        return 0;
+    }
+
+    pBus = &buses[numBuses];
+    pBus->hi2c = hi2c;
+    pBus->speed = SH2_HAL_I2C_HZ;
+
+    // As HAL_I2C_MspInit wires it
+    if (hi2c->Instance == I2C1) {
+        pBus->pinPort = GPIOB;
+        pBus->sclPin = GPIO_PIN_8;
+        pBus->sdaPin = GPIO_PIN_9;
+    }
+
+    // Need to init I2C peripheral before first use.
+    pBus->resetNeeded = true;
+
+    // init mutex for i2c bus
+    pBus->mutex = xSemaphoreCreateMutex();
+    pBus->blockSem = xSemaphoreCreateBinary();
+
+    // Create task
+    osThreadDef(halThreadDef, halTask, PRIO_TASK_HAL, 0, HAL_TASK_STACK);
+    pBus->task = rtos_threadCreate(osThread(halThreadDef), pBus,
+                                   (numBuses == 0) ? RTOS_STACK(halTaskStack) : 0);
+    if (pBus->task == NULL) {
+        return 0;
+    }
+
+    numBuses++;
+    return pBus;
+}
+
+static I2cBus_t *findBus(I2C_HandleTypeDef *hi2c)
+{
+    for (unsigned n = 0; n < numBuses; n++) {
+        if (buses[n].hi2c == hi2c) {
+            return &buses[n];
+        }
+    }
+
+    return 0;
+}
+
+// Read (part of) the packet a device signalled with INTN, and deliver it
+static void serviceIntn(Sh2Hal_t *pDev)
+{
+    uint32_t count;
+    uint64_t t_uS;
+    unsigned readLen = 0;
+    unsigned cargoLen = 0;
+
+    // Bits don't count, so INTNs can merge but are never dropped.
+    // (No new INTN when retrying after a bus error.)
+    t_uS = isrStamp_read(&pDev->intnStamp, &count);
+    if (count != pDev->intnSeen) {
+        health.intnMerged += count - pDev->intnSeen - 1;
+        health.intns += count - pDev->intnSeen;
+        pDev->intnSeen = count;
+    }
+
+    // If no RX callback registered, don't bother trying to read
+    if (pDev->onRx == 0) {
+        return;
+    }
+
+    // Compute read length
+    readLen = pDev->rxRemaining;
+    if (readLen == 0) {
+        // New packet, guess its size from recent ones
+        readLen = predictReadLen(pDev);
+    }
+    if (readLen < SHTP_HEADER_LEN) {
+        // always read at least the SHTP header
+        readLen = SHTP_HEADER_LEN;
+    }
+    if (readLen > pDev->maxTransfer) {
+        // limit reads to transfer size, the rest follows as continuations
+        readLen = pDev->maxTransfer;
+    }
+
+    // Read i2c
+    latency_begin(t_uS);
+    latency_mark(LAT_XFER_START);
+    power_readStarted();
+    uint32_t start = cycleBudget_start();
+#if SH2_HAL_I2C_COMBINED
+    // As long as the packet is, up to a whole transfer
+    if (pDev->bus->hi2c->hdmarx != 0) {
+        readLen = pDev->maxTransfer;
+    }
+    int rc = i2cCombinedRx(pDev, pDev->rxBuf, &readLen);
+#else
+    int rc = i2cBlockingRx(pDev, pDev->rxBuf, readLen);
+#endif
+    if (rc != SH2_OK) {
+        // Start the packet over.  INTN is level, so if the hub still
+        // wants to be read there won't be another edge: retry.
+        pDev->rxRemaining = 0;
+#if SH2_HAL_I2C_REASSEMBLE
+        if (pDev->reasm != 0) {
+            pDev->reasmBroken++;
+            reasmDrop(pDev);
+        }
+#endif
+#if SH2_HAL_I2C_POLL
+        if (pDev == pollDev) {
+            // (Or with no INTN, at the next poll)
+            pollNext(false);
+            return;
+        }
+#endif
+        if (HAL_GPIO_ReadPin(pDev->wiring.intnPort, pDev->wiring.intnPin) == GPIO_PIN_RESET) {
+            vTaskDelay(1);
+            xTaskNotify(pDev->bus->task, EVT_INTN(pDev - sh2Hal), eSetBits);
+        }
+        return;
+    }
+    latency_mark(LAT_XFER_DONE);
+    cycleBudget_check(BUDGET_STAGE_XFER, start, readLen);
+
+    // Get total cargo length from SHTP header
+    cargoLen = ((pDev->rxBuf[1] << 8) + (pDev->rxBuf[0])) & (~0x8000);
+    if (cargoLen == 0x7FFF) {
+        // 0x7FFF is an invalid length, don't chase continuations
+        health.invalidLen++;
+        cargoLen = 0;
+    }
+
+    bool cont = (pDev->rxRemaining != 0);
+    if (!cont) {
+        learnCargoLen(pDev, cargoLen, readLen);
+        if (cargoLen > pDev->maxTransfer) {
+            health.truncated++;
+        }
+    }
+
+    // Re-Evaluate rxRemaining
+    if (cargoLen > readLen) {
+        // More to read.
+        pDev->rxRemaining = (cargoLen - readLen) + SHTP_HEADER_LEN;
+    }
+    else {
+        // All done, next read should be header only.
+        pDev->rxRemaining = 0;
+    }
+
+    // Don't hand over padding read past the end of the packet
+    if ((cargoLen >= SHTP_HEADER_LEN) && (cargoLen < readLen)) {
+        readLen = cargoLen;
+    }
+
+    // Deliver via onRx callback
+    uint8_t *pData = pDev->rxBuf;
+#if SH2_HAL_I2C_REASSEMBLE
+    if (reassemble(pDev, cont, cargoLen, &pData, &readLen, &t_uS))
+#endif
+    {
+        latency_mark(LAT_DELIVER);
+        if (pDev->devNum == 0) {
+            // (Only the SH-2 library's device is captured)
+            shtpCapture_record(pData, readLen, (uint32_t)t_uS);
+        }
+        start = cycleBudget_start();
+        pDev->onRx(pDev->onRxCookie, pData, readLen, (uint32_t)t_uS);
+        cycleBudget_check(BUDGET_STAGE_DECODE, start, readLen);
+#if SH2_HAL_I2C_REASSEMBLE
+        if (pData != pDev->rxBuf) {
+            reasmDrop(pDev);
+        }
+#endif
+    }
+
+#if SH2_HAL_I2C_POLL
+    if (pDev == pollDev) {
+        // A continuation counts as data: it is read at once
+        if (cargoLen != 0) {
+            sh2_hal_polledData(pDev->devNum, t_uS);
+        }
+        pollNext(cargoLen != 0);
+        return;
+    }
+#endif
+    recheckIntn(pDev);
+}
+
+// INTN is level triggered on the hub's side: if it is asserted again with
+// no edge counted since the read, none will come.  Read it now.
+static void recheckIntn(Sh2Hal_t *pDev)
+{
+    uint32_t count;
+
+    isrStamp_read(&pDev->intnStamp, &count);
+    if ((count == pDev->intnSeen) &&
+        (HAL_GPIO_ReadPin(pDev->wiring.intnPort, pDev->wiring.intnPin) == GPIO_PIN_RESET)) {
+        health.intnRescued++;
+        xTaskNotify(pDev->bus->task, EVT_INTN(pDev - sh2Hal), eSetBits);
+    }
+}
+
+#if SH2_HAL_I2C_POLL
+// TIM2 alarm: poll now.  The poll time stands in for the INTN timestamp,
+// so polled reports are stamped up to a step late.
+static void pollAlarm(void)
+{
+    onIntn((unsigned)(pollDev - sh2Hal), timebase_getUs());
+}
+
+// (Re)start polling after a reset
+static void pollStart(void)
+{
+    pollDraining = false;
+    pollMissRun = 0;
+    pollPhase_uS = timebase_getUs() + POLL_RESET_US;
+    power_hold(POWER_HOLD_POLL);
+    timebase_setAlarm(TIMEBASE_ALARM_I2C_POLL, pollPhase_uS, pollAlarm);
+}
+
+static void pollStop(void)
+{
+    timebase_cancelAlarm(TIMEBASE_ALARM_I2C_POLL);
+    power_release(POWER_HOLD_POLL);
+}
+
+// Schedule the poll after one that read data (hit) or didn't.  Runs in
+// the HAL task.
+static void pollNext(bool hit)
+{
+    uint32_t interval = pollInterval_us;
+    uint32_t step = interval / POLL_STEPS;
+    uint64_t now;
+    uint64_t next;
+
+    polls++;
+    if (hit) {
+        // Drain the hub: read again at once
+        pollHits++;
+        pollDraining = true;
+        pollMissRun = 0;
+        xTaskNotify(pollDev->bus->task, EVT_INTN(pollDev - sh2Hal), eSetBits);
+        return;
+    }
+
+    if (pollDraining) {
+        // Data was waiting at the phase: come a little earlier next time
+        pollDraining = false;
+        next = pollPhase_uS + interval - step/4;
+    }
+    else {
+        // Too early: look again a step later, backing off to the interval
+        pollEarly++;
+        uint32_t wait = step << ((pollMissRun < 4) ? pollMissRun : 4);
+        pollMissRun++;
+        next = pollPhase_uS + ((wait < interval) ? wait : interval);
+    }
+
+    // Fallen a whole interval behind (a long drain, bus recovery): take
+    // the phase from here
+    now = timebase_getUs();
+    if ((next + interval) < now) {
+        next = now;
+    }
+
+    pollPhase_uS = next;
+    timebase_setAlarm(TIMEBASE_ALARM_I2C_POLL, next, pollAlarm);
+}
+#endif
+
+#if SH2_HAL_I2C_REASSEMBLE
+// Gather the reads of a packet longer than one into a pooled buffer.
+// Returns false to hold this read back, true to deliver *ppData and
+// *pLen: this read as it is, or after the last read of a packet, all of
+// it under one header with its whole length, the last read's sequence
+// number and the first read's timestamp.
+static bool reassemble(Sh2Hal_t *pDev, bool cont, unsigned cargoLen,
+                       uint8_t **ppData, unsigned *pLen, uint64_t *pT_uS)
+{
+    const uint8_t *pRead = pDev->rxBuf;
+    unsigned len = *pLen;
+    uint8_t *buf = pDev->reasm;
+
+    if ((buf != 0) &&
+        (!cont || !(pRead[1] & 0x80) || (pRead[2] != buf[2]) ||
+         ((pDev->reasmLen + len - SHTP_HEADER_LEN) > SH2_HAL_I2C_MAX_PACKET))) {
+        // Not the continuation expected, or too long after all
+        pDev->reasmBroken++;
+        reasmDrop(pDev);
+        buf = 0;
+    }
+
+    if (buf == 0) {
+        if (cont) {
+            // The start of it went up as read, so must the rest
+            pDev->reasmPassed++;
+            return true;
+        }
+        if ((cargoLen <= len) || (cargoLen > SH2_HAL_I2C_MAX_PACKET)) {
+            return true;
+        }
+        buf = pool_get(&reasmPool);
+        if (buf == 0) {
+            return true;
+        }
+        memcpy(buf, pRead, len);
+        pDev->reasm = buf;
+        pDev->reasmLen = len;
+        pDev->reasmT_uS = *pT_uS;
+        return false;
+    }
+
+    // Continuations repeat the header: keep only their cargo
+    memcpy(buf + pDev->reasmLen, pRead + SHTP_HEADER_LEN, len - SHTP_HEADER_LEN);
+    pDev->reasmLen += len - SHTP_HEADER_LEN;
+    if (pDev->rxRemaining != 0) {
+        return false;
+    }
+
+    buf[0] = pDev->reasmLen & 0xFF;
+    buf[1] = (pDev->reasmLen >> 8) & 0x7F;
+    buf[3] = pRead[3];
+    pDev->reasmPackets++;
+    *ppData = buf;
+    *pLen = pDev->reasmLen;
+    *pT_uS = pDev->reasmT_uS;
+    return true;
+}
+
+static void reasmDrop(Sh2Hal_t *pDev)
+{
+    pool_put(&reasmPool, pDev->reasm);
+    pDev->reasm = 0;
+}
+#endif
+
+// Expected length of the next new packet: the largest of the recent ones.
+// (Reports from several sensors interleave, so the max covers the mix.)
+static unsigned predictReadLen(Sh2Hal_t *pDev)
+{
+    unsigned len = 0;
+
+#if SH2_HAL_I2C_ADAPTIVE
+    for (int n = 0; n < LEN_HISTORY; n++) {
+        if (pDev->lenHistory[n] > len) {
+            len = pDev->lenHistory[n];
+        }
+    }
+    if (len > pDev->maxTransfer) {
+        len = pDev->maxTransfer;
+    }
+#endif
+
+    return len;
+}
+
+// Record the cargo length of a new packet and score the prediction.
+static void learnCargoLen(Sh2Hal_t *pDev, unsigned cargoLen, unsigned readLen)
+{
+    if (cargoLen == 0) {
+        // Nothing was pending, don't let that shrink the prediction
+        return;
+    }
+
+    if (cargoLen <= readLen) {
+        pDev->readHits++;
+        pDev->readWasted += readLen - cargoLen;
+    }
+    else {
+        pDev->readMisses++;
+    }
+
+    pDev->lenHistory[pDev->lenHistoryIdx] = cargoLen;
+    pDev->lenHistoryIdx = (pDev->lenHistoryIdx + 1) % LEN_HISTORY;
+}
+
+static void i2cCmd(int argc, char *argv[])
+{
+    for (unsigned unit = 0; unit < numDevices; unit++) {
+        const Sh2Hal_t *pDev = &sh2Hal[unit];
+        printf("Device %u (bus %u, 0x%02x, reads <= %u): %u complete, %u needed continuation, %u bytes over-read\n",
+               pDev->devNum, (unsigned)(pDev->bus - buses), pDev->addr >> 1, pDev->maxTransfer,
+               pDev->readHits, pDev->readMisses, pDev->readWasted);
+#if SH2_HAL_I2C_REASSEMBLE
+        printf("Device %u: %u packets reassembled, %u broken off, %u continuations delivered as read\n",
+               pDev->devNum, (unsigned)pDev->reasmPackets, (unsigned)pDev->reasmBroken,
+               (unsigned)pDev->reasmPassed);
+#endif
+#if SH2_HAL_I2C_POLL
+        if (pDev == pollDev) {
+            unsigned pct = (polls != 0) ? (unsigned)(((uint64_t)pollHits * 100) / polls) : 0;
+            printf("Device %u polled every %u us: %u polls, %u%% with data, %u phase polls early\n",
+                   pDev->devNum, (unsigned)pollInterval_us, (unsigned)polls, pct,
+                   (unsigned)pollEarly);
+        }
+#endif
+    }
+    for (unsigned n = 0; n < numBuses; n++) {
+        const I2cBus_t *pBus = &buses[n];
+        printf("Bus %u at %u Hz: %u timeouts, %u recoveries, %u us lost (worst %u)\n",
+               n, (unsigned)pBus->speed, (unsigned)pBus->timeouts,
+               (unsigned)pBus->recoveries, (unsigned)pBus->lostUs,
+               (unsigned)pBus->maxLostUs);
+#if SH2_HAL_I2C_COMBINED
+        printf("Bus %u: %u combined header and cargo reads\n", n, (unsigned)pBus->combReads);
+#endif
+    }
+}
+
+#if SH2_HAL_I2C_COMBINED
+// Read one packet in a single transaction: *pLen is the most to read on
+// entry, what was read on return.  Falls back to a plain read of *pLen
+// bytes on a bus without rx DMA, or if *pLen leaves no room for cargo.
+static int i2cCombinedRx(Sh2Hal_t *pDev, uint8_t *pData, unsigned *pLen)
+{
+    I2cBus_t *pBus = pDev->bus;
+    I2C_HandleTypeDef *hi2c = pBus->hi2c;
+    int status;
+
+    if ((hi2c->hdmarx == 0) || (*pLen < SHTP_HEADER_LEN + 2)) {
+        return i2cBlockingRx(pDev, pData, *pLen);
+    }
+
+    xSemaphoreTake(pBus->mutex, portMAX_DELAY);
+    power_hold(POWER_HOLD_I2C << (pBus - buses));
+    if (pBus->resetNeeded) {
+        i2cReset(pBus);
+    }
+
+    pBus->combBuf = pData;
+    pBus->combMax = *pLen;
+    pBus->combLen = *pLen;
+    uint64_t start_uS = timebase_getUs();
+    int rc = combinedStart(pBus, pDev->addr);
+    status = i2cWait(pBus, rc, *pLen, start_uS);
+    if (status == SH2_OK) {
+        // A byte clocked in after the last, while STOP was pending, is
+        // padding: drop it
+        uint64_t limit_uS = timebase_getUs() + 1000;
+        while ((hi2c->Instance->CR1 & I2C_CR1_STOP) && (timebase_getUs() < limit_uS)) {
+        }
+        if (hi2c->Instance->SR1 & I2C_SR1_RXNE) {
+            (void)hi2c->Instance->DR;
+        }
+        *pLen = pBus->combLen;
+        pBus->combReads++;
+    }
+    else {
+        HAL_DMA_Abort(hi2c->hdmarx);
+        hi2c->Instance->CR2 &= ~(I2C_CR2_DMAEN | I2C_CR2_LAST);
+    }
+    power_release(POWER_HOLD_I2C << (pBus - buses));
+    meterXfer(pBus, status, start_uS, 0, (status == SH2_OK) ? *pLen : 0);
+
+    xSemaphoreGive(pBus->mutex);
+
+    return status;
+}
+
+// Start the header leg and address the device, as
+// HAL_I2C_Master_Receive_DMA does but without LAST, so the device keeps
+// getting ACKs.  Returns a HAL status, like the HAL calls i2cWait takes.
+static int combinedStart(I2cBus_t *pBus, uint16_t addr)
+{
+    I2C_HandleTypeDef *hi2c = pBus->hi2c;
+    I2C_TypeDef *i2c = hi2c->Instance;
+    uint64_t limit_uS = timebase_getUs() + SH2_HAL_I2C_TIMEOUT_MS * 1000;
+
+    while (i2c->SR2 & I2C_SR2_BUSY) {
+        if (timebase_getUs() > limit_uS) {
+            return HAL_BUSY;
+        }
+    }
+
+    hi2c->ErrorCode = HAL_I2C_ERROR_NONE;
+    i2c->CR1 &= ~I2C_CR1_POS;
+    i2c->CR1 |= I2C_CR1_ACK;
+    i2c->CR2 &= ~I2C_CR2_LAST;
+
+    hi2c->hdmarx->XferCpltCallback = combinedHdrCplt;
+    hi2c->hdmarx->XferErrorCallback = combinedError;
+    if (HAL_DMA_Start_IT(hi2c->hdmarx, (uint32_t)&i2c->DR,
+                         (uint32_t)pBus->combBuf, SHTP_HEADER_LEN) != HAL_OK) {
+        return HAL_ERROR;
+    }
+
+    i2c->CR1 |= I2C_CR1_START;
+    while ((i2c->SR1 & I2C_SR1_SB) == 0) {
+        if (timebase_getUs() > limit_uS) {
+            HAL_DMA_Abort(hi2c->hdmarx);
+            return HAL_TIMEOUT;
+        }
+    }
+    i2c->DR = (uint8_t)(addr | 1);
+    while ((i2c->SR1 & I2C_SR1_ADDR) == 0) {
+        if ((i2c->SR1 & I2C_SR1_AF) || (timebase_getUs() > limit_uS)) {
+            // Not there (or not ready): the STOP frees the bus
+            bool nack = (i2c->SR1 & I2C_SR1_AF) != 0;
+            i2c->CR1 |= I2C_CR1_STOP;
+            i2c->SR1 = ~I2C_SR1_AF;
+            HAL_DMA_Abort(hi2c->hdmarx);
+            hi2c->ErrorCode = nack ? HAL_I2C_ERROR_AF : HAL_I2C_ERROR_TIMEOUT;
+            return nack ? HAL_ERROR : HAL_TIMEOUT;
+        }
+    }
+
+    i2c->CR2 |= I2C_CR2_DMAEN;
+    (void)i2c->SR1;
+    (void)i2c->SR2;     // clears ADDR: the bytes start coming
+
+    return HAL_OK;
+}
+
+// Header in (ISR).  SCL stretches from the second byte after it until
+// the next leg reads DR, so this leg may take its time.  The rest is the
+// announced cargo, at least 2 bytes (LAST needs 2) and at most combMax.
+static void combinedHdrCplt(DMA_HandleTypeDef *hdma)
+{
+    I2cBus_t *pBus = findBusByDma(hdma);
+    uint8_t *hdr = pBus->combBuf;
+    unsigned len = ((hdr[1] << 8) + hdr[0]) & ~0x8000;
+
+    if ((len == 0x7FFF) || (len < SHTP_HEADER_LEN + 2)) {
+        len = SHTP_HEADER_LEN + 2;
+    }
+    if (len > pBus->combMax) {
+        len = pBus->combMax;
+    }
+    pBus->combLen = len;
+
+    hdma->XferCpltCallback = combinedCplt;
+    pBus->hi2c->Instance->CR2 |= I2C_CR2_LAST;
+    if (HAL_DMA_Start_IT(hdma, (uint32_t)&pBus->hi2c->Instance->DR,
+                         (uint32_t)(pBus->combBuf + SHTP_HEADER_LEN),
+                         len - SHTP_HEADER_LEN) != HAL_OK) {
+        combinedError(hdma);
+    }
+}
+
+// Last byte in (ISR): NACK anything already on its way, and stop.
+static void combinedCplt(DMA_HandleTypeDef *hdma)
+{
+    I2cBus_t *pBus = findBusByDma(hdma);
+    I2C_TypeDef *i2c = pBus->hi2c->Instance;
+
+    i2c->CR2 &= ~(I2C_CR2_DMAEN | I2C_CR2_LAST);
+    i2c->CR1 &= ~I2C_CR1_ACK;
+    i2c->CR1 |= I2C_CR1_STOP;
+
+    opDone(pBus->hi2c, SH2_OK);
+}
+
+static void combinedError(DMA_HandleTypeDef *hdma)
+{
+    I2cBus_t *pBus = findBusByDma(hdma);
+    I2C_TypeDef *i2c = pBus->hi2c->Instance;
+
+    i2c->CR2 &= ~(I2C_CR2_DMAEN | I2C_CR2_LAST);
+    i2c->CR1 |= I2C_CR1_STOP;
+    pBus->hi2c->ErrorCode |= HAL_I2C_ERROR_DMA;
+
+    opDone(pBus->hi2c, SH2_ERR_IO);
+}
+
+static I2cBus_t *findBusByDma(DMA_HandleTypeDef *hdma)
+{
+    for (unsigned n = 0; n < numBuses; n++) {
+        if (buses[n].hi2c->hdmarx == hdma) {
+            return &buses[n];
         }
     }
+
+    // Only set as the callback of a bus's own stream
+    return &buses[0];
 }
+#endif
 
 // Perform a blocking i2c read
-static int i2cBlockingRx(unsigned addr, uint8_t* pData, unsigned len)
+static int i2cBlockingRx(Sh2Hal_t *pDev, uint8_t* pData, unsigned len)
 {
-    int status = SH2_OK;
+    I2cBus_t *pBus = pDev->bus;
+    int status;
     
-    // Get device mutex
-    xSemaphoreTake(i2cMutex, portMAX_DELAY);
+    // Get bus mutex, and stay out of STOP until the transfer is done
+    xSemaphoreTake(pBus->mutex, portMAX_DELAY);
+    power_hold(POWER_HOLD_I2C << (pBus - buses));
 
     // Reset bus, if necc.
-    if (i2cResetNeeded) {
-        i2cReset();
+    if (pBus->resetNeeded) {
+        i2cReset(pBus);
     }
     
     // Call I2C API rx
-    int rc = HAL_I2C_Master_Receive_IT(hi2c, addr, pData, len);
-
-    if (rc == 0) {
-        // Block on results
-        xSemaphoreTake(i2cBlockSem, portMAX_DELAY);
-    
-        // Set return status
-        status = i2cStatus;
-    }
-    else {
-        // I2C operation failed
-        status = SH2_ERR_IO;
-    }
+    uint64_t start_uS = timebase_getUs();
+#if SH2_HAL_USE_DMA
+    int rc = HAL_I2C_Master_Receive_DMA(pBus->hi2c, pDev->addr, pData, len);
+#else
+    int rc = HAL_I2C_Master_Receive_IT(pBus->hi2c, pDev->addr, pData, len);
+#endif
+    status = i2cWait(pBus, rc, len, start_uS);
+    power_release(POWER_HOLD_I2C << (pBus - buses));
+    meterXfer(pBus, status, start_uS, 0, len);
     
-    // Release device mutex
-    xSemaphoreGive(i2cMutex);
+    // Release bus mutex
+    xSemaphoreGive(pBus->mutex);
 
     return status;
 }
 
-static int i2cBlockingTx(unsigned addr, uint8_t* pData, unsigned len)
+static int i2cBlockingTx(Sh2Hal_t *pDev, uint8_t* pData, unsigned len)
 {
-    int status = SH2_OK;
+    I2cBus_t *pBus = pDev->bus;
+    int status;
     
-    // Get device mutex
-    xSemaphoreTake(i2cMutex, portMAX_DELAY);
+    // Get bus mutex, and stay out of STOP until the transfer is done
+    xSemaphoreTake(pBus->mutex, portMAX_DELAY);
+    power_hold(POWER_HOLD_I2C << (pBus - buses));
 
     // Reset bus, if necc.
-    if (i2cResetNeeded) {
-        i2cReset();
+    if (pBus->resetNeeded) {
+        i2cReset(pBus);
     }
     
-    // Call I2C API rx
-    int rc = HAL_I2C_Master_Transmit_IT(hi2c, addr, pData, len);
+    // Call I2C API tx
+    uint64_t start_uS = timebase_getUs();
+    latency_cmdBus();
+#if SH2_HAL_USE_DMA
+    int rc = HAL_I2C_Master_Transmit_DMA(pBus->hi2c, pDev->addr, pData, len);
+#else
+    int rc = HAL_I2C_Master_Transmit_IT(pBus->hi2c, pDev->addr, pData, len);
+#endif
+    status = i2cWait(pBus, rc, len, start_uS);
+    power_release(POWER_HOLD_I2C << (pBus - buses));
+    meterXfer(pBus, status, start_uS, len, 0);
+    
+    // Release bus mutex
+    xSemaphoreGive(pBus->mutex);
+
+    return status;
+}
+
+// Count a transfer started at start_uS in the bus meter: to its STOP if
+// it completed, else to its recovery.  Bytes only count if it completed.
+// The meter adds up every bus of the HAL.
+static void meterXfer(I2cBus_t *pBus, int status, uint64_t start_uS, unsigned txLen, unsigned rxLen)
+{
+    if (status == SH2_OK) {
+        sh2_hal_meter(&health, (uint32_t)(pBus->done_uS - start_uS), txLen, rxLen);
+    }
+    else {
+        sh2_hal_meter(&health, (uint32_t)(timebase_getUs() - start_uS), 0, 0);
+    }
+}
+
+// Wait for the transfer of len bytes started at start_uS with result rc.
+// Called holding the bus.  A transfer that doesn't finish in time, or
+// that failed in a way that can leave the bus stuck, recovers the bus.
+static int i2cWait(I2cBus_t *pBus, int rc, unsigned len, uint64_t start_uS)
+{
+    int status = SH2_OK;
+    bool recover = false;
 
     if (rc == 0) {
+        // Time on the wire: 9 clocks per byte, plus the address
+        uint32_t wire_ms = ((len + 1) * 9 * 1000 + pBus->speed - 1) / pBus->speed;
+        TickType_t timeout = pdMS_TO_TICKS(wire_ms + SH2_HAL_I2C_TIMEOUT_MS) + 1;
+
         // Block on results
-        xSemaphoreTake(i2cBlockSem, portMAX_DELAY);
-    
-        // Set return status
-        status = i2cStatus;
+        if (xSemaphoreTake(pBus->blockSem, timeout) == pdTRUE) {
+            // Set return status
+            status = pBus->status;
+
+            // A NACK ends with a STOP, anything else may have left a
+            // slave driving SDA.
+            if ((status != SH2_OK) && 
+                ((pBus->hi2c->ErrorCode & ~HAL_I2C_ERROR_AF) != 0)) {
+                recover = true;
+            }
+        }
+        else {
+            pBus->timeouts++;
+            status = SH2_ERR_TIMEOUT;
+            recover = true;
+        }
     }
     else {
-        // I2C operation failed
+        // I2C operation failed, perhaps on a BUSY flag that never clears
         status = SH2_ERR_IO;
+        recover = (rc == HAL_BUSY);
+    }
+
+    if (status != SH2_OK) {
+        health.busErrors++;
+    }
+    if (recover) {
+        i2cRecover(pBus, start_uS);
     }
-    
-    // Release device mutex
-    xSemaphoreGive(i2cMutex);
 
     return status;
 }
 
+// Transfer finished (ISR)
+static void opDone(I2C_HandleTypeDef *hi2c, int status)
+{
+    BaseType_t woken= pdFALSE;
+    I2cBus_t *pBus = findBus(hi2c);
+
+    if (pBus != 0) {
+        // Set status from this operation
+        pBus->status = status;
+        pBus->done_uS = timebase_getUs();
+
+        // Unblock the caller
+        xSemaphoreGiveFromISR(pBus->blockSem, &woken);
+    }
+    
+    portEND_SWITCHING_ISR(woken);
+}
+
 // DeInit and Init I2C Peripheral.
 // (This recovery step is necessary after resets of the device)
-static void i2cReset(void)
+static void i2cReset(I2cBus_t *pBus)
 {
+    I2C_HandleTypeDef *hi2c = pBus->hi2c;
+
+    // (Instance is left as CubeMX set it up.)
     HAL_I2C_DeInit(hi2c);
         
-    hi2c->Instance = I2C1;
-    hi2c->Init.ClockSpeed = 400000;
+    hi2c->Init.ClockSpeed = pBus->speed;
     hi2c->Init.DutyCycle = I2C_DUTYCYCLE_2;
     hi2c->Init.OwnAddress1 = 0;
     hi2c->Init.AddressingMode = I2C_ADDRESSINGMODE_7BIT;
@@ -424,17 +1392,250 @@ static void i2cReset(void)
     
     HAL_I2C_Init(hi2c);
 
-    i2cResetNeeded = false;
+    pBus->resetNeeded = false;
 }           
 
-static void bootn0(bool state)
+// Get a stuck bus going again: reset the peripheral, free SDA and
+// re-init.  Takes well under a millisecond.
+static void i2cRecover(I2cBus_t *pBus, uint64_t start_uS)
+{
+    I2C_HandleTypeDef *hi2c = pBus->hi2c;
+
+    TRACE(TRACE_I2C_RECOVER, hi2c->ErrorCode);
+
+    // Software reset clears a BUSY flag latched by a glitch, then DeInit
+    // stops DMA and hands the pins back as plain GPIO.
+    hi2c->Instance->CR1 |= I2C_CR1_SWRST;
+    hi2c->Instance->CR1 &= ~I2C_CR1_SWRST;
+    HAL_I2C_DeInit(hi2c);
+
+    i2cClockOut(pBus);
+    i2cReset(pBus);
+
+    // A completion that raced the timeout mustn't satisfy the next wait
+    xSemaphoreTake(pBus->blockSem, 0);
+
+    uint32_t lost = (uint32_t)(timebase_getUs() - start_uS);
+    pBus->recoveries++;
+    pBus->lostUs += lost;
+    if (lost > pBus->maxLostUs) {
+        pBus->maxLostUs = lost;
+    }
+    busRecoveries++;
+}
+
+// A slave cut off mid-byte holds SDA low until it gets the rest of its
+// clocks.  Clock SCL until SDA is released (9 clocks finish any byte),
+// then signal STOP so every slave returns to idle.
+static void i2cClockOut(I2cBus_t *pBus)
+{
+    GPIO_InitTypeDef GPIO_InitStruct;
+    GPIO_TypeDef *port = pBus->pinPort;
+    uint32_t halfBit_uS = (500000 + pBus->speed - 1) / pBus->speed;
+
+    if (pBus->sclPin == 0) {
+        // Wiring unknown, re-init will have to do
+        return;
+    }
+
+    HAL_GPIO_WritePin(port, pBus->sclPin | pBus->sdaPin, GPIO_PIN_SET);
+    memset(&GPIO_InitStruct, 0, sizeof(GPIO_InitStruct));
+    GPIO_InitStruct.Pin = pBus->sclPin | pBus->sdaPin;
+    GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_OD;
+    GPIO_InitStruct.Pull = GPIO_PULLUP;
+    GPIO_InitStruct.Speed = GPIO_SPEED_LOW;
+    HAL_GPIO_Init(port, &GPIO_InitStruct);
+    timebase_delayUs(halfBit_uS);
+
+    for (int n = 0; n < 9; n++) {
+        if (HAL_GPIO_ReadPin(port, pBus->sdaPin) == GPIO_PIN_SET) {
+            break;
+        }
+        HAL_GPIO_WritePin(port, pBus->sclPin, GPIO_PIN_RESET);
+        timebase_delayUs(halfBit_uS);
+        HAL_GPIO_WritePin(port, pBus->sclPin, GPIO_PIN_SET);
+        timebase_delayUs(halfBit_uS);
+    }
+
+    // STOP: SDA rises while SCL is high
+    HAL_GPIO_WritePin(port, pBus->sclPin, GPIO_PIN_RESET);
+    HAL_GPIO_WritePin(port, pBus->sdaPin, GPIO_PIN_RESET);
+    timebase_delayUs(halfBit_uS);
+    HAL_GPIO_WritePin(port, pBus->sclPin, GPIO_PIN_SET);
+    timebase_delayUs(halfBit_uS);
+    HAL_GPIO_WritePin(port, pBus->sdaPin, GPIO_PIN_SET);
+    timebase_delayUs(halfBit_uS);
+
+    // (HAL_I2C_MspInit gives the pins back to the peripheral.)
+}
+
+// Send a DFU packet.  With SH2_HAL_I2C_DFU_FAST it is only started, and
+// the status returned is the previous packet's.
+static int dfuTx(Sh2Hal_t *pDev, uint8_t *pData, unsigned len)
+{
+    I2cDfu_t *pDfu = &pDev->dfu;
+    int status;
+
+    dfuEnter(pDev);
+    status = dfuFinish(pDev);
+    if (status != SH2_OK) {
+        return dfuLeave(pDev, status);
+    }
+    pDfu->stats.txPackets++;
+    pDfu->stats.txBytes += len;
+
+#if SH2_HAL_I2C_DFU_FAST
+    I2cBus_t *pBus = pDev->bus;
+
+    if (len <= sizeof(pDfu->txBuf)) {
+        // Copy so the caller can fetch the next packet while this one
+        // goes out.  dfuFinish() gives the bus back.
+        memcpy(pDfu->txBuf, pData, len);
+
+        xSemaphoreTake(pBus->mutex, portMAX_DELAY);
+        power_hold(POWER_HOLD_I2C << (pBus - buses));
+        if (pBus->resetNeeded) {
+            i2cReset(pBus);
+        }
+        pDfu->len = len;
+        pDfu->start_uS = timebase_getUs();
+        pDfu->rc = HAL_I2C_Master_Transmit_DMA(pBus->hi2c, pDev->addr, pDfu->txBuf, len);
+        pDfu->pending = true;
+        return dfuLeave(pDev, SH2_OK);
+    }
+#endif
+
+    uint64_t start_uS = timebase_getUs();
+    status = i2cBlockingTx(pDev, pData, len);
+    uint32_t us = (uint32_t)(timebase_getUs() - start_uS);
+    pDfu->stats.txUs += us;
+    if (us > pDfu->stats.maxTxUs) {
+        pDfu->stats.maxTxUs = us;
+    }
+    return dfuLeave(pDev, status);
+}
+
+static int dfuRx(Sh2Hal_t *pDev, uint8_t *pData, unsigned len)
+{
+    int status;
+
+    dfuEnter(pDev);
+    status = dfuFinish(pDev);
+    if (status == SH2_OK) {
+        uint64_t start_uS = timebase_getUs();
+
+        status = i2cBlockingRx(pDev, pData, len);
+        pDev->dfu.stats.rxUs += timebase_getUs() - start_uS;
+        pDev->dfu.stats.rxPackets++;
+        pDev->dfu.stats.rxBytes += len;
+    }
+    return dfuLeave(pDev, status);
+}
+
+// Wait for pDev's DFU packet in flight, if any, and release the bus.
+// The bootloader NACKs while it is busy, so a NACKed packet is resent
+// for up to SH2_HAL_I2C_DFU_BUSY_MS.  The bus is let go between tries:
+// another hub on it, being updated too, goes on meanwhile.
+static int dfuFinish(Sh2Hal_t *pDev)
+{
+#if SH2_HAL_I2C_DFU_FAST
+    I2cDfu_t *pDfu = &pDev->dfu;
+
+    if (!pDfu->pending) {
+        return SH2_OK;
+    }
+
+    I2cBus_t *pBus = pDev->bus;
+    uint64_t t0 = timebase_getUs();
+    int status = i2cWait(pBus, pDfu->rc, pDfu->len, pDfu->start_uS);
+
+    pDfu->stats.waitUs += timebase_getUs() - t0;
+    while ((status != SH2_OK) && (pDfu->rc == HAL_OK) &&
+           (pBus->hi2c->ErrorCode == HAL_I2C_ERROR_AF) &&
+           (timebase_getUs() - pDfu->start_uS < SH2_HAL_I2C_DFU_BUSY_MS * 1000)) {
+        pDfu->stats.busyNacks++;
+        xSemaphoreGive(pBus->mutex);
+        vTaskDelay(1);
+        xSemaphoreTake(pBus->mutex, portMAX_DELAY);
+        if (pBus->resetNeeded) {
+            i2cReset(pBus);
+        }
+        pDfu->rc = HAL_I2C_Master_Transmit_DMA(pBus->hi2c, pDev->addr, pDfu->txBuf, pDfu->len);
+        status = i2cWait(pBus, pDfu->rc, pDfu->len, timebase_getUs());
+    }
+    if (status == SH2_OK) {
+        // Ended in the ISR, perhaps well before the caller came back
+        uint32_t us = (uint32_t)(pBus->done_uS - pDfu->start_uS);
+
+        pDfu->stats.txUs += us;
+        if (us > pDfu->stats.maxTxUs) {
+            pDfu->stats.maxTxUs = us;
+        }
+    }
+    pDfu->pending = false;
+
+    power_release(POWER_HOLD_I2C << (pBus - buses));
+    xSemaphoreGive(pBus->mutex);
+
+    return status;
+#else
+    return SH2_OK;
+#endif
+}
+
+// Called from devReset, holding the bus, once RSTN is released.  The
+// bootloader asserts INTN, and ACKs its address, once it runs, usually
+// well inside DFU_BOOT_DELAY.  Gives up at DFU_BOOT_DELAY, leaving dfu()
+// to find out.
+static void dfuWaitBoot(Sh2Hal_t *pDev)
+{
+    uint64_t start_uS = timebase_getUs();
+
+#if SH2_HAL_I2C_DFU_FAST
+    I2cBus_t *pBus = pDev->bus;
+    TickType_t start = xTaskGetTickCount();
+
+    vTaskDelay(pdMS_TO_TICKS(DFU_BOOT_MIN_DELAY));
+    i2cReset(pBus);
+    while (!sh2_hal_waitReady(pDev->devNum, 0) &&
+           (HAL_I2C_IsDeviceReady(pBus->hi2c, pDev->addr, 1, 1) != HAL_OK)) {
+        if ((xTaskGetTickCount() - start) >= pdMS_TO_TICKS(DFU_BOOT_DELAY)) {
+            break;
+        }
+        vTaskDelay(1);
+    }
+#else
+    sh2_hal_waitReady(pDev->devNum, DFU_BOOT_DELAY);
+#endif
+
+    pDev->dfu.stats.bootUs = (uint32_t)(timebase_getUs() - start_uS);
+}
+
+// Account time spent outside the HAL since the last DFU call returned.
+static void dfuEnter(Sh2Hal_t *pDev)
+{
+    uint64_t now = timebase_getUs();
+
+    if (pDev->dfu.return_uS != 0) {
+        pDev->dfu.stats.callerUs += now - pDev->dfu.return_uS;
+    }
+}
+
+static int dfuLeave(Sh2Hal_t *pDev, int status)
+{
+    pDev->dfu.return_uS = timebase_getUs();
+
+    return status;
+}
+
+static void bootn(Sh2Hal_t *pDev, bool state)
 {
-	HAL_GPIO_WritePin(BOOTN_GPIO_PORT, BOOTN_GPIO_PIN, 
+	HAL_GPIO_WritePin(pDev->wiring.bootnPort, pDev->wiring.bootnPin, 
 	                  state ? GPIO_PIN_SET : GPIO_PIN_RESET);
 }
 
-static void rstn0(bool state)
+static void rstn(Sh2Hal_t *pDev, bool state)
 {
-	HAL_GPIO_WritePin(RSTN_GPIO_PORT, RSTN_GPIO_PIN, 
+	HAL_GPIO_WritePin(pDev->wiring.rstnPort, pDev->wiring.rstnPin, 
 	                  state ? GPIO_PIN_SET : GPIO_PIN_RESET);
 }
@@ -29,15 +29,84 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "sh2_hal.h"
+#include "sh2_hal_registry.h"
 #include "sh2_hal_impl.h"
+#include "sh2_hal_health.h"
 #include "stm32f4xx_hal.h"
 
+// BNO080s the HAL can drive, and distinct I2C buses among them.  Each
+// bus has its own HAL task, so hubs on separate buses transfer in
+// parallel; hubs sharing a bus take turns on it.
+#ifndef SH2_HAL_I2C_MAX_DEVICES
+#define SH2_HAL_I2C_MAX_DEVICES (2)
+#endif
+#ifndef SH2_HAL_I2C_MAX_BUSES
+#define SH2_HAL_I2C_MAX_BUSES (2)
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-    // Initialize SH2 HAL Implementation
-    void sh2_hal_init(I2C_HandleTypeDef* _hi2c);
+    // Wiring of one BNO080.  The GPIO ports must already be clocked.
+    typedef struct {
+        I2C_HandleTypeDef *hi2c;   // bus, may be shared with other devices
+        GPIO_TypeDef *rstnPort;
+        uint16_t rstnPin;
+        GPIO_TypeDef *bootnPort;
+        uint16_t bootnPin;
+        GPIO_TypeDef *intnPort;
+        uint16_t intnPin;          // GPIO_PIN_10 to _15 (the EXTI15_10 vector),
+                                   // 0 if not wired (see SH2_HAL_I2C_POLL)
+        uint8_t sa0;               // SA0 strap: address 0x4A/0x28 if 0, 0x4B/0x29 if 1
+        uint16_t maxTransfer;      // longest read, 0 for SH2_HAL_MAX_TRANSFER
+    } sh2_hal_I2cDevice_t;
+
+    // Initialize SH2 HAL Implementation, with a BNO080 as the I2C HAL's
+    // device 0: the demo shield's, or in a build with the SPI HAL too, an
+    // auxiliary one on PC8 (RSTN), PC6 (BOOTN) and PB12 (INTN).
+    void sh2_hal_i2cInit(I2C_HandleTypeDef* _hi2c);
+
+    // Add another BNO080, held in reset until sh2_hal_devReset().  Call
+    // after sh2_hal_i2cInit(), before the scheduler starts.  Returns the
+    // device number in the registry (see sh2_hal_registry.h), or SH2_ERR
+    // if the table is full or the wiring clashes with a device already
+    // added.
+    int sh2_hal_i2cAddDevice(const sh2_hal_I2cDevice_t *pDevice);
+
+    // Change the bus speed of the I2C HAL's device 0, takes effect on the
+    // next transfer.  Speeds above SH2_HAL_I2C_MAX_HZ are clamped.
+    void sh2_hal_setI2cSpeed(uint32_t hz);
+    uint32_t sh2_hal_getI2cSpeed(void);
+
+    // Where the time went during the last DFU of an I2C device (since
+    // reset into DFU mode)
+    typedef struct {
+        uint32_t txPackets;
+        uint32_t txBytes;
+        uint32_t rxPackets;
+        uint32_t rxBytes;
+        uint32_t busyNacks; // packets resent while the bootloader was busy
+        uint32_t bootUs;    // from reset until the bootloader answered
+        uint32_t maxTxUs;   // slowest packet, start to done
+        uint64_t txUs;      // packets on the bus, start to done
+        uint64_t rxUs;
+        uint64_t waitUs;    // caller blocked on the previous packet
+        uint64_t callerUs;  // outside the HAL (dfu() and getAppData)
+    } sh2_hal_I2cDfuStats_t;
+    void sh2_hal_getI2cDfuStats(sh2_hal_I2cDfuStats_t *pStats);
+
+#if SH2_HAL_I2C_POLL
+    // Report interval to poll a hub without INTN at [us]: the shortest
+    // the subscriptions ask for, 0 if none.  Takes effect on the next poll.
+    void sh2_hal_i2cSetPollInterval(uint32_t interval_us);
+#endif
+
+    // Adaptive read statistics of the I2C HAL's device 0: reads that got
+    // the whole packet, reads that needed a continuation, and bytes read
+    // past the end of packets.
+    void sh2_hal_getReadStats(uint32_t *pHits, uint32_t *pMisses, uint32_t *pWasted);
 
 #ifdef __cplusplus
 }    // end of extern "C"
@@ -25,6 +25,252 @@
 #ifndef SH2_HAL_IMPL_H
 #define SH2_HAL_IMPL_H
 
+// Longest SHTP transfer, and the size of each HAL rx and tx buffer.  The
+// hub sends longer packets (batched FIFO flushes) as a transfer of this
+// size followed by continuations, so raise it to drain a batch in one
+// transaction.  SHTP lengths are 15 bits.
+#ifndef SH2_HAL_MAX_TRANSFER
 #define SH2_HAL_MAX_TRANSFER (256)
+#endif
+#if (SH2_HAL_MAX_TRANSFER < 4) || (SH2_HAL_MAX_TRANSFER > 0x7FFE)
+#error SH2_HAL_MAX_TRANSFER must be 4 to 0x7FFE
+#endif
+
+// Set to 1 to run SHTP bus transfers on DMA (one completion interrupt per
+// transfer), or 0 to fall back to interrupt-driven (per byte) transfers.
+#ifndef SH2_HAL_USE_DMA
+#define SH2_HAL_USE_DMA (1)
+#endif
+
+// Set to 1 to start and finish SHTP DMA transfers on the SPI and DMA
+// registers, instead of through HAL_SPI_TransmitReceive_DMA and the ST
+// HAL's DMA interrupt chain.  The completion interrupt goes straight to
+// the transfer phase logic.  DFU pacing and the SPI flash keep the ST HAL.
+#ifndef SH2_HAL_SPI_LL
+#define SH2_HAL_SPI_LL (SH2_HAL_USE_DMA)
+#endif
+#if SH2_HAL_SPI_LL && !SH2_HAL_USE_DMA
+#error SH2_HAL_SPI_LL needs SH2_HAL_USE_DMA
+#endif
+
+// Set to 1 to deliver SPI packets on SH2_HAL_PRIO_CHAN as soon as they
+// are read, ahead of packets on other channels.  Those wait in the rx
+// buffers, in order, until the HAL task has no transfer to start or
+// finish, so a burst of control traffic or a batch drain doesn't hold
+// up the pose channel.
+#ifndef SH2_HAL_RX_LANES
+#define SH2_HAL_RX_LANES (1)
+#endif
+
+// SHTP channel of the priority lane: the SH-2 gyro rotation vector
+#ifndef SH2_HAL_PRIO_CHAN
+#define SH2_HAL_PRIO_CHAN (5)
+#endif
+
+// Number of SPI receive buffers.  With 2 or more, the next transfer starts
+// into a free buffer before the previous one is delivered to SHTP ("SPI rx
+// overlapped" counts these).  With 1, it waits for the SHTP parser.  With
+// SH2_HAL_RX_LANES, the buffers beyond the one being filled hold packets
+// waiting for delivery.
+#ifndef SH2_HAL_RX_BUFS
+#if SH2_HAL_RX_LANES
+#define SH2_HAL_RX_BUFS (4)
+#else
+#define SH2_HAL_RX_BUFS (2)
+#endif
+#endif
+#if SH2_HAL_RX_LANES && (SH2_HAL_RX_BUFS < 3)
+#error SH2_HAL_RX_LANES needs SH2_HAL_RX_BUFS of 3 or more
+#endif
+
+// Number of outbound SHTP packets the SPI HAL can hold while waiting for
+// INTN.  Callers of sh2_hal_tx only block once all slots are in use.
+// (A power of 2.)
+#ifndef SH2_HAL_TX_QUEUE
+#define SH2_HAL_TX_QUEUE (4)
+#endif
+
+// HAL task stacks [words].  Both run SHTP and the SH-2 library's
+// handlers from their rx callbacks; "mem" shows what is left unused.
+#ifndef SH2_HAL_SPI_STACK
+#define SH2_HAL_SPI_STACK (1024)
+#endif
+#ifndef SH2_HAL_I2C_STACK
+#define SH2_HAL_I2C_STACK (256)
+#endif
+
+// Set to 1 to read SHTP packets in one SPI transfer sized from the
+// previous packet, with a second transfer only if the header says more
+// remains.  0 always reads the 2-byte header first.
+#ifndef SH2_HAL_SPI_SPECULATIVE
+#define SH2_HAL_SPI_SPECULATIVE (1)
+#endif
+
+// SHTP reads the SPI HAL may make in one hold of the bus.  When a read
+// completes with INTN asserted again (or within SH2_HAL_SPI_BURST_WAIT_US
+// of CSN going high), the next read starts at once instead of going back
+// through the HAL task's event and the bus arbiter, which drains a hub
+// with several packets queued (batches, FRS) faster.  The cap bounds how
+// long other SPI clients wait.  1 releases the bus after every read.
+// Needs SH2_HAL_RX_BUFS > 1, so the bus isn't held during delivery.
+#ifndef SH2_HAL_SPI_BURST
+#define SH2_HAL_SPI_BURST (8)
+#endif
+#ifndef SH2_HAL_SPI_BURST_WAIT_US
+#define SH2_HAL_SPI_BURST_WAIT_US (10)
+#endif
+
+// INTN moderation: with a window set, an INTN that finds the SPI HAL
+// idle starts its read only after the window [us], so reports queued in
+// the meantime are drained in one burst (SH2_HAL_SPI_BURST) for one
+// wakeup of the HAL task.  Costs up to the window in latency; "intmod"
+// sets it at run time.  0 reads at once.
+#ifndef SH2_HAL_SPI_MODERATE
+#define SH2_HAL_SPI_MODERATE (1)
+#endif
+#ifndef SH2_HAL_SPI_MODERATE_US
+#define SH2_HAL_SPI_MODERATE_US (0)
+#endif
+#define SH2_HAL_SPI_MODERATE_MAX_US (100000)
+#if SH2_HAL_SPI_MODERATE && (SH2_HAL_SPI_MODERATE_US > SH2_HAL_SPI_MODERATE_MAX_US)
+#error SH2_HAL_SPI_MODERATE_US must be at most SH2_HAL_SPI_MODERATE_MAX_US
+#endif
+
+// Set to 1 to size I2C reads from recent packet lengths, so header and
+// cargo usually arrive in one transaction.  0 reads the header only when
+// no continuation is pending.
+#ifndef SH2_HAL_I2C_ADAPTIVE
+#define SH2_HAL_I2C_ADAPTIVE (1)
+#endif
+
+// Set to 1 to read each I2C packet in one transaction of exactly its
+// length: the rx DMA stream takes the SHTP header, and the rest of the
+// cargo it announces follows in the same read, with SCL stretched while
+// the second DMA leg is set up.  Makes SH2_HAL_I2C_ADAPTIVE moot.
+#ifndef SH2_HAL_I2C_COMBINED
+#define SH2_HAL_I2C_COMBINED (SH2_HAL_USE_DMA)
+#endif
+#if SH2_HAL_I2C_COMBINED && !SH2_HAL_USE_DMA
+#error SH2_HAL_I2C_COMBINED needs SH2_HAL_USE_DMA
+#endif
+
+// Set to 1 to deliver each SHTP packet longer than one I2C read as one
+// onRx call: its header-only and continuation reads are gathered into
+// one of SH2_HAL_I2C_REASM_BUFS pooled buffers of SH2_HAL_I2C_MAX_PACKET
+// bytes.  Longer packets, or any while the buffers are all in use, go
+// up read by read as before.
+#ifndef SH2_HAL_I2C_REASSEMBLE
+#define SH2_HAL_I2C_REASSEMBLE (1)
+#endif
+#ifndef SH2_HAL_I2C_MAX_PACKET
+#define SH2_HAL_I2C_MAX_PACKET (512)
+#endif
+#ifndef SH2_HAL_I2C_REASM_BUFS
+#define SH2_HAL_I2C_REASM_BUFS (1)
+#endif
+#if SH2_HAL_I2C_REASSEMBLE && (SH2_HAL_I2C_MAX_PACKET > 0x7FFE)
+#error SH2_HAL_I2C_MAX_PACKET must be at most 0x7FFE
+#endif
+
+// Set to 1 to support one I2C hub without INTN (intnPin 0 in its
+// sh2_hal_I2cDevice_t).  TIM2's alarm reads it once per report interval
+// (sh2_hal_i2cSetPollInterval()), at a phase that follows where data
+// turns up.  Holds the MCU out of STOP, where TIM2 stops.
+#ifndef SH2_HAL_I2C_POLL
+#define SH2_HAL_I2C_POLL (1)
+#endif
+
+// Poll interval of a hub without INTN while no sensor is enabled [us],
+// which bounds how long command responses wait
+#ifndef SH2_HAL_I2C_POLL_IDLE_US
+#define SH2_HAL_I2C_POLL_IDLE_US (10000)
+#endif
+
+// Shortest poll interval [us]
+#ifndef SH2_HAL_I2C_POLL_MIN_US
+#define SH2_HAL_I2C_POLL_MIN_US (1000)
+#endif
+#if SH2_HAL_I2C_POLL && (SH2_HAL_I2C_POLL_MIN_US < 100)
+#error SH2_HAL_I2C_POLL_MIN_US must be at least 100
+#endif
+
+// Initial I2C bus speed.  The STM32F401/411 I2C peripheral tops out at
+// 400kHz fast mode; the application may probe for a slower reliable rate.
+#ifndef SH2_HAL_I2C_HZ
+#define SH2_HAL_I2C_HZ (400000)
+#endif
+#define SH2_HAL_I2C_MAX_HZ (400000)
+
+// Slack allowed on top of an I2C transfer's time on the wire (for clock
+// stretching) before the HAL gives up on it and recovers the bus.
+#ifndef SH2_HAL_I2C_TIMEOUT_MS
+#define SH2_HAL_I2C_TIMEOUT_MS (5)
+#endif
+
+// Set to 1 for faster I2C DFU: poll for the bootloader after reset
+// instead of sleeping its worst-case start time, and start each packet
+// on DMA then return, so dfu() fetches the next packet while this one
+// goes out (its status is returned by the next call).  Follows
+// SH2_HAL_USE_DMA.
+#ifndef SH2_HAL_I2C_DFU_FAST
+#define SH2_HAL_I2C_DFU_FAST (SH2_HAL_USE_DMA)
+#endif
+
+// With SH2_HAL_I2C_DFU_FAST, how long an I2C DFU packet is resent while
+// the bootloader NACKs it (busy, e.g. writing flash) before it fails.
+#ifndef SH2_HAL_I2C_DFU_BUSY_MS
+#define SH2_HAL_I2C_DFU_BUSY_MS (20)
+#endif
+
+// Set to 1 to pace DFU bytes with TIM1 and DMA instead of a per-byte
+// busy loop.  Needs the SPI DMA streams, so follows SH2_HAL_USE_DMA.
+#ifndef SH2_HAL_DFU_PACED
+#define SH2_HAL_DFU_PACED (SH2_HAL_USE_DMA)
+#endif
+
+// SPI clock limits.  The prescaler giving the fastest clock at or below
+// the limit is chosen from the actual APB2 clock.  (BNO080 supports up to
+// 3MHz in SHTP mode; the bootloader needs a much slower clock.)
+#ifndef SH2_HAL_SPI_SHTP_HZ
+#define SH2_HAL_SPI_SHTP_HZ (3000000)
+#endif
+#ifndef SH2_HAL_SPI_DFU_HZ
+#define SH2_HAL_SPI_DFU_HZ (700000)
+#endif
+
+// Time from INTN by which an SPI read should have the bus.  With several
+// devices on one bus, the arbiter serves the read due soonest first.
+#ifndef SH2_HAL_SPI_READ_DEADLINE_US
+#define SH2_HAL_SPI_READ_DEADLINE_US (1000)
+#endif
+
+// Slack on top of an SHTP transfer's time on the wire before the SPI HAL
+// aborts it as lost, and how long sh2_hal_tx waits for a free queue slot
+// before failing.
+#ifndef SH2_HAL_SPI_TIMEOUT_MS
+#define SH2_HAL_SPI_TIMEOUT_MS (5)
+#endif
+#ifndef SH2_HAL_SPI_TX_TIMEOUT_MS
+#define SH2_HAL_SPI_TX_TIMEOUT_MS (100)
+#endif
+
+// How the SPI HAL wakes the hub for outbound packets:
+//   EACH:      assert WAKE for every packet.
+//   PIGGYBACK: only when no transfer is under way.  A packet queued during
+//              a transfer goes out on the next one, which the end of the
+//              current transfer asks for.
+//   HOLD:      as PIGGYBACK, and keep WAKE asserted for
+//              SH2_HAL_SPI_WAKE_HOLD_US after the last packet, so the rest
+//              of a command burst finds the hub already awake.
+// Both can be changed at run time with the "wake" console command.
+#define SH2_HAL_SPI_WAKE_EACH      (0)
+#define SH2_HAL_SPI_WAKE_PIGGYBACK (1)
+#define SH2_HAL_SPI_WAKE_HOLD      (2)
+#ifndef SH2_HAL_SPI_WAKE
+#define SH2_HAL_SPI_WAKE (SH2_HAL_SPI_WAKE_PIGGYBACK)
+#endif
+#ifndef SH2_HAL_SPI_WAKE_HOLD_US
+#define SH2_HAL_SPI_WAKE_HOLD_US (5000)
+#endif
 
 #endif  // end of include guard
@@ -0,0 +1,327 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Registry of SH-2 devices and the transports that reach them.
+ * Implements the sh2_hal API on device 0, and routes each INTN line to
+ * its device.
+ */
+
+#include "sh2_hal_registry.h"
+
+#include <stdio.h>
+#include <string.h>
+#include "sh2_err.h"
+#include "exti.h"
+#include "timebase.h"
+#include "sysstats.h"
+#include "sh2_client.h"
+#include "latency.h"
+#include "shell.h"
+
+#include "stm32f4xx_hal.h"
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "task.h"
+
+// ------------------------------------------------------------------------
+// Private types
+
+typedef struct {
+    const sh2_hal_Transport_t *transport;
+    unsigned unit;
+    uint16_t intnPin;
+
+    // Receiver given at the last reset, for sh2_hal_devRestart()
+    sh2_rxCallback_t *onRx;
+    void *cookie;
+
+    // Reset to ready, written by onExti once released
+    volatile bool awaitingReady;
+    uint64_t release_uS;
+    sh2_hal_ResetStats_t reset;
+} Device_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void onExti(void *arg, uint16_t pin, uint64_t t_uS);
+static void markReady(Device_t *pDev, uint64_t t_uS);
+static bool firstOfTransport(unsigned dev);
+static void utilCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static Device_t devices[SH2_HAL_MAX_DEVICES];
+static unsigned numDevices;
+
+// SH-2 library's blocking
+static SemaphoreHandle_t blockSem;
+
+// ------------------------------------------------------------------------
+// Public API
+
+int sh2_hal_addDevice(const sh2_hal_Transport_t *pTransport, unsigned unit, uint16_t intnPin)
+{
+    Device_t *pDev;
+
+    if (numDevices >= SH2_HAL_MAX_DEVICES) {
+        return SH2_ERR;
+    }
+    pDev = &devices[numDevices];
+
+    if (blockSem == 0) {
+        // Semaphore to block clients with block/unblock API
+        blockSem = xSemaphoreCreateBinary();
+    }
+
+    pDev->transport = pTransport;
+    pDev->unit = unit;
+    pDev->intnPin = intnPin;
+    if ((intnPin != 0) && (exti_register(intnPin, onExti, pDev) != 0)) {
+        return SH2_ERR;
+    }
+    if (numDevices == 0) {
+        sysstats_addCounter("hub reset to INTN us", &pDev->reset.lastUs);
+        sysstats_addCounter("hub reset INTN timeouts", &pDev->reset.timeouts);
+        shell_addCommand("util", "[reset] SPI/I2C busy %, transfers and bytes per second", utilCmd);
+    }
+
+    return numDevices++;
+}
+
+void sh2_hal_resetReleased(unsigned dev)
+{
+    Device_t *pDev = &devices[dev];
+
+    taskENTER_CRITICAL();
+    pDev->reset.resets++;
+    pDev->release_uS = timebase_getUs();
+    pDev->awaitingReady = true;
+    taskEXIT_CRITICAL();
+}
+
+void sh2_hal_polledData(unsigned dev, uint64_t t_uS)
+{
+    markReady(&devices[dev], t_uS);
+}
+
+bool sh2_hal_waitReady(unsigned dev, uint32_t timeout_ms)
+{
+    Device_t *pDev = &devices[dev];
+    TickType_t start = xTaskGetTickCount();
+
+    while (pDev->awaitingReady) {
+        if ((xTaskGetTickCount() - start) >= pdMS_TO_TICKS(timeout_ms)) {
+            if (timeout_ms != 0) {
+                pDev->reset.timeouts++;
+            }
+            return false;
+        }
+        vTaskDelay(1);
+    }
+
+    return true;
+}
+
+void sh2_hal_getResetStats(unsigned dev, sh2_hal_ResetStats_t *pStats)
+{
+    if (dev < numDevices) {
+        taskENTER_CRITICAL();
+        *pStats = devices[dev].reset;
+        taskEXIT_CRITICAL();
+    }
+}
+
+unsigned sh2_hal_numDevices(void)
+{
+    return numDevices;
+}
+
+const char *sh2_hal_devName(unsigned dev)
+{
+    return (dev < numDevices) ? devices[dev].transport->name : "";
+}
+
+int sh2_hal_devReset(unsigned dev, bool dfuMode, sh2_rxCallback_t *onRx, void *cookie)
+{
+    if (dev >= numDevices) {
+        return SH2_ERR_BAD_PARAM;
+    }
+
+    devices[dev].onRx = onRx;
+    devices[dev].cookie = cookie;
+    return devices[dev].transport->reset(devices[dev].unit, dfuMode, onRx, cookie);
+}
+
+int sh2_hal_devRestart(unsigned dev)
+{
+    if ((dev >= numDevices) || (devices[dev].onRx == 0)) {
+        return SH2_ERR_BAD_PARAM;
+    }
+
+    return devices[dev].transport->reset(devices[dev].unit, false,
+                                         devices[dev].onRx, devices[dev].cookie);
+}
+
+int sh2_hal_devTx(unsigned dev, uint8_t *pData, uint32_t len)
+{
+    if (dev >= numDevices) {
+        return SH2_ERR_BAD_PARAM;
+    }
+
+    return devices[dev].transport->tx(devices[dev].unit, pData, len);
+}
+
+int sh2_hal_devRx(unsigned dev, uint8_t *pData, uint32_t len)
+{
+    if (dev >= numDevices) {
+        return SH2_ERR_BAD_PARAM;
+    }
+
+    return devices[dev].transport->rx(devices[dev].unit, pData, len);
+}
+
+// The SH-2 library's HAL, on device 0
+
+int sh2_hal_reset(bool dfuMode, sh2_rxCallback_t *onRx, void *cookie)
+{
+    return sh2_hal_devReset(0, dfuMode, onRx, cookie);
+}
+
+int sh2_hal_tx(uint8_t *pData, uint32_t len)
+{
+    return sh2_hal_devTx(0, pData, len);
+}
+
+int sh2_hal_rx(uint8_t *pData, uint32_t len)
+{
+    return sh2_hal_devRx(0, pData, len);
+}
+
+// The client holding the API (sh2_client.h) blocks on its own semaphore,
+// so a response can't wake another task's wait.
+int sh2_hal_block(void)
+{
+    SemaphoreHandle_t sem = sh2Client_blockSem();
+
+    xSemaphoreTake((sem != 0) ? sem : blockSem, portMAX_DELAY);
+
+    return SH2_OK;
+}
+
+int sh2_hal_unblock(void)
+{
+    SemaphoreHandle_t sem = sh2Client_blockSem();
+
+    latency_cmdResponse();
+    xSemaphoreGive((sem != 0) ? sem : blockSem);
+
+    return SH2_OK;
+}
+
+void sh2_hal_getHealth(sh2_hal_Health_t *pHealth)
+{
+    if (numDevices > 0) {
+        devices[0].transport->getHealth(pHealth);
+    }
+}
+
+void sh2_hal_clearHealth(void)
+{
+    if (numDevices > 0) {
+        devices[0].transport->clearHealth();
+    }
+}
+
+// ------------------------------------------------------------------------
+// Private functions
+
+// Devices on one transport share its health counters: show them once
+static bool firstOfTransport(unsigned dev)
+{
+    for (unsigned n = 0; n < dev; n++) {
+        if (devices[n].transport == devices[dev].transport) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Bus meter of each transport since its last clear.  "reset" clears the
+// health counters along with it.
+static void utilCmd(int argc, char *argv[])
+{
+    bool reset = (argc > 1) && (strcmp(argv[1], "reset") == 0);
+    sh2_hal_Health_t h;
+
+    if (!reset) {
+        printf("%-8s %9s %6s %8s %9s %9s\n",
+               "Bus", "since ms", "Busy%", "xfers/s", "tx B/s", "rx B/s");
+    }
+    for (unsigned n = 0; n < numDevices; n++) {
+        const sh2_hal_Transport_t *t = devices[n].transport;
+
+        if (!firstOfTransport(n)) {
+            continue;
+        }
+        if (reset) {
+            t->clearHealth();
+            continue;
+        }
+
+        t->getHealth(&h);
+        uint64_t interval = timebase_getUs() - h.since_uS;
+        if (interval == 0) {
+            interval = 1;
+        }
+        unsigned busy = (unsigned)((h.busyUs * 1000) / interval);
+        printf("%-8s %9u %4u.%u %8u %9u %9u\n",
+               t->name, (unsigned)(interval / 1000), busy / 10, busy % 10,
+               (unsigned)(((uint64_t)h.transfers * 1000000) / interval),
+               (unsigned)(((uint64_t)h.txBytes * 1000000) / interval),
+               (unsigned)(((uint64_t)h.rxBytes * 1000000) / interval));
+    }
+}
+
+// INTN edge of one device
+static void onExti(void *arg, uint16_t pin, uint64_t t_uS)
+{
+    Device_t *pDev = (Device_t *)arg;
+
+    markReady(pDev, t_uS);
+    pDev->transport->onIntn(pDev->unit, t_uS);
+}
+
+// INTN of a device, or the first data read from one without it
+static void markReady(Device_t *pDev, uint64_t t_uS)
+{
+    if (pDev->awaitingReady) {
+        // First INTN since reset: the hub is up
+        uint32_t us = (t_uS > pDev->release_uS) ? (uint32_t)(t_uS - pDev->release_uS) : 0;
+
+        pDev->reset.ready++;
+        pDev->reset.lastUs = us;
+        pDev->reset.sumUs += us;
+        if (us > pDev->reset.maxUs) {
+            pDev->reset.maxUs = us;
+        }
+        pDev->awaitingReady = false;
+    }
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Registry of SH-2 devices and the transports that reach them.
+ *
+ * Each HAL (SPI, I2C) registers the devices it drives, so both can be
+ * linked into one firmware.  The first device registered is the one
+ * behind the sh2_hal API the SH-2 library uses; the others are reached
+ * with the sh2_hal_dev* calls.
+ */
+
+#ifndef SH2_HAL_REGISTRY_H
+#define SH2_HAL_REGISTRY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sh2_hal.h"
+#include "sh2_hal_health.h"
+
+// SH-2 devices, over all transports
+#ifndef SH2_HAL_MAX_DEVICES
+#define SH2_HAL_MAX_DEVICES (3)
+#endif
+
+// How long the HALs hold RSTN low.  The hub only needs a short pulse;
+// the rest of the reset sequence waits on INTN, not on fixed delays.
+#ifndef SH2_HAL_RESET_HOLD_US
+#define SH2_HAL_RESET_HOLD_US (1000)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    // What a HAL provides for each of its devices.  unit is the HAL's
+    // own number for the device.
+    typedef struct {
+        const char *name;
+        int (*reset)(unsigned unit, bool dfuMode, sh2_rxCallback_t *onRx, void *cookie);
+        int (*tx)(unsigned unit, uint8_t *pData, uint32_t len);
+        int (*rx)(unsigned unit, uint8_t *pData, uint32_t len);
+        void (*getHealth)(sh2_hal_Health_t *pHealth);
+        void (*clearHealth)(void);
+        void (*onIntn)(unsigned unit, uint64_t t_uS);  // INTN edge, from the EXTI ISR
+    } sh2_hal_Transport_t;
+
+    // Reset to ready of one device.  The hub asserts INTN once it is up:
+    // SH-2 with its advertisement, the bootloader once it runs.
+    typedef struct {
+        uint32_t resets;
+        uint32_t ready;      // resets followed by an INTN
+        uint32_t timeouts;   // sh2_hal_waitReady() calls that gave up
+        uint32_t lastUs;     // RSTN release to INTN, last reset
+        uint32_t maxUs;
+        uint64_t sumUs;      // over the resets that got ready
+    } sh2_hal_ResetStats_t;
+
+    // Register a device whose INTN is on EXTI line intnPin, with the EXTI
+    // dispatcher (exti.h), or with intnPin 0 one the HAL polls instead.
+    // Called by the HALs, before the scheduler starts.  Returns the
+    // device number, or SH2_ERR if the table is full or the EXTI line is
+    // taken.
+    int sh2_hal_addDevice(const sh2_hal_Transport_t *pTransport, unsigned unit, uint16_t intnPin);
+
+    // For the HALs: RSTN of dev has just been released.
+    void sh2_hal_resetReleased(unsigned dev);
+
+    // For the HALs: a poll of dev, which has no INTN, read data at t_uS.
+    // Stands in for the INTN that ends the wait after a reset.
+    void sh2_hal_polledData(unsigned dev, uint64_t t_uS);
+
+    // For the HALs: wait up to timeout_ms (0: just look) for INTN of dev
+    // since its release from reset.  Returns true if it came.  A HAL that
+    // must not go on before the hub is up falls back on the timeout.
+    bool sh2_hal_waitReady(unsigned dev, uint32_t timeout_ms);
+
+    void sh2_hal_getResetStats(unsigned dev, sh2_hal_ResetStats_t *pStats);
+
+    unsigned sh2_hal_numDevices(void);
+    const char *sh2_hal_devName(unsigned dev);
+
+    // sh2_hal_reset(), _tx() and _rx() for any device.  Each device
+    // delivers its own SHTP traffic to its own onRx.
+    int sh2_hal_devReset(unsigned dev, bool dfuMode, sh2_rxCallback_t *onRx, void *cookie);
+    int sh2_hal_devTx(unsigned dev, uint8_t *pData, uint32_t len);
+    int sh2_hal_devRx(unsigned dev, uint8_t *pData, uint32_t len);
+
+    // Reset dev again, into SH-2 mode, with the receiver of its last
+    // reset: clears the HAL's transfer state and pulses RSTN, and the
+    // hub's reset then restarts SHTP as at power-up.  For recovering a
+    // stalled device.  SH2_ERR_BAD_PARAM if it was never reset.
+    int sh2_hal_devRestart(unsigned dev);
+
+#ifdef __cplusplus
+}    // end of extern "C"
+#endif
+
+#endif
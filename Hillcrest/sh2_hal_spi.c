@@ -24,12 +24,31 @@
  */
 
 
+#include <stdlib.h>
 #include <string.h>
 
 #include "sh2_hal_spi.h"
+#include "sh2_hal_registry.h"
 #include "sh2_hal.h"
 #include "sh2_err.h"
 #include "dbg.h"
+#include "trace.h"
+#include "coredump.h"
+#include "timebase.h"
+#include "sysstats.h"
+#include "placement.h"
+#include "isr_stamp.h"
+#include "spsc.h"
+#include "latency.h"
+#include "cycle_budget.h"
+#include "shtp_capture.h"
+#include "spi_bus.h"
+#include "gpio_fast.h"
+#include "shell.h"
+#include "microbench.h"
+#include "rtos_static.h"
+#include "priorities.h"
+#include "power.h"
 
 
 #include "stm32f4xx_hal.h"
@@ -41,15 +60,24 @@
 #include "semphr.h"
 
 // Timing parameters for DFU
-#define DFU_BOOT_DELAY (50)          // [mS]
-#define RESET_DELAY    (10)          // [mS]
+#define DFU_BOOT_DELAY (50)          // [mS] worst case, unless INTN comes first
+#define RESET_DELAY    (10)          // [mS] for flash writes after DFU
 #define DFU_CS_DEASSERT_DELAY_RX (0) // [mS]
 #define DFU_CS_DEASSERT_DELAY_TX (5) // [mS]
 #define DFU_CS_TIMING_US (20)        // [uS]
 #define DFU_BYTE_TIMING_US (28)      // [uS]
+#define DFU_PACED_TIMEOUT (50)       // [mS] one paced packet, worst case
 
-#define MAX_EVENTS (16)
 #define SHTP_HEADER_LEN (4)
+#define SHTP_MAX_CHAN (7)
+
+// SHTP clock self-check: after this many malformed headers before the
+// first good one, the clock is halved (down to SPI_MIN_HZ) and the hub reset.
+#define SPI_SELF_CHECK_ERRORS (2)
+#define SPI_MIN_HZ (300000)
+
+// Burst reads keep the bus across packets (SH2_HAL_SPI_BURST)
+#define SPI_BURST ((SH2_HAL_SPI_BURST > 1) && (SH2_HAL_RX_BUFS > 1))
 
 #define RSTN_GPIO_PORT GPIOB
 #define RSTN_GPIO_PIN  GPIO_PIN_4
@@ -73,88 +101,225 @@ typedef enum {
     TRANSFER_IDLE = 0,    // SPI device not in use
     TRANSFER_DATA,        // Transferring bulk of data (DFU transfer or second phase SHTP)
     TRANSFER_HDR,         // Transferring first two bytes of SHTP
+    TRANSFER_SPEC,        // Transferring header and expected payload together
 } TransferPhase_t;
 
 // SPI Bus access
 static SPI_HandleTypeDef *hspi;
-static SemaphoreHandle_t spiMutex;
+static int busReads;           // spi_bus client for INTN-driven transfers
+static int busControl;         // ... and for reset, DFU and recovery
+static int busHeld;            // whichever of the two holds the bus
 static int spiOpStatus;
-static const uint8_t txZeros[SH2_HAL_MAX_TRANSFER];
-static const uint8_t* spiTxData;
+static const uint8_t txIdle;   // clocked out for every byte of a read
+#if SH2_HAL_SPI_LL
+// Flags of the SPI rx (DMA2 Stream 0) and tx (Stream 3) streams in LIFCR
+#define LL_DMA_FLAGS (DMA_LIFCR_CTCIF0 | DMA_LIFCR_CHTIF0 | DMA_LIFCR_CTEIF0 | \
+                      DMA_LIFCR_CDMEIF0 | DMA_LIFCR_CFEIF0 | \
+                      DMA_LIFCR_CTCIF3 | DMA_LIFCR_CHTIF3 | DMA_LIFCR_CTEIF3 | \
+                      DMA_LIFCR_CDMEIF3 | DMA_LIFCR_CFEIF3)
+static volatile bool llBusy;   // an SHTP transfer is on the streams
+#endif
+static const uint8_t* spiTxData; // 0: nothing to send, clock out txIdle
 static uint8_t* spiRxData;
 static uint16_t spiTransferLen;
 static TransferPhase_t transferPhase;
-
-// HAL Queue and Task
-static QueueHandle_t evtQueue = 0;
-osThreadId halTaskHandle;
-
+static uint16_t specLen;        // expected length of next SHTP read (0: unknown)
+static uint32_t spiShtpHz = SH2_HAL_SPI_SHTP_HZ;  // lowered by self-check
+static bool shtpVerified;      // good SHTP header seen since reset
+static unsigned framingErrors; // bad SHTP headers since reset
+
+// DFU transfers.  When paced, TIM1 update events drive DMA2 Stream 5
+// (Channel 6) to write one byte per DFU_BYTE_TIMING_US into SPI1->DR, and
+// the SPI RX DMA stream collects what comes back.  A tx returns as soon as
+// its packet is started; the next call waits for it.
+static sh2_hal_DfuStats_t dfuStats;
+
+// WAKE strategy, see SH2_HAL_SPI_WAKE
+static volatile unsigned wakeMode = SH2_HAL_SPI_WAKE;
+static volatile uint32_t wakeHold_uS = SH2_HAL_SPI_WAKE_HOLD_US;
+static uint64_t wakeUntil_uS;        // end of hold after the last packet
+static sh2_hal_WakeStats_t wakeStats;
+static uint64_t dfuReturn_uS;        // last return to caller
+#if SH2_HAL_DFU_PACED
+static DMA_HandleTypeDef hdmaDfuPace;
+static SemaphoreHandle_t dfuDoneSem;
+DMA_BUF static uint8_t dfuTxBuf[SH2_HAL_MAX_TRANSFER];
+static bool dfuPending;              // paced transfer in flight
+static volatile int dfuStatus;
+static uint64_t dfuStart_uS;         // CSN asserted
+static volatile uint64_t dfuCsHigh_uS;  // CSN deasserted
+static uint32_t dfuGap_uS;           // required CSN high time before next op
+#endif
+
+// HAL Task and its ISR event timestamps
+#define HAL_TASK_STACK (SH2_HAL_SPI_STACK)
+static osThreadId halTaskHandle;
+static IsrStamp_t intnStamp;
+static int devNum;                   // in the registry
+static IsrStamp_t cpltStamp;
+static uint32_t intnSeen;           // INTNs handled
+static uint32_t cpltSeen;           // completions handled (or abandoned)
+static uint32_t spiTimeouts;        // transfers aborted by the watchdog
+static uint32_t spiTimeoutUs;       // INTN to recovery, over all of them
+static uint32_t rxOverlapped;       // transfers started before the last was delivered
+#if SH2_HAL_RX_LANES
+static uint32_t rxHeldFull;         // held packets delivered early to free a buffer
+static uint32_t rxPrioAhead;        // priority packets delivered ahead of held ones
+#endif
+static sh2_hal_Health_t health;
+static uint64_t csnLow_uS;          // CSN asserted for the SHTP transfer
+static uint32_t xferStart;          // cycle count at its first phase
+#if SPI_BURST
+static bool busBurst;               // bus kept for the next read
+static unsigned burstReads;         // reads in this hold of the bus
+static uint32_t burstCount;         // reads started without retaking the bus
+#endif
+#if SH2_HAL_SPI_MODERATE
+static volatile uint32_t modWindow_uS = SH2_HAL_SPI_MODERATE_US;
+static bool modDraining;            // reads since a window closed
+static uint32_t modWindows;         // windows waited out
+static uint32_t modReads;           // reads they drained
+#endif
+RTOS_STACK_DEF(halTaskStack, HAL_TASK_STACK);
+
+
+// A packet queued to send
+typedef struct {
+    uint8_t buf[SH2_HAL_MAX_TRANSFER];
+    uint16_t len;
+    uint64_t queued_uS;
+} TxSlot_t;
 
 typedef struct {
     bool dfuMode;
-    void (*rstn)(bool);
-    void (*bootn)(bool);
-    void (*csn)(bool);
-    void (*waken)(bool);
+    GpioPin_t rstn;
+    GpioPin_t bootn;
+    GpioPin_t csn;
+    GpioPin_t waken;
     sh2_rxCallback_t *onRx;
     void *onRxCookie;
 
     // Rx resources
-    uint8_t rxBuf[SH2_HAL_MAX_TRANSFER];
-    uint16_t rxLen;
-
-    // Tx resources
-    SemaphoreHandle_t txMutex;
-    uint8_t txBuf[SH2_HAL_MAX_TRANSFER];
-    uint16_t txLen;
-
-    uint32_t pending_t_uS;
-    uint32_t t_uS;
-    
-    SemaphoreHandle_t blockSem;
+    uint8_t rxBuf[SH2_HAL_RX_BUFS][SH2_HAL_MAX_TRANSFER];
+    uint16_t rxLen[SH2_HAL_RX_BUFS];
+    unsigned rxIdx;    // buffer the next/current transfer fills
+#if SH2_HAL_RX_LANES
+    // Packets off the priority lane waiting for delivery, oldest first.
+    // Buffers fill in turn, so the oldest is always the next to refill.
+    uint64_t rxT_uS[SH2_HAL_RX_BUFS];
+    uint8_t held[SH2_HAL_RX_BUFS];
+    unsigned heldTail;            // index in held of the oldest
+    unsigned heldCount;
+#endif
+
+    // Tx resources: packets queued for INTN-driven transfers.  Writers
+    // fill the ring under txMutex, the HAL task sends and empties it.
+    SemaphoreHandle_t txMutex;    // serializes writers, held only for the copy
+    SemaphoreHandle_t txSlots;    // counts free queue slots
+    SPSC_RING(TxSlot_t, SH2_HAL_TX_QUEUE) tx;
+    uint16_t txLen;               // length sent by the op in progress
+
+    uint64_t pending_t_uS;
+    uint64_t t_uS;
+    TickType_t opStart;           // tick the op in progress started
     
     // State machine state
     enum {
         DEV_IDLE,
         DEV_IN_PROG,
         DEV_NEW_INTN,
+        DEV_MODERATING,           // INTN waiting out the moderation window
     } state;
 } Dev_t;
-Dev_t dev;
-
-typedef enum {
-    EVT_INTN,
-    EVT_OP_CPLT,
-    EVT_OP_ERR,
-} EventId_t;
+DMA_BUF static Dev_t dev;
 
-typedef struct {
-    EventId_t id;
-    uint32_t t_uS;
-} Event_t;
+// Notification bits from ISRs to halTask
+#define EVT_INTN    (1 << 0)
+#define EVT_OP_CPLT (1 << 1)
+#define EVT_OP_ERR  (1 << 2)
+#define EVT_MOD_END (1 << 3)
+#define EVT_ALL     (EVT_INTN | EVT_OP_CPLT | EVT_OP_ERR | EVT_MOD_END)
 
 // ----------------------------------------------------------------------------------
 // Forward declarations
 // ----------------------------------------------------------------------------------
+static int devReset(unsigned unit, bool dfuMode, sh2_rxCallback_t *onRx, void *cookie);
+static int devTx(unsigned unit, uint8_t *pData, uint32_t len);
+static int devRx(unsigned unit, uint8_t *pData, uint32_t len);
+static void getHealth(sh2_hal_Health_t *pHealth);
+static void clearHealth(void);
+static void onIntn(unsigned unit, uint64_t t_uS);
 static void halTask(const void *params);
-static void rstn0(bool state);
-static void bootn0(bool state);
-static void csn0(bool state);
-static void waken0(bool state);
+static void takeBus(void);
+static void takeBusForRead(uint64_t intn_uS);
+static void relBus(void);
 static void spiReset(bool dfuMode);
+static uint32_t spiPrescaler(uint32_t maxHz);
+static bool shtpSelfCheck(unsigned buf);
+static void spiSlowDown(void);
+static bool wakeHeld(void);
+static void wakeCmd(int argc, char *argv[]);
 
 static int tx_dfu(uint8_t* pData, uint32_t len);
 static int tx_shtp(uint8_t* pData, uint32_t len);
 static int rx_dfu(uint8_t* pData, uint32_t len);
 
-static void delayUs(uint32_t count);
+#if SH2_HAL_DFU_PACED
+static void dfuPaceInit(void);
+static int dfuStartPaced(const uint8_t *pTx, uint8_t *pRx, uint32_t len);
+static int dfuFinish(void);
+static void dfuWaitGap(void);
+static void dfuRxCplt(DMA_HandleTypeDef *hdma);
+static void dfuRxError(DMA_HandleTypeDef *hdma);
+#endif
+static void dfuEnter(void);
+static int dfuLeave(int status);
+static int spiStartTxRx(const uint8_t *pTx, uint8_t *pRx, uint16_t len);
+#if SH2_HAL_SPI_LL
+static void spiStopTxRx(void);
+#endif
+static uint16_t shtpXferLen(void);
+static void opComplete(void);
+#if SH2_HAL_RX_LANES
+static void routeRx(unsigned buf, uint64_t t_uS);
+static void deliverHeld(void);
+#endif
+static void startNextOp(void);
+static void startIntnOp(void);
+#if SH2_HAL_SPI_MODERATE
+static void modAlarm(void);
+static void intmodCmd(int argc, char *argv[]);
+#endif
+static bool takeIntn(uint64_t *pT_uS);
+static bool intnAsserted(void);
+static void recheckIntnLevel(void);
+#if SPI_BURST
+static bool intnWithin(uint32_t wait_us);
+#endif
+static TickType_t opTimeout(void);
+static void abortOpShtp(void);
+#if MICROBENCH
+static void benchCplt(unsigned n);
+static void benchOpComplete(unsigned n);
+static void benchStart(unsigned n);
+#endif
+
+static const sh2_hal_Transport_t spiTransport = {
+    .name = "spi",
+    .reset = devReset,
+    .tx = devTx,
+    .rx = devRx,
+    .getHealth = getHealth,
+    .clearHealth = clearHealth,
+    .onIntn = onIntn,
+};
 
 
 // ----------------------------------------------------------------------------------
 // Public API
 // ----------------------------------------------------------------------------------
 // Initialize SH-2 HAL subsystem
-void sh2_hal_init(SPI_HandleTypeDef* _hspi) 
+void sh2_hal_spiInit(SPI_HandleTypeDef* _hspi) 
 {
     // Store reference to SPI peripheral
     hspi = _hspi;
@@ -167,92 +332,181 @@ void sh2_hal_init(SPI_HandleTypeDef* _hspi)
     // Semaphore to protect transmit state
     dev.txMutex = xSemaphoreCreateBinary();
     xSemaphoreGive(dev.txMutex);
+    dev.txSlots = xSemaphoreCreateCounting(SH2_HAL_TX_QUEUE, SH2_HAL_TX_QUEUE);
+
+    dev.rstn = (GpioPin_t){RSTN_GPIO_PORT, RSTN_GPIO_PIN};
+    dev.bootn = (GpioPin_t){BOOTN_GPIO_PORT, BOOTN_GPIO_PIN};
+    dev.csn = (GpioPin_t){CSN_GPIO_PORT, CSN_GPIO_PIN};
+    dev.waken = (GpioPin_t){WAKEN_GPIO_PORT, WAKEN_GPIO_PIN};
+
+    gpioFast_write(&dev.rstn, false);  // Hold in reset
+    gpioFast_write(&dev.bootn, true);  // SH-2, not DFU
+    gpioFast_write(&dev.csn, true);    // deassert CSN
+    gpioFast_write(&dev.waken, true);  // deassert WAKEN.
+
+    // Hub's clients of the SPI bus arbiter.  Reads are scheduled by
+    // their INTN deadline, everything else goes when the bus is free.
+    busReads = spiBus_addClient("sh2 intn", CSN_GPIO_PORT, CSN_GPIO_PIN);
+    busControl = spiBus_addClient("sh2 ctl", CSN_GPIO_PORT, CSN_GPIO_PIN);
+
+    sysstats_addCounter("SPI INTNs", &health.intns);
+    sysstats_addCounter("SPI INTNs merged", &health.intnMerged);
+    sysstats_addCounter("SPI INTNs collapsed", &health.intnCollapsed);
+    sysstats_addCounter("SPI INTNs rescued", &health.intnRescued);
+    sysstats_addCounter("SPI bus errors", &health.busErrors);
+    sysstats_addCounter("SPI truncated", &health.truncated);
+    sysstats_addCounter("SPI invalid len", &health.invalidLen);
+    sysstats_addCounter("SPI timeouts", &spiTimeouts);
+    sysstats_addCounter("SPI timeout us", &spiTimeoutUs);
+    sysstats_addCounter("SPI rx overlapped", &rxOverlapped);
+#if SPI_BURST
+    sysstats_addCounter("SPI burst reads", &burstCount);
+#endif
+#if SH2_HAL_RX_LANES
+    sysstats_addCounter("SPI rx held full", &rxHeldFull);
+    sysstats_addCounter("SPI rx prio ahead", &rxPrioAhead);
+#endif
+
+    sysstats_addMemory("SPI HAL buffers", sizeof(dev));
+#if SH2_HAL_DFU_PACED
+    sysstats_addMemory("SPI DFU buffer", sizeof(dfuTxBuf));
+#endif
+
+    coredump_addState("SPI state", &dev.state, sizeof(dev.state));
+    coredump_addState("SPI phase", &transferPhase, sizeof(transferPhase));
+    coredump_addState("SPI tx head", &dev.tx.idx.head, sizeof(dev.tx.idx.head));
+    coredump_addState("SPI tx tail", &dev.tx.idx.tail, sizeof(dev.tx.idx.tail));
+    shell_addCommand("wake", "[each | piggyback | hold <us>] SPI WAKE strategy", wakeCmd);
+#if SH2_HAL_SPI_MODERATE
+    shell_addCommand("intmod", "[<us>] SPI INTN moderation window", intmodCmd);
+#endif
 
-    // Semaphore to block clients with block/unblock API
-    dev.blockSem = xSemaphoreCreateBinary();
+    // Create task
+    osThreadDef(halThreadDef, halTask, PRIO_TASK_HAL, 1, HAL_TASK_STACK);
+    halTaskHandle = rtos_threadCreate(osThread(halThreadDef), NULL, RTOS_STACK(halTaskStack));
+    if (halTaskHandle == NULL) {
+        printf("Failed to create SH-2 HAL task.\n");
+    }
 
-    dev.rstn = rstn0;
-    dev.bootn = bootn0;
-    dev.csn = csn0;
-    dev.waken = waken0;
+    devNum = sh2_hal_addDevice(&spiTransport, 0, SH_INTN_Pin);
+    if (devNum < 0) {
+        printf("Failed to register SH-2 HAL.\n");
+    }
 
-    dev.rstn(false);  // Hold in reset
-    dev.bootn(true);  // SH-2, not DFU
-    dev.csn(true);    // deassert CSN
-    dev.waken(true);  // deassert WAKEN.
+#if MICROBENCH
+    microbench_add("HAL_SPI_TxRxCpltCallback", benchCplt);
+    microbench_add("halTask transfer done", benchOpComplete);
+    microbench_add("spiStartTxRx", benchStart);
+#endif
+}
 
-    // init mutex for spi bus
-    spiMutex = xSemaphoreCreateBinary();
-    xSemaphoreGive(spiMutex);
+void sh2_hal_getDfuStats(sh2_hal_DfuStats_t *pStats)
+{
+    *pStats = dfuStats;
+}
 
-    // Create queue to pass events from ISRs to task context.
-    evtQueue = xQueueCreate(MAX_EVENTS, sizeof(Event_t));
-    if (evtQueue == NULL) {
-        printf("The queue could not be created.\n");
-    }
+void sh2_hal_spiSetWake(unsigned mode, uint32_t hold_uS)
+{
+    wakeHold_uS = hold_uS;
+    wakeMode = mode;
+}
 
-    // Create task
-    osThreadDef(halThreadDef, halTask, osPriorityNormal, 1, 1024);
-    halTaskHandle = osThreadCreate(osThread(halThreadDef), NULL);
-    if (halTaskHandle == NULL) {
-        printf("Failed to create SH-2 HAL task.\n");
-    }
+void sh2_hal_getWakeStats(sh2_hal_WakeStats_t *pStats)
+{
+    *pStats = wakeStats;
+}
+
+uint32_t sh2_hal_spiGetSpeed(void)
+{
+    return spiShtpHz;
+}
+
+#if SH2_HAL_SPI_MODERATE
+void sh2_hal_spiSetModeration(uint32_t window_us)
+{
+    // Takes effect from the next INTN that finds the HAL idle
+    modWindow_uS = (window_us < SH2_HAL_SPI_MODERATE_MAX_US) ? window_us : SH2_HAL_SPI_MODERATE_MAX_US;
 }
+#endif
+
+// ----------------------------------------------------------------------------------
+// Transport, called through the registry
+// ----------------------------------------------------------------------------------
 
 // Reset an SH-2 module (into DFU mode, if flag is true)
 // The onRx callback function is registered with the HAL at the same time.
-int sh2_hal_reset(bool dfuMode,
-                  sh2_rxCallback_t *onRx,
-                  void *cookie)
+static int devReset(unsigned unit,
+                    bool dfuMode,
+                    sh2_rxCallback_t *onRx,
+                    void *cookie)
 {
+#if SH2_HAL_DFU_PACED
+    // Let the last DFU packet finish
+    dfuFinish();
+#endif
+    if (dfuMode) {
+        memset(&dfuStats, 0, sizeof(dfuStats));
+        dfuReturn_uS = 0;
+    }
+
     // Get exclusive access to SPI bus (blocking until we do.)
-    xSemaphoreTake(spiMutex, portMAX_DELAY);
+    takeBus();
+
+    bool afterDfu = dev.dfuMode;
 
     // Store params for later reference
     dev.dfuMode = dfuMode;
     dev.onRxCookie = cookie;
     dev.onRx = onRx;
 
-    // Wait a bit before asserting reset.
-    // (Because this may be a reset after a DFU and that process needs
-    // an extra few ms to store data in flash before the device is
-    // actually reset.)
-    vTaskDelay(RESET_DELAY); 
+    // Wait a bit before asserting reset, if this is a reset after a DFU.
+    // (That process needs an extra few ms to store data in flash before
+    // the device is actually reset.  At power-up there is nothing to
+    // wait for.)
+    if (afterDfu) {
+        vTaskDelay(RESET_DELAY);
+    }
        
     // Assert reset
-    dev.rstn(0);
+    gpioFast_write(&dev.rstn, 0);
 
     // Deassert CSN in case it was asserted
-    dev.csn(1);
+    gpioFast_write(&dev.csn, 1);
     
     // Set BOOTN according to dfuMode
-    dev.bootn(dfuMode ? 0 : 1);
+    gpioFast_write(&dev.bootn, dfuMode ? 0 : 1);
 
     // set PS0 (WAKEN) to support booting into SPI mode.
-    dev.waken(1);
+    gpioFast_write(&dev.waken, 1);
+    wakeUntil_uS = 0;
     
     // Reset SPI parameters
     spiReset(dfuMode);
+    shtpVerified = false;
+    framingErrors = 0;
+    specLen = 0;
 
     // Wait for reset to take effect
-    vTaskDelay(RESET_DELAY); 
+    timebase_delayUs(SH2_HAL_RESET_HOLD_US);
        
-    // Deassert reset
-    dev.rstn(1);
+    // Deassert reset.  SH-2 mode needs no wait: its first INTN starts the
+    // first read.
+    gpioFast_write(&dev.rstn, 1);
+    sh2_hal_resetReleased(devNum);
 
-    // If reset into DFU mode, wait until bootloader should be ready
+    // If reset into DFU mode, wait until bootloader is ready
     if (dfuMode) {
-        vTaskDelay(DFU_BOOT_DELAY);
+        sh2_hal_waitReady(devNum, DFU_BOOT_DELAY);
     }
 
     // Give up ownership of SPI bus.
-    xSemaphoreGive(spiMutex);
+    relBus();
 
     return SH2_OK;
 }
 
 // Send data to SH-2
-int sh2_hal_tx(uint8_t *pData, uint32_t len)
+static int devTx(unsigned unit, uint8_t *pData, uint32_t len)
 {
     // Do nothing if len is zero
     if (len == 0) {
@@ -270,7 +524,7 @@ int sh2_hal_tx(uint8_t *pData, uint32_t len)
 // Initiate a read of <len> bytes from SH-2
 // This is a blocking read, pData will contain read data on return
 // if return value was SH2_OK.
-int sh2_hal_rx(uint8_t* pData, uint32_t len)
+static int devRx(unsigned unit, uint8_t* pData, uint32_t len)
 {
     // Do nothing if len is zero
     if (len == 0) {
@@ -286,57 +540,67 @@ int sh2_hal_rx(uint8_t* pData, uint32_t len)
     }
 }
 
-int sh2_hal_block(void)
+static void getHealth(sh2_hal_Health_t *pHealth)
 {
-    xSemaphoreTake(dev.blockSem, portMAX_DELAY);
-
-    return SH2_OK;
+    *pHealth = health;
 }
 
-int sh2_hal_unblock(void)
+static void clearHealth(void)
 {
-    xSemaphoreGive(dev.blockSem);
-
-    return SH2_OK;
+    memset(&health, 0, sizeof(health));
+    health.since_uS = timebase_getUs();
 }
 
+
 // ----------------------------------------------------------------------------------
 // Callbacks for ISR, SPI Operations
 // ----------------------------------------------------------------------------------
 
-void HAL_GPIO_EXTI_Callback(uint16_t n)
+HOT_FN static void onIntn(unsigned unit, uint64_t t_uS)
 {
     BaseType_t woken= pdFALSE;
-    Event_t event;
-        
-    event.t_uS = xTaskGetTickCount()*1000;
-    event.id = EVT_INTN;
-    
-    xQueueSendFromISR(evtQueue, &event, &woken);
+
+    isrStamp_write(&intnStamp, t_uS);
+
+    if (halTaskHandle != 0) {
+        xTaskNotifyFromISR(halTaskHandle, EVT_INTN, eSetBits, &woken);
+    }
     portEND_SWITCHING_ISR(woken);
 }
 
-void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef * hspi)
+HOT_FN void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef * hspi)
 {
     BaseType_t woken= pdFALSE;
     bool opFinished = false;
-    Event_t event;
 
-    dbgPulse(2);
+    TRACE(TRACE_SPI_CPLT, transferPhase);
     
     // What to do next depends on transfer phase
-    if (transferPhase == TRANSFER_HDR) {
-        uint16_t txLen = (spiTxData[0] + (spiTxData[1] << 8) & ~0x8000);
-        uint16_t rxLen = (spiRxData[0] + (spiRxData[1] << 8) & ~0x8000);
-        if (rxLen == 0x7FFF) {
-            // 0x7FFF is an invalid length
-            rxLen = 0;
+    if (transferPhase == TRANSFER_SPEC) {
+        uint16_t len = shtpXferLen();
+
+        if (len > spiTransferLen) {
+            // Packet is longer than expected, fetch the rest.
+            transferPhase = TRANSFER_DATA;
+            TRACE(TRACE_SPI_START, len-spiTransferLen);
+            int rc = spiStartTxRx(spiTxData ? spiTxData+spiTransferLen : 0,
+                                  (spiRxData+spiTransferLen),
+                                  len-spiTransferLen);
+            spiTransferLen = len;
+            if (rc != 0) {
+                spiOpStatus = SH2_ERR_IO;
+                opFinished = true;
+            }
         }
-        
-        uint16_t len = (txLen > rxLen) ? txLen : rxLen;
-        if (len > SH2_HAL_MAX_TRANSFER) {
-            len = SH2_HAL_MAX_TRANSFER;
+        else {
+            // Everything arrived in one transfer
+            spiTransferLen = len;
+            spiOpStatus = SH2_OK;
+            opFinished = true;
         }
+    }
+    else if (transferPhase == TRANSFER_HDR) {
+        uint16_t len = shtpXferLen();
 
         if (len == 0) {
             // Nothing left to transfer!
@@ -348,8 +612,8 @@ void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef * hspi)
             transferPhase = TRANSFER_DATA;
             spiTransferLen = len;
     
-            dbgPulse(5);
-            int rc = HAL_SPI_TransmitReceive_IT(hspi, (uint8_t*)(spiTxData+2), (spiRxData+2), len-2);
+            TRACE(TRACE_SPI_START, len-2);
+            int rc = spiStartTxRx(spiTxData ? spiTxData+2 : 0, (spiRxData+2), len-2);
             if (rc != 0) {
                 // Signal IO Error to HAL task
                 spiOpStatus = SH2_ERR_IO;
@@ -365,22 +629,53 @@ void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef * hspi)
     // If operation finished for any reason, unblock the caller
     if (opFinished) {
         transferPhase = TRANSFER_IDLE;
+        cycleBudget_check(BUDGET_STAGE_XFER, xferStart, spiTransferLen);
         
-        event.id = EVT_OP_CPLT;
-        event.t_uS = 99;    // not used
-
-        xQueueSendFromISR(evtQueue, &event, &woken);
+        isrStamp_write(&cpltStamp, timebase_getUs());
+        xTaskNotifyFromISR(halTaskHandle, EVT_OP_CPLT, eSetBits, &woken);
     }
 
     portEND_SWITCHING_ISR(woken);
 }
 
+#if SH2_HAL_SPI_LL
+// With the streams started by spiStartTxRx, rx complete means the last
+// byte out has gone too, so the transfer is over.
+HOT_FN bool sh2_hal_spiDmaIrq(void)
+{
+    if (!llBusy) {
+        return false;
+    }
+
+    uint32_t isr = DMA2->LISR;
+    if ((isr & (DMA_LISR_TCIF0 | DMA_LISR_TEIF0)) == 0) {
+        // Nothing but a direct mode or FIFO flag: not done yet
+        DMA2->LIFCR = DMA_LIFCR_CDMEIF0 | DMA_LIFCR_CFEIF0;
+        return true;
+    }
+
+    hspi->Instance->CR2 &= ~(SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN);
+    DMA2->LIFCR = LL_DMA_FLAGS;
+    llBusy = false;
+
+    if (isr & DMA_LISR_TEIF0) {
+        spiStopTxRx();
+        hspi->ErrorCode |= HAL_SPI_ERROR_DMA;
+        HAL_SPI_ErrorCallback(hspi);
+    }
+    else {
+        HAL_SPI_TxRxCpltCallback(hspi);
+    }
+
+    return true;
+}
+#endif
+
 void HAL_SPI_ErrorCallback(SPI_HandleTypeDef * hspi)
 {
     BaseType_t woken= pdFALSE;
-    Event_t event;
 
-    dbgPulse(3);
+    TRACE(TRACE_SPI_ERROR, hspi->ErrorCode);
     
     // transfer is over
     transferPhase = TRANSFER_IDLE;
@@ -388,10 +683,7 @@ void HAL_SPI_ErrorCallback(SPI_HandleTypeDef * hspi)
     // Set status from this operation
     spiOpStatus = SH2_ERR_IO;
 
-    event.id = EVT_OP_ERR;
-    event.t_uS = 99;    // not used
-    
-    xQueueSendFromISR(evtQueue, &event, &woken);
+    xTaskNotifyFromISR(halTaskHandle, EVT_OP_ERR, eSetBits, &woken);
     
     portEND_SWITCHING_ISR(woken);
 }
@@ -402,177 +694,677 @@ void HAL_SPI_ErrorCallback(SPI_HandleTypeDef * hspi)
 
 static void takeBus(void)
 {
-    // get bus mutex
-    xSemaphoreTake(spiMutex, portMAX_DELAY);
+    // get bus, after any reads waiting for it
+    spiBus_acquire(busControl, SPI_BUS_NO_DEADLINE);
+    busHeld = busControl;
+}
+
+static void takeBusForRead(uint64_t intn_uS)
+{
+    // get bus, ahead of other devices whose reads are due later
+    spiBus_acquire(busReads, intn_uS + SH2_HAL_SPI_READ_DEADLINE_US);
+    busHeld = busReads;
 }
 
 static void relBus(void)
 {
     // Release bus
-    xSemaphoreGive(spiMutex);
+    spiBus_release(busHeld);
 }
 
-static void deliverRx(uint32_t t_uS)
+static void deliverRx(unsigned buf, uint64_t t_uS)
 {
     // Deliver results via onRx callback
+    // (The SH-2 API carries 32 bits of timestamp, it handles the wrap.)
+    // The buffer is owned by SHTP until onRx returns.
     if (dev.onRx != 0) {
-        if (dev.rxLen) {
-            dev.onRx(dev.onRxCookie, dev.rxBuf, dev.rxLen, t_uS);
+        if (dev.rxLen[buf]) {
+            latency_mark(LAT_DELIVER);
+            shtpCapture_record(dev.rxBuf[buf], dev.rxLen[buf], (uint32_t)t_uS);
+            uint32_t start = cycleBudget_start();
+            dev.onRx(dev.onRxCookie, dev.rxBuf[buf], dev.rxLen[buf], (uint32_t)t_uS);
+            cycleBudget_check(BUDGET_STAGE_DECODE, start, dev.rxLen[buf]);
         }
     }
 }
 
-static void endOpShtp(void)
+// End the SHTP transfer.  With mayHold, a completed read, the bus is
+// kept if the hub already has more (see SH2_HAL_SPI_BURST).
+static void endOpShtp(bool mayHold)
 {
+    uint32_t txLen = dev.txLen;
+
     // record rx len
-    dev.rxLen = spiTransferLen;
+    dev.rxLen[dev.rxIdx] = spiTransferLen;
     
-    // Release transmit mutex if it's held.
-    if (dev.txLen) {
+    // Free the queue slot that was just sent.
+    bool sent = (dev.txLen != 0);
+    if (sent) {
         dev.txLen = 0;
-        dbgClr();
-        xSemaphoreGive(dev.txMutex);
+        spsc_pop(&dev.tx);
+        xSemaphoreGive(dev.txSlots);
+        wakeUntil_uS = timebase_getUs() + wakeHold_uS;
+    }
+
+    if (spsc_count(&dev.tx) != 0) {
+        // More queued, perhaps during this transfer: WAKE for another.
+        // (Writers run below the HAL task, so a packet published after
+        // this check finds the device idle and asserts WAKE itself.)
+        gpioFast_write(&dev.waken, false);
+    }
+    else if (wakeHeld()) {
+        // Hub stays awake for the rest of the burst
+        wakeStats.held++;
+        gpioFast_write(&dev.waken, false);
+    }
+    else {
+        gpioFast_write(&dev.waken, true);
+        if (sent) {
+            dbgClr();
+        }
     }
 
     // deassert CSN
-    dev.csn(true);
+    gpioFast_write(&dev.csn, true);
+    sh2_hal_meter(&health, (uint32_t)(timebase_getUs() - csnLow_uS), txLen, spiTransferLen);
+
+#if SPI_BURST
+    if (mayHold && (burstReads < SH2_HAL_SPI_BURST) && intnWithin(SH2_HAL_SPI_BURST_WAIT_US)) {
+        busBurst = true;
+        return;
+    }
+#endif
 
     // Release the bus
     relBus();
 }
 
+#if SPI_BURST
+// True if INTN is asserted, or gets asserted within wait_us
+static bool intnWithin(uint32_t wait_us)
+{
+    uint64_t start_uS = timebase_getUs();
+
+    do {
+        if (intnAsserted()) {
+            return true;
+        }
+    } while ((timebase_getUs() - start_uS) < wait_us);
+
+    return false;
+}
+#endif
+
 static int startOpShtp(void)
 {
     int retval = 0;
     
-    // Set up operation on bus
-    takeBus();
+    // Set up operation on bus, unless the last read kept it
+#if SPI_BURST
+    if (busBurst) {
+        busBurst = false;
+        burstReads++;
+        burstCount++;
+    }
+    else {
+        takeBusForRead(dev.t_uS);
+        burstReads = 1;
+    }
+#else
+    takeBusForRead(dev.t_uS);
+#endif
+#if SH2_HAL_SPI_MODERATE
+    if (modDraining) {
+        modReads++;
+    }
+#endif
+    dev.opStart = xTaskGetTickCount();
                     
     // assert CSN
-    dev.csn(false);
+    gpioFast_write(&dev.csn, false);
+    csnLow_uS = timebase_getUs();
     
-    // Read into device's rxBuf
-    spiRxData = dev.rxBuf;
+    // Read into device's current rxBuf
+    spiRxData = dev.rxBuf[dev.rxIdx];
                     
-    // If there is stuff to transmit, deassert WAKE and do it now.
-    spiTxData = txZeros;
-    if (dev.txLen) {
-        dev.waken(true);
-        spiTxData = dev.txBuf;
+    // If there is stuff queued, deassert WAKE and send the oldest packet now.
+    spiTxData = 0;
+    TxSlot_t *pTx = spsc_readSlot(&dev.tx);
+    if (pTx != 0) {
+        dev.txLen = pTx->len;
+        if (!wakeHeld()) {
+            gpioFast_write(&dev.waken, true);
+        }
+        spiTxData = pTx->buf;
+        latency_cmd(LAT_CMD_HAL_TX, pTx->queued_uS);
+        latency_cmdBus();
     }
 
     // initiate (Header phase of) transfer
+    latency_begin(dev.t_uS);
+    latency_mark(LAT_XFER_START);
+    power_readStarted();
     transferPhase = TRANSFER_HDR;
     spiTransferLen = 2;
-    dbgPulse(5);
-    int rc = HAL_SPI_TransmitReceive_IT(hspi, (uint8_t*)spiTxData, spiRxData, 2);
+#if SH2_HAL_SPI_SPECULATIVE
+    if (specLen > 2) {
+        // Read header and expected payload in one go
+        transferPhase = TRANSFER_SPEC;
+        spiTransferLen = (dev.txLen > specLen) ? dev.txLen : specLen;
+    }
+#endif
+    TRACE(TRACE_SPI_START, spiTransferLen);
+    xferStart = cycleBudget_start();
+    int rc = spiStartTxRx(spiTxData, spiRxData, spiTransferLen);
     if (rc != 0) {
         // Failed to start!  Abort!
-        endOpShtp();
+        endOpShtp(false);
         retval = -1;
     }
 
     return retval;
 }
 
+// Start one phase of an SHTP transfer.  Completion is signalled through
+// HAL_SPI_TxRxCpltCallback or HAL_SPI_ErrorCallback in either mode.
+// With pTx == 0 only zeros are sent, without a buffer of them: the tx DMA
+// stream repeats txIdle, or the IT driver sends from the zeroed pRx, each
+// byte leaving before the received one overwrites it.
+HOT_FN static int spiStartTxRx(const uint8_t *pTx, uint8_t *pRx, uint16_t len)
+{
+#if SH2_HAL_SPI_LL
+    DMA_Stream_TypeDef *rx = hspi->hdmarx->Instance;
+    DMA_Stream_TypeDef *tx = hspi->hdmatx->Instance;
+    SPI_TypeDef *spi = hspi->Instance;
+
+    if ((len == 0) || ((rx->CR | tx->CR) & DMA_SxCR_EN)) {
+        // Nothing to move (the ST HAL refuses too), or a stream still runs
+        return -1;
+    }
+
+    // Channel, direction and widths stay as HAL_DMA_Init left them.  Only
+    // rx interrupts; tx is sending zeros (no MINC) unless pTx is given.
+    DMA2->LIFCR = LL_DMA_FLAGS;
+    rx->NDTR = len;
+    rx->PAR = (uint32_t)&spi->DR;
+    rx->M0AR = (uint32_t)pRx;
+    rx->FCR &= ~DMA_SxFCR_FEIE;
+    rx->CR = (rx->CR & ~(DMA_SxCR_HTIE | DMA_SxCR_DMEIE)) | DMA_SxCR_TCIE | DMA_SxCR_TEIE;
+
+    uint32_t txCr = tx->CR & ~(DMA_SxCR_TCIE | DMA_SxCR_HTIE | DMA_SxCR_TEIE |
+                               DMA_SxCR_DMEIE | DMA_SxCR_MINC);
+    tx->NDTR = len;
+    tx->PAR = (uint32_t)&spi->DR;
+    tx->M0AR = (uint32_t)((pTx != 0) ? pTx : &txIdle);
+    tx->FCR &= ~DMA_SxFCR_FEIE;
+    tx->CR = (pTx != 0) ? (txCr | DMA_SxCR_MINC) : txCr;
+
+    llBusy = true;
+    rx->CR |= DMA_SxCR_EN;
+    tx->CR |= DMA_SxCR_EN;
+
+    // Rx requests first, so the first byte in isn't missed
+    spi->CR2 |= SPI_CR2_RXDMAEN;
+    spi->CR1 |= SPI_CR1_SPE;
+    spi->CR2 |= SPI_CR2_TXDMAEN;
+
+    return 0;
+#elif SH2_HAL_USE_DMA
+    // The stream is idle between transfers, so MINC may be changed here
+    if (pTx == 0) {
+        hspi->hdmatx->Instance->CR &= ~DMA_SxCR_MINC;
+        pTx = &txIdle;
+    }
+    else {
+        hspi->hdmatx->Instance->CR |= DMA_SxCR_MINC;
+    }
+    return HAL_SPI_TransmitReceive_DMA(hspi, (uint8_t*)pTx, pRx, len);
+#else
+    if (pTx == 0) {
+        memset(pRx, 0, len);
+        pTx = pRx;
+    }
+    return HAL_SPI_TransmitReceive_IT(hspi, (uint8_t*)pTx, pRx, len);
+#endif
+}
+
+#if SH2_HAL_SPI_LL
+// Stop the streams of a transfer spiStartTxRx started.  A stream stops
+// once the byte it is moving is done.
+static void spiStopTxRx(void)
+{
+    DMA_Stream_TypeDef *rx = hspi->hdmarx->Instance;
+    DMA_Stream_TypeDef *tx = hspi->hdmatx->Instance;
+
+    llBusy = false;
+    hspi->Instance->CR2 &= ~(SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN);
+    rx->CR &= ~DMA_SxCR_EN;
+    tx->CR &= ~DMA_SxCR_EN;
+    while ((rx->CR | tx->CR) & DMA_SxCR_EN) {
+    }
+    DMA2->LIFCR = LL_DMA_FLAGS;
+}
+#endif
+
+// Length of the current SHTP transfer, from the tx and rx headers.
+// Also learns the expected length of the next read.
+HOT_FN static uint16_t shtpXferLen(void)
+{
+    uint16_t txLen = spiTxData ? (spiTxData[0] + (spiTxData[1] << 8) & ~0x8000) : 0;
+    uint16_t rxLen = (spiRxData[0] + (spiRxData[1] << 8) & ~0x8000);
+    if (rxLen == 0x7FFF) {
+        // 0x7FFF is an invalid length
+        health.invalidLen++;
+        rxLen = 0;
+    }
+    else if ((rxLen > SH2_HAL_MAX_TRANSFER) && !(spiRxData[1] & 0x80)) {
+        // Only the first SH2_HAL_MAX_TRANSFER bytes will be read, the hub
+        // sends the rest as continuations
+        health.truncated++;
+    }
+    if (rxLen != 0) {
+        // Periodic reports tend to repeat their length
+        specLen = (rxLen < SH2_HAL_MAX_TRANSFER) ? rxLen : SH2_HAL_MAX_TRANSFER;
+    }
+        
+    uint16_t len = (txLen > rxLen) ? txLen : rxLen;
+    if (len > SH2_HAL_MAX_TRANSFER) {
+        len = SH2_HAL_MAX_TRANSFER;
+    }
+
+    return len;
+}
+
 static void halTask(const void *params)
 {
-    Event_t event;
+    uint32_t events;
+    uint32_t count;
+    uint64_t t_uS;
     static volatile uint32_t trap = 0;
     static volatile uint32_t oops = 0;
-    int rc;
 
     while (1) {
-        // Block until there is work to do
-        xQueueReceive(evtQueue, &event, portMAX_DELAY);
-
-        // Handle the event
-        switch (event.id) {
-            case EVT_INTN:
-                if (dev.dfuMode) {
-                    // Ignore INTN in DFU mode
+        // Block until there is work to do, or the transfer in progress
+        // has had all the time it could need.
+        TickType_t wait = portMAX_DELAY;
+        if (!dev.dfuMode && (dev.state != DEV_IDLE)) {
+            TickType_t elapsed = xTaskGetTickCount() - dev.opStart;
+            wait = (elapsed < opTimeout()) ? (opTimeout() - elapsed) : 0;
+        }
+#if SH2_HAL_RX_LANES
+        // Packets off the priority lane go once nothing else is pending
+        bool holding = (dev.heldCount != 0);
+        if (holding) {
+            wait = 0;
+        }
+#endif
+        if (xTaskNotifyWait(0, EVT_ALL, &events, wait) != pdTRUE) {
+#if SH2_HAL_RX_LANES
+            if (holding) {
+                deliverHeld();
+                continue;
+            }
+#endif
+#if SH2_HAL_SPI_MODERATE
+            if (!dev.dfuMode && (dev.state == DEV_MODERATING)) {
+                // The alarm can't be later than the window: it was lost
+                startIntnOp();
+                continue;
+            }
+#endif
+            if (!dev.dfuMode && (dev.state != DEV_IDLE)) {
+                abortOpShtp();
+            }
+            continue;
+        }
+
+        // Completion first: an INTN pending along with it arrived later.
+        if (events & EVT_OP_CPLT) {
+            isrStamp_read(&cpltStamp, &count);
+            if (dev.dfuMode) {
+                // Ignore this event.
+                // By design, this shouldn't happen.  DFU mode doesn't use interrupt
+                // mode SPI API.
+            }
+            else if (count == cpltSeen) {
+                // Finished as the watchdog gave up on it, already cleaned up
+            }
+            else {
+                cpltSeen = count;
+                opComplete();
+            }
+        }
+        if (events & EVT_OP_ERR) {
+            if (dev.dfuMode) {
+                // Ignore this event.
+                // By design, this shouldn't happen.  DFU mode doesn't use interrupt
+                // mode SPI API.
+            }
+            else if ((dev.state == DEV_IDLE) || (dev.state == DEV_MODERATING)) {
+                // Error from a transfer the watchdog already aborted
+            }
+            else {
+                health.busErrors++;
+                endOpShtp(false);
+
+                // If a new INTN was signalled, start the next op
+                if ((dev.state == DEV_IN_PROG) && takeIntn(&dev.pending_t_uS)) {
+                    dev.state = DEV_NEW_INTN;
                 }
                 else {
-                    if (dev.state == DEV_IDLE) {
-                        // Start a new operation and go to IN-PROGRESS state
-                        dev.state = DEV_IN_PROG;
-                        dev.t_uS = event.t_uS;
-                        rc = startOpShtp();
-                        if (rc) {
-                            // failure to start
-                            dev.state = DEV_IDLE;
-                        }
-                    }
-                    else {
-                        // An operation is still in progress, go to NEW-INTN state
-                        dev.pending_t_uS = event.t_uS;
-                        dev.state = DEV_NEW_INTN;
-                    }
-                }
-                break;
-            case EVT_OP_CPLT:
-                if (dev.dfuMode) {
-                    // Ignore this event.
-                    // By design, this shouldn't happen.  DFU mode doesn't use interrupt
-                    // mode SPI API.
+                    recheckIntnLevel();
                 }
-                else {
-                    // Post-op for operation that just completed
-                    endOpShtp();
-
-                    // Deliver received content
-                    deliverRx(dev.t_uS);
-
-                    // If a new INTN was signalled, start the next op
-                    if (dev.state == DEV_NEW_INTN) {
-                        // start next op
-                        dev.t_uS = dev.pending_t_uS;
-                        dev.state = DEV_IN_PROG;
-                        rc = startOpShtp();
-                        if (rc) {
-                            // failure to start
-                            dev.state = DEV_IDLE;
-                        }
-                    }
-                    else {
-                        // no operation in progress now.
-                        dev.state = DEV_IDLE;
+                startNextOp();
+            }
+        }
+        if (events & EVT_INTN) {
+            if (!takeIntn(&t_uS)) {
+                // Already taken by opComplete
+            }
+            else if (dev.dfuMode) {
+                // Ignore INTN in DFU mode
+            }
+            else {
+                if (dev.state == DEV_IDLE) {
+                    dev.t_uS = t_uS;
+#if SH2_HAL_SPI_MODERATE
+                    uint32_t window_uS = modWindow_uS;
+                    if ((window_uS != 0) && (spsc_count(&dev.tx) == 0)) {
+                        // Let more reports queue up.  (Packets sent in the
+                        // window wait for it too, then go with the reads.)
+                        dev.state = DEV_MODERATING;
+                        dev.opStart = xTaskGetTickCount();
+                        timebase_setAlarm(TIMEBASE_ALARM_SPI_MODERATE, t_uS + window_uS, modAlarm);
+                        continue;
                     }
+#endif
+                    startIntnOp();
                 }
-                break;
-            case EVT_OP_ERR:
-                if (dev.dfuMode) {
-                    // Ignore this event.
-                    // By design, this shouldn't happen.  DFU mode doesn't use interrupt
-                    // mode SPI API.
+#if SH2_HAL_SPI_MODERATE
+                else if (dev.state == DEV_MODERATING) {
+                    // Level triggered: an edge now is INTN after a reset
                 }
+#endif
                 else {
-                    endOpShtp();
-
-                    // If a new INTN was signalled, start the next op
+                    // An operation is still in progress, go to NEW-INTN state
                     if (dev.state == DEV_NEW_INTN) {
-                        // start next op
-                        dev.t_uS = dev.pending_t_uS;
-                        dev.state = DEV_IN_PROG;
-                        rc = startOpShtp();
-                        if (rc) {
-                            // failure to start
-                            dev.state = DEV_IDLE;
-                        }
-                    }
-                    else {
-                        // no operation in progress now.
-                        dev.state = DEV_IDLE;
+                        // Already one waiting, this one goes with it
+                        health.intnCollapsed++;
                     }
+                    dev.pending_t_uS = t_uS;
+                    dev.state = DEV_NEW_INTN;
                 }
-                break;
-            default:
-                // Unknown event type.  Ignore.
-                break;
+            }
+        }
+#if SH2_HAL_SPI_MODERATE
+        if ((events & EVT_MOD_END) && !dev.dfuMode && (dev.state == DEV_MODERATING)) {
+            modWindows++;
+            startIntnOp();
+        }
+#endif
+    }
+}
+
+// Longest an SHTP transfer (both phases) can take at the current clock,
+// plus slack
+static TickType_t opTimeout(void)
+{
+    uint32_t wire_ms = (2 * SH2_HAL_MAX_TRANSFER * 8 * 1000 + spiShtpHz - 1) / spiShtpHz;
+
+    return pdMS_TO_TICKS(wire_ms + SH2_HAL_SPI_TIMEOUT_MS) + 1;
+}
+
+// The transfer in progress never completed (a lost interrupt, or a
+// stuck DMA stream).  Stop it, give back CSN and the bus, and start over
+// if the hub still wants to be read.  Any packet it carried is dropped,
+// as on a bus error.
+static void abortOpShtp(void)
+{
+    uint32_t count;
+
+    TRACE(TRACE_SPI_ABORT, transferPhase);
+#if SH2_HAL_SPI_LL
+    spiStopTxRx();
+#elif SH2_HAL_USE_DMA
+    HAL_SPI_DMAStop(hspi);
+#endif
+    spiReset(false);
+    transferPhase = TRANSFER_IDLE;
+
+    // If it completed after all, that notification is stale now
+    isrStamp_read(&cpltStamp, &count);
+    cpltSeen = count;
+
+    health.busErrors++;
+    endOpShtp(false);
+
+    spiTimeouts++;
+    spiTimeoutUs += (uint32_t)(timebase_getUs() - dev.t_uS);
+
+    // INTN is level: if it's still low no new edge will come for it.
+    bool intnLow = intnAsserted();
+    if ((dev.state != DEV_NEW_INTN) && intnLow) {
+        health.intnRescued++;
+    }
+    if ((dev.state == DEV_NEW_INTN) || intnLow) {
+        dev.t_uS = (dev.state == DEV_NEW_INTN) ? dev.pending_t_uS : timebase_getUs();
+        dev.state = DEV_IN_PROG;
+        if (startOpShtp()) {
+            health.busErrors++;
+            dev.state = DEV_IDLE;
+        }
+    }
+    else {
+        dev.state = DEV_IDLE;
+    }
+}
+
+// Post-op for the SHTP transfer that just completed: free the bus, start
+// the next transfer if INTN is waiting, deliver what was read.
+static void opComplete(void)
+{
+    uint32_t count;
+
+    if (spiOpStatus != SH2_OK) {
+        health.busErrors++;
+    }
+
+    // Post-op for operation that just completed
+    latency_begin(dev.t_uS);
+    latency_markAt(LAT_XFER_DONE, isrStamp_read(&cpltStamp, &count));
+    endOpShtp(true);
+
+    // Don't deliver if the clock is still unproven and
+    // this looks like garbage.  (Must be checked before the
+    // next op takes the bus, it may reset the hub.)
+    bool deliver = shtpSelfCheck(dev.rxIdx);
+
+    // Take the filled buffer, next transfer uses another
+    unsigned rxBuf = dev.rxIdx;
+    uint64_t rx_t_uS = dev.t_uS;
+    dev.rxIdx = (dev.rxIdx + 1) % SH2_HAL_RX_BUFS;
+
+#if SH2_HAL_RX_LANES
+    // The next transfer refills the oldest held packet's buffer
+    if ((dev.heldCount != 0) && (dev.held[dev.heldTail] == dev.rxIdx)) {
+        rxHeldFull++;
+        deliverHeld();
+    }
+#endif
+
+    // INTN may have come in with the completion, before halTask saw it.
+    if ((dev.state == DEV_IN_PROG) && takeIntn(&dev.pending_t_uS)) {
+        dev.state = DEV_NEW_INTN;
+    }
+#if SPI_BURST
+    else if ((dev.state == DEV_IN_PROG) && busBurst) {
+        // INTN stayed low through the read: there was no edge for it
+        dev.pending_t_uS = timebase_getUs();
+        dev.state = DEV_NEW_INTN;
+    }
+#endif
+    else {
+        recheckIntnLevel();
+    }
+
+#if SH2_HAL_RX_BUFS > 1
+    // If a new INTN was signalled, start the next op now
+    // so it overlaps delivery of this one.
+    if (dev.state == DEV_NEW_INTN) {
+        rxOverlapped++;
+    }
+    startNextOp();
+#endif
+
+    // Deliver received content
+    if (deliver) {
+#if SH2_HAL_RX_LANES
+        routeRx(rxBuf, rx_t_uS);
+#else
+        latency_begin(rx_t_uS);
+        deliverRx(rxBuf, rx_t_uS);
+#endif
+    }
+
+#if SH2_HAL_RX_BUFS == 1
+    // Only one buffer: the next op can't start until SHTP is done with it.
+    startNextOp();
+#endif
+}
+
+#if SH2_HAL_RX_LANES
+// Deliver buf now if it came on the priority lane, else hold it back
+// until the HAL task has nothing more urgent to do.  Packets on the other
+// channels keep their order; SHTP sequences each channel on its own.
+static void routeRx(unsigned buf, uint64_t t_uS)
+{
+    if ((dev.rxLen[buf] >= SHTP_HEADER_LEN) && (dev.rxBuf[buf][2] == SH2_HAL_PRIO_CHAN)) {
+        if (dev.heldCount != 0) {
+            rxPrioAhead++;
         }
+        latency_begin(t_uS);
+        deliverRx(buf, t_uS);
+        return;
     }
+
+    dev.rxT_uS[buf] = t_uS;
+    dev.held[(dev.heldTail + dev.heldCount) % SH2_HAL_RX_BUFS] = buf;
+    dev.heldCount++;
 }
 
+// Deliver the oldest packet held back
+static void deliverHeld(void)
+{
+    unsigned buf = dev.held[dev.heldTail];
+
+    dev.heldTail = (dev.heldTail + 1) % SH2_HAL_RX_BUFS;
+    dev.heldCount--;
+    latency_begin(dev.rxT_uS[buf]);
+    deliverRx(buf, dev.rxT_uS[buf]);
+}
+#endif
+
+// Account for INTNs since the last call.  False if there were none.
+static bool takeIntn(uint64_t *pT_uS)
+{
+    uint32_t count;
+    uint64_t t_uS = isrStamp_read(&intnStamp, &count);
+
+    if (count == intnSeen) {
+        return false;
+    }
+
+    // Bits don't count, so INTNs can merge but are never dropped.
+    health.intnMerged += count - intnSeen - 1;
+    health.intns += count - intnSeen;
+    intnSeen = count;
+    *pT_uS = t_uS;
+
+    return true;
+}
+
+static bool intnAsserted(void)
+{
+    return HAL_GPIO_ReadPin(SH_INTN_GPIO_Port, SH_INTN_Pin) == GPIO_PIN_RESET;
+}
+
+// INTN is level triggered on the hub's side: asserted again with no edge
+// counted since the transfer (one missed while the EXTI was busy, say), it
+// will never see another.  Read it as if the edge had come.
+static void recheckIntnLevel(void)
+{
+    if ((dev.state == DEV_IN_PROG) && intnAsserted()) {
+        health.intnRescued++;
+        dev.pending_t_uS = timebase_getUs();
+        dev.state = DEV_NEW_INTN;
+    }
+}
+
+// Start the op a new INTN asked for, or go idle.
+static void startNextOp(void)
+{
+    if (dev.state == DEV_NEW_INTN) {
+        // start next op
+        dev.t_uS = dev.pending_t_uS;
+        dev.state = DEV_IN_PROG;
+        if (startOpShtp()) {
+            // failure to start
+            health.busErrors++;
+            dev.state = DEV_IDLE;
+        }
+    }
+    else {
+        // no operation in progress now.
+        dev.state = DEV_IDLE;
+#if SH2_HAL_SPI_MODERATE
+        modDraining = false;
+#endif
+    }
+}
+
+// Start the read for the INTN at dev.t_uS and go to IN-PROGRESS state
+static void startIntnOp(void)
+{
+#if SH2_HAL_SPI_MODERATE
+    // Reads from here until idle again drain what the window collected
+    modDraining = (dev.state == DEV_MODERATING);
+#endif
+    dev.state = DEV_IN_PROG;
+    if (startOpShtp()) {
+        // failure to start
+        health.busErrors++;
+        dev.state = DEV_IDLE;
+    }
+}
+
+#if SH2_HAL_SPI_MODERATE
+// TIM2 alarm: the moderation window is over
+static void modAlarm(void)
+{
+    BaseType_t woken = pdFALSE;
+
+    xTaskNotifyFromISR(halTaskHandle, EVT_MOD_END, eSetBits, &woken);
+    portEND_SWITCHING_ISR(woken);
+}
+
+static void intmodCmd(int argc, char *argv[])
+{
+    if (argc > 1) {
+        sh2_hal_spiSetModeration(strtoul(argv[1], 0, 0));
+        modWindows = 0;
+        modReads = 0;
+    }
+
+    printf("INTN moderation window %u us", (unsigned)modWindow_uS);
+    if (modWindows != 0) {
+        unsigned tenths = (unsigned)(((uint64_t)modReads * 10) / modWindows);
+        printf(": %u windows, %u reads (%u.%u per window)",
+               (unsigned)modWindows, (unsigned)modReads, tenths / 10, tenths % 10);
+    }
+    printf("\n");
+}
+#endif
+
 // DeInit and Init SPI Peripheral.
 static void spiReset(bool dfuMode)
 {
@@ -597,17 +1389,22 @@ static void spiReset(bool dfuMode)
     if (dfuMode) {
         hspi->Init.CLKPolarity = SPI_POLARITY_LOW;
         hspi->Init.CLKPhase = SPI_PHASE_1EDGE;
-        hspi->Init.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_128; // 84MHz / 128 -> 0.65MHz
+        hspi->Init.BaudRatePrescaler = spiPrescaler(SH2_HAL_SPI_DFU_HZ);
     }
     else {
         hspi->Init.CLKPolarity = SPI_POLARITY_HIGH;
         hspi->Init.CLKPhase = SPI_PHASE_2EDGE;
-        // hspi->Init.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_64; // 84MHz / 64 -> 1.3MHz
-        hspi->Init.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_128; // 84MHz / 128 -> 0.65MHz
+        hspi->Init.BaudRatePrescaler = spiPrescaler(spiShtpHz);
     }
     
     HAL_SPI_Init(hspi);
     
+#if SH2_HAL_DFU_PACED
+    if (dfuMode) {
+        dfuPaceInit();
+    }
+#endif
+
     if (dfuMode) {
         // For some reason, SCLK is still in high state even after being
         // configured to be low.  Doing one SPI operation with no CS
@@ -617,25 +1414,168 @@ static void spiReset(bool dfuMode)
 
         memset(dummyTx, 0xAA, sizeof(dummyTx));
         
-        dbgPulse(5);
+        TRACE(TRACE_SPI_START, sizeof(dummyTx));
         HAL_SPI_TransmitReceive(hspi, dummyTx, dummyRx, sizeof(dummyTx), 1);
     }
 }           
 
+// Fastest SPI1 prescaler giving a clock at or below maxHz
+static uint32_t spiPrescaler(uint32_t maxHz)
+{
+    static const uint32_t prescaler[] = {
+        SPI_BAUDRATEPRESCALER_2,  SPI_BAUDRATEPRESCALER_4,
+        SPI_BAUDRATEPRESCALER_8,  SPI_BAUDRATEPRESCALER_16,
+        SPI_BAUDRATEPRESCALER_32, SPI_BAUDRATEPRESCALER_64,
+        SPI_BAUDRATEPRESCALER_128, SPI_BAUDRATEPRESCALER_256,
+    };
+    uint32_t pclk = HAL_RCC_GetPCLK2Freq();  // SPI1 is on APB2
+    unsigned n = 0;
+
+    while ((n < 7) && ((pclk >> (n+1)) > maxHz)) {
+        n++;
+    }
+
+    return prescaler[n];
+}
+
+// Check the SHTP header just received until one good one has been seen
+// after reset.  Persistent garbage means the clock is too fast for this
+// board, so step it down and restart the hub.
+// Returns false if the data should not be delivered.
+static bool shtpSelfCheck(unsigned buf)
+{
+    uint16_t len;
+    uint8_t chan;
+
+    if (shtpVerified) {
+        return true;
+    }
+
+    len = (dev.rxBuf[buf][0] + (dev.rxBuf[buf][1] << 8)) & ~0x8000;
+    chan = dev.rxBuf[buf][2];
+    if (len == 0) {
+        // Nothing sent, nothing learned
+        return true;
+    }
+
+    if ((len >= SHTP_HEADER_LEN) && (len != 0x7FFF) && (chan <= SHTP_MAX_CHAN)) {
+        shtpVerified = true;
+        return true;
+    }
+
+    framingErrors++;
+    if ((framingErrors >= SPI_SELF_CHECK_ERRORS) && (spiShtpHz > SPI_MIN_HZ)) {
+        spiSlowDown();
+    }
+
+    return false;
+}
+
+// Halve the SHTP clock and reset the hub so it starts over at the new rate.
+static void spiSlowDown(void)
+{
+    spiShtpHz = spiShtpHz / 2;
+    printf("SPI framing errors, SHTP clock lowered to %u Hz\n", spiShtpHz);
+
+    takeBus();
+    gpioFast_write(&dev.rstn, 0);
+    gpioFast_write(&dev.csn, 1);
+    gpioFast_write(&dev.waken, 1);  // PS0 high selects SPI at boot
+    wakeUntil_uS = 0;
+    spiReset(false);
+    timebase_delayUs(SH2_HAL_RESET_HOLD_US);
+    gpioFast_write(&dev.rstn, 1);
+    sh2_hal_resetReleased(devNum);
+    relBus();
+
+    shtpVerified = false;
+    framingErrors = 0;
+    specLen = 0;
+}
+
+// True while HOLD mode keeps the hub awake after a command
+static bool wakeHeld(void)
+{
+    return (wakeMode == SH2_HAL_SPI_WAKE_HOLD) &&
+        (timebase_getUs() < wakeUntil_uS);
+}
+
+static void wakeCmd(int argc, char *argv[])
+{
+    static const char * const modeName[] = { "each", "piggyback", "hold" };
+
+    if (argc > 1) {
+        unsigned mode;
+        for (mode = 0; mode < 3; mode++) {
+            if (strcmp(argv[1], modeName[mode]) == 0) break;
+        }
+        if (mode == 3) {
+            printf("Unknown mode %s\n", argv[1]);
+            return;
+        }
+        uint32_t hold_uS = wakeHold_uS;
+        if ((mode == SH2_HAL_SPI_WAKE_HOLD) && (argc > 2)) {
+            hold_uS = strtoul(argv[2], 0, 0);
+        }
+        sh2_hal_spiSetWake(mode, hold_uS);
+        memset(&wakeStats, 0, sizeof(wakeStats));
+    }
+
+    printf("WAKE mode %s", modeName[wakeMode]);
+    if (wakeMode == SH2_HAL_SPI_WAKE_HOLD) {
+        printf(", hold %u us", (unsigned)wakeHold_uS);
+    }
+    printf("\n  wakes %u, piggybacked %u, held %u\n",
+           (unsigned)wakeStats.wakes, (unsigned)wakeStats.piggybacked,
+           (unsigned)wakeStats.held);
+}
+
 static int tx_dfu(uint8_t* pData, uint32_t len)
 {
     int status = SH2_OK;
 
+    dfuEnter();
+
+#if SH2_HAL_DFU_PACED
+    // Previous packet must finish, and report its status, first
+    status = dfuFinish();
+    if ((status == SH2_OK) && (len <= sizeof(dfuTxBuf))) {
+        // Copy so the caller can fetch the next packet while this one
+        // goes out.
+        memcpy(dfuTxBuf, pData, len);
+
+        dfuWaitGap();
+        takeBus();
+        gpioFast_write(&dev.csn, false);
+        dfuStart_uS = timebase_getUs();
+        dfuGap_uS = DFU_CS_DEASSERT_DELAY_TX * 1000;
+        if (dfuStartPaced(dfuTxBuf, dev.rxBuf[0], len) == 0) {
+            dfuPending = true;
+            dfuStats.txPackets++;
+            dfuStats.txBytes += len;
+        }
+        else {
+            gpioFast_write(&dev.csn, true);
+            relBus();
+            status = SH2_ERR_IO;
+        }
+        return dfuLeave(status);
+    }
+    if (status != SH2_OK) {
+        return dfuLeave(status);
+    }
+#endif
+
     takeBus();
 
     // assert CSN
-    dev.csn(false);
+    gpioFast_write(&dev.csn, false);
 
-    delayUs(DFU_CS_TIMING_US);
+    timebase_delayUs(DFU_CS_TIMING_US);
     
     // Set up Tx, Rx bufs
     spiTxData = pData;
-    spiRxData = dev.rxBuf;
+    spiRxData = dev.rxBuf[0];
 
     // We will just use a simple one-phase transfer for DFU
     transferPhase = TRANSFER_DATA;
@@ -644,35 +1584,37 @@ static int tx_dfu(uint8_t* pData, uint32_t len)
     // time between bytes.
     int rc = 0;
     for (int n = 0; n < len; n++) {
-        dbgPulse(5);
+        TRACE(TRACE_DFU_BYTE, n);
         rc = HAL_SPI_Transmit(hspi, (uint8_t*)spiTxData+n, 1, 1);
         if (rc != 0) {
             break;
         }
-        delayUs(DFU_BYTE_TIMING_US);
+        timebase_delayUs(DFU_BYTE_TIMING_US);
     }
     spiTransferLen = len;
 
     if (rc == 0) {
         // Set return status
-        dev.rxLen = spiTransferLen;
+        dev.rxLen[0] = spiTransferLen;
         status = spiOpStatus;
     }
     else {
         // SPI operation failed
-        dev.rxLen = 0;
+        dev.rxLen[0] = 0;
         status = SH2_ERR_IO;
     }
 
     // deassert CSN
-    dev.csn(true);
+    gpioFast_write(&dev.csn, true);
 
     // Wait on each CSN assertion.  DFU Requires at least 5ms of deasserted time!
     vTaskDelay(DFU_CS_DEASSERT_DELAY_TX);
 
     relBus();
     
-    return status;
+    dfuStats.txPackets++;
+    dfuStats.txBytes += len;
+    return dfuLeave(status);
 }
 
 static int tx_shtp(uint8_t* pData, uint32_t len)
@@ -680,21 +1622,44 @@ static int tx_shtp(uint8_t* pData, uint32_t len)
     int status = SH2_OK;
     static volatile uint32_t wtf = 0;
 
-    // Get semaphore on device
+    if (len > SH2_HAL_MAX_TRANSFER) {
+        return SH2_ERR;
+    }
+
+    // Wait for a free queue slot (only blocks when the queue is full).
+    // A queue that doesn't drain means the hub isn't answering WAKE.
     wtf++;
-    xSemaphoreTake(dev.txMutex, portMAX_DELAY);
+    if (xSemaphoreTake(dev.txSlots, pdMS_TO_TICKS(SH2_HAL_SPI_TX_TIMEOUT_MS)) != pdTRUE) {
+        return SH2_ERR_TIMEOUT;
+    }
 
-    // Set up txLen and txBuf
-    memset(dev.txBuf, 0, sizeof(dev.txBuf));
-    memcpy(dev.txBuf, pData, len);
+    // Copy just the packet.  The SHTP header bounds it, so whatever
+    // follows in the slot is ignored by the hub.
+    if (xSemaphoreTake(dev.txMutex, pdMS_TO_TICKS(SH2_HAL_SPI_TX_TIMEOUT_MS)) != pdTRUE) {
+        xSemaphoreGive(dev.txSlots);
+        return SH2_ERR_TIMEOUT;
+    }
+    // txSlots took a slot, so there is one
+    TxSlot_t *pTx = spsc_writeSlot(&dev.tx);
+    memcpy(pTx->buf, pData, len);
+    pTx->len = len;
+    pTx->queued_uS = timebase_getUs();
+
+    // Publishing the slot triggers tx processing in HAL task
+    spsc_push(&dev.tx);
+    xSemaphoreGive(dev.txMutex);
     
-    // Assert WAKE
+    // Assert WAKE, unless a transfer is under way: its end will see this
+    // packet queued and ask for the next one.
     dbgSet();
-    dev.waken(false);
+    if ((wakeMode == SH2_HAL_SPI_WAKE_EACH) || (dev.state == DEV_IDLE)) {
+        wakeStats.wakes++;
+        gpioFast_write(&dev.waken, false);
+    }
+    else {
+        wakeStats.piggybacked++;
+    }
 
-    // Finally, set len, which triggers tx processing in HAL task
-    dev.txLen = len;
-    
     // Transmission will take place after INTN is processed.
     
     return status;
@@ -704,17 +1669,46 @@ static int rx_dfu(uint8_t* pData, uint32_t len)
 {
     int status = SH2_OK;
 
+    dfuEnter();
+
+#if SH2_HAL_DFU_PACED
+    // Previous packet must finish, and report its status, first
+    status = dfuFinish();
+    if ((status == SH2_OK) && (len <= 0xFFFF)) {
+        dfuWaitGap();
+        takeBus();
+        gpioFast_write(&dev.csn, false);
+        dfuStart_uS = timebase_getUs();
+        dfuGap_uS = DFU_CS_DEASSERT_DELAY_RX * 1000;
+        if (dfuStartPaced(0, pData, len) == 0) {
+            dfuPending = true;
+            status = dfuFinish();
+            dfuStats.rxPackets++;
+            dfuStats.rxBytes += len;
+        }
+        else {
+            gpioFast_write(&dev.csn, true);
+            relBus();
+            status = SH2_ERR_IO;
+        }
+        return dfuLeave(status);
+    }
+    if (status != SH2_OK) {
+        return dfuLeave(status);
+    }
+#endif
+
     takeBus();
 
     // Wait on each CSN assertion.  DFU Requires at least 5ms of deasserted time!
     vTaskDelay(DFU_CS_DEASSERT_DELAY_RX);
 
     // assert CSN
-    dev.csn(false);
-    delayUs(DFU_CS_TIMING_US);
+    gpioFast_write(&dev.csn, false);
+    timebase_delayUs(DFU_CS_TIMING_US);
                     
     // Set up Tx, Rx bufs
-    spiTxData = txZeros;
+    spiTxData = 0;
     spiRxData = pData;
 
     // We will just use a simple one-phase transfer for DFU
@@ -724,72 +1718,338 @@ static int rx_dfu(uint8_t* pData, uint32_t len)
     int rc = 0;
     spiTransferLen = len;
     for (int n = 0; n < len; n++) {
-        dbgPulse(5);
+        TRACE(TRACE_DFU_BYTE, n);
         rc = HAL_SPI_Receive(hspi, spiRxData+n, 1, 1);
         if (rc != 0) {
             break;
         }
-        delayUs(DFU_BYTE_TIMING_US);
+        timebase_delayUs(DFU_BYTE_TIMING_US);
     }
 
     if (rc == 0) {
         // Set return status
-        dev.rxLen = spiTransferLen;
+        dev.rxLen[0] = spiTransferLen;
         status = spiOpStatus;
     }
     else {
         // SPI operation failed
-        dev.rxLen = 0;
+        dev.rxLen[0] = 0;
         status = SH2_ERR_IO;
     }
 
     // deassert CSN
-    dev.csn(true);
+    gpioFast_write(&dev.csn, true);
 
     // Wait after each CSN deassertion in DFU mode to ensure proper timing.
     vTaskDelay(DFU_CS_DEASSERT_DELAY_RX);
 
     relBus();
     
+    dfuStats.rxPackets++;
+    dfuStats.rxBytes += len;
+    return dfuLeave(status);
+}
+
+// Account time spent outside the HAL since the last DFU call returned.
+static void dfuEnter(void)
+{
+    uint64_t now = timebase_getUs();
+
+    if (dfuReturn_uS != 0) {
+        dfuStats.callerUs += now - dfuReturn_uS;
+    }
+}
+
+static int dfuLeave(int status)
+{
+    dfuReturn_uS = timebase_getUs();
+
     return status;
 }
 
-static void bootn0(bool state)
+#if SH2_HAL_DFU_PACED
+// Set up TIM1 as the byte clock and its update DMA stream.
+static void dfuPaceInit(void)
+{
+    static bool initialized = false;
+    uint32_t timClk;
+
+    if (!initialized) {
+        dfuDoneSem = xSemaphoreCreateBinary();
+
+        hdmaDfuPace.Instance = DMA2_Stream5;
+        hdmaDfuPace.Init.Channel = DMA_CHANNEL_6;     // TIM1_UP
+        hdmaDfuPace.Init.Direction = DMA_MEMORY_TO_PERIPH;
+        hdmaDfuPace.Init.PeriphInc = DMA_PINC_DISABLE;
+        hdmaDfuPace.Init.MemInc = DMA_MINC_ENABLE;
+        hdmaDfuPace.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+        hdmaDfuPace.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+        hdmaDfuPace.Init.Mode = DMA_NORMAL;
+        hdmaDfuPace.Init.Priority = DMA_PRIORITY_HIGH;
+        hdmaDfuPace.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+        HAL_DMA_Init(&hdmaDfuPace);
+
+        initialized = true;
+    }
+
+    // TIM1 is on APB2, its clock is doubled when APB2 is divided.
+    timClk = HAL_RCC_GetPCLK2Freq();
+    if ((RCC->CFGR & RCC_CFGR_PPRE2) != RCC_CFGR_PPRE2_DIV1) {
+        timClk *= 2;
+    }
+
+    __TIM1_CLK_ENABLE();
+    TIM1->CR1 = 0;
+    TIM1->DIER = 0;
+    TIM1->PSC = 0;
+    TIM1->ARR = (timClk / 1000000) * DFU_BYTE_TIMING_US - 1;
+    TIM1->RCR = 0;
+    TIM1->EGR = TIM_EGR_UG;
+    TIM1->SR = 0;
+}
+
+// Start pacing len bytes from pTx (0: txIdle repeated) out of SPI1,
+// received bytes go to pRx.  Completion is signalled on dfuDoneSem when the last byte is received,
+// which is also when CSN is deasserted.
+static int dfuStartPaced(const uint8_t *pTx, uint8_t *pRx, uint32_t len)
+{
+    // Discard stale rx data and overrun flag
+    (void)hspi->Instance->DR;
+    (void)hspi->Instance->SR;
+    __HAL_SPI_ENABLE(hspi);
+
+    dfuStatus = SH2_ERR_IO;
+    hspi->hdmarx->XferCpltCallback = dfuRxCplt;
+    hspi->hdmarx->XferHalfCpltCallback = 0;
+    hspi->hdmarx->XferErrorCallback = dfuRxError;
+    if (HAL_DMA_Start_IT(hspi->hdmarx, (uint32_t)&hspi->Instance->DR, (uint32_t)pRx, len) != HAL_OK) {
+        return -1;
+    }
+    hspi->Instance->CR2 |= SPI_CR2_RXDMAEN;
+
+    if (pTx == 0) {
+        hdmaDfuPace.Instance->CR &= ~DMA_SxCR_MINC;
+        pTx = &txIdle;
+    }
+    else {
+        hdmaDfuPace.Instance->CR |= DMA_SxCR_MINC;
+    }
+    if (HAL_DMA_Start(&hdmaDfuPace, (uint32_t)pTx, (uint32_t)&hspi->Instance->DR, len) != HAL_OK) {
+        hspi->Instance->CR2 &= ~SPI_CR2_RXDMAEN;
+        HAL_DMA_Abort(hspi->hdmarx);
+        return -1;
+    }
+
+    // First byte goes out one period from now, which also covers the
+    // CSN setup time.
+    TIM1->CNT = 0;
+    TIM1->SR = 0;
+    TIM1->DIER = TIM_DIER_UDE;
+    TIM1->CR1 |= TIM_CR1_CEN;
+
+    return 0;
+}
+
+// Wait for the paced transfer in flight, if any, and release the bus.
+static int dfuFinish(void)
+{
+    uint64_t t0;
+
+    if (!dfuPending) {
+        return SH2_OK;
+    }
+
+    t0 = timebase_getUs();
+    if (xSemaphoreTake(dfuDoneSem, DFU_PACED_TIMEOUT / portTICK_PERIOD_MS + 1) != pdTRUE) {
+        // Transfer never completed
+        TIM1->CR1 &= ~TIM_CR1_CEN;
+        hspi->Instance->CR2 &= ~SPI_CR2_RXDMAEN;
+        gpioFast_write(&dev.csn, true);
+        dfuCsHigh_uS = timebase_getUs();
+        dfuStatus = SH2_ERR_IO;
+    }
+    dfuStats.waitUs += timebase_getUs() - t0;
+    dfuStats.busUs += dfuCsHigh_uS - dfuStart_uS;
+
+    // Return both streams to ready state
+    TIM1->DIER = 0;
+    HAL_DMA_Abort(&hdmaDfuPace);
+    HAL_DMA_Abort(hspi->hdmarx);
+
+    dfuPending = false;
+    relBus();
+
+    return dfuStatus;
+}
+
+// Block (not spin) until CSN has been high long enough.
+static void dfuWaitGap(void)
+{
+    uint64_t t0 = timebase_getUs();
+    uint64_t elapsed = t0 - dfuCsHigh_uS;
+
+    if (elapsed < dfuGap_uS) {
+        vTaskDelay((dfuGap_uS - elapsed) / 1000 / portTICK_PERIOD_MS + 1);
+        dfuStats.gapUs += timebase_getUs() - t0;
+    }
+}
+
+// SPI RX DMA complete: last byte is in, end the packet.
+static void dfuRxCplt(DMA_HandleTypeDef *hdma)
 {
-	HAL_GPIO_WritePin(BOOTN_GPIO_PORT, BOOTN_GPIO_PIN, 
-	                  state ? GPIO_PIN_SET : GPIO_PIN_RESET);
+    BaseType_t woken = pdFALSE;
+
+    TIM1->CR1 &= ~TIM_CR1_CEN;
+    hspi->Instance->CR2 &= ~SPI_CR2_RXDMAEN;
+    gpioFast_write(&dev.csn, true);
+    dfuCsHigh_uS = timebase_getUs();
+    dfuStatus = SH2_OK;
+
+    xSemaphoreGiveFromISR(dfuDoneSem, &woken);
+    portEND_SWITCHING_ISR(woken);
 }
 
-static void rstn0(bool state)
+static void dfuRxError(DMA_HandleTypeDef *hdma)
 {
-	HAL_GPIO_WritePin(RSTN_GPIO_PORT, RSTN_GPIO_PIN, 
-	                  state ? GPIO_PIN_SET : GPIO_PIN_RESET);
+    BaseType_t woken = pdFALSE;
+
+    TIM1->CR1 &= ~TIM_CR1_CEN;
+    hspi->Instance->CR2 &= ~SPI_CR2_RXDMAEN;
+    gpioFast_write(&dev.csn, true);
+    dfuCsHigh_uS = timebase_getUs();
+    dfuStatus = SH2_ERR_IO;
+
+    xSemaphoreGiveFromISR(dfuDoneSem, &woken);
+    portEND_SWITCHING_ISR(woken);
 }
+#endif
+
+#if MICROBENCH
+// ----------------------------------------------------------------------------------
+// Microbenchmarks.  These run before the hub is reset, with the HAL idle.
+// ----------------------------------------------------------------------------------
+
+// One SHTP packet, as read from the hub: timebase reference, then a
+// rotation vector report.
+static const uint8_t benchPacket[] = {
+    23, 0, 3, 0,                      // SHTP header: length, channel, seq
+    0xFB, 0x10, 0x00, 0x00, 0x00,     // base timestamp reference
+    0x05, 0x00, 0x03, 0x00,           // rotation vector: id, seq, status, delay
+    0x12, 0x01, 0x34, 0xfe, 0x56, 0x02, 0x9a, 0x3e, 0x00, 0x02,
+};
 
-static void csn0(bool state)
+static void benchRx(void *cookie, uint8_t *pData, uint32_t len, uint32_t t_uS)
 {
-	HAL_GPIO_WritePin(CSN_GPIO_PORT, CSN_GPIO_PIN, 
-	                  state ? GPIO_PIN_SET : GPIO_PIN_RESET);
+    // SHTP is measured on its own
 }
 
-static void waken0(bool state)
+// Completion of a transfer that read everything it needed in one go.
+// The notification goes to the benchmark task instead of the HAL task.
+static void benchCplt(unsigned n)
 {
-    HAL_GPIO_WritePin(WAKEN_GPIO_PORT, WAKEN_GPIO_PIN, 
-	              state ? GPIO_PIN_SET : GPIO_PIN_RESET);
+    osThreadId hal = halTaskHandle;
+    uint16_t wasSpecLen = specLen;
+    uint32_t events;
+
+    if (dev.onRx != 0) {
+        // Hub is running, leave it alone
+        return;
+    }
+
+    spiTxData = 0;
+    spiRxData = dev.rxBuf[dev.rxIdx];
+    memcpy(spiRxData, benchPacket, sizeof(benchPacket));
+
+    halTaskHandle = osThreadGetId();
+    for (unsigned i = 0; i < n; i++) {
+#if SH2_HAL_SPI_SPECULATIVE
+        transferPhase = TRANSFER_SPEC;
+#else
+        transferPhase = TRANSFER_DATA;
+#endif
+        spiTransferLen = sizeof(benchPacket);
+        microbench_begin();
+        HAL_SPI_TxRxCpltCallback(hspi);
+        microbench_end();
+    }
+    xTaskNotifyWait(0, EVT_ALL, &events, 0);
+    halTaskHandle = hal;
+
+    specLen = wasSpecLen;
+    transferPhase = TRANSFER_IDLE;
 }
 
-#define DELAY_LOOP_1_US (8.4656)
-#define DELAY_LOOP_OFFSET (-12.7)
+// The HAL task's handling of a completed transfer, up to onRx
+static void benchOpComplete(unsigned n)
+{
+    bool wasVerified = shtpVerified;
+
+    if (dev.onRx != 0) {
+        return;
+    }
+
+    for (unsigned b = 0; b < SH2_HAL_RX_BUFS; b++) {
+        memcpy(dev.rxBuf[b], benchPacket, sizeof(benchPacket));
+    }
+    shtpVerified = true;
+    dev.onRx = benchRx;
+
+    for (unsigned i = 0; i < n; i++) {
+        takeBus();
+        dev.state = DEV_IN_PROG;
+        spiOpStatus = SH2_OK;
+        spiTransferLen = sizeof(benchPacket);
+#if SPI_BURST
+        // Never hold the bus for a next read: INTN isn't the bench's
+        burstReads = SH2_HAL_SPI_BURST;
+#endif
+        microbench_begin();
+        opComplete();
+#if SH2_HAL_RX_LANES
+        // As the HAL task would, with nothing else to do
+        while (dev.heldCount != 0) {
+            deliverHeld();
+        }
+#endif
+        microbench_end();
+        microbench_bytes(sizeof(benchPacket));
+    }
+
+    dev.onRx = 0;
+    dev.rxIdx = 0;
+    shtpVerified = wasVerified;
+}
 
-static void delayUs(uint32_t count)
+// Starting one read, as each transfer phase does: the cost of
+// SH2_HAL_SPI_LL, or of HAL_SPI_TransmitReceive_DMA without it.  The
+// bytes are clocked with CSN high, so the hub doesn't see them.
+static void benchStart(unsigned n)
 {
-    float delayCount;
-    volatile unsigned delayCounter;
+    osThreadId hal = halTaskHandle;
+    uint32_t events;
 
-    delayCount = DELAY_LOOP_1_US * count + DELAY_LOOP_OFFSET;
-    if (delayCount < 1.0) return;
-    
-    delayCounter = (unsigned)delayCount;
-    
-    while (delayCounter > 0) delayCounter--;
+    if (dev.onRx != 0) {
+        return;
+    }
+
+    takeBus();
+    halTaskHandle = osThreadGetId();
+    for (unsigned i = 0; i < n; i++) {
+        spiTxData = 0;
+        spiRxData = dev.rxBuf[0];
+        transferPhase = TRANSFER_DATA;
+        microbench_begin();
+        int rc = spiStartTxRx(0, dev.rxBuf[0], sizeof(benchPacket));
+        microbench_end();
+        microbench_bytes(sizeof(benchPacket));
+        if ((rc != 0) ||
+            (xTaskNotifyWait(0, EVT_ALL, &events, pdMS_TO_TICKS(SH2_HAL_SPI_TIMEOUT_MS)) != pdTRUE)) {
+            printf("spiStartTxRx: transfer %u failed.\n", i);
+            break;
+        }
+    }
+    halTaskHandle = hal;
+    transferPhase = TRANSFER_IDLE;
+    relBus();
 }
+#endif
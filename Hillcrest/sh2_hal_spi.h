@@ -29,14 +29,57 @@
 #include <stdbool.h>
 
 #include "sh2_hal_impl.h"
+#include "sh2_hal_health.h"
+#include "sh2_hal_registry.h"
 #include "stm32f4xx_hal.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-    // Initialize SH2 HAL Implementation
-    void sh2_hal_init(SPI_HandleTypeDef* _hspi);
+    // Initialize SH2 HAL Implementation, and register the shield's BNO080
+    // with the registry.  The SPI HAL drives that one device.
+    void sh2_hal_spiInit(SPI_HandleTypeDef* _hspi);
+
+    // Where the time went during the last DFU (since reset into DFU mode)
+    typedef struct {
+        uint32_t txPackets;
+        uint32_t txBytes;
+        uint32_t rxPackets;
+        uint32_t rxBytes;
+        uint64_t busUs;     // CSN asserted, bytes being clocked
+        uint64_t gapUs;     // waiting out CSN deassert time
+        uint64_t waitUs;    // waiting for the previous packet to finish
+        uint64_t callerUs;  // outside the HAL (dfu() and getAppData)
+    } sh2_hal_DfuStats_t;
+    void sh2_hal_getDfuStats(sh2_hal_DfuStats_t *pStats);
+
+    // Select the WAKE strategy (SH2_HAL_SPI_WAKE_EACH, ...).  hold_uS is
+    // only used by SH2_HAL_SPI_WAKE_HOLD.
+    void sh2_hal_spiSetWake(unsigned mode, uint32_t hold_uS);
+
+    // How outbound packets got the hub's attention
+    typedef struct {
+        uint32_t wakes;        // packets that asserted WAKE themselves
+        uint32_t piggybacked;  // packets left to the transfer in progress
+        uint32_t held;         // transfers that ended with WAKE held
+    } sh2_hal_WakeStats_t;
+    void sh2_hal_getWakeStats(sh2_hal_WakeStats_t *pStats);
+
+    // Highest SPI clock used in SHTP mode, lowered by the clock self-check
+    uint32_t sh2_hal_spiGetSpeed(void);
+
+#if SH2_HAL_SPI_MODERATE
+    // Set the INTN moderation window [us] (see SH2_HAL_SPI_MODERATE_US),
+    // 0 for none.  Clamped to SH2_HAL_SPI_MODERATE_MAX_US.
+    void sh2_hal_spiSetModeration(uint32_t window_us);
+#endif
+
+#if SH2_HAL_SPI_LL
+    // SPI rx DMA stream interrupt (DMA2 Stream 0).  Returns true if it
+    // finished an SHTP transfer; if not, the ST HAL handler has it.
+    bool sh2_hal_spiDmaIrq(void);
+#endif
 
 #ifdef __cplusplus
 }    // end of extern "C"
@@ -0,0 +1,156 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Console command shell.
+ * Reads lines from the console and dispatches them to registered commands.
+ */
+
+#include "shell.h"
+
+#include <stdio.h>
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "console.h"
+
+// Long enough for an FRS record pasted back as "frs set <id> <words...>"
+#define SHELL_LINE_LEN (256)
+#define SHELL_MAX_ARGS (24)
+
+// ------------------------------------------------------------------------
+// Private types
+
+typedef struct {
+	const char *name;
+	const char *help;
+	ShellCmdFn_t *fn;
+} ShellCmd_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static int tokenize(char *line, char *argv[], int maxArgs);
+static void helpCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static ShellCmd_t cmds[SHELL_MAX_CMDS] = {
+	{"help", "list commands", helpCmd},
+};
+static volatile unsigned numCmds = 1;
+static uint8_t frameSync;
+static ShellFrameFn_t *frameFn;
+
+// ------------------------------------------------------------------------
+// Public API
+
+int shell_addCommand(const char *name, const char *help, ShellCmdFn_t *fn)
+{
+	int rc = -1;
+
+	// Commands may be registered from any task
+	taskENTER_CRITICAL();
+	if (numCmds < SHELL_MAX_CMDS) {
+		cmds[numCmds].name = name;
+		cmds[numCmds].help = help;
+		cmds[numCmds].fn = fn;
+		numCmds++;
+		rc = 0;
+	}
+	taskEXIT_CRITICAL();
+
+	return rc;
+}
+
+void shell_setFrameHandler(uint8_t sync, ShellFrameFn_t *fn)
+{
+	frameFn = fn;
+	frameSync = sync;
+	console_setFrameSync(sync);
+}
+
+void shellTaskStart(const void * params)
+{
+	static char line[SHELL_LINE_LEN];
+	char *argv[SHELL_MAX_ARGS];
+	int argc;
+	unsigned n;
+
+	while (1) {
+		size_t len = console_readLine(line, sizeof(line));
+
+		if ((len == 1) && (frameFn != 0) && ((uint8_t)line[0] == frameSync)) {
+			frameFn();
+			continue;
+		}
+
+		argc = tokenize(line, argv, SHELL_MAX_ARGS);
+		if (argc == 0) {
+			continue;
+		}
+
+		for (n = 0; n < numCmds; n++) {
+			if (strcmp(argv[0], cmds[n].name) == 0) {
+				cmds[n].fn(argc, argv);
+				break;
+			}
+		}
+		if (n == numCmds) {
+			printf("Unknown command: %s (try help)\n", argv[0]);
+		}
+	}
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+// Split line in place at whitespace
+static int tokenize(char *line, char *argv[], int maxArgs)
+{
+	int argc = 0;
+	char *p = line;
+
+	while ((argc < maxArgs) && (*p != 0)) {
+		// skip leading whitespace
+		while ((*p == ' ') || (*p == '\t')) {
+			p++;
+		}
+		if (*p == 0) {
+			break;
+		}
+		argv[argc++] = p;
+
+		// find end of token
+		while ((*p != 0) && (*p != ' ') && (*p != '\t')) {
+			p++;
+		}
+		if (*p != 0) {
+			*p++ = 0;
+		}
+	}
+
+	return argc;
+}
+
+static void helpCmd(int argc, char *argv[])
+{
+	for (unsigned n = 0; n < numCmds; n++) {
+		printf("  %-10s %s\n", cmds[n].name, cmds[n].help);
+	}
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Console command shell.
+ * Reads lines from the console and dispatches them to registered commands.
+ */
+
+#ifndef SHELL_H
+#define SHELL_H
+
+#include <stdint.h>
+
+// Maximum number of commands that can be registered
+#define SHELL_MAX_CMDS (64)
+
+// Command handler.  argv[0] is the command name.
+typedef void (ShellCmdFn_t)(int argc, char *argv[]);
+
+// Register a command.  name and help must remain valid.
+// Returns 0 on success, -1 if the command table is full.
+int shell_addCommand(const char *name, const char *help, ShellCmdFn_t *fn);
+
+// Binary frame handler, called in the shell task once a frame's sync
+// byte has been read; it reads the rest with console_readRaw().
+typedef void (ShellFrameFn_t)(void);
+
+// Hand lines starting with sync to fn rather than parsing them as
+// commands (console_setFrameSync()).  One handler at a time.
+void shell_setFrameHandler(uint8_t sync, ShellFrameFn_t *fn);
+
+// Shell task body
+void shellTaskStart(const void * params);
+
+#endif
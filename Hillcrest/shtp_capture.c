@@ -0,0 +1,249 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Capture of raw SHTP traffic.  See shtp_capture.h.
+ */
+
+#include "shtp_capture.h"
+
+#if SHTP_CAPTURE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "cmsis_os.h"
+#include "stm32f4xx_hal.h"
+#include "sh2_hal_impl.h"
+#include "console.h"
+#include "crc16.h"
+#include "shell.h"
+#include "sysstats.h"
+#include "rtos_static.h"
+#include "priorities.h"
+
+#ifndef CAPTURE_TASK_STACK
+#define CAPTURE_TASK_STACK (160)
+#endif
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void captureTask(const void *params);
+static void sendRecord(void);
+static void ringWrite(uint32_t pos, const uint8_t *p, uint32_t len);
+static void ringRead(uint32_t pos, uint8_t *p, uint32_t len);
+static void capCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+RTOS_STACK_DEF(captureTaskStack, CAPTURE_TASK_STACK);
+static osThreadId captureTaskHandle;
+
+// The HAL task is the only producer, the capture task the only consumer
+// (it also carries out restarts, so tail has one writer).  head and tail
+// run freely and count bytes.
+static uint8_t ring[SHTP_CAPTURE_BYTES];
+static volatile uint32_t head;
+static volatile uint32_t tail;
+
+static volatile CaptureMode_t mode = SHTP_CAPTURE_BOOT;
+static volatile CaptureMode_t pendingMode;
+static volatile bool restartPending;
+static volatile bool dumpPending;
+
+static uint32_t records;
+static uint32_t drops;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void shtpCapture_init(void)
+{
+    head = 0;
+    tail = 0;
+    sysstats_addMemory("SHTP capture", sizeof(ring));
+
+    osThreadDef(captureThreadDef, captureTask, PRIO_TASK_LOG, 0, CAPTURE_TASK_STACK);
+    captureTaskHandle = rtos_threadCreate(osThread(captureThreadDef), NULL,
+                                          RTOS_STACK(captureTaskStack));
+    if (captureTaskHandle == NULL) {
+        printf("Failed to create capture task.\n");
+        mode = CAPTURE_OFF;
+        return;
+    }
+
+    shell_addCommand("cap", "[off | ram | uart | dump] capture raw SHTP traffic", capCmd);
+    sysstats_addCounter("capture drops", &drops);
+}
+
+void shtpCapture_start(CaptureMode_t newMode)
+{
+    // Stop recording, then let the consumer empty the ring and resume
+    mode = CAPTURE_OFF;
+    pendingMode = newMode;
+    restartPending = true;
+    xTaskNotifyGive(captureTaskHandle);
+}
+
+void shtpCapture_record(const uint8_t *pData, uint32_t len, uint32_t t_uS)
+{
+    uint8_t hdr[CAP_REC_HDR_LEN];
+    uint32_t h = head;
+
+    if (mode == CAPTURE_OFF) {
+        return;
+    }
+
+    if ((len > SH2_HAL_MAX_TRANSFER) ||
+        (CAP_REC_HDR_LEN + len > SHTP_CAPTURE_BYTES - (h - tail))) {
+        drops++;
+        return;
+    }
+
+    hdr[0] = (uint8_t)t_uS;
+    hdr[1] = (uint8_t)(t_uS >> 8);
+    hdr[2] = (uint8_t)(t_uS >> 16);
+    hdr[3] = (uint8_t)(t_uS >> 24);
+    hdr[4] = (uint8_t)len;
+    hdr[5] = (uint8_t)(len >> 8);
+    ringWrite(h, hdr, CAP_REC_HDR_LEN);
+    ringWrite(h + CAP_REC_HDR_LEN, pData, len);
+
+    // Make sure the record is written before it is published
+    __DMB();
+    head = h + CAP_REC_HDR_LEN + len;
+    records++;
+
+    if (mode == CAPTURE_UART) {
+        xTaskNotifyGive(captureTaskHandle);
+    }
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static void captureTask(const void *params)
+{
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        if (restartPending) {
+            restartPending = false;
+            tail = head;
+            records = 0;
+            drops = 0;
+            mode = pendingMode;
+        }
+
+        if (dumpPending) {
+            // Only what was captured when asked, so a capture that is
+            // still running can't keep the dump going
+            uint32_t end = head;
+            dumpPending = false;
+            while ((int32_t)(end - tail) > 0) {
+                sendRecord();
+            }
+        }
+
+        while ((mode == CAPTURE_UART) && (tail != head)) {
+            sendRecord();
+        }
+    }
+}
+
+// Frame the oldest record and send it to the console
+static void sendRecord(void)
+{
+    static uint8_t frame[2 + CAP_REC_HDR_LEN + SH2_HAL_MAX_TRANSFER + CAP_CRC_LEN];
+    uint32_t t = tail;
+    uint32_t len;
+    uint16_t crc;
+
+    frame[0] = CAP_SYNC0;
+    frame[1] = CAP_SYNC1;
+    ringRead(t, &frame[2], CAP_REC_HDR_LEN);
+    len = frame[6] | (frame[7] << 8);
+    ringRead(t + CAP_REC_HDR_LEN, &frame[2 + CAP_REC_HDR_LEN], len);
+
+    // The slot can be reused as soon as it's copied out
+    tail = t + CAP_REC_HDR_LEN + len;
+
+    crc = crc16(CRC16_INIT, &frame[2], CAP_REC_HDR_LEN + len);
+    frame[2 + CAP_REC_HDR_LEN + len] = (uint8_t)(crc & 0xFF);
+    frame[2 + CAP_REC_HDR_LEN + len + 1] = (uint8_t)(crc >> 8);
+
+    console_writeRaw(frame, 2 + CAP_REC_HDR_LEN + len + CAP_CRC_LEN);
+}
+
+static void ringWrite(uint32_t pos, const uint8_t *p, uint32_t len)
+{
+    uint32_t off = pos & (SHTP_CAPTURE_BYTES-1);
+    uint32_t first = SHTP_CAPTURE_BYTES - off;
+
+    if (first > len) {
+        first = len;
+    }
+    memcpy(&ring[off], p, first);
+    memcpy(&ring[0], p + first, len - first);
+}
+
+static void ringRead(uint32_t pos, uint8_t *p, uint32_t len)
+{
+    uint32_t off = pos & (SHTP_CAPTURE_BYTES-1);
+    uint32_t first = SHTP_CAPTURE_BYTES - off;
+
+    if (first > len) {
+        first = len;
+    }
+    memcpy(p, &ring[off], first);
+    memcpy(p + first, &ring[0], len - first);
+}
+
+static void capCmd(int argc, char *argv[])
+{
+    static const char *modeName[] = {"off", "ram", "uart"};
+
+    if (argc == 1) {
+        printf("Capture %s: %u records, %u of %u bytes, %u dropped.\n",
+               modeName[mode], (unsigned)records,
+               (unsigned)(head - tail), (unsigned)SHTP_CAPTURE_BYTES,
+               (unsigned)drops);
+    }
+    else if (strcmp(argv[1], "off") == 0) {
+        // Keeps what was captured, for a later dump
+        mode = CAPTURE_OFF;
+    }
+    else if (strcmp(argv[1], "ram") == 0) {
+        shtpCapture_start(CAPTURE_RAM);
+    }
+    else if (strcmp(argv[1], "uart") == 0) {
+        shtpCapture_start(CAPTURE_UART);
+    }
+    else if (strcmp(argv[1], "dump") == 0) {
+        dumpPending = true;
+        xTaskNotifyGive(captureTaskHandle);
+    }
+    else {
+        printf("usage: %s [off | ram | uart | dump]\n", argv[0]);
+    }
+}
+
+#endif
@@ -0,0 +1,85 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Capture of raw SHTP traffic, as the HAL hands each transfer to SHTP.
+ *
+ * The HAL task only copies transfers into a RAM ring; a low priority
+ * capture task sends them to the console, either as they arrive ("cap
+ * uart") or on request after a RAM capture ("cap ram", then "cap dump").
+ *
+ * Records use the replay format of tools/hostsim/host_hal.h:
+ *   t_uS (32-bit LE), len (16-bit LE), len bytes of transfer.
+ * On the console each record is framed as
+ *   sync (0xA5 0xC3), record, CRC-16 (LE) over the record
+ * and tools/shtpcap.py extracts the records from a serial capture.
+ */
+
+#ifndef SHTP_CAPTURE_H
+#define SHTP_CAPTURE_H
+
+#include <stdint.h>
+
+// Set to 1 to build in the capture and its SHTP_CAPTURE_BYTES ring.
+#ifndef SHTP_CAPTURE
+#define SHTP_CAPTURE (0)
+#endif
+
+// Capture ring size in bytes, a power of 2.
+#ifndef SHTP_CAPTURE_BYTES
+#define SHTP_CAPTURE_BYTES (4096)
+#endif
+
+// Mode at startup.  CAPTURE_RAM here catches the hub's advertisement,
+// which a replay needs before any sensor reports make sense.
+#ifndef SHTP_CAPTURE_BOOT
+#define SHTP_CAPTURE_BOOT (CAPTURE_OFF)
+#endif
+
+#define CAP_SYNC0 (0xA5)
+#define CAP_SYNC1 (0xC3)
+#define CAP_REC_HDR_LEN (6)
+#define CAP_CRC_LEN (2)
+
+typedef enum {
+    CAPTURE_OFF,
+    CAPTURE_RAM,     // record until the ring is full, send on "cap dump"
+    CAPTURE_UART,    // send records as they arrive
+} CaptureMode_t;
+
+#if SHTP_CAPTURE
+
+// Create the capture task and register the "cap" console command.
+// Call before the HAL starts.
+void shtpCapture_init(void);
+
+// Discard anything captured and start over in the given mode.
+void shtpCapture_start(CaptureMode_t mode);
+
+// Record one received transfer.  Called by the HAL task just before
+// onRx.  Never blocks; records that don't fit are counted and dropped.
+void shtpCapture_record(const uint8_t *pData, uint32_t len, uint32_t t_uS);
+
+#else
+
+#define shtpCapture_init()
+#define shtpCapture_start(mode)
+#define shtpCapture_record(pData, len, t_uS)
+
+#endif
+
+#endif
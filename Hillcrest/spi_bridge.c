@@ -0,0 +1,307 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * SPI slave bridge to an application processor.
+ */
+
+#include "spi_bridge.h"
+
+#if SPI_BRIDGE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include "stm32f4xx_hal.h"
+#include "shell.h"
+#include "sysstats.h"
+#include "timebase.h"
+#include "exti.h"
+#include "spsc.h"
+#include "sensor_dispatch.h"
+#include "sensor_output.h"
+#include "priorities.h"
+
+#define NSS_PORT  GPIOB
+#define NSS_PIN   GPIO_PIN_12
+#define DRDY_PORT GPIOC
+#define DRDY_PIN  GPIO_PIN_9
+
+#define RX_STREAM DMA1_Stream3
+#define TX_STREAM DMA1_Stream4
+#define RX_FLAGS  (DMA_LIFCR_CTCIF3 | DMA_LIFCR_CHTIF3 | DMA_LIFCR_CTEIF3 | \
+                   DMA_LIFCR_CDMEIF3 | DMA_LIFCR_CFEIF3)
+#define TX_FLAGS  (DMA_HIFCR_CTCIF4 | DMA_HIFCR_CHTIF4 | DMA_HIFCR_CTEIF4 | \
+                   DMA_HIFCR_CDMEIF4 | DMA_HIFCR_CFEIF4)
+
+// ------------------------------------------------------------------------
+// Private types
+
+typedef struct {
+    uint8_t len;
+    uint8_t data[BIN_HDR_LEN + BIN_REPORT_MAX + BIN_CRC_LEN];
+} BridgeFrame_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void bridgeEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix);
+static void nssEdge(void *arg, uint16_t pin, uint64_t t_uS);
+static void fill(void);
+static void arm(void);
+static void bridgeCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static bool running;
+
+// Sensor task to NSS ISR
+static SPSC_RING(BridgeFrame_t, SPI_BRIDGE_FRAMES) ring;
+static uint8_t binSeq;
+static volatile uint32_t dropped;
+
+// NSS ISR only, read unlocked by the shell
+static uint8_t txBuf[SPI_BRIDGE_XFER_MAX];
+static uint8_t rxBuf[SPI_BRIDGE_XFER_MAX];
+static volatile uint16_t payloadLen;    // in txBuf, 0 if none
+static unsigned txEnd;                  // end of what txBuf holds
+static uint16_t seq;
+static bool resent;
+static uint32_t droppedSeen;            // dropped at the last block
+
+static uint32_t transfers;
+static uint32_t bytes;
+static uint32_t payloads;
+static uint32_t resends;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void spiBridge_init(void)
+{
+    GPIO_InitTypeDef GPIO_InitStruct;
+
+    if (exti_register(NSS_PIN, nssEdge, 0) != 0) {
+        printf("SPI bridge off: EXTI line of PB12 taken\n");
+        return;
+    }
+
+    __GPIOB_CLK_ENABLE();
+    __GPIOC_CLK_ENABLE();
+    __SPI2_CLK_ENABLE();
+    __DMA1_CLK_ENABLE();
+    __HAL_RCC_SYSCFG_CLK_ENABLE();
+
+    memset(&GPIO_InitStruct, 0, sizeof(GPIO_InitStruct));
+    HAL_GPIO_WritePin(DRDY_PORT, DRDY_PIN, GPIO_PIN_RESET);
+    GPIO_InitStruct.Pin = DRDY_PIN;
+    GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_PP;
+    GPIO_InitStruct.Pull = GPIO_NOPULL;
+    GPIO_InitStruct.Speed = GPIO_SPEED_LOW;
+    HAL_GPIO_Init(DRDY_PORT, &GPIO_InitStruct);
+
+    GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+    GPIO_InitStruct.Speed = GPIO_SPEED_HIGH;
+    GPIO_InitStruct.Alternate = GPIO_AF5_SPI2;
+    GPIO_InitStruct.Pin = GPIO_PIN_13;
+    HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
+    GPIO_InitStruct.Pin = GPIO_PIN_2 | GPIO_PIN_3;
+    HAL_GPIO_Init(GPIOC, &GPIO_InitStruct);
+    GPIO_InitStruct.Pin = NSS_PIN;
+    GPIO_InitStruct.Pull = GPIO_PULLUP;
+    HAL_GPIO_Init(NSS_PORT, &GPIO_InitStruct);
+
+    // NSS is the SPI's, in AF mode; its EXTI line sees both edges anyway
+    SYSCFG->EXTICR[3] = (SYSCFG->EXTICR[3] & ~SYSCFG_EXTICR4_EXTI12) | SYSCFG_EXTICR4_EXTI12_PB;
+    EXTI->RTSR |= NSS_PIN;
+    EXTI->FTSR |= NSS_PIN;
+    EXTI->IMR |= NSS_PIN;
+
+    running = true;
+
+    // First status block, via the ISR like every other
+    EXTI->SWIER = NSS_PIN;
+
+    sysstats_addMemory("spi bridge", sizeof(ring) + sizeof(txBuf) + sizeof(rxBuf));
+    sysstats_addCounter("bridge frames dropped", (const uint32_t *)&dropped);
+    shell_addCommand("bridge", "SPI slave bridge counts", bridgeCmd);
+    sensorDispatch_subscribe(SENSOR_DISPATCH_ALL, PRIO_SUB_BRIDGE, bridgeEvent, 0);
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+// Dispatch callback, in the sensor task
+static void bridgeEvent(void *cookie, const sh2_SensorEvent_t *pEvent, const SensorFix_t *pFix)
+{
+    uint8_t frame[BIN_FRAME_MAX];
+    BridgeFrame_t *pSlot;
+    unsigned len;
+
+    pSlot = spsc_writeSlot(&ring);
+    if (pSlot == 0) {
+        dropped++;
+        return;
+    }
+    len = sensorOutput_binFrame(frame, &binSeq, pEvent);
+    pSlot->len = (uint8_t)len;
+    memcpy(pSlot->data, frame, len);
+    spsc_push(&ring);
+
+    if (payloadLen == 0) {
+        // Nothing waiting: have the ISR make a payload of it
+        EXTI->SWIER = NSS_PIN;
+    }
+}
+
+// Either edge of NSS, or a software trigger, from the EXTI ISR
+static void nssEdge(void *arg, uint16_t pin, uint64_t t_uS)
+{
+    unsigned clocked;
+
+    if (HAL_GPIO_ReadPin(NSS_PORT, NSS_PIN) == GPIO_PIN_RESET) {
+        // Transaction starting
+        HAL_GPIO_WritePin(DRDY_PORT, DRDY_PIN, GPIO_PIN_RESET);
+        return;
+    }
+
+    // Ended, or no transaction since the last arm()
+    clocked = SPI_BRIDGE_XFER_MAX - RX_STREAM->NDTR;
+    if (clocked != 0) {
+        transfers++;
+        bytes += clocked;
+        if (payloadLen != 0) {
+            if (clocked >= SPI_BRIDGE_STATUS_LEN + payloadLen) {
+                payloadLen = 0;
+                payloads++;
+            }
+            else {
+                resent = true;
+                resends++;
+            }
+        }
+        if (rxBuf[0] == SPI_BRIDGE_CMD_FLUSH) {
+            while (spsc_readSlot(&ring) != 0) {
+                spsc_pop(&ring);
+            }
+            payloadLen = 0;
+        }
+    }
+
+    fill();
+    arm();
+    HAL_GPIO_WritePin(DRDY_PORT, DRDY_PIN, (payloadLen != 0) ? GPIO_PIN_SET : GPIO_PIN_RESET);
+}
+
+// Make the next status block, and the next payload if none is waiting
+static void fill(void)
+{
+    uint8_t *p = txBuf;
+    uint32_t pending;
+    uint32_t lost = dropped;
+    uint64_t now = timebase_getUs();
+
+    if (payloadLen == 0) {
+        unsigned pos = SPI_BRIDGE_STATUS_LEN;
+        BridgeFrame_t *pFrame;
+
+        while (((pFrame = spsc_readSlot(&ring)) != 0) &&
+               (pos + pFrame->len <= SPI_BRIDGE_XFER_MAX)) {
+            memcpy(&txBuf[pos], pFrame->data, pFrame->len);
+            pos += pFrame->len;
+            spsc_pop(&ring);
+        }
+        if (txEnd > pos) {
+            memset(&txBuf[pos], 0, txEnd - pos);
+        }
+        txEnd = pos;
+        payloadLen = (uint16_t)(pos - SPI_BRIDGE_STATUS_LEN);
+        if (payloadLen != 0) {
+            seq++;
+        }
+        resent = false;
+    }
+    pending = spsc_count(&ring);
+
+    p[0] = 'S';
+    p[1] = 'B';
+    p[2] = SPI_BRIDGE_VERSION;
+    p[3] = ((lost != droppedSeen) ? SPI_BRIDGE_DROPPED : 0) | (resent ? SPI_BRIDGE_RESENT : 0);
+    p[4] = (uint8_t)seq;
+    p[5] = (uint8_t)(seq >> 8);
+    p[6] = (uint8_t)payloadLen;
+    p[7] = (uint8_t)(payloadLen >> 8);
+    for (int n = 0; n < 4; n++) {
+        p[8 + n] = (uint8_t)(pending >> (8*n));
+        p[12 + n] = (uint8_t)(lost >> (8*n));
+    }
+    for (int n = 0; n < 8; n++) {
+        p[16 + n] = (uint8_t)(now >> (8*n));
+    }
+    droppedSeen = lost;
+}
+
+// Reset SPI2, which drops the byte its TX buffer still holds, and set
+// both DMA streams up for the next transaction
+static void arm(void)
+{
+    RX_STREAM->CR &= ~DMA_SxCR_EN;
+    TX_STREAM->CR &= ~DMA_SxCR_EN;
+    while ((RX_STREAM->CR | TX_STREAM->CR) & DMA_SxCR_EN) {
+        // streams stop after the current beat
+    }
+    RCC->APB1RSTR |= RCC_APB1RSTR_SPI2RST;
+    RCC->APB1RSTR &= ~RCC_APB1RSTR_SPI2RST;
+    DMA1->LIFCR = RX_FLAGS;
+    DMA1->HIFCR = TX_FLAGS;
+
+    rxBuf[0] = SPI_BRIDGE_CMD_NONE;
+
+    // Channel 0 on both, byte wide, memory incremented
+    RX_STREAM->PAR = (uint32_t)&SPI2->DR;
+    RX_STREAM->M0AR = (uint32_t)rxBuf;
+    RX_STREAM->NDTR = SPI_BRIDGE_XFER_MAX;
+    RX_STREAM->CR = DMA_SxCR_MINC | DMA_SxCR_PL_1;
+    TX_STREAM->PAR = (uint32_t)&SPI2->DR;
+    TX_STREAM->M0AR = (uint32_t)txBuf;
+    TX_STREAM->NDTR = SPI_BRIDGE_XFER_MAX;
+    TX_STREAM->CR = DMA_SxCR_MINC | DMA_SxCR_DIR_0 | DMA_SxCR_PL_1;
+
+    // Slave, mode 0, 8 bits, MSB first, hardware NSS
+    SPI2->CR2 = SPI_CR2_RXDMAEN;
+    RX_STREAM->CR |= DMA_SxCR_EN;
+    TX_STREAM->CR |= DMA_SxCR_EN;
+    SPI2->CR2 |= SPI_CR2_TXDMAEN;
+    SPI2->CR1 = SPI_CR1_SPE;
+}
+
+static void bridgeCmd(int argc, char *argv[])
+{
+    if (!running) {
+        printf("SPI bridge off\n");
+        return;
+    }
+
+    printf("SPI bridge: %lu transfers, %lu bytes, %lu payloads (%lu sent again)\n",
+           (unsigned long)transfers, (unsigned long)bytes,
+           (unsigned long)payloads, (unsigned long)resends);
+    printf("  %lu frames pending, %lu dropped, payload %u bytes waiting\n",
+           (unsigned long)spsc_count(&ring), (unsigned long)dropped, (unsigned)payloadLen);
+}
+
+#endif
@@ -0,0 +1,94 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * SPI slave bridge to an application processor.
+ *
+ * SPI2 runs as a DMA-driven slave.  It hands an application processor
+ * the sensor stream as binary frames (sensor_output.h), with no console
+ * and no parsing in the way.  Every transaction (NSS low to high, mode
+ * 0, MSB first) reads a status block followed by a payload of whole
+ * frames, all little endian:
+ *
+ *   [0]  'S' 'B'          magic; anything else: retry
+ *   [2]  version          SPI_BRIDGE_VERSION
+ *   [3]  flags            SPI_BRIDGE_DROPPED: frames dropped since the
+ *                         last payload; SPI_BRIDGE_RESENT: the payload
+ *                         is the last one again, which wasn't read whole
+ *   [4]  seq (16)         payload sequence number
+ *   [6]  payload len (16) bytes of frames after the block, 0 if none
+ *   [8]  pending (32)     frames still waiting behind this payload
+ *   [12] dropped (32)     frames dropped since startup, ring full
+ *   [16] time (64)        timebase_getUs() when the block was made
+ *   [24] payload, then zeros to the end of the transaction
+ *
+ * A payload counts as read once the transaction clocks past its end.
+ * Otherwise it is sent again.  Reading SPI_BRIDGE_XFER_MAX bytes always
+ * takes a whole payload.  The data-ready line is high while a payload is
+ * waiting and goes low as NSS falls.  The first byte the processor
+ * sends is a command: SPI_BRIDGE_CMD_FLUSH drops every frame pending.
+ *
+ * Frames wait in a ring of SPI_BRIDGE_FRAMES.  The sensor task fills it
+ * and never waits: when it is full a frame is dropped and counted.  The
+ * NSS EXTI ISR empties it into the next payload as a transaction ends.
+ * The peripheral is reset then, to drop the byte left in its TX
+ * buffer.  A processor should leave a few microseconds between
+ * transactions.
+ *
+ * Pins (AF5): PB13 SCK, PC2 MISO, PC3 MOSI, PB12 NSS; data ready on PC9.
+ * PB12 is also the INTN option of an auxiliary I2C hub (sh2_hal_i2c.h).
+ * If that takes EXTI line 12 first, the bridge stays off.  DMA1 streams
+ * 3 and 4 (channel 0) carry RX and TX.  "bridge" shows the counts.
+ */
+
+#ifndef SPI_BRIDGE_H
+#define SPI_BRIDGE_H
+
+// Set to 1 to build in the bridge (its transfer buffers and frame ring
+// take 7KB RAM at the default sizes)
+#ifndef SPI_BRIDGE
+#define SPI_BRIDGE (0)
+#endif
+
+#define SPI_BRIDGE_VERSION (1)
+
+// Status block flags
+#define SPI_BRIDGE_DROPPED (0x01)
+#define SPI_BRIDGE_RESENT  (0x02)
+
+// Commands (first byte from the processor)
+#define SPI_BRIDGE_CMD_NONE  (0x00)
+#define SPI_BRIDGE_CMD_FLUSH (0x01)
+
+#define SPI_BRIDGE_STATUS_LEN (24)
+
+// Longest transaction served; the payload is whole frames up to this
+// less the status block.  RAM for two buffers of it.
+#ifndef SPI_BRIDGE_XFER_MAX
+#define SPI_BRIDGE_XFER_MAX (1024)
+#endif
+
+// Frames waiting between the sensor task and the bridge (power of two)
+#ifndef SPI_BRIDGE_FRAMES
+#define SPI_BRIDGE_FRAMES (64)
+#endif
+
+// Set up SPI2, its DMA streams and pins, subscribe to every sensor and
+// register the "bridge" command.
+void spiBridge_init(void);
+
+#endif
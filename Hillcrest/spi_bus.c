@@ -0,0 +1,233 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * SPI bus arbiter for several devices on one SPI peripheral.
+ * Grants go earliest deadline first.
+ */
+
+#include "spi_bus.h"
+
+#include <stdio.h>
+#include <string.h>
+#include "timebase.h"
+#include "shell.h"
+#include "power.h"
+#include "gpio_fast.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+// ------------------------------------------------------------------------
+// Private types
+
+typedef struct {
+    const char *name;
+    GpioPin_t cs;
+    SemaphoreHandle_t grantSem;
+
+    // Request state, under critical section
+    bool waiting;
+    uint64_t deadline_uS;
+
+    // Written only by the client's own task
+    uint64_t request_uS;
+    uint64_t grant_uS;
+    SpiBus_Stats_t stats;
+} Client_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static int nextOwner(void);
+static void deselectOthers(int client);
+static void busCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static Client_t clients[SPI_BUS_MAX_CLIENTS];
+static unsigned numClients;
+static int owner = -1;
+static uint64_t statsSince_uS;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void spiBus_init(void)
+{
+    shell_addCommand("bus", "[reset] SPI bus occupancy and waits per client", busCmd);
+}
+
+int spiBus_addClient(const char *name, GPIO_TypeDef *csPort, uint16_t csPin)
+{
+    Client_t *c;
+
+    if (numClients >= SPI_BUS_MAX_CLIENTS) {
+        return -1;
+    }
+
+    c = &clients[numClients];
+    memset(c, 0, sizeof(*c));
+    c->name = name;
+    c->cs.port = csPort;
+    c->cs.pin = csPin;
+    c->grantSem = xSemaphoreCreateBinary();
+
+    // Deselected until it holds the bus
+    HAL_GPIO_WritePin(csPort, csPin, GPIO_PIN_SET);
+
+    return numClients++;
+}
+
+void spiBus_acquire(int client, uint64_t deadline_uS)
+{
+    Client_t *c = &clients[client];
+    bool granted = false;
+    uint32_t wait_uS;
+
+    c->request_uS = timebase_getUs();
+
+    taskENTER_CRITICAL();
+    if (owner < 0) {
+        owner = client;
+        granted = true;
+        // Whoever owns the bus keeps the MCU out of STOP
+        power_hold(POWER_HOLD_SPI);
+    }
+    else {
+        c->deadline_uS = deadline_uS;
+        c->waiting = true;
+    }
+    taskEXIT_CRITICAL();
+
+    if (!granted) {
+        // The releasing client picks us and gives the semaphore
+        xSemaphoreTake(c->grantSem, portMAX_DELAY);
+    }
+
+    c->grant_uS = timebase_getUs();
+    deselectOthers(client);
+
+    wait_uS = (uint32_t)(c->grant_uS - c->request_uS);
+    c->stats.grants++;
+    c->stats.waitUs += wait_uS;
+    if (wait_uS > c->stats.maxWaitUs) {
+        c->stats.maxWaitUs = wait_uS;
+    }
+    if (c->grant_uS > deadline_uS) {
+        c->stats.late++;
+    }
+}
+
+void spiBus_release(int client)
+{
+    Client_t *c = &clients[client];
+    int next;
+
+    gpioFast_set(&c->cs);
+    c->stats.heldUs += timebase_getUs() - c->grant_uS;
+
+    taskENTER_CRITICAL();
+    next = nextOwner();
+    owner = next;
+    if (next >= 0) {
+        clients[next].waiting = false;
+    }
+    else {
+        power_release(POWER_HOLD_SPI);
+    }
+    taskEXIT_CRITICAL();
+
+    if (next >= 0) {
+        xSemaphoreGive(clients[next].grantSem);
+    }
+}
+
+void spiBus_getStats(int client, SpiBus_Stats_t *pStats)
+{
+    *pStats = clients[client].stats;
+}
+
+void spiBus_clearStats(void)
+{
+    for (unsigned n = 0; n < numClients; n++) {
+        memset(&clients[n].stats, 0, sizeof(clients[n].stats));
+    }
+    statsSince_uS = timebase_getUs();
+}
+
+// ------------------------------------------------------------------------
+// Private functions
+
+// Waiting client with the earliest deadline, -1 if none.  Called in a
+// critical section.
+static int nextOwner(void)
+{
+    int next = -1;
+
+    for (unsigned n = 0; n < numClients; n++) {
+        if (clients[n].waiting &&
+            ((next < 0) || (clients[n].deadline_uS < clients[next].deadline_uS))) {
+            next = n;
+        }
+    }
+
+    return next;
+}
+
+// Only the new owner's device may be selected.  (Clients of the same
+// device share its chip select.)
+static void deselectOthers(int client)
+{
+    const Client_t *c = &clients[client];
+
+    for (unsigned n = 0; n < numClients; n++) {
+        if ((clients[n].cs.port != c->cs.port) || (clients[n].cs.pin != c->cs.pin)) {
+            gpioFast_set(&clients[n].cs);
+        }
+    }
+}
+
+static void busCmd(int argc, char *argv[])
+{
+    uint64_t interval;
+
+    if ((argc > 1) && (strcmp(argv[1], "reset") == 0)) {
+        spiBus_clearStats();
+        return;
+    }
+
+    interval = timebase_getUs() - statsSince_uS;
+    if (interval == 0) {
+        interval = 1;
+    }
+
+    printf("%u ms since reset\n", (unsigned)(interval / 1000));
+    printf("%-12s %8s %6s %8s %8s %6s\n",
+           "Client", "Grants", "Busy%", "Wait us", "Max us", "Late");
+    for (unsigned n = 0; n < numClients; n++) {
+        const SpiBus_Stats_t *s = &clients[n].stats;
+        unsigned busy = (unsigned)((s->heldUs * 1000) / interval);
+        unsigned avgWait = s->grants ? (unsigned)(s->waitUs / s->grants) : 0;
+
+        printf("%-12s %8u %4u.%u %8u %8u %6u\n",
+               clients[n].name, (unsigned)s->grants, busy / 10, busy % 10,
+               avgWait, (unsigned)s->maxWaitUs, (unsigned)s->late);
+    }
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * SPI bus arbiter for several devices on one SPI peripheral.
+ *
+ * Each client (a device, or one task's use of it) asks for the bus with
+ * a deadline.  When the bus is released it goes to the waiting client
+ * with the earliest deadline, so INTN-driven reads are not held up
+ * behind a long DFU or reset.  Clients keep their own chip select
+ * asserted while they hold the bus; the arbiter makes sure the others
+ * are deselected at each hand-over.
+ */
+
+#ifndef SPI_BUS_H
+#define SPI_BUS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "stm32f4xx_hal.h"
+
+#ifndef SPI_BUS_MAX_CLIENTS
+#define SPI_BUS_MAX_CLIENTS (4)
+#endif
+
+// Deadline for clients that only need the bus eventually
+#define SPI_BUS_NO_DEADLINE (UINT64_MAX)
+
+typedef struct {
+    uint32_t grants;
+    uint32_t late;          // granted after their deadline
+    uint64_t heldUs;        // total time holding the bus
+    uint64_t waitUs;        // total time waiting for it
+    uint32_t maxWaitUs;
+} SpiBus_Stats_t;
+
+// Register the "bus" console command.
+void spiBus_init(void);
+
+// Add a client whose chip select is csPin on csPort (active low).
+// Clients added first win ties between equal deadlines.  Returns the
+// client number, or -1 if the table is full.
+int spiBus_addClient(const char *name, GPIO_TypeDef *csPort, uint16_t csPin);
+
+// Block until the client holds the bus.  deadline_uS is on the
+// timebase_getUs() clock, or SPI_BUS_NO_DEADLINE.  (Task context.)
+void spiBus_acquire(int client, uint64_t deadline_uS);
+
+// Give up the bus, deselecting the client, and hand it to the most
+// urgent waiter.  (Task context.)
+void spiBus_release(int client);
+
+void spiBus_getStats(int client, SpiBus_Stats_t *pStats);
+void spiBus_clearStats(void);
+
+#endif
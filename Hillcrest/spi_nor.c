@@ -0,0 +1,253 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * JEDEC SPI-NOR flash on the shared SPI bus.
+ */
+
+#include "spi_nor.h"
+
+#include "sh2_err.h"
+#include "spi_bus.h"
+#include "cmsis_os.h"
+
+// Commands
+#define CMD_WRITE_ENABLE  (0x06)
+#define CMD_READ_STATUS   (0x05)
+#define CMD_READ          (0x03)
+#define CMD_PAGE_PROGRAM  (0x02)
+#define CMD_SECTOR_ERASE  (0x20)
+#define CMD_CHIP_ERASE    (0xC7)
+#define CMD_READ_ID       (0x9F)
+#define CMD_WAKE          (0xAB)    // release from deep power-down
+
+#define STATUS_BUSY (0x01)
+
+// Timeouts [ms]: HAL polling per transfer, and worst cases from the
+// W25Q/MX25L datasheets
+#define XFER_TIMEOUT_MS (10)
+#define PROGRAM_TIMEOUT_MS (5)
+#define SECTOR_TIMEOUT_MS (500)
+#define CHIP_TIMEOUT_MS (200000)
+
+// Largest chip reachable with 3-byte addresses
+#define MAX_CHIP_BYTES (16ul*1024*1024)
+
+// Flash in SPI mode 3: clock idles high, sampled on the second edge
+#define NOR_CR1_MODE (SPI_POLARITY_HIGH | SPI_PHASE_2EDGE | SPI_NOR_BAUD_PRESCALER)
+#define NOR_CR1_MASK (SPI_CR1_CPOL | SPI_CR1_CPHA | SPI_CR1_BR)
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void select(void);
+static void deselect(void);
+static int command(uint8_t cmd, uint32_t addr, unsigned addrLen,
+                   const uint8_t *pTx, uint8_t *pRx, unsigned len);
+static int writeEnable(void);
+static int waitReady(uint32_t timeout_ms, uint32_t poll_ms);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static SPI_HandleTypeDef *hspi;
+static int busClient = -1;
+static uint32_t hubCr1;         // the hub's SPI setup, put back on release
+static uint32_t jedecId;
+
+// ------------------------------------------------------------------------
+// Public API
+
+uint32_t spiNor_init(SPI_HandleTypeDef *pHspi)
+{
+    GPIO_InitTypeDef GPIO_InitStruct;
+    uint8_t id[3];
+    uint32_t bytes;
+
+    hspi = pHspi;
+
+    // Deselected before the first transfer on the bus
+    HAL_GPIO_WritePin(SPI_NOR_CS_PORT, SPI_NOR_CS_PIN, GPIO_PIN_SET);
+    GPIO_InitStruct.Pin = SPI_NOR_CS_PIN;
+    GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_PP;
+    GPIO_InitStruct.Pull = GPIO_PULLUP;
+    GPIO_InitStruct.Speed = GPIO_SPEED_FAST;
+    HAL_GPIO_Init(SPI_NOR_CS_PORT, &GPIO_InitStruct);
+
+    if (busClient < 0) {
+        busClient = spiBus_addClient("nor flash", SPI_NOR_CS_PORT, SPI_NOR_CS_PIN);
+    }
+    if (busClient < 0) {
+        return 0;
+    }
+
+    // Wake the chip in case it was left in deep power-down (tRES1 < 30us)
+    command(CMD_WAKE, 0, 0, 0, 0, 0);
+    osDelay(1);
+
+    if (command(CMD_READ_ID, 0, 0, 0, id, sizeof(id)) != SH2_OK) {
+        return 0;
+    }
+    jedecId = ((uint32_t)id[0] << 16) | ((uint32_t)id[1] << 8) | id[2];
+
+    // No chip (bus floating or held) reads all ones or all zeros.  The
+    // last id byte is the capacity as a power of two on these families.
+    if ((id[0] == 0x00) || (id[0] == 0xFF) || (id[2] < 16) || (id[2] > 31)) {
+        return 0;
+    }
+    bytes = 1ul << id[2];
+    return (bytes < MAX_CHIP_BYTES) ? bytes : MAX_CHIP_BYTES;
+}
+
+uint32_t spiNor_id(void)
+{
+    return jedecId;
+}
+
+int spiNor_read(uint32_t addr, void *pData, unsigned len)
+{
+    return command(CMD_READ, addr, 3, 0, pData, len);
+}
+
+int spiNor_program(uint32_t addr, const void *pData, unsigned len)
+{
+    int rc;
+
+    if ((len == 0) || ((addr % SPI_NOR_PAGE) + len > SPI_NOR_PAGE)) {
+        return SH2_ERR_BAD_PARAM;
+    }
+
+    rc = writeEnable();
+    if (rc == SH2_OK) {
+        rc = command(CMD_PAGE_PROGRAM, addr, 3, pData, 0, len);
+    }
+    if (rc == SH2_OK) {
+        rc = waitReady(PROGRAM_TIMEOUT_MS, 1);
+    }
+    return rc;
+}
+
+int spiNor_eraseSector(uint32_t addr)
+{
+    int rc = writeEnable();
+
+    if (rc == SH2_OK) {
+        rc = command(CMD_SECTOR_ERASE, addr, 3, 0, 0, 0);
+    }
+    if (rc == SH2_OK) {
+        rc = waitReady(SECTOR_TIMEOUT_MS, 1);
+    }
+    return rc;
+}
+
+int spiNor_eraseChip(void)
+{
+    int rc = writeEnable();
+
+    if (rc == SH2_OK) {
+        rc = command(CMD_CHIP_ERASE, 0, 0, 0, 0, 0);
+    }
+    if (rc == SH2_OK) {
+        rc = waitReady(CHIP_TIMEOUT_MS, 100);
+    }
+    return rc;
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+// Take the bus and switch it to the flash's mode and clock.
+static void select(void)
+{
+    spiBus_acquire(busClient, SPI_BUS_NO_DEADLINE);
+
+    // Mode and clock may only change with the SPI disabled
+    hubCr1 = hspi->Instance->CR1 & ~SPI_CR1_SPE;
+    hspi->Instance->CR1 = hubCr1;
+    hspi->Instance->CR1 = (hubCr1 & ~NOR_CR1_MASK) | NOR_CR1_MODE;
+
+    HAL_GPIO_WritePin(SPI_NOR_CS_PORT, SPI_NOR_CS_PIN, GPIO_PIN_RESET);
+}
+
+static void deselect(void)
+{
+    HAL_GPIO_WritePin(SPI_NOR_CS_PORT, SPI_NOR_CS_PIN, GPIO_PIN_SET);
+
+    // HAL re-enables the SPI at the hub's next transfer
+    hspi->Instance->CR1 &= ~SPI_CR1_SPE;
+    hspi->Instance->CR1 = hubCr1;
+
+    spiBus_release(busClient);
+}
+
+// One command: opcode, addrLen address bytes (MSB first), then len bytes
+// sent from pTx or received into pRx.
+static int command(uint8_t cmd, uint32_t addr, unsigned addrLen,
+                   const uint8_t *pTx, uint8_t *pRx, unsigned len)
+{
+    uint8_t hdr[4];
+    unsigned n = 0;
+    HAL_StatusTypeDef status;
+
+    if ((addrLen != 0) && (addr + len > MAX_CHIP_BYTES)) {
+        return SH2_ERR_BAD_PARAM;
+    }
+
+    hdr[n++] = cmd;
+    while (addrLen-- > 0) {
+        hdr[n++] = (uint8_t)(addr >> (8*addrLen));
+    }
+
+    // Polled: the hub's transfer-complete callbacks are its own
+    select();
+    status = HAL_SPI_Transmit(hspi, hdr, n, XFER_TIMEOUT_MS);
+    if ((status == HAL_OK) && (pTx != 0)) {
+        status = HAL_SPI_Transmit(hspi, (uint8_t *)pTx, len, XFER_TIMEOUT_MS);
+    }
+    else if ((status == HAL_OK) && (pRx != 0)) {
+        status = HAL_SPI_Receive(hspi, pRx, len, XFER_TIMEOUT_MS);
+    }
+    deselect();
+
+    return (status == HAL_OK) ? SH2_OK : SH2_ERR_IO;
+}
+
+static int writeEnable(void)
+{
+    return command(CMD_WRITE_ENABLE, 0, 0, 0, 0, 0);
+}
+
+// Poll the status register until the chip is done, sleeping poll_ms
+// with the bus released in between.
+static int waitReady(uint32_t timeout_ms, uint32_t poll_ms)
+{
+    uint32_t start = HAL_GetTick();
+    uint8_t status;
+
+    for (;;) {
+        if (command(CMD_READ_STATUS, 0, 0, 0, &status, 1) != SH2_OK) {
+            return SH2_ERR_IO;
+        }
+        if ((status & STATUS_BUSY) == 0) {
+            return SH2_OK;
+        }
+        if ((HAL_GetTick() - start) > timeout_ms) {
+            return SH2_ERR_TIMEOUT;
+        }
+        osDelay(poll_ms);
+    }
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Driver for a JEDEC SPI-NOR flash (W25Q, MX25L, IS25LP ...) sharing the
+ * sensor hub's SPI bus through spi_bus.
+ *
+ * 3-byte addresses (up to 16 MB), 256-byte pages and 4 KB sectors.  Each
+ * command holds the bus only for its own bytes: while the chip programs
+ * or erases, the bus is released and the caller sleeps between status
+ * polls, so hub reads with a deadline go ahead of it.  The SPI mode and
+ * clock are switched to the flash's on each acquire and put back after.
+ * Calls block, from task context only.
+ */
+
+#ifndef SPI_NOR_H
+#define SPI_NOR_H
+
+#include <stdint.h>
+
+#include "stm32f4xx_hal.h"
+
+// Chip select (active low), pulled up on the board
+#ifndef SPI_NOR_CS_PORT
+#define SPI_NOR_CS_PORT GPIOA
+#define SPI_NOR_CS_PIN GPIO_PIN_9       // Arduino D8
+#endif
+
+// SPI clock prescaler while the flash holds the bus
+#ifndef SPI_NOR_BAUD_PRESCALER
+#define SPI_NOR_BAUD_PRESCALER SPI_BAUDRATEPRESCALER_4
+#endif
+
+#define SPI_NOR_PAGE (256)
+#define SPI_NOR_SECTOR (4096)
+
+// Register as a bus client on hspi, which the hub shares, and read the
+// JEDEC id.  Returns the chip size in bytes, or 0 if no flash answers.
+uint32_t spiNor_init(SPI_HandleTypeDef *hspi);
+
+// JEDEC manufacturer and device id (3 bytes), as read by spiNor_init().
+uint32_t spiNor_id(void);
+
+// These return SH2_OK, or SH2_ERR_IO / SH2_ERR_TIMEOUT.
+int spiNor_read(uint32_t addr, void *pData, unsigned len);
+
+// Program within one page (len bytes from addr, not crossing a page
+// boundary) and wait until done.
+int spiNor_program(uint32_t addr, const void *pData, unsigned len);
+
+// Erase the sector holding addr, waiting until done (up to ~400 ms).
+int spiNor_eraseSector(uint32_t addr);
+
+// Erase the whole chip, waiting until done (tens of seconds).
+int spiNor_eraseChip(void);
+
+#endif
@@ -0,0 +1,128 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Lock-free single-producer, single-consumer ring.
+ *
+ * One context (a task or an ISR) fills slots and another empties them;
+ * neither takes a lock or masks interrupts.  head is only written by the
+ * producer and tail only by the consumer.  Both run freely and are masked
+ * to the ring's length, a power of two, so the ring holds all of its
+ * slots and full is head - tail == len.  The F401 has no data cache, so
+ * the two indices are kept together ahead of the slots.
+ *
+ * A ring is a struct declared with SPSC_RING(type, len):
+ *
+ *     typedef SPSC_RING(Sample_t, 64) SampleRing_t;
+ *     SampleRing_t ring;
+ *
+ *     // Producer
+ *     Sample_t *p = spsc_writeSlot(&ring);
+ *     if (p != 0) { *p = sample; spsc_push(&ring); }
+ *
+ *     // Consumer
+ *     while ((p = spsc_readSlot(&ring)) != 0) { use(p); spsc_pop(&ring); }
+ *
+ * Slots are filled and read in place, between spsc_writeSlot() and
+ * spsc_push(), and spsc_readSlot() and spsc_pop().  The macros evaluate
+ * their ring argument more than once.  A zeroed ring is empty.
+ */
+
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "stm32f4xx.h"
+
+typedef struct {
+    volatile uint32_t head;     // next slot to fill, producer only
+    volatile uint32_t tail;     // next slot to empty, consumer only
+} Spsc_t;
+
+// A ring of len slots of type.  A len that isn't a power of two is a
+// negative array size.
+#define SPSC_RING(type, len) \
+    struct { \
+        Spsc_t idx; \
+        type slot[(((len) & ((len) - 1)) == 0) ? (len) : -1]; \
+    }
+
+#define SPSC_LEN(r)         (sizeof((r)->slot) / sizeof((r)->slot[0]))
+
+// Slots in use.  Exact in either context, a bound in any other.
+#define spsc_count(r)       spsc_used(&(r)->idx)
+
+// Producer: the slot to fill, or 0 if the ring is full
+#define spsc_writeSlot(r) \
+    (spsc_full(&(r)->idx, SPSC_LEN(r)) ? 0 : &(r)->slot[(r)->idx.head & (SPSC_LEN(r) - 1)])
+
+// Producer: hand the slot filled to the consumer
+#define spsc_push(r)        spsc_publish(&(r)->idx)
+
+// Consumer: the oldest filled slot, or 0 if the ring is empty
+#define spsc_readSlot(r) \
+    (spsc_empty(&(r)->idx) ? 0 : &(r)->slot[spsc_acquire(&(r)->idx) & (SPSC_LEN(r) - 1)])
+
+// Consumer: hand the slot read back to the producer
+#define spsc_pop(r)         spsc_release(&(r)->idx)
+
+// Consumer: empty the ring (the producer may be filling a slot)
+#define spsc_flush(r)       ((r)->idx.tail = (r)->idx.head)
+
+// ------------------------------------------------------------------------
+// Index operations behind the macros
+
+static inline uint32_t spsc_used(const Spsc_t *q)
+{
+    return q->head - q->tail;
+}
+
+static inline bool spsc_full(const Spsc_t *q, uint32_t len)
+{
+    return (q->head - q->tail) >= len;
+}
+
+static inline bool spsc_empty(const Spsc_t *q)
+{
+    return q->head == q->tail;
+}
+
+static inline void spsc_publish(Spsc_t *q)
+{
+    // The slot is written before it is published
+    __DMB();
+    q->head = q->head + 1;
+}
+
+static inline uint32_t spsc_acquire(const Spsc_t *q)
+{
+    uint32_t tail = q->tail;
+
+    // The read of head completes before the slot is read
+    __DMB();
+    return tail;
+}
+
+static inline void spsc_release(Spsc_t *q)
+{
+    // Finished with the slot before handing it back
+    __DMB();
+    q->tail = q->tail + 1;
+}
+
+#endif
@@ -0,0 +1,422 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * System statistics: per-task CPU share, stack high-water marks, heap
+ * and queue usage, printed by the "top" shell command, and the RAM each
+ * module holds, printed by "mem".
+ */
+
+#include "sysstats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "task.h"
+#include "shell.h"
+
+// ------------------------------------------------------------------------
+// Private types
+
+typedef struct {
+    const char *name;
+    QueueHandle_t queue;
+    unsigned len;
+    volatile unsigned maxDepth;
+} WatchedQueue_t;
+
+typedef struct {
+    const char *name;
+    const uint32_t *counter;
+} WatchedCounter_t;
+
+typedef struct {
+    const char *name;
+    TaskHandle_t task;     // owner of a stack
+    unsigned bytes;
+    enum {
+        BLOCK_BUFFER,
+        BLOCK_STACK,       // static task stack
+        BLOCK_HEAP_STACK,  // task stack from the heap
+    } kind;
+} MemBlock_t;
+
+typedef struct {
+    UBaseType_t taskNumber;
+    uint32_t runTime;
+} PrevRunTime_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void topCmd(int argc, char *argv[]);
+static void memCmd(int argc, char *argv[]);
+static void memFit(unsigned margin);
+static void memStress(unsigned ms);
+static int addBlock(const char *name, TaskHandle_t task, unsigned bytes, int kind);
+static const TaskStatus_t *findTask(TaskHandle_t task, UBaseType_t count);
+static void printTasks(void);
+static void printQueues(void);
+static void printCounters(void);
+static uint32_t prevRunTime(UBaseType_t taskNumber);
+static unsigned tenths(uint32_t part, uint32_t whole);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static WatchedQueue_t queues[SYSSTATS_MAX_QUEUES];
+static unsigned numQueues = 0;
+
+static WatchedCounter_t counters[SYSSTATS_MAX_COUNTERS];
+static unsigned numCounters = 0;
+
+static MemBlock_t blocks[SYSSTATS_MAX_BLOCKS];
+static unsigned numBlocks = 0;
+
+// Used only from the shell task
+static TaskStatus_t taskStatus[SYSSTATS_MAX_TASKS];
+// sysstats_cpuLoad()'s own, so it may run while "top" holds taskStatus
+static TaskStatus_t loadStatus[SYSSTATS_MAX_TASKS];
+static PrevRunTime_t prev[SYSSTATS_MAX_TASKS];
+static unsigned numPrev = 0;
+static uint32_t prevTotal = 0;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void sysstats_init(void)
+{
+    shell_addCommand("top", "[reset] task CPU share, stack, heap, queue usage and counters", topCmd);
+    shell_addCommand("mem", "[fit [margin%] | stress <ms>] RAM held by each module's buffers and stacks", memCmd);
+}
+
+int sysstats_addQueue(const char *name, QueueHandle_t queue, unsigned len)
+{
+    int retval = -1;
+
+    taskENTER_CRITICAL();
+    if (numQueues < SYSSTATS_MAX_QUEUES) {
+        queues[numQueues].name = name;
+        queues[numQueues].queue = queue;
+        queues[numQueues].len = len;
+        queues[numQueues].maxDepth = 0;
+        numQueues++;
+        retval = 0;
+    }
+    taskEXIT_CRITICAL();
+
+    return retval;
+}
+
+int sysstats_addCounter(const char *name, const uint32_t *counter)
+{
+    int retval = -1;
+
+    taskENTER_CRITICAL();
+    if (numCounters < SYSSTATS_MAX_COUNTERS) {
+        counters[numCounters].name = name;
+        counters[numCounters].counter = counter;
+        numCounters++;
+        retval = 0;
+    }
+    taskEXIT_CRITICAL();
+
+    return retval;
+}
+
+int sysstats_addMemory(const char *name, unsigned bytes)
+{
+    return addBlock(name, 0, bytes, BLOCK_BUFFER);
+}
+
+int sysstats_addStack(const char *name, TaskHandle_t task, unsigned words, bool isStatic)
+{
+    return addBlock(name, task, words * sizeof(StackType_t),
+                    isStatic ? BLOCK_STACK : BLOCK_HEAP_STACK);
+}
+
+unsigned sysstats_cpuLoad(SysstatsLoadMark_t *pMark)
+{
+    uint32_t total;
+    uint32_t idle = 0;
+
+    vTaskSuspendAll();
+    UBaseType_t count = uxTaskGetSystemState(loadStatus, SYSSTATS_MAX_TASKS, &total);
+    for (unsigned n = 0; n < count; n++) {
+        if (strcmp(loadStatus[n].pcTaskName, "IDLE") == 0) {
+            idle = loadStatus[n].ulRunTimeCounter;
+        }
+    }
+    xTaskResumeAll();
+
+    uint32_t interval = total - pMark->total;
+    uint32_t idleDelta = idle - pMark->idle;
+    pMark->idle = idle;
+    pMark->total = total;
+
+    return (idleDelta < interval) ? 1000 - tenths(idleDelta, interval) : 0;
+}
+
+unsigned sysstats_counters(void)
+{
+    return numCounters;
+}
+
+const char *sysstats_counterName(unsigned n)
+{
+    return (n < numCounters) ? counters[n].name : "";
+}
+
+uint32_t sysstats_counterValue(unsigned n)
+{
+    return (n < numCounters) ? *counters[n].counter : 0;
+}
+
+void sysstats_tick(void)
+{
+    for (unsigned n = 0; n < numQueues; n++) {
+        unsigned depth = uxQueueMessagesWaitingFromISR(queues[n].queue);
+        if (depth > queues[n].maxDepth) {
+            queues[n].maxDepth = depth;
+        }
+    }
+}
+
+// ------------------------------------------------------------------------
+// Private functions
+
+static void topCmd(int argc, char *argv[])
+{
+    if ((argc > 1) && (strcmp(argv[1], "reset") == 0)) {
+        for (unsigned n = 0; n < numQueues; n++) {
+            queues[n].maxDepth = 0;
+        }
+        return;
+    }
+
+    printTasks();
+    printQueues();
+    printCounters();
+}
+
+// CPU share is shown both since the last "top" and since boot.  Time in
+// ISRs is charged to whichever task they interrupted.
+static void printTasks(void)
+{
+    uint32_t total;
+    uint32_t interval;
+    UBaseType_t count;
+    static const char stateChar[] = {'X', 'R', 'B', 'S', 'D'};
+
+    count = uxTaskGetSystemState(taskStatus, SYSSTATS_MAX_TASKS, &total);
+    if (count == 0) {
+        printf("More than %d tasks.\n", SYSSTATS_MAX_TASKS);
+        return;
+    }
+    interval = total - prevTotal;
+
+    printf("%u ms since last, %u ms since boot\n",
+           (unsigned)(interval / 1000), (unsigned)(total / 1000));
+    printf("%-*s St Pri  CPU%%  (boot) Stack free\n", configMAX_TASK_NAME_LEN, "Task");
+    for (unsigned n = 0; n < count; n++) {
+        const TaskStatus_t *t = &taskStatus[n];
+        uint32_t delta = t->ulRunTimeCounter - prevRunTime(t->xTaskNumber);
+        unsigned now = tenths(delta, interval);
+        unsigned boot = tenths(t->ulRunTimeCounter, total);
+
+        printf("%-*s %c  %3u %3u.%u (%3u.%u) %u\n",
+               configMAX_TASK_NAME_LEN, t->pcTaskName,
+               (t->eCurrentState < sizeof(stateChar)) ? stateChar[t->eCurrentState] : '?',
+               (unsigned)t->uxCurrentPriority,
+               now / 10, now % 10, boot / 10, boot % 10,
+               (unsigned)(t->usStackHighWaterMark * sizeof(StackType_t)));
+    }
+
+    // Remember counters for next time
+    for (unsigned n = 0; n < count; n++) {
+        prev[n].taskNumber = taskStatus[n].xTaskNumber;
+        prev[n].runTime = taskStatus[n].ulRunTimeCounter;
+    }
+    numPrev = count;
+    prevTotal = total;
+
+    printf("Heap: %u free, %u min free of %u\n",
+           (unsigned)xPortGetFreeHeapSize(),
+           (unsigned)xPortGetMinimumEverFreeHeapSize(),
+           (unsigned)configTOTAL_HEAP_SIZE);
+}
+
+static void printQueues(void)
+{
+    for (unsigned n = 0; n < numQueues; n++) {
+        printf("Queue %s: %u/%u now, %u max\n",
+               queues[n].name,
+               (unsigned)uxQueueMessagesWaiting(queues[n].queue),
+               queues[n].len, queues[n].maxDepth);
+    }
+}
+
+// Static blocks first, then stacks with their unused part.  Stacks from
+// the heap are shown but counted in the heap line, not the total.
+static void memCmd(int argc, char *argv[])
+{
+    if ((argc > 1) && (strcmp(argv[1], "fit") == 0)) {
+        memFit((argc > 2) ? strtoul(argv[2], 0, 0) : SYSSTATS_STACK_MARGIN_PCT);
+        return;
+    }
+    if ((argc > 2) && (strcmp(argv[1], "stress") == 0)) {
+        memStress(strtoul(argv[2], 0, 0));
+        return;
+    }
+
+    UBaseType_t count = uxTaskGetSystemState(taskStatus, SYSSTATS_MAX_TASKS, 0);
+    unsigned total = 0;
+    unsigned unused = 0;
+
+    printf("%-*s %7s %7s\n", configMAX_TASK_NAME_LEN + 6, "Block", "bytes", "unused");
+    for (unsigned n = 0; n < numBlocks; n++) {
+        const MemBlock_t *b = &blocks[n];
+        if (b->kind == BLOCK_BUFFER) {
+            printf("%-*s %7u\n", configMAX_TASK_NAME_LEN + 6, b->name, b->bytes);
+            total += b->bytes;
+        }
+    }
+    for (unsigned n = 0; n < numBlocks; n++) {
+        const MemBlock_t *b = &blocks[n];
+        const TaskStatus_t *t = findTask(b->task, count);
+        unsigned free = t ? t->usStackHighWaterMark * sizeof(StackType_t) : 0;
+
+        if (b->kind == BLOCK_BUFFER) {
+            continue;
+        }
+        printf("%-*s stack%c%7u %7u\n", configMAX_TASK_NAME_LEN, b->name,
+               (b->kind == BLOCK_HEAP_STACK) ? '*' : ' ', b->bytes, free);
+        if (b->kind == BLOCK_STACK) {
+            total += b->bytes;
+            unused += free;
+        }
+    }
+    printf("Total %u bytes reported, %u of it unused stack\n", total, unused);
+    printf("Heap: %u used, %u most used of %u (* stacks are in here)\n",
+           (unsigned)(configTOTAL_HEAP_SIZE - xPortGetFreeHeapSize()),
+           (unsigned)(configTOTAL_HEAP_SIZE - xPortGetMinimumEverFreeHeapSize()),
+           (unsigned)configTOTAL_HEAP_SIZE);
+}
+
+// Recommended size of each stack: the most it has used so far plus
+// margin percent, rounded up to SYSSTATS_STACK_ROUND words.
+static void memFit(unsigned margin)
+{
+    UBaseType_t count = uxTaskGetSystemState(taskStatus, SYSSTATS_MAX_TASKS, 0);
+    int saved = 0;
+
+    printf("%-*s %7s %7s %7s [words, +%u%%]\n", configMAX_TASK_NAME_LEN, "Stack",
+           "size", "used", "fit", margin);
+    for (unsigned n = 0; n < numBlocks; n++) {
+        const MemBlock_t *b = &blocks[n];
+        const TaskStatus_t *t = findTask(b->task, count);
+
+        if ((b->kind == BLOCK_BUFFER) || (t == 0)) {
+            continue;
+        }
+        unsigned words = b->bytes / sizeof(StackType_t);
+        unsigned used = words - t->usStackHighWaterMark;
+        unsigned fit = (used * (100 + margin) + 99) / 100;
+        fit = (fit + SYSSTATS_STACK_ROUND - 1) / SYSSTATS_STACK_ROUND * SYSSTATS_STACK_ROUND;
+        if (fit < configMINIMAL_STACK_SIZE) {
+            fit = configMINIMAL_STACK_SIZE;
+        }
+
+        printf("%-*s %7u %7u %7u%s\n", configMAX_TASK_NAME_LEN, b->name,
+               words, used, fit, (fit > words) ? " too small" : "");
+        saved += ((int)words - (int)fit) * (int)sizeof(StackType_t);
+    }
+    printf("%d bytes to reclaim at these sizes.\n", saved);
+}
+
+// Run float printf, the deepest console path, from the shell task for
+// ms, on top of whatever the sensor streams do meanwhile.
+static void memStress(unsigned ms)
+{
+    TickType_t end = xTaskGetTickCount() + pdMS_TO_TICKS(ms);
+    unsigned n = 0;
+
+    while ((int32_t)(end - xTaskGetTickCount()) > 0) {
+        float x = n * 0.001f;
+        printf("%5u %12.6f %12.6e %10.3f %8.2f\n", n, x, x * x, -x, x / 3.0f);
+        n++;
+    }
+    printf("%u lines.  Now \"mem fit\".\n", n);
+}
+
+static int addBlock(const char *name, TaskHandle_t task, unsigned bytes, int kind)
+{
+    int retval = -1;
+
+    taskENTER_CRITICAL();
+    if (numBlocks < SYSSTATS_MAX_BLOCKS) {
+        blocks[numBlocks].name = name;
+        blocks[numBlocks].task = task;
+        blocks[numBlocks].bytes = bytes;
+        blocks[numBlocks].kind = kind;
+        numBlocks++;
+        retval = 0;
+    }
+    taskEXIT_CRITICAL();
+
+    return retval;
+}
+
+static const TaskStatus_t *findTask(TaskHandle_t task, UBaseType_t count)
+{
+    for (unsigned n = 0; n < count; n++) {
+        if (taskStatus[n].xHandle == task) {
+            return &taskStatus[n];
+        }
+    }
+
+    return 0;
+}
+
+static void printCounters(void)
+{
+    for (unsigned n = 0; n < numCounters; n++) {
+        printf("%s: %u\n", counters[n].name, (unsigned)*counters[n].counter);
+    }
+}
+
+static uint32_t prevRunTime(UBaseType_t taskNumber)
+{
+    for (unsigned n = 0; n < numPrev; n++) {
+        if (prev[n].taskNumber == taskNumber) {
+            return prev[n].runTime;
+        }
+    }
+
+    // New since last time
+    return 0;
+}
+
+// part/whole in tenths of a percent
+static unsigned tenths(uint32_t part, uint32_t whole)
+{
+    if (whole == 0) {
+        return 0;
+    }
+
+    return (unsigned)(((uint64_t)part * 1000) / whole);
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * System statistics: per-task CPU share, stack high-water marks, heap
+ * and queue usage, printed by the "top" shell command, and the RAM each
+ * module holds, printed by "mem".
+ *
+ * "mem fit" turns the stack high-water marks into recommended stack
+ * sizes.  They only cover the paths run since boot, so take them after
+ * "mem stress" and a run at the highest report rates (see "sweep").
+ */
+
+#ifndef SYSSTATS_H
+#define SYSSTATS_H
+
+#include <stdbool.h>
+#include "FreeRTOS.h"
+#include "queue.h"
+#include "task.h"
+
+// Maximum number of tasks reported
+#ifndef SYSSTATS_MAX_TASKS
+#define SYSSTATS_MAX_TASKS (12)
+#endif
+
+// Maximum number of queues that can be watched
+#ifndef SYSSTATS_MAX_QUEUES
+#define SYSSTATS_MAX_QUEUES (4)
+#endif
+
+// Maximum number of event counters that can be watched (the dual SPI +
+// I2C build registers two sets of HAL counters)
+#ifndef SYSSTATS_MAX_COUNTERS
+#define SYSSTATS_MAX_COUNTERS (40)
+#endif
+
+// Maximum number of memory blocks (buffers and task stacks) reported
+#ifndef SYSSTATS_MAX_BLOCKS
+#define SYSSTATS_MAX_BLOCKS (32)
+#endif
+
+// "mem fit": headroom added to the most stack each task has used [%],
+// and the granule its recommended size is rounded up to [words]
+#ifndef SYSSTATS_STACK_MARGIN_PCT
+#define SYSSTATS_STACK_MARGIN_PCT (25)
+#endif
+#ifndef SYSSTATS_STACK_ROUND
+#define SYSSTATS_STACK_ROUND (32)
+#endif
+
+// Run-time counters at one moment, for sysstats_cpuLoad()
+typedef struct {
+    uint32_t idle;
+    uint32_t total;
+} SysstatsLoadMark_t;
+
+// Register the "top" and "mem" commands.  Call before the scheduler starts.
+void sysstats_init(void);
+
+// Watch a queue's depth.  name must remain valid.
+// Returns 0 on success, -1 if the queue table is full.
+int sysstats_addQueue(const char *name, QueueHandle_t queue, unsigned len);
+
+// Report a counter maintained elsewhere.  name and counter must remain valid.
+// Returns 0 on success, -1 if the counter table is full.
+int sysstats_addCounter(const char *name, const uint32_t *counter);
+
+// Report a statically allocated buffer of <bytes>.  name must remain valid.
+// Returns 0 on success, -1 if the block table is full.
+int sysstats_addMemory(const char *name, unsigned bytes);
+
+// Report the stack of <words> of a task, from .bss if isStatic, else from
+// the heap.  name must remain valid.
+int sysstats_addStack(const char *name, TaskHandle_t task, unsigned words, bool isStatic);
+
+// Share of CPU time spent outside the idle task since *pMark, in tenths
+// of a percent, and move *pMark to now.  From a zeroed mark it is the
+// share since boot.  Any task.
+unsigned sysstats_cpuLoad(SysstatsLoadMark_t *pMark);
+
+// The counters registered so far, by index: how many, and each one's
+// name and value.
+unsigned sysstats_counters(void);
+const char *sysstats_counterName(unsigned n);
+uint32_t sysstats_counterValue(unsigned n);
+
+// Sample queue depths.  Called from the tick hook.
+void sysstats_tick(void);
+
+#endif
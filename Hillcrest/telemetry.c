@@ -0,0 +1,328 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Telemetry frames.  See telemetry.h.
+ */
+
+#include "telemetry.h"
+
+#if TELEMETRY
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "cmsis_os.h"
+#include "sh2.h"
+#include "sh2_hal_health.h"
+#include "sensor_output.h"
+#include "sensor_stats.h"
+#include "sensor_app.h"
+#include "console.h"
+#include "crc16.h"
+#include "crc32.h"
+#include "timebase.h"
+#include "sysstats.h"
+#include "shell.h"
+#include "rtos_static.h"
+#include "priorities.h"
+
+#ifndef TELEMETRY_STACK
+#define TELEMETRY_STACK (192)
+#endif
+
+// How often to look again while frames are off [ms]
+#define IDLE_MS (250)
+
+#define HDR_LEN (5)                     // sync, kind, seq, body len
+#define BODY_MAX (255)
+// Room a metric takes at most (two 5-byte varints), and the longest
+// name sent
+#define ENTRY_MAX (10)
+#define NAME_MAX (32)
+
+// ------------------------------------------------------------------------
+// Private types
+
+// Sums read at the last metrics frame, for the _PERMILLE keys
+typedef struct {
+    SysstatsLoadMark_t load;
+    uint64_t busBusy_us;
+    uint64_t t_uS;
+} TelemMark_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void telemetryTask(const void *params);
+static bool streaming(void);
+static void sendValues(void);
+static void sendNames(void);
+static void begin(uint8_t kind);
+static void put(uint32_t key, uint32_t value);
+static void putName(uint32_t key, const char *name);
+static void flush(void);
+static uint8_t *putVarint(uint8_t *p, uint64_t v);
+static void metricsCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static const struct {
+    uint8_t key;
+    const char *name;
+} systemKeys[] = {
+    {TELEM_KEY_CPU_LOAD_PERMILLE, "cpu load permille"},
+    {TELEM_KEY_BUS_UTIL_PERMILLE, "bus util permille"},
+    {TELEM_KEY_CONSOLE_BYTES, "console bytes"},
+    {TELEM_KEY_CONSOLE_DROPS, "console drops"},
+    {TELEM_KEY_RING_OVERFLOWS, "sensor ring overflows"},
+    {TELEM_KEY_UPTIME_S, "uptime s"},
+};
+
+RTOS_STACK_DEF(telemetryTaskStack, TELEMETRY_STACK);
+
+static volatile uint32_t interval_ms = TELEMETRY_MS;
+
+// The frame being built
+static uint8_t frame[HDR_LEN + BODY_MAX + BIN_CRC_LEN];
+static uint8_t *pBody;
+static uint8_t kind;
+static uint8_t seq;
+
+static TelemMark_t mark;
+static unsigned namesDue;               // metrics frames until the names again
+
+static uint32_t frames;
+static uint32_t bytes;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void telemetry_init(void)
+{
+    osThreadDef(telemetryThreadDef, telemetryTask, PRIO_TASK_TELEMETRY, 0, TELEMETRY_STACK);
+    if (rtos_threadCreate(osThread(telemetryThreadDef), NULL, RTOS_STACK(telemetryTaskStack)) == NULL) {
+        printf("Failed to create telemetry task.\n");
+        return;
+    }
+
+    sysstats_addMemory("telemetry frame", sizeof(frame));
+    shell_addCommand("metrics", "[ms | off] telemetry frames in the binary output", metricsCmd);
+}
+
+void telemetry_setInterval(uint32_t ms)
+{
+    interval_ms = ms;
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static void telemetryTask(const void *params)
+{
+    bool was = false;
+
+    while (1) {
+        uint32_t ms = interval_ms;
+
+        if ((ms == 0) || !streaming()) {
+            was = false;
+            vTaskDelay(pdMS_TO_TICKS(IDLE_MS));
+            continue;
+        }
+        if (!was) {
+            // Output just started: names first, rates from the next frame
+            was = true;
+            sendNames();
+            namesDue = TELEMETRY_NAMES_EVERY;
+            mark.t_uS = 0;
+        }
+
+        vTaskDelay(pdMS_TO_TICKS(ms));
+        sendValues();
+        if (--namesDue == 0) {
+            sendNames();
+            namesDue = TELEMETRY_NAMES_EVERY;
+        }
+    }
+}
+
+// True while the sensor output is binary frames
+static bool streaming(void)
+{
+    OutputMode_t mode = sensorOutput_getMode();
+
+    return (mode == OUTPUT_BIN) || (mode == OUTPUT_DELTA) || (mode == OUTPUT_POSE);
+}
+
+// One or more metrics frames of everything there is to report
+static void sendValues(void)
+{
+    TelemMark_t now;
+    sh2_hal_Health_t health;
+    SensorStatsSummary_t sum;
+    uint32_t overflows, highWater;
+
+    now.load = mark.load;
+    unsigned load = sysstats_cpuLoad(&now.load);
+    sh2_hal_getHealth(&health);
+    now.busBusy_us = health.busyUs;
+    now.t_uS = timebase_getUs();
+    uint64_t span_us = now.t_uS - mark.t_uS;
+    uint64_t busy_us = now.busBusy_us - mark.busBusy_us;
+    bool rates = (mark.t_uS != 0) && (span_us != 0) && (busy_us <= span_us);
+    mark = now;
+    sensorApp_getRingStats(&overflows, &highWater);
+
+    begin(TELEM_FRAME_VALUES);
+    if (rates) {
+        put(TELEM_KEY_CPU_LOAD_PERMILLE, load);
+        put(TELEM_KEY_BUS_UTIL_PERMILLE, (uint32_t)(busy_us * 1000 / span_us));
+    }
+    put(TELEM_KEY_CONSOLE_BYTES, console_txBytes());
+    put(TELEM_KEY_CONSOLE_DROPS, console_txDrops());
+    put(TELEM_KEY_RING_OVERFLOWS, overflows);
+    put(TELEM_KEY_UPTIME_S, (uint32_t)(now.t_uS / 1000000));
+
+    for (unsigned n = 0; n < sysstats_counters(); n++) {
+        put(TELEM_KEY_COUNTER + n, sysstats_counterValue(n));
+    }
+
+    for (unsigned id = 1; id <= SH2_MAX_SENSOR_ID; id++) {
+        if ((sensorApp_interval(id) == 0) || !sensorStats_get((sh2_SensorId_t)id, &sum)) {
+            continue;
+        }
+        uint32_t key = TELEM_KEY_SENSOR + 4 * id;
+        put(key + TELEM_SENSOR_RECEIVED, sum.received);
+        put(key + TELEM_SENSOR_GAPS, sum.gaps);
+        put(key + TELEM_SENSOR_LOST, sum.lost);
+        put(key + TELEM_SENSOR_RATE_MHZ, (uint32_t)(sum.rate_Hz * 1000.0f + 0.5f));
+    }
+    flush();
+}
+
+// Name frames of the system and counter keys
+static void sendNames(void)
+{
+    begin(TELEM_FRAME_NAMES);
+    for (unsigned n = 0; n < sizeof(systemKeys) / sizeof(systemKeys[0]); n++) {
+        putName(systemKeys[n].key, systemKeys[n].name);
+    }
+    for (unsigned n = 0; n < sysstats_counters(); n++) {
+        putName(TELEM_KEY_COUNTER + n, sysstats_counterName(n));
+    }
+    flush();
+}
+
+// Start a frame of kind; a values frame starts with the time.
+static void begin(uint8_t k)
+{
+    kind = k;
+    pBody = &frame[HDR_LEN];
+    if (kind == TELEM_FRAME_VALUES) {
+        pBody = putVarint(pBody, timebase_getUs());
+    }
+}
+
+static void put(uint32_t key, uint32_t value)
+{
+    if (pBody + ENTRY_MAX > &frame[HDR_LEN + BODY_MAX]) {
+        flush();
+        begin(kind);
+    }
+    pBody = putVarint(pBody, key);
+    pBody = putVarint(pBody, value);
+}
+
+static void putName(uint32_t key, const char *name)
+{
+    size_t len = strlen(name);
+
+    if (len > NAME_MAX) {
+        len = NAME_MAX;
+    }
+    if (pBody + 5 + 1 + len > &frame[HDR_LEN + BODY_MAX]) {
+        flush();
+        begin(kind);
+    }
+    pBody = putVarint(pBody, key);
+    *pBody++ = (uint8_t)len;
+    memcpy(pBody, name, len);
+    pBody += len;
+}
+
+// Finish the frame and send it
+static void flush(void)
+{
+    unsigned blen = pBody - &frame[HDR_LEN];
+    uint8_t *p = pBody;
+
+    frame[0] = BIN_SYNC0;
+    frame[1] = BIN_METRICS_SYNC1;
+    frame[2] = kind;
+    frame[3] = seq++;
+    frame[4] = (uint8_t)blen;
+
+#if BIN_CRC32
+    uint32_t crc = crc32(&frame[2], 3 + blen);
+    *p++ = (uint8_t)crc;
+    *p++ = (uint8_t)(crc >> 8);
+    *p++ = (uint8_t)(crc >> 16);
+    *p++ = (uint8_t)(crc >> 24);
+#else
+    uint16_t crc = crc16(CRC16_INIT, &frame[2], 3 + blen);
+    *p++ = (uint8_t)(crc & 0xFF);
+    *p++ = (uint8_t)(crc >> 8);
+#endif
+
+    sensorOutput_writeFrame(frame, p - frame);
+    frames++;
+    bytes += p - frame;
+}
+
+static uint8_t *putVarint(uint8_t *p, uint64_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+// Shell command: show or set the metrics frame interval.
+static void metricsCmd(int argc, char *argv[])
+{
+    if (argc > 1) {
+        telemetry_setInterval((strcmp(argv[1], "off") == 0) ? 0 : strtoul(argv[1], 0, 0));
+    }
+
+    if (interval_ms == 0) {
+        printf("Metrics frames off.\n");
+    }
+    else {
+        printf("Metrics frames every %u ms%s.\n", (unsigned)interval_ms,
+               streaming() ? "" : " of binary output");
+    }
+    printf("%u frames, %u bytes sent.\n", (unsigned)frames, (unsigned)bytes);
+}
+
+#endif
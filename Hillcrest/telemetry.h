@@ -0,0 +1,97 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Telemetry frames in the binary output.
+ *
+ * While the console carries binary frames ("out bin", "out delta" or
+ * "out pose"), a low priority task adds a metrics frame every
+ * TELEMETRY_MS: each metric as a key and its value, both varints, so a
+ * frame of a few dozen counters costs a hundred bytes or so.  Frames
+ * are laid out as in sensor_output.h (BIN_METRICS_SYNC1); the
+ * kind byte tells values from names.
+ *
+ * Keys:
+ *   TELEM_KEY_*               system figures, below
+ *   TELEM_KEY_COUNTER + n     sysstats counter n ("top"), in the order
+ *                             registered: HAL health, hub resets, ...
+ *   TELEM_KEY_SENSOR + 4*id + TELEM_SENSOR_*
+ *                             statistics of each subscribed sensor
+ * Values are cumulative since boot but for the _PERMILLE ones, which
+ * cover the time since the frame before.  The names of the system and
+ * counter keys go out in name frames when the output starts and every
+ * TELEMETRY_NAMES_EVERY frames, so a parser that joins mid-stream
+ * soon knows them; tools/logparse decodes both.  "metrics" sets the
+ * interval.
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+
+// Set to 0 to leave telemetry frames out.
+#ifndef TELEMETRY
+#define TELEMETRY (1)
+#endif
+
+// Interval between metrics frames at startup [ms], 0 for none
+#ifndef TELEMETRY_MS
+#define TELEMETRY_MS (1000)
+#endif
+
+// Metrics frames between repeats of the key names
+#ifndef TELEMETRY_NAMES_EVERY
+#define TELEMETRY_NAMES_EVERY (30)
+#endif
+
+// Frame kinds, in the kind byte
+#define TELEM_FRAME_VALUES (0)
+#define TELEM_FRAME_NAMES (1)
+
+// Keys
+#define TELEM_KEY_CPU_LOAD_PERMILLE   (1)   // outside the idle task
+#define TELEM_KEY_BUS_UTIL_PERMILLE   (2)   // sensor bus busy time
+#define TELEM_KEY_CONSOLE_BYTES       (3)   // handed to the UART
+#define TELEM_KEY_CONSOLE_DROPS       (4)   // dropped by the tx policy
+#define TELEM_KEY_RING_OVERFLOWS      (5)   // sensor event ring
+#define TELEM_KEY_UPTIME_S            (6)
+#define TELEM_KEY_COUNTER             (0x40)
+#define TELEM_KEY_SENSOR              (0x100)
+
+// Per-sensor keys, from TELEM_KEY_SENSOR + 4 * sensor id
+#define TELEM_SENSOR_RECEIVED         (0)
+#define TELEM_SENSOR_GAPS             (1)
+#define TELEM_SENSOR_LOST             (2)
+#define TELEM_SENSOR_RATE_MHZ         (3)
+
+#if TELEMETRY
+
+// Start the telemetry task and register the "metrics" command.
+void telemetry_init(void);
+
+// Set the interval between metrics frames [ms], 0 to stop them.
+void telemetry_setInterval(uint32_t ms);
+
+#else
+
+#define telemetry_init()
+#define telemetry_setInterval(ms)
+
+#endif
+
+#endif
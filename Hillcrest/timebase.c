@@ -0,0 +1,513 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * High resolution timebase, based on TIM2 and the DWT cycle counter.
+ */
+
+#include "timebase.h"
+
+#include <string.h>
+#include <stdbool.h>
+#include "stm32f4xx_hal.h"
+#include "FreeRTOS.h"
+#include "placement.h"
+#include "priorities.h"
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static uint32_t lastCycles;      // CYCCNT at previous read
+static uint32_t cycleWraps;      // number of CYCCNT wraps seen
+static uint32_t cyclesPerUs;
+
+static uint32_t lastUs;          // TIM2 count at previous read
+static uint32_t usWraps;         // number of TIM2 wraps seen
+
+// Discipline: TIM2 microsecond d after baseRaw reads as
+// baseUs + d * (1 + rateQ32 / 2^32)
+static uint64_t baseRaw;
+static uint64_t baseUs;
+static int32_t rateQ32;
+static int32_t ratePpb;
+
+// Spans beyond this are folded into the base, so d * rateQ32 can't overflow
+#define REBASE_US (0x40000000)
+
+// Alarm n is compare channel n+3, channel 1 is the input capture and
+// channel 2 the pulse output
+static TimebaseAlarmFn_t *volatile alarmFn[TIMEBASE_NUM_ALARMS];
+
+#define ALARM_IE(n)  (TIM_DIER_CC3IE << (n))
+#define ALARM_IF(n)  (TIM_SR_CC3IF << (n))
+#define ALARM_G(n)   (TIM_EGR_CC3G << (n))
+#define ALARM_CCR(n) ((&TIM2->CCR3)[n])
+
+static TimebaseCaptureFn_t *volatile captureFn;
+static volatile uint32_t *captureLost;
+
+// Output compare modes of channel 2
+#define OC2M_ACTIVE     (TIM_CCMR1_OC2M_0)      // high on match
+#define OC2M_INACTIVE   (TIM_CCMR1_OC2M_1)      // low on match
+#define OC2M_FORCE_LOW  (TIM_CCMR1_OC2M_2)
+
+// The pulse in progress and the one set to follow it
+typedef struct {
+    uint64_t t_uS;
+    uint32_t width_uS;
+    TimebaseAlarmFn_t *fn;
+} Pulse_t;
+
+static Pulse_t pulse;
+static Pulse_t nextPulse;
+static bool pulseHigh;
+static bool pulseQueued;
+static bool pulseMissed;        // the count jumped over an edge
+
+static uint64_t rawUs(void);
+static uint32_t toRaw(uint32_t us);
+static uint32_t calcCyclesPerUs(void);
+static uint32_t calcTim2Prescaler(void);
+static void startPulse(const Pulse_t *p);
+static void pulseIrq(void);
+
+// ------------------------------------------------------------------------
+// Public API
+
+void timebase_init(void)
+{
+    cyclesPerUs = calcCyclesPerUs();
+
+    // Enable trace block, then the cycle counter itself.
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    lastCycles = 0;
+    cycleWraps = 0;
+
+    // TIM2 free running at 1MHz over its full 32 bits.
+    __TIM2_CLK_ENABLE();
+    TIM2->CR1 = 0;
+    TIM2->PSC = calcTim2Prescaler();
+    TIM2->ARR = 0xFFFFFFFF;
+    TIM2->EGR = TIM_EGR_UG;
+    TIM2->CR1 = TIM_CR1_CEN;
+
+    lastUs = 0;
+    usWraps = 0;
+    baseRaw = 0;
+    baseUs = 0;
+    rateQ32 = 0;
+    ratePpb = 0;
+
+    // The compare channels stay frozen: their compares only raise alarms
+    memset((void *)alarmFn, 0, sizeof(alarmFn));
+    captureFn = 0;
+    HAL_NVIC_SetPriority(TIM2_IRQn, PRIO_IRQ_SENSOR_BUS, 0);
+    HAL_NVIC_EnableIRQ(TIM2_IRQn);
+}
+
+uint64_t timebase_getCycles(void)
+{
+    UBaseType_t mask;
+    uint32_t now;
+    uint64_t retval;
+
+    mask = portSET_INTERRUPT_MASK_FROM_ISR();
+
+    now = DWT->CYCCNT;
+    if (now < lastCycles) {
+        // counter wrapped since last read
+        cycleWraps++;
+    }
+    lastCycles = now;
+    retval = ((uint64_t)cycleWraps << 32) | now;
+
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+
+    return retval;
+}
+
+HOT_FN uint64_t timebase_getUs(void)
+{
+    UBaseType_t mask;
+    uint64_t raw;
+    uint64_t d;
+    uint64_t retval;
+
+    mask = portSET_INTERRUPT_MASK_FROM_ISR();
+
+    raw = rawUs();
+    d = raw - baseRaw;
+    retval = baseUs + d + (((int64_t)d * rateQ32) >> 32);
+    if (d >= REBASE_US) {
+        baseRaw = raw;
+        baseUs = retval;
+    }
+
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+
+    return retval;
+}
+
+void timebase_setRatePpb(int32_t ppb)
+{
+    UBaseType_t mask;
+    uint64_t raw;
+    uint64_t d;
+
+    if (ppb > TIMEBASE_MAX_RATE_PPB) {
+        ppb = TIMEBASE_MAX_RATE_PPB;
+    }
+    else if (ppb < -TIMEBASE_MAX_RATE_PPB) {
+        ppb = -TIMEBASE_MAX_RATE_PPB;
+    }
+
+    mask = portSET_INTERRUPT_MASK_FROM_ISR();
+
+    // Rebase on now, so the new rate only applies from here on
+    raw = rawUs();
+    d = raw - baseRaw;
+    baseUs += d + (((int64_t)d * rateQ32) >> 32);
+    baseRaw = raw;
+    ratePpb = ppb;
+    rateQ32 = (int32_t)(((int64_t)ppb << 32) / 1000000000);
+
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+}
+
+int32_t timebase_getRatePpb(void)
+{
+    return ratePpb;
+}
+
+void timebase_stepUs(uint32_t us)
+{
+    UBaseType_t mask;
+
+    mask = portSET_INTERRUPT_MASK_FROM_ISR();
+    baseUs += us;
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+}
+
+uint32_t timebase_getStatsCount(void)
+{
+    return TIM2->CNT;
+}
+
+void timebase_delayUs(uint32_t us)
+{
+    uint32_t start = DWT->CYCCNT;
+    uint32_t cycles = us * cyclesPerUs;
+
+    // Unsigned difference is immune to counter wrap.
+    while ((DWT->CYCCNT - start) < cycles) {
+        // spin
+    }
+}
+
+void timebase_clockChanged(void)
+{
+    UBaseType_t mask;
+    uint32_t count;
+
+    mask = portSET_INTERRUPT_MASK_FROM_ISR();
+
+    cyclesPerUs = calcCyclesPerUs();
+
+    // A new prescaler only loads on an update event, which also clears
+    // the count, so put the count back afterwards.
+    count = TIM2->CNT;
+    TIM2->PSC = calcTim2Prescaler();
+    TIM2->EGR = TIM_EGR_UG;
+    TIM2->CNT = count;
+
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+}
+
+void timebase_advanceUs(uint32_t us)
+{
+    UBaseType_t mask;
+
+    mask = portSET_INTERRUPT_MASK_FROM_ISR();
+
+    // A wrap past lastUs is counted by the next read, as usual
+    TIM2->CNT += us;
+
+    // The jump may have carried the count over alarms
+    for (unsigned n = 0; n < TIMEBASE_NUM_ALARMS; n++) {
+        if ((TIM2->DIER & ALARM_IE(n)) && ((int32_t)(ALARM_CCR(n) - TIM2->CNT) <= 0)) {
+            TIM2->EGR = ALARM_G(n);
+        }
+    }
+
+    // and over a pulse edge: keep the pin low and let the ISR move on
+    if ((TIM2->DIER & TIM_DIER_CC2IE) && ((int32_t)(TIM2->CCR2 - TIM2->CNT) <= 0)) {
+        TIM2->CCMR1 = (TIM2->CCMR1 & ~TIM_CCMR1_OC2M) | OC2M_FORCE_LOW;
+        pulseMissed = true;
+        TIM2->EGR = TIM_EGR_CC2G;
+    }
+
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+}
+
+void timebase_setAlarm(TimebaseAlarm_t alarm, uint64_t t_uS, TimebaseAlarmFn_t *fn)
+{
+    UBaseType_t mask;
+    uint64_t now;
+    uint32_t delta;
+
+    mask = portSET_INTERRUPT_MASK_FROM_ISR();
+
+    TIM2->DIER &= ~ALARM_IE(alarm);
+    alarmFn[alarm] = fn;
+
+    // Compare on the raw count, within half a wrap
+    now = timebase_getUs();
+    delta = 0;
+    if (t_uS > now) {
+        delta = ((t_uS - now) < 0x7FFFFFFF) ? (uint32_t)(t_uS - now) : 0x7FFFFFFF;
+    }
+    ALARM_CCR(alarm) = TIM2->CNT + toRaw(delta);
+    TIM2->SR = ~ALARM_IF(alarm);
+    TIM2->DIER |= ALARM_IE(alarm);
+
+    // Too close to catch the match: fire now
+    if ((int32_t)(ALARM_CCR(alarm) - TIM2->CNT) <= 0) {
+        TIM2->EGR = ALARM_G(alarm);
+    }
+
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+}
+
+void timebase_cancelAlarm(TimebaseAlarm_t alarm)
+{
+    UBaseType_t mask;
+
+    mask = portSET_INTERRUPT_MASK_FROM_ISR();
+    TIM2->DIER &= ~ALARM_IE(alarm);
+    TIM2->SR = ~ALARM_IF(alarm);
+    alarmFn[alarm] = 0;
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+}
+
+void timebase_setCapture(TimebaseCaptureFn_t *fn, volatile uint32_t *pLost)
+{
+    UBaseType_t mask;
+
+    mask = portSET_INTERRUPT_MASK_FROM_ISR();
+
+    TIM2->DIER &= ~TIM_DIER_CC1IE;
+    TIM2->CCER &= ~TIM_CCER_CC1E;
+    captureFn = fn;
+    captureLost = pLost;
+
+    if (fn != 0) {
+        // IC1 on TI1, rising edge, no prescaler, filtered over 8 timer
+        // clocks (~0.1us) so a glitch on the line doesn't count
+        TIM2->CCMR1 = (TIM2->CCMR1 & ~(TIM_CCMR1_CC1S | TIM_CCMR1_IC1PSC | TIM_CCMR1_IC1F)) |
+                      TIM_CCMR1_CC1S_0 | TIM_CCMR1_IC1F_0 | TIM_CCMR1_IC1F_1;
+        TIM2->CCER &= ~(TIM_CCER_CC1P | TIM_CCER_CC1NP);
+        TIM2->SR = ~(TIM_SR_CC1IF | TIM_SR_CC1OF);
+        TIM2->CCER |= TIM_CCER_CC1E;
+        TIM2->DIER |= TIM_DIER_CC1IE;
+    }
+
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+}
+
+void timebase_setPulse(uint64_t t_uS, uint32_t width_uS, TimebaseAlarmFn_t *fn)
+{
+    UBaseType_t mask;
+    Pulse_t p = {t_uS, (width_uS != 0) ? width_uS : 1, fn};
+
+    mask = portSET_INTERRUPT_MASK_FROM_ISR();
+
+    if (pulseHigh) {
+        // Goes out when this one ends
+        nextPulse = p;
+        pulseQueued = true;
+    }
+    else {
+        startPulse(&p);
+    }
+
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+}
+
+void timebase_cancelPulse(void)
+{
+    UBaseType_t mask;
+
+    mask = portSET_INTERRUPT_MASK_FROM_ISR();
+    TIM2->DIER &= ~TIM_DIER_CC2IE;
+    TIM2->CCMR1 = (TIM2->CCMR1 & ~(TIM_CCMR1_CC2S | TIM_CCMR1_OC2M)) | OC2M_FORCE_LOW;
+    TIM2->CCER |= TIM_CCER_CC2E;
+    TIM2->SR = ~TIM_SR_CC2IF;
+    pulseHigh = false;
+    pulseQueued = false;
+    pulseMissed = false;
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(mask);
+}
+
+void timebase_alarmIrq(void)
+{
+    uint32_t due = TIM2->SR & TIM2->DIER;
+
+    if (due & TIM_SR_CC2IF) {
+        pulseIrq();
+    }
+
+    if (due & TIM_SR_CC1IF) {
+        // Reading CCR1 clears CC1IF; the count has moved on since the
+        // edge by however long this took to run.
+        uint32_t edge = TIM2->CCR1;
+        uint32_t age = TIM2->CNT - edge;
+        uint64_t now = timebase_getUs();
+        TimebaseCaptureFn_t *fn = captureFn;
+
+        if (TIM2->SR & TIM_SR_CC1OF) {
+            TIM2->SR = ~TIM_SR_CC1OF;
+            if (captureLost != 0) {
+                (*captureLost)++;
+            }
+        }
+        if (fn != 0) {
+            fn(now - age - (((int64_t)age * rateQ32) >> 32));
+        }
+    }
+
+    for (unsigned n = 0; n < TIMEBASE_NUM_ALARMS; n++) {
+        if (due & ALARM_IF(n)) {
+            TimebaseAlarmFn_t *fn = alarmFn[n];
+
+            TIM2->SR = ~ALARM_IF(n);
+            TIM2->DIER &= ~ALARM_IE(n);
+            if (fn != 0) {
+                fn();
+            }
+        }
+    }
+}
+
+// ------------------------------------------------------------------------
+// Private functions
+
+// Set the rising edge of p, with interrupts masked and the pin low
+static void startPulse(const Pulse_t *p)
+{
+    uint64_t now = timebase_getUs();
+    uint32_t delta = 2;
+
+    if (p->t_uS > now + delta) {
+        delta = ((p->t_uS - now) < 0x7FFFFFFF) ? (uint32_t)(p->t_uS - now) : 0x7FFFFFFF;
+    }
+
+    pulse = *p;
+    TIM2->CCR2 = TIM2->CNT + toRaw(delta);
+    TIM2->CCMR1 = (TIM2->CCMR1 & ~(TIM_CCMR1_CC2S | TIM_CCMR1_OC2M)) | OC2M_ACTIVE;
+    TIM2->CCER |= TIM_CCER_CC2E;
+    TIM2->SR = ~TIM_SR_CC2IF;
+    TIM2->DIER |= TIM_DIER_CC2IE;
+}
+
+// A compare on channel 2: the pin just went high, or just went low
+static void pulseIrq(void)
+{
+    TIM2->SR = ~TIM_SR_CC2IF;
+
+    if (pulseMissed && !pulseHigh) {
+        // No rising edge went out; still let the owner set the next one
+        TimebaseAlarmFn_t *fn = pulse.fn;
+
+        pulseMissed = false;
+        TIM2->DIER &= ~TIM_DIER_CC2IE;
+        if (fn != 0) {
+            fn();
+        }
+        return;
+    }
+    pulseMissed = false;
+
+    if (!pulseHigh) {
+        TimebaseAlarmFn_t *fn = pulse.fn;
+
+        pulseHigh = true;
+        TIM2->CCR2 += pulse.width_uS;
+        TIM2->CCMR1 = (TIM2->CCMR1 & ~TIM_CCMR1_OC2M) | OC2M_INACTIVE;
+        if ((int32_t)(TIM2->CCR2 - TIM2->CNT) <= 0) {
+            // Already past the end, which will never match: take it low
+            // now, and come back to finish (a software compare event
+            // raises the flag but doesn't drive the pin)
+            TIM2->CCMR1 = (TIM2->CCMR1 & ~TIM_CCMR1_OC2M) | OC2M_FORCE_LOW;
+            TIM2->EGR = TIM_EGR_CC2G;
+        }
+        if (fn != 0) {
+            fn();
+        }
+        return;
+    }
+
+    pulseHigh = false;
+    if (pulseQueued) {
+        pulseQueued = false;
+        startPulse(&nextPulse);
+    }
+    else {
+        TIM2->DIER &= ~TIM_DIER_CC2IE;
+    }
+}
+
+// TIM2 count, extended to 64 bits.  With interrupts masked.
+HOT_FN static uint64_t rawUs(void)
+{
+    uint32_t now = TIM2->CNT;
+
+    if (now < lastUs) {
+        // counter wrapped since last read
+        usWraps++;
+    }
+    lastUs = now;
+
+    return ((uint64_t)usWraps << 32) | now;
+}
+
+// TIM2 counts in us microseconds of timebase_getUs(), to first order
+static uint32_t toRaw(uint32_t us)
+{
+    return us - (uint32_t)(((int64_t)us * rateQ32) >> 32);
+}
+
+static uint32_t calcCyclesPerUs(void)
+{
+    uint32_t retval = SystemCoreClock / 1000000;
+
+    return (retval != 0) ? retval : 1;
+}
+
+static uint32_t calcTim2Prescaler(void)
+{
+    uint32_t timClk = HAL_RCC_GetPCLK1Freq();
+
+    // TIM2 is on APB1, its clock is doubled when APB1 is divided.
+    if ((RCC->CFGR & RCC_CFGR_PPRE1) != RCC_CFGR_PPRE1_DIV1) {
+        timClk *= 2;
+    }
+
+    return (timClk / 1000000) - 1;
+}
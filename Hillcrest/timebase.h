@@ -0,0 +1,115 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * High resolution timebase.
+ *
+ * Microseconds come from TIM2, a 32-bit timer clocked at 1MHz, which keeps
+ * running while the core sleeps in tickless idle.  Cycles come from the
+ * DWT cycle counter, which stops in sleep, so are only good for measuring
+ * and delaying while running.
+ */
+
+#ifndef TIMEBASE_H
+#define TIMEBASE_H
+
+#include <stdint.h>
+
+// Start TIM2 and the cycle counter.  Call after SystemClock_Config().
+void timebase_init(void);
+
+// Cycle count since timebase_init(), extended to 64 bits.
+// Safe to call from tasks and ISRs.  Must be called at least once per
+// counter wrap (2^32 cycles, ~51s at 84MHz); the tick hook takes care of that.
+uint64_t timebase_getCycles(void);
+
+// Microseconds since timebase_init(), extended to 64 bits, as
+// disciplined by timebase_setRatePpb().  Accurate across sleep.  Safe to call from tasks and ISRs.  Must be called at
+// least once per wrap (~71 min); the tick hook takes care of that.
+uint64_t timebase_getUs(void);
+
+// Discipline the microsecond count against an outside reference (see
+// gps_pps.h): from the call on, each TIM2 microsecond counts as
+// 1 + ppb/10^9 of them.  The count carries on from where it was, so
+// it never jumps.  Limited to +/-TIMEBASE_MAX_RATE_PPB.  Alarms, pulses and
+// captures follow the rate.
+#define TIMEBASE_MAX_RATE_PPB (20000000)
+void timebase_setRatePpb(int32_t ppb);
+int32_t timebase_getRatePpb(void);
+
+// Move the microsecond count forward by us at once.  Forward only, so
+// time never goes backwards; alarms and pulses already set stay where
+// they were in real time.
+void timebase_stepUs(uint32_t us);
+
+// Run time stats counter for FreeRTOS, in microseconds.
+// Wraps every 2^32 us (~71 min).
+uint32_t timebase_getStatsCount(void);
+
+// Busy-wait for at least us microseconds, to within a few cycles at any
+// core clock.  Up to 2^32 cycles (~51s at 84MHz) per call.
+void timebase_delayUs(uint32_t us);
+
+// Call after changing SystemCoreClock (e.g. HAL_RCC_ClockConfig()) so
+// delays and timestamps keep using the right rate.
+void timebase_clockChanged(void);
+
+// Move the microsecond count on by the time TIM2 missed, e.g. in STOP
+// mode, where it stops with the clocks (power.c).
+void timebase_advanceUs(uint32_t us);
+
+// One-shot alarms on TIM2's compare channels 3 and 4, called from the
+// TIM2 ISR at PRIO_IRQ_SENSOR_BUS.  Setting an alarm replaces its last setting.
+// A time already past fires at once.  Like the count, alarms do not run
+// in STOP.
+typedef enum {
+    TIMEBASE_ALARM_I2C_POLL,        // hub without INTN (sh2_hal_i2c.c)
+    TIMEBASE_ALARM_SPI_MODERATE,    // INTN moderation window (sh2_hal_spi.c)
+    TIMEBASE_NUM_ALARMS,            // up to 2, one per channel
+} TimebaseAlarm_t;
+typedef void (TimebaseAlarmFn_t)(void);
+void timebase_setAlarm(TimebaseAlarm_t alarm, uint64_t t_uS, TimebaseAlarmFn_t *fn);
+void timebase_cancelAlarm(TimebaseAlarm_t alarm);
+
+// Input capture on TIM2 channel 1 (TIM2_CH1_ETR, e.g. PA0 in AF1; the
+// caller sets the pin up).  Each rising edge is latched by the timer
+// itself, so fn gets the edge's time on the timebase_getUs() clock
+// however late the ISR runs, as long as it runs within the same ~71 min
+// wrap.  fn is called from the TIM2 ISR at PRIO_IRQ_SENSOR_BUS.  An edge
+// that comes before the ISR read the last one is lost, and counted in
+// *pLost (if not NULL).  NULL fn stops capturing.  Edges in STOP mode
+// are not seen.
+typedef void (TimebaseCaptureFn_t)(uint64_t t_uS);
+void timebase_setCapture(TimebaseCaptureFn_t *fn, volatile uint32_t *pLost);
+
+// Pulse output on TIM2 channel 2 (TIM2_CH2, e.g. PA1 in AF1; the caller
+// sets the pin up).  The timer drives the pin high at t_uS, with no
+// software in the way, and the ISR takes it low width_uS later.  fn is
+// called from the TIM2 ISR at the rising edge, and may set the next
+// pulse, which starts once this one has ended.  A t_uS less than 2us
+// ahead goes out 2us from now.  Like the alarms, pulses stop in STOP;
+// an edge the count jumps over on waking is skipped, fn still called.
+void timebase_setPulse(uint64_t t_uS, uint32_t width_uS, TimebaseAlarmFn_t *fn);
+
+// Drop any pulse set and drive the pin low.  Call once before the pin
+// is switched to the timer, so it starts low.
+void timebase_cancelPulse(void);
+
+// Call from TIM2_IRQHandler.
+void timebase_alarmIrq(void);
+
+#endif
@@ -0,0 +1,142 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Trace points
+ */
+
+#include "trace.h"
+
+#include <stdio.h>
+#include <string.h>
+#include "stm32f4xx_hal.h"
+#include "itm.h"
+#include "dbg.h"
+#include "shell.h"
+#include "sysstats.h"
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void traceCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static const char * const eventName[TRACE_NUM_EVENTS] = {
+    [TRACE_NONE] = "-",
+    [TRACE_SPI_CPLT] = "spi cplt",
+    [TRACE_SPI_ERROR] = "spi error",
+    [TRACE_DFU_BYTE] = "dfu byte",
+    [TRACE_SPI_START] = "spi start",
+    [TRACE_SPI_ABORT] = "spi abort",
+    [TRACE_I2C_RECOVER] = "i2c recover",
+};
+
+#if TRACE_POINTS
+static TraceRec_t ring[TRACE_RING_LEN];
+static volatile uint32_t ringIn;      // runs freely, masked on access
+#endif
+
+// ------------------------------------------------------------------------
+// Public API
+
+void trace_init(void)
+{
+#if TRACE_POINTS
+    sysstats_addMemory("trace ring", sizeof(ring));
+#endif
+    shell_addCommand("trace", "[clear] recent trace point records", traceCmd);
+}
+
+void trace_record(TraceEvent_t event, uint32_t arg)
+{
+#if TRACE_POINTS
+    // Claim a slot, ISRs and tasks may race for it
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    TraceRec_t *r = &ring[ringIn++ & (TRACE_RING_LEN - 1)];
+    __set_PRIMASK(primask);
+
+    r->cycles = DWT->CYCCNT;
+    r->event = event;
+    r->arg = arg;
+
+    // One word, so ISRs and tasks can share the port
+    itm_write32(ITM_PORT_TRACE, (event << 24) | (arg & 0xFFFFFF));
+#if TRACE_GPIO
+    dbgPulse(event);
+#endif
+#endif
+}
+
+unsigned trace_copy(TraceRec_t *pRecs, unsigned max)
+{
+#if TRACE_POINTS
+    uint32_t in = ringIn;
+    uint32_t count = (in < TRACE_RING_LEN) ? in : TRACE_RING_LEN;
+
+    if (count > max) {
+        count = max;
+    }
+    for (uint32_t n = 0; n < count; n++) {
+        pRecs[n] = ring[(in - count + n) & (TRACE_RING_LEN - 1)];
+    }
+    return count;
+#else
+    return 0;
+#endif
+}
+
+const char *trace_eventName(uint32_t event)
+{
+    const char *name = (event < TRACE_NUM_EVENTS) ? eventName[event] : 0;
+
+    return name ? name : "?";
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static void traceCmd(int argc, char *argv[])
+{
+#if TRACE_POINTS
+    if ((argc > 1) && (strcmp(argv[1], "clear") == 0)) {
+        ringIn = 0;
+        memset(ring, 0, sizeof(ring));
+        return;
+    }
+
+    // Snapshot, so the dump doesn't trace the console's own traffic
+    static TraceRec_t copy[TRACE_RING_LEN];
+    uint32_t in = ringIn;
+    memcpy(copy, ring, sizeof(copy));
+
+    uint32_t count = (in < TRACE_RING_LEN) ? in : TRACE_RING_LEN;
+    uint32_t cyclesPerUs = HAL_RCC_GetHCLKFreq() / 1000000;
+    uint32_t t0 = copy[(in - count) & (TRACE_RING_LEN - 1)].cycles;
+
+    printf("%u records, oldest first [us]:\n", (unsigned)count);
+    for (uint32_t n = in - count; n != in; n++) {
+        const TraceRec_t *r = &copy[n & (TRACE_RING_LEN - 1)];
+        printf("  %10u %-12s %u\n", (unsigned)((r->cycles - t0) / cyclesPerUs),
+               trace_eventName(r->event), (unsigned)r->arg);
+    }
+#else
+    printf("Built without TRACE_POINTS.\n");
+#endif
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Trace points: (event, cycle count, argument) records in a RAM ring,
+ * cheap enough for ISRs.  The ring is dumped with the trace command,
+ * and each record can also go out on SWO or as pulses on the debug pin.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// Set to 0 to compile all trace points out (release builds).
+#ifndef TRACE_POINTS
+#define TRACE_POINTS (1)
+#endif
+
+// Records kept (power of 2), 12 bytes each
+#ifndef TRACE_RING_LEN
+#define TRACE_RING_LEN (128)
+#endif
+
+// Set to 1 to also pulse the dbg pin <event> times per record, as the
+// HAL used to.  Slow: several GPIO writes per event.
+#ifndef TRACE_GPIO
+#define TRACE_GPIO (0)
+#endif
+
+// Event ids.  The SPI ones keep the pulse counts they had as dbgPulse().
+typedef enum {
+    TRACE_NONE = 0,
+    TRACE_SPI_CPLT = 2,     // SPI transfer phase done, arg: phase
+    TRACE_SPI_ERROR = 3,    // SPI error callback, arg: HAL error code
+    TRACE_DFU_BYTE = 4,     // DFU byte on the bus, arg: index in packet
+    TRACE_SPI_START = 5,    // SPI transfer phase started, arg: length
+    TRACE_SPI_ABORT = 6,    // SPI watchdog abort, arg: phase
+    TRACE_I2C_RECOVER = 7,  // I2C bus recovery, arg: HAL error code
+    TRACE_NUM_EVENTS
+} TraceEvent_t;
+
+typedef struct {
+    uint32_t cycles;    // DWT cycle count
+    uint32_t event;
+    uint32_t arg;
+} TraceRec_t;
+
+#if TRACE_POINTS
+#define TRACE(event, arg) trace_record((event), (uint32_t)(arg))
+#else
+#define TRACE(event, arg) ((void)0)
+#endif
+
+// Register the trace command.
+void trace_init(void);
+
+// Use TRACE() rather than calling this, so trace points compile out.
+void trace_record(TraceEvent_t event, uint32_t arg);
+
+// Copy up to max of the newest records, oldest first.  Returns the count.
+unsigned trace_copy(TraceRec_t *pRecs, unsigned max);
+
+const char *trace_eventName(uint32_t event);
+
+#endif
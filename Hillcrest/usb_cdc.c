@@ -0,0 +1,927 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * USB CDC-ACM device on the OTG_FS core.
+ */
+
+#include "usb_cdc.h"
+
+#if USB_CDC
+
+#include <stdio.h>
+#include <string.h>
+#include "stm32f4xx_hal.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+#include "clock.h"
+#include "console.h"
+#include "shell.h"
+#include "sysstats.h"
+#include "priorities.h"
+#include "timebase.h"
+
+// OTG_FS register blocks
+#define USBx        USB_OTG_FS
+#define USB_DEV     ((USB_OTG_DeviceTypeDef *)(USB_OTG_FS_PERIPH_BASE + USB_OTG_DEVICE_BASE))
+#define USB_IN(ep)  ((USB_OTG_INEndpointTypeDef *)(uintptr_t)(USB_OTG_FS_PERIPH_BASE + \
+                        USB_OTG_IN_ENDPOINT_BASE + (ep)*USB_OTG_EP_REG_SIZE))
+#define USB_OUT(ep) ((USB_OTG_OUTEndpointTypeDef *)(uintptr_t)(USB_OTG_FS_PERIPH_BASE + \
+                        USB_OTG_OUT_ENDPOINT_BASE + (ep)*USB_OTG_EP_REG_SIZE))
+#define USB_FIFO(ep) (*(volatile uint32_t *)(uintptr_t)(USB_OTG_FS_PERIPH_BASE + \
+                        USB_OTG_FIFO_BASE + (ep)*USB_OTG_FIFO_SIZE))
+#define USB_PCGCCTL (*(volatile uint32_t *)(USB_OTG_FS_PERIPH_BASE + USB_OTG_PCGCCTL_BASE))
+
+// Field values
+#define TSIZ_PKTCNT_1   (1u << 19)
+#define TSIZ_STUPCNT_3  (3u << 29)
+#define EPTYP_BULK      (2u << 18)
+#define EPTYP_INTR      (3u << 18)
+#define TXFNUM(n)       ((uint32_t)(n) << 22)
+#define DSPD_FS_PHY     (3u)
+#define TRDT_AHB_32MHZ  (6u << 10)      // turnaround for HCLK >= 32MHz
+#define FLUSH_ALL_TX    (0x10u << 6)
+
+// 96-bit unique device id, the serial number
+#define UID_ADDR        (0x1FFF7A10)
+
+// Received packet status (GRXSTSP PKTSTS)
+#define PKTSTS_OUT_DATA   (2)
+#define PKTSTS_SETUP_DATA (6)
+
+// Endpoints
+#define EP_DATA         (1)             // bulk IN and OUT
+#define EP_NOTIFY       (2)             // interrupt IN, never sent on
+#define EP0_SIZE        (64)
+#define DATA_SIZE       (64)
+#define NOTIFY_SIZE     (8)
+
+// FIFO RAM (320 words): rx, then tx per IN endpoint, in words
+#define RX_FIFO_WORDS   (128)
+#define TX0_FIFO_WORDS  (16)
+#define TX1_FIFO_WORDS  (128)
+#define TX2_FIFO_WORDS  (16)
+
+// Largest IN transfer loaded at once: the whole EP1 FIFO
+#define TX_BURST        (TX1_FIFO_WORDS * 4)
+
+#define TX_MASK (USB_CDC_TX_BUFLEN-1)
+#define RX_MASK (USB_CDC_RX_BUFLEN-1)
+
+// Standard and CDC requests
+#define REQ_GET_STATUS              (0x00)
+#define REQ_CLEAR_FEATURE           (0x01)
+#define REQ_SET_ADDRESS             (0x05)
+#define REQ_GET_DESCRIPTOR          (0x06)
+#define REQ_GET_CONFIGURATION       (0x08)
+#define REQ_SET_CONFIGURATION       (0x09)
+#define REQ_SET_LINE_CODING         (0x20)
+#define REQ_GET_LINE_CODING         (0x21)
+#define REQ_SET_CONTROL_LINE_STATE  (0x22)
+#define REQ_SEND_BREAK              (0x23)
+
+#define REQ_TYPE_MASK   (0x60)
+#define REQ_TYPE_STD    (0x00)
+#define REQ_TYPE_CLASS  (0x20)
+
+#define DESC_DEVICE     (1)
+#define DESC_CONFIG     (2)
+#define DESC_STRING     (3)
+
+#define LINE_DTR        (0x01)
+
+// ------------------------------------------------------------------------
+// Private types
+
+typedef enum {
+    EP0_IDLE,
+    EP0_DATA_IN,                // then status OUT
+    EP0_DATA_OUT,               // then status IN
+    EP0_STATUS_IN,
+    EP0_STATUS_OUT,
+} Ep0Stage_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void coreInit(void);
+static void busResetIsr(void);
+static void rxFifoIsr(void);
+static void outEpIsr(void);
+static void inEpIsr(void);
+static void setupIsr(void);
+static bool stdRequest(void);
+static bool classRequest(void);
+static void ep0Send(const uint8_t *p, unsigned len);
+static void ep0InPacket(void);
+static void ep0OutArm(void);
+static void ep0Stall(void);
+static void configure(uint8_t config);
+static void rxArm(void);
+static void txStart(void);
+static void fifoWrite(unsigned ep, const uint8_t *p, unsigned len);
+static unsigned stringDesc(uint8_t index, uint8_t *desc);
+static void usbCmd(int argc, char *argv[]);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static const uint8_t deviceDesc[18] = {
+    18, DESC_DEVICE, 0x00, 0x02,        // USB 2.0
+    0x02, 0x00, 0x00, EP0_SIZE,         // CDC device class
+    USB_CDC_VID & 0xFF, USB_CDC_VID >> 8,
+    USB_CDC_PID & 0xFF, USB_CDC_PID >> 8,
+    0x00, 0x02,                         // release 2.00
+    1, 2, 3,                            // manufacturer, product, serial strings
+    1,                                  // configurations
+};
+
+static const uint8_t configDesc[67] = {
+    9, DESC_CONFIG, sizeof(configDesc), 0, 2, 1, 0, 0x80, 50,   // 2 interfaces, 100mA
+    // Communication interface, one notification endpoint
+    9, 4, 0, 0, 1, 0x02, 0x02, 0x01, 0,
+    5, 0x24, 0x00, 0x10, 0x01,          // header, CDC 1.10
+    5, 0x24, 0x01, 0x00, 1,             // call management: none, data on 1
+    4, 0x24, 0x02, 0x02,                // ACM: line coding and state
+    5, 0x24, 0x06, 0, 1,                // union: control 0, data 1
+    7, 5, 0x80 | EP_NOTIFY, 0x03, NOTIFY_SIZE, 0, 16,
+    // Data interface
+    9, 4, 1, 0, 2, 0x0A, 0x00, 0x00, 0,
+    7, 5, EP_DATA, 0x02, DATA_SIZE, 0, 0,
+    7, 5, 0x80 | EP_DATA, 0x02, DATA_SIZE, 0, 0,
+};
+
+static const char * const strings[] = {
+    [1] = "Hillcrest Laboratories",
+    [2] = "SH-2 Sensor Hub Demo",
+};
+
+// Default 115200 8N1, kept only to hand back to the host
+static uint8_t lineCoding[7] = { 0x00, 0xC2, 0x01, 0x00, 0, 0, 8 };
+
+// Control endpoint, touched only by the interrupt
+static uint8_t setup[8];
+static uint8_t ep0Buf[64];
+static Ep0Stage_t ep0Stage;
+static const uint8_t *ep0TxPtr;
+static unsigned ep0TxLeft;
+static bool ep0TxZlp;
+static bool ep0LineCoding;          // SET_LINE_CODING data is in ep0Buf
+
+static bool started;
+static volatile uint8_t config;
+static volatile bool dtr;
+static volatile bool suspended;
+
+// Transmit ring.  Writers fill from txHead under txMutex, the interrupt
+// empties from txTail into the FIFO.  Both run freely.  The slack past
+// the end lets a reservation run over the wrap; usbCdc_commit() moves
+// the part past the end to the start.
+static uint8_t txBuf[USB_CDC_TX_BUFLEN + USB_CDC_RESERVE_MAX];
+static volatile uint32_t txHead;
+static volatile uint32_t txTail;
+static volatile bool txBusy;        // an EP1 IN transfer is loaded
+static bool txZlp;                  // it ends on a full packet
+static volatile bool txWaiting;
+static SemaphoreHandle_t txMutex;
+static SemaphoreHandle_t txSpaceSem;
+
+// Receive ring, filled by the interrupt from rxIn
+static uint8_t rxBuf[USB_CDC_RX_BUFLEN];
+static volatile uint32_t rxIn;
+static uint32_t rxOut;
+static volatile bool rxNak;         // EP1 OUT left unarmed for lack of room
+
+static uint32_t txBytes;
+static uint32_t rxBytes;
+static uint32_t txDrops;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void usbCdc_init(void)
+{
+    if (!clock_usingHse()) {
+        printf("USB off: needs HSE for 48MHz.\n");
+        return;
+    }
+
+    txMutex = xSemaphoreCreateMutex();
+    txSpaceSem = xSemaphoreCreateBinary();
+
+    sysstats_addMemory("usb buffers", sizeof(txBuf) + sizeof(rxBuf));
+    sysstats_addCounter("usb tx drops", &txDrops);
+    shell_addCommand("usb", "USB virtual COM port state", usbCmd);
+
+    coreInit();
+    started = true;
+}
+
+bool usbCdc_active(void)
+{
+    return started && (config != 0) && dtr && !suspended;
+}
+
+bool usbCdc_busy(void)
+{
+    return started && !suspended;
+}
+
+size_t usbCdc_write(const uint8_t *buf, size_t len, bool expandLf)
+{
+    size_t n = 0;
+
+    if (xSemaphoreTake(txMutex, pdMS_TO_TICKS(USB_CDC_TX_TIMEOUT_MS)) != pdTRUE) {
+        txDrops++;
+        return 0;
+    }
+
+    while ((n < len) && usbCdc_active()) {
+        uint32_t head = txHead;
+        uint32_t room = USB_CDC_TX_BUFLEN - (head - txTail);
+
+        // Leave room for a CR-LF pair, whichever comes next
+        while ((n < len) && (room >= 2)) {
+            if (expandLf && (buf[n] == '\n')) {
+                txBuf[head++ & TX_MASK] = '\r';
+                room--;
+            }
+            txBuf[head++ & TX_MASK] = buf[n++];
+            room--;
+        }
+
+        // USB interrupt is below the syscall priority, so this masks it
+        taskENTER_CRITICAL();
+        txBytes += head - txHead;
+        txHead = head;
+        txStart();
+        txWaiting = (n < len);
+        taskEXIT_CRITICAL();
+
+        if ((n < len) &&
+            (xSemaphoreTake(txSpaceSem, pdMS_TO_TICKS(USB_CDC_TX_TIMEOUT_MS)) != pdTRUE)) {
+            // Host not reading
+            txDrops++;
+            break;
+        }
+    }
+
+    xSemaphoreGive(txMutex);
+
+    return n;
+}
+
+uint8_t *usbCdc_reserve(size_t len)
+{
+    if (!usbCdc_active() || (len > USB_CDC_RESERVE_MAX)) {
+        return NULL;
+    }
+
+    if (xSemaphoreTake(txMutex, pdMS_TO_TICKS(USB_CDC_TX_TIMEOUT_MS)) != pdTRUE) {
+        txDrops++;
+        return NULL;
+    }
+
+    if (USB_CDC_TX_BUFLEN - (txHead - txTail) < len) {
+        xSemaphoreGive(txMutex);
+        txDrops++;
+        return NULL;
+    }
+
+    return &txBuf[txHead & TX_MASK];
+}
+
+void usbCdc_commit(size_t len)
+{
+    uint32_t pos = txHead & TX_MASK;
+
+    if (pos + len > USB_CDC_TX_BUFLEN) {
+        memcpy(txBuf, &txBuf[USB_CDC_TX_BUFLEN], pos + len - USB_CDC_TX_BUFLEN);
+    }
+
+    taskENTER_CRITICAL();
+    txBytes += len;
+    txHead += len;
+    txStart();
+    taskEXIT_CRITICAL();
+
+    xSemaphoreGive(txMutex);
+}
+
+size_t usbCdc_rxAvailable(void)
+{
+    return rxIn - rxOut;
+}
+
+size_t usbCdc_read(uint8_t *buf, size_t len, bool toEol)
+{
+    size_t n = 0;
+    uint32_t in = rxIn;
+
+    while ((n < len) && (rxOut != in)) {
+        uint8_t c = rxBuf[rxOut & RX_MASK];
+        rxOut++;
+        buf[n++] = c;
+        if (toEol && ((c == '\r') || (c == '\n'))) {
+            break;
+        }
+    }
+
+    // Take the next packet once there is room for it
+    taskENTER_CRITICAL();
+    if (rxNak && (USB_CDC_RX_BUFLEN - (rxIn - rxOut) >= DATA_SIZE)) {
+        rxNak = false;
+        rxArm();
+    }
+    taskEXIT_CRITICAL();
+
+    return n;
+}
+
+void usbCdc_irq(void)
+{
+    uint32_t sts = USBx->GINTSTS & USBx->GINTMSK;
+
+    if (sts & USB_OTG_GINTSTS_USBRST) {
+        USBx->GINTSTS = USB_OTG_GINTSTS_USBRST;
+        busResetIsr();
+    }
+
+    if (sts & USB_OTG_GINTSTS_ENUMDNE) {
+        USBx->GINTSTS = USB_OTG_GINTSTS_ENUMDNE;
+        // Full speed: EP0 max packet 64 (MPSIZ 0)
+        USB_IN(0)->DIEPCTL &= ~USB_OTG_DIEPCTL_MPSIZ;
+        USB_DEV->DCTL |= USB_OTG_DCTL_CGINAK;
+    }
+
+    if (sts & USB_OTG_GINTSTS_RXFLVL) {
+        rxFifoIsr();
+    }
+
+    if (sts & USB_OTG_GINTSTS_OEPINT) {
+        outEpIsr();
+    }
+
+    if (sts & USB_OTG_GINTSTS_IEPINT) {
+        inEpIsr();
+    }
+
+    if (sts & USB_OTG_GINTSTS_USBSUSP) {
+        // Also what unplugging looks like, without VBUS sensing
+        USBx->GINTSTS = USB_OTG_GINTSTS_USBSUSP;
+        suspended = true;
+    }
+
+    if (sts & USB_OTG_GINTSTS_WKUINT) {
+        USBx->GINTSTS = USB_OTG_GINTSTS_WKUINT;
+        suspended = false;
+    }
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static void coreInit(void)
+{
+    GPIO_InitTypeDef GPIO_InitStruct;
+
+    // PA11 DM, PA12 DP
+    __GPIOA_CLK_ENABLE();
+    GPIO_InitStruct.Pin = GPIO_PIN_11 | GPIO_PIN_12;
+    GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+    GPIO_InitStruct.Pull = GPIO_NOPULL;
+    GPIO_InitStruct.Speed = GPIO_SPEED_HIGH;
+    GPIO_InitStruct.Alternate = GPIO_AF10_OTG_FS;
+    HAL_GPIO_Init(GPIOA, &GPIO_InitStruct);
+
+    __USB_OTG_FS_CLK_ENABLE();
+
+    // Embedded PHY, core reset
+    USBx->GAHBCFG &= ~USB_OTG_GAHBCFG_GINT;
+    USBx->GUSBCFG |= USB_OTG_GUSBCFG_PHYSEL;
+    while ((USBx->GRSTCTL & USB_OTG_GRSTCTL_AHBIDL) == 0) {
+    }
+    USBx->GRSTCTL |= USB_OTG_GRSTCTL_CSRST;
+    while (USBx->GRSTCTL & USB_OTG_GRSTCTL_CSRST) {
+    }
+
+    // PHY on; the board doesn't route VBUS to PA9 (SPI_NOR_CS)
+    USBx->GCCFG = USB_OTG_GCCFG_PWRDWN | USB_OTG_GCCFG_NOVBUSSENS;
+
+    // Device mode takes 25ms to force.  (No HAL_Delay(): the tick is
+    // masked until the scheduler starts.)
+    USBx->GUSBCFG = (USBx->GUSBCFG & ~USB_OTG_GUSBCFG_TRDT) |
+                    USB_OTG_GUSBCFG_FDMOD | TRDT_AHB_32MHZ;
+    timebase_delayUs(25000);
+
+    USB_PCGCCTL = 0;
+    USB_DEV->DCTL |= USB_OTG_DCTL_SDIS;
+    USB_DEV->DCFG |= DSPD_FS_PHY;
+
+    USBx->GRXFSIZ = RX_FIFO_WORDS;
+    USBx->DIEPTXF0_HNPTXFSIZ = (TX0_FIFO_WORDS << 16) | RX_FIFO_WORDS;
+    USBx->DIEPTXF[EP_DATA-1] = (TX1_FIFO_WORDS << 16) | (RX_FIFO_WORDS + TX0_FIFO_WORDS);
+    USBx->DIEPTXF[EP_NOTIFY-1] = (TX2_FIFO_WORDS << 16) |
+                                 (RX_FIFO_WORDS + TX0_FIFO_WORDS + TX1_FIFO_WORDS);
+
+    USB_DEV->DIEPMSK = 0;
+    USB_DEV->DOEPMSK = 0;
+    USB_DEV->DAINTMSK = 0;
+    USBx->GINTSTS = 0xFFFFFFFF;
+    USBx->GINTMSK = USB_OTG_GINTMSK_USBRST | USB_OTG_GINTMSK_ENUMDNEM |
+                    USB_OTG_GINTMSK_RXFLVLM | USB_OTG_GINTMSK_IEPINT |
+                    USB_OTG_GINTMSK_OEPINT | USB_OTG_GINTMSK_USBSUSPM |
+                    USB_OTG_GINTMSK_WUIM;
+    USBx->GAHBCFG |= USB_OTG_GAHBCFG_GINT;
+
+    HAL_NVIC_SetPriority(OTG_FS_IRQn, PRIO_IRQ_USB, 0);
+    HAL_NVIC_EnableIRQ(OTG_FS_IRQn);
+
+    // Connect
+    USB_DEV->DCTL &= ~USB_OTG_DCTL_SDIS;
+}
+
+static void busResetIsr(void)
+{
+    USB_DEV->DCTL &= ~USB_OTG_DCTL_RWUSIG;
+
+    USBx->GRSTCTL = USB_OTG_GRSTCTL_TXFFLSH | FLUSH_ALL_TX;
+    while (USBx->GRSTCTL & USB_OTG_GRSTCTL_TXFFLSH) {
+    }
+    USBx->GRSTCTL = USB_OTG_GRSTCTL_RXFFLSH;
+    while (USBx->GRSTCTL & USB_OTG_GRSTCTL_RXFFLSH) {
+    }
+
+    for (unsigned ep = 1; ep <= EP_NOTIFY; ep++) {
+        USB_IN(ep)->DIEPCTL = USB_OTG_DIEPCTL_SNAK;
+        USB_OUT(ep)->DOEPCTL = USB_OTG_DOEPCTL_SNAK;
+    }
+    for (unsigned ep = 0; ep <= EP_NOTIFY; ep++) {
+        USB_IN(ep)->DIEPINT = 0xFF;
+        USB_OUT(ep)->DOEPINT = 0xFF;
+    }
+
+    USB_DEV->DAINTMSK = (1u << 0) | (1u << 16);
+    USB_DEV->DIEPMSK = USB_OTG_DIEPINT_XFRC;
+    USB_DEV->DOEPMSK = USB_OTG_DOEPINT_XFRC | USB_OTG_DOEPINT_STUP;
+    USB_DEV->DCFG &= ~USB_OTG_DCFG_DAD;
+
+    config = 0;
+    dtr = false;
+    suspended = false;
+    ep0Stage = EP0_IDLE;
+    txBusy = false;
+    txTail = txHead;
+    rxNak = false;
+
+    USB_OUT(0)->DOEPTSIZ = TSIZ_STUPCNT_3 | TSIZ_PKTCNT_1 | 3*8;
+}
+
+// Pop one entry of the shared receive FIFO
+static void rxFifoIsr(void)
+{
+    uint32_t st = USBx->GRXSTSP;
+    unsigned ep = st & USB_OTG_GRXSTSP_EPNUM;
+    unsigned len = (st & USB_OTG_GRXSTSP_BCNT) >> 4;
+    unsigned pktsts = (st & USB_OTG_GRXSTSP_PKTSTS) >> 17;
+
+    if (pktsts == PKTSTS_SETUP_DATA) {
+        uint32_t w0 = USB_FIFO(0);
+        uint32_t w1 = USB_FIFO(0);
+        memcpy(&setup[0], &w0, 4);
+        memcpy(&setup[4], &w1, 4);
+    }
+    else if (pktsts == PKTSTS_OUT_DATA) {
+        for (unsigned n = 0; n < len; n += 4) {
+            uint32_t w = USB_FIFO(0);
+            for (unsigned b = 0; (b < 4) && (n + b < len); b++) {
+                if (ep == 0) {
+                    if (n + b < sizeof(ep0Buf)) {
+                        ep0Buf[n + b] = w >> (8*b);
+                    }
+                }
+                else {
+                    // Armed only with room for a whole packet
+                    rxBuf[rxIn & RX_MASK] = w >> (8*b);
+                    rxIn++;
+                }
+            }
+        }
+        if ((ep == EP_DATA) && (len != 0)) {
+            rxBytes += len;
+            console_rxWakeIsr();
+        }
+    }
+}
+
+static void outEpIsr(void)
+{
+    uint32_t daint = USB_DEV->DAINT & USB_DEV->DAINTMSK;
+
+    if (daint & (1u << 16)) {
+        uint32_t epint = USB_OUT(0)->DOEPINT & USB_DEV->DOEPMSK;
+        USB_OUT(0)->DOEPINT = epint;
+
+        if (epint & USB_OTG_DOEPINT_XFRC) {
+            if (ep0Stage == EP0_DATA_OUT) {
+                if (ep0LineCoding) {
+                    memcpy(lineCoding, ep0Buf, sizeof(lineCoding));
+                }
+                ep0Send(NULL, 0);
+            }
+            else if (ep0Stage == EP0_STATUS_OUT) {
+                ep0Stage = EP0_IDLE;
+            }
+        }
+        if (epint & USB_OTG_DOEPINT_STUP) {
+            setupIsr();
+        }
+    }
+
+    if (daint & (1u << (16 + EP_DATA))) {
+        uint32_t epint = USB_OUT(EP_DATA)->DOEPINT & USB_DEV->DOEPMSK;
+        USB_OUT(EP_DATA)->DOEPINT = epint;
+
+        if (epint & USB_OTG_DOEPINT_XFRC) {
+            if (USB_CDC_RX_BUFLEN - (rxIn - rxOut) >= DATA_SIZE) {
+                rxArm();
+            }
+            else {
+                // NAK the host until the reader catches up
+                rxNak = true;
+            }
+        }
+    }
+}
+
+static void inEpIsr(void)
+{
+    uint32_t daint = USB_DEV->DAINT & USB_DEV->DAINTMSK;
+
+    if (daint & (1u << 0)) {
+        uint32_t epint = USB_IN(0)->DIEPINT & USB_DEV->DIEPMSK;
+        USB_IN(0)->DIEPINT = epint;
+
+        if (epint & USB_OTG_DIEPINT_XFRC) {
+            if ((ep0TxLeft != 0) || ep0TxZlp) {
+                ep0TxZlp = false;
+                ep0InPacket();
+            }
+            else if (ep0Stage == EP0_DATA_IN) {
+                ep0Stage = EP0_STATUS_OUT;
+                ep0OutArm();
+            }
+            else {
+                ep0Stage = EP0_IDLE;
+            }
+        }
+    }
+
+    if (daint & (1u << EP_DATA)) {
+        uint32_t epint = USB_IN(EP_DATA)->DIEPINT & USB_DEV->DIEPMSK;
+        USB_IN(EP_DATA)->DIEPINT = epint;
+
+        if (epint & USB_OTG_DIEPINT_XFRC) {
+            BaseType_t woken = pdFALSE;
+
+            txBusy = false;
+            txStart();
+            if (txWaiting) {
+                txWaiting = false;
+                xSemaphoreGiveFromISR(txSpaceSem, &woken);
+            }
+            portYIELD_FROM_ISR(woken);
+        }
+    }
+}
+
+static void setupIsr(void)
+{
+    bool ok;
+
+    // Ready for the next SETUP, whatever this one does
+    USB_OUT(0)->DOEPTSIZ = TSIZ_STUPCNT_3 | TSIZ_PKTCNT_1 | 3*8;
+
+    ep0TxLeft = 0;
+    ep0TxZlp = false;
+    ep0LineCoding = false;
+
+    switch (setup[0] & REQ_TYPE_MASK) {
+        case REQ_TYPE_STD:
+            ok = stdRequest();
+            break;
+        case REQ_TYPE_CLASS:
+            ok = classRequest();
+            break;
+        default:
+            ok = false;
+            break;
+    }
+
+    if (!ok) {
+        ep0Stall();
+    }
+}
+
+static bool stdRequest(void)
+{
+    uint16_t value = setup[2] | (setup[3] << 8);
+    const uint8_t *desc = 0;
+    unsigned len = 0;
+
+    switch (setup[1]) {
+        case REQ_GET_DESCRIPTOR:
+            if (setup[3] == DESC_DEVICE) {
+                desc = deviceDesc;
+                len = sizeof(deviceDesc);
+            }
+            else if (setup[3] == DESC_CONFIG) {
+                desc = configDesc;
+                len = sizeof(configDesc);
+            }
+            else if (setup[3] == DESC_STRING) {
+                len = stringDesc(setup[2], ep0Buf);
+                desc = ep0Buf;
+            }
+            if (len == 0) {
+                return false;
+            }
+            ep0Send(desc, len);
+            return true;
+
+        case REQ_SET_ADDRESS:
+            // The core wants the address before the status stage
+            USB_DEV->DCFG = (USB_DEV->DCFG & ~USB_OTG_DCFG_DAD) | ((value & 0x7F) << 4);
+            ep0Send(NULL, 0);
+            return true;
+
+        case REQ_SET_CONFIGURATION:
+            if (value > 1) {
+                return false;
+            }
+            configure(value);
+            ep0Send(NULL, 0);
+            return true;
+
+        case REQ_GET_CONFIGURATION:
+            ep0Buf[0] = config;
+            ep0Send(ep0Buf, 1);
+            return true;
+
+        case REQ_GET_STATUS:
+            ep0Buf[0] = 0;                  // bus powered, no remote wakeup
+            ep0Buf[1] = 0;
+            ep0Send(ep0Buf, 2);
+            return true;
+
+        case REQ_CLEAR_FEATURE:
+            // ENDPOINT_HALT: restart the data toggles
+            if ((setup[0] & 0x1F) == 2) {
+                if (setup[4] == (0x80 | EP_DATA)) {
+                    USB_IN(EP_DATA)->DIEPCTL |= USB_OTG_DIEPCTL_SD0PID_SEVNFRM;
+                }
+                else if (setup[4] == EP_DATA) {
+                    USB_OUT(EP_DATA)->DOEPCTL |= USB_OTG_DOEPCTL_SD0PID_SEVNFRM;
+                }
+            }
+            ep0Send(NULL, 0);
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+static bool classRequest(void)
+{
+    switch (setup[1]) {
+        case REQ_SET_LINE_CODING:
+            ep0LineCoding = true;
+            ep0Stage = EP0_DATA_OUT;
+            ep0OutArm();
+            return true;
+
+        case REQ_GET_LINE_CODING:
+            ep0Send(lineCoding, sizeof(lineCoding));
+            return true;
+
+        case REQ_SET_CONTROL_LINE_STATE:
+            // Terminals raise DTR on open and drop it on close
+            dtr = (setup[2] & LINE_DTR) != 0;
+            ep0Send(NULL, 0);
+            return true;
+
+        case REQ_SEND_BREAK:
+            ep0Send(NULL, 0);
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+// Start the data stage (or, with len 0, the status stage) of a control
+// read, cut to the host's wLength.
+static void ep0Send(const uint8_t *p, unsigned len)
+{
+    unsigned wLength = setup[6] | (setup[7] << 8);
+
+    if (len > wLength) {
+        len = wLength;
+    }
+
+    ep0Stage = (p != NULL) ? EP0_DATA_IN : EP0_STATUS_IN;
+    ep0TxPtr = p;
+    ep0TxLeft = len;
+
+    // A short reply ending on a full packet needs a zero-length one
+    ep0TxZlp = (p != NULL) && (len < wLength) && ((len % EP0_SIZE) == 0);
+
+    ep0InPacket();
+}
+
+static void ep0InPacket(void)
+{
+    unsigned n = (ep0TxLeft < EP0_SIZE) ? ep0TxLeft : EP0_SIZE;
+
+    USB_IN(0)->DIEPTSIZ = TSIZ_PKTCNT_1 | n;
+    USB_IN(0)->DIEPCTL |= USB_OTG_DIEPCTL_CNAK | USB_OTG_DIEPCTL_EPENA;
+    fifoWrite(0, ep0TxPtr, n);
+    ep0TxPtr += n;
+    ep0TxLeft -= n;
+}
+
+static void ep0OutArm(void)
+{
+    USB_OUT(0)->DOEPTSIZ = TSIZ_STUPCNT_3 | TSIZ_PKTCNT_1 | EP0_SIZE;
+    USB_OUT(0)->DOEPCTL |= USB_OTG_DOEPCTL_CNAK | USB_OTG_DOEPCTL_EPENA;
+}
+
+// Refuse the request; the core clears the stalls on the next SETUP.
+static void ep0Stall(void)
+{
+    ep0Stage = EP0_IDLE;
+    USB_IN(0)->DIEPCTL |= USB_OTG_DIEPCTL_STALL;
+    USB_OUT(0)->DOEPCTL |= USB_OTG_DOEPCTL_STALL;
+}
+
+static void configure(uint8_t value)
+{
+    config = value;
+    dtr = false;
+
+    if (value == 0) {
+        USB_IN(EP_DATA)->DIEPCTL = USB_OTG_DIEPCTL_SNAK;
+        USB_OUT(EP_DATA)->DOEPCTL = USB_OTG_DOEPCTL_SNAK;
+        USB_IN(EP_NOTIFY)->DIEPCTL = USB_OTG_DIEPCTL_SNAK;
+        USB_DEV->DAINTMSK = (1u << 0) | (1u << 16);
+        txBusy = false;
+        return;
+    }
+
+    USB_IN(EP_DATA)->DIEPCTL = DATA_SIZE | EPTYP_BULK | TXFNUM(EP_DATA) |
+                               USB_OTG_DIEPCTL_SD0PID_SEVNFRM | USB_OTG_DIEPCTL_USBAEP;
+    USB_OUT(EP_DATA)->DOEPCTL = DATA_SIZE | EPTYP_BULK |
+                                USB_OTG_DOEPCTL_SD0PID_SEVNFRM | USB_OTG_DOEPCTL_USBAEP;
+    USB_IN(EP_NOTIFY)->DIEPCTL = NOTIFY_SIZE | EPTYP_INTR | TXFNUM(EP_NOTIFY) |
+                                 USB_OTG_DIEPCTL_SD0PID_SEVNFRM | USB_OTG_DIEPCTL_USBAEP;
+    USB_DEV->DAINTMSK = (1u << 0) | (1u << EP_DATA) | (1u << 16) | (1u << (16 + EP_DATA));
+
+    rxArm();
+    txBusy = false;
+    txStart();
+}
+
+static void rxArm(void)
+{
+    USB_OUT(EP_DATA)->DOEPTSIZ = TSIZ_PKTCNT_1 | DATA_SIZE;
+    USB_OUT(EP_DATA)->DOEPCTL |= USB_OTG_DOEPCTL_CNAK | USB_OTG_DOEPCTL_EPENA;
+}
+
+// Load the next IN transfer from the ring, or the zero-length packet that
+// ends a burst on a full packet.  With the interrupt masked or from it.
+static void txStart(void)
+{
+    if (txBusy || (config == 0)) {
+        return;
+    }
+
+    uint32_t tail = txTail;
+    uint32_t n = txHead - tail;
+    uint32_t toEnd = USB_CDC_TX_BUFLEN - (tail & TX_MASK);
+
+    if (n == 0) {
+        if (!txZlp) {
+            return;
+        }
+        txZlp = false;
+        USB_IN(EP_DATA)->DIEPTSIZ = TSIZ_PKTCNT_1;
+        USB_IN(EP_DATA)->DIEPCTL |= USB_OTG_DIEPCTL_CNAK | USB_OTG_DIEPCTL_EPENA;
+        txBusy = true;
+        return;
+    }
+
+    // Stop at the end of the ring: the FIFO takes whole words, and a short
+    // packet there costs nothing on the host side.
+    if (n > TX_BURST) n = TX_BURST;
+    if (n > toEnd) n = toEnd;
+
+    USB_IN(EP_DATA)->DIEPTSIZ = (((n + DATA_SIZE - 1) / DATA_SIZE) << 19) | n;
+    USB_IN(EP_DATA)->DIEPCTL |= USB_OTG_DIEPCTL_CNAK | USB_OTG_DIEPCTL_EPENA;
+    fifoWrite(EP_DATA, &txBuf[tail & TX_MASK], n);
+
+    // In the FIFO now, so the ring space is free
+    txTail = tail + n;
+    txZlp = (n % DATA_SIZE) == 0;
+    txBusy = true;
+}
+
+// The FIFO takes whole words; the core only sends len bytes of them.
+static void fifoWrite(unsigned ep, const uint8_t *p, unsigned len)
+{
+    unsigned n = 0;
+    uint32_t w;
+
+    // Unaligned word reads are fine on the M4
+    for (; n + 4 <= len; n += 4) {
+        memcpy(&w, p + n, 4);
+        USB_FIFO(ep) = w;
+    }
+    if (n < len) {
+        w = 0;
+        memcpy(&w, p + n, len - n);
+        USB_FIFO(ep) = w;
+    }
+}
+
+// String descriptor index into desc, returns its length (0: none)
+static unsigned stringDesc(uint8_t index, uint8_t *desc)
+{
+    char serial[25];
+    const char *s;
+    unsigned len;
+
+    if (index == 0) {
+        // English (US)
+        desc[0] = 4;
+        desc[1] = DESC_STRING;
+        desc[2] = 0x09;
+        desc[3] = 0x04;
+        return 4;
+    }
+
+    if (index == 3) {
+        // From the unique device id
+        const uint32_t *uid = (const uint32_t *)UID_ADDR;
+        snprintf(serial, sizeof(serial), "%08X%08X%08X",
+                 (unsigned)uid[0], (unsigned)uid[1], (unsigned)uid[2]);
+        s = serial;
+    }
+    else if ((index < sizeof(strings)/sizeof(strings[0])) && (strings[index] != 0)) {
+        s = strings[index];
+    }
+    else {
+        return 0;
+    }
+
+    len = 2;
+    while ((*s != 0) && (len + 2 <= sizeof(ep0Buf))) {
+        desc[len++] = *s++;
+        desc[len++] = 0;
+    }
+    desc[0] = len;
+    desc[1] = DESC_STRING;
+
+    return len;
+}
+
+// Shell command: show the USB state.
+static void usbCmd(int argc, char *argv[])
+{
+    uint32_t baud = lineCoding[0] | (lineCoding[1] << 8) |
+                    (lineCoding[2] << 16) | ((uint32_t)lineCoding[3] << 24);
+
+    printf("USB: %s, %s%s (host set %u baud)\n",
+           config ? "configured" : "not configured",
+           dtr ? "port open" : "port closed",
+           suspended ? ", suspended" : "", (unsigned)baud);
+    printf("  tx %u bytes, rx %u bytes, %u tx drops\n",
+           (unsigned)txBytes, (unsigned)rxBytes, (unsigned)txDrops);
+}
+
+#endif
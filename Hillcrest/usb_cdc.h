@@ -0,0 +1,113 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * USB CDC-ACM (virtual COM port) device on the OTG_FS core (PA11/PA12).
+ *
+ * Full speed, register level: the HAL in this tree has no PCD driver.
+ * Once a host opens the port (sets DTR) the console and the binary
+ * sensor stream go over USB instead of USART2, and back when it closes.
+ * The line coding the host sets is accepted and ignored.
+ *
+ * Transmit is a byte ring that the EP1 IN interrupt empties 64 bytes
+ * (one packet) at a time straight into the endpoint FIFO.  Writers can
+ * reserve room in the ring and build data in place (usbCdc_reserve() /
+ * usbCdc_commit()), so a sensor frame is copied once, ring to FIFO; the
+ * OTG_FS core has no DMA.  Receive is NAK flow controlled: EP1 OUT is
+ * only armed while the rx ring has room for a whole packet.
+ */
+
+#ifndef USB_CDC_H
+#define USB_CDC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Build in the USB console.  Needs 48MHz from the PLL (see clock.h).
+#ifndef USB_CDC
+#define USB_CDC (1)
+#endif
+
+// Transmit ring size (power of 2).  At full speed a bulk endpoint moves
+// up to 19 packets per frame, so this covers a few ms of host latency.
+#ifndef USB_CDC_TX_BUFLEN
+#define USB_CDC_TX_BUFLEN (2048)
+#endif
+
+// Receive ring size (power of 2, at least two packets)
+#ifndef USB_CDC_RX_BUFLEN
+#define USB_CDC_RX_BUFLEN (256)
+#endif
+
+// Longest block usbCdc_reserve() hands out (covers BIN_FRAME_MAX)
+#define USB_CDC_RESERVE_MAX (96)
+
+// How long a writer waits for ring space before dropping its data [ms].
+// A host that keeps the port open without reading stalls the writers
+// this long per write, not forever.
+#ifndef USB_CDC_TX_TIMEOUT_MS
+#define USB_CDC_TX_TIMEOUT_MS (50)
+#endif
+
+// USB device identity.  The default is ST's virtual COM port, which
+// hosts bind to their CDC-ACM driver without an .inf.
+#ifndef USB_CDC_VID
+#define USB_CDC_VID (0x0483)
+#endif
+#ifndef USB_CDC_PID
+#define USB_CDC_PID (0x5740)
+#endif
+
+// Bring up the OTG_FS core and connect to the bus.  Call after the
+// console and before the scheduler starts.  Does nothing without HSE.
+void usbCdc_init(void);
+
+// True while a host has the port open: the console and sensor output
+// then go here.
+bool usbCdc_active(void);
+
+// True while the core is on a bus that isn't suspended: the MCU must
+// not STOP then, or it drops off the bus (power.h).
+bool usbCdc_busy(void);
+
+// Queue len bytes for the host, optionally expanding LF to CR-LF.
+// Blocks while the ring is full, up to USB_CDC_TX_TIMEOUT_MS, and
+// returns how many bytes of buf were queued.
+size_t usbCdc_write(const uint8_t *buf, size_t len, bool expandLf);
+
+// Reserve len (<= USB_CDC_RESERVE_MAX) contiguous bytes of the transmit
+// ring to build data in place, without waiting.  Returns NULL (writers
+// count it as a drop) if the port is closed or the ring has no room.
+// Every reservation that succeeds must be followed by usbCdc_commit()
+// from the same task.
+uint8_t *usbCdc_reserve(size_t len);
+
+// Send the first len bytes of the last reservation.
+void usbCdc_commit(size_t len);
+
+// Bytes received and not yet read
+size_t usbCdc_rxAvailable(void);
+
+// Copy up to len received bytes into buf without blocking.  With toEol,
+// stops after the first CR or LF.  Returns the number copied.
+size_t usbCdc_read(uint8_t *buf, size_t len, bool toEol);
+
+// Call from OTG_FS_IRQHandler.
+void usbCdc_irq(void);
+
+#endif
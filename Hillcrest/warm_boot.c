@@ -0,0 +1,109 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * State kept over a warm reset of the MCU.
+ */
+
+#include "warm_boot.h"
+
+#include <string.h>
+#include "stm32f4xx.h"
+#include "crc16.h"
+
+#define WARM_BOOT_MAGIC (0x5741524Du)   // "WARM"
+
+// Resets that lose RAM: power-on (also set on brown-out) and brown-out
+#define COLD_RESET_FLAGS (RCC_CSR_PORRSTF | RCC_CSR_BORRSTF)
+
+// ------------------------------------------------------------------------
+// Private types
+
+typedef struct {
+    uint32_t magic;             // WARM_BOOT_MAGIC once saved
+    uint32_t size;              // sizeof(WarmState_t), catches layout changes
+    uint16_t crc;               // CRC-16 of state
+    WarmState_t state;
+} WarmRecord_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static uint16_t stateCrc(void);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+// Survives reset: not zeroed by the startup code
+static __no_init WarmRecord_t record;
+
+static bool warm;
+
+// ------------------------------------------------------------------------
+// Public API
+
+bool warmBoot_init(void)
+{
+    uint32_t csr = RCC->CSR;
+
+    // The flags stick until cleared, so tell the next reset apart
+    RCC->CSR |= RCC_CSR_RMVF;
+
+    warm = WARM_BOOT && !(csr & COLD_RESET_FLAGS) &&
+           (record.magic == WARM_BOOT_MAGIC) && (record.size == sizeof(WarmState_t)) &&
+           (record.crc == stateCrc());
+    if (!warm) {
+        memset(&record.state, 0, sizeof(record.state));
+    }
+
+    // Until saved again, a reset part way through starts cold
+    record.magic = 0;
+
+    return warm;
+}
+
+bool warmBoot_warm(void)
+{
+    return warm;
+}
+
+WarmState_t *warmBoot_state(void)
+{
+    return &record.state;
+}
+
+void warmBoot_save(void)
+{
+#if WARM_BOOT
+    record.size = sizeof(WarmState_t);
+    record.crc = stateCrc();
+    record.magic = WARM_BOOT_MAGIC;
+#endif
+}
+
+void warmBoot_clear(void)
+{
+    record.magic = 0;
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static uint16_t stateCrc(void)
+{
+    return crc16(CRC16_INIT, (const uint8_t *)&record.state, sizeof(record.state));
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * State kept over a warm reset of the MCU.
+ *
+ * A reset that leaves RAM powered (the reset pin, the watchdog, a
+ * software reset) finds WarmState_t as the last boot left it, in a
+ * __no_init region, validated by a magic, its size and a CRC-16.  The
+ * hub is reset along with the MCU, so it still has to be configured,
+ * but what the last boot learnt or was told need not be rediscovered:
+ * the hub's product ids, the I2C speed probed, the sensor metadata, the
+ * subscription table and calibration set from the shell, and the hub
+ * clock skew.  A power-on or brown-out reset, or a DFU changing the hub
+ * firmware, starts cold.
+ *
+ * The demo task fills the state in and calls warmBoot_save(); nothing
+ * else writes it.
+ */
+
+#ifndef WARM_BOOT_H
+#define WARM_BOOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sh2.h"
+#include "sensor_meta.h"
+
+// Build in warm boot: keep state over resets that leave RAM powered
+#ifndef WARM_BOOT
+#define WARM_BOOT (1)
+#endif
+
+// Subscriptions kept
+#ifndef WARM_BOOT_SUBS
+#define WARM_BOOT_SUBS (8)
+#endif
+
+// Longest profile or policy name kept, terminator included
+#define WARM_BOOT_NAME_LEN (16)
+
+// One subscription, as the sensor app holds it
+typedef struct {
+    uint8_t sensorId;           // 0: unused
+    bool wakeup;
+    uint16_t changeSensitivity;
+    uint32_t reportInterval_us;
+    uint32_t batchInterval_us;
+} WarmSub_t;
+
+typedef struct {
+    bool haveProdIds;
+    sh2_ProductIds_t prodIds;
+    uint32_t i2cHz;             // probed I2C speed, 0 if not probed
+    char profile[WARM_BOOT_NAME_LEN];
+    char policy[WARM_BOOT_NAME_LEN];
+    uint8_t calSensors;         // dynamic calibration in effect
+    int32_t skewPpm;            // hub clock skew estimate
+    WarmSub_t sub[WARM_BOOT_SUBS];
+    uint8_t numMeta;
+    uint8_t metaId[SENSOR_META_MAX];
+    SensorMeta_t meta[SENSOR_META_MAX];
+} WarmState_t;
+
+// Check the state kept over the reset, and take the reset cause.  Call
+// once, early at boot.  Returns true if it is valid: a warm boot.
+bool warmBoot_init(void);
+
+// True if this boot started warm
+bool warmBoot_warm(void);
+
+// The state kept: as found at a warm boot, zeroed at a cold one.  Fill
+// it in and save it.
+WarmState_t *warmBoot_state(void);
+
+// Seal the state, for the next boot to find.
+void warmBoot_save(void);
+
+// Start the next boot cold (e.g. the hub firmware changed).
+void warmBoot_clear(void);
+
+#endif
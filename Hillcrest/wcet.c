@@ -0,0 +1,239 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Worst-case timing run.  See wcet.h.
+ */
+
+#include "wcet.h"
+
+#if WCET_RUN
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "sh2.h"
+#include "sensor_app.h"
+#include "latency.h"
+#include "cycle_budget.h"
+#include "console.h"
+#include "perf_suite.h"
+#include "timebase.h"
+#include "sysstats.h"
+#include "shell.h"
+
+#if !LATENCY_TRACE || !CYCLE_BUDGET
+#error The wcet run needs LATENCY_TRACE and CYCLE_BUDGET
+#endif
+
+// Fixed point iterations before the bound is called unbounded, and the
+// largest bound taken seriously [us]
+#define MAX_ITERATIONS (32)
+#define MAX_BOUND_US (1000000)
+
+// Stages whose worst cases make up the bound
+#define NUM_TIMED (4)
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void wcetCmd(int argc, char *argv[]);
+static void stress(uint32_t secs);
+static uint32_t fastestInterval(void);
+static uint32_t worstUs(BudgetStage_t stage);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static const BudgetStage_t timed[NUM_TIMED] = {
+    BUDGET_STAGE_ISR,
+    BUDGET_STAGE_XFER,
+    BUDGET_STAGE_DECODE,
+    BUDGET_STAGE_DISPATCH,
+};
+
+static volatile bool heapFrozen;
+static uint32_t lateAllocs;           // heap allocations after the freeze
+static uint32_t lateBytes;
+
+// ------------------------------------------------------------------------
+// Public API
+
+void wcet_init(void)
+{
+    sysstats_addCounter("heap allocs after boot", &lateAllocs);
+    shell_addCommand("wcet", "[secs] worst case INTN to sensor task bound", wcetCmd);
+}
+
+void wcet_heapFreeze(void)
+{
+    heapFrozen = true;
+}
+
+// Called by pvPortMalloc() with the scheduler suspended
+void wcet_onMalloc(size_t size)
+{
+    if (heapFrozen) {
+        lateAllocs++;
+        lateBytes += size;
+    }
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static void wcetCmd(int argc, char *argv[])
+{
+    uint32_t secs = (argc > 1) ? strtoul(argv[1], 0, 0) : WCET_RUN_SECS;
+    uint32_t limitUs[NUM_TIMED];
+    uint32_t overflows0, overflows, highWater;
+    LatSummary_t handler, consume;
+
+    if ((argc > 2) || (secs == 0)) {
+        printf("usage: %s [secs]\n", argv[0]);
+        return;
+    }
+    uint32_t t_us = fastestInterval();
+    if (t_us == 0) {
+        printf("No sensors subscribed.\n");
+        return;
+    }
+
+    // Every run of a timed stage is an overrun: its worst is its longest
+    for (unsigned n = 0; n < NUM_TIMED; n++) {
+        limitUs[n] = cycleBudget_limitUs(timed[n]);
+        cycleBudget_setLimit(timed[n], 0);
+    }
+    cycleBudget_clear();
+    latency_reset();
+    sensorApp_getRingStats(&overflows0, &highWater);
+    uint32_t allocs0 = lateAllocs;
+    uint32_t drops0 = console_txDrops();
+
+    printf("WCET run: %u s, flush every %u ms, console flooded.\n",
+           (unsigned)secs, WCET_FLUSH_MS);
+    stress(secs);
+
+    uint32_t isr_us = worstUs(BUDGET_STAGE_ISR);
+    uint32_t xfer_us = worstUs(BUDGET_STAGE_XFER);
+    uint32_t decode_us = worstUs(BUDGET_STAGE_DECODE);
+    uint32_t dispatch_us = worstUs(BUDGET_STAGE_DISPATCH);
+    for (unsigned n = 0; n < NUM_TIMED; n++) {
+        cycleBudget_setLimit(timed[n], limitUs[n]);
+    }
+    cycleBudget_clear();
+    sensorApp_getRingStats(&overflows, &highWater);
+
+    if (!latency_getStage(LAT_HANDLER, &handler) || !latency_getStage(LAT_CONSUME, &consume)) {
+        printf("No reports during the run.\n");
+        return;
+    }
+
+    // Response time of the sensor task to a report, to a fixed point
+    uint32_t base_us = handler.max + (highWater + 1) * dispatch_us;
+    uint32_t preempt_us = isr_us + xfer_us + decode_us;
+    uint32_t bound_us = base_us;
+    bool bounded = false;
+    for (unsigned n = 0; (n < MAX_ITERATIONS) && (bound_us <= MAX_BOUND_US); n++) {
+        uint32_t next_us = base_us + ((bound_us + t_us - 1) / t_us) * preempt_us;
+        if (next_us == bound_us) {
+            bounded = true;
+            break;
+        }
+        bound_us = next_us;
+    }
+
+    printf("Worst cases [us]: isr %u, xfer %u, decode %u, dispatch %u\n",
+           (unsigned)isr_us, (unsigned)xfer_us, (unsigned)decode_us, (unsigned)dispatch_us);
+    printf("INTN to handler %u us, ring high water %u, fastest interval %u us\n",
+           (unsigned)handler.max, (unsigned)highWater, (unsigned)t_us);
+    if (!bounded) {
+        printf("No bound: transfers can keep the sensor task from the ring.\n");
+    }
+    else {
+        printf("Bound: INTN to sensor task <= %u us; worst seen %u us (p99 %u): %s\n",
+               (unsigned)bound_us, (unsigned)consume.max, (unsigned)consume.p99,
+               (consume.max <= bound_us) ? "holds" : "VIOLATED");
+    }
+    printf("During the run: %u ring overflows, %u heap allocs (%u bytes since boot), "
+           "%u console bytes dropped.\n",
+           (unsigned)(overflows - overflows0), (unsigned)(lateAllocs - allocs0),
+           (unsigned)lateBytes, (unsigned)(console_txDrops() - drops0));
+    printf("Set these with budget <stage> <us> to flag a run past them.\n");
+
+    perfSuite_begin("wcet");
+    perfSuite_metric("wcet", "isr", "us", isr_us);
+    perfSuite_metric("wcet", "xfer", "us", xfer_us);
+    perfSuite_metric("wcet", "decode", "us", decode_us);
+    perfSuite_metric("wcet", "dispatch", "us", dispatch_us);
+    perfSuite_metric("wcet", "consume.max", "us", consume.max);
+    if (bounded) {
+        perfSuite_metric("wcet", "bound", "us", bound_us);
+    }
+    perfSuite_end();
+}
+
+// Flush the hub and flood the console until secs have passed
+static void stress(uint32_t secs)
+{
+    uint64_t end_uS = timebase_getUs() + secs * 1000000ULL;
+    uint32_t flushes = 0, reports = 0;
+
+    while (timebase_getUs() < end_uS) {
+        uint32_t n, drain_us;
+
+        if (sensorApp_flush(&n, &drain_us) == SH2_OK) {
+            flushes++;
+            reports += n;
+        }
+        for (unsigned line = 0; line < WCET_FLOOD_LINES; line++) {
+            printf("%5u ....................................................................\n", line);
+        }
+        vTaskDelay(pdMS_TO_TICKS(WCET_FLUSH_MS));
+    }
+
+    printf("%u flushes, %u reports flushed.\n", (unsigned)flushes, (unsigned)reports);
+}
+
+// Shortest report interval the hub granted a subscription [us], 0 if
+// none is subscribed
+static uint32_t fastestInterval(void)
+{
+    uint32_t fastest = 0;
+
+    for (unsigned id = 1; id <= SH2_MAX_SENSOR_ID; id++) {
+        uint32_t interval_us = sensorApp_grantedInterval(id);
+
+        if ((interval_us != 0) && ((fastest == 0) || (interval_us < fastest))) {
+            fastest = interval_us;
+        }
+    }
+
+    return fastest;
+}
+
+// Longest run of stage, rounded up [us]
+static uint32_t worstUs(BudgetStage_t stage)
+{
+    uint32_t cyclesPerUs = HAL_RCC_GetHCLKFreq() / 1000000;
+
+    return (cycleBudget_worstCycles(stage) + cyclesPerUs - 1) / cyclesPerUs;
+}
+
+#endif
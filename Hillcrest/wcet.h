@@ -0,0 +1,89 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Worst-case timing run, for builds that must show bounded latency.
+ *
+ * The sh2-demo-wcet configuration pre-includes wcet_profile.h, which
+ * turns this on with the settings it assumes: console writes that drop
+ * rather than block, and a count of heap allocations after the first
+ * sensor report (FreeRTOS's traceMALLOC hook), which should stay 0.
+ *
+ * "wcet [secs]" runs the subscribed sensors under stress: the hub is
+ * flushed every WCET_FLUSH_MS, so batched reports arrive as bursts of
+ * the longest transfers, and the shell floods the console meanwhile.
+ * With every cycle budget at 0 for the run, cycle_budget.h keeps each
+ * stage's longest run.  The bound on INTN to sensor task latency is
+ * then composed from those worst cases:
+ *
+ *   base  = worst INTN to sensor handler + (ring high water + 1) * worst dispatch
+ *   R     = base + ceil(R / T) * (worst isr + xfer + decode)
+ *
+ * iterated to a fixed point, with T the fastest granted report
+ * interval: the time to reach the report, plus the reports ahead of it
+ * in the ring, plus the transfers that preempt the sensor task while it
+ * drains them.  The run prints each term, the bound and the worst
+ * latency it saw, which must not exceed the bound.  The bound holds as
+ * long as no stage runs longer than in the run: set the cycle budgets to
+ * the worst cases it printed, and an overrun flags that it no longer
+ * holds.
+ */
+
+#ifndef WCET_H
+#define WCET_H
+
+#include <stddef.h>
+
+// Set to 1 (wcet_profile.h does) for the wcet command and heap check.
+#ifndef WCET_RUN
+#define WCET_RUN (0)
+#endif
+
+// Default length of a run [s]
+#ifndef WCET_RUN_SECS
+#define WCET_RUN_SECS (30)
+#endif
+
+// Interval between hub flushes during a run [ms]
+#ifndef WCET_FLUSH_MS
+#define WCET_FLUSH_MS (200)
+#endif
+
+// Console lines flooded between flushes
+#ifndef WCET_FLOOD_LINES
+#define WCET_FLOOD_LINES (20)
+#endif
+
+#if WCET_RUN
+
+// Register the "wcet" command and the late allocation counter.
+void wcet_init(void);
+
+// Count heap allocations from now on: call once startup is over.
+void wcet_heapFreeze(void);
+
+// traceMALLOC hook (wcet_profile.h).
+void wcet_onMalloc(size_t size);
+
+#else
+
+#define wcet_init()
+#define wcet_heapFreeze()
+
+#endif
+
+#endif
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Worst-case timing build profile, pre-included by the sh2-demo-wcet
+ * configuration (IAR: C/C++ Compiler > Preprocessor > Preinclude file).
+ *
+ * Each value overrides the #ifndef default of the module that owns it,
+ * as in ram_lean.h.  Task stacks are static (rtos_static.h) and the
+ * TCBs, queues and semaphores FreeRTOS 8.2 still takes from the heap
+ * are created at startup; the traceMALLOC hook counts any allocation
+ * after the first sensor report.  Console writes drop what doesn't fit
+ * instead of waiting on the UART, so no task on the sensor path waits
+ * on output.  "wcet" (wcet.h) measures the bound.
+ */
+
+#ifndef WCET_PROFILE_H
+#define WCET_PROFILE_H
+
+#include <stddef.h>
+
+#define WCET_RUN (1)
+
+// Console: bounded-time writes.  Dropped bytes are counted and marked.
+#define CONSOLE_TX_POLICY (CONSOLE_TX_DROP_NEWEST)
+
+// The run composes the bound from these
+#define LATENCY_TRACE (1)
+#define CYCLE_BUDGET (1)
+
+// Heap allocations after startup
+void wcet_onMalloc(size_t size);
+#define traceMALLOC(pvAddress, uiSize) wcet_onMalloc(uiSize)
+
+#endif
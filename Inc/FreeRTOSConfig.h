@@ -95,12 +95,16 @@
 
 #define configUSE_PREEMPTION                     1
 #define configUSE_IDLE_HOOK                      0
-#define configUSE_TICK_HOOK                      0
+#define configUSE_TICK_HOOK                      1
 #define configCPU_CLOCK_HZ                       ( SystemCoreClock )
 #define configTICK_RATE_HZ                       ((TickType_t)1000)
 #define configMAX_PRIORITIES                     ( 7 )
 #define configMINIMAL_STACK_SIZE                 ((uint16_t)128)
-#define configTOTAL_HEAP_SIZE                    ((size_t)15360)
+/* Task stacks are static (rtos_static.h): the heap holds TCBs, queues,
+   semaphores, the idle and default task stacks and the dfu_multi workers. */
+#ifndef configTOTAL_HEAP_SIZE
+#define configTOTAL_HEAP_SIZE                    ((size_t)10240)
+#endif
 #define configMAX_TASK_NAME_LEN                  ( 16 )
 #define configUSE_TRACE_FACILITY                 1
 #define configUSE_16_BIT_TICKS                   0
@@ -120,9 +124,10 @@ to exclude the API function. */
 #define INCLUDE_vTaskDelete                 1
 #define INCLUDE_vTaskCleanUpResources       0
 #define INCLUDE_vTaskSuspend                1
-#define INCLUDE_vTaskDelayUntil             0
+#define INCLUDE_vTaskDelayUntil             1
 #define INCLUDE_vTaskDelay                  1
 #define INCLUDE_xTaskGetSchedulerState      1
+#define INCLUDE_pcTaskGetTaskName           1
 
 /* Cortex-M specific definitions. */
 #ifdef __NVIC_PRIO_BITS
@@ -166,6 +171,36 @@ standard names. */
 
 /* USER CODE BEGIN Defines */   	      
 /* Section where parameter definitions can be added (for instance, to override default ones in FreeRTOS.h) */
+
+/* Run time stats, counted in microseconds by the timebase (see
+timebase.h).  The timebase is started in main() before the scheduler, so
+there is nothing to configure here. */
+#define configGENERATE_RUN_TIME_STATS            1
+#define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS()
+#define portGET_RUN_TIME_COUNTER_VALUE()         timebase_getStatsCount()
+#if defined(__ICCARM__) || defined(__CC_ARM) || defined(__GNUC__)
+    extern uint32_t timebase_getStatsCount(void);
+#endif
+
+/* Stop the tick and sleep (WFI) when idle.  Peripherals, DMA and EXTI keep
+running in sleep mode, so INTN and console interrupts wake the core.
+Sensor timestamps come from TIM2, which keeps counting through sleep. */
+#define configUSE_TICKLESS_IDLE                  1
+
+/* Or STOP, with the clocks and TIM2 stopped, when power.c allows it: it
+then sleeps itself and puts the time stopped back on the timebase and
+the tick. */
+#define configPRE_SLEEP_PROCESSING(x)            power_preSleep(x)
+#if defined(__ICCARM__) || defined(__CC_ARM) || defined(__GNUC__)
+    extern void power_preSleep(uint32_t *pIdle);
+#endif
+
+/* Kernel trace hooks (task switches, queues, interrupts) into the RAM ring
+of rtos_trace.c.  The header holds C declarations, so not for the
+assembler. */
+#if defined(__ICCARM__) || defined(__CC_ARM) || defined(__GNUC__)
+    #include "rtos_trace.h"
+#endif
 /* USER CODE END Defines */ 
 
 #endif /* FREERTOS_CONFIG_H */
@@ -36,6 +36,8 @@
 #include "task.h"
 
 /* USER CODE BEGIN Includes */     
+#include "timebase.h"
+#include "sysstats.h"
 
 /* USER CODE END Includes */
 
@@ -52,6 +54,19 @@
 /* USER CODE END FunctionPrototypes */
 
 /* Hook prototypes */
+void vApplicationTickHook(void);
+
+/* USER CODE BEGIN 3 */
+void vApplicationTickHook( void )
+{
+  /* Keep the 64-bit timebase extensions current: they have to observe
+  every wrap of the 32-bit counters. */
+  timebase_getCycles();
+  timebase_getUs();
+
+  sysstats_tick();
+}
+/* USER CODE END 3 */
 
 /* USER CODE BEGIN Application */
      
@@ -35,36 +35,85 @@
 #include "cmsis_os.h"
 
 /* USER CODE BEGIN Includes */
+#if defined(SH2_HAL_SPI)
+#include "sh2_hal_spi.h"
+#endif
+#include "spi_bus.h"
+#include "flash_log.h"
 #if defined(SH2_HAL_I2C)
 #include "sh2_hal_i2c.h"
-#elif defined(SH2_HAL_SPI)
-#include "sh2_hal_spi.h"
-#else
-  #error either SH2_HAL_I2C or SH2_HAL_SPI must be predefined
+#endif
+#if !defined(SH2_HAL_I2C) && !defined(SH2_HAL_SPI)
+  #error SH2_HAL_I2C, SH2_HAL_SPI or both must be predefined
 #endif
 
 #include "sensor_app.h"
 #include "dbg.h"
+#include "timebase.h"
+#include "shell.h"
+#include "latency.h"
+#include "sysstats.h"
+#include "dlog.h"
+#include "rtos_static.h"
+#include "clock.h"
+#include "priorities.h"
+#include "console.h"
+#include "usb_cdc.h"
+#include "power.h"
+#include "boot_prof.h"
+#include "shtp_capture.h"
+#include "microbench.h"
+#include "cpu_load.h"
+#include "perf_suite.h"
+#include "wcet.h"
+#include "exti.h"
+#include "itm.h"
+#include "trace.h"
+#include "rtos_trace.h"
+#include "cycle_budget.h"
+#include "coredump.h"
+#include "art_bench.h"
+#include "gps_pps.h"
+#include "data_uart.h"
+#include "crc32.h"
 /* USER CODE END Includes */
 
 /* Private variables ---------------------------------------------------------*/
 I2C_HandleTypeDef hi2c1;
+DMA_HandleTypeDef hdma_i2c1_rx;
+DMA_HandleTypeDef hdma_i2c1_tx;
 
 SPI_HandleTypeDef hspi1;
+DMA_HandleTypeDef hdma_spi1_rx;
+DMA_HandleTypeDef hdma_spi1_tx;
 
 UART_HandleTypeDef huart2;
+DMA_HandleTypeDef hdma_usart2_rx;
+DMA_HandleTypeDef hdma_usart2_tx;
 
 osThreadId defaultTaskHandle;
 
 /* USER CODE BEGIN PV */
 /* Private variables ---------------------------------------------------------*/
+#ifndef DEMO_TASK_STACK
+#define DEMO_TASK_STACK (256)    /* words */
+#endif
+#ifndef SHELL_TASK_STACK
+#define SHELL_TASK_STACK (256)   /* words */
+#endif
 osThreadId demoTaskHandle;
+osThreadId shellTaskHandle;
+#if !MICROBENCH
+RTOS_STACK_DEF(demoTaskStack, DEMO_TASK_STACK);
+#endif
+RTOS_STACK_DEF(shellTaskStack, SHELL_TASK_STACK);
 
 /* USER CODE END PV */
 
 /* Private function prototypes -----------------------------------------------*/
 void SystemClock_Config(void);
 static void MX_GPIO_Init(void);
+static void MX_DMA_Init(void);
 static void MX_I2C1_Init(void);
 static void MX_USART2_UART_Init(void);
 static void MX_SPI1_Init(void);
@@ -83,7 +132,9 @@ int main(void)
 {
 
   /* USER CODE BEGIN 1 */
-
+  /* Start the timebase first, so that boot phases can be timed */
+  timebase_init();
+  bootProf_mark(BOOT_MAIN);
   /* USER CODE END 1 */
 
   /* MCU Configuration----------------------------------------------------------*/
@@ -96,12 +147,40 @@ int main(void)
 
   /* Initialize all configured peripherals */
   MX_GPIO_Init();
+  MX_DMA_Init();
   MX_I2C1_Init();
   MX_USART2_UART_Init();
   MX_SPI1_Init();
 
   /* USER CODE BEGIN 2 */
+  bootProf_mark(BOOT_PERIPH);
+  artBench_run();
   dbgInit();
+  itm_init();
+  trace_init();
+  rtosTrace_init();
+  coredump_init();
+  crc32_init();
+  latency_init();
+  cycleBudget_init();
+  sysstats_init();
+  exti_init();
+  dlog_init();
+  shtpCapture_init();
+  microbench_init();
+  cpuLoad_init();
+  perfSuite_init();
+  wcet_init();
+#if USB_CDC
+  usbCdc_init();
+#endif
+  power_init();
+#if DATA_UART
+  dataUart_init();
+#endif
+#if GPS_PPS
+  gpsPps_init();
+#endif
   /* USER CODE END 2 */
 
   /* USER CODE BEGIN RTOS_MUTEX */
@@ -123,17 +202,34 @@ int main(void)
 
   /* USER CODE BEGIN RTOS_THREADS */
   /* add threads, ... */
+  // The first device registered is the one the SH-2 library and demo
+  // use: with both HALs built, the SPI one.
+#if defined(SH2_HAL_SPI) || FLASH_LOG
+  spiBus_init();
+#endif
+#if defined(SH2_HAL_SPI)
+  sh2_hal_spiInit(&hspi1);
+#endif
 #if defined(SH2_HAL_I2C)
-  sh2_hal_init(&hi2c1);
-#elif defined(SH2_HAL_SPI)
-  sh2_hal_init(&hspi1);
+  sh2_hal_i2cInit(&hi2c1);
 #endif
+  // Recorder flash on SPI1, shared with an SPI hub
+  flashLog_init(&hspi1);
   
-  osThreadDef(demoTask, demoTaskStart, osPriorityNormal, 0, 256);
-  demoTaskHandle = osThreadCreate(osThread(demoTask), NULL);
+#if !MICROBENCH
+  // (Benchmark builds leave the hub in reset and run the benchmarks.)
+  osThreadDef(demoTask, demoTaskStart, PRIO_TASK_DEMO, 0, DEMO_TASK_STACK);
+  demoTaskHandle = rtos_threadCreate(osThread(demoTask), NULL, RTOS_STACK(demoTaskStack));
   if (demoTaskHandle == NULL) {
 	  printf("Failed to create demo task.\n");
   }
+#endif
+
+  osThreadDef(shellTask, shellTaskStart, PRIO_TASK_SHELL, 0, SHELL_TASK_STACK);
+  shellTaskHandle = rtos_threadCreate(osThread(shellTask), NULL, RTOS_STACK(shellTaskStack));
+  if (shellTaskHandle == NULL) {
+	  printf("Failed to create shell task.\n");
+  }
   
   /* USER CODE END RTOS_THREADS */
 
@@ -165,30 +261,10 @@ int main(void)
 void SystemClock_Config(void)
 {
 
-  RCC_OscInitTypeDef RCC_OscInitStruct;
-  RCC_ClkInitTypeDef RCC_ClkInitStruct;
-
-  __PWR_CLK_ENABLE();
-
-  __HAL_PWR_VOLTAGESCALING_CONFIG(PWR_REGULATOR_VOLTAGE_SCALE2);
-
-  RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSI;
-  RCC_OscInitStruct.HSIState = RCC_HSI_ON;
-  RCC_OscInitStruct.HSICalibrationValue = 16;
-  RCC_OscInitStruct.PLL.PLLState = RCC_PLL_ON;
-  RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_HSI;
-  RCC_OscInitStruct.PLL.PLLM = 16;
-  RCC_OscInitStruct.PLL.PLLN = 168;
-  RCC_OscInitStruct.PLL.PLLP = RCC_PLLP_DIV2;
-  RCC_OscInitStruct.PLL.PLLQ = 4;
-  HAL_RCC_OscConfig(&RCC_OscInitStruct);
-
-  RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_SYSCLK|RCC_CLOCKTYPE_PCLK1;
-  RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_PLLCLK;
-  RCC_ClkInitStruct.AHBCLKDivider = RCC_SYSCLK_DIV1;
-  RCC_ClkInitStruct.APB1CLKDivider = RCC_HCLK_DIV2;
-  RCC_ClkInitStruct.APB2CLKDivider = RCC_HCLK_DIV1;
-  HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_2);
+  /* PLL, voltage scale, flash latency and bus dividers per CLOCK_PROFILE */
+  clock_config();
+  timebase_clockChanged();
+  bootProf_mark(BOOT_CLOCK);
 
   HAL_SYSTICK_Config(HAL_RCC_GetHCLKFreq()/1000);
 
@@ -240,17 +316,42 @@ void MX_USART2_UART_Init(void)
 {
 
   huart2.Instance = USART2;
-  huart2.Init.BaudRate = 115200;
+  huart2.Init.BaudRate = CONSOLE_BAUD;
   huart2.Init.WordLength = UART_WORDLENGTH_8B;
   huart2.Init.StopBits = UART_STOPBITS_1;
   huart2.Init.Parity = UART_PARITY_NONE;
   huart2.Init.Mode = UART_MODE_TX_RX;
   huart2.Init.HwFlowCtl = UART_HWCONTROL_NONE;
-  huart2.Init.OverSampling = UART_OVERSAMPLING_16;
+  huart2.Init.OverSampling = console_overSampling(CONSOLE_BAUD);
   HAL_UART_Init(&huart2);
 
 }
 
+/** 
+  * Enable DMA controller clock
+  */
+void MX_DMA_Init(void) 
+{
+  /* DMA controller clock enable */
+  __DMA1_CLK_ENABLE();
+  __DMA2_CLK_ENABLE();
+
+  /* DMA interrupt init */
+  HAL_NVIC_SetPriority(DMA1_Stream0_IRQn, PRIO_IRQ_SENSOR_BUS, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Stream0_IRQn);
+  HAL_NVIC_SetPriority(DMA1_Stream5_IRQn, PRIO_IRQ_CONSOLE, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Stream5_IRQn);
+  HAL_NVIC_SetPriority(DMA1_Stream6_IRQn, PRIO_IRQ_CONSOLE, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Stream6_IRQn);
+  HAL_NVIC_SetPriority(DMA1_Stream7_IRQn, PRIO_IRQ_SENSOR_BUS, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Stream7_IRQn);
+  HAL_NVIC_SetPriority(DMA2_Stream0_IRQn, PRIO_IRQ_SENSOR_BUS, 0);
+  HAL_NVIC_EnableIRQ(DMA2_Stream0_IRQn);
+  HAL_NVIC_SetPriority(DMA2_Stream3_IRQn, PRIO_IRQ_SENSOR_BUS, 0);
+  HAL_NVIC_EnableIRQ(DMA2_Stream3_IRQn);
+
+}
+
 /** Configure pins as 
         * Analog 
         * Input 
@@ -289,7 +390,7 @@ void MX_GPIO_Init(void)
   HAL_GPIO_Init(SH_CSN_GPIO_Port, &GPIO_InitStruct);
 
   /* EXTI interrupt init*/
-  HAL_NVIC_SetPriority(EXTI15_10_IRQn, 5, 0);
+  HAL_NVIC_SetPriority(EXTI15_10_IRQn, PRIO_IRQ_INTN, 0);
   HAL_NVIC_EnableIRQ(EXTI15_10_IRQn);
 
 }
@@ -304,11 +405,9 @@ void StartDefaultTask(void const * argument)
 
   /* USER CODE BEGIN 5 */
 
-  /* Infinite loop */
-  for(;;)
-  {
-    osDelay(1);
-  }
+  /* No work here.  Exit rather than wake every tick, so the idle task
+  can sleep between interrupts. */
+  osThreadTerminate(NULL);
   /* USER CODE END 5 */ 
 }
 
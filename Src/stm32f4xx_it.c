@@ -37,13 +37,32 @@
 #include "cmsis_os.h"
 
 /* USER CODE BEGIN 0 */
+#include "console.h"
+#include "exti.h"
+#include "coredump.h"
+#include "usb_cdc.h"
+#include "power.h"
+#include "timebase.h"
+#include "data_uart.h"
+#include "rtos_trace.h"
+#include "sensor_resample.h"
+#include "sensor_tick.h"
+#if defined(SH2_HAL_SPI)
+#include "sh2_hal_spi.h"
+#endif
 
 /* USER CODE END 0 */
 
 /* External variables --------------------------------------------------------*/
 extern I2C_HandleTypeDef hi2c1;
+extern DMA_HandleTypeDef hdma_i2c1_rx;
+extern DMA_HandleTypeDef hdma_i2c1_tx;
 extern SPI_HandleTypeDef hspi1;
+extern DMA_HandleTypeDef hdma_spi1_rx;
+extern DMA_HandleTypeDef hdma_spi1_tx;
 extern UART_HandleTypeDef huart2;
+extern DMA_HandleTypeDef hdma_usart2_rx;
+extern DMA_HandleTypeDef hdma_usart2_tx;
 
 /******************************************************************************/
 /*            Cortex-M4 Processor Interruption and Exception Handlers         */ 
@@ -69,7 +88,7 @@ void NMI_Handler(void)
 void HardFault_Handler(void)
 {
   /* USER CODE BEGIN HardFault_IRQn 0 */
-
+  coredump_fault(CORE_DUMP_HARD_FAULT, __get_LR(), __get_MSP());
   /* USER CODE END HardFault_IRQn 0 */
   while (1)
   {
@@ -85,7 +104,7 @@ void HardFault_Handler(void)
 void MemManage_Handler(void)
 {
   /* USER CODE BEGIN MemoryManagement_IRQn 0 */
-
+  coredump_fault(CORE_DUMP_MEM_MANAGE, __get_LR(), __get_MSP());
   /* USER CODE END MemoryManagement_IRQn 0 */
   while (1)
   {
@@ -101,7 +120,7 @@ void MemManage_Handler(void)
 void BusFault_Handler(void)
 {
   /* USER CODE BEGIN BusFault_IRQn 0 */
-
+  coredump_fault(CORE_DUMP_BUS_FAULT, __get_LR(), __get_MSP());
   /* USER CODE END BusFault_IRQn 0 */
   while (1)
   {
@@ -117,7 +136,7 @@ void BusFault_Handler(void)
 void UsageFault_Handler(void)
 {
   /* USER CODE BEGIN UsageFault_IRQn 0 */
-
+  coredump_fault(CORE_DUMP_USAGE_FAULT, __get_LR(), __get_MSP());
   /* USER CODE END UsageFault_IRQn 0 */
   while (1)
   {
@@ -165,17 +184,73 @@ void SysTick_Handler(void)
 /* please refer to the startup file (startup_stm32f4xx.s).                    */
 /******************************************************************************/
 
+/**
+* @brief This function handles DMA1 Stream0 global interrupt.
+*/
+void DMA1_Stream0_IRQHandler(void)
+{
+  /* USER CODE BEGIN DMA1_Stream0_IRQn 0 */
+  traceISR_ENTER();
+  /* USER CODE END DMA1_Stream0_IRQn 0 */
+  HAL_DMA_IRQHandler(&hdma_i2c1_rx);
+  /* USER CODE BEGIN DMA1_Stream0_IRQn 1 */
+  traceISR_EXIT();
+  /* USER CODE END DMA1_Stream0_IRQn 1 */
+}
+
+/**
+* @brief This function handles DMA1 Stream5 global interrupt.
+*/
+void DMA1_Stream5_IRQHandler(void)
+{
+  /* USER CODE BEGIN DMA1_Stream5_IRQn 0 */
+  traceISR_ENTER();
+  /* USER CODE END DMA1_Stream5_IRQn 0 */
+  HAL_DMA_IRQHandler(&hdma_usart2_rx);
+  /* USER CODE BEGIN DMA1_Stream5_IRQn 1 */
+  traceISR_EXIT();
+  /* USER CODE END DMA1_Stream5_IRQn 1 */
+}
+
+/**
+* @brief This function handles DMA1 Stream6 global interrupt.
+*/
+void DMA1_Stream6_IRQHandler(void)
+{
+  /* USER CODE BEGIN DMA1_Stream6_IRQn 0 */
+  traceISR_ENTER();
+  /* USER CODE END DMA1_Stream6_IRQn 0 */
+  HAL_DMA_IRQHandler(&hdma_usart2_tx);
+  /* USER CODE BEGIN DMA1_Stream6_IRQn 1 */
+  traceISR_EXIT();
+  /* USER CODE END DMA1_Stream6_IRQn 1 */
+}
+
+/**
+* @brief This function handles DMA1 Stream7 global interrupt.
+*/
+void DMA1_Stream7_IRQHandler(void)
+{
+  /* USER CODE BEGIN DMA1_Stream7_IRQn 0 */
+  traceISR_ENTER();
+  /* USER CODE END DMA1_Stream7_IRQn 0 */
+  HAL_DMA_IRQHandler(&hdma_i2c1_tx);
+  /* USER CODE BEGIN DMA1_Stream7_IRQn 1 */
+  traceISR_EXIT();
+  /* USER CODE END DMA1_Stream7_IRQn 1 */
+}
+
 /**
 * @brief This function handles I2C1 event interrupt.
 */
 void I2C1_EV_IRQHandler(void)
 {
   /* USER CODE BEGIN I2C1_EV_IRQn 0 */
-
+  traceISR_ENTER();
   /* USER CODE END I2C1_EV_IRQn 0 */
   HAL_I2C_EV_IRQHandler(&hi2c1);
   /* USER CODE BEGIN I2C1_EV_IRQn 1 */
-
+  traceISR_EXIT();
   /* USER CODE END I2C1_EV_IRQn 1 */
 }
 
@@ -185,11 +260,11 @@ void I2C1_EV_IRQHandler(void)
 void I2C1_ER_IRQHandler(void)
 {
   /* USER CODE BEGIN I2C1_ER_IRQn 0 */
-
+  traceISR_ENTER();
   /* USER CODE END I2C1_ER_IRQn 0 */
   HAL_I2C_ER_IRQHandler(&hi2c1);
   /* USER CODE BEGIN I2C1_ER_IRQn 1 */
-
+  traceISR_EXIT();
   /* USER CODE END I2C1_ER_IRQn 1 */
 }
 
@@ -199,11 +274,11 @@ void I2C1_ER_IRQHandler(void)
 void SPI1_IRQHandler(void)
 {
   /* USER CODE BEGIN SPI1_IRQn 0 */
-
+  traceISR_ENTER();
   /* USER CODE END SPI1_IRQn 0 */
   HAL_SPI_IRQHandler(&hspi1);
   /* USER CODE BEGIN SPI1_IRQn 1 */
-
+  traceISR_EXIT();
   /* USER CODE END SPI1_IRQn 1 */
 }
 
@@ -213,29 +288,151 @@ void SPI1_IRQHandler(void)
 void USART2_IRQHandler(void)
 {
   /* USER CODE BEGIN USART2_IRQn 0 */
-
+  traceISR_ENTER();
+  console_uartIrq();
   /* USER CODE END USART2_IRQn 0 */
   HAL_UART_IRQHandler(&huart2);
   /* USER CODE BEGIN USART2_IRQn 1 */
-
+  traceISR_EXIT();
   /* USER CODE END USART2_IRQn 1 */
 }
 
+/**
+* @brief This function handles DMA2 Stream0 global interrupt.
+*/
+void DMA2_Stream0_IRQHandler(void)
+{
+  /* USER CODE BEGIN DMA2_Stream0_IRQn 0 */
+  traceISR_ENTER();
+#if defined(SH2_HAL_SPI) && SH2_HAL_SPI_LL
+  // SHTP transfers finish without the ST HAL (see SH2_HAL_SPI_LL)
+  if (sh2_hal_spiDmaIrq()) {
+    traceISR_EXIT();
+    return;
+  }
+#endif
+  /* USER CODE END DMA2_Stream0_IRQn 0 */
+  HAL_DMA_IRQHandler(&hdma_spi1_rx);
+  /* USER CODE BEGIN DMA2_Stream0_IRQn 1 */
+  traceISR_EXIT();
+  /* USER CODE END DMA2_Stream0_IRQn 1 */
+}
+
+/**
+* @brief This function handles DMA2 Stream3 global interrupt.
+*/
+void DMA2_Stream3_IRQHandler(void)
+{
+  /* USER CODE BEGIN DMA2_Stream3_IRQn 0 */
+  traceISR_ENTER();
+  /* USER CODE END DMA2_Stream3_IRQn 0 */
+  HAL_DMA_IRQHandler(&hdma_spi1_tx);
+  /* USER CODE BEGIN DMA2_Stream3_IRQn 1 */
+  traceISR_EXIT();
+  /* USER CODE END DMA2_Stream3_IRQn 1 */
+}
+
 /**
 * @brief This function handles EXTI line[15:10] interrupts.
 */
 void EXTI15_10_IRQHandler(void)
 {
   /* USER CODE BEGIN EXTI15_10_IRQn 0 */
-
+  traceISR_ENTER();
   /* USER CODE END EXTI15_10_IRQn 0 */
   HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_10);
   /* USER CODE BEGIN EXTI15_10_IRQn 1 */
-
+  // The rest of the vector's lines, in one pass (see exti.h)
+  exti_dispatch(GPIO_PIN_11 | GPIO_PIN_12 | GPIO_PIN_13 |
+                GPIO_PIN_14 | GPIO_PIN_15);
+  traceISR_EXIT();
   /* USER CODE END EXTI15_10_IRQn 1 */
 }
 
 /* USER CODE BEGIN 1 */
+/**
+* @brief This function handles TIM2 global interrupt (timebase alarms and capture).
+*/
+void TIM2_IRQHandler(void)
+{
+  traceISR_ENTER();
+  timebase_alarmIrq();
+  traceISR_EXIT();
+}
+
+#if SENSOR_RESAMPLE
+/**
+* @brief This function handles TIM5 global interrupt (resampler grid).
+*/
+void TIM5_IRQHandler(void)
+{
+  traceISR_ENTER();
+  sensorResample_irq();
+  traceISR_EXIT();
+}
+#endif
+
+#if SENSOR_TICK
+/**
+* @brief This function handles TIM4 global interrupt (control tick).
+*/
+void TIM4_IRQHandler(void)
+{
+  traceISR_ENTER();
+  sensorTick_irq();
+  traceISR_EXIT();
+}
+#endif
+
+#if USB_CDC
+/**
+* @brief This function handles USB On The Go FS global interrupt.
+*/
+void OTG_FS_IRQHandler(void)
+{
+  traceISR_ENTER();
+  usbCdc_irq();
+  traceISR_EXIT();
+}
+#endif
+
+#if DATA_UART
+/**
+* @brief This function handles DMA2 stream7 global interrupt (data UART TX).
+*/
+void DMA2_Stream7_IRQHandler(void)
+{
+  traceISR_ENTER();
+  dataUart_dmaIrq();
+  traceISR_EXIT();
+}
+
+/**
+* @brief This function handles USART1 global interrupt (data UART TX done).
+*/
+void USART1_IRQHandler(void)
+{
+  traceISR_ENTER();
+  dataUart_uartIrq();
+  traceISR_EXIT();
+}
+#endif
+
+/**
+* @brief This function handles RTC wakeup interrupt through EXTI line 22.
+*/
+void RTC_WKUP_IRQHandler(void)
+{
+  power_wakeIrq();
+}
+
+/**
+* @brief This function handles EXTI line3 interrupt (console RX wake).
+*/
+void EXTI3_IRQHandler(void)
+{
+  power_wakeIrq();
+}
 
 /* USER CODE END 1 */
 /************************ (C) COPYRIGHT STMicroelectronics *****END OF FILE****/
@@ -0,0 +1,390 @@
+#!/usr/bin/env python3
+#
+# Copyright 2015-16 Hillcrest Laboratories, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License and
+# any applicable agreements you may have with Hillcrest Laboratories, Inc.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+"""
+Convert a capture of the demo's BIN_OUTPUT or DELTA_OUTPUT stream to DSF.
+
+Usage: bin2dsf.py capture.bin [out.dsf]
+
+Frames are located by their sync bytes and validated by CRC, so any text
+the firmware prints between frames (e.g. "SH2 Reset.") is skipped.
+Frames with a first sync byte of 0xA5 carry a CRC-16, those with 0xA6
+(BIN_CRC32 builds) a CRC-32 from the MCU's CRC unit; both are checked.
+The frame layout must match printBin() and printDelta() in
+Hillcrest/sensor_output.c.  Delta frames are expanded back to the plain
+report; after a gap in a sensor's frame seq its deltas are dropped until
+its next keyframe.  The compression ratio of delta frames is reported.
+Pose frames ("out pose") have their smallest-three quaternion unpacked
+as quatPack_decode() in Hillcrest/quat_pack.c does.
+"""
+
+import math
+import struct
+import sys
+
+SYNC0 = 0xa5
+SYNC0_CRC32 = 0xa6
+SYNC1 = 0x5a
+DELTA_SYNC1 = 0x5b
+DELTA_KEY = 0x80
+POSE_SYNC1 = 0x5c
+HDR_LEN = 13
+CRC_LEN = {SYNC0: 2, SYNC0_CRC32: 4}
+
+ACCELEROMETER = 0x01
+GYROSCOPE_CALIBRATED = 0x02
+MAGNETIC_FIELD_CALIBRATED = 0x03
+LINEAR_ACCELERATION = 0x04
+ROTATION_VECTOR = 0x05
+GAME_ROTATION_VECTOR = 0x08
+GEOMAGNETIC_ROTATION_VECTOR = 0x09
+RAW_ACCELEROMETER = 0x14
+RAW_GYROSCOPE = 0x15
+RAW_MAGNETOMETER = 0x16
+GYRO_INTEGRATED_RV = 0x2A
+CAMSYNC = 0x70           # camera trigger pose, Hillcrest/sensor_camsync.h
+
+HEADERS = {
+    ROTATION_VECTOR:
+        "TIME[x]{s}, SAMPLE_ID[x]{samples}, ANG_POS_GLOBAL[rijk]{quaternion}, ANG_POS_ACCURACY[x]{rad}",
+    GEOMAGNETIC_ROTATION_VECTOR:
+        "TIME[x]{s}, SAMPLE_ID[x]{samples}, ANG_POS_GLOBAL[rijk]{quaternion}, ANG_POS_ACCURACY[x]{rad}",
+    GAME_ROTATION_VECTOR:
+        "TIME[x]{s}, SAMPLE_ID[x]{samples}, ANG_POS_GAME[rijk]{quaternion}",
+    RAW_ACCELEROMETER:
+        "TIME[x]{s}, SAMPLE_ID[x]{samples}, RAW_ACCELEROMETER[xyz]{adc units}",
+    RAW_MAGNETOMETER:
+        "TIME[x]{s}, SAMPLE_ID[x]{samples}, RAW_MAGNETOMETER[xyz]{adc units}",
+    RAW_GYROSCOPE:
+        "TIME[x]{s}, SAMPLE_ID[x]{samples}, RAW_GYROSCOPE[xyz]{adc units}",
+    ACCELEROMETER:
+        "TIME[x]{s}, SAMPLE_ID[x]{samples}, ACCELEROMETER[xyz]{m/s^2}",
+    LINEAR_ACCELERATION:
+        "TIME[x]{s}, SAMPLE_ID[x]{samples}, LINEAR_ACCELERATION[xyz]{m/s^2}",
+    GYROSCOPE_CALIBRATED:
+        "TIME[x]{s}, SAMPLE_ID[x]{samples}, ANG_VEL[xyz]{rad/s}",
+    MAGNETIC_FIELD_CALIBRATED:
+        "TIME[x]{s}, SAMPLE_ID[x]{samples}, MAG_FIELD[xyz]{uTesla}, STATUS[x]{enum}",
+    GYRO_INTEGRATED_RV:
+        "TIME[x]{s}, ANG_VEL_GYRO_RV[xyz]{rad/s}, ANG_POS_GYRO_RV[wxyz]{quaternion}",
+    CAMSYNC:
+        "TIME[x]{s}, SAMPLE_ID[x]{samples}, CAMERA_POSE[rijk]{quaternion}, STATUS[x]{enum}",
+}
+
+
+def crc16(data, crc=0xFFFF):
+    """CRC-16/CCITT, as computed by crc16() in Hillcrest/crc16.c."""
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            if crc & 0x8000:
+                crc = ((crc << 1) ^ 0x1021) & 0xFFFF
+            else:
+                crc = (crc << 1) & 0xFFFF
+    return crc
+
+
+def crc32(data, crc=0xFFFFFFFF):
+    """CRC-32/MPEG-2, as computed by crc32() in Hillcrest/crc32.c."""
+    for b in data:
+        crc ^= b << 24
+        for _ in range(8):
+            if crc & 0x80000000:
+                crc = ((crc << 1) ^ 0x04C11DB7) & 0xFFFFFFFF
+            else:
+                crc = (crc << 1) & 0xFFFFFFFF
+    return crc
+
+
+def frame_crc(sync0, data, pos):
+    """The CRC a frame with first sync byte sync0 carries at data[pos]."""
+    if sync0 == SYNC0_CRC32:
+        return struct.unpack_from('<I', data, pos)[0]
+    return struct.unpack_from('<H', data, pos)[0]
+
+
+def frames(data):
+    """Yield (sync1, sensorId, frameSeq, body, length) for each valid frame.
+
+    body is timestamp and payload of a plain frame, the coded body of
+    a delta frame; length is the whole frame's.
+    """
+    pos = 0
+    while True:
+        found = [p for p in (data.find(bytes([s]), pos) for s in CRC_LEN) if p >= 0]
+        if not found:
+            return
+        pos = min(found)
+        if pos + 5 > len(data):
+            return
+        sync0, sync1, sensor_id, seq, blen = struct.unpack_from('<BBBBB', data, pos)
+        crc_len = CRC_LEN[sync0]
+        if sync1 == SYNC1:
+            end = pos + HDR_LEN + blen
+        elif sync1 in (DELTA_SYNC1, POSE_SYNC1):
+            end = pos + 5 + blen
+        else:
+            pos += 1
+            continue
+        if end + crc_len > len(data):
+            return
+        check = crc32 if sync0 == SYNC0_CRC32 else crc16
+        if frame_crc(sync0, data, end) != check(data[pos + 2:end]):
+            # Not a frame (or a damaged one), resync one byte further on
+            pos += 1
+            continue
+        yield sync1, sensor_id, seq, data[pos + 5:end], end + crc_len - pos
+        pos = end + crc_len
+
+
+def varint(body, pos):
+    """Return (value, next pos) of the varint at body[pos]."""
+    v = 0
+    shift = 0
+    while True:
+        b = body[pos]
+        pos += 1
+        v |= (b & 0x7f) << shift
+        shift += 7
+        if not b & 0x80:
+            return v, pos
+
+
+def unzigzag(v):
+    return (v >> 1) ^ -(v & 1)
+
+
+class DeltaDecoder:
+    """Expand delta frames back to (timestamp_us, payload), per sensor."""
+
+    def __init__(self):
+        self.state = {}   # sensor id: [frame seq, t_us, dt_us, payload]
+        self.lost = 0     # delta frames that could not be decoded
+
+    def decode(self, sensor_id, seq, body):
+        """Return (sensor id, timestamp_us, payload), or None if out of sync."""
+        key = sensor_id & DELTA_KEY
+        sensor_id &= ~DELTA_KEY
+        hdr = 0 if sensor_id == GYRO_INTEGRATED_RV else 4
+        last = self.state.get(sensor_id)
+        if last is not None and ((seq - last[0]) & 0xff) != 1:
+            # Missed a frame: wait for a keyframe
+            del self.state[sensor_id]
+            last = None
+        if not key and last is None:
+            self.lost += 1
+            return None
+
+        pos = 0
+        if key:
+            plen = body[pos]
+            t_us, pos = varint(body, pos + 1)
+            dt_us = 0
+        else:
+            _, t_us, dt_us, prev = last
+            plen = len(prev)
+            ddt, pos = varint(body, pos)
+            dt_us += unzigzag(ddt)
+            t_us += dt_us
+
+        hdr = min(hdr, plen)
+        p = bytearray(plen)
+        if hdr:
+            p[0] = sensor_id
+            p[1:hdr] = body[pos:pos + hdr - 1]
+            pos += hdr - 1
+        n = hdr
+        while n + 1 < plen:
+            v, pos = varint(body, pos)
+            v = unzigzag(v)
+            if not key:
+                v += struct.unpack_from('<h', prev, n)[0]
+            struct.pack_into('<H', p, n, v & 0xffff)
+            n += 2
+        if n < plen:
+            p[n] = body[pos]
+
+        self.state[sensor_id] = [seq, t_us, dt_us, bytes(p)]
+        return sensor_id, t_us, bytes(p)
+
+
+def unpack_quat(data, pos, bits, qpoint=14):
+    """Return ([i, j, k, real], next pos) of a smallest-three quaternion."""
+    nbytes = (2 + 3 * bits + 7) // 8
+    packed = int.from_bytes(data[pos:pos + nbytes], 'little')
+    one = 1 << qpoint
+    half = (one * 46341 + 0x8000) >> 16
+    vmax = (1 << bits) - 1
+    big = packed & 3
+    shift = 2
+    quat = [0] * 4
+    rest = one * one
+    for n in range(4):
+        if n == big:
+            continue
+        v = (packed >> shift) & vmax
+        c = (v * 2 * half + vmax // 2) // vmax - half
+        quat[n] = c
+        rest -= c * c
+        shift += bits
+    quat[big] = int(math.sqrt(rest) + 0.5) if rest > 0 else 0
+    return quat, pos + nbytes
+
+
+def unpose(sensor_id, body, last_t_us):
+    """Return (timestamp_us, payload) of a pose frame's body.
+
+    The 32-bit timestamp is extended from last_t_us, that of the frame
+    before.
+    """
+    t32, seq, info = struct.unpack_from('<IBB', body, 0)
+    t_us = last_t_us + ((t32 - last_t_us) & 0xffffffff)
+    quat, pos = unpack_quat(body, 6, info >> 2)
+    packed = struct.pack('<4h', *quat) + body[pos:]
+    if sensor_id == GYRO_INTEGRATED_RV:
+        return t_us, packed
+    return t_us, bytes([sensor_id, seq, info & 0x3, 0]) + packed
+
+
+def q(v, n):
+    return v / float(1 << n)
+
+
+def decode(sensor_id, t, sample_id, p):
+    """Format one report the way printDsf() does, or None if unsupported."""
+    if sensor_id == GYRO_INTEGRATED_RV:
+        # No report header on the GIRV channel
+        i, j, k, r, x, y, z = struct.unpack_from('<7h', p, 0)
+        return "%0.6f, %0.6f, %0.6f, %0.6f, %0.6f, %0.6f, %0.6f, %0.6f" % (
+            t, q(x, 10), q(y, 10), q(z, 10),
+            q(r, 14), q(i, 14), q(j, 14), q(k, 14))
+
+    status = p[2]
+    if sensor_id in (RAW_ACCELEROMETER, RAW_GYROSCOPE, RAW_MAGNETOMETER):
+        x, y, z = struct.unpack_from('<3h', p, 4)
+        return "%0.6f, %d, %d, %d, %d" % (t, sample_id, x, y, z)
+
+    if sensor_id in (ACCELEROMETER, LINEAR_ACCELERATION):
+        x, y, z = struct.unpack_from('<3h', p, 4)
+        return "%0.6f, %d, %0.3f, %0.3f, %0.3f" % (
+            t, sample_id, q(x, 8), q(y, 8), q(z, 8))
+
+    if sensor_id == GYROSCOPE_CALIBRATED:
+        x, y, z = struct.unpack_from('<3h', p, 4)
+        return "%0.6f, %d, %0.3f, %0.3f, %0.3f" % (
+            t, sample_id, q(x, 9), q(y, 9), q(z, 9))
+
+    if sensor_id == MAGNETIC_FIELD_CALIBRATED:
+        x, y, z = struct.unpack_from('<3h', p, 4)
+        return "%0.6f, %d, %0.3f, %0.3f, %0.3f, %u" % (
+            t, sample_id, q(x, 4), q(y, 4), q(z, 4), status & 0x3)
+
+    if sensor_id in (ROTATION_VECTOR, GEOMAGNETIC_ROTATION_VECTOR):
+        i, j, k, r, acc = struct.unpack_from('<5h', p, 4)
+        return "%0.6f, %d, %0.3f, %0.3f, %0.3f, %0.3f, %0.3f" % (
+            t, sample_id, q(r, 14), q(i, 14), q(j, 14), q(k, 14), q(acc, 12))
+
+    if sensor_id == GAME_ROTATION_VECTOR:
+        i, j, k, r = struct.unpack_from('<4h', p, 4)
+        return "%0.6f, %d, %0.3f, %0.3f, %0.3f, %0.3f" % (
+            t, sample_id, q(r, 14), q(i, 14), q(j, 14), q(k, 14))
+
+    if sensor_id == CAMSYNC:
+        i, j, k, r = struct.unpack_from('<4h', p, 4)
+        return "%0.6f, %d, %0.3f, %0.3f, %0.3f, %0.3f, %u" % (
+            t, sample_id, q(r, 14), q(i, 14), q(j, 14), q(k, 14), status)
+
+    return None
+
+
+def main(argv):
+    if len(argv) < 2:
+        sys.stderr.write(__doc__)
+        return 1
+
+    with open(argv[1], 'rb') as f:
+        data = f.read()
+    out = open(argv[2], 'w') if len(argv) > 2 else sys.stdout
+
+    for sensor_id in sorted(HEADERS):
+        out.write("+%d %s\n" % (sensor_id, HEADERS[sensor_id]))
+
+    last_seq = {}     # last 32-bit sample id for each sensor
+    last_frame = {}   # last frame seq: of plain frames (None), or per sensor
+    dropped = 0
+    delta = DeltaDecoder()
+    delta_bytes = 0
+    delta_raw = 0
+    last_t_us = 0     # of the last frame, to extend pose timestamps
+    for sync1, sensor_id, frame_seq, body, flen in frames(data):
+        stream = None if sync1 in (SYNC1, POSE_SYNC1) else sensor_id & ~DELTA_KEY
+        if stream in last_frame:
+            dropped += (frame_seq - last_frame[stream] - 1) & 0xFF
+        last_frame[stream] = frame_seq
+
+        if sync1 == SYNC1:
+            t_us, = struct.unpack_from('<Q', body, 0)
+            payload = body[8:]
+        elif sync1 == POSE_SYNC1:
+            try:
+                t_us, payload = unpose(sensor_id, body, last_t_us)
+            except (struct.error, IndexError):
+                continue
+        else:
+            try:
+                frame = delta.decode(sensor_id, frame_seq, body)
+            except (struct.error, IndexError):
+                frame = None
+            if frame is None:
+                continue
+            sensor_id, t_us, payload = frame
+            delta_bytes += flen
+            # A plain frame would carry the same CRC as this one
+            delta_raw += HDR_LEN + len(payload) + flen - 5 - len(body)
+
+        last_t_us = t_us
+
+        # Extend 8-bit report sequence to a sample id, as printDsf() does
+        sample_id = 0
+        if sensor_id != GYRO_INTEGRATED_RV and len(payload) > 1:
+            prev = last_seq.get(sensor_id, 0)
+            sample_id = prev + ((payload[1] - (prev & 0xFF)) & 0xFF)
+            last_seq[sensor_id] = sample_id
+
+        try:
+            line = decode(sensor_id, t_us / 1000000.0, sample_id, payload)
+        except (struct.error, IndexError):
+            line = None
+        if line is None:
+            sys.stderr.write("Skipping sensor %d (len %d)\n" % (sensor_id, len(payload)))
+            continue
+        out.write(".%d %s\n" % (sensor_id, line))
+
+    if dropped:
+        sys.stderr.write("%d frames missing from capture\n" % dropped)
+    if delta.lost:
+        sys.stderr.write("%d delta frames skipped waiting for a keyframe\n" % delta.lost)
+    if delta_raw:
+        sys.stderr.write("Delta frames: %d bytes for %d as bin (%.1f%%)\n" % (
+            delta_bytes, delta_raw, 100.0 * delta_bytes / delta_raw))
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
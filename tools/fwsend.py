@@ -0,0 +1,158 @@
+#!/usr/bin/env python3
+#
+# Copyright 2015-16 Hillcrest Laboratories, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License and
+# any applicable agreements you may have with Hillcrest Laboratories, Inc.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+
+"""
+Send a BNO080 application image to the demo's "dfu" console command.
+
+Usage: fwsend.py [-b baud] [-r] /dev/ttyACM0 app.bin [Key=Value ...]
+
+Key=Value pairs are the image metadata, as for hcbin_pack.py, e.g.
+SW-Part-Number=1000-3608 (FW-Format defaults to BNO_V1, App-CRC32 is
+computed).  -r resumes a transfer whose link dropped: it doesn't type
+"dfu", just answers the requests the firmware is repeating.  The tty is
+put in raw mode at baud (CONSOLE_BAUD, 115200 by default; ignored over
+USB).  The script types "dfu", then answers the firmware's requests as
+Hillcrest/firmware_console.h describes, one frame per request, and
+exits with the DFU status.  Other console output is passed through.
+"""
+
+import getopt
+import os
+import struct
+import sys
+import termios
+import time
+import zlib
+
+SYNC = b'\xa5\x46'
+START_TIMEOUT_S = 5.0     # for the first request after "dfu"
+IDLE_TIMEOUT_S = 10.0     # between requests
+
+
+def crc16(data, crc=0xFFFF):
+    """CRC-16/CCITT, as computed by crc16() in Hillcrest/crc16.c."""
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            if crc & 0x8000:
+                crc = ((crc << 1) ^ 0x1021) & 0xFFFF
+            else:
+                crc = (crc << 1) & 0xFFFF
+    return crc
+
+
+def frame(seq, payload):
+    body = struct.pack('<BH', seq, len(payload)) + payload
+    return SYNC + body + struct.pack('<H', crc16(body))
+
+
+def open_tty(path, baud):
+    fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+    attr = termios.tcgetattr(fd)
+    attr[0] = 0                                     # iflag
+    attr[1] = 0                                     # oflag
+    attr[2] = termios.CS8 | termios.CREAD | termios.CLOCAL
+    attr[3] = 0                                     # lflag
+    speed = getattr(termios, 'B%d' % baud)
+    attr[4] = attr[5] = speed
+    attr[6][termios.VMIN] = 0
+    attr[6][termios.VTIME] = 1                      # 100ms read timeout
+    termios.tcsetattr(fd, termios.TCSANOW, attr)
+    termios.tcflush(fd, termios.TCIFLUSH)
+    return fd
+
+
+def lines(fd):
+    """Yield console lines as they arrive, or None after each quiet read."""
+    buf = b''
+    while True:
+        data = os.read(fd, 256)
+        if not data:
+            yield None
+            continue
+        buf += data
+        while b'\n' in buf:
+            line, buf = buf.split(b'\n', 1)
+            yield line.rstrip(b'\r').decode('ascii', 'replace')
+
+
+def main(argv):
+    opts, args = getopt.getopt(argv[1:], 'b:r')
+    baud = 115200
+    resume = False
+    for o, a in opts:
+        if o == '-b':
+            baud = int(a)
+        elif o == '-r':
+            resume = True
+    if len(args) < 2:
+        sys.stderr.write(__doc__)
+        return 1
+
+    with open(args[1], 'rb') as f:
+        image = f.read()
+    meta = {'FW-Format': 'BNO_V1', 'App-CRC32': '%08x' % (zlib.crc32(image) & 0xFFFFFFFF)}
+    for kv in args[2:]:
+        k, v = kv.split('=', 1)
+        meta[k] = v
+
+    fd = open_tty(args[0], baud)
+    if not resume:
+        os.write(fd, b'\rdfu\r')
+
+    timeout = START_TIMEOUT_S
+    last = time.time()
+    for line in lines(fd):
+        if line is None:
+            if time.time() - last > timeout:
+                sys.stderr.write("No request from the firmware for %.0f s\n" % timeout)
+                return 1
+            continue
+
+        if not line.startswith('#FW '):
+            print(line)
+            continue
+        last = time.time()
+        timeout = IDLE_TIMEOUT_S
+
+        words = line.split()
+        if words[1] == 'done':
+            status = int(words[2])
+            sys.stderr.write("DFU status %d\n" % status)
+            return 0 if status == 0 else 1
+
+        seq = int(words[1])
+        op = words[2]
+        if op == 'open':
+            reply = struct.pack('<I', len(image))
+        elif op == 'meta':
+            reply = meta.get(words[3], '').encode('ascii')
+        elif op == 'read':
+            offset, n = int(words[3]), int(words[4])
+            reply = image[offset:offset + n]
+        else:
+            sys.stderr.write("Unknown request: %s\n" % line)
+            continue
+        os.write(fd, frame(seq, reply))
+
+    return 1
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
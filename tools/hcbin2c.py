@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+#
+# Copyright 2015-16 Hillcrest Laboratories, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License and
+# any applicable agreements you may have with Hillcrest Laboratories, Inc.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+
+"""
+Generate Hillcrest/firmware_data.c from a BNO080 application image.
+
+Usage: hcbin2c.py [-p packet] app.bin out.c [Key=Value ...]
+
+Key=Value pairs become the image metadata, as for hcbin_pack.py
+(FW-Format defaults to BNO_V1, App-CRC32 is added).  The output defines
+firmwareData (see Hillcrest/firmware.h): the image as 32-bit words, so
+it is word aligned in flash, and a table of one CRC per packet-sized
+chunk (-p, 64 bytes by default, a multiple of 4) that firmware_verify()
+checks with the STM32 CRC unit.  The last chunk is padded with 0xFF.
+
+app.bin is the application image itself, as the vendor .hcbin file
+carries it, with its metadata given as Key=Value.
+"""
+
+import getopt
+import struct
+import sys
+import zlib
+
+STM32_CRC_POLY = 0x04C11DB7
+
+
+def stm32_crc(words):
+    """CRC of words as the STM32 CRC unit computes it: CRC-32/MPEG-2,
+    a 32-bit word at a time, most significant bit first."""
+    crc = 0xFFFFFFFF
+    for w in words:
+        crc ^= w
+        for _ in range(32):
+            if crc & 0x80000000:
+                crc = ((crc << 1) ^ STM32_CRC_POLY) & 0xFFFFFFFF
+            else:
+                crc = (crc << 1) & 0xFFFFFFFF
+    return crc
+
+
+def c_string(s):
+    return '"' + s.replace('\\', '\\\\').replace('"', '\\"') + '"'
+
+
+def write_c(f, meta, data, packet_len):
+    padded = data + b'\xff' * (-len(data) % packet_len)
+    words = struct.unpack('<%dI' % (len(padded) // 4), padded)
+    per_chunk = packet_len // 4
+    crcs = [stm32_crc(words[i:i + per_chunk]) for i in range(0, len(words), per_chunk)]
+
+    f.write("/* Generated by tools/hcbin2c.py, do not edit. */\n\n")
+    f.write('#include "firmware.h"\n\n')
+    f.write("/* Sorted by key, for firmwareMeta_find() */\n")
+    f.write("static const FirmwareMeta_t meta[] = {\n")
+    for key, value in meta:
+        f.write("    {%s, %s},\n" % (c_string(key), c_string(value)))
+    f.write("};\n\n")
+    f.write("static const uint32_t words[] = {\n")
+    for i in range(0, len(words), 8):
+        f.write("    " + ", ".join("0x%08x" % w for w in words[i:i + 8]) + ",\n")
+    f.write("};\n\n")
+    f.write("static const uint32_t chunkCrc[] = {\n")
+    for i in range(0, len(crcs), 8):
+        f.write("    " + ", ".join("0x%08x" % c for c in crcs[i:i + 8]) + ",\n")
+    f.write("};\n\n")
+    f.write("const FirmwareData_t firmwareData = {\n")
+    f.write("    meta, sizeof(meta) / sizeof(meta[0]),\n")
+    f.write("    words, %d,\n" % len(data))
+    f.write("    %d,\n" % packet_len)
+    f.write("    chunkCrc, sizeof(chunkCrc) / sizeof(chunkCrc[0])\n")
+    f.write("};\n")
+
+
+def main(argv):
+    try:
+        opts, args = getopt.getopt(argv[1:], 'p:')
+    except getopt.GetoptError:
+        sys.stderr.write(__doc__)
+        return 1
+    packet_len = 64
+    for opt, val in opts:
+        if opt == '-p':
+            packet_len = int(val)
+    if len(args) < 2 or packet_len <= 0 or packet_len % 4:
+        sys.stderr.write(__doc__)
+        return 1
+
+    meta = []
+    for kv in args[2:]:
+        key, sep, value = kv.partition('=')
+        if not sep:
+            sys.stderr.write("Bad metadata '%s', expected Key=Value\n" % kv)
+            return 1
+        meta.append((key, value))
+
+    with open(args[0], 'rb') as f:
+        data = f.read()
+    if not data:
+        sys.stderr.write("Empty image\n")
+        return 1
+    keys = [key for key, value in meta]
+    if 'FW-Format' not in keys:
+        meta.append(('FW-Format', 'BNO_V1'))
+    if 'App-CRC32' not in keys:
+        meta.append(('App-CRC32', '%08x' % (zlib.crc32(data) & 0xFFFFFFFF)))
+    # firmwareMeta_find() binary searches: ASCII order is strcmp order
+    meta.sort()
+
+    with open(args[1], 'w') as f:
+        write_c(f, meta, data, packet_len)
+
+    sys.stderr.write("%d bytes, %d chunks of %d\n" % (
+        len(data), (len(data) + packet_len - 1) // packet_len, packet_len))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,201 @@
+#!/usr/bin/env python3
+#
+# Copyright 2015-16 Hillcrest Laboratories, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License and
+# any applicable agreements you may have with Hillcrest Laboratories, Inc.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+
+"""
+Compress a BNO080 application image for firmware_hs.c.
+
+Usage: hcbin_pack.py [-w bits] [-l bits] app.bin out.c [Key=Value ...]
+
+The output is heatshrink's LZSS bitstream (window 2^w, lookahead 2^l),
+wrapped in a C file defining firmwareHsImage (see Hillcrest/firmware_hs.h).
+Key=Value pairs become the image metadata, e.g. SW-Part-Number=1000-3608.
+FW-Format defaults to BNO_V1, and App-CRC32 (the CRC-32 of app.bin, which
+firmware_check.c verifies before DFU) is added.
+The stream is decompressed again before writing, to check it.
+"""
+
+import getopt
+import sys
+import zlib
+
+MIN_MATCH = 2     # a backref of 2 already beats two literals for w+l <= 16
+CHAIN_LIMIT = 256  # candidates tried per position
+
+
+class BitWriter(object):
+    def __init__(self):
+        self.out = bytearray()
+        self.cur = 0
+        self.nbits = 0
+
+    def put(self, value, count):
+        for i in range(count - 1, -1, -1):
+            self.cur = (self.cur << 1) | ((value >> i) & 1)
+            self.nbits += 1
+            if self.nbits == 8:
+                self.out.append(self.cur)
+                self.cur = 0
+                self.nbits = 0
+
+    def finish(self):
+        if self.nbits:
+            self.out.append(self.cur << (8 - self.nbits))
+        return bytes(self.out)
+
+
+def compress(data, w, l):
+    window = 1 << w
+    max_len = 1 << l
+    bits = BitWriter()
+    heads = {}     # 2-byte prefix -> positions, most recent last
+    pos = 0
+    n = len(data)
+    while pos < n:
+        best_len = 0
+        best_dist = 0
+        if pos + MIN_MATCH <= n:
+            key = data[pos:pos + 2]
+            cands = heads.get(key, [])
+            limit = min(max_len, n - pos)
+            for cand in reversed(cands[-CHAIN_LIMIT:]):
+                dist = pos - cand
+                if dist > window:
+                    break
+                k = 0
+                while k < limit and data[cand + k] == data[pos + k]:
+                    k += 1
+                if k > best_len:
+                    best_len, best_dist = k, dist
+                    if k == limit:
+                        break
+        if best_len >= MIN_MATCH:
+            bits.put(0, 1)
+            bits.put(best_dist - 1, w)
+            bits.put(best_len - 1, l)
+            step = best_len
+        else:
+            bits.put(1, 1)
+            bits.put(data[pos], 8)
+            step = 1
+        for p in range(pos, pos + step):
+            if p + 2 <= n:
+                heads.setdefault(data[p:p + 2], []).append(p)
+        pos += step
+    return bits.finish()
+
+
+def decompress(stream, w, l, app_len):
+    """Same algorithm as firmware_hs.c, for checking."""
+    out = bytearray()
+    state = {'pos': 0, 'mask': 0, 'byte': 0}
+
+    def get(count):
+        v = 0
+        for _ in range(count):
+            if state['mask'] == 0:
+                state['byte'] = stream[state['pos']]
+                state['pos'] += 1
+                state['mask'] = 0x80
+            v = (v << 1) | (1 if state['byte'] & state['mask'] else 0)
+            state['mask'] >>= 1
+        return v
+
+    while len(out) < app_len:
+        if get(1):
+            out.append(get(8))
+        else:
+            dist = get(w) + 1
+            count = get(l) + 1
+            for _ in range(count):
+                out.append(out[-dist])
+    return bytes(out[:app_len])
+
+
+def c_string(s):
+    return '"' + s.replace('\\', '\\\\').replace('"', '\\"') + '"'
+
+
+def write_c(f, meta, app_len, stream, w, l):
+    f.write("/* Generated by tools/hcbin_pack.py, do not edit. */\n\n")
+    f.write('#include "firmware_hs.h"\n\n')
+    f.write("static const FirmwareHsMeta_t meta[] = {\n")
+    for key, value in meta:
+        f.write("    {%s, %s},\n" % (c_string(key), c_string(value)))
+    f.write("};\n\n")
+    f.write("static const uint8_t data[] = {\n")
+    for i in range(0, len(stream), 16):
+        f.write("    " + ", ".join("0x%02x" % b for b in stream[i:i + 16]) + ",\n")
+    f.write("};\n\n")
+    f.write("const FirmwareHsImage_t firmwareHsImage = {\n")
+    f.write("    meta, sizeof(meta) / sizeof(meta[0]),\n")
+    f.write("    %d,\n" % app_len)
+    f.write("    data, sizeof(data),\n")
+    f.write("    %d, %d\n" % (w, l))
+    f.write("};\n")
+
+
+def main(argv):
+    try:
+        opts, args = getopt.getopt(argv[1:], 'w:l:')
+    except getopt.GetoptError:
+        sys.stderr.write(__doc__)
+        return 1
+    w, l = 10, 5
+    for opt, val in opts:
+        if opt == '-w':
+            w = int(val)
+        elif opt == '-l':
+            l = int(val)
+    if len(args) < 2 or not (4 <= w <= 15) or not (3 <= l < w):
+        sys.stderr.write(__doc__)
+        return 1
+
+    meta = []
+    for kv in args[2:]:
+        key, sep, value = kv.partition('=')
+        if not sep:
+            sys.stderr.write("Bad metadata '%s', expected Key=Value\n" % kv)
+            return 1
+        meta.append((key, value))
+
+    with open(args[0], 'rb') as f:
+        data = f.read()
+    keys = [key for key, value in meta]
+    if 'FW-Format' not in keys:
+        meta.insert(0, ('FW-Format', 'BNO_V1'))
+    if 'App-CRC32' not in keys:
+        meta.append(('App-CRC32', '%08x' % (zlib.crc32(data) & 0xFFFFFFFF)))
+    # firmwareMeta_find() binary searches: ASCII order is strcmp order
+    meta.sort()
+
+    stream = compress(data, w, l)
+    if decompress(stream, w, l, len(data)) != data:
+        sys.stderr.write("Round trip check failed\n")
+        return 1
+
+    with open(args[1], 'w') as f:
+        write_c(f, meta, len(data), stream, w, l)
+
+    sys.stderr.write("%d -> %d bytes (%.1f%%), window %d bytes\n" % (
+        len(data), len(stream), 100.0 * len(stream) / max(len(data), 1), 1 << w))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,361 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host simulation build: benchmark of the Hillcrest sensor path.
+//
+// Feeds sensor events through the same stages the sensor task runs on
+// the target and reports throughput and the cost of each stage:
+//
+//   shtp      SHTP reassembly and sh2 report parsing (replay only)
+//   decode    sensorFix_decode()
+//   dispatch  hub clock correction and dispatch to the subscribers
+//             (statistics, GIRV prediction), less the decode it repeats
+//   output    sensorOutput_event() in the selected format
+//
+// Events come either from a capture replayed through the sh2 library
+// (see host_hal.h) or, with -s, are generated here.  Report output is
+// written to stdout, the benchmark results to stderr, so
+//
+//   ./bench -o dsf capture.bin > /dev/null
+//
+// measures formatting without the cost of a terminal.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+
+#include "sh2.h"
+#include "sh2_err.h"
+#include "sensor_fix.h"
+#include "sensor_dispatch.h"
+#include "sensor_output.h"
+#include "sensor_stats.h"
+#include "hub_clock.h"
+#include "girv_predict.h"
+#include "host_hal.h"
+
+// Synthetic events per sensor if -n isn't given
+#define SYNTH_EVENTS (100000)
+
+// Synthetic report rate if -s is given without a usable rate
+#define SYNTH_HZ (400)
+
+// ------------------------------------------------------------------------
+// Private types
+
+typedef enum {
+    STAGE_DECODE,
+    STAGE_DISPATCH,
+    STAGE_OUTPUT,
+    STAGE_COUNT
+} Stage_t;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static void usage(void);
+static void eventHandler(void *cookie, sh2_AsyncEvent_t *pEvent);
+static void sensorHandler(void *cookie, sh2_SensorEvent_t *pEvent);
+static void runEvent(sh2_SensorEvent_t *pEvent, uint64_t intn_uS);
+static void synthesize(unsigned hz, unsigned count);
+static void makeReport(sh2_SensorEvent_t *pEvent, uint8_t sensorId, uint8_t seq,
+                       uint64_t t_uS, const int16_t *data, unsigned words);
+static void report(uint64_t wallNs, uint64_t shtpNs);
+static uint64_t nowNs(void);
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static const char *stageName[STAGE_COUNT] = {"decode", "dispatch", "output"};
+
+static bool outputEnabled = true;
+static uint64_t stageNs[STAGE_COUNT];
+static uint64_t handlerNs;
+static uint32_t events;
+static uint32_t decodeErrors;
+
+// ------------------------------------------------------------------------
+// Public API
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    unsigned loops = 1;
+    unsigned synthHz = 0;
+    unsigned synthCount = SYNTH_EVENTS;
+    float speed = 0;
+    uint64_t start;
+
+    while ((opt = getopt(argc, argv, "o:x:l:s:n:")) != -1) {
+        switch (opt) {
+            case 'o':
+                if (strcmp(optarg, "text") == 0) {
+                    sensorOutput_setMode(OUTPUT_TEXT);
+                }
+                else if (strcmp(optarg, "dsf") == 0) {
+                    sensorOutput_setMode(OUTPUT_DSF);
+                }
+                else if (strcmp(optarg, "bin") == 0) {
+                    sensorOutput_setMode(OUTPUT_BIN);
+                }
+                else if (strcmp(optarg, "delta") == 0) {
+                    sensorOutput_setMode(OUTPUT_DELTA);
+                }
+                else if (strcmp(optarg, "pose") == 0) {
+                    sensorOutput_setMode(OUTPUT_POSE);
+                }
+                else if (strcmp(optarg, "none") == 0) {
+                    outputEnabled = false;
+                }
+                else {
+                    usage();
+                    return 1;
+                }
+                break;
+            case 'x':
+                speed = atof(optarg);
+                break;
+            case 'l':
+                loops = atoi(optarg);
+                break;
+            case 's':
+                synthHz = atoi(optarg);
+                if (synthHz == 0) {
+                    synthHz = SYNTH_HZ;
+                }
+                break;
+            case 'n':
+                synthCount = atoi(optarg);
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+    if ((synthHz == 0) && (optind >= argc)) {
+        usage();
+        return 1;
+    }
+
+    // Same subscribers as the firmware, less the console output, which
+    // is called (and timed) separately
+    sensorDispatch_init(NULL);
+    hubClock_init();
+    sensorStats_init();
+    girvPredict_init();
+
+    if (synthHz != 0) {
+        start = nowNs();
+        synthesize(synthHz, synthCount);
+        report(nowNs() - start, 0);
+        return 0;
+    }
+
+    if (hostHal_open(argv[optind]) != SH2_OK) {
+        return 1;
+    }
+    hostHal_setSpeed(speed);
+
+    sh2_initialize(eventHandler, NULL);
+    sh2_setSensorCallback(sensorHandler, NULL);
+
+    start = nowNs();
+    if (hostHal_replay(loops) < 0) {
+        return 1;
+    }
+    report(nowNs() - start, hostHal_rxNs() - handlerNs);
+
+    return 0;
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "Usage: bench [-o text|dsf|bin|delta|pose|none] [-x speed] [-l loops] capture.bin\n"
+            "       bench [-o text|dsf|bin|delta|pose|none] -s hz [-n events]\n"
+            "  -o  report output format (default text)\n"
+            "  -x  replay speed relative to the capture, 0 = as fast as possible\n"
+            "  -l  replay the capture this many times\n"
+            "  -s  generate accelerometer, rotation vector and GIRV reports at hz\n"
+            "  -n  events per generated sensor (default %u)\n",
+            SYNTH_EVENTS);
+}
+
+static void eventHandler(void *cookie, sh2_AsyncEvent_t *pEvent)
+{
+    if (pEvent->eventId == SH2_RESET) {
+        fprintf(stderr, "SH2 Reset (in capture).\n");
+        sensorStats_restart();
+        hubClock_restart();
+    }
+}
+
+// Called by the sh2 library from within the replayed receive callback
+static void sensorHandler(void *cookie, sh2_SensorEvent_t *pEvent)
+{
+    uint64_t start = nowNs();
+
+    runEvent(pEvent, hostHal_rxUs());
+
+    handlerNs += nowNs() - start;
+}
+
+// The sensor task's work for one event, stage by stage
+static void runEvent(sh2_SensorEvent_t *pEvent, uint64_t intn_uS)
+{
+    SensorFix_t fix;
+    uint64_t t0, t1, t2, t3;
+    uint64_t decodeNs;
+
+    t0 = nowNs();
+    if (sensorFix_decode(&fix, pEvent) != SH2_OK) {
+        decodeErrors++;
+    }
+    t1 = nowNs();
+    hubClock_correct(pEvent, intn_uS);
+    sensorDispatch_publish(pEvent);
+    t2 = nowNs();
+    if (outputEnabled) {
+        sensorOutput_event(pEvent, &fix);
+    }
+    t3 = nowNs();
+
+    // sensorDispatch_publish() decodes the event once itself
+    decodeNs = t1 - t0;
+    stageNs[STAGE_DECODE] += decodeNs;
+    stageNs[STAGE_DISPATCH] += (t2 - t1 > decodeNs) ? (t2 - t1 - decodeNs) : 0;
+    stageNs[STAGE_OUTPUT] += t3 - t2;
+    events++;
+}
+
+// Accelerometer, rotation vector and GIRV reports of a slow rotation
+// about z, all at the same rate, as the hub would interleave them.
+static void synthesize(unsigned hz, unsigned count)
+{
+    sh2_SensorEvent_t event;
+    uint32_t interval_us = 1000000 / hz;
+    uint64_t t_uS = 0;
+    int16_t data[7];
+
+    sensorStats_setInterval(SH2_ACCELEROMETER, interval_us);
+    sensorStats_setInterval(SH2_ROTATION_VECTOR, interval_us);
+    sensorStats_setInterval(SH2_GYRO_INTEGRATED_RV, interval_us);
+
+    for (unsigned n = 0; n < count; n++) {
+        float half = 0.5f * (float)t_uS * 1.0e-6f;   // 1 rad/s about z
+        int16_t k = (int16_t)(sinf(half) * (1 << 14));
+        int16_t real = (int16_t)(cosf(half) * (1 << 14));
+
+        // Accelerometer, gravity only, Q8 m/s^2
+        data[0] = 0;
+        data[1] = 0;
+        data[2] = (int16_t)(9.81f * (1 << 8));
+        makeReport(&event, SH2_ACCELEROMETER, n, t_uS, data, 3);
+        runEvent(&event, t_uS);
+
+        // Rotation vector i, j, k, real (Q14) and accuracy (Q12)
+        data[0] = 0;
+        data[1] = 0;
+        data[2] = k;
+        data[3] = real;
+        data[4] = (int16_t)(0.1f * (1 << 12));
+        makeReport(&event, SH2_ROTATION_VECTOR, n, t_uS, data, 5);
+        runEvent(&event, t_uS);
+
+        // GIRV i, j, k, real (Q14) and angular velocity (Q10)
+        data[4] = 0;
+        data[5] = 0;
+        data[6] = 1 << 10;
+        makeReport(&event, SH2_GYRO_INTEGRATED_RV, n, t_uS, data, 7);
+        runEvent(&event, t_uS);
+
+        t_uS += interval_us;
+    }
+}
+
+// Build an event as the sh2 library delivers it.  GIRV reports carry no
+// report id/sequence/status/delay header.
+static void makeReport(sh2_SensorEvent_t *pEvent, uint8_t sensorId, uint8_t seq,
+                       uint64_t t_uS, const int16_t *data, unsigned words)
+{
+    uint8_t *p = pEvent->report;
+
+    memset(pEvent, 0, sizeof(*pEvent));
+    pEvent->timestamp_uS = t_uS;
+    pEvent->reportId = sensorId;
+
+    if (sensorId != SH2_GYRO_INTEGRATED_RV) {
+        *p++ = sensorId;
+        *p++ = seq;
+        *p++ = 3;   // status: high accuracy
+        *p++ = 0;   // delay
+    }
+    for (unsigned n = 0; n < words; n++) {
+        *p++ = data[n] & 0xFF;
+        *p++ = (data[n] >> 8) & 0xFF;
+    }
+    pEvent->len = p - pEvent->report;
+}
+
+static void report(uint64_t wallNs, uint64_t shtpNs)
+{
+    uint64_t totalNs = shtpNs;
+
+    fflush(stdout);
+
+    for (int n = 0; n < STAGE_COUNT; n++) {
+        totalNs += stageNs[n];
+    }
+
+    fprintf(stderr, "%u events in %.3f s: %.0f events/s",
+            events, wallNs * 1.0e-9, (wallNs > 0) ? events * 1.0e9 / wallNs : 0.0);
+    if (totalNs > 0) {
+        fprintf(stderr, " (%.0f events/s of CPU in the sensor path)", events * 1.0e9 / totalNs);
+    }
+    fprintf(stderr, "\n");
+    if (decodeErrors) {
+        fprintf(stderr, "%u events not decoded\n", decodeErrors);
+    }
+    if (events == 0) {
+        return;
+    }
+
+    fprintf(stderr, "%-10s %10s\n", "stage", "ns/event");
+    if (shtpNs) {
+        fprintf(stderr, "%-10s %10.1f\n", "shtp", (double)shtpNs / events);
+    }
+    for (int n = 0; n < STAGE_COUNT; n++) {
+        fprintf(stderr, "%-10s %10.1f\n", stageName[n], (double)stageNs[n] / events);
+    }
+    fprintf(stderr, "%-10s %10.1f\n", "total", (double)totalNs / events);
+    fprintf(stderr, "hub clock skew %d ppm\n", (int)hubClock_skewPpm());
+}
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
@@ -0,0 +1,205 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host simulation build: replay sh2_hal backend.  See host_hal.h.
+
+#include "host_hal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "sh2_hal.h"
+#include "sh2_err.h"
+
+// Record header: t_uS and len
+#define REC_HDR_LEN (6)
+
+// ------------------------------------------------------------------------
+// Private state variables
+
+static uint8_t *capture;
+static long captureLen;
+
+static float speed;
+
+static sh2_rxCallback_t *onRx;
+static void *onRxCookie;
+
+static uint32_t rxUs;
+static uint64_t rxNs;
+
+// ------------------------------------------------------------------------
+// Forward declarations
+
+static uint64_t nowNs(void);
+static uint32_t read32(const uint8_t *p);
+
+// ------------------------------------------------------------------------
+// Public API
+
+int hostHal_open(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == 0) {
+        printf("Can't open %s\n", path);
+        return SH2_ERR;
+    }
+
+    fseek(f, 0, SEEK_END);
+    captureLen = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    capture = malloc(captureLen > 0 ? captureLen : 1);
+    if ((capture == 0) || (fread(capture, 1, captureLen, f) != (size_t)captureLen)) {
+        printf("Can't read %s\n", path);
+        fclose(f);
+        return SH2_ERR;
+    }
+    fclose(f);
+
+    return SH2_OK;
+}
+
+void hostHal_setSpeed(float s)
+{
+    speed = s;
+}
+
+int hostHal_replay(unsigned loops)
+{
+    int records = 0;
+    uint32_t loopOffset_us = 0;
+    uint32_t last_us = 0;
+    uint64_t startNs = nowNs();
+    bool first = true;
+    uint32_t first_us = 0;
+
+    if (onRx == 0) {
+        printf("No receive callback: sh2_hal_reset() wasn't called\n");
+        return SH2_ERR;
+    }
+
+    for (unsigned loop = 0; loop < loops; loop++) {
+        long pos = 0;
+        uint32_t loopStart_us = 0;
+
+        while (pos + REC_HDR_LEN <= captureLen) {
+            uint32_t t_us = read32(capture + pos);
+            uint16_t len = capture[pos+4] | (capture[pos+5] << 8);
+
+            if (pos + REC_HDR_LEN + len > captureLen) {
+                printf("Truncated record at offset %ld\n", pos);
+                break;
+            }
+            if (pos == 0) {
+                loopStart_us = t_us;
+            }
+
+            // Continue the timeline across loops
+            rxUs = t_us - loopStart_us + loopOffset_us;
+            if (first) {
+                first = false;
+                first_us = rxUs;
+            }
+            last_us = rxUs;
+
+            if (speed > 0) {
+                // Hold each record until its (scaled) time comes round
+                uint64_t due = startNs + (uint64_t)((rxUs - first_us) * 1000.0 / speed);
+                uint64_t now = nowNs();
+                if (due > now) {
+                    struct timespec ts;
+                    ts.tv_sec = (due - now) / 1000000000;
+                    ts.tv_nsec = (due - now) % 1000000000;
+                    nanosleep(&ts, 0);
+                }
+            }
+
+            uint64_t t0 = nowNs();
+            onRx(onRxCookie, capture + pos + REC_HDR_LEN, len, rxUs);
+            rxNs += nowNs() - t0;
+
+            records++;
+            pos += REC_HDR_LEN + len;
+        }
+
+        // Leave a nominal 1ms between the end of one loop and the next
+        loopOffset_us = last_us + 1000;
+    }
+
+    return records;
+}
+
+uint32_t hostHal_rxUs(void)
+{
+    return rxUs;
+}
+
+uint64_t hostHal_rxNs(void)
+{
+    return rxNs;
+}
+
+// ------------------------------------------------------------------------
+// sh2_hal API
+
+int sh2_hal_reset(bool dfuMode, sh2_rxCallback_t *callback, void *cookie)
+{
+    onRx = callback;
+    onRxCookie = cookie;
+
+    return SH2_OK;
+}
+
+int sh2_hal_tx(uint8_t *pData, uint32_t len)
+{
+    // Nobody is listening
+    return SH2_OK;
+}
+
+int sh2_hal_rx(uint8_t *pData, uint32_t len)
+{
+    return SH2_OK;
+}
+
+int sh2_hal_block(void)
+{
+    return SH2_OK;
+}
+
+int sh2_hal_unblock(void)
+{
+    return SH2_OK;
+}
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static uint64_t nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t read32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host simulation build: an sh2_hal backend that replays a recorded SHTP
+// byte stream instead of talking to a hub.
+//
+// A capture is a sequence of records, one per bus transfer as the HAL
+// delivered it to SHTP:
+//
+//   uint32 t_uS    INTN time of the transfer (little endian)
+//   uint16 len     bytes that follow (little endian)
+//   uint8  data[len]
+//
+// Transmits from the sh2 library are accepted and discarded, so only
+// traffic the hub sends unprompted (the advertisement, sensor reports)
+// is meaningful in a replay.
+
+#ifndef HOST_HAL_H
+#define HOST_HAL_H
+
+#include <stdint.h>
+
+// Load a capture file.  Returns SH2_OK or SH2_ERR.
+int hostHal_open(const char *path);
+
+// Replay speed relative to the recorded timing.  0 (the default) delivers
+// records as fast as possible.
+void hostHal_setSpeed(float speed);
+
+// Deliver the whole capture to the receive callback registered by
+// sh2_hal_reset(), loops times over.  Timestamps keep increasing from one
+// loop to the next.  Returns the number of records delivered, or SH2_ERR
+// if no callback was registered.
+int hostHal_replay(unsigned loops);
+
+// INTN time of the record being delivered
+uint32_t hostHal_rxUs(void);
+
+// Time spent inside the receive callback, in nanoseconds, over all
+// replays so far.
+uint64_t hostHal_rxNs(void);
+
+#endif
@@ -0,0 +1,123 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and 
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Host simulation build: stand-ins for the firmware services the
+// Hillcrest sensor path links against (shell, sysstats, timebase,
+// console, itm).
+
+#include <stdio.h>
+#include <time.h>
+
+#include "FreeRTOS.h"
+#include "queue.h"
+#include "task.h"
+#include "shell.h"
+#include "sysstats.h"
+#include "timebase.h"
+#include "console.h"
+#include "itm.h"
+
+// ------------------------------------------------------------------------
+// Public API
+
+int shell_addCommand(const char *name, const char *help, ShellCmdFn_t *fn)
+{
+    // No shell on the host
+    return 0;
+}
+
+int sysstats_addQueue(const char *name, QueueHandle_t queue, unsigned len)
+{
+    return 0;
+}
+
+int sysstats_addCounter(const char *name, const uint32_t *counter)
+{
+    return 0;
+}
+
+int sysstats_addMemory(const char *name, unsigned bytes)
+{
+    return 0;
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *pItem, TickType_t wait)
+{
+    return pdFAIL;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    return 0;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue)
+{
+    return 0;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(timebase_getUs() / 1000);
+}
+
+uint64_t timebase_getUs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+bool itm_routed(ItmPort_t port)
+{
+    // No SWO on the host, everything goes to stdout
+    return false;
+}
+
+void itm_write(ItmPort_t port, const void *pData, size_t len)
+{
+}
+
+size_t console_writeRaw(const uint8_t *buf, size_t len)
+{
+    // Same stream as the text output, so captures look like the UART's
+    return fwrite(buf, 1, len, stdout);
+}
+
+size_t console_write(const char *buf, size_t len)
+{
+    return fwrite(buf, 1, len, stdout);
+}
+
+unsigned console_txFill(void)
+{
+    // stdout never backs up into the sensor path
+    return 0;
+}
+
+#if CONSOLE_TX_IN_PLACE
+char *console_reserve(size_t len)
+{
+    // No tx buffer to format into: lines go through console_write()
+    return NULL;
+}
+
+void console_commit(size_t len)
+{
+}
+#endif
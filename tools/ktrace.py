@@ -0,0 +1,222 @@
+#!/usr/bin/env python3
+#
+# Copyright 2015-16 Hillcrest Laboratories, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License and
+# any applicable agreements you may have with Hillcrest Laboratories, Inc.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+"""
+Convert a "ktrace dump" from the demo console to Chrome trace JSON.
+
+Usage: ktrace.py console.log trace.json
+
+Open trace.json in chrome://tracing or https://ui.perfetto.dev: each task
+and each interrupt gets a track, with a slice for every time it ran.
+Tasks made ready, queue and semaphore operations and priority
+inheritance are marked on the track that caused them.  A summary of run
+time and ready-to-running delay per task goes to stderr.
+
+The last dump in the capture is used; console text and BIN_OUTPUT frames
+around it are skipped.  Event ids must match Hillcrest/rtos_trace.h.
+"""
+
+import json
+import sys
+
+SWITCH_IN = 1
+SWITCH_OUT = 2
+READY = 3
+ISR_ENTER = 4
+ISR_EXIT = 5
+QUEUE_SEND = 6
+QUEUE_RECEIVE = 7
+QUEUE_SEND_ISR = 8
+QUEUE_RECEIVE_ISR = 9
+QUEUE_BLOCK_SEND = 10
+QUEUE_BLOCK_RECEIVE = 11
+PRIO_INHERIT = 12
+
+QUEUE_EVENTS = {
+    QUEUE_SEND: 'send',
+    QUEUE_RECEIVE: 'receive',
+    QUEUE_SEND_ISR: 'send',
+    QUEUE_RECEIVE_ISR: 'receive',
+    QUEUE_BLOCK_SEND: 'block on send',
+    QUEUE_BLOCK_RECEIVE: 'block on receive',
+}
+
+# STM32F401 IRQs with handlers in Src/stm32f4xx_it.c
+IRQ_NAMES = {
+    9: 'EXTI3 (console wake)',
+    11: 'DMA1_Stream0 (I2C rx)',
+    16: 'DMA1_Stream5 (console rx)',
+    17: 'DMA1_Stream6 (console tx)',
+    28: 'TIM2 (timebase)',
+    31: 'I2C1_EV',
+    32: 'I2C1_ER',
+    35: 'SPI1',
+    37: 'USART1 (data UART)',
+    38: 'USART2 (console)',
+    40: 'EXTI15_10 (INTN)',
+    47: 'DMA1_Stream7 (I2C tx)',
+    56: 'DMA2_Stream0 (SPI rx)',
+    59: 'DMA2_Stream3 (SPI tx)',
+    67: 'OTG_FS (USB)',
+    70: 'DMA2_Stream7 (data UART tx)',
+}
+
+# Track ids for interrupts, clear of task numbers
+ISR_TID_BASE = 1000
+
+
+def last_dump(text):
+    """Return (hclk, tasks, records) from the last complete dump."""
+    lines = text.splitlines()
+    begin = None
+    dump = None
+    for n, line in enumerate(lines):
+        if line.startswith('ktrace begin'):
+            begin = n
+        elif line.startswith('ktrace end') and begin is not None:
+            dump = lines[begin:n]
+            begin = None
+    if dump is None:
+        raise ValueError("no complete ktrace dump found")
+
+    hclk = int(dump[0].split()[2])
+    tasks = {}
+    records = []
+    for line in dump[1:]:
+        fields = line.split(None, 3)
+        if fields and fields[0] == 'task' and len(fields) == 4:
+            tasks[int(fields[1])] = (fields[3].strip(), int(fields[2]))
+        elif len(fields) == 2:
+            records.append((int(fields[0], 16), int(fields[1], 16)))
+    return hclk, tasks, records
+
+
+def convert(hclk, tasks, records):
+    """Return the trace events, per-task statistics and the span in us."""
+    events = []
+    stats = {}
+    t_cycles = 0
+    last = None
+    current = None      # task running, and since when
+    isrs = []           # interrupts active, innermost last
+    ready = {}          # task number: time made ready
+
+    def task_stats(task):
+        return stats.setdefault(task, {'runs': 0, 'run_us': 0.0, 'delays': []})
+
+    for cycles, word in records:
+        # Unwrap the 32-bit cycle count into microseconds
+        if last is not None:
+            t_cycles += (cycles - last) & 0xFFFFFFFF
+        last = cycles
+        t = t_cycles * 1e6 / hclk
+        event = word >> 24
+        arg = word & 0xFFFFFF
+
+        if event == SWITCH_IN:
+            current = (arg, t)
+            if arg in ready:
+                task_stats(arg)['delays'].append(t - ready.pop(arg))
+        elif event == SWITCH_OUT:
+            if current is not None and current[0] == arg:
+                events.append({'name': 'run', 'ph': 'X', 'pid': 0, 'tid': arg,
+                               'ts': current[1], 'dur': t - current[1]})
+                s = task_stats(arg)
+                s['runs'] += 1
+                s['run_us'] += t - current[1]
+            current = None
+        elif event == READY:
+            ready.setdefault(arg, t)
+            tid = ISR_TID_BASE + isrs[-1][0] if isrs else (current[0] if current else arg)
+            name = tasks.get(arg, ('task %d' % arg,))[0]
+            events.append({'name': 'ready ' + name, 'ph': 'i', 's': 't',
+                           'pid': 0, 'tid': tid, 'ts': t})
+        elif event == ISR_ENTER:
+            isrs.append((arg, t))
+        elif event == ISR_EXIT:
+            if isrs and isrs[-1][0] == arg:
+                irq, start = isrs.pop()
+                events.append({'name': 'isr', 'ph': 'X', 'pid': 0,
+                               'tid': ISR_TID_BASE + irq, 'ts': start, 'dur': t - start})
+        elif event in QUEUE_EVENTS:
+            if event in (QUEUE_SEND_ISR, QUEUE_RECEIVE_ISR) and isrs:
+                tid = ISR_TID_BASE + isrs[-1][0]
+            elif current is not None:
+                tid = current[0]
+            else:
+                continue
+            events.append({'name': '%s 0x%06x' % (QUEUE_EVENTS[event], arg),
+                           'ph': 'i', 's': 't', 'pid': 0, 'tid': tid, 'ts': t})
+        elif event == PRIO_INHERIT:
+            events.append({'name': 'inherits priority %d' % (arg >> 16), 'ph': 'i',
+                           's': 't', 'pid': 0, 'tid': arg & 0xFFFF, 'ts': t})
+
+    # Track names, tasks by priority then interrupts
+    events.append({'name': 'process_name', 'ph': 'M', 'pid': 0,
+                   'args': {'name': 'sh2-demo'}})
+    tids = set(e['tid'] for e in events if 'tid' in e)
+    for tid in sorted(tids):
+        if tid >= ISR_TID_BASE:
+            irq = tid - ISR_TID_BASE
+            name = 'IRQ %d %s' % (irq, IRQ_NAMES.get(irq, ''))
+            order = -1000 + irq
+        else:
+            name, prio = tasks.get(tid, ('task %d' % tid, 0))
+            name = '%s (prio %d)' % (name, prio)
+            order = -prio
+        events.append({'name': 'thread_name', 'ph': 'M', 'pid': 0, 'tid': tid,
+                       'args': {'name': name.strip()}})
+        events.append({'name': 'thread_sort_index', 'ph': 'M', 'pid': 0, 'tid': tid,
+                       'args': {'sort_index': order}})
+
+    return events, stats, t_cycles * 1e6 / hclk
+
+
+def main(argv):
+    if len(argv) < 3:
+        sys.stderr.write(__doc__)
+        return 1
+
+    with open(argv[1], 'rb') as f:
+        text = f.read().decode('ascii', errors='replace')
+
+    try:
+        hclk, tasks, records = last_dump(text)
+    except ValueError as e:
+        sys.stderr.write("%s: %s\n" % (argv[1], e))
+        return 1
+
+    events, stats, span = convert(hclk, tasks, records)
+    with open(argv[2], 'w') as out:
+        json.dump({'traceEvents': events, 'displayTimeUnit': 'ns'}, out)
+
+    sys.stderr.write("%d records over %.0f us\n" % (len(records), span))
+    sys.stderr.write("  task              runs   run %    ready->run us: mean    max\n")
+    for task in sorted(stats, key=lambda n: -tasks.get(n, ('', 0))[1]):
+        s = stats[task]
+        delays = s['delays']
+        mean = sum(delays) / len(delays) if delays else 0.0
+        sys.stderr.write("  %-16s %5d %6.1f %20.1f %6.1f\n" % (
+            tasks.get(task, ('task %d' % task,))[0], s['runs'],
+            100.0 * s['run_us'] / span if span else 0.0,
+            mean, max(delays) if delays else 0.0))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,175 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * DSF text: "+<id> <header>" lines name a sensor's columns, ".<id> v, v, ..."
+ * lines carry its reports.  Anything else the firmware printed (resets,
+ * shell output) is skipped.
+ */
+
+#include "logparse_impl.h"
+
+#include <charconv>
+#include <cstring>
+
+namespace logparse {
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static const uint8_t *lineEnd(const uint8_t *p, const uint8_t *end)
+{
+    const void *nl = memchr(p, '\n', end - p);
+    return nl ? static_cast<const uint8_t *>(nl) : end;
+}
+
+static bool parseId(const uint8_t *&p, const uint8_t *end, unsigned &id)
+{
+    auto r = std::from_chars(reinterpret_cast<const char *>(p),
+                             reinterpret_cast<const char *>(end), id);
+    if (r.ec != std::errc() || (r.ptr == reinterpret_cast<const char *>(end)) || (*r.ptr != ' ')) {
+        return false;
+    }
+    p = reinterpret_cast<const uint8_t *>(r.ptr) + 1;
+    return true;
+}
+
+// Parse "v, v, ..." up to end onto values.  Returns the count, or 0 if
+// the line is malformed (nothing is left appended then).
+static unsigned parseValues(const uint8_t *p, const uint8_t *end, std::vector<double> &values)
+{
+    size_t start = values.size();
+    const char *s = reinterpret_cast<const char *>(p);
+    const char *e = reinterpret_cast<const char *>(end);
+
+    while ((e > s) && ((e[-1] == '\r') || (e[-1] == ' '))) {
+        e--;
+    }
+    while (s < e) {
+        double v;
+        auto r = std::from_chars(s, e, v);
+        if (r.ec != std::errc()) {
+            values.resize(start);
+            return 0;
+        }
+        values.push_back(v);
+        s = r.ptr;
+        if (s == e) {
+            break;
+        }
+        if ((*s++ != ',') || (s == e)) {
+            values.resize(start);
+            return 0;
+        }
+        while ((s < e) && (*s == ' ')) {
+            s++;
+        }
+    }
+
+    return static_cast<unsigned>(values.size() - start);
+}
+
+// ------------------------------------------------------------------------
+// Internal API
+
+void dsfChunk(const uint8_t *data, size_t len, size_t begin, size_t end, ChunkResult &out)
+{
+    const uint8_t *fileEnd = data + len;
+    const uint8_t *p = data + begin;
+
+    // A line belongs to the chunk it starts in
+    if ((begin > 0) && (data[begin - 1] != '\n')) {
+        p = lineEnd(p, fileEnd);
+        if (p < fileEnd) {
+            p++;
+        }
+    }
+
+    while (p < data + end) {
+        const uint8_t *eol = lineEnd(p, fileEnd);
+        const uint8_t *s = p + 1;
+        unsigned id;
+
+        if ((*p == '.') && parseId(s, eol, id)) {
+            ChunkRows &rows = out.rows[id];
+            unsigned n = parseValues(s, eol, rows.values);
+            if ((n == 0) || ((rows.width != 0) && (n != rows.width))) {
+                // Not a report, or a different width than this sensor's first
+                rows.values.resize(rows.values.size() - n);
+                out.stats.skipped++;
+            }
+            else {
+                rows.width = n;
+            }
+        }
+        else if ((*p == '+') && parseId(s, eol, id)) {
+            const uint8_t *e = eol;
+            if ((e > s) && (e[-1] == '\r')) {
+                e--;
+            }
+            out.headers.emplace(id, std::string(s, e));
+        }
+
+        p = (eol < fileEnd) ? eol + 1 : eol;
+    }
+}
+
+// ------------------------------------------------------------------------
+// Public API
+
+std::vector<std::string> dsfColumns(const std::string &header)
+{
+    std::vector<std::string> columns;
+    size_t pos = 0;
+
+    while (pos < header.size()) {
+        size_t comma = header.find(',', pos);
+        if (comma == std::string::npos) {
+            comma = header.size();
+        }
+        std::string field = header.substr(pos, comma - pos);
+        pos = comma + 1;
+
+        size_t first = field.find_first_not_of(' ');
+        if (first == std::string::npos) {
+            continue;
+        }
+        field.erase(0, first);
+
+        // NAME[axes]{units}: a column per axis, unless there is only one
+        size_t open = field.find('[');
+        size_t close = field.find(']', open);
+        if ((open == std::string::npos) || (close == std::string::npos)) {
+            columns.push_back(field.substr(0, field.find_first_of(" {")));
+            continue;
+        }
+        std::string name = field.substr(0, open);
+        std::string axes = field.substr(open + 1, close - open - 1);
+        if (axes.size() <= 1) {
+            columns.push_back(name);
+        }
+        else {
+            for (char a : axes) {
+                columns.push_back(name + "_" + a);
+            }
+        }
+    }
+
+    return columns;
+}
+
+} // namespace logparse
@@ -0,0 +1,717 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Binary frames, as built by Hillcrest/sensor_output.c and read by
+ * tools/bin2dsf.py, whose results these match report for report.
+ *
+ * Three passes:
+ *   - find: each chunk is scanned for CRC-valid frames starting in it
+ *   - order: in file order, frames overlapping the one before (false
+ *     syncs found inside it by the next chunk) are dropped, frame seq
+ *     gaps counted, pose timestamps extended, delta frames expanded and
+ *     telemetry frames decoded to metrics
+ *   - decode: each run of frames is turned into rows per sensor
+ * and the 8-bit report sequence numbers are extended to sample ids
+ * once the rows are joined.
+ */
+
+#include "logparse_impl.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace logparse {
+
+// Frame layout, from Hillcrest/sensor_output.h
+#define SYNC0 (0xA5)                    // CRC-16
+#define SYNC0_CRC32 (0xA6)              // CRC-32
+#define SYNC1 (0x5A)
+#define DELTA_SYNC1 (0x5B)
+#define DELTA_KEY (0x80)
+#define POSE_SYNC1 (0x5C)
+#define METRICS_SYNC1 (0x5F)
+#define HDR_LEN (13)
+
+// Telemetry frame kinds, from Hillcrest/telemetry.h
+#define METRICS_VALUES (0)
+#define METRICS_NAMES (1)
+
+// Sensor ids, from sh2.h and Hillcrest/sensor_camsync.h
+#define ACCELEROMETER (0x01)
+#define GYROSCOPE_CALIBRATED (0x02)
+#define MAGNETIC_FIELD_CALIBRATED (0x03)
+#define LINEAR_ACCELERATION (0x04)
+#define ROTATION_VECTOR (0x05)
+#define GAME_ROTATION_VECTOR (0x08)
+#define GEOMAGNETIC_ROTATION_VECTOR (0x09)
+#define RAW_ACCELEROMETER (0x14)
+#define RAW_GYROSCOPE (0x15)
+#define RAW_MAGNETOMETER (0x16)
+#define GYRO_INTEGRATED_RV (0x2A)
+#define CAMSYNC (0x70)
+
+// Payload bytes of a report, the most any frame expands to
+#define PAYLOAD_MAX (255)
+
+// ------------------------------------------------------------------------
+// Private types
+
+// A valid frame, and what the order pass learned of it
+struct Frame {
+    uint64_t off;
+    uint64_t tUs;
+    uint32_t delta;                     // payload offset in deltaPayloads, delta frames
+    uint16_t len;                       // up to the CRC
+    uint8_t sync1;
+    uint8_t sensor;
+    uint8_t seq;
+};
+
+struct DeltaState {
+    bool valid = false;
+    uint8_t seq = 0;
+    int64_t tUs = 0;
+    int64_t dtUs = 0;
+    uint8_t plen = 0;
+    uint8_t payload[PAYLOAD_MAX];
+};
+
+// ------------------------------------------------------------------------
+// Private data
+
+// DSF headers of the sensors decoded to units, as printDsfHeaders() prints
+static const std::map<unsigned, std::string> knownHeaders = {
+    {ACCELEROMETER, "TIME[x]{s}, SAMPLE_ID[x]{samples}, ACCELEROMETER[xyz]{m/s^2}"},
+    {GYROSCOPE_CALIBRATED, "TIME[x]{s}, SAMPLE_ID[x]{samples}, ANG_VEL[xyz]{rad/s}"},
+    {MAGNETIC_FIELD_CALIBRATED,
+     "TIME[x]{s}, SAMPLE_ID[x]{samples}, MAG_FIELD[xyz]{uTesla}, STATUS[x]{enum}"},
+    {LINEAR_ACCELERATION, "TIME[x]{s}, SAMPLE_ID[x]{samples}, LINEAR_ACCELERATION[xyz]{m/s^2}"},
+    {ROTATION_VECTOR,
+     "TIME[x]{s}, SAMPLE_ID[x]{samples}, ANG_POS_GLOBAL[rijk]{quaternion}, ANG_POS_ACCURACY[x]{rad}"},
+    {GEOMAGNETIC_ROTATION_VECTOR,
+     "TIME[x]{s}, SAMPLE_ID[x]{samples}, ANG_POS_GLOBAL[rijk]{quaternion}, ANG_POS_ACCURACY[x]{rad}"},
+    {GAME_ROTATION_VECTOR, "TIME[x]{s}, SAMPLE_ID[x]{samples}, ANG_POS_GAME[rijk]{quaternion}"},
+    {RAW_ACCELEROMETER, "TIME[x]{s}, SAMPLE_ID[x]{samples}, RAW_ACCELEROMETER[xyz]{adc units}"},
+    {RAW_GYROSCOPE, "TIME[x]{s}, SAMPLE_ID[x]{samples}, RAW_GYROSCOPE[xyz]{adc units}"},
+    {RAW_MAGNETOMETER, "TIME[x]{s}, SAMPLE_ID[x]{samples}, RAW_MAGNETOMETER[xyz]{adc units}"},
+    {GYRO_INTEGRATED_RV,
+     "TIME[x]{s}, ANG_VEL_GYRO_RV[xyz]{rad/s}, ANG_POS_GYRO_RV[wxyz]{quaternion}"},
+    {CAMSYNC,
+     "TIME[x]{s}, SAMPLE_ID[x]{samples}, CAMERA_POSE[rijk]{quaternion}, STATUS[x]{enum}"},
+};
+
+static uint16_t crc16Table[256];
+static uint32_t crc32Table[256];
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static bool makeTables()
+{
+    for (unsigned n = 0; n < 256; n++) {
+        uint16_t c16 = n << 8;
+        uint32_t c32 = n << 24;
+        for (unsigned bit = 0; bit < 8; bit++) {
+            c16 = (c16 & 0x8000) ? ((c16 << 1) ^ 0x1021) : (c16 << 1);
+            c32 = (c32 & 0x80000000u) ? ((c32 << 1) ^ 0x04C11DB7u) : (c32 << 1);
+        }
+        crc16Table[n] = c16;
+        crc32Table[n] = c32;
+    }
+    return true;
+}
+
+static const bool tablesMade = makeTables();
+
+// CRC-16/CCITT as Hillcrest/crc16.c, CRC-32/MPEG-2 as Hillcrest/crc32.c
+static uint16_t crc16(const uint8_t *p, size_t len)
+{
+    uint16_t crc = 0xFFFF;
+    while (len--) {
+        crc = (crc << 8) ^ crc16Table[(crc >> 8) ^ *p++];
+    }
+    return crc;
+}
+
+static uint32_t crc32(const uint8_t *p, size_t len)
+{
+    uint32_t crc = 0xFFFFFFFFu;
+    while (len--) {
+        crc = (crc << 8) ^ crc32Table[(crc >> 24) ^ *p++];
+    }
+    return crc;
+}
+
+static uint16_t le16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t le32(const uint8_t *p)
+{
+    return le16(p) | (uint32_t(le16(p + 2)) << 16);
+}
+
+static uint64_t le64(const uint8_t *p)
+{
+    return le32(p) | (uint64_t(le32(p + 4)) << 32);
+}
+
+static int16_t s16(const uint8_t *p)
+{
+    return int16_t(le16(p));
+}
+
+static double q(int v, int n)
+{
+    return std::ldexp(double(v), -n);
+}
+
+// Length of the frame at pos up to its CRC, or 0 if there is none
+static unsigned checkFrame(const uint8_t *data, size_t len, size_t pos)
+{
+    const uint8_t *p = data + pos;
+    unsigned crcLen;
+    unsigned flen;
+
+    if ((p[0] != SYNC0) && (p[0] != SYNC0_CRC32)) {
+        return 0;
+    }
+    if (pos + 5 > len) {
+        return 0;
+    }
+    if (p[1] == SYNC1) {
+        flen = HDR_LEN + p[4];
+    }
+    else if ((p[1] == DELTA_SYNC1) || (p[1] == POSE_SYNC1) || (p[1] == METRICS_SYNC1)) {
+        flen = 5 + p[4];
+    }
+    else {
+        return 0;
+    }
+
+    crcLen = (p[0] == SYNC0_CRC32) ? 4 : 2;
+    if (pos + flen + crcLen > len) {
+        return 0;
+    }
+    if (crcLen == 4) {
+        return (le32(p + flen) == crc32(p + 2, flen - 2)) ? flen : 0;
+    }
+    return (le16(p + flen) == crc16(p + 2, flen - 2)) ? flen : 0;
+}
+
+static unsigned crcLen(uint8_t sync0)
+{
+    return (sync0 == SYNC0_CRC32) ? 4 : 2;
+}
+
+static uint64_t varint(const uint8_t *body, unsigned blen, unsigned &pos, bool &ok)
+{
+    uint64_t v = 0;
+    unsigned shift = 0;
+
+    for (;;) {
+        if ((pos >= blen) || (shift > 63)) {
+            ok = false;
+            return 0;
+        }
+        uint8_t b = body[pos++];
+        v |= uint64_t(b & 0x7f) << shift;
+        shift += 7;
+        if (!(b & 0x80)) {
+            return v;
+        }
+    }
+}
+
+static int64_t unzigzag(uint64_t v)
+{
+    return int64_t(v >> 1) ^ -int64_t(v & 1);
+}
+
+// Expand a delta frame into s, as DeltaDecoder.decode() in bin2dsf.py.
+// False if it can't be decoded; lost counts those waiting for a keyframe.
+static bool deltaDecode(DeltaState &s, uint8_t sensorId, uint8_t seq,
+                        const uint8_t *body, unsigned blen, uint64_t &lost)
+{
+    bool key = sensorId & DELTA_KEY;
+    bool ok = true;
+    unsigned pos = 0;
+    uint8_t p[PAYLOAD_MAX];
+    unsigned plen;
+    int64_t tUs;
+    int64_t dtUs;
+
+    sensorId &= ~DELTA_KEY;
+    if (s.valid && (uint8_t(seq - s.seq) != 1)) {
+        // Missed a frame: wait for a keyframe
+        s.valid = false;
+    }
+    if (!key && !s.valid) {
+        lost++;
+        return false;
+    }
+
+    if (key) {
+        if (blen < 1) {
+            return false;
+        }
+        plen = body[pos++];
+        tUs = int64_t(varint(body, blen, pos, ok));
+        dtUs = 0;
+    }
+    else {
+        plen = s.plen;
+        dtUs = s.dtUs + unzigzag(varint(body, blen, pos, ok));
+        tUs = s.tUs + dtUs;
+    }
+
+    unsigned hdr = (sensorId == GYRO_INTEGRATED_RV) ? 0 : 4;
+    if (hdr > plen) {
+        hdr = plen;
+    }
+    memset(p, 0, sizeof(p));
+    if (hdr) {
+        if (pos + hdr - 1 > blen) {
+            return false;
+        }
+        p[0] = sensorId;
+        memcpy(&p[1], &body[pos], hdr - 1);
+        pos += hdr - 1;
+    }
+    unsigned n = hdr;
+    for (; n + 1 < plen; n += 2) {
+        int64_t v = unzigzag(varint(body, blen, pos, ok));
+        if (!key) {
+            v += s16(&s.payload[n]);
+        }
+        p[n] = uint8_t(v);
+        p[n + 1] = uint8_t(v >> 8);
+    }
+    if (n < plen) {
+        if (pos >= blen) {
+            return false;
+        }
+        p[n] = body[pos];
+    }
+    if (!ok) {
+        return false;
+    }
+
+    s.valid = true;
+    s.seq = seq;
+    s.tUs = tUs;
+    s.dtUs = dtUs;
+    s.plen = uint8_t(plen);
+    memcpy(s.payload, p, plen);
+    return true;
+}
+
+// Add a telemetry frame's values, or names, to capture.  False if it is
+// damaged or of a kind not known.
+static bool decodeMetrics(Capture &capture, uint8_t kind, const uint8_t *body, unsigned blen)
+{
+    bool ok = true;
+    unsigned pos = 0;
+
+    if (kind == METRICS_VALUES) {
+        double t = varint(body, blen, pos, ok) / 1000000.0;
+        while (ok && (pos < blen)) {
+            unsigned key = unsigned(varint(body, blen, pos, ok));
+            uint64_t value = varint(body, blen, pos, ok);
+            if (ok) {
+                capture.metrics.push_back({t, key, value});
+            }
+        }
+        return ok;
+    }
+    if (kind == METRICS_NAMES) {
+        while (ok && (pos < blen)) {
+            unsigned key = unsigned(varint(body, blen, pos, ok));
+            if (!ok || (pos >= blen) || (pos + 1 + body[pos] > blen)) {
+                return false;
+            }
+            unsigned n = body[pos++];
+            capture.metricNames[key] = std::string(reinterpret_cast<const char *>(&body[pos]), n);
+            pos += n;
+        }
+        return ok;
+    }
+    return false;
+}
+
+// Bytes of a smallest-three quaternion of bits per component
+static unsigned quatLen(unsigned bits)
+{
+    return (2 + 3 * bits + 7) / 8;
+}
+
+// Unpack a smallest-three quaternion as quatPack_decode(), to i, j, k, real
+// at qpoint 14.
+static void unpackQuat(int16_t quat[4], const uint8_t *in, unsigned bits)
+{
+    const int32_t one = 1 << 14;
+    const int32_t half = (one * 46341 + 0x8000) >> 16;
+    const int32_t max = (1 << bits) - 1;
+    uint64_t packed = 0;
+    unsigned nbytes = quatLen(bits);
+    unsigned big;
+    unsigned shift = 2;
+    int64_t rest = int64_t(one) * one;
+
+    for (unsigned n = 0; n < nbytes; n++) {
+        packed |= uint64_t(in[n]) << (8 * n);
+    }
+    big = packed & 3;
+    for (unsigned n = 0; n < 4; n++) {
+        if (n == big) {
+            continue;
+        }
+        int32_t v = int32_t((packed >> shift) & max);
+        int32_t c = (v * 2 * half + max / 2) / max - half;
+        quat[n] = int16_t(c);
+        rest -= int64_t(c) * c;
+        shift += bits;
+    }
+    quat[big] = (rest > 0) ? int16_t(std::sqrt(double(rest)) + 0.5) : 0;
+}
+
+// Rebuild the payload of a pose frame, as unpose() in bin2dsf.py.
+// Returns its length.
+static unsigned unpose(uint8_t *p, uint8_t sensorId, const uint8_t *body, unsigned blen)
+{
+    unsigned bits = body[5] >> 2;
+    unsigned pos = 6 + quatLen(bits);
+    unsigned n = 0;
+    int16_t quat[4];
+
+    unpackQuat(quat, &body[6], bits);
+    if (sensorId != GYRO_INTEGRATED_RV) {
+        p[n++] = sensorId;
+        p[n++] = body[4];
+        p[n++] = body[5] & 0x3;
+        p[n++] = 0;
+    }
+    for (unsigned i = 0; i < 4; i++) {
+        p[n++] = uint8_t(quat[i]);
+        p[n++] = uint8_t(quat[i] >> 8);
+    }
+    memcpy(&p[n], &body[pos], blen - pos);
+    return n + blen - pos;
+}
+
+// Append the row of one report to rows, its 8-bit report sequence
+// standing in for the sample id.  False if the payload is too short.
+static bool decodeRow(ChunkResult &out, unsigned id, uint64_t tUs,
+                      const uint8_t *p, unsigned plen)
+{
+    ChunkRows &rows = out.rows[id];
+    std::vector<double> &v = rows.values;
+    size_t start = v.size();
+    double t = tUs / 1000000.0;
+
+    if (rows.width == 0) {
+        auto known = knownHeaders.find(id);
+        if (known != knownHeaders.end()) {
+            out.headers.emplace(id, known->second);
+        }
+        else {
+            // Keep the fields of sensors DSF has no format for raw
+            std::string fields = "TIME[x]{s}, SAMPLE_ID[x]{samples}";
+            if (plen >= 6) {
+                static const char axes[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+                unsigned n = (plen - 4) / 2;
+                fields += ", F[" + std::string(axes, std::min<size_t>(n, sizeof(axes) - 1)) + "]{raw}";
+            }
+            out.headers.emplace(id, fields);
+        }
+    }
+
+    switch (id) {
+        case GYRO_INTEGRATED_RV:
+            // No report header on the GIRV channel
+            if (plen < 14) {
+                return false;
+            }
+            v.insert(v.end(), {t, q(s16(p + 8), 10), q(s16(p + 10), 10), q(s16(p + 12), 10),
+                               q(s16(p + 6), 14), q(s16(p + 0), 14), q(s16(p + 2), 14),
+                               q(s16(p + 4), 14)});
+            break;
+        case RAW_ACCELEROMETER:
+        case RAW_GYROSCOPE:
+        case RAW_MAGNETOMETER:
+            if (plen < 10) {
+                return false;
+            }
+            v.insert(v.end(), {t, double(p[1]), double(s16(p + 4)), double(s16(p + 6)),
+                               double(s16(p + 8))});
+            break;
+        case ACCELEROMETER:
+        case LINEAR_ACCELERATION:
+        case GYROSCOPE_CALIBRATED:
+        case MAGNETIC_FIELD_CALIBRATED: {
+            int qp = (id == GYROSCOPE_CALIBRATED) ? 9 : (id == MAGNETIC_FIELD_CALIBRATED) ? 4 : 8;
+            if (plen < 10) {
+                return false;
+            }
+            v.insert(v.end(), {t, double(p[1]), q(s16(p + 4), qp), q(s16(p + 6), qp),
+                               q(s16(p + 8), qp)});
+            if (id == MAGNETIC_FIELD_CALIBRATED) {
+                v.push_back(p[2] & 0x3);
+            }
+            break;
+        }
+        case ROTATION_VECTOR:
+        case GEOMAGNETIC_ROTATION_VECTOR:
+            if (plen < 14) {
+                return false;
+            }
+            v.insert(v.end(), {t, double(p[1]), q(s16(p + 10), 14), q(s16(p + 4), 14),
+                               q(s16(p + 6), 14), q(s16(p + 8), 14), q(s16(p + 12), 12)});
+            break;
+        case GAME_ROTATION_VECTOR:
+            if (plen < 12) {
+                return false;
+            }
+            v.insert(v.end(), {t, double(p[1]), q(s16(p + 10), 14), q(s16(p + 4), 14),
+                               q(s16(p + 6), 14), q(s16(p + 8), 14)});
+            break;
+        case CAMSYNC:
+            if (plen < 12) {
+                return false;
+            }
+            v.insert(v.end(), {t, double(p[1]), q(s16(p + 10), 14), q(s16(p + 4), 14),
+                               q(s16(p + 6), 14), q(s16(p + 8), 14), double(p[2])});
+            break;
+        default:
+            if (plen < 4) {
+                return false;
+            }
+            v.insert(v.end(), {t, double(p[1])});
+            for (unsigned n = 4; n + 1 < plen; n += 2) {
+                v.push_back(s16(p + n));
+            }
+            break;
+    }
+
+    unsigned width = unsigned(v.size() - start);
+    if ((rows.width != 0) && (width != rows.width)) {
+        v.resize(start);
+        return false;
+    }
+    rows.width = width;
+    return true;
+}
+
+// Find the valid frames starting in data[begin, end)
+static void findFrames(const uint8_t *data, size_t len, size_t begin, size_t end,
+                       std::vector<Frame> &frames)
+{
+    size_t pos = begin;
+
+    while (pos < end) {
+        // Most bytes are neither sync: skip them quickly
+        const uint8_t *p = data + pos;
+        const uint8_t *e = data + end;
+        while ((p < e) && (*p != SYNC0) && (*p != SYNC0_CRC32)) {
+            p++;
+        }
+        pos = p - data;
+        if (pos >= end) {
+            break;
+        }
+
+        unsigned flen = checkFrame(data, len, pos);
+        if (flen == 0) {
+            // Not a frame (or a damaged one), resync one byte further on
+            pos++;
+            continue;
+        }
+
+        Frame f = {};
+        f.off = pos;
+        f.len = uint16_t(flen);
+        f.sync1 = p[1];
+        f.sensor = p[2];
+        f.seq = p[3];
+        frames.push_back(f);
+        pos += flen + crcLen(p[0]);
+    }
+}
+
+// Extend each sensor's 8-bit report sequence, in SAMPLE_ID, to a sample
+// id as printDsf() does.
+static void extendSampleIds(SensorLog &log)
+{
+    size_t width = log.columns.size();
+    if ((width < 2) || (log.columns[1] != "SAMPLE_ID")) {
+        return;
+    }
+
+    uint64_t last = 0;
+    for (size_t n = 1; n < log.values.size(); n += width) {
+        unsigned seq = unsigned(log.values[n]);
+        last += uint8_t(seq - (last & 0xFF));
+        log.values[n] = double(last);
+    }
+}
+
+// ------------------------------------------------------------------------
+// Internal API
+
+bool looksBinary(const uint8_t *data, size_t len, size_t limit)
+{
+    bool lineStart = true;
+
+    (void)tablesMade;
+    for (size_t pos = 0; (pos < len) && (pos < limit); pos++) {
+        uint8_t c = data[pos];
+        if (lineStart && ((c == '.') || (c == '+')) && (pos + 1 < len) &&
+            (data[pos + 1] >= '0') && (data[pos + 1] <= '9')) {
+            return false;
+        }
+        if (checkFrame(data, len, pos) != 0) {
+            return true;
+        }
+        lineStart = (c == '\n');
+    }
+    return false;
+}
+
+void parseFrames(const uint8_t *data, size_t len, const Options &opt, Capture &capture)
+{
+    size_t nChunks = (len + opt.chunkBytes - 1) / opt.chunkBytes;
+    std::vector<std::vector<Frame>> found(nChunks);
+
+    forEachChunk(nChunks, opt.threads, [&](size_t n) {
+        size_t begin = n * opt.chunkBytes;
+        size_t end = std::min(len, begin + opt.chunkBytes);
+        findFrames(data, len, begin, end, found[n]);
+    });
+
+    // Order: serial, but only frame headers and delta bodies are touched
+    std::vector<Frame> frames;
+    std::vector<uint8_t> deltaPayloads;
+    std::vector<DeltaState> delta(128);
+    int lastSeq[258];                   // per delta sensor, other data, telemetry
+    uint64_t lastEnd = 0;
+    uint64_t lastTUs = 0;
+    uint64_t skipped = 0;
+
+    for (int &s : lastSeq) {
+        s = -1;
+    }
+    for (std::vector<Frame> &chunk : found) {
+        for (Frame &f : chunk) {
+            const uint8_t *body = data + f.off + 5;
+            unsigned blen = data[f.off + 4];
+
+            if (f.off < lastEnd) {
+                continue;
+            }
+            lastEnd = f.off + f.len + crcLen(data[f.off]);
+
+            unsigned stream = (f.sync1 == DELTA_SYNC1) ? (f.sensor & ~DELTA_KEY) :
+                              (f.sync1 == METRICS_SYNC1) ? 257 : 256;
+            if (lastSeq[stream] >= 0) {
+                capture.stats.missing += uint8_t(f.seq - lastSeq[stream] - 1);
+            }
+            lastSeq[stream] = f.seq;
+
+            if (f.sync1 == METRICS_SYNC1) {
+                // Few and small: decoded here, not as rows
+                if (!decodeMetrics(capture, f.sensor, body, blen)) {
+                    skipped++;
+                }
+                continue;
+            }
+            if (f.sync1 == SYNC1) {
+                f.tUs = le64(body);
+            }
+            else if (f.sync1 == POSE_SYNC1) {
+                unsigned bits;
+                if ((blen < 6) || ((bits = body[5] >> 2) < 1) ||
+                    (bits > 15) || (6 + quatLen(bits) > blen)) {
+                    skipped++;
+                    continue;
+                }
+                f.tUs = lastTUs + uint32_t(le32(body) - uint32_t(lastTUs));
+            }
+            else {
+                DeltaState &s = delta[f.sensor & ~DELTA_KEY];
+                if (!deltaDecode(s, f.sensor, f.seq, body, blen, capture.stats.deltaLost)) {
+                    continue;
+                }
+                f.sensor &= ~DELTA_KEY;
+                f.tUs = s.tUs;
+                f.delta = uint32_t(deltaPayloads.size());
+                deltaPayloads.push_back(s.plen);
+                deltaPayloads.insert(deltaPayloads.end(), s.payload, s.payload + s.plen);
+            }
+
+            lastTUs = f.tUs;
+            frames.push_back(f);
+        }
+        std::vector<Frame>().swap(chunk);
+    }
+
+    // Decode, a run of frames at a time
+    const size_t run = 65536;
+    size_t nRuns = (frames.size() + run - 1) / run;
+    std::vector<ChunkResult> results(nRuns);
+
+    forEachChunk(nRuns, opt.threads, [&](size_t n) {
+        ChunkResult &out = results[n];
+        size_t end = std::min(frames.size(), (n + 1) * run);
+        uint8_t buf[PAYLOAD_MAX + 8];
+
+        for (size_t i = n * run; i < end; i++) {
+            const Frame &f = frames[i];
+            const uint8_t *body = data + f.off + 5;
+            unsigned blen = data[f.off + 4];
+            const uint8_t *p;
+            unsigned plen;
+
+            if (f.sync1 == SYNC1) {
+                p = body + 8;
+                plen = blen;
+            }
+            else if (f.sync1 == POSE_SYNC1) {
+                plen = unpose(buf, f.sensor, body, blen);
+                p = buf;
+            }
+            else {
+                plen = deltaPayloads[f.delta];
+                p = &deltaPayloads[f.delta + 1];
+            }
+
+            if (!decodeRow(out, f.sensor, f.tUs, p, plen)) {
+                out.stats.skipped++;
+            }
+        }
+    });
+
+    mergeChunks(results, capture);
+    capture.stats.skipped += skipped;
+    for (auto &s : capture.sensors) {
+        extendSampleIds(s.second);
+    }
+}
+
+} // namespace logparse
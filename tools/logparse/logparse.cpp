@@ -0,0 +1,348 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Capture parser: file mapping, worker threads, and columnar output.
+ */
+
+#include "logparse_impl.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace logparse {
+
+// Bytes looked at to tell DSF from binary
+#define DETECT_LEN (65536)
+
+// First per-sensor metric key, TELEM_KEY_SENSOR in Hillcrest/telemetry.h
+#define METRIC_KEY_SENSOR (0x100)
+
+// ------------------------------------------------------------------------
+// Private types
+
+// A read-only mapping of a whole file
+class MappedFile {
+public:
+    explicit MappedFile(const std::string &path)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        struct stat st;
+
+        if (fd < 0) {
+            throw std::runtime_error(path + ": " + strerror(errno));
+        }
+        if (fstat(fd, &st) != 0) {
+            int err = errno;
+            close(fd);
+            throw std::runtime_error(path + ": " + strerror(err));
+        }
+        len_ = size_t(st.st_size);
+        if (len_ > 0) {
+            void *p = mmap(nullptr, len_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                int err = errno;
+                close(fd);
+                throw std::runtime_error(path + ": " + strerror(err));
+            }
+            data_ = static_cast<const uint8_t *>(p);
+            // Each chunk is read front to back, once
+            madvise(p, len_, MADV_SEQUENTIAL);
+        }
+        close(fd);
+    }
+
+    ~MappedFile()
+    {
+        if (data_ != nullptr) {
+            munmap(const_cast<uint8_t *>(data_), len_);
+        }
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const uint8_t *data() const { return data_; }
+    size_t size() const { return len_; }
+
+private:
+    const uint8_t *data_ = nullptr;
+    size_t len_ = 0;
+};
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static std::string sensorPath(const std::string &dir, unsigned id, const char *ext)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/sensor_%u.%s", id, ext);
+    return dir + name;
+}
+
+static FILE *openOut(const std::string &path)
+{
+    FILE *f = fopen(path.c_str(), "wb");
+    if (f == nullptr) {
+        throw std::runtime_error(path + ": " + strerror(errno));
+    }
+    return f;
+}
+
+static void closeOut(FILE *f, const std::string &path)
+{
+    bool failed = ferror(f);
+    if ((fclose(f) != 0) || failed) {
+        throw std::runtime_error(path + ": write failed");
+    }
+}
+
+// metrics.csv: time, key, name, value per metric sample
+static void writeMetrics(const Capture &capture, const std::string &dir)
+{
+    if (capture.metrics.empty()) {
+        return;
+    }
+
+    std::map<unsigned, std::string> names;
+    std::string path = dir + "/metrics.csv";
+    FILE *f = openOut(path);
+
+    fprintf(f, "time,key,name,value\n");
+    for (const Metric &m : capture.metrics) {
+        auto name = names.find(m.key);
+        if (name == names.end()) {
+            name = names.emplace(m.key, metricName(capture, m.key)).first;
+        }
+        fprintf(f, "%.6f,%u,%s,%llu\n", m.time, m.key, name->second.c_str(),
+                (unsigned long long)m.value);
+    }
+    closeOut(f, path);
+}
+
+static void parseDsf(const uint8_t *data, size_t len, const Options &opt, Capture &capture)
+{
+    size_t nChunks = (len + opt.chunkBytes - 1) / opt.chunkBytes;
+    std::vector<ChunkResult> results(nChunks);
+
+    forEachChunk(nChunks, opt.threads, [&](size_t n) {
+        size_t begin = n * opt.chunkBytes;
+        dsfChunk(data, len, begin, std::min(len, begin + opt.chunkBytes), results[n]);
+    });
+
+    mergeChunks(results, capture);
+}
+
+// ------------------------------------------------------------------------
+// Internal API
+
+void forEachChunk(size_t n, unsigned threads, const std::function<void(size_t)> &fn)
+{
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> workers;
+
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = unsigned(std::min<size_t>(threads, n));
+
+    auto work = [&]() {
+        for (size_t i = next++; i < n; i = next++) {
+            fn(i);
+        }
+    };
+    for (unsigned t = 1; t < threads; t++) {
+        workers.emplace_back(work);
+    }
+    work();
+    for (std::thread &w : workers) {
+        w.join();
+    }
+}
+
+void mergeChunks(std::vector<ChunkResult> &results, Capture &capture)
+{
+    std::map<unsigned, std::string> headers;
+    std::map<unsigned, size_t> sizes;
+
+    for (ChunkResult &r : results) {
+        headers.insert(r.headers.begin(), r.headers.end());
+        for (auto &rows : r.rows) {
+            sizes[rows.first] += rows.second.values.size();
+        }
+        capture.stats.skipped += r.stats.skipped;
+    }
+
+    for (ChunkResult &r : results) {
+        for (auto &rows : r.rows) {
+            ChunkRows &chunk = rows.second;
+            if (chunk.width == 0) {
+                continue;
+            }
+
+            SensorLog &log = capture.sensors[rows.first];
+            if (log.columns.empty()) {
+                log.id = rows.first;
+                log.header = headers[log.id];
+                log.columns = dsfColumns(log.header);
+                if (log.columns.size() != chunk.width) {
+                    log.columns.clear();
+                    for (unsigned c = 0; c < chunk.width; c++) {
+                        log.columns.push_back("C" + std::to_string(c));
+                    }
+                }
+                log.values.reserve(sizes[log.id]);
+            }
+
+            if (chunk.width != log.columns.size()) {
+                capture.stats.skipped += chunk.values.size() / chunk.width;
+            }
+            else {
+                log.values.insert(log.values.end(), chunk.values.begin(), chunk.values.end());
+                capture.stats.reports += chunk.values.size() / chunk.width;
+            }
+            std::vector<double>().swap(chunk.values);
+        }
+    }
+}
+
+// ------------------------------------------------------------------------
+// Public API
+
+Capture parse(const uint8_t *data, size_t len, const Options &opt)
+{
+    Capture capture;
+    Options o = opt;
+
+    if (o.chunkBytes == 0) {
+        o.chunkBytes = Options().chunkBytes;
+    }
+    capture.format = o.format;
+    if (capture.format == Format::Auto) {
+        capture.format = looksBinary(data, len, DETECT_LEN) ? Format::Bin : Format::Dsf;
+    }
+    capture.stats.bytes = len;
+
+    if (capture.format == Format::Bin) {
+        parseFrames(data, len, o, capture);
+    }
+    else {
+        parseDsf(data, len, o, capture);
+    }
+
+    return capture;
+}
+
+Capture parseFile(const std::string &path, const Options &opt)
+{
+    MappedFile file(path);
+    return parse(file.data(), file.size(), opt);
+}
+
+std::string metricName(const Capture &capture, unsigned key)
+{
+    static const char *const sensorFields[] = {"received", "gaps", "lost", "rate_mHz"};
+    auto name = capture.metricNames.find(key);
+    std::string s;
+
+    if (name != capture.metricNames.end()) {
+        // Names are for people: make them safe as CSV fields and identifiers
+        s = name->second;
+        for (char &c : s) {
+            if (!isalnum((unsigned char)c)) {
+                c = '_';
+            }
+        }
+        return s;
+    }
+    if (key >= METRIC_KEY_SENSOR) {
+        unsigned n = key - METRIC_KEY_SENSOR;
+        return "sensor_" + std::to_string(n / 4) + "_" + sensorFields[n % 4];
+    }
+    return "key_" + std::to_string(key);
+}
+
+void writeNpy(const Capture &capture, const std::string &dir)
+{
+    for (const auto &s : capture.sensors) {
+        const SensorLog &log = s.second;
+
+        // NPY 1.0: magic, version, header length, then a dict padded
+        // with spaces and a newline to a multiple of 64 bytes
+        char dict[128];
+        int n = snprintf(dict, sizeof(dict),
+                         "{'descr': '<f8', 'fortran_order': False, 'shape': (%zu, %zu), }",
+                         log.rows(), log.columns.size());
+        std::string header(dict, n);
+        size_t total = 10 + header.size() + 1;
+        header.append((64 - total % 64) % 64, ' ');
+        header.push_back('\n');
+
+        std::string path = sensorPath(dir, log.id, "npy");
+        FILE *f = openOut(path);
+        uint8_t pre[10] = {0x93, 'N', 'U', 'M', 'P', 'Y', 1, 0,
+                           uint8_t(header.size()), uint8_t(header.size() >> 8)};
+        fwrite(pre, 1, sizeof(pre), f);
+        fwrite(header.data(), 1, header.size(), f);
+        fwrite(log.values.data(), sizeof(double), log.values.size(), f);
+        closeOut(f, path);
+
+        path = sensorPath(dir, log.id, "txt");
+        f = openOut(path);
+        for (const std::string &c : log.columns) {
+            fprintf(f, "%s\n", c.c_str());
+        }
+        closeOut(f, path);
+    }
+    writeMetrics(capture, dir);
+}
+
+void writeCsv(const Capture &capture, const std::string &dir)
+{
+    for (const auto &s : capture.sensors) {
+        const SensorLog &log = s.second;
+        size_t width = log.columns.size();
+        std::string path = sensorPath(dir, log.id, "csv");
+        FILE *f = openOut(path);
+
+        for (size_t c = 0; c < width; c++) {
+            fprintf(f, "%s%s", c ? "," : "", log.columns[c].c_str());
+        }
+        fputc('\n', f);
+        for (size_t n = 0; n < log.values.size(); n++) {
+            fprintf(f, "%s%.9g", (n % width) ? "," : "", log.values[n]);
+            if ((n % width) == width - 1) {
+                fputc('\n', f);
+            }
+        }
+        closeOut(f, path);
+    }
+    writeMetrics(capture, dir);
+}
+
+} // namespace logparse
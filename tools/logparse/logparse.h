@@ -0,0 +1,119 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host-side parser of the demo's sensor captures.
+ *
+ * Reads DSF text (printDsf() and printDsfHeaders() in
+ * Hillcrest/sensor_output.c) or the binary stream (plain, delta and pose
+ * frames, CRC-16 or CRC-32, as sensor_output.h lays them out) into one
+ * table per sensor: a row per report, a column per value, in the units
+ * and order DSF prints them.  Binary frames of sensors without a DSF
+ * format keep their 16-bit fields raw, as F0, F1, ...  Telemetry frames
+ * in a binary capture (Hillcrest/telemetry.h) become a list of metric
+ * samples beside the tables.
+ *
+ * The file is memory mapped and cut into chunks that worker threads
+ * parse at once.  DSF lines and CRC-checked frames are found and
+ * decoded per chunk; only what depends on the reports before it runs
+ * in order afterwards: delta frames, 32-bit pose timestamps, and the
+ * extension of 8-bit report sequence numbers to sample ids.
+ */
+
+#ifndef LOGPARSE_H
+#define LOGPARSE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace logparse {
+
+enum class Format {
+    Auto,       // binary if a valid frame comes before a DSF line
+    Dsf,
+    Bin,
+};
+
+struct Options {
+    Format format = Format::Auto;
+    unsigned threads = 0;               // 0: one per hardware thread
+    size_t chunkBytes = 8u << 20;
+};
+
+// One sensor's reports, row-major: columns.size() values per row.
+struct SensorLog {
+    unsigned id = 0;
+    std::string header;                 // DSF header, without "+id "
+    std::vector<std::string> columns;
+    std::vector<double> values;
+
+    size_t rows() const { return columns.empty() ? 0 : values.size() / columns.size(); }
+};
+
+struct Stats {
+    uint64_t bytes = 0;
+    uint64_t reports = 0;               // rows, all sensors
+    uint64_t skipped = 0;               // lines or frames not understood
+    uint64_t missing = 0;               // frames missing by frame seq
+    uint64_t deltaLost = 0;             // delta frames with no keyframe before
+};
+
+// One value of a telemetry frame
+struct Metric {
+    double time;                        // s, on the board's timebase
+    unsigned key;                       // TELEM_KEY_* in Hillcrest/telemetry.h
+    uint64_t value;
+};
+
+struct Capture {
+    Format format = Format::Auto;       // what was found
+    std::map<unsigned, SensorLog> sensors;
+    std::vector<Metric> metrics;        // in capture order
+    std::map<unsigned, std::string> metricNames;    // from name frames
+    Stats stats;
+};
+
+// Parse a capture file.  Throws std::runtime_error if it can't be read.
+Capture parseFile(const std::string &path, const Options &opt = Options());
+
+// Parse a capture in memory.
+Capture parse(const uint8_t *data, size_t len, const Options &opt = Options());
+
+// Column names of a DSF header: "TIME[x]{s}, ANG_POS_GLOBAL[rijk]{quaternion}"
+// gives TIME, ANG_POS_GLOBAL_r, ANG_POS_GLOBAL_i, ...
+std::vector<std::string> dsfColumns(const std::string &header);
+
+// Name of a metric key: from the capture's name frames, by formula for
+// the per-sensor keys ("sensor_5_received"), else "key_<key>".
+std::string metricName(const Capture &capture, unsigned key);
+
+// Write each sensor to dir as sensor_<id>.npy (float64, rows by
+// columns, for numpy.load()) and its column names to sensor_<id>.txt,
+// one per line.  dir must exist.  Throws std::runtime_error.
+// Metrics, if any, go to metrics.csv as with writeCsv().
+void writeNpy(const Capture &capture, const std::string &dir);
+
+// Write each sensor to dir as sensor_<id>.csv with a header row, and
+// the metrics to metrics.csv, a row per value: time, key, name, value.
+void writeCsv(const Capture &capture, const std::string &dir);
+
+} // namespace logparse
+
+#endif
@@ -0,0 +1,65 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Internals shared by the DSF and binary parsers (dsf.cpp, frames.cpp)
+ * and the driver (logparse.cpp).
+ */
+
+#ifndef LOGPARSE_IMPL_H
+#define LOGPARSE_IMPL_H
+
+#include "logparse.h"
+
+#include <functional>
+
+namespace logparse {
+
+// Rows one chunk produced for one sensor
+struct ChunkRows {
+    std::vector<double> values;
+    unsigned width = 0;                 // values per row
+};
+
+// What one worker made of one chunk
+struct ChunkResult {
+    std::map<unsigned, ChunkRows> rows;
+    std::map<unsigned, std::string> headers;    // DSF: first of each id
+    Stats stats;
+};
+
+// Run fn(0) .. fn(n-1) on up to threads workers.
+void forEachChunk(size_t n, unsigned threads, const std::function<void(size_t)> &fn);
+
+// DSF: parse the lines starting in data[begin, end) of a len byte file.
+void dsfChunk(const uint8_t *data, size_t len, size_t begin, size_t end, ChunkResult &out);
+
+// True if a valid binary frame starts in the first limit bytes before
+// any DSF line does.
+bool looksBinary(const uint8_t *data, size_t len, size_t limit);
+
+// Binary: parse the whole file, chunked across threads.
+void parseFrames(const uint8_t *data, size_t len, const Options &opt, Capture &capture);
+
+// Join the chunks' rows, in chunk order, into capture's sensor logs.
+// A sensor's columns are named from its first header, if that has as
+// many as its first chunk's rows; chunks of another width are skipped.
+void mergeChunks(std::vector<ChunkResult> &results, Capture &capture);
+
+} // namespace logparse
+
+#endif
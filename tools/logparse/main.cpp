@@ -0,0 +1,163 @@
+/*
+ * Copyright 2015-16 Hillcrest Laboratories, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License and
+ * any applicable agreements you may have with Hillcrest Laboratories, Inc.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// logparse: split a DSF or binary capture into per-sensor arrays.
+//
+//   ./logparse -o out capture.bin
+//
+// writes out/sensor_<id>.npy and out/sensor_<id>.txt (column names) for
+// each sensor, out/metrics.csv if the capture has telemetry frames, and
+// prints a summary: rows, time span and rate per sensor, and the parse
+// throughput.  Without -o only the summary is printed.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <unistd.h>
+
+#include "logparse.h"
+
+// ------------------------------------------------------------------------
+// Private utility functions
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: logparse [-f dsf|bin] [-j threads] [-c MB] [-o dir] [-t npy|csv] capture\n"
+            "  -f  capture format (default: detected)\n"
+            "  -j  worker threads (default: one per CPU)\n"
+            "  -c  chunk size in MB (default: %u)\n"
+            "  -o  write per-sensor arrays to dir\n"
+            "  -t  array format (default: npy)\n",
+            unsigned(logparse::Options().chunkBytes >> 20));
+    exit(1);
+}
+
+static void summary(const logparse::Capture &capture, double secs)
+{
+    const logparse::Stats &s = capture.stats;
+
+    printf("%s capture, %llu bytes, %llu reports\n",
+           (capture.format == logparse::Format::Bin) ? "Binary" : "DSF",
+           (unsigned long long)s.bytes, (unsigned long long)s.reports);
+    printf("  id     rows  columns      span s      rate Hz\n");
+    for (const auto &e : capture.sensors) {
+        const logparse::SensorLog &log = e.second;
+        size_t rows = log.rows();
+        size_t width = log.columns.size();
+        double span = 0.0;
+        double rate = 0.0;
+
+        if ((rows > 1) && (log.columns[0] == "TIME")) {
+            span = log.values[(rows - 1) * width] - log.values[0];
+            rate = (span > 0.0) ? (rows - 1) / span : 0.0;
+        }
+        printf("%4u %8zu %8zu %11.3f %12.1f\n", log.id, rows, width, span, rate);
+    }
+    if (!capture.metrics.empty()) {
+        printf("%zu metric values, %.3f s to %.3f s\n", capture.metrics.size(),
+               capture.metrics.front().time, capture.metrics.back().time);
+    }
+    if (s.skipped) {
+        printf("%llu lines or frames skipped\n", (unsigned long long)s.skipped);
+    }
+    if (s.missing) {
+        printf("%llu frames missing from capture\n", (unsigned long long)s.missing);
+    }
+    if (s.deltaLost) {
+        printf("%llu delta frames skipped waiting for a keyframe\n",
+               (unsigned long long)s.deltaLost);
+    }
+
+    fprintf(stderr, "Parsed in %.3f s, %.1f MB/s\n",
+            secs, (secs > 0.0) ? s.bytes / secs / 1e6 : 0.0);
+}
+
+// ------------------------------------------------------------------------
+// Main
+
+int main(int argc, char *argv[])
+{
+    logparse::Options opt;
+    const char *outDir = nullptr;
+    bool csv = false;
+    int c;
+
+    while ((c = getopt(argc, argv, "f:j:c:o:t:h")) != -1) {
+        switch (c) {
+            case 'f':
+                if (strcmp(optarg, "dsf") == 0) {
+                    opt.format = logparse::Format::Dsf;
+                }
+                else if (strcmp(optarg, "bin") == 0) {
+                    opt.format = logparse::Format::Bin;
+                }
+                else {
+                    usage();
+                }
+                break;
+            case 'j':
+                opt.threads = unsigned(atoi(optarg));
+                break;
+            case 'c':
+                opt.chunkBytes = size_t(atoi(optarg)) << 20;
+                break;
+            case 'o':
+                outDir = optarg;
+                break;
+            case 't':
+                if (strcmp(optarg, "csv") == 0) {
+                    csv = true;
+                }
+                else if (strcmp(optarg, "npy") != 0) {
+                    usage();
+                }
+                break;
+            default:
+                usage();
+        }
+    }
+    if (optind != argc - 1) {
+        usage();
+    }
+
+    try {
+        auto start = std::chrono::steady_clock::now();
+        logparse::Capture capture = logparse::parseFile(argv[optind], opt);
+        std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start;
+
+        if (outDir != nullptr) {
+            std::filesystem::create_directories(outDir);
+            if (csv) {
+                logparse::writeCsv(capture, outDir);
+            }
+            else {
+                logparse::writeNpy(capture, outDir);
+            }
+        }
+        summary(capture, secs.count());
+    }
+    catch (const std::exception &e) {
+        fprintf(stderr, "logparse: %s\n", e.what());
+        return 1;
+    }
+
+    return 0;
+}
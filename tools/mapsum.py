@@ -0,0 +1,140 @@
+#!/usr/bin/env python3
+#
+# Copyright 2015-16 Hillcrest Laboratories, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License and
+# any applicable agreements you may have with Hillcrest Laboratories, Inc.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+"""
+Summarize flash and RAM use per pipeline stage from an IAR linker map.
+
+Usage: mapsum.py sh2-demo.map [-m]
+
+Reads the MODULE SUMMARY of the map (EWARM/<config>/List/sh2-demo.map)
+and groups modules into the stages below.  -m also lists each module.
+Static RAM is rw data; the FreeRTOS heap shows up under rtos (heap_4),
+task stacks under the module that defines them.  The "mem" console
+command shows how much of each stack and of the heap is used.
+"""
+
+import re
+import sys
+
+# (stage, module name prefixes), first match wins
+STAGES = [
+    ('hal', ('sh2_hal_', 'spi_bus', 'spi_nor', 'exti', 'timebase', 'clock', 'power')),
+    ('diag', ('latency', 'sysstats', 'trace', 'coredump', 'boot_prof',
+              'art_bench', 'microbench', 'shtp_capture', 'dbg')),
+    ('sh2', ('sh2', 'shtp', 'dfu')),
+    ('firmware', ('firmware',)),
+    ('app', ('sensor_', 'fixfmt', 'flash_log', 'hub_', 'girv_', 'frs_cache', 'pool',
+             'quat')),
+    ('console', ('console', 'usb_cdc', 'shell', 'dlog', 'itm', 'crc16')),
+    ('rtos', ('tasks', 'queue', 'list', 'port', 'heap_', 'cmsis_os',
+              'timers', 'croutine', 'event_groups', 'rtos_static')),
+    ('st hal', ('stm32f4xx', 'system_stm32')),
+    ('dsp', ('arm_',)),
+    ('startup', ('main', 'startup_', 'freertos')),
+]
+
+COLUMNS = ('ro code', 'ro data', 'rw data')
+
+
+def stage_of(module):
+    name = module.lower()
+    for stage, prefixes in STAGES:
+        if name.startswith(prefixes):
+            return stage
+    return 'libs'
+
+
+def parse_int(text):
+    # IAR groups thousands with a space: "2 100"
+    digits = text.replace(' ', '').replace("'", '')
+    return int(digits) if digits.isdigit() else 0
+
+
+def modules(lines):
+    """Yield (module, ro code, ro data, rw data) from the MODULE SUMMARY."""
+    in_summary = False
+    ends = None
+    for line in lines:
+        if '*** MODULE SUMMARY' in line:
+            in_summary = True
+            continue
+        if not in_summary:
+            continue
+        if line.startswith('***') and ends is not None:
+            return
+        if all(c in line for c in COLUMNS):
+            # Columns are right-aligned under their titles
+            ends = [line.index(c) + len(c) for c in COLUMNS]
+            continue
+        if ends is None:
+            continue
+        m = re.match(r'\s+(\S+\.o)\s', line)
+        if not m:
+            continue
+        # Empty columns are blank, so place each number by where it ends
+        values = [0, 0, 0]
+        for num in re.finditer(r"\d{1,3}(?:[ ']\d{3})*", line[m.end():]):
+            end = m.end() + num.end()
+            col = min(range(len(ends)), key=lambda c: abs(ends[c] - end))
+            values[col] = parse_int(num.group(0))
+        yield (m.group(1)[:-2],) + tuple(values)
+
+
+def main(argv):
+    args = [a for a in argv[1:] if not a.startswith('-')]
+    if not args:
+        sys.stderr.write(__doc__)
+        return 1
+    verbose = '-m' in argv
+
+    with open(args[0], errors='replace') as f:
+        lines = f.read().splitlines()
+
+    totals = {}
+    rows = []
+    for name, code, rodata, rwdata in modules(lines):
+        t = totals.setdefault(stage_of(name), [0, 0, 0])
+        t[0] += code
+        t[1] += rodata
+        t[2] += rwdata
+        rows.append((stage_of(name), name, code, rodata, rwdata))
+
+    if not rows:
+        sys.stderr.write("No MODULE SUMMARY in %s\n" % args[0])
+        return 1
+
+    print("%-10s %9s %9s %9s" % ('stage', 'flash', '(const)', 'ram'))
+    for stage in sorted(totals, key=lambda s: -totals[s][2]):
+        code, rodata, rwdata = totals[stage]
+        print("%-10s %9d %9d %9d" % (stage, code + rodata, rodata, rwdata))
+    print("%-10s %9d %9d %9d" % (
+        'total',
+        sum(t[0] + t[1] for t in totals.values()),
+        sum(t[1] for t in totals.values()),
+        sum(t[2] for t in totals.values())))
+
+    if verbose:
+        print()
+        for stage, name, code, rodata, rwdata in sorted(rows, key=lambda r: (r[0], -r[4])):
+            print("%-10s %-24s %9d %9d %9d" % (stage, name, code + rodata, rodata, rwdata))
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,166 @@
+#!/usr/bin/env python3
+#
+# Copyright 2015-16 Hillcrest Laboratories, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License and
+# any applicable agreements you may have with Hillcrest Laboratories, Inc.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+"""
+Compare the PERF results in a console capture against a stored baseline.
+
+Usage: perfcheck.py console.log baseline.json
+       perfcheck.py --save console.log baseline.json
+
+The capture holds the output of "perf" and, from the sh2-demo-bench
+build, of "bench" (see Hillcrest/perf_suite.h).  Where a suite was run
+more than once, its last run counts.  Exits 1 if any baseline metric got
+worse by more than its tolerance, or is missing.
+
+--save writes the results as the new baseline, keeping any tolerances
+already in the file.  A baseline looks like:
+
+  {
+    "mhz": 84,
+    "metrics": {"decode.fix_cycles": 212, ...},
+    "tolerance": {"lat.consume.p99_us": {"pct": 20, "abs": 100}}
+  }
+
+Metrics without a tolerance get the default for their unit suffix.
+"""
+
+import json
+import os
+import sys
+
+# Unit suffix: (higher is worse, tolerance [%], slack [units])
+DEFAULT_BANDS = {
+    'cycles': (True, 10, 20),
+    'us': (True, 10, 50),
+    'per_s': (False, 5, 0),
+    'count': (True, 0, 0),
+    'permille': (True, 0, 20),
+}
+
+
+def parse(path):
+    """Return ({metric: value}, core MHz) from the PERF blocks in a capture."""
+    suites = {}
+    mhz = None
+    suite = None
+    with open(path, 'r', errors='replace') as f:
+        for line in f:
+            # Console text and BIN_OUTPUT frames may share the capture
+            pos = line.find('PERF ')
+            if pos < 0:
+                continue
+            words = line[pos:].split()
+            if len(words) >= 4 and words[1] == 'begin':
+                suite = {}
+                suites[words[2]] = suite
+                mhz = int(words[3])
+            elif len(words) == 2 and words[1] == 'end':
+                suite = None
+            elif len(words) == 3 and suite is not None:
+                try:
+                    suite[words[1]] = int(words[2])
+                except ValueError:
+                    pass
+    metrics = {}
+    for s in suites.values():
+        metrics.update(s)
+    return metrics, mhz
+
+
+def band(name, tolerance):
+    unit = name.rsplit('_', 1)[-1]
+    if name.endswith('_per_s'):
+        unit = 'per_s'
+    higher_worse, pct, slack = DEFAULT_BANDS.get(unit, (True, 10, 0))
+    t = tolerance.get(name, {})
+    return higher_worse, t.get('pct', pct), t.get('abs', slack)
+
+
+def check(metrics, mhz, baseline):
+    tolerance = baseline.get('tolerance', {})
+    failed = 0
+
+    if mhz is not None and baseline.get('mhz') not in (None, mhz):
+        print('note: baseline at %s MHz, results at %d MHz' % (baseline['mhz'], mhz))
+
+    print('%-36s %10s %10s %8s' % ('metric', 'baseline', 'now', 'change'))
+    for name, base in sorted(baseline.get('metrics', {}).items()):
+        if name not in metrics:
+            print('%-36s %10d %10s %8s  MISSING' % (name, base, '-', ''))
+            failed += 1
+            continue
+        now = metrics[name]
+        higher_worse, pct, slack = band(name, tolerance)
+        allowed = base * pct / 100.0 + slack
+        delta = now - base if higher_worse else base - now
+        change = '%+.1f%%' % (100.0 * (now - base) / base) if base else ''
+        verdict = ''
+        if delta > allowed:
+            verdict = 'WORSE'
+            failed += 1
+        elif -delta > allowed:
+            verdict = 'better'
+        print('%-36s %10d %10d %8s  %s' % (name, base, now, change, verdict))
+
+    for name in sorted(set(metrics) - set(baseline.get('metrics', {}))):
+        print('%-36s %10s %10d %8s  new' % (name, '-', metrics[name], ''))
+
+    return failed
+
+
+def main(argv):
+    save = '--save' in argv
+    args = [a for a in argv[1:] if a != '--save']
+    if len(args) != 2:
+        sys.stderr.write(__doc__)
+        return 2
+
+    metrics, mhz = parse(args[0])
+    if not metrics:
+        sys.stderr.write('No PERF results in %s\n' % args[0])
+        return 2
+
+    baseline = {}
+    if os.path.exists(args[1]):
+        with open(args[1]) as f:
+            baseline = json.load(f)
+
+    if save:
+        baseline['mhz'] = mhz
+        baseline['metrics'] = metrics
+        baseline.setdefault('tolerance', {})
+        with open(args[1], 'w') as f:
+            json.dump(baseline, f, indent=2, sort_keys=True)
+            f.write('\n')
+        print('Saved %d metrics to %s' % (len(metrics), args[1]))
+        return 0
+
+    if not baseline:
+        sys.stderr.write('No baseline %s: record one with --save\n' % args[1])
+        return 2
+
+    failed = check(metrics, mhz, baseline)
+    if failed:
+        print('%d metric(s) regressed' % failed)
+        return 1
+    print('No regressions')
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,239 @@
+#!/usr/bin/env python3
+#
+# Copyright 2015-16 Hillcrest Laboratories, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License and
+# any applicable agreements you may have with Hillcrest Laboratories, Inc.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+"""
+Send binary control requests to the demo (Hillcrest/rpc.h).
+
+Usage: rpc.py [-b baud] [-c16] /dev/ttyACM0 <request> [args]
+
+Requests:
+  ping [text]
+  sub <sensor> <interval us> [<sensor> <interval us> ...]
+  profile <name>
+  stats <sensor>
+  frs get <id>
+  frs set <id> [words...]
+  flush
+  dfu                    then run fwsend.py -r to send the image
+
+Prints the answer and exits with 1 if its status isn't 0.  -c16 is for
+firmware built without BIN_CRC32.  A test rig can import this file and
+use Link, which keeps several requests in flight and skips the sensor
+output and console text sharing the link.
+"""
+
+import getopt
+import os
+import struct
+import sys
+import termios
+import time
+
+SYNC0_CRC32 = 0xA6
+SYNC0_CRC16 = 0xA5
+REQ_SYNC1 = 0x5D
+RSP_SYNC1 = 0x5E
+RSP_HDR_LEN = 5
+TIMEOUT_S = 3.0
+FLUSH_TIMEOUT_S = 10.0
+
+OP_PING = 0x01
+OP_SUBSCRIBE = 0x02
+OP_PROFILE = 0x03
+OP_STATS = 0x04
+OP_FRS_GET = 0x05
+OP_FRS_SET = 0x06
+OP_FLUSH = 0x07
+OP_DFU = 0x08
+
+STATS_FIELDS = ('interval_us', 'received', 'gaps', 'lost', 'rate_mHz',
+                'min_delta_us', 'max_delta_us', 'jitter_us')
+
+
+def crc16(data, crc=0xFFFF):
+    """CRC-16/CCITT, as computed by crc16() in Hillcrest/crc16.c."""
+    for b in data:
+        crc ^= b << 8
+        for _ in range(8):
+            if crc & 0x8000:
+                crc = ((crc << 1) ^ 0x1021) & 0xFFFF
+            else:
+                crc = (crc << 1) & 0xFFFF
+    return crc
+
+
+def crc32(data, crc=0xFFFFFFFF):
+    """CRC-32/MPEG-2, as computed by crc32() in Hillcrest/crc32.c."""
+    for b in data:
+        crc ^= b << 24
+        for _ in range(8):
+            if crc & 0x80000000:
+                crc = ((crc << 1) ^ 0x04C11DB7) & 0xFFFFFFFF
+            else:
+                crc = (crc << 1) & 0xFFFFFFFF
+    return crc
+
+
+def open_tty(path, baud):
+    fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+    attr = termios.tcgetattr(fd)
+    attr[0] = 0                                     # iflag
+    attr[1] = 0                                     # oflag
+    attr[2] = termios.CS8 | termios.CREAD | termios.CLOCAL
+    attr[3] = 0                                     # lflag
+    speed = getattr(termios, 'B%d' % baud)
+    attr[4] = attr[5] = speed
+    attr[6][termios.VMIN] = 0
+    attr[6][termios.VTIME] = 1                      # 100ms read timeout
+    termios.tcsetattr(fd, termios.TCSANOW, attr)
+    termios.tcflush(fd, termios.TCIFLUSH)
+    return fd
+
+
+class Link:
+    """Requests and answers over an open tty."""
+
+    def __init__(self, fd, use_crc32=True):
+        self.fd = fd
+        self.sync0 = SYNC0_CRC32 if use_crc32 else SYNC0_CRC16
+        self.crc_len = 4 if use_crc32 else 2
+        self.next_id = 1
+        self.answers = {}
+        self.buf = b''
+
+    def crc(self, data):
+        if self.crc_len == 4:
+            return struct.pack('<I', crc32(data))
+        return struct.pack('<H', crc16(data))
+
+    def send(self, op, payload=b''):
+        """Send a request, returning its id without waiting."""
+        req_id = self.next_id
+        self.next_id = (self.next_id % 0xFFFF) + 1
+        body = struct.pack('<HBB', req_id, op, len(payload)) + payload
+        os.write(self.fd, bytes([self.sync0, REQ_SYNC1]) + body + self.crc(body))
+        return req_id
+
+    def wait(self, req_id, timeout=TIMEOUT_S):
+        """Return (status, payload) of req_id's answer, or None."""
+        end = time.time() + timeout
+        while req_id not in self.answers and time.time() < end:
+            data = os.read(self.fd, 512)
+            if data:
+                self.buf += data
+                self.parse()
+        return self.answers.pop(req_id, None)
+
+    def request(self, op, payload=b'', timeout=TIMEOUT_S):
+        return self.wait(self.send(op, payload), timeout)
+
+    def parse(self):
+        """Take answers out of buf, skipping anything else."""
+        sync = bytes([self.sync0, RSP_SYNC1])
+        while True:
+            pos = self.buf.find(sync)
+            if pos < 0:
+                self.buf = self.buf[-1:]
+                return
+            hdr = self.buf[pos + 2:pos + 2 + RSP_HDR_LEN]
+            if len(hdr) < RSP_HDR_LEN:
+                self.buf = self.buf[pos:]
+                return
+            req_id, op, status, n = struct.unpack('<HBbB', hdr)
+            end = pos + 2 + RSP_HDR_LEN + n
+            if end + self.crc_len > len(self.buf):
+                self.buf = self.buf[pos:]
+                return
+            if self.buf[end:end + self.crc_len] != self.crc(self.buf[pos + 2:end]):
+                # Not an answer (or a damaged one), resync a byte further on
+                self.buf = self.buf[pos + 1:]
+                continue
+            self.answers[req_id] = (status, self.buf[end - n:end])
+            self.buf = self.buf[end + self.crc_len:]
+
+
+def main(argv):
+    opts, args = getopt.getopt(argv[1:], 'b:c:')
+    baud = 115200
+    use_crc32 = True
+    for o, a in opts:
+        if o == '-b':
+            baud = int(a)
+        elif o == '-c':
+            use_crc32 = (a != '16')
+    if len(args) < 2:
+        sys.stderr.write(__doc__)
+        return 2
+
+    link = Link(open_tty(args[0], baud), use_crc32)
+    cmd, params = args[1], args[2:]
+    timeout = TIMEOUT_S
+
+    if cmd == 'ping':
+        op, payload = OP_PING, ' '.join(params).encode('ascii')
+    elif cmd == 'sub' and params and len(params) % 2 == 0:
+        op = OP_SUBSCRIBE
+        payload = b''.join(struct.pack('<BI', int(params[n], 0), int(params[n + 1], 0))
+                           for n in range(0, len(params), 2))
+    elif cmd == 'profile' and len(params) == 1:
+        op, payload = OP_PROFILE, params[0].encode('ascii')
+    elif cmd == 'stats' and len(params) == 1:
+        op, payload = OP_STATS, struct.pack('<B', int(params[0], 0))
+    elif cmd == 'frs' and len(params) == 2 and params[0] == 'get':
+        op, payload = OP_FRS_GET, struct.pack('<H', int(params[1], 0))
+    elif cmd == 'frs' and len(params) >= 2 and params[0] == 'set':
+        op = OP_FRS_SET
+        payload = struct.pack('<H', int(params[1], 0))
+        payload += b''.join(struct.pack('<I', int(w, 0)) for w in params[2:])
+    elif cmd == 'flush':
+        op, payload = OP_FLUSH, b''
+        timeout = FLUSH_TIMEOUT_S
+    elif cmd == 'dfu':
+        op, payload = OP_DFU, b''
+    else:
+        sys.stderr.write(__doc__)
+        return 2
+
+    answer = link.request(op, payload, timeout)
+    if answer is None:
+        sys.stderr.write('No answer in %.0f s\n' % timeout)
+        return 1
+    status, data = answer
+
+    if status == 0 and op == OP_SUBSCRIBE:
+        print(' '.join('%d:%d' % (int(params[2 * n], 0), struct.unpack('b', data[n:n + 1])[0])
+                       for n in range(len(data))))
+    elif status == 0 and op == OP_STATS:
+        for name, v in zip(STATS_FIELDS, struct.unpack('<8I', data)):
+            print('%-14s %u' % (name, v))
+    elif status == 0 and op == OP_FRS_GET:
+        words = struct.unpack('<%dI' % (len(data) // 4), data)
+        print('frs set 0x%04x%s' % (int(params[1], 0), ''.join(' 0x%08x' % w for w in words)))
+    elif status == 0 and op == OP_FLUSH:
+        print('Flushed %u reports in %u us.' % struct.unpack('<II', data))
+    elif status == 0 and data:
+        print(data.decode('ascii', 'replace'))
+
+    if status != 0:
+        sys.stderr.write('Status %d\n' % status)
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+#
+# Copyright 2015-16 Hillcrest Laboratories, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License and
+# any applicable agreements you may have with Hillcrest Laboratories, Inc.
+# You may obtain a copy of the License at
+#
+#   http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+"""
+Extract SHTP capture records from a serial capture of the demo console.
+
+Usage: shtpcap.py serial.bin capture.shtp
+
+Frames written by the "cap" command are located by their sync bytes and
+validated by CRC, so console text and BIN_OUTPUT frames in between are
+skipped.  The output is the replay format read by tools/hostsim.
+The frame layout must match sendRecord() in Hillcrest/shtp_capture.c.
+"""
+
+import struct
+import sys
+
+from bin2dsf import crc16
+
+SYNC = b'\xa5\xc3'
+REC_HDR_LEN = 6
+CRC_LEN = 2
+MAX_TRANSFER = 0x7FFE  # largest SH2_HAL_MAX_TRANSFER of any build
+
+
+def records(data):
+    """Yield each valid record (header and transfer bytes)."""
+    pos = 0
+    while True:
+        pos = data.find(SYNC, pos)
+        if pos < 0 or pos + 2 + REC_HDR_LEN > len(data):
+            return
+        _t_us, length = struct.unpack_from('<IH', data, pos + 2)
+        end = pos + 2 + REC_HDR_LEN + length
+        if length > MAX_TRANSFER or end + CRC_LEN > len(data):
+            # Can't be a frame, or one cut off at the end of the capture
+            pos += 1
+            continue
+        crc, = struct.unpack_from('<H', data, end)
+        if crc != crc16(data[pos + 2:end]):
+            # Not a frame (or a damaged one), resync one byte further on
+            pos += 1
+            continue
+        yield data[pos + 2:end]
+        pos = end + CRC_LEN
+
+
+def main(argv):
+    if len(argv) < 3:
+        sys.stderr.write(__doc__)
+        return 1
+
+    with open(argv[1], 'rb') as f:
+        data = f.read()
+
+    count = 0
+    last_t = None
+    with open(argv[2], 'wb') as out:
+        for rec in records(data):
+            t_us, = struct.unpack_from('<I', rec, 0)
+            if last_t is not None and ((t_us - last_t) & 0xFFFFFFFF) > 0x80000000:
+                sys.stderr.write("Timestamp goes backwards after record %d\n" % count)
+            last_t = t_us
+            out.write(rec)
+            count += 1
+
+    sys.stderr.write("%d records\n" % count)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))